@@ -0,0 +1,285 @@
+/* Compiled accept/reject lists.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* The -A/-R and -I/-X lists can hold hundreds of patterns, and are
+   matched against every link of a recursive retrieval.  Instead of
+   trying each pattern in turn, the patterns without wildcards are put
+   in a trie: reversed for file names, which they have to end with,
+   and as they are for directories, which they have to be a prefix of.
+   Matching a name against all of them then takes a single walk along
+   the name.  File name patterns of the form "*SUFFIX", the most
+   common kind, are treated as the suffix.  What remains is matched
+   with fnmatch as before.
+
+   The semantics are those of in_acclist and dir_matches_p in
+   utils.c.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "c-ctype.h"
+#include "acclist.h"
+
+#ifdef TESTING
+#include "test.h"
+#endif
+
+struct trie_node {
+  int child;                    /* the first child, or -1 */
+  int sibling;                  /* the next child of the parent, or -1 */
+  unsigned char c;              /* the character leading here */
+  bool terminal;                /* whether a pattern ends here */
+};
+
+struct acclist {
+  bool dirs;                    /* a directory list */
+  bool fold_case;               /* opt.ignore_case at creation */
+
+  /* The patterns without wildcards.  Node 0 is the root.  */
+  struct trie_node *nodes;
+  int count, size;
+
+  /* The patterns with wildcards.  */
+  const char **wildcards;
+  int nwildcards;
+};
+
+/* Return the child of node N of L reached with C, creating it if
+   CREATE is true, or -1.  */
+
+static int
+trie_child (struct acclist *l, int n, unsigned char c, bool create)
+{
+  int i;
+
+  for (i = l->nodes[n].child; i != -1; i = l->nodes[i].sibling)
+    if (l->nodes[i].c == c)
+      return i;
+  if (!create)
+    return -1;
+
+  if (l->count == l->size)
+    {
+      l->size *= 2;
+      l->nodes = xrealloc (l->nodes, l->size * sizeof *l->nodes);
+    }
+  i = l->count++;
+  l->nodes[i].child = -1;
+  l->nodes[i].sibling = l->nodes[n].child;
+  l->nodes[i].c = c;
+  l->nodes[i].terminal = false;
+  l->nodes[n].child = i;
+  return i;
+}
+
+/* Add the LEN characters at S to the trie of L, backwards if BACKWARD
+   is true.  */
+
+static void
+trie_add (struct acclist *l, const char *s, int len, bool backward)
+{
+  int n = 0, i;
+
+  for (i = 0; i < len; i++)
+    {
+      unsigned char c = backward ? s[len - 1 - i] : s[i];
+      if (l->fold_case)
+        c = c_tolower (c);
+      n = trie_child (l, n, c, true);
+    }
+  l->nodes[n].terminal = true;
+}
+
+/* Return the child of node N of L reached with C, or -1.  */
+
+static inline int
+trie_next (const struct acclist *l, int n, unsigned char c)
+{
+  int i;
+
+  if (l->fold_case)
+    c = c_tolower (c);
+  for (i = l->nodes[n].child; i != -1; i = l->nodes[i].sibling)
+    if (l->nodes[i].c == c)
+      return i;
+  return -1;
+}
+
+/* Compile PATTERNS, a NULL-terminated vector, into a list matching
+   file names if DIRS is false, and directories if it is true.  The
+   patterns are not copied, and have to outlive the list.  */
+
+struct acclist *
+acclist_new (char *const *patterns, bool dirs)
+{
+  struct acclist *l = xnew0 (struct acclist);
+  int n;
+
+  for (n = 0; patterns[n]; n++)
+    ;
+  l->dirs = dirs;
+  l->fold_case = opt.ignore_case;
+  l->size = 64;
+  l->nodes = xnew_array (struct trie_node, l->size);
+  l->nodes[0].child = l->nodes[0].sibling = -1;
+  l->nodes[0].c = 0;
+  l->nodes[0].terminal = false;
+  l->count = 1;
+  l->wildcards = xnew_array (const char *, n);
+
+  for (; *patterns; patterns++)
+    {
+      const char *p = *patterns;
+      if (dirs && *p == '/')
+        ++p;
+      if (!has_wildcards_p (p))
+        trie_add (l, p, strlen (p), !dirs);
+      else if (!dirs && p[0] == '*' && !has_wildcards_p (p + 1)
+               && !strchr (p + 1, '\\'))
+        trie_add (l, p + 1, strlen (p + 1), true);
+      else
+        l->wildcards[l->nwildcards++] = p;
+    }
+  return l;
+}
+
+/* Return whether S matches a pattern of L.  */
+
+bool
+acclist_match (const struct acclist *l, const char *s)
+{
+  int (*matcher) (const char *, const char *, int)
+    = l->fold_case ? fnmatch_nocase : fnmatch;
+  int n = 0, i;
+
+  if (l->nodes[0].terminal)
+    return true;
+  if (l->dirs)
+    {
+      /* A directory matches DIR if it is DIR or in it.  */
+      for (i = 0; s[i]; i++)
+        {
+          n = trie_next (l, n, s[i]);
+          if (n == -1)
+            break;
+          if (l->nodes[n].terminal && (s[i + 1] == '\0' || s[i + 1] == '/'))
+            return true;
+        }
+    }
+  else
+    {
+      for (i = strlen (s) - 1; i >= 0; i--)
+        {
+          n = trie_next (l, n, s[i]);
+          if (n == -1)
+            break;
+          if (l->nodes[n].terminal)
+            return true;
+        }
+    }
+
+  for (i = 0; i < l->nwildcards; i++)
+    if (matcher (l->wildcards[i], s, l->dirs ? FNM_PATHNAME : 0) == 0)
+      return true;
+  return false;
+}
+
+void
+acclist_free (struct acclist *l)
+{
+  xfree (l->nodes);
+  xfree (l->wildcards);
+  xfree (l);
+}
+
+#ifdef TESTING
+
+const char *
+test_acclist (void)
+{
+  static char *files[] = {
+    "jpg", "*.gif", "index.html", "*[0-9].txt", "README", NULL
+  };
+  static char *dirs[] = {
+    "/somedir/d1", "/someotherdir", "*/*COMPLETE", "pub", NULL
+  };
+  static const struct {
+    const char *s;
+    bool dirs;
+    bool result;
+  } tests[] = {
+    { "photo.jpg", false, true },
+    { "photo.JPG", false, false },
+    { "anim.gif", false, true },
+    { "gif", false, false },
+    { "index.html", false, true },
+    { "oldindex.html", false, true },
+    { "index.htm", false, false },
+    { "notes7.txt", false, true },
+    { "notes.txt", false, false },
+    { "README", false, true },
+    { "somedir/d1", true, true },
+    { "somedir/d1/sub", true, true },
+    { "somedir/d10", true, false },
+    { "somedir", true, false },
+    { "someotherdir", true, true },
+    { "foo/!COMPLETE", true, true },
+    { "pub/gnu", true, true },
+    { "public", true, false },
+  };
+  struct acclist *fl, *dl;
+  bool saved = opt.ignore_case;
+  unsigned i;
+
+  opt.ignore_case = false;
+  fl = acclist_new (files, false);
+  dl = acclist_new (dirs, true);
+  for (i = 0; i < countof (tests); i++)
+    mu_assert ("test_acclist: wrong result",
+               acclist_match (tests[i].dirs ? dl : fl, tests[i].s)
+               == tests[i].result);
+  acclist_free (fl);
+  acclist_free (dl);
+
+  opt.ignore_case = true;
+  fl = acclist_new (files, false);
+  mu_assert ("test_acclist: case not folded",
+             acclist_match (fl, "PHOTO.JPG") && acclist_match (fl, "Readme"));
+  acclist_free (fl);
+  opt.ignore_case = saved;
+
+  return NULL;
+}
+
+#endif /* TESTING */
@@ -1,12 +1,12 @@
-/* Declarations for css.lex
-   Copyright (C) 2006, 2009, 2010, 2011 Free Software Foundation, Inc.
+/* Declarations for acclist.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
 
 This file is part of GNU Wget.
 
 GNU Wget is free software; you can redistribute it and/or modify
 it under the terms of the GNU General Public License as published by
-the Free Software Foundation; either version 3 of the License, or (at
-your option) any later version.
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
 
 GNU Wget is distributed in the hope that it will be useful,
 but WITHOUT ANY WARRANTY; without even the implied warranty of
@@ -27,40 +27,18 @@ Corresponding Source for a non-source form of such a combination
 shall include the source code for the parts of OpenSSL used as well
 as that of the covered work.  */
 
-#ifndef CSS_TOKENS_H
-#define CSS_TOKENS_H
 
-enum {
-  CSSEOF,
-  S,
-  CDO,
-  CDC,
-  INCLUDES,
-  DASHMATCH,
-  LBRACE,
-  PLUS,
-  GREATER,
-  COMMA,
-  STRING,
-  INVALID,
-  IDENT,
-  HASH,
-  IMPORT_SYM,
-  PAGE_SYM,
-  MEDIA_SYM,
-  CHARSET_SYM,
-  IMPORTANT_SYM,
-  EMS,
-  EXS,
-  LENGTH,
-  ANGLE,
-  TIME,
-  FREQ,
-  DIMENSION,
-  PERCENTAGE,
-  NUMBER,
-  URI,
-  FUNCTION
-};
+#ifndef ACCLIST_H
+#define ACCLIST_H
 
-#endif /* CSS_TOKENS_H */
+/* A list of -A/-R patterns, matched against file names, or of -I/-X
+   patterns, matched against directories, compiled for matching many
+   names against it.  */
+
+struct acclist;
+
+struct acclist *acclist_new (char *const *, bool);
+bool acclist_match (const struct acclist *, const char *);
+void acclist_free (struct acclist *);
+
+#endif /* ACCLIST_H */
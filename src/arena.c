@@ -0,0 +1,193 @@
+/* Arena allocation.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#include "wget.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "arena.h"
+
+#ifdef TESTING
+#include "test.h"
+#endif
+
+/* Size of the first chunk.  Each following one is twice as large, up
+   to ARENA_CHUNK_MAX, so that small arenas stay small and large ones
+   don't need many chunks.  */
+#define ARENA_CHUNK_MIN 4096
+#define ARENA_CHUNK_MAX (64 * 1024)
+
+/* Allocations are aligned to this many bytes, enough for any of the
+   types stored in an arena.  */
+#define ARENA_ALIGN (2 * sizeof (void *))
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  /* The memory handed out follows, suitably aligned.  */
+};
+
+#define CHUNK_HEADER \
+  ((sizeof (struct arena_chunk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct arena {
+  struct arena_chunk *chunks;	/* all chunks, the current one first */
+  char *free;			/* the free part of the current chunk */
+  char *end;
+  size_t next_size;		/* size of the next chunk */
+  size_t size;			/* the total size of the chunks */
+};
+
+struct arena *
+arena_new (void)
+{
+  struct arena *a = xnew0 (struct arena);
+  a->next_size = ARENA_CHUNK_MIN;
+  return a;
+}
+
+/* Return SIZE bytes from arena A.  */
+
+void *
+arena_alloc (struct arena *a, size_t size)
+{
+  struct arena_chunk *chunk;
+  char *p;
+
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if ((size_t) (a->end - a->free) >= size)
+    {
+      p = a->free;
+      a->free += size;
+      return p;
+    }
+
+  if (size > a->next_size / 4)
+    {
+      /* A large object gets a chunk of its own, linked behind the
+         current one so that the current one stays in use.  */
+      chunk = xmalloc (CHUNK_HEADER + size);
+      a->size += CHUNK_HEADER + size;
+      if (a->chunks)
+        {
+          chunk->next = a->chunks->next;
+          a->chunks->next = chunk;
+        }
+      else
+        {
+          chunk->next = NULL;
+          a->chunks = chunk;
+        }
+      return (char *) chunk + CHUNK_HEADER;
+    }
+
+  chunk = xmalloc (CHUNK_HEADER + a->next_size);
+  a->size += CHUNK_HEADER + a->next_size;
+  chunk->next = a->chunks;
+  a->chunks = chunk;
+  p = (char *) chunk + CHUNK_HEADER;
+  a->free = p + size;
+  a->end = p + a->next_size;
+  if (a->next_size < ARENA_CHUNK_MAX)
+    a->next_size *= 2;
+  return p;
+}
+
+void *
+arena_alloc0 (struct arena *a, size_t size)
+{
+  void *p = arena_alloc (a, size);
+  memset (p, 0, size);
+  return p;
+}
+
+char *
+arena_strdup (struct arena *a, const char *s)
+{
+  size_t len = strlen (s) + 1;
+  return memcpy (arena_alloc (a, len), s, len);
+}
+
+/* Return the number of bytes taken by arena A.  */
+
+size_t
+arena_memory (const struct arena *a)
+{
+  return sizeof *a + a->size;
+}
+
+/* Release arena A and all the memory allocated from it.  */
+
+void
+arena_free (struct arena *a)
+{
+  struct arena_chunk *chunk = a->chunks;
+  while (chunk)
+    {
+      struct arena_chunk *next = chunk->next;
+      xfree (chunk);
+      chunk = next;
+    }
+  xfree (a);
+}
+
+#ifdef TESTING
+
+const char *
+test_arena (void)
+{
+  struct arena *a = arena_new ();
+  char *big, *s;
+  int i;
+
+  for (i = 0; i < 10000; i++)
+    {
+      void *p = arena_alloc (a, 1 + i % 37);
+      mu_assert ("test_arena: misaligned allocation",
+                 ((unsigned long) p & (ARENA_ALIGN - 1)) == 0);
+      memset (p, 0xaa, 1 + i % 37);
+    }
+
+  /* A large allocation must not disturb the current chunk.  */
+  s = arena_strdup (a, "before");
+  big = arena_alloc0 (a, 100000);
+  mu_assert ("test_arena: large allocation not zeroed",
+             big[0] == 0 && big[99999] == 0);
+  mu_assert ("test_arena: string clobbered", !strcmp (s, "before"));
+  s = arena_strdup (a, "after");
+  mu_assert ("test_arena: string after large allocation",
+             !strcmp (s, "after") && (s < big || s >= big + 100000));
+
+  arena_free (a);
+  return NULL;
+}
+
+#endif /* TESTING */
@@ -46,6 +46,7 @@ as that of the covered work.  */
 #  include <netdb.h>
 # endif /* def __VMS [else] */
 # include <netinet/in.h>
+# include <netinet/tcp.h>
 # ifndef __BEOS__
 #  include <arpa/inet.h>
 # endif
@@ -54,10 +55,26 @@ as that of the covered work.  */
 #include <errno.h>
 #include <string.h>
 #include <sys/time.h>
+#ifndef WINDOWS
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SENDFILE
+# include <sys/sendfile.h>
+#endif
 #include "utils.h"
 #include "host.h"
 #include "connect.h"
 #include "hash.h"
+#include "evloop.h"
+#include "timing.h"
+#include "counters.h"
+
+#ifndef MIN
+# define MIN(i, j) ((i) <= (j) ? (i) : (j))
+#endif
+#ifndef MAX
+# define MAX(i, j) ((i) >= (j) ? (i) : (j))
+#endif
 
 /* Apparently needed for Interix: */
 #ifdef HAVE_STDINT_H
@@ -217,6 +234,7 @@ resolve_bind_address (struct sockaddr *sa)
   return true;
 }
 
+#ifdef WINDOWS
 struct cwt_context {
   int fd;
   const struct sockaddr *addr;
@@ -253,53 +271,191 @@ connect_with_timeout (int fd, const struct sockaddr *addr, socklen_t addrlen,
     errno = ETIMEDOUT;
   return ctx.result;
 }
-
-/* Connect via TCP to the specified address and port.
+#else /* not WINDOWS */
+/* Like connect, but specifies a timeout.  If connecting takes longer
+   than TIMEOUT seconds, -1 is returned and errno is set to
+   ETIMEDOUT.
 
-   If PRINT is non-NULL, it is the host name to print that we're
-   connecting to.  */
+   The socket is put in non-blocking mode for the duration of the
+   connect, and the wait for its completion is done by select_fd, so
+   that no alarm needs to be armed around it.  */
 
-int
-connect_to_ip (const ip_address *ip, int port, const char *print)
+static int
+connect_with_timeout (int fd, const struct sockaddr *addr, socklen_t addrlen,
+                      double timeout)
 {
-  struct sockaddr_storage ss;
-  struct sockaddr *sa = (struct sockaddr *)&ss;
-  int sock;
+  int flags, result, err;
+  socklen_t errlen = sizeof err;
 
-  /* If PRINT is non-NULL, print the "Connecting to..." line, with
-     PRINT being the host name we're connecting to.  */
-  if (print)
+  if (timeout == 0)
     {
-      const char *txt_addr = print_address (ip);
-      if (0 != strcmp (print, txt_addr))
-        {
-				  char *str = NULL, *name;
+      do
+        result = connect (fd, addr, addrlen);
+      while (result < 0 && errno == EINTR);
+      return result;
+    }
 
-          if (opt.enable_iri && (name = idn_decode ((char *) print)) != NULL)
+  flags = fcntl (fd, F_GETFL, 0);
+  if (flags < 0 || fcntl (fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return -1;
+
+  result = connect (fd, addr, addrlen);
+  if (result < 0 && (errno == EINPROGRESS || errno == EINTR))
+    {
+      int ready = select_fd (fd, timeout, WAIT_FOR_WRITE);
+      if (ready == 0)
+        {
+          errno = ETIMEDOUT;
+          result = -1;
+        }
+      else if (ready > 0)
+        {
+          if (getsockopt (fd, SOL_SOCKET, SO_ERROR, (void *) &err, &errlen) < 0)
+            result = -1;
+          else if (err)
             {
-              int len = strlen (print) + strlen (name) + 4;
-              str = xmalloc (len);
-              snprintf (str, len, "%s (%s)", name, print);
-              str[len-1] = '\0';
-              xfree (name);
+              errno = err;
+              result = -1;
             }
+          else
+            result = 0;
+        }
+      else
+        result = -1;
+    }
 
-          logprintf (LOG_VERBOSE, _("Connecting to %s|%s|:%d... "),
-                     str ? str : escnonprint_uri (print), txt_addr, port);
+  err = errno;
+  fcntl (fd, F_SETFL, flags);
+  errno = err;
+  return result;
+}
+#endif /* not WINDOWS */
+
+/* Print the "Connecting to..." line for connecting to IP, with PRINT
+   being the host name we're connecting to.  */
 
-					if (str)
-					  xfree (str);
+static void
+print_connecting (const ip_address *ip, int port, const char *print)
+{
+  const char *txt_addr = print_address (ip);
+  if (0 != strcmp (print, txt_addr))
+    {
+      char *str = NULL, *name;
+
+      if (opt.enable_iri && (name = idn_decode ((char *) print)) != NULL)
+        {
+          int len = strlen (print) + strlen (name) + 4;
+          str = xmalloc (len);
+          snprintf (str, len, "%s (%s)", name, print);
+          str[len-1] = '\0';
+          xfree (name);
         }
-      else
-       {
-           if (ip->family == AF_INET)
-               logprintf (LOG_VERBOSE, _("Connecting to %s:%d... "), txt_addr, port);
+
+      logprintf (LOG_VERBOSE, _("Connecting to %s|%s|:%d... "),
+                 str ? str : escnonprint_uri (print), txt_addr, port);
+
+      if (str)
+        xfree (str);
+    }
+  else
+    {
+      if (ip->family == AF_INET)
+        logprintf (LOG_VERBOSE, _("Connecting to %s:%d... "), txt_addr, port);
 #ifdef ENABLE_IPV6
-           else if (ip->family == AF_INET6)
-               logprintf (LOG_VERBOSE, _("Connecting to [%s]:%d... "), txt_addr, port);
+      else if (ip->family == AF_INET6)
+        logprintf (LOG_VERBOSE, _("Connecting to [%s]:%d... "), txt_addr, port);
 #endif
-       }
     }
+}
+
+/* Set the receive buffer of SOCK to the size requested with
+   --recv-buffer.  Without it, for very small rate limits, set the
+   buffer size (and hence, hopefully, the kernel's TCP window size) to
+   the per-second limit.  That way we should never have to sleep for
+   more than 1s between network reads.
+
+   This must be done before connecting or listening, because the TCP
+   window scale is chosen during the handshake.  */
+
+static void
+set_recv_buffer (int sock)
+{
+  int bufsize;
+
+  if (opt.recv_buffer)
+    bufsize = MIN (opt.recv_buffer, INT_MAX);
+  else if (opt.limit_rate && opt.limit_rate < 8192)
+    {
+      bufsize = opt.limit_rate;
+      if (bufsize < 512)
+        bufsize = 512;          /* avoid pathologically small values */
+    }
+  else
+    return;
+
+#ifdef SO_RCVBUF
+  if (setsockopt (sock, SOL_SOCKET, SO_RCVBUF,
+                  (void *)&bufsize, (socklen_t)sizeof (bufsize)) < 0)
+    DEBUGP (("Failed setting SO_RCVBUF to %d: %s\n", bufsize,
+             strerror (errno)));
+#endif
+  /* When we add limit_rate support for writing, which is useful
+     for POST, we should also set SO_SNDBUF here.  */
+}
+
+/* Set the TCP options requested by the user on SOCK, which is about
+   to be connected.  Failures are not fatal: the connection merely
+   goes without the option.  */
+
+static void
+set_tcp_options (int sock)
+{
+  int on = 1;
+
+  if (opt.tcp_nodelay)
+    {
+      /* Send each request as soon as it is written, rather than
+         holding its last segment back until the previous one is
+         acknowledged.  */
+#ifdef TCP_NODELAY
+      if (setsockopt (sock, IPPROTO_TCP, TCP_NODELAY,
+                      (void *)&on, (socklen_t)sizeof (on)) < 0)
+        DEBUGP (("Failed setting TCP_NODELAY: %s\n", strerror (errno)));
+#endif
+    }
+
+  if (opt.tcp_fastopen)
+    {
+      /* With TCP_FASTOPEN_CONNECT, connect returns without waiting
+         for the handshake when the host has given us a Fast Open
+         cookie before, and the first write -- the request, or the
+         TLS ClientHello -- is sent along with the SYN.  */
+#ifdef TCP_FASTOPEN_CONNECT
+      if (setsockopt (sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                      (void *)&on, (socklen_t)sizeof (on)) < 0)
+        DEBUGP (("Failed setting TCP_FASTOPEN_CONNECT: %s\n",
+                 strerror (errno)));
+#else
+      static bool warned;
+      if (!warned)
+        {
+          logputs (LOG_NOTQUIET,
+                   _("TCP Fast Open is not supported on this system.\n"));
+          warned = true;
+        }
+#endif
+    }
+}
+
+/* Create a socket for connecting to IP on PORT, with the options and
+   the local address requested by the user, and store the address to
+   connect to in SS.  Returns -1 on error, with errno set.  */
+
+static int
+make_socket (const ip_address *ip, int port, struct sockaddr_storage *ss)
+{
+  struct sockaddr *sa = (struct sockaddr *)ss;
+  int sock;
 
   /* Store the sockaddr info to SA.  */
   sockaddr_set_data (sa, ip, port);
@@ -307,7 +463,7 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   /* Create the socket of the family appropriate for the address.  */
   sock = socket (sa->sa_family, SOCK_STREAM, 0);
   if (sock < 0)
-    goto err;
+    return -1;
 
 #if defined(ENABLE_IPV6) && defined(IPV6_V6ONLY)
   if (opt.ipv6_only) {
@@ -320,22 +476,8 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   }
 #endif
 
-  /* For very small rate limits, set the buffer size (and hence,
-     hopefully, the kernel's TCP window size) to the per-second limit.
-     That way we should never have to sleep for more than 1s between
-     network reads.  */
-  if (opt.limit_rate && opt.limit_rate < 8192)
-    {
-      int bufsize = opt.limit_rate;
-      if (bufsize < 512)
-        bufsize = 512;          /* avoid pathologically small values */
-#ifdef SO_RCVBUF
-      setsockopt (sock, SOL_SOCKET, SO_RCVBUF,
-                  (void *)&bufsize, (socklen_t)sizeof (bufsize));
-#endif
-      /* When we add limit_rate support for writing, which is useful
-         for POST, we should also set SO_SNDBUF here.  */
-    }
+  set_recv_buffer (sock);
+  set_tcp_options (sock);
 
   if (opt.bind_address)
     {
@@ -346,9 +488,37 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
       if (resolve_bind_address (bind_sa))
         {
           if (bind (sock, bind_sa, sockaddr_size (bind_sa)) < 0)
-            goto err;
+            {
+              int save_errno = errno;
+              fd_close (sock);
+              errno = save_errno;
+              return -1;
+            }
         }
     }
+  return sock;
+}
+
+/* Connect via TCP to the specified address and port.
+
+   If PRINT is non-NULL, it is the host name to print that we're
+   connecting to.  */
+
+int
+connect_to_ip (const ip_address *ip, int port, const char *print)
+{
+  struct sockaddr_storage ss;
+  struct sockaddr *sa = (struct sockaddr *)&ss;
+  int sock;
+
+  /* If PRINT is non-NULL, print the "Connecting to..." line, with
+     PRINT being the host name we're connecting to.  */
+  if (print)
+    print_connecting (ip, port, print);
+
+  sock = make_socket (ip, port, &ss);
+  if (sock < 0)
+    goto err;
 
   /* Connect the socket to the remote endpoint.  */
   if (connect_with_timeout (sock, sa, sockaddr_size (sa),
@@ -376,19 +546,298 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   }
 }
 
+#if defined ENABLE_IPV6 && !defined WINDOWS
+/* Racing connections to the addresses of a dual-stack host ("Happy
+   Eyeballs", RFC 8305).  Addresses are tried alternating between the
+   families, starting with the first address of the list, which
+   --prefer-family puts first.  A new attempt is started whenever the
+   previous one fails, or when it has gone RACE_DELAY seconds without
+   connecting; the first attempt to connect wins and the others are
+   abandoned.  That way a host whose IPv6 (or IPv4) connectivity is
+   broken costs a quarter of a second rather than a connect timeout
+   per address.  */
+
+#define RACE_DELAY 0.25
+
+struct race;
+
+struct race_attempt {
+  struct race *race;
+  const ip_address *ip;
+  int sock;                     /* -1 once the attempt has ended */
+  struct evtimer *deadline;     /* --connect-timeout, or NULL */
+};
+
+struct race {
+  struct evloop *loop;
+  int port;
+  const char *print;
+  struct race_attempt *winner;
+  int pending;                  /* number of attempts in progress */
+  bool next_due;                /* whether to start the next attempt */
+  struct evtimer *stagger;      /* the timer setting NEXT_DUE */
+  int last_errno;               /* why the last attempt failed */
+};
+
+/* End attempt A, which failed with error ERR.  */
+
+static void
+race_fail (struct race_attempt *a, int err)
+{
+  struct race *r = a->race;
+  if (a->sock >= 0)
+    {
+      evloop_unwatch (r->loop, a->sock);
+      fd_close (a->sock);
+      a->sock = -1;
+      --r->pending;
+    }
+  if (a->deadline)
+    {
+      evloop_timer_cancel (r->loop, a->deadline);
+      a->deadline = NULL;
+    }
+  if (r->print)
+    {
+      print_connecting (a->ip, r->port, r->print);
+      logprintf (LOG_VERBOSE, _("failed: %s.\n"), strerror (err));
+    }
+  r->last_errno = err;
+  /* Don't wait for the stagger timer to try the next address.  */
+  r->next_due = true;
+}
+
+static void
+race_stagger (void *arg)
+{
+  struct race *r = arg;
+  r->stagger = NULL;
+  r->next_due = true;
+}
+
+static void
+race_timeout (void *arg)
+{
+  struct race_attempt *a = arg;
+  a->deadline = NULL;
+  race_fail (a, ETIMEDOUT);
+}
+
+static void
+race_ready (int fd, int events, void *arg)
+{
+  struct race_attempt *a = arg;
+  struct race *r = a->race;
+  int err = 0;
+  socklen_t errlen = sizeof err;
+
+  if (getsockopt (fd, SOL_SOCKET, SO_ERROR, (void *) &err, &errlen) < 0)
+    err = errno;
+  if (err)
+    {
+      race_fail (a, err);
+      return;
+    }
+  if (r->winner)
+    /* Another attempt has connected in the same round.  */
+    return;
+  evloop_unwatch (r->loop, fd);
+  if (a->deadline)
+    {
+      evloop_timer_cancel (r->loop, a->deadline);
+      a->deadline = NULL;
+    }
+  --r->pending;
+  r->winner = a;
+}
+
+/* Start the attempt to connect A.  */
+
+static void
+race_start (struct race_attempt *a)
+{
+  struct race *r = a->race;
+  struct sockaddr_storage ss;
+  struct sockaddr *sa = (struct sockaddr *)&ss;
+  int flags;
+
+  a->sock = make_socket (a->ip, r->port, &ss);
+  if (a->sock < 0)
+    {
+      race_fail (a, errno);
+      return;
+    }
+  ++r->pending;
+  DEBUGP (("Racing connection to %s on socket %d.\n",
+           print_address (a->ip), a->sock));
+
+  flags = fcntl (a->sock, F_GETFL, 0);
+  if (flags < 0 || fcntl (a->sock, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+      race_fail (a, errno);
+      return;
+    }
+  if (connect (a->sock, sa, sockaddr_size (sa)) == 0)
+    {
+      --r->pending;
+      r->winner = a;
+      return;
+    }
+  if (errno != EINPROGRESS && errno != EINTR)
+    {
+      race_fail (a, errno);
+      return;
+    }
+  if (!evloop_watch (r->loop, a->sock, WAIT_FOR_WRITE, race_ready, a))
+    {
+      race_fail (a, EMFILE);
+      return;
+    }
+  if (opt.connect_timeout)
+    a->deadline = evloop_timer_add (r->loop, opt.connect_timeout,
+                                    race_timeout, a);
+}
+
+/* Connect to one of the addresses of AL from START to END, racing
+   them as described above.  Returns the socket, or -1 if none could
+   be connected, with errno set.  The index of the address that was
+   connected to is stored to *INDEX.  */
+
+static int
+connect_race (struct address_list *al, int start, int end, int port,
+              const char *print, int *index)
+{
+  struct race r;
+  struct race_attempt *attempts;
+  int count = end - start, next = 0, i, j, sock = -1;
+  int first_family = address_list_address_at (al, start)->family;
+
+  xzero (r);
+  r.loop = evloop_new ();
+  r.port = port;
+  r.print = print;
+  r.last_errno = ECONNREFUSED;
+
+  /* Interleave the families: A1, B1, A2, B2, ..., followed by the
+     addresses left over when one of the families runs out.  */
+  attempts = xnew0_array (struct race_attempt, count);
+  {
+    int a = start, b = start, n = 0;
+    while (n < count)
+      {
+        while (a < end && address_list_address_at (al, a)->family != first_family)
+          ++a;
+        if (a < end)
+          attempts[n++].ip = address_list_address_at (al, a++);
+        while (b < end && address_list_address_at (al, b)->family == first_family)
+          ++b;
+        if (b < end)
+          attempts[n++].ip = address_list_address_at (al, b++);
+      }
+    for (i = 0; i < count; i++)
+      {
+        attempts[i].race = &r;
+        attempts[i].sock = -1;
+      }
+  }
+
+  while (!r.winner)
+    {
+      if (next < count && (r.pending == 0 || r.next_due))
+        {
+          r.next_due = false;
+          if (r.stagger)
+            {
+              evloop_timer_cancel (r.loop, r.stagger);
+              r.stagger = NULL;
+            }
+          race_start (&attempts[next++]);
+          if (!r.winner && r.pending && next < count)
+            r.stagger = evloop_timer_add (r.loop, RACE_DELAY,
+                                          race_stagger, &r);
+          continue;
+        }
+      if (r.pending == 0)
+        break;
+      if (evloop_run_once (r.loop, -1) < 0)
+        {
+          r.last_errno = errno;
+          break;
+        }
+    }
+
+  /* Abandon the attempts still in progress.  */
+  for (i = 0; i < next; i++)
+    {
+      struct race_attempt *a = &attempts[i];
+      if (a == r.winner || a->sock < 0)
+        continue;
+      DEBUGP (("Abandoning connection to %s.\n", print_address (a->ip)));
+      evloop_unwatch (r.loop, a->sock);
+      fd_close (a->sock);
+      if (a->deadline)
+        evloop_timer_cancel (r.loop, a->deadline);
+    }
+
+  if (r.winner)
+    {
+      int flags;
+      sock = r.winner->sock;
+      flags = fcntl (sock, F_GETFL, 0);
+      if (flags >= 0)
+        fcntl (sock, F_SETFL, flags & ~O_NONBLOCK);
+      for (j = start; j < end; j++)
+        if (address_list_address_at (al, j) == r.winner->ip)
+          *index = j;
+      if (print)
+        {
+          print_connecting (r.winner->ip, port, print);
+          logprintf (LOG_VERBOSE, _("connected.\n"));
+        }
+      DEBUGP (("Created socket %d.\n", sock));
+    }
+
+  if (r.stagger)
+    evloop_timer_cancel (r.loop, r.stagger);
+  evloop_delete (r.loop);
+  xfree (attempts);
+  if (sock < 0)
+    errno = r.last_errno;
+  return sock;
+}
+
+/* Return true if the addresses of AL from START to END belong to
+   both families, in which case they are raced.  */
+
+static bool
+mixed_families_p (const struct address_list *al, int start, int end)
+{
+  int i;
+  for (i = start + 1; i < end; i++)
+    if (address_list_address_at (al, i)->family
+        != address_list_address_at (al, start)->family)
+      return true;
+  return false;
+}
+#endif /* ENABLE_IPV6 && !WINDOWS */
+
 /* Connect via TCP to a remote host on the specified port.
 
    HOST is resolved as an Internet host name.  If HOST resolves to
    more than one IP address, they are tried in the order returned by
-   DNS until connecting to one of them succeeds.  */
+   DNS until connecting to one of them succeeds.  Addresses of both
+   IPv4 and IPv6 are raced instead; see connect_race.  */
 
 int
 connect_to_host (const char *host, int port)
 {
   int i, start, end;
   int sock;
+  struct address_list *al;
 
-  struct address_list *al = lookup_host (host, 0);
+  timing_begin (PHASE_DNS);
+  al = lookup_host (host, 0);
+  timing_end (PHASE_DNS);
 
  retry:
   if (!al)
@@ -399,7 +848,27 @@ connect_to_host (const char *host, int port)
       return E_HOST;
     }
 
+  timing_begin (PHASE_CONNECT);
   address_list_get_bounds (al, &start, &end);
+#if defined ENABLE_IPV6 && !defined WINDOWS
+  if (mixed_families_p (al, start, end))
+    {
+      sock = connect_race (al, start, end, port, host, &i);
+      if (sock >= 0)
+        {
+          /* Skip the addresses before the winner next time.  */
+          for (; start < i; start++)
+            address_list_set_faulty (al, start);
+          address_list_set_connected (al);
+          address_list_release (al);
+          timing_end (PHASE_CONNECT);
+          COUNTER_ADD (connections, 1);
+          return sock;
+        }
+      for (; start < end; start++)
+        address_list_set_faulty (al, start);
+    }
+#endif
   for (i = start; i < end; i++)
     {
       const ip_address *ip = address_list_address_at (al, i);
@@ -409,6 +878,8 @@ connect_to_host (const char *host, int port)
           /* Success. */
           address_list_set_connected (al);
           address_list_release (al);
+          timing_end (PHASE_CONNECT);
+          COUNTER_ADD (connections, 1);
           return sock;
         }
 
@@ -420,12 +891,15 @@ connect_to_host (const char *host, int port)
 
   /* Failed to connect to any of the addresses in AL. */
 
+  timing_end (PHASE_CONNECT);
   if (address_list_connected_p (al))
     {
       /* We connected to AL before, but cannot do so now.  That might
          indicate that our DNS cache entry for HOST has expired.  */
       address_list_release (al);
+      timing_begin (PHASE_DNS);
       al = lookup_host (host, LH_REFRESH);
+      timing_end (PHASE_DNS);
       goto retry;
     }
   address_list_release (al);
@@ -465,6 +939,9 @@ bind_local (const ip_address *bind_address, int *port)
 #ifdef SO_REUSEADDR
   setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, setopt_ptr, setopt_size);
 #endif
+  /* Accepted connections inherit the buffer size of the listening
+     socket.  */
+  set_recv_buffer (sock);
 
   xzero (ss);
   sockaddr_set_data (sa, bind_address, *port);
@@ -668,39 +1145,19 @@ retryable_socket_connect_error (int err)
    -1 for error.  The argument WAIT_FOR can be a combination of
    WAIT_FOR_READ and WAIT_FOR_WRITE.
 
-   This is a mere convenience wrapper around the select call, and
+   This is a mere convenience wrapper around evloop_wait_fd, and
    should be taken as such (for example, it doesn't implement Wget's
    0-timeout-means-no-timeout semantics.)  */
 
 int
 select_fd (int fd, double maxtime, int wait_for)
 {
-  fd_set fdset;
-  fd_set *rd = NULL, *wr = NULL;
-  struct timeval tmout;
-  int result;
-
-  FD_ZERO (&fdset);
-  FD_SET (fd, &fdset);
-  if (wait_for & WAIT_FOR_READ)
-    rd = &fdset;
-  if (wait_for & WAIT_FOR_WRITE)
-    wr = &fdset;
-
-  tmout.tv_sec = (long) maxtime;
-  tmout.tv_usec = 1000000 * (maxtime - (long) maxtime);
-
-  do
-  {
-    result = select (fd + 1, rd, wr, NULL, &tmout);
+  int result = evloop_wait_fd (fd, wait_for, maxtime);
 #ifdef WINDOWS
-    /* gnulib select() converts blocking sockets to nonblocking in windows.
-       wget uses blocking sockets so we must convert them back to blocking.  */
-    set_windows_fd_as_blocking_socket (fd);
+  /* gnulib select() converts blocking sockets to nonblocking in windows.
+     wget uses blocking sockets so we must convert them back to blocking.  */
+  set_windows_fd_as_blocking_socket (fd);
 #endif
-  }
-  while (result < 0 && errno == EINTR);
-
   return result;
 }
 
@@ -718,28 +1175,15 @@ select_fd (int fd, double maxtime, int wait_for)
 bool
 test_socket_open (int sock)
 {
-  fd_set check_set;
-  struct timeval to;
-  int ret = 0;
-
   /* Check if we still have a valid (non-EOF) connection.  From Andrew
    * Maholski's code in the Unix Socket FAQ.  */
+  int ret;
 
-  FD_ZERO (&check_set);
-  FD_SET (sock, &check_set);
-
-  /* Wait one microsecond */
-  to.tv_sec = 0;
-  to.tv_usec = 1;
-
-  ret = select (sock + 1, &check_set, NULL, NULL, &to);
-#ifdef WINDOWS
-/* gnulib select() converts blocking sockets to nonblocking in windows.
-wget uses blocking sockets so we must convert them back to blocking
-*/
-  set_windows_fd_as_blocking_socket ( sock );
-#endif
+  /* Data already read from the socket counts as pending.  */
+  if (fd_pending_p (sock))
+    return false;
 
+  ret = select_fd (sock, 0, WAIT_FOR_READ);
   if ( !ret )
     /* We got a timeout, it means we're still connected. */
     return true;
@@ -813,6 +1257,101 @@ struct transport_info {
   void *ctx;
 };
 
+/* Data read from a descriptor but not consumed, such as the start of
+   a response body read together with the response head.  It is kept
+   with the connection and returned by the next fd_read before
+   anything else is read from the socket.  Indexed by descriptor.  */
+
+struct readahead {
+  char *data;
+  int pos, len, size;		/* unread data is [pos, len) */
+};
+
+static struct readahead *readahead_table;
+static int readahead_count;
+
+/* Return the read-ahead data of FD, or NULL if there is none.  */
+
+static inline struct readahead *
+readahead_get (int fd)
+{
+  struct readahead *ra;
+  if (fd >= readahead_count)
+    return NULL;
+  ra = &readahead_table[fd];
+  return ra->pos < ra->len ? ra : NULL;
+}
+
+/* Copy up to BUFSIZE bytes of the read-ahead data RA to BUF, consuming
+   them if CONSUME is set.  Returns the number of bytes copied.  */
+
+static int
+readahead_take (struct readahead *ra, char *buf, int bufsize, bool consume)
+{
+  int n = MIN (bufsize, ra->len - ra->pos);
+  memcpy (buf, ra->data + ra->pos, n);
+  if (consume)
+    {
+      ra->pos += n;
+      if (ra->pos == ra->len)
+        ra->pos = ra->len = 0;
+    }
+  return n;
+}
+
+/* Give back the LEN bytes at BUF, which were read from FD but not
+   used, so that they are returned by the next fd_read or fd_peek on
+   FD, ahead of any data still unread.  */
+
+void
+fd_unread (int fd, const char *buf, int len)
+{
+  struct readahead *ra;
+
+  assert (fd >= 0);
+  if (len <= 0)
+    return;
+  if (fd >= readahead_count)
+    {
+      int old = readahead_count;
+      readahead_count = MAX (fd + 1, 2 * readahead_count);
+      readahead_table = xrealloc (readahead_table,
+                                  readahead_count * sizeof *readahead_table);
+      memset (readahead_table + old, 0,
+              (readahead_count - old) * sizeof *readahead_table);
+    }
+  ra = &readahead_table[fd];
+  if (ra->pos >= len)
+    {
+      /* Usually BUF has just been taken from here.  */
+      ra->pos -= len;
+      memcpy (ra->data + ra->pos, buf, len);
+      return;
+    }
+  if (ra->size < len + ra->len - ra->pos)
+    {
+      ra->size = len + ra->len - ra->pos;
+      ra->data = xrealloc (ra->data, ra->size);
+    }
+  memmove (ra->data + len, ra->data + ra->pos, ra->len - ra->pos);
+  memcpy (ra->data, buf, len);
+  ra->len = len + ra->len - ra->pos;
+  ra->pos = 0;
+}
+
+/* Discard the read-ahead data of FD.  */
+
+static void
+readahead_drop (int fd)
+{
+  if (fd < readahead_count)
+    {
+      struct readahead *ra = &readahead_table[fd];
+      xfree_null (ra->data);
+      xzero (*ra);
+    }
+}
+
 /* Register the transport layer operations that will be used when
    reading, writing, and polling FD.
 
@@ -835,6 +1374,15 @@ fd_register_transport (int fd, struct transport_implementation *imp, void *ctx)
   info->ctx = ctx;
   if (!transport_map)
     transport_map = hash_table_new (0, NULL, NULL);
+  else
+    {
+      /* A transport stacked on top of another one, such as HTTP/2 on
+         top of TLS, replaces it in the map; it holds on to the lower
+         transport itself.  */
+      struct transport_info *old = hash_table_get (transport_map,
+                                                   (void *)(intptr_t) fd);
+      xfree_null (old);
+    }
   hash_table_put (transport_map, (void *)(intptr_t) fd, info);
   ++transport_map_modified_tick;
 }
@@ -850,6 +1398,23 @@ fd_transport_context (int fd)
   return info->ctx;
 }
 
+/* Return the transport registered for FD and store its context to
+   *CTX, or return NULL if FD has none.  */
+
+struct transport_implementation *
+fd_transport (int fd, void **ctx)
+{
+  struct transport_info *info;
+
+  if (!transport_map)
+    return NULL;
+  info = hash_table_get (transport_map, (void *)(intptr_t) fd);
+  if (!info)
+    return NULL;
+  *ctx = info->ctx;
+  return info->imp;
+}
+
 /* When fd_read/fd_write are called multiple times in a loop, they should
    remember the INFO pointer instead of fetching it every time.  It is
    not enough to compare FD to LAST_FD because FD might have been
@@ -905,6 +1470,9 @@ int
 fd_read (int fd, char *buf, int bufsize, double timeout)
 {
   struct transport_info *info;
+  struct readahead *ra = readahead_get (fd);
+  if (ra)
+    return readahead_take (ra, buf, bufsize, true);
   LAZY_RETRIEVE_INFO (info);
   if (!poll_internal (fd, info, WAIT_FOR_READ, timeout))
     return -1;
@@ -930,6 +1498,9 @@ int
 fd_peek (int fd, char *buf, int bufsize, double timeout)
 {
   struct transport_info *info;
+  struct readahead *ra = readahead_get (fd);
+  if (ra)
+    return readahead_take (ra, buf, bufsize, false);
   LAZY_RETRIEVE_INFO (info);
   if (!poll_internal (fd, info, WAIT_FOR_READ, timeout))
     return -1;
@@ -970,6 +1541,210 @@ fd_write (int fd, char *buf, int bufsize, double timeout)
   return res;
 }
 
+#ifdef HAVE_SPLICE
+/* The pipe through which fd_splice moves data from the socket to the
+   output file.  It is created on first use and kept for the rest of
+   the run.  */
+static int splice_pipe[2] = { -1, -1 };
+
+static void
+splice_pipe_close (void)
+{
+  if (splice_pipe[0] >= 0)
+    {
+      close (splice_pipe[0]);
+      close (splice_pipe[1]);
+      splice_pipe[0] = splice_pipe[1] = -1;
+    }
+}
+
+/* Return true if data arriving on FD can be moved to a file with
+   fd_splice.  That is the case for plain sockets, but not for most
+   transports: SSL must see the bytes to decrypt them, unless the
+   kernel does it (kTLS).  */
+
+bool
+fd_splice_p (int fd)
+{
+  struct transport_info *info = NULL;
+  if (transport_map)
+    info = hash_table_get (transport_map, (void *)(intptr_t) fd);
+  if (info && !(info->imp->plaintext && info->imp->plaintext (fd, info->ctx)))
+    return false;
+  if (splice_pipe[0] < 0)
+    {
+      if (pipe (splice_pipe) < 0)
+        {
+          splice_pipe[0] = splice_pipe[1] = -1;
+          return false;
+        }
+#ifdef F_SETPIPE_SZ
+      /* A larger pipe lets a single splice call move as much as a
+         single read into the body buffer would.  Failure is
+         harmless.  */
+      fcntl (splice_pipe[1], F_SETPIPE_SZ, 1024 * 1024);
+#endif
+    }
+  return true;
+}
+
+/* Write LEN bytes of DATA to OUTFD.  */
+
+static bool
+write_fully (int outfd, const char *data, ssize_t len)
+{
+  while (len > 0)
+    {
+      ssize_t w = write (outfd, data, len);
+      if (w == -1 && errno == EINTR)
+        continue;
+      if (w <= 0)
+        {
+          if (w == 0)
+            errno = ENOSPC;
+          return false;
+        }
+      data += w;
+      len -= w;
+    }
+  return true;
+}
+
+/* Read up to BUFSIZE bytes through the transport of FD and write them
+   to OUTFD, with the return values of fd_splice.  */
+
+static int
+transport_to_file (int fd, struct transport_info *info, int outfd,
+                   int bufsize)
+{
+  char buf[16384];
+  int res = info->imp->reader (fd, buf, MIN (bufsize, (int) sizeof buf),
+                               info->ctx);
+  if (res > 0 && !write_fully (outfd, buf, res))
+    return -2;
+  return res;
+}
+
+/* Move up to BUFSIZE bytes from the socket FD to the file OUTFD
+   without copying them through user space.  The meaning of TIMEOUT
+   is the same as for fd_read.
+
+   Returns the number of bytes moved, 0 on EOF, -1 on error reading
+   from FD, and -2 on error writing to OUTFD, in which case errno
+   describes the write error.  */
+
+int
+fd_splice (int fd, int outfd, int bufsize, double timeout)
+{
+  ssize_t res, left;
+  struct transport_info *info;
+  struct readahead *ra = readahead_get (fd);
+
+  if (ra)
+    {
+      /* The read-ahead data is already in user space.  */
+      res = MIN (bufsize, ra->len - ra->pos);
+      if (!write_fully (outfd, ra->data + ra->pos, res))
+        return -2;
+      ra->pos += res;
+      if (ra->pos == ra->len)
+        ra->pos = ra->len = 0;
+      return res;
+    }
+
+  LAZY_RETRIEVE_INFO (info);
+  /* Data the transport has already decrypted must be read through
+     it.  */
+  if (info && info->imp->pending && info->imp->pending (fd, info->ctx))
+    return transport_to_file (fd, info, outfd, bufsize);
+
+  if (!poll_internal (fd, info, WAIT_FOR_READ, timeout))
+    return -1;
+  do
+    res = splice (fd, NULL, splice_pipe[1], NULL, bufsize,
+                  SPLICE_F_MOVE | SPLICE_F_MORE);
+  while (res == -1 && errno == EINTR);
+  /* With kTLS, records other than application data, such as the
+     closing alert, can only be read through the TLS library.  */
+  if (res == -1 && info && (errno == EIO || errno == EINVAL))
+    return transport_to_file (fd, info, outfd, bufsize);
+  if (res <= 0)
+    return res;
+
+  /* Drain the pipe completely, so that nothing is left over to end
+     up in the next file.  */
+  for (left = res; left > 0; )
+    {
+      ssize_t w = splice (splice_pipe[0], NULL, outfd, NULL, left,
+                          SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (w == -1 && errno == EINTR)
+        continue;
+      if (w <= 0)
+        {
+          int saved_errno = w == 0 ? ENOSPC : errno;
+          /* The pipe may still hold data; start afresh next time.  */
+          splice_pipe_close ();
+          errno = saved_errno;
+          return -2;
+        }
+      left -= w;
+    }
+  return res;
+}
+#endif /* HAVE_SPLICE */
+
+#ifdef HAVE_SENDFILE
+/* Send up to COUNT bytes of the file INFD, starting at *OFFSET, to FD
+   without copying them through user space, and advance *OFFSET.  The
+   meaning of TIMEOUT is the same as for fd_write.
+
+   Returns the number of bytes sent, 0 at the end of the file and -1
+   on error.  errno is EOPNOTSUPP if the transport of FD can't send
+   files this way.  */
+
+int
+fd_sendfile (int fd, int infd, wgint *offset, int count, double timeout)
+{
+  struct transport_info *info;
+  off_t off;
+  ssize_t res;
+
+  LAZY_RETRIEVE_INFO (info);
+  if (info && !info->imp->sendfile)
+    {
+      errno = EOPNOTSUPP;
+      return -1;
+    }
+  if (!poll_internal (fd, info, WAIT_FOR_WRITE, timeout))
+    return -1;
+  if (info)
+    return info->imp->sendfile (fd, infd, offset, count, info->ctx);
+
+  off = *offset;
+  do
+    res = sendfile (fd, infd, &off, count);
+  while (res == -1 && errno == EINTR);
+  if (res > 0)
+    *offset = off;
+  return res;
+}
+#endif /* HAVE_SENDFILE */
+
+/* Return true if the transport of FD holds data it has already read
+   from the socket, such as decrypted SSL records.  Such data can be
+   read without waiting, although the socket itself may never become
+   readable again.  */
+
+bool
+fd_pending_p (int fd)
+{
+  struct transport_info *info;
+  if (readahead_get (fd))
+    return true;
+  LAZY_RETRIEVE_INFO (info);
+  return info && info->imp->pending && info->imp->pending (fd, info->ctx);
+}
+
 /* Report the most recent error(s) on FD.  This should only be called
    after fd_* functions, such as fd_read and fd_write, and only if
    they return a negative result.  For errors coming from other calls
@@ -1018,6 +1793,7 @@ fd_close (int fd)
     info->imp->closer (fd, info->ctx);
   else
     sock_close (fd);
+  readahead_drop (fd);
 
   if (info)
     {
@@ -70,13 +70,26 @@ struct transport_implementation {
   int (*peeker) (int, char *, int, void *);
   const char *(*errstr) (int, void *);
   void (*closer) (int, void *);
+  int (*pending) (int, void *);
+  bool (*plaintext) (int, void *);
+  int (*sendfile) (int, int, wgint *, int, void *);
 };
 
 void fd_register_transport (int, struct transport_implementation *, void *);
 void *fd_transport_context (int);
+struct transport_implementation *fd_transport (int, void **);
 int fd_read (int, char *, int, double);
 int fd_write (int, char *, int, double);
 int fd_peek (int, char *, int, double);
+void fd_unread (int, const char *, int);
+#ifdef HAVE_SPLICE
+bool fd_splice_p (int);
+int fd_splice (int, int, int, double);
+#endif
+#ifdef HAVE_SENDFILE
+int fd_sendfile (int, int, wgint *, int, double);
+#endif
+bool fd_pending_p (int);
 const char *fd_errstr (int);
 void fd_close (int);
 
@@ -36,6 +36,10 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#ifdef HAVE_FORK
+# include <sys/types.h>
+# include <sys/wait.h>
+#endif
 #include "convert.h"
 #include "url.h"
 #include "recur.h"
@@ -46,6 +50,11 @@ as that of the covered work.  */
 #include "html-url.h"
 #include "css-url.h"
 #include "iri.h"
+#include "parallel.h"
+#include "state.h"
+#include "visited.h"
+#include "intern.h"
+#include "timing.h"
 
 static struct hash_table *dl_file_url_map;
 struct hash_table *dl_url_file_map;
@@ -57,13 +66,469 @@ struct hash_table *downloaded_css_set;
 
 static void convert_links (const char *, struct urlpos *);
 
+/* Converting links during the crawl.
+
+   convert_all_links waits for the end of the retrieval to convert the
+   links, because only then is it known which of the URLs a document
+   refers to have been downloaded.  For most documents that is known
+   much earlier.  When convert_incrementally is set, retrieve_tree
+   tells us which URLs are in its queue (convert_url_queued) and when
+   it is done with them (convert_url_settled), and hands us every
+   document it has finished with (convert_file_when_ready).  A
+   document none of whose links point into the queue is converted
+   right away.  The others wait, counting their links that are still
+   queued, until the last of those is settled.  Whatever is still
+   waiting at the end is left to convert_all_links.
+
+   A link that is neither downloaded nor queued when its document is
+   converted is taken to point to something that won't be downloaded.
+   That is nearly always right, but another document can still cause
+   the URL to be downloaded later, for instance by reaching it at a
+   smaller depth.  Such URLs are collected in late_downloads, and
+   convert_all_links then makes another pass over the documents
+   converted early to point their links to the local copies.  */
+
+bool convert_incrementally;
+
+struct pending_conversion {
+  char *file;
+  int waiting;			/* links to URLs still in the queue */
+};
+
+struct conversion_waiter {
+  struct pending_conversion *pc;
+  struct conversion_waiter *next;
+};
+
+/* An entry of the frontier table, keyed by the fingerprint of a
+   queued URL.  Two URLs sharing a fingerprint only make a document
+   be converted too early, which is then fixed as a late download.  */
+struct frontier_url {
+  uint64_t fp;
+  int queued;			/* times queued and not yet settled */
+  struct conversion_waiter *waiters;
+};
+
+static struct hash_table *frontier;
+
+/* Files converted during the crawl, URLs their links were converted
+   as not downloaded, and those of the latter downloaded since.  */
+static struct hash_table *converted_early;
+static struct hash_table *assumed_missing;
+static struct hash_table *late_downloads;
+
+/* Time spent converting during the crawl and the number of files
+   converted.  */
+static double early_secs;
+static int early_count;
+
+static unsigned long
+hash_fingerprint (const void *key)
+{
+  return (unsigned long) *(const uint64_t *) key;
+}
+
+static int
+cmp_fingerprint (const void *a, const void *b)
+{
+  return *(const uint64_t *) a == *(const uint64_t *) b;
+}
+
+/* Decide how each of LINKS, found in a document, is to be converted,
+   from what has been downloaded so far.
+
+   DURING_CRAWL means that more is going to be downloaded, so the
+   links converted as not downloaded are remembered.  If PC is
+   non-NULL, links to URLs still in the queue are left alone and PC
+   is made to wait for them; use PC->waiting to tell whether that
+   happened.  */
+
+static void
+decide_conversions (struct urlpos *links, bool during_crawl,
+                    struct pending_conversion *pc)
+{
+  struct urlpos *cur_url;
+
+  for (cur_url = links; cur_url; cur_url = cur_url->next)
+    {
+      char *local_name;
+      struct url *u;
+      struct iri *pi;
+
+      if (cur_url->link_base_p)
+        {
+          /* Base references have been resolved by our parser, so
+             we turn the base URL into an empty string.  (Perhaps
+             we should remove the tag entirely?)  */
+          cur_url->convert = CO_NULLIFY_BASE;
+          continue;
+        }
+
+      /* We decide the direction of conversion according to whether
+         a URL was downloaded.  Downloaded URLs will be converted
+         ABS2REL, whereas non-downloaded will be converted REL2ABS.  */
+
+      pi = iri_new ();
+      set_uri_encoding (pi, opt.locale, true);
+
+      u = url_parse (cur_url->url->url, NULL, pi, true);
+      if (!u)
+        {
+          iri_free (pi);
+          continue;
+        }
+
+      local_name = hash_table_get (dl_url_file_map, u->url);
+
+      /* Decide on the conversion type.  */
+      if (local_name)
+        {
+          /* We've downloaded this URL.  Convert it to relative
+             form.  We do this even if the URL already is in
+             relative form, because our directory structure may
+             not be identical to that on the server (think `-nd',
+             `--cut-dirs', etc.)  */
+          cur_url->convert = CO_CONVERT_TO_RELATIVE;
+          xfree_null (cur_url->local_name);
+          cur_url->local_name = xstrdup (local_name);
+          DEBUGP (("will convert url %s to local %s\n", u->url, local_name));
+        }
+      else if (pc && frontier)
+        {
+          /* Wait and see whether the URL gets downloaded.  */
+          uint64_t fp = url_fingerprint (u->url);
+          struct frontier_url *fu = hash_table_get (frontier, &fp);
+          if (fu)
+            {
+              struct conversion_waiter *w = xnew (struct conversion_waiter);
+              w->pc = pc;
+              w->next = fu->waiters;
+              fu->waiters = w;
+              ++pc->waiting;
+            }
+          else
+            pc = NULL;
+        }
+
+      if (!local_name && !pc)
+        {
+          /* We haven't downloaded this URL.  If it's not already
+             complete (including a full host name), convert it to
+             that form, so it can be reached while browsing this
+             HTML locally.  */
+          if (!cur_url->link_complete_p)
+            cur_url->convert = CO_CONVERT_TO_COMPLETE;
+          cur_url->local_name = NULL;
+          DEBUGP (("will convert url %s to complete\n", u->url));
+          if (during_crawl)
+            {
+              if (!assumed_missing)
+                assumed_missing = make_string_hash_table (0);
+              string_set_add (assumed_missing, u->url);
+            }
+        }
+
+      url_free (u);
+      iri_free (pi);
+    }
+}
+
+/* Return the URL FILE was downloaded from and set *IS_CSS if it is
+   to have its links converted, or return NULL.  */
+
+static const char *
+conversion_url (const char *file, bool *is_css)
+{
+  const char *url = dl_file_url_map ? hash_table_get (dl_file_url_map, file)
+                                    : NULL;
+  if (!url)
+    return NULL;
+  if (downloaded_html_set && string_set_contains (downloaded_html_set, file))
+    *is_css = false;
+  else if (downloaded_css_set && string_set_contains (downloaded_css_set, file))
+    *is_css = true;
+  else
+    return NULL;
+  return url;
+}
+
+/* Convert the links in FILE, given as LINKS, as decided by
+   decide_conversions during the crawl.  */
+
+static void
+convert_early (const char *file, struct urlpos *links)
+{
+  struct ptimer *timer = ptimer_new ();
+  double task_start = timing_task_begin ();
+
+  convert_links (file, links);
+  if (!converted_early)
+    converted_early = make_string_hash_table (0);
+  string_set_add (converted_early, file);
+  ++early_count;
+
+  early_secs += ptimer_measure (timer);
+  ptimer_destroy (timer);
+  timing_task_end (TASK_CONVERT, task_start);
+}
+
+/* Convert the file of PC, whose links have all been settled, and
+   free PC.  */
+
+static void
+convert_pending (struct pending_conversion *pc)
+{
+  bool is_css;
+  const char *url = conversion_url (pc->file, &is_css);
+
+  if (url)
+    {
+      struct urlpos *links = is_css ? get_urls_css_file (pc->file, url)
+                                    : get_urls_html (pc->file, url, NULL, NULL);
+      decide_conversions (links, true, NULL);
+      convert_early (pc->file, links);
+      free_urlpos (links);
+    }
+  xfree (pc->file);
+  xfree (pc);
+}
+
+/* Note that URL has been placed in the queue of URLs to retrieve.  */
+
+void
+convert_url_queued (const char *url)
+{
+  uint64_t fp = url_fingerprint (url);
+  struct frontier_url *fu;
+
+  if (!frontier)
+    frontier = hash_table_new (0, hash_fingerprint, cmp_fingerprint);
+  fu = hash_table_get (frontier, &fp);
+  if (!fu)
+    {
+      fu = xnew0 (struct frontier_url);
+      fu->fp = fp;
+      hash_table_put (frontier, &fu->fp, fu);
+    }
+  ++fu->queued;
+}
+
+/* Note that URL, taken from the queue, has been retrieved or given
+   up on.  The documents that were only waiting for it are converted
+   now.  */
+
+void
+convert_url_settled (const char *url)
+{
+  uint64_t fp = url_fingerprint (url);
+  struct frontier_url *fu;
+  struct conversion_waiter *w;
+
+  fu = frontier ? hash_table_get (frontier, &fp) : NULL;
+  if (!fu || --fu->queued > 0)
+    return;
+
+  hash_table_remove (frontier, &fu->fp);
+  w = fu->waiters;
+  xfree (fu);
+  while (w)
+    {
+      struct conversion_waiter *next = w->next;
+      if (--w->pc->waiting == 0)
+        convert_pending (w->pc);
+      xfree (w);
+      w = next;
+    }
+}
+
+/* Convert the links in FILE, which retrieve_tree is done with, as soon
+   as it is known where they point.  LINKS, if non-NULL, are the links
+   found in FILE when it was retrieved from URL.  They are used if the
+   file can be converted right away.  */
+
+void
+convert_file_when_ready (const char *file, const char *url,
+                         struct urlpos *links, bool is_css)
+{
+  struct pending_conversion *pc;
+  struct urlpos *own_links = NULL;
+  bool file_is_css;
+  const char *file_url = conversion_url (file, &file_is_css);
+
+  if (!file_url
+      || (converted_early && string_set_contains (converted_early, file)))
+    return;
+  if (!links || file_is_css != is_css || strcmp (file_url, url) != 0)
+    links = own_links = file_is_css ? get_urls_css_file (file, file_url)
+                                    : get_urls_html (file, file_url, NULL, NULL);
+
+  pc = xnew0 (struct pending_conversion);
+  decide_conversions (links, true, pc);
+  if (pc->waiting)
+    {
+      DEBUGP (("Converting %s when %d more links are settled.\n",
+               file, pc->waiting));
+      pc->file = xstrdup (file);
+    }
+  else
+    {
+      convert_early (file, links);
+      xfree (pc);
+    }
+  if (own_links)
+    free_urlpos (own_links);
+}
+
+/* Return true if FILE has been converted during the crawl.  */
+
+bool
+convert_file_done_p (const char *file)
+{
+  return converted_early && string_set_contains (converted_early, file);
+}
+
+/* Forget the documents still waiting to be converted, leaving them
+   to convert_links_in_hashtable.  */
+
+static void
+frontier_free (void)
+{
+  hash_table_iterator iter;
+
+  if (!frontier)
+    return;
+  for (hash_table_iterate (frontier, &iter); hash_table_iter_next (&iter); )
+    {
+      struct frontier_url *fu = iter.value;
+      struct conversion_waiter *w = fu->waiters;
+      while (w)
+        {
+          struct conversion_waiter *next = w->next;
+          if (--w->pc->waiting == 0)
+            {
+              xfree (w->pc->file);
+              xfree (w->pc);
+            }
+          xfree (w);
+          w = next;
+        }
+      xfree (fu);
+    }
+  hash_table_destroy (frontier);
+  frontier = NULL;
+}
+
+/* Convert the links in FILE, of the html or css set.  */
+
+static void
+convert_file (const char *file, bool is_css)
+{
+  struct urlpos *urls;
+  char *url;
+
+  /* Determine the URL of the file.  get_urls_{html,css} will need
+     it.  */
+  url = hash_table_get (dl_file_url_map, file);
+  DEBUGP (("Scanning %s (from %s)\n", file, url));
+
+  /* Parse the file...  */
+  urls = is_css ? get_urls_css_file (file, url) :
+                  get_urls_html (file, url, NULL, NULL);
+
+  /* We don't respect meta_disallow_follow here because, even if
+     the file is not followed, we might still want to convert the
+     links that have been followed from other files.  */
+
+  decide_conversions (urls, false, NULL);
+
+  /* Convert the links in the file.  */
+  convert_links (file, urls);
+
+  /* Free the data.  */
+  free_urlpos (urls);
+}
+
+/* Set in the processes started by convert_files_in_parallel.  */
+static bool convert_worker_p;
+
+#ifdef HAVE_FORK
+
+/* Convert the links in the COUNT FILES using up to opt.convert_jobs
+   processes.  The files are independent of each other and nothing
+   read by the conversion changes any more, so it only needs to be
+   split between the processes.  Each file is converted by one
+   process only, which makes the backups of -K safe; the record of
+   the backups made by a process is lost with it, but no file is
+   converted again afterwards.  */
+
+static void
+convert_files_in_parallel (char **files, int count, bool is_css)
+{
+  int jobs = opt.convert_jobs < count ? opt.convert_jobs : count;
+  pid_t *pids = xnew_array (pid_t, jobs);
+  int started, i, failed = 0;
+
+  /* Don't let the processes repeat the buffered output.  */
+  logflush ();
+  fflush (stdout);
+
+  for (started = 0; started < jobs; started++)
+    {
+      pid_t pid = fork ();
+      if (pid < 0)
+        {
+          logprintf (LOG_NOTQUIET, _("Cannot start conversion process: %s\n"),
+                     strerror (errno));
+          break;
+        }
+      if (pid == 0)
+        {
+          convert_worker_p = true;
+          for (i = started; i < count; i += jobs)
+            convert_file (files[i], is_css);
+          /* Skip atexit handlers and stdio buffers inherited from
+             the parent.  */
+          logflush ();
+          _exit (0);
+        }
+      pids[started] = pid;
+    }
+
+  /* Convert the shares of the processes that could not be started.  */
+  for (i = started; i < jobs; i++)
+    {
+      int j;
+      for (j = i; j < count; j += jobs)
+        convert_file (files[j], is_css);
+    }
+
+  for (i = 0; i < started; i++)
+    {
+      int status;
+      while (waitpid (pids[i], &status, 0) < 0)
+        if (errno != EINTR)
+          {
+            status = -1;
+            break;
+          }
+      if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+        ++failed;
+    }
+  if (failed)
+    logprintf (LOG_NOTQUIET,
+               _("%d conversion processes failed; some links may not have been converted.\n"),
+               failed);
+  xfree (pids);
+}
+
+#endif /* HAVE_FORK */
 
 static void
 convert_links_in_hashtable (struct hash_table *downloaded_set,
                             int is_css,
                             int *file_count)
 {
-  int i;
+  int i, n;
 
   int cnt;
   char **file_array;
@@ -76,92 +541,73 @@ convert_links_in_hashtable (struct hash_table *downloaded_set,
   file_array = alloca_array (char *, cnt);
   string_set_to_array (downloaded_set, file_array);
 
-  for (i = 0; i < cnt; i++)
+  /* Keep the files to convert.  */
+  for (i = n = 0; i < cnt; i++)
     {
-      struct urlpos *urls, *cur_url;
-      char *url;
       char *file = file_array[i];
 
-      /* Determine the URL of the file.  get_urls_{html,css} will need
-         it.  */
-      url = hash_table_get (dl_file_url_map, file);
-      if (!url)
+      /* Converted already during the crawl.  */
+      if (convert_file_done_p (file))
+        continue;
+      if (!hash_table_contains (dl_file_url_map, file))
         {
           DEBUGP (("Apparently %s has been removed.\n", file));
           continue;
         }
+      file_array[n++] = file;
+    }
+  *file_count += n;
 
-      DEBUGP (("Scanning %s (from %s)\n", file, url));
-
-      /* Parse the file...  */
-      urls = is_css ? get_urls_css_file (file, url) :
-                      get_urls_html (file, url, NULL, NULL);
-
-      /* We don't respect meta_disallow_follow here because, even if
-         the file is not followed, we might still want to convert the
-         links that have been followed from other files.  */
-
-      for (cur_url = urls; cur_url; cur_url = cur_url->next)
-        {
-          char *local_name;
-          struct url *u;
-          struct iri *pi;
-
-          if (cur_url->link_base_p)
-            {
-              /* Base references have been resolved by our parser, so
-                 we turn the base URL into an empty string.  (Perhaps
-                 we should remove the tag entirely?)  */
-              cur_url->convert = CO_NULLIFY_BASE;
-              continue;
-            }
-
-          /* We decide the direction of conversion according to whether
-             a URL was downloaded.  Downloaded URLs will be converted
-             ABS2REL, whereas non-downloaded will be converted REL2ABS.  */
+#ifdef HAVE_FORK
+  if (opt.convert_jobs > 1 && n > 1)
+    {
+      convert_files_in_parallel (file_array, n, is_css);
+      return;
+    }
+#endif
 
-          pi = iri_new ();
-          set_uri_encoding (pi, opt.locale, true);
+  for (i = 0; i < n; i++)
+    convert_file (file_array[i], is_css);
+}
 
-          u = url_parse (cur_url->url->url, NULL, pi, true);
-          if (!u)
-	    continue;
+/* Point the links to late_downloads in the files converted during
+   the crawl to the local copies.  Those links have been made
+   complete by the conversion, so they are the only ones needing a
+   look.  The files are not counted again.  */
 
-          local_name = hash_table_get (dl_url_file_map, u->url);
+static void
+convert_late_downloads (void)
+{
+  hash_table_iterator iter;
 
-          /* Decide on the conversion type.  */
-          if (local_name)
-            {
-              /* We've downloaded this URL.  Convert it to relative
-                 form.  We do this even if the URL already is in
-                 relative form, because our directory structure may
-                 not be identical to that on the server (think `-nd',
-                 `--cut-dirs', etc.)  */
-              cur_url->convert = CO_CONVERT_TO_RELATIVE;
-              cur_url->local_name = xstrdup (local_name);
-              DEBUGP (("will convert url %s to local %s\n", u->url, local_name));
-            }
-          else
-            {
-              /* We haven't downloaded this URL.  If it's not already
-                 complete (including a full host name), convert it to
-                 that form, so it can be reached while browsing this
-                 HTML locally.  */
-              if (!cur_url->link_complete_p)
-                cur_url->convert = CO_CONVERT_TO_COMPLETE;
-              cur_url->local_name = NULL;
-              DEBUGP (("will convert url %s to complete\n", u->url));
-            }
+  for (hash_table_iterate (converted_early, &iter);
+       hash_table_iter_next (&iter); )
+    {
+      const char *file = iter.key;
+      struct urlpos *urls, *cur_url;
+      bool is_css;
+      int count = 0;
+      const char *url = conversion_url (file, &is_css);
 
-          url_free (u);
-          iri_free (pi);
+      if (!url)
+        continue;
+      urls = is_css ? get_urls_css_file (file, url) :
+                      get_urls_html (file, url, NULL, NULL);
+      for (cur_url = urls; cur_url; cur_url = cur_url->next)
+        {
+          const char *local_name;
+          if (cur_url->link_base_p || !cur_url->link_complete_p
+              || !string_set_contains (late_downloads, cur_url->url->url))
+            continue;
+          local_name = hash_table_get (dl_url_file_map, cur_url->url->url);
+          if (!local_name)
+            continue;
+          cur_url->convert = CO_CONVERT_TO_RELATIVE;
+          cur_url->local_name = xstrdup (local_name);
+          ++count;
         }
-
-      /* Convert the links in the file.  */
-      convert_links (file, urls);
-      ++*file_count;
-
-      /* Free the data.  */
+      if (count)
+        convert_links (file, urls);
       free_urlpos (urls);
     }
 }
@@ -179,33 +625,97 @@ convert_links_in_hashtable (struct hash_table *downloaded_set,
 
    All the downloaded HTMLs are kept in downloaded_html_files, and
    downloaded URLs in urls_downloaded.  All the information is
-   extracted from these two lists.  */
+   extracted from these two lists.  Those converted during the crawl
+   are only looked at again for links to late downloads.  */
 
 void
 convert_all_links (void)
 {
   double secs;
   int file_count = 0;
+  double task_start = timing_task_begin ();
 
   struct ptimer *timer = ptimer_new ();
 
+  frontier_free ();
   convert_links_in_hashtable (downloaded_html_set, 0, &file_count);
   convert_links_in_hashtable (downloaded_css_set, 1, &file_count);
+  if (converted_early && late_downloads)
+    convert_late_downloads ();
 
   secs = ptimer_measure (timer);
-  logprintf (LOG_VERBOSE, _("Converted %d files in %s seconds.\n"),
-             file_count, print_decimal (secs));
+  if (early_count)
+    logprintf (LOG_VERBOSE,
+               _("Converted %d files in %s seconds, %d of them during the retrieval.\n"),
+               file_count + early_count, print_decimal (secs + early_secs),
+               early_count);
+  else
+    logprintf (LOG_VERBOSE, _("Converted %d files in %s seconds.\n"),
+               file_count, print_decimal (secs));
 
   ptimer_destroy (timer);
+  timing_task_end (TASK_CONVERT, task_start);
+}
+
+/* A growable buffer.  convert_links assembles the converted file in
+   one of these and writes it out at once; smaller ones are reused as
+   scratch space for the text of each link, so that converting a file
+   does not allocate per link.  */
+struct convbuf {
+  char *base;
+  long size;                    /* allocated */
+  long len;                     /* used */
+};
+
+static struct convbuf conv_out, conv_relative, conv_text;
+
+static void
+convbuf_append (struct convbuf *cb, const char *s, long n)
+{
+  DO_REALLOC (cb->base, cb->size, cb->len + n + 1, char);
+  memcpy (cb->base + cb->len, s, n);
+  cb->len += n;
+  cb->base[cb->len] = '\0';
+}
+
+#define convbuf_puts(cb, s) convbuf_append (cb, s, strlen (s))
+
+static void
+convbuf_free (struct convbuf *cb)
+{
+  xfree_null (cb->base);
+  cb->base = NULL;
+  cb->size = cb->len = 0;
 }
 
 static void write_backup_file (const char *, downloaded_file_t);
-static const char *replace_plain (const char*, int, FILE*, const char *);
-static const char *replace_attr (const char *, int, FILE *, const char *);
-static const char *replace_attr_refresh_hack (const char *, int, FILE *,
+static const char *replace_plain (const char*, int, struct convbuf *,
+                                  const char *);
+static const char *replace_attr (const char *, int, struct convbuf *,
+                                 const char *);
+static const char *replace_attr_refresh_hack (const char *, int,
+                                              struct convbuf *,
                                               const char *, int);
-static char *local_quote_string (const char *, bool);
-static char *construct_relative (const char *, const char *);
+static void html_quote_append (struct convbuf *, const char *);
+static void local_quote_append (struct convbuf *, const char *, bool);
+static const char *construct_relative (const char *, const char *);
+
+/* Log the outcome of converting FILE.  The processes converting in
+   parallel log the whole line at once, so that their lines don't get
+   mixed up.  */
+
+static void
+log_conversion (const char *file, const char *outcome)
+{
+  if (convert_worker_p)
+    {
+      char *start = aprintf (_("Converting %s... "), file);
+      logprintf (LOG_VERBOSE, "%s%s", start, outcome);
+      xfree (start);
+    }
+  else
+    logputs (LOG_VERBOSE, outcome);
+}
 
 /* Change the links in one file.  LINKS is a list of links in the
    document, along with their positions and the desired direction of
@@ -217,11 +727,15 @@ convert_links (const char *file, struct urlpos *links)
   FILE *fp;
   const char *p;
   downloaded_file_t downloaded_file_return;
+  char *tmp;
+  bool ok;
 
   struct urlpos *link;
   int to_url_count = 0, to_file_count = 0;
+  char counts[64];
 
-  logprintf (LOG_VERBOSE, _("Converting %s... "), file);
+  if (!convert_worker_p)
+    logprintf (LOG_VERBOSE, _("Converting %s... "), file);
 
   {
     /* First we do a "dry run": go through the list L and see whether
@@ -234,7 +748,7 @@ convert_links (const char *file, struct urlpos *links)
         ++dry_count;
     if (!dry_count)
       {
-        logputs (LOG_VERBOSE, _("nothing to do.\n"));
+        log_conversion (file, _("nothing to do.\n"));
         return;
       }
   }
@@ -247,30 +761,12 @@ convert_links (const char *file, struct urlpos *links)
       return;
     }
 
-  downloaded_file_return = downloaded_file (CHECK_FOR_FILE, file);
-  if (opt.backup_converted && downloaded_file_return)
-    write_backup_file (file, downloaded_file_return);
-
-  /* Before opening the file for writing, unlink the file.  This is
-     important if the data in FM is mmaped.  In such case, nulling the
-     file, which is what fopen() below does, would make us read all
-     zeroes from the mmaped region.  */
-  if (unlink (file) < 0 && errno != ENOENT)
-    {
-      logprintf (LOG_NOTQUIET, _("Unable to delete %s: %s\n"),
-                 quote (file), strerror (errno));
-      wget_read_file_free (fm);
-      return;
-    }
-  /* Now open the file for writing.  */
-  fp = fopen (file, "wb");
-  if (!fp)
-    {
-      logprintf (LOG_NOTQUIET, _("Cannot convert links in %s: %s\n"),
-                 file, strerror (errno));
-      wget_read_file_free (fm);
-      return;
-    }
+  /* Assemble the converted contents in CONV_OUT, sized for the file
+     plus some room for links growing longer, and then write them out
+     in one go.  */
+  conv_out.len = 0;
+  DO_REALLOC (conv_out.base, conv_out.size,
+              fm->length + fm->length / 4 + 1, char);
 
   /* Here we loop through all the URLs in file, replacing those of
      them that are downloaded with relative references.  */
@@ -292,31 +788,30 @@ convert_links (const char *file, struct urlpos *links)
         }
 
       /* Echo the file contents, up to the offending URL's opening
-         quote, to the outfile.  */
-      fwrite (p, 1, url_start - p, fp);
+         quote, to the output.  */
+      convbuf_append (&conv_out, p, url_start - p);
       p = url_start;
 
+      conv_text.len = 0;
       switch (link->convert)
         {
         case CO_CONVERT_TO_RELATIVE:
           /* Convert absolute URL to relative. */
           {
-            char *newname = construct_relative (file, link->local_name);
-            char *quoted_newname = local_quote_string (newname,
-                                                       link->link_css_p);
+            const char *newname = construct_relative (file, link->local_name);
+            local_quote_append (&conv_text, newname, link->link_css_p);
 
             if (link->link_css_p)
-              p = replace_plain (p, link->size, fp, quoted_newname);
+              p = replace_plain (p, link->size, &conv_out, conv_text.base);
             else if (!link->link_refresh_p)
-              p = replace_attr (p, link->size, fp, quoted_newname);
+              p = replace_attr (p, link->size, &conv_out, conv_text.base);
             else
-              p = replace_attr_refresh_hack (p, link->size, fp, quoted_newname,
+              p = replace_attr_refresh_hack (p, link->size, &conv_out,
+                                             conv_text.base,
                                              link->refresh_timeout);
 
             DEBUGP (("TO_RELATIVE: %s to %s at position %d in %s.\n",
                      link->url->url, newname, link->pos, file));
-            xfree (newname);
-            xfree (quoted_newname);
             ++to_file_count;
             break;
           }
@@ -324,25 +819,28 @@ convert_links (const char *file, struct urlpos *links)
           /* Convert the link to absolute URL. */
           {
             char *newlink = link->url->url;
-            char *quoted_newlink = html_quote_string (newlink);
 
             if (link->link_css_p)
-              p = replace_plain (p, link->size, fp, newlink);
-            else if (!link->link_refresh_p)
-              p = replace_attr (p, link->size, fp, quoted_newlink);
+              p = replace_plain (p, link->size, &conv_out, newlink);
             else
-              p = replace_attr_refresh_hack (p, link->size, fp, quoted_newlink,
-                                             link->refresh_timeout);
+              {
+                html_quote_append (&conv_text, newlink);
+                if (!link->link_refresh_p)
+                  p = replace_attr (p, link->size, &conv_out, conv_text.base);
+                else
+                  p = replace_attr_refresh_hack (p, link->size, &conv_out,
+                                                 conv_text.base,
+                                                 link->refresh_timeout);
+              }
 
             DEBUGP (("TO_COMPLETE: <something> to %s at position %d in %s.\n",
                      newlink, link->pos, file));
-            xfree (quoted_newlink);
             ++to_url_count;
             break;
           }
         case CO_NULLIFY_BASE:
           /* Change the base href to "". */
-          p = replace_attr (p, link->size, fp, "");
+          p = replace_attr (p, link->size, &conv_out, "");
           break;
         case CO_NOCONVERT:
           abort ();
@@ -352,16 +850,55 @@ convert_links (const char *file, struct urlpos *links)
 
   /* Output the rest of the file. */
   if (p - fm->content < fm->length)
-    fwrite (p, 1, fm->length - (p - fm->content), fp);
-  fclose (fp);
+    convbuf_append (&conv_out, p, fm->length - (p - fm->content));
+
   wget_read_file_free (fm);
 
-  logprintf (LOG_VERBOSE, "%d-%d\n", to_file_count, to_url_count);
+  /* Write the converted file under a temporary name and rename it
+     over FILE, so that FILE is left intact should writing fail.  */
+  tmp = aprintf ("%s.wget-convert", file);
+  fp = fopen (tmp, "wb");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot convert links in %s: %s\n"),
+                 file, strerror (errno));
+      xfree (tmp);
+      return;
+    }
+  ok = fwrite (conv_out.base, 1, conv_out.len, fp) == (size_t) conv_out.len;
+  if (fclose (fp) == EOF)
+    ok = false;
+  if (!ok)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot convert links in %s: %s\n"),
+                 file, strerror (errno));
+      unlink (tmp);
+      xfree (tmp);
+      return;
+    }
+
+  downloaded_file_return = downloaded_file (CHECK_FOR_FILE, file);
+  if (opt.backup_converted && downloaded_file_return)
+    write_backup_file (file, downloaded_file_return);
+
+  if (rename (tmp, file) != 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot convert links in %s: %s\n"),
+                 file, strerror (errno));
+      unlink (tmp);
+      xfree (tmp);
+      return;
+    }
+  xfree (tmp);
+
+  snprintf (counts, sizeof counts, "%d-%d\n", to_file_count, to_url_count);
+  log_conversion (file, counts);
 }
 
 /* Construct and return a link that points from BASEFILE to LINKFILE.
    Both files should be local file names, BASEFILE of the referrering
-   file, and LINKFILE of the referred file.
+   file, and LINKFILE of the referred file.  The link is built in
+   scratch storage that the next call overwrites.
 
    Examples:
 
@@ -376,10 +913,9 @@ convert_links (const char *file, struct urlpos *links)
    handle "." and ".." in links, so make sure they're not there
    (e.g. using path_simplify).  */
 
-static char *
+static const char *
 construct_relative (const char *basefile, const char *linkfile)
 {
-  char *link;
   int basedirs;
   const char *b, *l;
   int i, start;
@@ -414,12 +950,12 @@ construct_relative (const char *basefile, const char *linkfile)
         ++basedirs;
     }
 
-  /* Construct LINK as explained above. */
-  link = xmalloc (3 * basedirs + strlen (linkfile) + 1);
+  /* Construct the link as explained above. */
+  conv_relative.len = 0;
   for (i = 0; i < basedirs; i++)
-    memcpy (link + 3 * i, "../", 3);
-  strcpy (link + 3 * i, linkfile);
-  return link;
+    convbuf_append (&conv_relative, "../", 3);
+  convbuf_puts (&conv_relative, linkfile);
+  return conv_relative.base;
 }
 
 /* Used by write_backup_file to remember which files have been
@@ -501,17 +1037,20 @@ static bool find_fragment (const char *, int, const char **, const char **);
 
 /* Replace a string with NEW_TEXT.  Ignore quoting. */
 static const char *
-replace_plain (const char *p, int size, FILE *fp, const char *new_text)
+replace_plain (const char *p, int size, struct convbuf *out,
+               const char *new_text)
 {
-  fputs (new_text, fp);
+  convbuf_puts (out, new_text);
   p += size;
   return p;
 }
 
-/* Replace an attribute's original text with NEW_TEXT. */
+/* Replace an attribute's original text with PREFIX followed by
+   NEW_TEXT. */
 
 static const char *
-replace_attr (const char *p, int size, FILE *fp, const char *new_text)
+replace_attr_1 (const char *p, int size, struct convbuf *out,
+                const char *prefix, const char *new_text)
 {
   bool quote_flag = false;
   char quote_char = '\"';       /* use "..." for quoting, unless the
@@ -533,36 +1072,43 @@ replace_attr (const char *p, int size, FILE *fp, const char *new_text)
       ++p;
       size -= 2;                /* disregard opening and closing quote */
     }
-  putc (quote_char, fp);
-  fputs (new_text, fp);
+  convbuf_append (out, &quote_char, 1);
+  convbuf_puts (out, prefix);
+  convbuf_puts (out, new_text);
 
   /* Look for fragment identifier, if any. */
   if (find_fragment (p, size, &frag_beg, &frag_end))
-    fwrite (frag_beg, 1, frag_end - frag_beg, fp);
+    convbuf_append (out, frag_beg, frag_end - frag_beg);
   p += size;
   if (quote_flag)
     ++p;
-  putc (quote_char, fp);
+  convbuf_append (out, &quote_char, 1);
 
   return p;
 }
 
+/* Replace an attribute's original text with NEW_TEXT. */
+
+static const char *
+replace_attr (const char *p, int size, struct convbuf *out,
+              const char *new_text)
+{
+  return replace_attr_1 (p, size, out, "", new_text);
+}
+
 /* The same as REPLACE_ATTR, but used when replacing
    <meta http-equiv=refresh content="new_text"> because we need to
    append "timeout_value; URL=" before the next_text.  */
 
 static const char *
-replace_attr_refresh_hack (const char *p, int size, FILE *fp,
+replace_attr_refresh_hack (const char *p, int size, struct convbuf *out,
                            const char *new_text, int timeout)
 {
   /* "0; URL=..." */
-  char *new_with_timeout = (char *)alloca (numdigit (timeout)
-                                           + 6 /* "; URL=" */
-                                           + strlen (new_text)
-                                           + 1);
-  sprintf (new_with_timeout, "%d; URL=%s", timeout, new_text);
+  char prefix[24 + 6];
+  sprintf (prefix, "%d; URL=", timeout);
 
-  return replace_attr (p, size, fp, new_with_timeout);
+  return replace_attr_1 (p, size, out, prefix, new_text);
 }
 
 /* Find the first occurrence of '#' in [BEG, BEG+SIZE) that is not
@@ -599,7 +1145,8 @@ find_fragment (const char *beg, int size, const char **bp, const char **ep)
   return false;
 }
 
-/* Quote FILE for use as local reference to an HTML file.
+/* Append FILE to OUT, quoted for use as local reference to an HTML
+   file.
 
    We quote ? as %3F to avoid passing part of the file name as the
    parameter when browsing the converted file through HTTP.  However,
@@ -611,56 +1158,69 @@ find_fragment (const char *beg, int size, const char **bp, const char **ep)
    safe for both local and HTTP-served browsing.
 
    We always quote "#" as "%23", "%" as "%25" and ";" as "%3B"
-   because those characters have special meanings in URLs.  */
+   because those characters have special meanings in URLs.  Unless
+   NO_HTML_QUOTE is set, the result is also quoted the way
+   html_quote_string does it.  */
 
-static char *
-local_quote_string (const char *file, bool no_html_quote)
+static void
+local_quote_append (struct convbuf *out, const char *file,
+                    bool no_html_quote)
 {
-  const char *from;
-  char *newname, *to;
-
-  char *any = strpbrk (file, "?#%;");
-  if (!any)
-    return no_html_quote ? strdup (file) : html_quote_string (file);
-
-  /* Allocate space assuming the worst-case scenario, each character
-     having to be quoted.  */
-  to = newname = (char *)alloca (3 * strlen (file) + 1);
-  for (from = file; *from; from++)
-    switch (*from)
-      {
-      case '%':
-        *to++ = '%';
-        *to++ = '2';
-        *to++ = '5';
-        break;
-      case '#':
-        *to++ = '%';
-        *to++ = '2';
-        *to++ = '3';
-        break;
-      case ';':
-        *to++ = '%';
-        *to++ = '3';
-        *to++ = 'B';
-        break;
-      case '?':
-        if (opt.adjust_extension)
-          {
-            *to++ = '%';
-            *to++ = '3';
-            *to++ = 'F';
-            break;
-          }
-        /* fallthrough */
-      default:
-        *to++ = *from;
-      }
-  *to = '\0';
+  const char *from, *run;
 
-  return no_html_quote ? strdup (newname) : html_quote_string (newname);
+  /* Copy runs of characters that need no quoting in one go.  */
+  for (from = run = file; *from; from++)
+    {
+      const char *repl;
+      switch (*from)
+        {
+        case '%': repl = "%25"; break;
+        case '#': repl = "%23"; break;
+        case ';': repl = "%3B"; break;
+        case '?': repl = opt.adjust_extension ? "%3F" : NULL; break;
+        case '&': repl = no_html_quote ? NULL : "&amp;"; break;
+        case '<': repl = no_html_quote ? NULL : "&lt;"; break;
+        case '>': repl = no_html_quote ? NULL : "&gt;"; break;
+        case '\"': repl = no_html_quote ? NULL : "&quot;"; break;
+        case ' ': repl = no_html_quote ? NULL : "&#32;"; break;
+        default: repl = NULL;
+        }
+      if (repl)
+        {
+          convbuf_append (out, run, from - run);
+          convbuf_puts (out, repl);
+          run = from + 1;
+        }
+    }
+  convbuf_append (out, run, from - run);
 }
-
+
+/* Append S to OUT, quoted the way html_quote_string does it.  */
+
+static void
+html_quote_append (struct convbuf *out, const char *s)
+{
+  const char *run;
+
+  for (run = s; *s; s++)
+    {
+      const char *repl;
+      switch (*s)
+        {
+        case '&': repl = "&amp;"; break;
+        case '<': repl = "&lt;"; break;
+        case '>': repl = "&gt;"; break;
+        case '\"': repl = "&quot;"; break;
+        case ' ': repl = "&#32;"; break;
+        default: continue;
+        }
+      convbuf_append (out, run, s - run);
+      convbuf_puts (out, repl);
+      run = s + 1;
+    }
+  convbuf_append (out, run, s - run);
+}
+
 /* Book-keeping code for dl_file_url_map, dl_url_file_map,
    downloaded_html_list, and downloaded_html_set.  Other code calls
    these functions to let us know that a file has been downloaded.  */
@@ -734,11 +1294,7 @@ dissociate_urls_from_file_mapper (void *key, void *value, void *arg)
   char *file = (char *)arg;
 
   if (0 == strcmp (mapping_file, file))
-    {
-      hash_table_remove (dl_url_file_map, mapping_url);
-      xfree (mapping_url);
-      xfree (mapping_file);
-    }
+    hash_table_remove (dl_url_file_map, mapping_url);
 
   /* Continue mapping. */
   return 0;
@@ -754,6 +1310,20 @@ dissociate_urls_from_file (const char *file)
                        (char *) file);
 }
 
+/* Note that URL has been downloaded, in case links to it were
+   converted during the crawl as not downloaded.  */
+
+static void
+note_late_download (const char *url)
+{
+  if (assumed_missing && string_set_contains (assumed_missing, url))
+    {
+      if (!late_downloads)
+        late_downloads = make_string_hash_table (0);
+      string_set_add (late_downloads, url);
+    }
+}
+
 /* Register that URL has been successfully downloaded to FILE.  This
    is used by the link conversion code to convert references to URLs
    to references to local files.  It is also being used to check if a
@@ -764,8 +1334,18 @@ register_download (const char *url, const char *file)
 {
   char *old_file, *old_url;
 
+  if (parallel_worker_p ())
+    {
+      parallel_forward (PEV_REGISTER_DOWNLOAD, url, file);
+      return;
+    }
+
   ENSURE_TABLES_EXIST;
 
+  /* The maps share one copy of each URL and file name.  */
+  url = intern_string (url);
+  file = intern_string (file);
+
   /* With some forms of retrieval, it is possible, although not likely
      or particularly desirable.  If both are downloaded, the second
      download will override the first one.  When that happens,
@@ -773,7 +1353,7 @@ register_download (const char *url, const char *file)
 
   if (hash_table_get_pair (dl_file_url_map, file, &old_file, &old_url))
     {
-      if (0 == strcmp (url, old_url))
+      if (url == old_url)
         /* We have somehow managed to download the same URL twice.
            Nothing to do.  */
         return;
@@ -787,8 +1367,6 @@ register_download (const char *url, const char *file)
         goto url_only;
 
       hash_table_remove (dl_file_url_map, file);
-      xfree (old_file);
-      xfree (old_url);
 
       /* Remove all the URLs that point to this file.  Yes, there can
          be more than one such URL, because we store redirections as
@@ -806,7 +1384,7 @@ register_download (const char *url, const char *file)
       dissociate_urls_from_file (file);
     }
 
-  hash_table_put (dl_file_url_map, xstrdup (file), xstrdup (url));
+  hash_table_put (dl_file_url_map, file, url);
 
  url_only:
   /* A URL->FILE mapping is not possible without a FILE->URL mapping.
@@ -824,15 +1402,19 @@ register_download (const char *url, const char *file)
      then the first URL will resolve to "FILE", and the other to
      "FILE.1".  In that case, FILE.1 will not be found in
      dl_file_url_map, but URL will still point to FILE in
-     dl_url_file_map.  */
-  if (hash_table_get_pair (dl_url_file_map, url, &old_url, &old_file))
+     dl_url_file_map.  Since the strings are interned, putting the new
+     mapping simply replaces the old one.  */
+  hash_table_put (dl_url_file_map, url, file);
+
+  note_late_download (url);
+
+  /* A file downloaded anew has its links to be converted anew.  */
+  if (converted_early
+      && hash_table_get_pair (converted_early, file, &old_file, NULL))
     {
-      hash_table_remove (dl_url_file_map, url);
-      xfree (old_url);
+      hash_table_remove (converted_early, file);
       xfree (old_file);
     }
-
-  hash_table_put (dl_url_file_map, xstrdup (url), xstrdup (file));
 }
 
 /* Register that FROM has been redirected to TO.  This assumes that TO
@@ -844,12 +1426,19 @@ register_redirection (const char *from, const char *to)
 {
   char *file;
 
+  if (parallel_worker_p ())
+    {
+      parallel_forward (PEV_REGISTER_REDIRECTION, from, to);
+      return;
+    }
+
   ENSURE_TABLES_EXIST;
 
   file = hash_table_get (dl_url_file_map, to);
   assert (file != NULL);
   if (!hash_table_contains (dl_url_file_map, from))
-    hash_table_put (dl_url_file_map, xstrdup (from), xstrdup (file));
+    hash_table_put (dl_url_file_map, intern_string (from), file);
+  note_late_download (from);
 }
 
 /* Register that the file has been deleted. */
@@ -857,16 +1446,16 @@ register_redirection (const char *from, const char *to)
 void
 register_delete_file (const char *file)
 {
-  char *old_url, *old_file;
+  if (parallel_worker_p ())
+    {
+      parallel_forward (PEV_REGISTER_DELETE_FILE, file, NULL);
+      return;
+    }
 
   ENSURE_TABLES_EXIST;
 
-  if (!hash_table_get_pair (dl_file_url_map, file, &old_file, &old_url))
+  if (!hash_table_remove (dl_file_url_map, file))
     return;
-
-  hash_table_remove (dl_file_url_map, file);
-  xfree (old_file);
-  xfree (old_url);
   dissociate_urls_from_file (file);
 }
 
@@ -875,6 +1464,11 @@ register_delete_file (const char *file)
 void
 register_html (const char *file)
 {
+  if (parallel_worker_p ())
+    {
+      parallel_forward (PEV_REGISTER_HTML, file, NULL);
+      return;
+    }
   if (!downloaded_html_set)
     downloaded_html_set = make_string_hash_table (0);
   string_set_add (downloaded_html_set, file);
@@ -885,6 +1479,11 @@ register_html (const char *file)
 void
 register_css (const char *file)
 {
+  if (parallel_worker_p ())
+    {
+      parallel_forward (PEV_REGISTER_CSS, file, NULL);
+      return;
+    }
   if (!downloaded_css_set)
     downloaded_css_set = make_string_hash_table (0);
   string_set_add (downloaded_css_set, file);
@@ -897,23 +1496,36 @@ static void downloaded_files_free (void);
 void
 convert_cleanup (void)
 {
+  /* The keys and values of the maps are interned.  */
   if (dl_file_url_map)
     {
-      free_keys_and_values (dl_file_url_map);
       hash_table_destroy (dl_file_url_map);
       dl_file_url_map = NULL;
     }
   if (dl_url_file_map)
     {
-      free_keys_and_values (dl_url_file_map);
       hash_table_destroy (dl_url_file_map);
       dl_url_file_map = NULL;
     }
   if (downloaded_html_set)
     string_set_free (downloaded_html_set);
+  if (downloaded_css_set)
+    string_set_free (downloaded_css_set);
   downloaded_files_free ();
   if (converted_files)
     string_set_free (converted_files);
+  frontier_free ();
+  if (converted_early)
+    string_set_free (converted_early);
+  if (assumed_missing)
+    string_set_free (assumed_missing);
+  if (late_downloads)
+    string_set_free (late_downloads);
+  convbuf_free (&conv_out);
+  convbuf_free (&conv_relative);
+  convbuf_free (&conv_text);
+  downloaded_html_set = downloaded_css_set = converted_files = NULL;
+  converted_early = assumed_missing = late_downloads = NULL;
 }
 
 /* Book-keeping code for downloaded files that enables extension
@@ -984,6 +1596,13 @@ downloaded_file (downloaded_file_t mode, const char *file)
       return *ptr;
     }
 
+  if (parallel_worker_p ())
+    {
+      parallel_forward (PEV_DOWNLOADED_FILE, file,
+                        number_to_static_string (mode));
+      return FILE_NOT_ALREADY_DOWNLOADED;
+    }
+
   if (!downloaded_files_hash)
     downloaded_files_hash = make_string_hash_table (0);
 
@@ -1011,6 +1630,69 @@ downloaded_files_free (void)
       downloaded_files_hash = NULL;
     }
 }
+
+/* Write the registries of downloaded files to the state file FP, so
+   that a resumed crawl can convert the links of the files downloaded
+   before it and knows not to clobber them.  */
+
+void
+convert_state_save (FILE *fp)
+{
+  hash_table_iterator iter;
+
+  state_put_string_table (fp, dl_file_url_map, true);
+  state_put_string_table (fp, dl_url_file_map, true);
+  state_put_string_table (fp, downloaded_html_set, false);
+  state_put_string_table (fp, downloaded_css_set, false);
+  state_put_string_table (fp, converted_files, false);
+  state_put_string_table (fp, converted_early, false);
+  state_put_string_table (fp, assumed_missing, false);
+  state_put_string_table (fp, late_downloads, false);
+
+  state_put_number (fp, downloaded_files_hash
+                    ? hash_table_count (downloaded_files_hash) : 0);
+  if (downloaded_files_hash)
+    for (hash_table_iterate (downloaded_files_hash, &iter);
+         hash_table_iter_next (&iter); )
+      {
+        state_put_string (fp, iter.key);
+        state_put_number (fp, *(downloaded_file_t *) iter.value);
+      }
+}
+
+/* Read the registries written by convert_state_save from FP.  */
+
+bool
+convert_state_load (FILE *fp)
+{
+  wgint count, mode, i;
+
+  if (!state_get_interned_table (fp, &dl_file_url_map, true)
+      || !state_get_interned_table (fp, &dl_url_file_map, true)
+      || !state_get_string_table (fp, &downloaded_html_set, false)
+      || !state_get_string_table (fp, &downloaded_css_set, false)
+      || !state_get_string_table (fp, &converted_files, false)
+      || !state_get_string_table (fp, &converted_early, false)
+      || !state_get_string_table (fp, &assumed_missing, false)
+      || !state_get_string_table (fp, &late_downloads, false)
+      || !state_get_number (fp, &count))
+    return false;
+
+  for (i = 0; i < count; i++)
+    {
+      char *file;
+      if (!state_get_string (fp, &file) || !file)
+        return false;
+      if (!state_get_number (fp, &mode) || mode > CHECK_FOR_FILE)
+        {
+          xfree (file);
+          return false;
+        }
+      downloaded_file (mode, file);
+      xfree (file);
+    }
+  return true;
+}
 
 /* The function returns the pointer to the malloc-ed quoted version of
    string s.  It will recognize and quote numeric and special graphic
@@ -1084,6 +1766,27 @@ html_quote_string (const char *s)
   return res;
 }
 
+/* Return the number of bytes taken by the tables of this file.  Their
+   keys and values are mostly interned, and counted with the interned
+   strings.  */
+
+size_t
+convert_memory (void)
+{
+  struct hash_table *tables[] = {
+    dl_file_url_map, dl_url_file_map, downloaded_html_set,
+    downloaded_css_set, frontier, converted_early, assumed_missing,
+    late_downloads, converted_files, downloaded_files_hash
+  };
+  size_t size = 0;
+  int i;
+
+  for (i = 0; i < countof (tables); i++)
+    if (tables[i])
+      size += hash_table_memory (tables[i]);
+  return size;
+}
+
 /*
  * vim: et ts=2 sw=2
  */
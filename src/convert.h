@@ -81,6 +81,8 @@ struct urlpos {
   int pos, size;
 
   struct urlpos *next;		/* next list element */
+  struct arena *arena;		/* the arena this element was allocated
+				   from, or NULL if it was malloc'ed */
 };
 
 /* downloaded_file() takes a parameter of this type and returns this type. */
@@ -105,7 +107,18 @@ void register_html (const char *);
 void register_css (const char *);
 void register_delete_file (const char *);
 void convert_all_links (void);
+
+extern bool convert_incrementally;
+void convert_url_queued (const char *);
+void convert_url_settled (const char *);
+void convert_file_when_ready (const char *, const char *, struct urlpos *,
+                              bool);
+bool convert_file_done_p (const char *);
 void convert_cleanup (void);
+size_t convert_memory (void);
+
+void convert_state_save (FILE *);
+bool convert_state_load (FILE *);
 
 char *html_quote_string (const char *);
 
@@ -51,10 +51,15 @@ as that of the covered work.  */
 #include <assert.h>
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
 #include "utils.h"
 #include "hash.h"
 #include "cookies.h"
 #include "http.h"               /* for http_atotm */
+
+#ifdef TESTING
+#include "test.h"
+#endif
 
 /* Declarations of `struct cookie' and the most basic functions. */
 
@@ -68,15 +73,50 @@ as that of the covered work.  */
    course, when sending a cookie to `www.google.com', one must search
    for cookies that belong to either `www.google.com' or `google.com'
    -- but the point is that the code doesn't need to go through *all*
-   the cookies.  */
+   the cookies.
+
+   Since the same Cookie header is typically sent with many requests,
+   the jar also caches the generated headers, indexed by host name
+   and then by port, security and directory of the request.  A host's
+   cached headers are dropped whenever a cookie is stored to or
+   discarded from one of the chains that serve that host.  */
 
 struct cookie_jar {
   /* Cookie chains indexed by domain.  */
   struct hash_table *chains;
 
   int cookie_count;             /* number of cookies in the jar. */
+
+  /* Tables of cached Cookie headers, indexed by host.  */
+  struct hash_table *header_cache;
+  int header_cache_count;       /* number of cached headers. */
+
+  /* The cookies file changes are appended to, see
+     cookie_jar_journal.  */
+  char *journal_file;
+  FILE *journal;                /* open for appending, or NULL */
+  pid_t journal_pid;            /* process that writes the journal */
+  int journal_records;          /* records appended since compaction */
+};
+
+/* A Cookie header generated by cookie_header.  HEADER is NULL if no
+   cookies are to be sent.  The header may be reused until
+   EXPIRY_TIME, the earliest expiry time of the cookies it contains,
+   0 meaning no expiry.  */
+
+struct cached_header {
+  char *header;
+  time_t expiry_time;
 };
 
+/* The maximum number of cached headers.  When it is reached, the
+   cache is flushed before being refilled.  */
+#define HEADER_CACHE_MAX 1024
+
+/* The journal is compacted once it holds more than this many records
+   and more than twice as many records as there are cookies.  */
+#define JOURNAL_COMPACT_MIN 1000
+
 /* Value set by entry point functions, so that the low-level
    routines don't need to call time() all the time.  */
 static time_t cookies_now;
@@ -87,6 +127,11 @@ cookie_jar_new (void)
   struct cookie_jar *jar = xnew (struct cookie_jar);
   jar->chains = make_nocase_string_hash_table (0);
   jar->cookie_count = 0;
+  jar->header_cache = make_nocase_string_hash_table (0);
+  jar->header_cache_count = 0;
+  jar->journal_file = NULL;
+  jar->journal = NULL;
+  jar->journal_records = 0;
   return jar;
 }
 
@@ -154,6 +199,61 @@ delete_cookie (struct cookie *cookie)
   xfree_null (cookie->value);
   xfree (cookie);
 }
+
+/* Free the cached headers in HEADERS, a table from the jar's header
+   cache, and empty the table.  Return the number of headers freed.  */
+
+static int
+clear_cached_headers (struct hash_table *headers)
+{
+  hash_table_iterator iter;
+  int count = hash_table_count (headers);
+  for (hash_table_iterate (headers, &iter); hash_table_iter_next (&iter); )
+    {
+      struct cached_header *ch = iter.value;
+      xfree (iter.key);
+      xfree_null (ch->header);
+      xfree (ch);
+    }
+  hash_table_clear (headers);
+  return count;
+}
+
+/* Drop from JAR's header cache the headers of all hosts that belong
+   to DOMAIN, or the whole cache if DOMAIN is NULL.  Called whenever
+   the chain of DOMAIN changes.  */
+
+static void
+invalidate_cached_headers (struct cookie_jar *jar, const char *domain)
+{
+  hash_table_iterator iter;
+  int domlen = 0;
+
+  if (!jar->header_cache_count)
+    return;
+
+  if (domain)
+    {
+      if (*domain == '.')
+        ++domain;
+      domlen = strlen (domain);
+    }
+
+  for (hash_table_iterate (jar->header_cache, &iter);
+       hash_table_iter_next (&iter); )
+    {
+      const char *host = iter.key;
+      if (domain)
+        {
+          int hostlen = strlen (host);
+          if (hostlen < domlen
+              || 0 != strcasecmp (host + hostlen - domlen, domain)
+              || (hostlen > domlen && host[hostlen - domlen - 1] != '.'))
+            continue;
+        }
+      jar->header_cache_count -= clear_cached_headers (iter.value);
+    }
+}
 
 /* Functions for storing cookies.
 
@@ -254,6 +354,7 @@ store_cookie (struct cookie_jar *jar, struct cookie *cookie)
 
   hash_table_put (jar->chains, chain_key, cookie);
   ++jar->cookie_count;
+  invalidate_cached_headers (jar, cookie->domain);
 
   IF_DEBUG
     {
@@ -310,6 +411,7 @@ discard_matching_cookie (struct cookie_jar *jar, struct cookie *cookie)
           else
             hash_table_put (jar->chains, chain_key, victim->next);
         }
+      invalidate_cached_headers (jar, victim->domain);
       delete_cookie (victim);
       DEBUGP (("Discarded old cookie.\n"));
     }
@@ -648,6 +750,10 @@ check_path_match (const char *cookie_path, const char *path)
 } while (0)
 
 
+static bool cookie_saved_p (const struct cookie *);
+static void journal_cookie (struct cookie_jar *, const struct cookie *,
+                            bool);
+
 /* Process the HTTP `Set-Cookie' header.  This results in storing the
    cookie or discarding a matching one, or ignoring it completely, all
    depending on the contents.  */
@@ -723,10 +829,26 @@ cookie_handle_set_cookie (struct cookie_jar *jar,
   if (cookie->discard_requested)
     {
       discard_matching_cookie (jar, cookie);
+      journal_cookie (jar, cookie, true);
       goto out;
     }
 
-  store_cookie (jar, cookie);
+  if (cookie_saved_p (cookie))
+    {
+      store_cookie (jar, cookie);
+      journal_cookie (jar, cookie, false);
+    }
+  else
+    {
+      /* A cookie that won't be saved may still replace one that
+         was.  */
+      struct cookie *prev;
+      bool replaces = (jar->journal
+                       && find_matching_cookie (jar, cookie, &prev) != NULL);
+      store_cookie (jar, cookie);
+      if (replaces)
+        journal_cookie (jar, cookie, true);
+    }
   return;
 
  out:
@@ -953,15 +1075,20 @@ goodness_comparator (const void *p1, const void *p2)
   return dgdiff ? dgdiff : pgdiff;
 }
 
-/* Generate a `Cookie' header for a request that goes to HOST:PORT and
-   requests PATH from the server.  The resulting string is allocated
-   with `malloc', and the caller is responsible for freeing it.  If no
-   cookies pertain to this request, i.e. no cookie header should be
-   generated, NULL is returned.  */
+/* Generate the `Cookie' header for cookie_header.  PATH is the
+   /-prefixed path of the request, and DIRLEN the length of its
+   directory part, including the trailing slash.
 
-char *
-cookie_header (struct cookie_jar *jar, const char *host,
-               int port, const char *path, bool secflag)
+   *CACHEABLE is set to whether the header applies to all requests for
+   the files in that directory; this is the case unless a cookie's
+   path reaches into the directory, such as "/dir/file" for request
+   path "/dir/fi".  *EXPIRY_TIME is set to the earliest expiry time of
+   the cookies in the header, 0 if none of them expires.  */
+
+static char *
+build_cookie_header (struct cookie_jar *jar, const char *host,
+                     int port, const char *path, bool secflag,
+                     int dirlen, bool *cacheable, time_t *expiry_time)
 {
   struct cookie **chains;
   int chain_count;
@@ -971,7 +1098,9 @@ cookie_header (struct cookie_jar *jar, const char *host,
   int count, i, ocnt;
   char *result;
   int result_size, pos;
-  PREPEND_SLASH (path);         /* see cookie_handle_set_cookie */
+
+  *cacheable = true;
+  *expiry_time = 0;
 
   /* First, find the cookie chains whose domains match HOST. */
 
@@ -985,8 +1114,6 @@ cookie_header (struct cookie_jar *jar, const char *host,
   if (!chain_count)
     return NULL;
 
-  cookies_now = time (NULL);
-
   /* Now extract from the chains those cookies that match our host
      (for domain_exact cookies), port (for cookies with port other
      than PORT_ANY), etc.  See matching_cookie for details.  */
@@ -995,8 +1122,17 @@ cookie_header (struct cookie_jar *jar, const char *host,
   count = 0;
   for (i = 0; i < chain_count; i++)
     for (cookie = chains[i]; cookie; cookie = cookie->next)
-      if (cookie_matches_url (cookie, host, port, path, secflag, NULL))
+      {
+        if ((int) strlen (cookie->path) > dirlen
+            && 0 == strncmp (cookie->path, path, dirlen))
+          *cacheable = false;
+        if (!cookie_matches_url (cookie, host, port, path, secflag, NULL))
+          continue;
+        if (cookie->expiry_time
+            && (!*expiry_time || cookie->expiry_time < *expiry_time))
+          *expiry_time = cookie->expiry_time;
         ++count;
+      }
   if (!count)
     return NULL;                /* no cookies matched */
 
@@ -1064,6 +1200,73 @@ cookie_header (struct cookie_jar *jar, const char *host,
   assert (pos == result_size);
   return result;
 }
+
+/* Generate a `Cookie' header for a request that goes to HOST:PORT and
+   requests PATH from the server.  The resulting string is allocated
+   with `malloc', and the caller is responsible for freeing it.  If no
+   cookies pertain to this request, i.e. no cookie header should be
+   generated, NULL is returned.  */
+
+char *
+cookie_header (struct cookie_jar *jar, const char *host,
+               int port, const char *path, bool secflag)
+{
+  struct hash_table *headers;
+  struct cached_header *ch;
+  char *key, *header;
+  int dirlen;
+  bool cacheable;
+  time_t expiry_time;
+  PREPEND_SLASH (path);         /* see cookie_handle_set_cookie */
+
+  /* Bail out quickly if there are no cookies in the jar.  */
+  if (!hash_table_count (jar->chains))
+    return NULL;
+
+  cookies_now = time (NULL);
+
+  /* Look up the header sent with the previous request for the same
+     directory.  */
+  dirlen = strrchr (path, '/') + 1 - path;
+  key = (char *) alloca (dirlen + 32);
+  sprintf (key, "%d %d %.*s", port, (int) secflag, dirlen, path);
+
+  headers = hash_table_get (jar->header_cache, host);
+  if (headers)
+    {
+      ch = hash_table_get (headers, key);
+      if (ch && (!ch->expiry_time || cookies_now <= ch->expiry_time))
+        return ch->header ? xstrdup (ch->header) : NULL;
+    }
+
+  header = build_cookie_header (jar, host, port, path, secflag, dirlen,
+                                &cacheable, &expiry_time);
+  if (!cacheable)
+    return header;
+
+  if (jar->header_cache_count >= HEADER_CACHE_MAX)
+    invalidate_cached_headers (jar, NULL);
+  if (!headers)
+    {
+      headers = make_string_hash_table (0);
+      hash_table_put (jar->header_cache, xstrdup (host), headers);
+    }
+  ch = hash_table_get (headers, key);
+  if (ch)
+    {
+      /* An expired entry; reuse it.  */
+      xfree_null (ch->header);
+    }
+  else
+    {
+      ch = xnew (struct cached_header);
+      hash_table_put (headers, xstrdup (key), ch);
+      ++jar->header_cache_count;
+    }
+  ch->header = header ? xstrdup (header) : NULL;
+  ch->expiry_time = expiry_time;
+  return header;
+}
 
 /* Support for loading and saving cookies.  The format used for
    loading and saving should be the format of the `cookies.txt' file
@@ -1222,7 +1425,13 @@ cookie_jar_load (struct cookie_jar *jar, const char *file)
       else
         {
           if (expiry < cookies_now)
-            goto abort_cookie;  /* ignore stale cookie. */
+            {
+              /* Ignore stale cookie.  A journal records the removal of
+                 a cookie as a stale copy of it, so forget the earlier
+                 copy as well.  */
+              discard_matching_cookie (jar, cookie);
+              goto abort_cookie;
+            }
           cookie->expiry_time = expiry;
           cookie->permanent = 1;
         }
@@ -1238,25 +1447,39 @@ cookie_jar_load (struct cookie_jar *jar, const char *file)
   fclose (fp);
 }
 
-/* Save cookies, in format described above, to FILE. */
+/* Return true if COOKIE is to be written out to the cookies file.  */
 
-void
-cookie_jar_save (struct cookie_jar *jar, const char *file)
+static bool
+cookie_saved_p (const struct cookie *cookie)
 {
-  FILE *fp;
-  hash_table_iterator iter;
+  return (cookie->permanent || opt.keep_session_cookies)
+    && !cookie_expired_p (cookie);
+}
 
-  DEBUGP (("Saving cookies to %s.\n", file));
+/* Write COOKIE to FP as a line of the cookies file, with EXPIRY as
+   the expiry time.  */
 
-  cookies_now = time (NULL);
+static void
+write_cookie (FILE *fp, const struct cookie *cookie, time_t expiry)
+{
+  if (!cookie->domain_exact)
+    fputc ('.', fp);
+  fputs (cookie->domain, fp);
+  if (cookie->port != PORT_ANY)
+    fprintf (fp, ":%d", cookie->port);
+  fprintf (fp, "\t%s\t%s\t%s\t%.0f\t%s\t%s\n",
+           cookie->domain_exact ? "FALSE" : "TRUE",
+           cookie->path, cookie->secure ? "TRUE" : "FALSE",
+           (double)expiry,
+           cookie->attr, cookie->value);
+}
 
-  fp = fopen (file, "w");
-  if (!fp)
-    {
-      logprintf (LOG_NOTQUIET, _("Cannot open cookies file %s: %s\n"),
-                 quote (file), strerror (errno));
-      return;
-    }
+/* Write the cookies of JAR to FP.  Return false on write error.  */
+
+static bool
+write_cookies (struct cookie_jar *jar, FILE *fp)
+{
+  hash_table_iterator iter;
 
   fputs ("# HTTP cookie file.\n", fp);
   fprintf (fp, "# Generated by Wget on %s.\n", datetime_str (cookies_now));
@@ -1266,30 +1489,133 @@ cookie_jar_save (struct cookie_jar *jar, const char *file)
        hash_table_iter_next (&iter);
        )
     {
-      const char *domain = iter.key;
       struct cookie *cookie = iter.value;
       for (; cookie; cookie = cookie->next)
         {
-          if (!cookie->permanent && !opt.keep_session_cookies)
-            continue;
-          if (cookie_expired_p (cookie))
+          if (!cookie_saved_p (cookie))
             continue;
-          if (!cookie->domain_exact)
-            fputc ('.', fp);
-          fputs (domain, fp);
-          if (cookie->port != PORT_ANY)
-            fprintf (fp, ":%d", cookie->port);
-          fprintf (fp, "\t%s\t%s\t%s\t%.0f\t%s\t%s\n",
-                   cookie->domain_exact ? "FALSE" : "TRUE",
-                   cookie->path, cookie->secure ? "TRUE" : "FALSE",
-                   (double)cookie->expiry_time,
-                   cookie->attr, cookie->value);
+          write_cookie (fp, cookie, cookie->expiry_time);
           if (ferror (fp))
-            goto out;
+            return false;
         }
     }
- out:
-  if (ferror (fp))
+  return !ferror (fp);
+}
+
+/* Rewrite the journal of JAR to hold just the cookies in the jar, and
+   reopen it for appending.  The new contents are written to a
+   temporary file which then replaces the journal, so that a crash
+   leaves either the old or the new journal in place.  */
+
+static void
+compact_cookie_journal (struct cookie_jar *jar)
+{
+  char *tmp = concat_strings (jar->journal_file, ".tmp", (char *) 0);
+  FILE *fp;
+
+  DEBUGP (("Compacting cookie journal %s.\n", jar->journal_file));
+
+  if (jar->journal)
+    fclose (jar->journal);
+
+  fp = fopen (tmp, "w");
+  if (!fp)
+    logprintf (LOG_NOTQUIET, _("Cannot open cookies file %s: %s\n"),
+               quote (tmp), strerror (errno));
+  else
+    {
+      bool ok = write_cookies (jar, fp);
+      if (fclose (fp) < 0)
+        ok = false;
+      if (ok && rename (tmp, jar->journal_file) == 0)
+        jar->journal_records = 0;
+      else
+        {
+          logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
+                     quote (jar->journal_file), strerror (errno));
+          unlink (tmp);
+        }
+    }
+  xfree (tmp);
+
+  jar->journal = fopen (jar->journal_file, "a");
+  if (!jar->journal)
+    logprintf (LOG_NOTQUIET, _("Cannot open cookies file %s: %s\n"),
+               quote (jar->journal_file), strerror (errno));
+}
+
+/* Append COOKIE to the journal of JAR, if any.  If DISCARD is true,
+   record the cookie's removal instead; it is written out as expired,
+   which makes cookie_jar_load discard it.  */
+
+static void
+journal_cookie (struct cookie_jar *jar, const struct cookie *cookie,
+                bool discard)
+{
+  /* Parallel workers forward their cookies to the parent, which
+     journals them.  */
+  if (!jar->journal || jar->journal_pid != getpid ())
+    return;
+
+  write_cookie (jar->journal, cookie, discard ? 1 : cookie->expiry_time);
+  if (fflush (jar->journal) != 0)
+    logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
+               quote (jar->journal_file), strerror (errno));
+
+  if (++jar->journal_records > JOURNAL_COMPACT_MIN
+      && jar->journal_records > 2 * jar->cookie_count)
+    compact_cookie_journal (jar);
+}
+
+/* Start journaling the cookies of JAR to FILE: write out the cookies
+   in the jar now, then append every change to them as it happens.
+   Unlike with cookie_jar_save, the cookies survive an interrupted
+   run, and FILE remains readable by cookie_jar_load, where later
+   lines override earlier ones.  */
+
+void
+cookie_jar_journal (struct cookie_jar *jar, const char *file)
+{
+  if (jar->journal_file)
+    return;
+
+  cookies_now = time (NULL);
+  jar->journal_file = xstrdup (file);
+  jar->journal_pid = getpid ();
+  compact_cookie_journal (jar);
+}
+
+/* Save cookies, in format described above, to FILE.  If the jar is
+   journaled, compact the journal instead, and stop journaling.  */
+
+void
+cookie_jar_save (struct cookie_jar *jar, const char *file)
+{
+  FILE *fp;
+
+  DEBUGP (("Saving cookies to %s.\n", file));
+
+  cookies_now = time (NULL);
+
+  if (jar->journal_file && jar->journal_pid == getpid ())
+    {
+      compact_cookie_journal (jar);
+      if (jar->journal)
+        fclose (jar->journal);
+      jar->journal = NULL;
+      DEBUGP (("Done saving cookies.\n"));
+      return;
+    }
+
+  fp = fopen (file, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot open cookies file %s: %s\n"),
+                 quote (file), strerror (errno));
+      return;
+    }
+
+  if (!write_cookies (jar, fp))
     logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
                quote (file), strerror (errno));
   if (fclose (fp) < 0)
@@ -1298,7 +1624,28 @@ cookie_jar_save (struct cookie_jar *jar, const char *file)
 
   DEBUGP (("Done saving cookies.\n"));
 }
-
+
+/* Return the number of bytes taken by JAR.  */
+
+size_t
+cookie_jar_memory (const struct cookie_jar *jar)
+{
+  hash_table_iterator iter;
+  size_t size = sizeof *jar + hash_table_memory (jar->chains);
+
+  if (jar->header_cache)
+    size += hash_table_memory (jar->header_cache);
+  for (hash_table_iterate (jar->chains, &iter); hash_table_iter_next (&iter); )
+    {
+      const struct cookie *c;
+      size += strlen (iter.key) + 1;
+      for (c = iter.value; c; c = c->next)
+        size += sizeof *c + strlen (c->domain) + strlen (c->path)
+          + strlen (c->attr) + strlen (c->value) + 4;
+    }
+  return size;
+}
+
 /* Clean up cookie-related data. */
 
 void
@@ -1319,9 +1666,81 @@ cookie_jar_delete (struct cookie_jar *jar)
         }
     }
   hash_table_destroy (jar->chains);
+
+  for (hash_table_iterate (jar->header_cache, &iter);
+       hash_table_iter_next (&iter); )
+    {
+      xfree (iter.key);
+      clear_cached_headers (iter.value);
+      hash_table_destroy (iter.value);
+    }
+  hash_table_destroy (jar->header_cache);
+
+  if (jar->journal)
+    fclose (jar->journal);
+  xfree_null (jar->journal_file);
   xfree (jar);
 }
 
+#ifdef TESTING
+
+static bool
+header_equals (const char *header, const char *expected)
+{
+  return expected ? header && !strcmp (header, expected) : !header;
+}
+
+const char *
+test_cookie_header_cache (void)
+{
+  struct cookie_jar *jar = cookie_jar_new ();
+  char *h;
+
+#define HEADER_IS(path, expected) do {                                  \
+  h = cookie_header (jar, "www.example.com", 80, path, false);          \
+  mu_assert ("test_cookie_header_cache: wrong header for " path,        \
+             header_equals (h, expected));                              \
+  xfree_null (h);                                                       \
+} while (0)
+
+  cookie_handle_set_cookie (jar, "www.example.com", 80, "index.html",
+                            "a=1; domain=example.com; path=/");
+  HEADER_IS ("index.html", "a=1");
+  HEADER_IS ("other.html", "a=1");
+  HEADER_IS ("dir/file", "a=1");
+
+  /* Storing a cookie in a chain that serves the host is seen.  */
+  cookie_handle_set_cookie (jar, "www.example.com", 80, "dir/file",
+                            "b=2");
+  HEADER_IS ("dir/file", "b=2; a=1");
+  HEADER_IS ("index.html", "a=1");
+
+  /* So is a cookie path that reaches into the directory.  */
+  cookie_handle_set_cookie (jar, "www.example.com", 80, "dir/file",
+                            "c=3; path=/dir/file");
+  HEADER_IS ("dir/file", "c=3; b=2; a=1");
+  HEADER_IS ("dir/other", "b=2; a=1");
+  HEADER_IS ("dir/file", "c=3; b=2; a=1");
+
+  /* And discarding a cookie.  */
+  cookie_handle_set_cookie (jar, "www.example.com", 80, "index.html",
+                            "a=1; domain=example.com; path=/; max-age=0");
+  HEADER_IS ("index.html", NULL);
+  HEADER_IS ("dir/other", "b=2");
+
+  /* Cookies of unrelated domains don't matter.  */
+  cookie_handle_set_cookie (jar, "www.example.org", 80, "index.html",
+                            "d=4");
+  HEADER_IS ("dir/other", "b=2");
+
+#undef HEADER_IS
+
+  cookie_jar_delete (jar);
+  return NULL;
+}
+
+#endif /* TESTING */
+
 /* Test cases.  Currently this is only tests parse_set_cookies.  To
    use, recompile Wget with -DTEST_COOKIES and call test_cookies()
    from main.  */
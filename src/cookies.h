@@ -35,6 +35,7 @@ struct cookie_jar;
 
 struct cookie_jar *cookie_jar_new (void);
 void cookie_jar_delete (struct cookie_jar *);
+size_t cookie_jar_memory (const struct cookie_jar *);
 
 void cookie_handle_set_cookie (struct cookie_jar *, const char *, int,
 			       const char *, const char *);
@@ -43,5 +44,6 @@ char *cookie_header (struct cookie_jar *, const char *, int,
 
 void cookie_jar_load (struct cookie_jar *, const char *);
 void cookie_jar_save (struct cookie_jar *, const char *);
+void cookie_jar_journal (struct cookie_jar *, const char *);
 
 #endif /* COOKIES_H */
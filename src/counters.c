@@ -0,0 +1,283 @@
+/* Live statistics of a running Wget.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* Counters of the bytes received, the transfers, the connections,
+   and the DNS and TLS caches are kept in the hot paths, and a
+   snapshot of them can be had while Wget runs.  SIGUSR2 (and SIGINFO
+   where there is one) logs the snapshot, with the throughput over the
+   last ten seconds and the last minute, and the size of the queue and
+   the blacklist of a recursive retrieval.  With --metrics-file, the
+   snapshot is written to a file in the text format of Prometheus
+   every METRICS_INTERVAL seconds and when Wget exits, for example
+   for the textfile collector of node_exporter to pick up.
+
+   The counters live in memory shared with the workers of --parallel,
+   which add to them directly.  The throughput is sampled, and the
+   snapshot taken, by the main process in counters_poll, which the
+   read loop of the bodies and the loop of retrieve_tree call.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#if defined HAVE_FORK && defined HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+#include "utils.h"
+#include "ptimer.h"
+#include "retr.h"
+#include "recur.h"
+#include "parallel.h"
+#include "counters.h"
+
+/* Seconds between two samples of the bytes received.  */
+#define SAMPLE_INTERVAL 1.0
+
+/* Number of samples kept, which must cover the longest window the
+   throughput is measured over.  */
+#define SAMPLES 64
+
+/* Seconds between two writes of --metrics-file.  */
+#define METRICS_INTERVAL 10.0
+
+static struct counters early_counters;
+
+/* Until counters_init, the counters of this process alone.  */
+struct counters *counters = &early_counters;
+
+/* Set by the signal handler.  */
+static volatile sig_atomic_t report_requested;
+
+static struct ptimer *timer;
+
+/* The ring of samples of counters->bytes.  */
+static struct {
+  double time;
+  wgint bytes;
+} samples[SAMPLES];
+static int sample_next, sample_count;
+static double last_metrics = -METRICS_INTERVAL;
+
+/* Put the counters in memory that the workers of --parallel will
+   share.  Must be called before any worker is forked.  */
+
+void
+counters_init (void)
+{
+#if defined HAVE_FORK && defined HAVE_MMAP
+  struct counters *shared = mmap (NULL, sizeof *shared,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared != MAP_FAILED)
+    {
+      *shared = *counters;
+      counters = shared;
+    }
+#endif
+  timer = ptimer_new ();
+}
+
+/* Ask for the snapshot to be logged at the next call to counters_poll.
+   Safe to call from a signal handler.  */
+
+void
+counters_request_report (void)
+{
+  report_requested = 1;
+}
+
+/* Return the bytes received per second over the last WINDOW seconds,
+   as far as the samples go back.  */
+
+static double
+throughput (double now, double window)
+{
+  int i, oldest = -1;
+
+  for (i = 0; i < sample_count; i++)
+    {
+      int k = (sample_next - 1 - i + SAMPLES) % SAMPLES;
+      if (now - samples[k].time > window)
+        break;
+      oldest = k;
+    }
+  if (oldest < 0 || now - samples[oldest].time < SAMPLE_INTERVAL / 2)
+    return 0;
+  return (counters->bytes - samples[oldest].bytes)
+    / (now - samples[oldest].time);
+}
+
+/* Return PART as a percentage of WHOLE.  */
+
+static double
+percent (long part, long whole)
+{
+  return whole ? 100.0 * part / whole : 0;
+}
+
+/* Log a snapshot of the counters.  */
+
+static void
+counters_report (double now)
+{
+  struct counters c = *counters;
+  int queued, seen;
+
+  recur_counts (&queued, &seen);
+  logprintf (LOG_NOTQUIET, _("Status at %s:\n"), datetime_str (time (NULL)));
+  logprintf (LOG_NOTQUIET, _("  throughput: %s over 10s"),
+             retr_rate ((wgint) throughput (now, 10), 1));
+  logprintf (LOG_NOTQUIET, _(", %s over 1m\n"),
+             retr_rate ((wgint) throughput (now, 60), 1));
+  logprintf (LOG_NOTQUIET, _("  transfers: %ld active, %ld done, %s bytes\n"),
+             c.active, c.transfers, number_to_static_string (c.bytes));
+  logprintf (LOG_NOTQUIET, _("  queue: %d URLs, %d seen\n"), queued, seen);
+  logprintf (LOG_NOTQUIET,
+             _("  connections: %ld new, %ld reused (%.0f%%)\n"),
+             c.connections, c.reused,
+             percent (c.reused, c.connections + c.reused));
+  logprintf (LOG_NOTQUIET,
+             _("  DNS: %ld lookups, %ld from the cache (%.0f%%)\n"),
+             c.dns_lookups, c.dns_hits, percent (c.dns_hits, c.dns_lookups));
+  logprintf (LOG_NOTQUIET,
+             _("  TLS: %ld handshakes, %ld resumed (%.0f%%)\n"),
+             c.tls_handshakes, c.tls_resumed,
+             percent (c.tls_resumed, c.tls_handshakes));
+}
+
+/* Print one metric of the Prometheus text format to FP.  */
+
+static void
+metric (FILE *fp, const char *name, const char *type, const char *help,
+        double value)
+{
+  fprintf (fp, "# HELP wget_%s %s\n# TYPE wget_%s %s\nwget_%s %.0f\n",
+           name, help, name, type, name, value);
+}
+
+/* Write the snapshot to --metrics-file.  It is written to a temporary
+   file renamed over it, so that the file is never seen half
+   written.  */
+
+static void
+counters_write_metrics (double now)
+{
+  struct counters c = *counters;
+  char *tmp = aprintf ("%s.tmp", opt.metrics_file);
+  FILE *fp = fopen (tmp, "w");
+  int queued, seen;
+
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", tmp, strerror (errno));
+      xfree (tmp);
+      return;
+    }
+
+  recur_counts (&queued, &seen);
+  metric (fp, "bytes_total", "counter", "Bytes of bodies received.",
+          c.bytes);
+  metric (fp, "transfers_total", "counter", "Bodies received.",
+          c.transfers);
+  metric (fp, "transfers_active", "gauge", "Bodies being received.",
+          c.active);
+  fprintf (fp, "# HELP wget_throughput_bytes_per_second "
+           "Bytes received per second over the window.\n"
+           "# TYPE wget_throughput_bytes_per_second gauge\n"
+           "wget_throughput_bytes_per_second{window=\"10s\"} %.0f\n"
+           "wget_throughput_bytes_per_second{window=\"1m\"} %.0f\n",
+           throughput (now, 10), throughput (now, 60));
+  metric (fp, "queue_urls", "gauge", "URLs in the queue.", queued);
+  metric (fp, "seen_urls", "gauge", "URLs queued so far.", seen);
+  metric (fp, "connections_total", "counter",
+          "Connections made to servers.", c.connections);
+  metric (fp, "connections_reused_total", "counter",
+          "Requests sent on kept-alive connections.", c.reused);
+  metric (fp, "dns_lookups_total", "counter", "Host names looked up.",
+          c.dns_lookups);
+  metric (fp, "dns_cache_hits_total", "counter",
+          "Lookups answered by the cache.", c.dns_hits);
+  metric (fp, "tls_handshakes_total", "counter",
+          "TLS handshakes completed.", c.tls_handshakes);
+  metric (fp, "tls_resumed_total", "counter",
+          "TLS handshakes that resumed a session.", c.tls_resumed);
+
+  if (fclose (fp) != 0 || rename (tmp, opt.metrics_file) != 0)
+    logprintf (LOG_NOTQUIET, "%s: %s\n", opt.metrics_file, strerror (errno));
+  xfree (tmp);
+}
+
+/* Sample the bytes received if it hasn't been done for a while, and
+   log the snapshot or write it to --metrics-file when it is due.
+   Cheap enough to be called for each read.  */
+
+void
+counters_poll (void)
+{
+  double now;
+
+  if (!timer || parallel_worker_p ())
+    return;
+  now = ptimer_measure (timer);
+
+  if (!sample_count
+      || now - samples[(sample_next - 1 + SAMPLES) % SAMPLES].time
+         >= SAMPLE_INTERVAL)
+    {
+      samples[sample_next].time = now;
+      samples[sample_next].bytes = counters->bytes;
+      sample_next = (sample_next + 1) % SAMPLES;
+      if (sample_count < SAMPLES)
+        ++sample_count;
+    }
+
+  if (report_requested)
+    {
+      report_requested = 0;
+      counters_report (now);
+    }
+  if (opt.metrics_file && now - last_metrics >= METRICS_INTERVAL)
+    {
+      last_metrics = now;
+      counters_write_metrics (now);
+    }
+}
+
+/* Write the last snapshot to --metrics-file.  */
+
+void
+counters_finish (void)
+{
+  if (opt.metrics_file && timer)
+    counters_write_metrics (ptimer_measure (timer));
+}
@@ -0,0 +1,65 @@
+/* Declarations for counters.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+/* Counters of the work done so far, kept in the hot paths for the
+   live statistics.  */
+struct counters {
+  wgint bytes;                  /* bytes of bodies received */
+  long transfers;               /* bodies received */
+  long active;                  /* bodies being received */
+  long connections;             /* connections made to servers */
+  long reused;                  /* requests sent on kept-alive
+                                   connections */
+  long dns_lookups;             /* host names looked up */
+  long dns_hits;                /* lookups answered by the cache */
+  long tls_handshakes;          /* TLS handshakes completed */
+  long tls_resumed;             /* those that resumed a session */
+};
+
+extern struct counters *counters;
+
+/* Add N to the counter FIELD.  The counters are shared with the
+   workers of --parallel, so the addition is atomic where the compiler
+   can make it so.  */
+#if defined __GNUC__ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+# define COUNTER_ADD(field, n) \
+  ((void) __sync_fetch_and_add (&counters->field, (n)))
+#else
+# define COUNTER_ADD(field, n) ((void) (counters->field += (n)))
+#endif
+
+void counters_init (void);
+void counters_poll (void);
+void counters_request_report (void);
+void counters_finish (void);
+
+#endif /* COUNTERS_H */
@@ -36,6 +36,14 @@ as that of the covered work.  */
   grab those without truly understanding the input.  The only downside
   to this is that we might be coerced into downloading files that
   a browser would ignore.  That might merit some more investigation.
+
+  The scanner used to be a flex-generated tokenizer for the whole of
+  CSS 2.1, which spent most of its time building tokens nobody looked
+  at.  Now we only stop at the few characters that can begin a
+  comment, a string, an escape, a url() token or an @import rule, and
+  skip over everything else.  Tokens are recognized following the
+  CSS 2.1 grammar (http://www.w3.org/TR/CSS21/grammar.html#q2), so
+  url(...) inside comments and strings is correctly ignored.
  */
 
 #include <wget.h>
@@ -47,205 +55,321 @@ as that of the covered work.  */
 # include <strings.h>
 #endif
 #include <stdlib.h>
-#include <ctype.h>
 #include <errno.h>
 
 #include "wget.h"
 #include "utils.h"
+#include "url.h"
 #include "convert.h"
 #include "html-url.h"
-#include "css-tokens.h"
 #include "css-url.h"
+#include "arena.h"
 
-/* from lex.yy.c */
-extern char *yytext;
-extern int yyleng;
-typedef struct yy_buffer_state *YY_BUFFER_STATE;
-extern YY_BUFFER_STATE yy_scan_bytes (const char *bytes,int len  );
-extern int yylex (void);
-
-#if 1
-const char *token_names[] = {
-  "CSSEOF",
-  "S",
-  "CDO",
-  "CDC",
-  "INCLUDES",
-  "DASHMATCH",
-  "LBRACE",
-  "PLUS",
-  "GREATER",
-  "COMMA",
-  "STRING",
-  "INVALID",
-  "IDENT",
-  "HASH",
-  "IMPORT_SYM",
-  "PAGE_SYM",
-  "MEDIA_SYM",
-  "CHARSET_SYM",
-  "IMPORTANT_SYM",
-  "EMS",
-  "EXS",
-  "LENGTH",
-  "ANGLE",
-  "TIME",
-  "FREQ",
-  "DIMENSION",
-  "PERCENTAGE",
-  "NUMBER",
-  "URI",
-  "FUNCTION"
-};
+#ifdef TESTING
+#include "test.h"
 #endif
 
-/*
-  Given a detected URI token, get only the URI specified within.
-  Also adjust the starting position and length of the string.
-
-  A URI can be specified with or without quotes, and the quotes
-  can be single or double quotes.  In addition there can be
-  whitespace after the opening parenthesis and before the closing
-  parenthesis.
-*/
-static char *
-get_uri_string (const char *at, int *pos, int *length)
+/* Whitespace as defined by CSS; note that it doesn't include \v.  */
+#define CSS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' \
+                      || (c) == '\r' || (c) == '\f')
+#define CSS_NEWLINE(c) ((c) == '\n' || (c) == '\r' || (c) == '\f')
+
+/* Characters at which get_urls_css needs to stop and look around:
+   the ones that begin a comment, a string or an escape, the `(' of
+   url( and the `@' of @import.  */
+static const char css_special[256] = {
+  ['/'] = 1, ['"'] = 1, ['\''] = 1, ['\\'] = 1, ['('] = 1, ['@'] = 1
+};
+
+/* Return true if C may appear in a CSS identifier (the "nmchar" of
+   the grammar, not counting escapes).  */
+static inline bool
+css_name_char_p (char c)
 {
-  char *uri;
-  /*char buf[1024];
-  strncpy(buf,at + *pos, *length);
-  buf[*length] = '\0';
-  DEBUGP (("get_uri_string: \"%s\"\n", buf));*/
+  return c_isalnum (c) || c == '-' || c == '_' || (unsigned char) c >= 0x80;
+}
 
-  if (0 != strncasecmp (at + *pos, "url(", 4))
-    return NULL;
+/* Return true if C may appear unescaped in an unquoted url().  */
+static inline bool
+css_url_char_p (char c)
+{
+  unsigned char uc = c;
+  return uc == '!' || (uc >= '#' && uc <= '&') || (uc >= '*' && uc <= '~')
+    || uc >= 0x80;
+}
 
-  *pos += 4;
-  *length -= 5; /* url() */
-  /* skip leading space */
-  while (isspace (at[*pos]))
+static const char *
+skip_css_space (const char *p, const char *end)
+{
+  while (p < end && CSS_SPACE (*p))
+    ++p;
+  return p;
+}
+
+/* P points to the slash that opens a comment.  Return the position
+   after the comment.  An unterminated comment extends to END, as it
+   does in browsers.  */
+static const char *
+skip_css_comment (const char *p, const char *end)
+{
+  p += 2;
+  while (p < end)
     {
-      (*pos)++;
-      if (--(*length) == 0)
-        return NULL;
+      const char *star = memchr (p, '*', end - p);
+      if (!star)
+        break;
+      p = star + 1;
+      if (p < end && *p == '/')
+        return p + 1;
     }
+  return end;
+}
 
-  /* skip trailing space */
-  while (isspace (at[*pos + *length - 1]))
+/* P points to a backslash whose next character is not a newline.
+   Return the position after the escape sequence.  Up to six hex
+   digits (and one whitespace character after them) belong to the
+   escape, anything else is escaped on its own.  */
+static const char *
+skip_css_escape (const char *p, const char *end)
+{
+  int digits = 0;
+  ++p;
+  if (!c_isxdigit (*p))
+    return p + 1;
+  while (p < end && digits < 6 && c_isxdigit (*p))
+    ++p, ++digits;
+  if (end - p >= 2 && p[0] == '\r' && p[1] == '\n')
+    p += 2;
+  else if (p < end && CSS_SPACE (*p))
+    ++p;
+  return p;
+}
+
+/* P points to the opening quote of a string.  Return the position
+   after the closing quote, or NULL if the string is not terminated.
+   In that case *STOP is set to where the broken string ends: at the
+   first unescaped newline or at END, whichever comes first.  */
+static const char *
+skip_css_string (const char *p, const char *end, const char **stop)
+{
+  char quote = *p++;
+  while (p < end)
     {
-      (*length)--;
+      char c = *p;
+      if (c == quote)
+        return p + 1;
+      if (CSS_NEWLINE (c))
+        break;
+      if (c != '\\')
+        ++p;
+      else if (end - p < 2)
+        break;
+      else if (p[1] == '\r' && end - p >= 3 && p[2] == '\n')
+        p += 3;
+      else if (CSS_NEWLINE (p[1]))
+        p += 2;
+      else
+        p = skip_css_escape (p, end);
     }
-  /* trim off quotes */
-  if (at[*pos] == '\'' || at[*pos] == '"')
+  *stop = p;
+  return NULL;
+}
+
+/* P points after the "url(" of what might be a url() token.  If it
+   is one, return the position after its closing parenthesis and set
+   *BEG and *FIN to the URL inside, without the quotes and the
+   surrounding whitespace.  Otherwise return NULL.  */
+static const char *
+skip_css_url (const char *p, const char *end,
+              const char **beg, const char **fin)
+{
+  const char *b, *e;
+
+  p = skip_css_space (p, end);
+  if (p < end && (*p == '"' || *p == '\''))
     {
-      (*pos)++;
-      *length -= 2;
+      const char *stop;
+      b = p + 1;
+      p = skip_css_string (p, end, &stop);
+      if (!p)
+        return NULL;
+      e = p - 1;
     }
-
-  uri = xmalloc (*length + 1);
-  if (uri)
+  else
     {
-      strncpy (uri, at + *pos, *length);
-      uri[*length] = '\0';
+      /* A backslash is a URL character on its own too, so it only
+         has to begin an escape when what follows couldn't otherwise
+         be part of the URL.  That makes "\)" either an escaped
+         parenthesis or the end of the URL.  Prefer the former, but
+         remember the latter in case the URL goes wrong further on.  */
+      const char *fallback = NULL;
+      b = p;
+      while (p < end)
+        {
+          if (*p == '\\' && end - p >= 2 && c_isxdigit (p[1]))
+            p = skip_css_escape (p, end);
+          else if (*p == '\\' && end - p >= 2 && !css_url_char_p (p[1])
+                   && !CSS_NEWLINE (p[1]))
+            {
+              if (p[1] == ')')
+                fallback = p + 1;
+              p += 2;
+            }
+          else if (css_url_char_p (*p))
+            ++p;
+          else
+            break;
+        }
+      /* An escape may have swallowed a space after it.  */
+      e = p;
+      while (e > b && CSS_SPACE (e[-1]))
+        --e;
+      p = skip_css_space (p, end);
+      if ((p == end || *p != ')') && fallback)
+        e = p = fallback;
     }
+  p = skip_css_space (p, end);
+  if (p == end || *p != ')')
+    return NULL;
+  *beg = b;
+  *fin = e;
+  return p + 1;
+}
 
-  return uri;
+/* Return true if the url( at U begins a token of its own, rather
+   than being the tail of an identifier, a number or a #name, which
+   the grammar would not treat as a URL.  START is where the CSS
+   text begins, and NAME_END is where the last escape outside a
+   string ended; an escape begins an identifier.  */
+static bool
+css_url_token_start_p (const char *start, const char *u,
+                       const char *name_end)
+{
+  char prev;
+  if (u == start)
+    return true;
+  if (u == name_end)
+    return false;
+  prev = u[-1];
+  if (prev == '-' && u - start >= 4 && 0 == memcmp (u - 4, "<!--", 4)
+      && !(name_end && name_end > u - 4))
+    return true;
+  return !css_name_char_p (prev) && prev != '#' && prev != '\\';
 }
 
-void
-get_urls_css (struct map_context *ctx, int offset, int buf_length)
+/* Record the URL between B and E, found in an url() token, or in a
+   string if IMPORT_P is true.  */
+static void
+css_found_url (struct map_context *ctx, const char *b, const char *e,
+               bool import_p)
 {
-  int token;
-  /*char tmp[2048];*/
-  int buffer_pos = 0;
-  int pos, length;
+  struct urlpos *up;
   char *uri;
 
-  /*
-  strncpy(tmp,ctx->text + offset, buf_length);
-  tmp[buf_length] = '\0';
-  DEBUGP (("get_urls_css: \"%s\"\n", tmp));
-  */
+  if (b == e)
+    return;
+  uri = strdupdelim (b, e);
+  up = append_url (uri, b - ctx->text, e - b, ctx);
+  DEBUGP (("Found %s: [%s] at %d\n", import_p ? "@import" : "URI", uri,
+           (int) (b - ctx->text)));
+  if (up)
+    {
+      up->link_inline_p = 1;
+      up->link_css_p = 1;
+      if (import_p)
+        up->link_expect_css = 1;
+    }
+  xfree (uri);
+}
 
-  /* tell flex to scan from this buffer */
-  yy_scan_bytes (ctx->text + offset, buf_length);
+void
+get_urls_css (struct map_context *ctx, int offset, int buf_length)
+{
+  const char *start = ctx->text + offset;
+  const char *end = start + buf_length;
+  const char *p = start;
+  const char *name_end = NULL;
 
-  while((token = yylex()) != CSSEOF)
+  while (p < end)
     {
-      /*DEBUGP (("%s ", token_names[token]));*/
-      /* @import "foo.css"
-         or @import url(foo.css)
-      */
-      if(token == IMPORT_SYM)
-        {
-          do {
-            buffer_pos += yyleng;
-          } while((token = yylex()) == S);
+      const char *b, *e, *q;
 
-          /*DEBUGP (("%s ", token_names[token]));*/
+      while (p < end && !css_special[(unsigned char) *p])
+        ++p;
+      if (p == end)
+        break;
 
-          if (token == STRING || token == URI)
+      switch (*p)
+        {
+        case '/':
+          if (end - p >= 2 && p[1] == '*')
+            p = skip_css_comment (p, end);
+          else
+            ++p;
+          break;
+        case '"':
+        case '\'':
+          q = skip_css_string (p, end, &e);
+          p = q ? q : e;
+          break;
+        case '\\':
+          /* Escaped characters never start anything.  */
+          if (end - p >= 2 && !CSS_NEWLINE (p[1]))
+            p = name_end = skip_css_escape (p, end);
+          else
+            ++p;
+          break;
+        case '(':
+          /* background-image: url(foo.png)
+             note that we don't care what
+             property this is actually on.
+          */
+          if (p - start >= 3 && 0 == strncasecmp (p - 3, "url", 3)
+              && css_url_token_start_p (start, p - 3, name_end)
+              && (q = skip_css_url (p + 1, end, &b, &e)) != NULL)
             {
-              /*DEBUGP (("Got URI "));*/
-              pos = buffer_pos + offset;
-              length = yyleng;
-
-              if (token == URI)
-                {
-                  uri = get_uri_string (ctx->text, &pos, &length);
-                }
+              css_found_url (ctx, b, e, false);
+              p = q;
+            }
+          else
+            ++p;
+          break;
+        case '@':
+          /* @import "foo.css"
+             or @import url(foo.css)
+          */
+          if (end - p < 7 || 0 != strncasecmp (p, "@import", 7))
+            {
+              ++p;
+              break;
+            }
+          p += 7;
+          for (;;)
+            {
+              p = skip_css_space (p, end);
+              if (end - p >= 2 && p[0] == '/' && p[1] == '*')
+                p = skip_css_comment (p, end);
               else
-                {
-                  /* cut out quote characters */
-                  pos++;
-                  length -= 2;
-                  uri = xmalloc (length + 1);
-                  strncpy (uri, yytext + 1, length);
-                  uri[length] = '\0';
-                }
-
-              if (uri)
-                {
-                  struct urlpos *up = append_url (uri, pos, length, ctx);
-                  DEBUGP (("Found @import: [%s] at %d [%s]\n", yytext, buffer_pos, uri));
-
-                  if (up)
-                    {
-                      up->link_inline_p = 1;
-                      up->link_css_p = 1;
-                      up->link_expect_css = 1;
-                    }
-
-                  xfree(uri);
-                }
+                break;
             }
-        }
-      /* background-image: url(foo.png)
-         note that we don't care what
-         property this is actually on.
-      */
-      else if(token == URI)
-        {
-          pos = buffer_pos + offset;
-          length = yyleng;
-          uri = get_uri_string (ctx->text, &pos, &length);
-
-          if (uri)
+          if (p < end && (*p == '"' || *p == '\''))
             {
-              struct urlpos *up = append_url (uri, pos, length, ctx);
-              DEBUGP (("Found URI: [%s] at %d [%s]\n", yytext, buffer_pos, uri));
-              if (up)
+              q = skip_css_string (p, end, &e);
+              if (q)
                 {
-                  up->link_inline_p = 1;
-                  up->link_css_p = 1;
+                  css_found_url (ctx, p + 1, q - 1, true);
+                  p = q;
                 }
-
-              xfree (uri);
             }
+          else if (end - p >= 4 && 0 == strncasecmp (p, "url(", 4)
+                   && (q = skip_css_url (p + 4, end, &b, &e)) != NULL)
+            {
+              css_found_url (ctx, b, e, true);
+              p = q;
+            }
+          break;
         }
-      buffer_pos += yyleng;
     }
-  DEBUGP (("\n"));
 }
 
 struct urlpos *
@@ -255,7 +379,7 @@ get_urls_css_file (const char *file, const char *url)
   struct map_context ctx;
 
   /* Load the file. */
-  fm = wget_read_file (file);
+  fm = link_stream_read_file (file);
   if (!fm)
     {
       logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
@@ -264,7 +388,8 @@ get_urls_css_file (const char *file, const char *url)
   DEBUGP (("Loaded %s (size %s).\n", file, number_to_static_string (fm->length)));
 
   ctx.text = fm->content;
-  ctx.head = NULL;
+  ctx.head = ctx.tail = NULL;
+  ctx.arena = arena_new ();
   ctx.base = NULL;
   ctx.parent_base = url ? url : opt.base_href;
   ctx.document_file = file;
@@ -272,5 +397,68 @@ get_urls_css_file (const char *file, const char *url)
 
   get_urls_css (&ctx, 0, fm->length);
   wget_read_file_free (fm);
+  if (!ctx.head)
+    arena_free (ctx.arena);
   return ctx.head;
 }
+
+#ifdef TESTING
+
+const char *
+test_get_urls_css (void)
+{
+  static const struct {
+    const char *css;
+    const char *urls;           /* space-separated, `+' marks @import */
+  } tests[] = {
+    { "@import \"a.css\"; @IMPORT url( 'b.css' ) screen;",
+      "+a.css +b.css" },
+    { "@import/**/url(c.css);", "+c.css" },
+    { "p { background: url(x.png) } q { b: URL( \"y.png\" ) }",
+      "x.png y.png" },
+    { "/* url(no.png) */ a { content: \"url(no.png)\" }", "" },
+    { "a { content: 'it\\'s url(no.png)' } b { c: url(yes.png) }",
+      "yes.png" },
+    { "a { b: myurl(no.png); c: -url(no.png); d: 5url(no.png) }", "" },
+    { "a { b: \"broken\n url(yes.png) }", "yes.png" },
+    { "a { b: url() url( ) url(\n) }", "" },
+    { "<!--url(a.png)-->", "a.png" },
+    { "a { b: url(/* c */) } /* url(d.png)", "" },
+  };
+  size_t i;
+
+  for (i = 0; i < countof (tests); i++)
+    {
+      struct map_context ctx;
+      struct urlpos *up;
+      char *found = NULL;
+
+      xzero (ctx);
+      ctx.text = xstrdup (tests[i].css);
+      ctx.arena = arena_new ();
+      ctx.parent_base = "http://example.com/css/";
+      ctx.document_file = "test.css";
+      get_urls_css (&ctx, 0, strlen (tests[i].css));
+
+      for (up = ctx.head; up; up = up->next)
+        {
+          const char *rel = up->url->url + strlen (ctx.parent_base);
+          char *tmp = aprintf ("%s%s%s%s", found ? found : "",
+                               found ? " " : "",
+                               up->link_expect_css ? "+" : "", rel);
+          xfree_null (found);
+          found = tmp;
+        }
+      mu_assert ("test_get_urls_css: wrong URLs",
+                 !strcmp (found ? found : "", tests[i].urls));
+      xfree_null (found);
+      xfree (ctx.text);
+      if (ctx.head)
+        free_urlpos (ctx.head);
+      else
+        arena_free (ctx.arena);
+    }
+  return NULL;
+}
+
+#endif /* TESTING */
@@ -0,0 +1,368 @@
+/* Running jobs sent over a local socket.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --daemon=SOCKET, Wget listens on the UNIX socket SOCKET and
+   runs the jobs it is sent there one after the other, in a single
+   process.  The caches of DNS lookups, robots.txt files, cookies and
+   TLS sessions, and the persistent connection to the last server, all
+   carry over from one job to the next, as does the work of starting
+   Wget and reading the wgetrc files.
+
+   A client sends each job as lines in the wgetrc syntax, ended by an
+   empty line:
+
+     url = URL
+     COMMAND = VALUE
+
+   Each "url" line names a URL to retrieve as if given on the command
+   line.  The other lines are wgetrc commands, which apply to that job
+   only.  Once the job is done, Wget answers with a line "OK STATUS",
+   STATUS being the exit status it would have exited with, or with
+   "ERROR MESSAGE" if the job could not be run.  A client may send any
+   number of jobs before hanging up.  Clients are served one at a
+   time.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WINDOWS
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif
+
+#include "utils.h"
+#include "init.h"
+#include "exits.h"
+#include "retr.h"
+#include "recur.h"
+#include "url.h"
+#include "convert.h"
+#include "spider.h"
+#include "progress.h"
+#include "connect.h"
+#include "c-ctype.h"
+#include "daemon.h"
+
+#ifndef WINDOWS
+
+/* Seconds between checks for a signal to stop.  */
+#define DAEMON_POLL_INTERVAL 1.0
+
+/* Set by SIGTERM and SIGINT, which stop the daemon once the client
+   being served hangs up.  */
+static volatile sig_atomic_t stopping;
+
+static void
+stop_signal (int sig)
+{
+  stopping = 1;
+}
+
+/* If LINE is "url = VALUE", return VALUE, else NULL.  */
+
+static char *
+job_url (char *line)
+{
+  char *p = line;
+
+  if (strncasecmp (p, "url", 3) != 0)
+    return NULL;
+  for (p += 3; c_isspace (*p); p++)
+    ;
+  if (*p != '=')
+    return NULL;
+  for (++p; c_isspace (*p); p++)
+    ;
+  return p;
+}
+
+/* Apply the dependencies between options that main applies to the
+   options of the command line.  */
+
+static void
+job_fix_options (void)
+{
+  if (opt.noclobber && opt.convert_links)
+    opt.noclobber = false;
+  if (opt.reclevel == 0)
+    opt.reclevel = INFINITE_RECURSION;
+  if (opt.spider || opt.delete_after)
+    opt.no_dirstruct = true;
+  if (opt.page_requisites && !opt.recursive)
+    {
+      opt.reclevel = 0;
+      if (!opt.no_dirstruct)
+        opt.dirstruct = 1;
+    }
+  free_acclists ();
+  compile_acclists ();
+}
+
+/* Retrieve URLS with the options the job has set.  OUTPUT_DOCUMENT is
+   the -O of the daemon, which the job may have replaced.  Returns the
+   exit status of the job.  */
+
+static int
+run_job (char **urls, const char *output_document)
+{
+  FILE *saved_stream = output_stream;
+  bool saved_regular = output_stream_regular;
+  int status;
+  char **u;
+
+  job_fix_options ();
+
+  if (opt.output_document && opt.output_document != output_document)
+    {
+      struct_fstat st;
+
+      output_stream = fopen (opt.output_document,
+                             opt.always_rest ? "ab" : "wb");
+      if (!output_stream)
+        {
+          logprintf (LOG_NOTQUIET, "%s: %s\n", opt.output_document,
+                     strerror (errno));
+          inform_exit_status (FOPENERR);
+          goto out;
+        }
+      output_stream_regular = (fstat (fileno (output_stream), &st) == 0
+                               && S_ISREG (st.st_mode));
+    }
+
+  for (u = urls; u && *u; u++)
+    {
+      char *rewritten = rewrite_shorthand_url (*u);
+      retrieve_from_arg (rewritten ? rewritten : *u);
+      xfree_null (rewritten);
+    }
+  if (opt.input_filename)
+    {
+      int count;
+      inform_exit_status (retrieve_from_file (opt.input_filename,
+                                              opt.force_html, &count));
+      if (!count)
+        logprintf (LOG_NOTQUIET, _("No URLs found in %s.\n"),
+                   opt.input_filename);
+    }
+  progress_job_done ();
+
+  if (opt.recursive && opt.spider)
+    print_broken_links ();
+  if (opt.convert_links && !opt.delete_after)
+    convert_all_links ();
+
+  if (output_stream != saved_stream)
+    fclose (output_stream);
+
+ out:
+  /* Leave nothing of the job behind but the caches.  */
+  convert_cleanup ();
+  spider_cleanup ();
+  output_stream = saved_stream;
+  output_stream_regular = saved_regular;
+  total_downloaded_bytes = 0;
+  status = get_exit_status ();
+  reset_exit_status ();
+  return status;
+}
+
+/* Read jobs from the client connected to SOCK and run them, until the
+   client hangs up.  */
+
+static void
+serve_client (int sock)
+{
+  FILE *in, *out;
+  char *output_document = opt.output_document;
+  char **urls = NULL;
+  char *bad = NULL;
+  bool in_job = false;
+
+  in = fdopen (sock, "r");
+  out = in ? fdopen (dup (sock), "w") : NULL;
+  if (!out)
+    {
+      logprintf (LOG_NOTQUIET, "fdopen: %s\n", strerror (errno));
+      if (in)
+        fclose (in);
+      else
+        close (sock);
+      return;
+    }
+
+  for (;;)
+    {
+      char *line = read_whole_line (in);
+      if (line)
+        {
+          char *end = line + strlen (line);
+          while (end > line && c_isspace (end[-1]))
+            *--end = '\0';
+          if (*line == '#')
+            {
+              xfree (line);
+              continue;
+            }
+        }
+
+      if (line && *line)
+        {
+          char *url;
+          if (!in_job)
+            {
+              job_options_begin ();
+              in_job = true;
+            }
+          if ((url = job_url (line)) != NULL)
+            urls = vec_append (urls, url);
+          else if (!bad && !job_option (line))
+            bad = xstrdup (line);
+          xfree (line);
+          continue;
+        }
+
+      /* An empty line, or the client hanging up, ends the job.  */
+      if (in_job)
+        {
+          if (bad)
+            {
+              logprintf (LOG_NOTQUIET, _("Invalid job command %s.\n"),
+                         quote (bad));
+              fprintf (out, "ERROR invalid command %s\n", bad);
+            }
+          else if (!urls && !opt.input_filename)
+            fprintf (out, "ERROR no URL\n");
+          else
+            fprintf (out, "OK %d\n", run_job (urls, output_document));
+          fflush (out);
+
+          job_options_end ();
+          free_acclists ();
+          compile_acclists ();
+          free_vec (urls);
+          urls = NULL;
+          xfree_null (bad);
+          bad = NULL;
+          in_job = false;
+        }
+      if (!line)
+        break;
+      xfree (line);
+    }
+  fclose (in);
+  fclose (out);
+}
+
+/* Listen on the UNIX socket PATH and run the jobs sent there, until
+   SIGTERM or SIGINT.  Returns false if PATH could not be listened
+   on.  */
+
+bool
+daemon_run (const char *path)
+{
+  struct sockaddr_un addr;
+  struct_stat st;
+  mode_t old_umask;
+  int sock, err;
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      logprintf (LOG_NOTQUIET, _("%s: socket name too long.\n"), path);
+      return false;
+    }
+  xzero (addr);
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+
+  sock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0)
+    {
+      logprintf (LOG_NOTQUIET, "socket: %s\n", strerror (errno));
+      return false;
+    }
+
+  /* Replace the socket left by an earlier daemon, but nothing else.  */
+  if (lstat (path, &st) == 0 && S_ISSOCK (st.st_mode))
+    unlink (path);
+
+  /* Only the user running Wget may send it jobs.  */
+  old_umask = umask (077);
+  err = bind (sock, (struct sockaddr *) &addr, sizeof (addr));
+  umask (old_umask);
+  if (err < 0 || listen (sock, 16) < 0)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", path, strerror (errno));
+      close (sock);
+      return false;
+    }
+
+  signal (SIGTERM, stop_signal);
+  signal (SIGINT, stop_signal);
+  logprintf (LOG_VERBOSE, _("Waiting for jobs on %s.\n"), path);
+
+  while (!stopping)
+    {
+      int client;
+      int ready = select_fd (sock, DAEMON_POLL_INTERVAL, WAIT_FOR_READ);
+      if (ready < 0 && errno != EINTR)
+        {
+          logprintf (LOG_NOTQUIET, "select: %s\n", strerror (errno));
+          break;
+        }
+      if (ready <= 0)
+        continue;
+      client = accept (sock, NULL, NULL);
+      if (client < 0)
+        continue;
+      DEBUGP (("Accepted job connection %d.\n", client));
+      serve_client (client);
+    }
+
+  close (sock);
+  unlink (path);
+  return true;
+}
+
+#else /* WINDOWS */
+
+bool
+daemon_run (const char *path)
+{
+  logputs (LOG_NOTQUIET, _("--daemon is not supported on this system.\n"));
+  return false;
+}
+
+#endif /* WINDOWS */
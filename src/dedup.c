@@ -0,0 +1,287 @@
+/* Sharing the storage of identical downloaded files.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --dedup-files, the SHA-1 digest of every file saved over HTTP
+   is remembered along with the file's name.  A later file with the
+   same contents is made to share the storage of the first: it is
+   reflinked to it where the file system can do that, and hard-linked
+   to it otherwise.
+
+   Hard links share one inode, and hence one time-stamp, and writing
+   into one changes them all.  Link conversion replaces files rather
+   than writing into them, and with this option files are removed
+   before being downloaded again.  A download that is resumed (-c,
+   --start-pos) appends to the file, so with this option dedup_unshare
+   first gives a linked file an inode of its own.  Without it, links
+   are taken to be the user's own and left as they are.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_LINUX_FS_H
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
+
+#include "utils.h"
+#include "hash.h"
+#include "manifest.h"
+#include "dedup.h"
+
+/* What is known of the first file saved with given contents.  If the
+   file no longer matches this, it has been replaced since.  */
+struct dedup_entry {
+  char *file;
+  wgint size;
+  time_t mtime;
+  dev_t dev;
+  ino_t ino;
+};
+
+/* Hex digest -> struct dedup_entry.  */
+static struct hash_table *entries;
+
+static void
+set_entry (struct dedup_entry *e, const char *file, const struct_stat *st)
+{
+  e->file = xstrdup (file);
+  e->size = st->st_size;
+  e->mtime = st->st_mtime;
+  e->dev = st->st_dev;
+  e->ino = st->st_ino;
+}
+
+/* Make FILE share the storage of FIRST, which has the same contents.
+   Returns false if that could not be done.  *REFLINKED tells whether
+   FILE was reflinked rather than hard-linked.  */
+
+static bool
+share_storage (const char *first, const char *file, const struct_stat *st,
+               bool *reflinked)
+{
+  char *tmp;
+
+#ifdef FICLONE
+  {
+    /* A reflink leaves FILE its own inode, so only the time-stamp the
+       clone changes needs restoring.  */
+    int in = open (first, O_RDONLY);
+    if (in >= 0)
+      {
+        int out = open (file, O_WRONLY);
+        bool ok = out >= 0 && ioctl (out, FICLONE, in) == 0;
+        if (out >= 0)
+          close (out);
+        close (in);
+        if (ok)
+          {
+            touch (file, st->st_mtime);
+            *reflinked = true;
+            return true;
+          }
+      }
+  }
+#endif
+
+  /* Link under a temporary name and rename over FILE, so that FILE
+     is never missing.  */
+  tmp = aprintf ("%s.wget-dedup", file);
+  if (link (first, tmp) != 0)
+    {
+      DEBUGP (("link %s -> %s: %s\n", first, tmp, strerror (errno)));
+      xfree (tmp);
+      return false;
+    }
+  if (rename (tmp, file) != 0)
+    {
+      DEBUGP (("rename %s -> %s: %s\n", tmp, file, strerror (errno)));
+      unlink (tmp);
+      xfree (tmp);
+      return false;
+    }
+  xfree (tmp);
+  *reflinked = false;
+  return true;
+}
+
+/* FILE was just saved, and the SHA-1 digest of its contents is
+   DIGEST.  If a file with the same contents was saved before, make
+   FILE share its storage; otherwise remember FILE for the files to
+   come.  */
+
+void
+dedup_file (const char *file, const unsigned char *digest)
+{
+  char key[2 * MANIFEST_DIGEST_SIZE + 1];
+  struct dedup_entry *e;
+  struct_stat st, first_st;
+  bool reflinked;
+  int i;
+
+  if (stat (file, &st) != 0 || !S_ISREG (st.st_mode))
+    return;
+  for (i = 0; i < MANIFEST_DIGEST_SIZE; i++)
+    sprintf (key + 2 * i, "%02x", digest[i]);
+
+  if (!entries)
+    entries = make_string_hash_table (0);
+  e = hash_table_get (entries, key);
+  if (!e)
+    {
+      e = xnew (struct dedup_entry);
+      set_entry (e, file, &st);
+      hash_table_put (entries, xstrdup (key), e);
+      return;
+    }
+  if (0 == strcmp (e->file, file)
+      || (e->dev == st.st_dev && e->ino == st.st_ino))
+    return;
+
+  if (stat (e->file, &first_st) != 0
+      || first_st.st_dev != e->dev || first_st.st_ino != e->ino
+      || first_st.st_size != e->size || first_st.st_mtime != e->mtime
+      || first_st.st_size != st.st_size)
+    {
+      /* The first file is gone or has been replaced; this one takes
+         its place.  */
+      xfree (e->file);
+      set_entry (e, file, &st);
+      return;
+    }
+
+  if (share_storage (e->file, file, &st, &reflinked))
+    logprintf (LOG_VERBOSE,
+               reflinked
+               ? _("%s is identical to %s; reflinked.\n")
+               : _("%s is identical to %s; hard-linked.\n"),
+               quote_n (0, file), quote_n (1, e->file));
+}
+
+/* FILE is about to be appended to.  If --dedup-files is in effect
+   and FILE is hard-linked to other files, replace it with a copy of
+   its own, so that the others are left alone.  Returns false, with
+   errno set, if that could not be done.  */
+
+bool
+dedup_unshare (const char *file)
+{
+  struct_stat st;
+  char *tmp;
+  int in, out = -1;
+  bool ok = false;
+  int saved_errno;
+
+  if (!opt.dedup_files
+      || stat (file, &st) != 0 || !S_ISREG (st.st_mode) || st.st_nlink < 2)
+    return true;
+
+  /* Copy under a temporary name and rename over FILE, so that FILE
+     is never missing or incomplete.  */
+  tmp = aprintf ("%s.wget-dedup", file);
+  in = open (file, O_RDONLY);
+  if (in >= 0)
+    out = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+  if (out >= 0)
+    {
+#ifdef FICLONE
+      ok = ioctl (out, FICLONE, in) == 0;
+#endif
+      if (!ok)
+        {
+          char buf[65536];
+          ssize_t n;
+          ok = true;
+          while (ok && (n = read (in, buf, sizeof buf)) != 0)
+            {
+              char *p = buf;
+              if (n < 0)
+                {
+                  if (errno != EINTR)
+                    ok = false;
+                  continue;
+                }
+              while (n > 0)
+                {
+                  ssize_t w = write (out, p, n);
+                  if (w < 0 && errno == EINTR)
+                    continue;
+                  if (w <= 0)
+                    {
+                      ok = false;
+                      break;
+                    }
+                  p += w;
+                  n -= w;
+                }
+            }
+        }
+      if (close (out) != 0)
+        ok = false;
+      if (ok)
+        touch (tmp, st.st_mtime);
+      ok = ok && rename (tmp, file) == 0;
+    }
+
+  saved_errno = errno;
+  if (in >= 0)
+    close (in);
+  if (out >= 0 && !ok)
+    unlink (tmp);
+  xfree (tmp);
+  if (ok)
+    DEBUGP (("Copied %s, which is linked to other files, before "
+             "appending to it.\n", quote (file)));
+  errno = saved_errno;
+  return ok;
+}
+
+/* Free the table of digests.  */
+
+void
+dedup_cleanup (void)
+{
+  hash_table_iterator iter;
+
+  if (!entries)
+    return;
+  for (hash_table_iterate (entries, &iter); hash_table_iter_next (&iter); )
+    {
+      struct dedup_entry *e = iter.value;
+      xfree (iter.key);
+      xfree (e->file);
+      xfree (e);
+    }
+  hash_table_destroy (entries);
+  entries = NULL;
+}
@@ -0,0 +1,653 @@
+/* Event loop for waiting on many descriptors and timers at once.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* An event loop lets one process wait for any of many descriptors to
+   become ready, and for timeouts, and calls back whoever is
+   interested.  Descriptors are watched with epoll where the system
+   has it, and with poll, or failing that select, elsewhere.
+
+   Timers are kept on a timer wheel: a timer is filed in the slot of
+   the tick in which it expires, modulo the number of slots, so that
+   adding, cancelling and expiring a timer take constant time no
+   matter how many timers there are.  Timers further away than one
+   turn of the wheel stay in their slot for as many turns as needed.
+
+   A transport such as SSL may hold data it has already read from
+   the socket, which the system knows nothing about.  Such
+   descriptors are reported readable without waiting for as long as
+   fd_pending_p says that the transport has data.
+
+   evloop_wait_fd, the single-descriptor case, is what select_fd uses
+   for all the blocking waits in connect.c.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined HAVE_SYS_EPOLL_H && defined HAVE_EPOLL_CREATE
+# define USE_EPOLL
+# include <sys/epoll.h>
+#endif
+#if defined HAVE_POLL_H && defined HAVE_POLL
+# define USE_POLL
+# include <poll.h>
+#else
+# include <sys/time.h>
+# ifdef HAVE_SYS_SELECT_H
+#  include <sys/select.h>
+# endif
+#endif
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
+#include "utils.h"
+#include "connect.h"
+#include "ptimer.h"
+#include "evloop.h"
+
+#ifdef TESTING
+#include "test.h"
+#endif
+
+/* Length of a tick of the timer wheel, in seconds, and the number of
+   slots in it.  One turn takes 2.56 seconds.  */
+#define EVLOOP_TICK 0.01
+#define EVLOOP_SLOTS 256
+
+struct evtimer {
+  struct evtimer *next;		/* next timer in the same list */
+  struct evtimer **pprev;	/* the pointer pointing to this timer */
+  unsigned long expires;	/* the tick in which the timer expires */
+  evloop_timer_fn fn;
+  void *arg;
+};
+
+struct evwatch {
+  int events;			/* WAIT_FOR_* flags, 0 if not watched */
+  evloop_io_fn fn;
+  void *arg;
+};
+
+struct evloop {
+  struct evwatch *watches;	/* indexed by descriptor */
+  int watches_size;		/* number of elements in WATCHES */
+  int maxfd;			/* largest watched descriptor, or -1 */
+
+  struct ptimer *clock;		/* the time since the loop was made */
+  unsigned long tick;		/* the last tick whose timers have run */
+  struct evtimer *wheel[EVLOOP_SLOTS];
+  int ntimers;
+
+#ifdef USE_EPOLL
+  int epfd;			/* the epoll instance, or -1 if epoll
+                                   can't be used */
+  struct epoll_event *epevents;
+  int epevents_size;
+#endif
+#ifdef USE_POLL
+  struct pollfd *pfds;
+  int pfds_size;
+#endif
+};
+
+/* The current tick.  */
+
+static unsigned long
+evloop_now (struct evloop *loop)
+{
+  return (unsigned long) (ptimer_measure (loop->clock) / EVLOOP_TICK);
+}
+
+/* Link the timer T at the head of the list *HEAD.  */
+
+static void
+timer_link (struct evtimer **head, struct evtimer *t)
+{
+  t->next = *head;
+  if (t->next)
+    t->next->pprev = &t->next;
+  t->pprev = head;
+  *head = t;
+}
+
+static void
+timer_unlink (struct evtimer *t)
+{
+  *t->pprev = t->next;
+  if (t->next)
+    t->next->pprev = t->pprev;
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+/* Create a new event loop.  */
+
+struct evloop *
+evloop_new (void)
+{
+  struct evloop *loop = xnew0 (struct evloop);
+  loop->maxfd = -1;
+  loop->clock = ptimer_new ();
+#ifdef USE_EPOLL
+  loop->epfd = epoll_create (64);
+  if (loop->epfd < 0)
+    DEBUGP (("epoll_create: %s; falling back to %s.\n", strerror (errno),
+# ifdef USE_POLL
+             "poll"
+# else
+             "select"
+# endif
+             ));
+#endif
+  return loop;
+}
+
+/* Destroy LOOP.  The watched descriptors are not closed, and the
+   pending timers are freed without being called.  */
+
+void
+evloop_delete (struct evloop *loop)
+{
+  int i;
+  for (i = 0; i < EVLOOP_SLOTS; i++)
+    while (loop->wheel[i])
+      {
+        struct evtimer *t = loop->wheel[i];
+        timer_unlink (t);
+        xfree (t);
+      }
+#ifdef USE_EPOLL
+  if (loop->epfd >= 0)
+    close (loop->epfd);
+  xfree_null (loop->epevents);
+#endif
+#ifdef USE_POLL
+  xfree_null (loop->pfds);
+#endif
+  xfree_null (loop->watches);
+  ptimer_destroy (loop->clock);
+  xfree (loop);
+}
+
+/* Return the name of the mechanism LOOP waits with, for debug
+   output.  */
+
+const char *
+evloop_backend (const struct evloop *loop)
+{
+#ifdef USE_EPOLL
+  if (loop->epfd >= 0)
+    return "epoll";
+#endif
+#ifdef USE_POLL
+  return "poll";
+#else
+  return "select";
+#endif
+}
+
+/* Call FN with ARG when FD becomes ready for any of EVENTS, a
+   combination of WAIT_FOR_READ and WAIT_FOR_WRITE.  Watching a
+   descriptor again replaces the previous interest.  FN stays
+   registered until evloop_unwatch is called.  Returns false if FD
+   can't be watched.  */
+
+bool
+evloop_watch (struct evloop *loop, int fd, int events,
+              evloop_io_fn fn, void *arg)
+{
+  struct evwatch *w;
+
+  if (fd < 0 || !events)
+    return false;
+#if !defined USE_POLL
+  if (fd >= FD_SETSIZE
+# ifdef USE_EPOLL
+      && loop->epfd < 0
+# endif
+      )
+    return false;
+#endif
+
+  if (fd >= loop->watches_size)
+    {
+      int old = loop->watches_size;
+      loop->watches_size = 2 * old > fd ? 2 * old : fd + 1;
+      loop->watches = xrealloc (loop->watches,
+                                loop->watches_size * sizeof *loop->watches);
+      memset (loop->watches + old, 0,
+              (loop->watches_size - old) * sizeof *loop->watches);
+    }
+  w = &loop->watches[fd];
+
+#ifdef USE_EPOLL
+  if (loop->epfd >= 0)
+    {
+      struct epoll_event ev;
+      xzero (ev);
+      ev.events = ((events & WAIT_FOR_READ ? EPOLLIN : 0)
+                   | (events & WAIT_FOR_WRITE ? EPOLLOUT : 0));
+      ev.data.fd = fd;
+      if (epoll_ctl (loop->epfd, w->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                     fd, &ev) < 0)
+        {
+          DEBUGP (("epoll_ctl on fd %d: %s\n", fd, strerror (errno)));
+          return false;
+        }
+    }
+#endif
+
+  w->events = events;
+  w->fn = fn;
+  w->arg = arg;
+  if (fd > loop->maxfd)
+    loop->maxfd = fd;
+  return true;
+}
+
+/* Stop watching FD.  This must be done before FD is closed.  */
+
+void
+evloop_unwatch (struct evloop *loop, int fd)
+{
+  if (fd < 0 || fd >= loop->watches_size || !loop->watches[fd].events)
+    return;
+#ifdef USE_EPOLL
+  if (loop->epfd >= 0)
+    {
+      struct epoll_event ev;
+      xzero (ev);
+      epoll_ctl (loop->epfd, EPOLL_CTL_DEL, fd, &ev);
+    }
+#endif
+  xzero (loop->watches[fd]);
+  while (loop->maxfd >= 0 && !loop->watches[loop->maxfd].events)
+    --loop->maxfd;
+}
+
+/* Call FN with ARG once, SECONDS from now.  The returned timer can be
+   passed to evloop_timer_cancel until it has expired; it is freed
+   after FN returns.  */
+
+struct evtimer *
+evloop_timer_add (struct evloop *loop, double seconds,
+                  evloop_timer_fn fn, void *arg)
+{
+  struct evtimer *t = xnew0 (struct evtimer);
+  unsigned long ticks;
+
+  if (seconds < 0)
+    seconds = 0;
+  /* Round up, so that a timer never runs early.  */
+  ticks = (unsigned long) (seconds / EVLOOP_TICK);
+  if (ticks * EVLOOP_TICK < seconds)
+    ++ticks;
+  if (!ticks)
+    ticks = 1;
+
+  /* Bring the wheel up to date, so that T isn't filed behind its
+     position.  */
+  if (!loop->ntimers)
+    loop->tick = evloop_now (loop);
+
+  t->expires = evloop_now (loop) + ticks;
+  t->fn = fn;
+  t->arg = arg;
+  timer_link (&loop->wheel[t->expires % EVLOOP_SLOTS], t);
+  ++loop->ntimers;
+  return t;
+}
+
+/* Cancel the timer T before it expires.  */
+
+void
+evloop_timer_cancel (struct evloop *loop, struct evtimer *t)
+{
+  timer_unlink (t);
+  --loop->ntimers;
+  xfree (t);
+}
+
+/* Run the timers that have expired.  Returns the number of timers
+   run.  */
+
+static int
+run_timers (struct evloop *loop)
+{
+  unsigned long now = evloop_now (loop);
+  struct evtimer *due = NULL;
+  int count = 0;
+
+  if (!loop->ntimers)
+    {
+      loop->tick = now;
+      return 0;
+    }
+
+  /* Collect the timers first, so that the callbacks are free to add
+     and cancel timers.  Past one turn, every slot has been visited.  */
+  if (now - loop->tick > EVLOOP_SLOTS)
+    loop->tick = now - EVLOOP_SLOTS;
+  while (loop->tick < now)
+    {
+      struct evtimer *t, *next;
+      ++loop->tick;
+      for (t = loop->wheel[loop->tick % EVLOOP_SLOTS]; t; t = next)
+        {
+          next = t->next;
+          if (t->expires <= now)
+            {
+              timer_unlink (t);
+              timer_link (&due, t);
+            }
+        }
+    }
+
+  while (due)
+    {
+      struct evtimer *t = due;
+      timer_unlink (t);
+      --loop->ntimers;
+      ++count;
+      t->fn (t->arg);
+      xfree (t);
+    }
+  return count;
+}
+
+/* Return the number of seconds until the next timer expires, or -1 if
+   there are no timers.  */
+
+static double
+next_timeout (struct evloop *loop)
+{
+  unsigned long now = evloop_now (loop), i;
+  unsigned long best = 0;
+  bool found = false;
+
+  if (!loop->ntimers)
+    return -1;
+
+  /* The first slot holding a timer that expires during this turn
+     decides; otherwise the earliest of the later ones does.  */
+  for (i = 1; i <= EVLOOP_SLOTS; i++)
+    {
+      struct evtimer *t;
+      for (t = loop->wheel[(loop->tick + i) % EVLOOP_SLOTS]; t; t = t->next)
+        if (!found || t->expires < best)
+          {
+            best = t->expires;
+            found = true;
+          }
+      if (found && best <= loop->tick + i)
+        break;
+    }
+  if (best <= now)
+    return 0;
+  return (best - now) * EVLOOP_TICK;
+}
+
+/* Dispatch the events of watched descriptor FD that are among
+   READY.  */
+
+static void
+dispatch (struct evloop *loop, int fd, int ready)
+{
+  struct evwatch *w;
+  if (fd < 0 || fd >= loop->watches_size)
+    return;
+  w = &loop->watches[fd];
+  ready &= w->events;
+  if (ready)
+    w->fn (fd, ready, w->arg);
+}
+
+/* Wait until a watched descriptor is ready or a timer expires, but no
+   longer than MAXTIME seconds (forever if MAXTIME is negative), and
+   run the callbacks.  Returns the number of callbacks run, 0 if
+   nothing happened in MAXTIME, and -1 on error.  */
+
+int
+evloop_run_once (struct evloop *loop, double maxtime)
+{
+  double timeout = next_timeout (loop);
+  int count = 0, nready, fd;
+
+  if (timeout < 0 || (maxtime >= 0 && maxtime < timeout))
+    timeout = maxtime;
+  if (timeout < 0 && loop->maxfd < 0)
+    /* Nothing could ever wake us up.  */
+    return -1;
+
+  /* Data buffered by transports is there without waiting.  */
+  for (fd = 0; fd <= loop->maxfd; fd++)
+    if ((loop->watches[fd].events & WAIT_FOR_READ) && fd_pending_p (fd))
+      {
+        dispatch (loop, fd, WAIT_FOR_READ);
+        ++count;
+      }
+  if (count)
+    return count + run_timers (loop);
+
+#ifdef USE_EPOLL
+  if (loop->epfd >= 0)
+    {
+      int i, nwatched = 1;
+      for (fd = 0; fd <= loop->maxfd; fd++)
+        if (loop->watches[fd].events)
+          ++nwatched;
+      DO_REALLOC (loop->epevents, loop->epevents_size, nwatched,
+                  struct epoll_event);
+      do
+        nready = epoll_wait (loop->epfd, loop->epevents, nwatched,
+                             timeout < 0 ? -1 : (int) (timeout * 1000 + 0.999));
+      while (nready < 0 && errno == EINTR);
+      if (nready < 0)
+        return -1;
+      for (i = 0; i < nready; i++)
+        {
+          struct epoll_event *ev = &loop->epevents[i];
+          int ready = 0;
+          if (ev->events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            ready |= WAIT_FOR_READ;
+          if (ev->events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            ready |= WAIT_FOR_WRITE;
+          dispatch (loop, ev->data.fd, ready);
+        }
+      return nready + run_timers (loop);
+    }
+#endif
+
+#ifdef USE_POLL
+  {
+    int i, n = 0;
+    DO_REALLOC (loop->pfds, loop->pfds_size, loop->maxfd + 1, struct pollfd);
+    for (fd = 0; fd <= loop->maxfd; fd++)
+      {
+        int events = loop->watches[fd].events;
+        if (!events)
+          continue;
+        loop->pfds[n].fd = fd;
+        loop->pfds[n].events = ((events & WAIT_FOR_READ ? POLLIN : 0)
+                                | (events & WAIT_FOR_WRITE ? POLLOUT : 0));
+        loop->pfds[n].revents = 0;
+        ++n;
+      }
+    do
+      nready = poll (loop->pfds, n,
+                     timeout < 0 ? -1 : (int) (timeout * 1000 + 0.999));
+    while (nready < 0 && errno == EINTR);
+    if (nready < 0)
+      return -1;
+    for (i = 0; i < n && nready > 0; i++)
+      {
+        short re = loop->pfds[i].revents;
+        int ready = 0;
+        if (re & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+          ready |= WAIT_FOR_READ;
+        if (re & (POLLOUT | POLLHUP | POLLERR | POLLNVAL))
+          ready |= WAIT_FOR_WRITE;
+        if (ready)
+          {
+            dispatch (loop, loop->pfds[i].fd, ready);
+            ++count;
+          }
+      }
+  }
+#else /* not USE_POLL */
+  {
+    fd_set rd, wr;
+    struct timeval tv, *tvp = NULL;
+    FD_ZERO (&rd);
+    FD_ZERO (&wr);
+    for (fd = 0; fd <= loop->maxfd; fd++)
+      {
+        if (loop->watches[fd].events & WAIT_FOR_READ)
+          FD_SET (fd, &rd);
+        if (loop->watches[fd].events & WAIT_FOR_WRITE)
+          FD_SET (fd, &wr);
+      }
+    if (timeout >= 0)
+      {
+        tv.tv_sec = (long) timeout;
+        tv.tv_usec = 1000000 * (timeout - (long) timeout);
+        tvp = &tv;
+      }
+    do
+      nready = select (loop->maxfd + 1, &rd, &wr, NULL, tvp);
+    while (nready < 0 && errno == EINTR);
+    if (nready < 0)
+      return -1;
+    for (fd = 0; fd <= loop->maxfd && nready > 0; fd++)
+      {
+        int ready = ((FD_ISSET (fd, &rd) ? WAIT_FOR_READ : 0)
+                     | (FD_ISSET (fd, &wr) ? WAIT_FOR_WRITE : 0));
+        if (ready)
+          {
+            dispatch (loop, fd, ready);
+            ++count;
+          }
+      }
+  }
+#endif /* not USE_POLL */
+
+  return count + run_timers (loop);
+}
+
+/* Wait for FD to become ready for WAIT_FOR, a combination of
+   WAIT_FOR_READ and WAIT_FOR_WRITE, for at most MAXTIME seconds.  A
+   MAXTIME of zero only checks whether FD is ready.  Returns 1 if FD is
+   ready, 0 on timeout and -1 on error, like select.  */
+
+int
+evloop_wait_fd (int fd, int wait_for, double maxtime)
+{
+  int result;
+#ifdef USE_POLL
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = ((wait_for & WAIT_FOR_READ ? POLLIN : 0)
+                | (wait_for & WAIT_FOR_WRITE ? POLLOUT : 0));
+  do
+    {
+      pfd.revents = 0;
+      result = poll (&pfd, 1, (int) (maxtime * 1000 + 0.999));
+    }
+  while (result < 0 && errno == EINTR);
+  if (result > 0 && (pfd.revents & POLLNVAL))
+    {
+      errno = EBADF;
+      result = -1;
+    }
+#else /* not USE_POLL */
+  fd_set fdset;
+  fd_set *rd = NULL, *wr = NULL;
+  struct timeval tmout;
+
+  FD_ZERO (&fdset);
+  FD_SET (fd, &fdset);
+  if (wait_for & WAIT_FOR_READ)
+    rd = &fdset;
+  if (wait_for & WAIT_FOR_WRITE)
+    wr = &fdset;
+
+  tmout.tv_sec = (long) maxtime;
+  tmout.tv_usec = 1000000 * (maxtime - (long) maxtime);
+
+  do
+    result = select (fd + 1, rd, wr, NULL, &tmout);
+  while (result < 0 && errno == EINTR);
+#endif /* not USE_POLL */
+  return result;
+}
+
+#ifdef TESTING
+
+static int timer_order[4];
+static int timer_fired;
+
+static void
+test_timer_fn (void *arg)
+{
+  timer_order[timer_fired++] = (int) (intptr_t) arg;
+}
+
+const char *
+test_evloop_timers (void)
+{
+  struct evloop *loop = evloop_new ();
+  struct evtimer *cancelled;
+  int i;
+
+  timer_fired = 0;
+  evloop_timer_add (loop, 0.05, test_timer_fn, (void *) 2);
+  evloop_timer_add (loop, 0.01, test_timer_fn, (void *) 1);
+  cancelled = evloop_timer_add (loop, 0.02, test_timer_fn, (void *) 9);
+  evloop_timer_add (loop, 2.7, test_timer_fn, (void *) 3);
+  evloop_timer_cancel (loop, cancelled);
+
+  for (i = 0; i < 1000 && timer_fired < 3; i++)
+    mu_assert ("evloop_run_once failed", evloop_run_once (loop, -1) >= 0);
+  evloop_delete (loop);
+
+  mu_assert ("wrong number of timers run", timer_fired == 3);
+  mu_assert ("timers run out of order",
+             timer_order[0] == 1 && timer_order[1] == 2
+             && timer_order[2] == 3);
+  return NULL;
+}
+
+#endif /* TESTING */
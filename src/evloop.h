@@ -0,0 +1,57 @@
+/* Declarations for evloop.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+struct evloop;			/* forward declarations; all struct */
+struct evtimer;			/* members are private */
+
+/* Descriptors are watched for the WAIT_FOR_READ and WAIT_FOR_WRITE
+   events of connect.h.  An I/O callback gets the descriptor and the
+   events it is ready for.  */
+typedef void (*evloop_io_fn) (int, int, void *);
+typedef void (*evloop_timer_fn) (void *);
+
+struct evloop *evloop_new (void);
+void evloop_delete (struct evloop *);
+const char *evloop_backend (const struct evloop *);
+
+bool evloop_watch (struct evloop *, int, int, evloop_io_fn, void *);
+void evloop_unwatch (struct evloop *, int);
+
+struct evtimer *evloop_timer_add (struct evloop *, double,
+                                  evloop_timer_fn, void *);
+void evloop_timer_cancel (struct evloop *, struct evtimer *);
+
+int evloop_run_once (struct evloop *, double);
+
+int evloop_wait_fd (int, int, double);
+
+#endif /* EVLOOP_H */
@@ -55,7 +55,7 @@ get_status_for_err (uerr_t err)
 {
   switch (err)
     {
-    case RETROK:
+    case RETROK: case RETRYLATER:
       return WGET_EXIT_SUCCESS;
     case FOPENERR: case FOPEN_EXCL_ERR: case FWRITEERR: case WRITEFAILED:
     case UNLINKERR: case CLOSEFAILED:
@@ -100,6 +100,14 @@ inform_exit_status (uerr_t err)
     }
 }
 
+/* Forget the problems informed of so far, for the next job of
+   --daemon to have a status of its own.  */
+void
+reset_exit_status (void)
+{
+  final_exit_status = WGET_EXIT_SUCCESS;
+}
+
 int
 get_exit_status (void)
 {
@@ -26,5 +26,7 @@ void inform_exit_status (uerr_t err);
 
 int get_exit_status (void);
 
+void reset_exit_status (void);
+
 
 #endif /* WGET_EXITS_H */
@@ -958,24 +958,31 @@ ftp_retr (int csock, const char *file)
 }
 
 /* Sends the LIST command to the server.  If FILE is NULL, send just
-   `LIST' (no space).  */
+   `LIST' (no space).  If *MLSD is true, the machine-readable MLSD
+   listing of RFC 3659 is asked for first; *MLSD is then set to
+   whether the server agreed to send it.  */
 uerr_t
-ftp_list (int csock, const char *file, enum stype rs)
+ftp_list (int csock, const char *file, enum stype rs, bool *mlsd)
 {
   char *request, *respline;
   int nwritten;
   uerr_t err;
   bool ok = false;
   size_t i = 0;
-  /* Try `LIST -a' first and revert to `LIST' in case of failure.  */
-  const char *list_commands[] = { "LIST -a",
+  /* Try `MLSD' and `LIST -a' first and revert to `LIST' in case of
+     failure.  */
+  const char *list_commands[] = { "MLSD",
+                                  "LIST -a",
                                   "LIST" };
 
+  if (!*mlsd)
+    i = 1;
+
   /* 2008-01-29  SMS.  For a VMS FTP server, where "LIST -a" may not
      fail, but will never do what is desired here, skip directly to the
      simple "LIST" command (assumed to be the last one in the list).
   */
-  if (rs == ST_VMS)
+  if (rs == ST_VMS && i > 0)
     i = countof (list_commands)- 1;
 
   do {
@@ -1000,6 +1007,7 @@ ftp_list (int csock, const char *file, enum stype rs)
           {
             err = FTPOK;
             ok = true;
+            *mlsd = (i == 0);
           }
         else
           {
@@ -1008,8 +1016,13 @@ ftp_list (int csock, const char *file, enum stype rs)
         xfree (respline);
       }
     ++i;
+    /* MLSD was refused; VMS servers go on with the plain `LIST'.  */
+    if (i == 1 && rs == ST_VMS)
+      i = countof (list_commands)- 1;
   } while (i < countof (list_commands) && !ok);
 
+  if (!ok)
+    *mlsd = false;
   return err;
 }
 
@@ -81,6 +81,62 @@ clean_line(char *line)
   return len;
 }
 
+/* A listing file being parsed.  The whole file is read into memory
+   once, and its lines are split in place, so that the parsers below
+   neither allocate nor copy anything per line.  */
+struct listing {
+  struct file_memory *fm;
+  char *pos, *end;
+  char *tail;                   /* copy of an unterminated last line */
+};
+
+/* Load FILE into LS.  Returns false (and logs why) on failure.  */
+static bool
+listing_open (struct listing *ls, const char *file)
+{
+  ls->fm = wget_read_file (file);
+  if (!ls->fm)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      return false;
+    }
+  ls->pos = ls->fm->content;
+  ls->end = ls->pos + ls->fm->length;
+  ls->tail = NULL;
+  return true;
+}
+
+/* Return the next line of LS, without its terminating newline, or
+   NULL at the end of the listing.  The line may be modified by the
+   caller, and stays valid until the listing is closed.  */
+static char *
+listing_next_line (struct listing *ls)
+{
+  char *line = ls->pos, *nl;
+
+  if (line >= ls->end)
+    return NULL;
+  nl = memchr (line, '\n', ls->end - line);
+  if (nl)
+    {
+      *nl = '\0';
+      ls->pos = nl + 1;
+      return line;
+    }
+  /* The last line has no newline, and there is no room to terminate
+     it in place.  */
+  ls->pos = ls->end;
+  ls->tail = strdupdelim (line, ls->end);
+  return ls->tail;
+}
+
+static void
+listing_close (struct listing *ls)
+{
+  xfree_null (ls->tail);
+  wget_read_file_free (ls->fm);
+}
+
 /* Convert the Un*x-ish style directory listing stored in FILE to a
    linked list of fileinfo (system-independent) entries.  The contents
    of FILE are considered to be produced by the standard Unix `ls -la'
@@ -90,9 +146,8 @@ clean_line(char *line)
    The time stamps are stored in a separate variable, time_t
    compatible (I hope).  The timezones are ignored.  */
 static struct fileinfo *
-ftp_parse_unix_ls (const char *file, int ignore_perms)
+ftp_parse_unix_ls (struct listing *ls, int ignore_perms)
 {
-  FILE *fp;
   static const char *months[] = {
     "Jan", "Feb", "Mar", "Apr", "May", "Jun",
     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
@@ -106,31 +161,23 @@ ftp_parse_unix_ls (const char *file, int ignore_perms)
   char *line, *tok, *ptok;      /* tokenizer */
   struct fileinfo *dir, *l, cur; /* list creation */
 
-  fp = fopen (file, "rb");
-  if (!fp)
-    {
-      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
-      return NULL;
-    }
   dir = l = NULL;
 
+  /* Get the current time, for the year guess below.  */
+  timenow = time (NULL);
+  tnow = localtime (&timenow);
+
   /* Line loop to end of file: */
-  while ((line = read_whole_line (fp)) != NULL)
+  while ((line = listing_next_line (ls)) != NULL)
     {
       len = clean_line (line);
       /* Skip if total...  */
       if (!strncasecmp (line, "total", 5))
-        {
-          xfree (line);
-          continue;
-        }
+        continue;
       /* Get the first token (permissions).  */
       tok = strtok (line, " ");
       if (!tok)
-        {
-          xfree (line);
-          continue;
-        }
+        continue;
 
       cur.name = NULL;
       cur.linkto = NULL;
@@ -368,7 +415,6 @@ ftp_parse_unix_ls (const char *file, int ignore_perms)
           DEBUGP (("Skipping.\n"));
           xfree_null (cur.name);
           xfree_null (cur.linkto);
-          xfree (line);
           continue;
         }
 
@@ -386,9 +432,6 @@ ftp_parse_unix_ls (const char *file, int ignore_perms)
           memcpy (l, &cur, sizeof (cur));
           l->next = NULL;
         }
-      /* Get the current time.  */
-      timenow = time (NULL);
-      tnow = localtime (&timenow);
       /* Build the time-stamp (the idea by zaga@fly.cc.fer.hr).  */
       timestruct.tm_sec   = sec;
       timestruct.tm_min   = min;
@@ -416,18 +459,14 @@ ftp_parse_unix_ls (const char *file, int ignore_perms)
       timestruct.tm_isdst = -1;
       l->tstamp = mktime (&timestruct); /* store the time-stamp */
       l->ptype = ptype;
-
-      xfree (line);
     }
 
-  fclose (fp);
   return dir;
 }
 
 static struct fileinfo *
-ftp_parse_winnt_ls (const char *file)
+ftp_parse_winnt_ls (struct listing *ls)
 {
-  FILE *fp;
   int len;
   int year, month, day;         /* for time analysis */
   int hour, min;
@@ -437,16 +476,10 @@ ftp_parse_winnt_ls (const char *file)
   char *filename;
   struct fileinfo *dir, *l, cur; /* list creation */
 
-  fp = fopen (file, "rb");
-  if (!fp)
-    {
-      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
-      return NULL;
-    }
   dir = l = NULL;
 
   /* Line loop to end of file: */
-  while ((line = read_whole_line (fp)) != NULL)
+  while ((line = listing_next_line (ls)) != NULL)
     {
       len = clean_line (line);
 
@@ -566,10 +599,9 @@ ftp_parse_winnt_ls (const char *file)
         }
 
 continue_loop:
-      xfree (line);
+      ;
     }
 
-  fclose(fp);
   return dir;
 }
 
@@ -684,9 +716,8 @@ static void eat_carets( char *str)
 
 
 static struct fileinfo *
-ftp_parse_vms_ls (const char *file)
+ftp_parse_vms_ls (struct listing *ls)
 {
-  FILE *fp;
   int dt, i, j, len;
   int perms;
   time_t timenow;
@@ -696,12 +727,6 @@ ftp_parse_vms_ls (const char *file)
   char *line, *tok;		 /* tokenizer */
   struct fileinfo *dir, *l, cur; /* list creation */
 
-  fp = fopen (file, "r");
-  if (!fp)
-    {
-      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
-      return NULL;
-    }
   dir = l = NULL;
 
   /* Skip blank lines, Directory heading, and more blank lines. */
@@ -709,7 +734,7 @@ ftp_parse_vms_ls (const char *file)
   j = 0; /* Expecting initial blank line(s). */
   while (1)
     {
-      line = read_whole_line (fp);
+      line = listing_next_line (ls);
       if (line == NULL)
         {
         break;
@@ -718,10 +743,7 @@ ftp_parse_vms_ls (const char *file)
         {
           i = clean_line (line);
           if (i <= 0)
-            {
-              xfree (line); /* Free useless line storage. */
-              continue; /* Blank line.  Keep looking. */
-            }
+            continue; /* Blank line.  Keep looking. */
           else
             {
               if ((j == 0) && (line[ i- 1] == ']'))
@@ -736,7 +758,6 @@ ftp_parse_vms_ls (const char *file)
                   /* Found "Total of ..." footing line.  No valid data
                      will follow (empty directory).
                   */
-                  xfree (line); /* Free useless line storage. */
                   line = NULL; /* Arrange for early exit. */
                   break;
                 }
@@ -745,7 +766,6 @@ ftp_parse_vms_ls (const char *file)
                   break; /* Must be significant data. */
                 }
             }
-          xfree (line); /* Free useless line storage. */
         }
     }
 
@@ -842,8 +862,7 @@ ftp_parse_vms_ls (const char *file)
       if (tok == NULL)
         {
           DEBUGP (("Getting additional line.\n"));
-          xfree (line);
-          line = read_whole_line (fp);
+          line = listing_next_line (ls);
           if (!line)
             {
               DEBUGP (("EOF.  Leaving listing parser.\n"));
@@ -857,7 +876,6 @@ ftp_parse_vms_ls (const char *file)
             {
               /* Blank line.  End of significant file listing. */
               DEBUGP (("Blank line.  Leaving listing parser.\n"));
-              xfree (line); /* Free useless line storage. */
               break;
             }
           else if (line[ 0] != ' ')
@@ -872,7 +890,6 @@ ftp_parse_vms_ls (const char *file)
                 {
                   /* Unexpected non-empty but apparently blank line. */
                   DEBUGP (("Null token.  Leaving listing parser.\n"));
-                  xfree (line); /* Free useless line storage. */
                   break;
                 }
             }
@@ -1015,22 +1032,168 @@ ftp_parse_vms_ls (const char *file)
           l->next = NULL;
         }
 
-      /* Free old line storage.  Read a new line. */
-      xfree (line);
-      line = read_whole_line (fp);
+      /* Read a new line. */
+      line = listing_next_line (ls);
       if (line != NULL)
         {
           i = clean_line (line);
           if (i <= 0)
-	    {
-              /* Blank line.  End of significant file listing. */
-              xfree (line); /* Free useless line storage. */
-	      break;
-	    }
+            break; /* Blank line.  End of significant file listing. */
         }
     }
 
-  fclose (fp);
+  return dir;
+}
+
+
+/* Returns the value of the N decimal digits at S.  */
+static int
+mlsd_number (const char *s, int n)
+{
+  int value = 0;
+  while (n--)
+    value = 10 * value + (*s++ - '0');
+  return value;
+}
+
+/* Converts the MLSD time value YYYYMMDDHHMMSS[.sss] between BEG and
+   END, which is in UTC, to time_t.  Returns -1 if it is invalid.  */
+static time_t
+mlsd_time (const char *beg, const char *end)
+{
+  struct tm t;
+  int i;
+
+  if (end - beg < 14)
+    return -1;
+  for (i = 0; i < 14; i++)
+    if (!c_isdigit (beg[i]))
+      return -1;
+
+  xzero (t);
+  t.tm_year = mlsd_number (beg, 4) - 1900;
+  t.tm_mon = mlsd_number (beg + 4, 2) - 1;
+  t.tm_mday = mlsd_number (beg + 6, 2);
+  t.tm_hour = mlsd_number (beg + 8, 2);
+  t.tm_min = mlsd_number (beg + 10, 2);
+  t.tm_sec = mlsd_number (beg + 12, 2);
+  return timegm (&t);
+}
+
+/* Convert the MLSD listing (RFC 3659) stored in FILE to a linked list
+   of fileinfo entries.  Unlike the `ls' formats, every line is made
+   of "fact=value;" pairs, a space and the file name, so the listing
+   is parsed right in the memory it is read into.  The sizes and the
+   time-stamps (which are in UTC) are exact.  */
+struct fileinfo *
+ftp_parse_mlsd (const char *file)
+{
+  struct file_memory *fm;
+  const char *p, *end;
+  struct fileinfo *dir, *l, cur;
+
+  fm = wget_read_file (file);
+  if (!fm)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      return NULL;
+    }
+  dir = l = NULL;
+
+  p = fm->content;
+  end = p + fm->length;
+  while (p < end)
+    {
+      const char *line = p, *line_end, *facts_end, *fact;
+      bool skip = false;
+
+      line_end = memchr (line, '\n', end - line);
+      if (line_end)
+        p = line_end + 1;
+      else
+        p = line_end = end;
+      if (line_end > line && line_end[-1] == '\r')
+        --line_end;
+
+      /* The facts end at the first space, and the name follows.  */
+      facts_end = memchr (line, ' ', line_end - line);
+      if (!facts_end || facts_end + 1 == line_end)
+        continue;
+
+      xzero (cur);
+      cur.type = FT_UNKNOWN;
+      cur.tstamp = -1;
+      cur.ptype = TT_HOUR_MIN;
+
+      for (fact = line; fact < facts_end; fact++)
+        {
+          const char *fact_end, *val;
+
+          fact_end = memchr (fact, ';', facts_end - fact);
+          if (!fact_end)
+            fact_end = facts_end;
+          val = memchr (fact, '=', fact_end - fact);
+          if (!val)
+            {
+              fact = fact_end;
+              continue;
+            }
+
+          if (BOUNDED_EQUAL_NO_CASE (fact, val, "type"))
+            {
+              ++val;
+              if (BOUNDED_EQUAL_NO_CASE (val, fact_end, "file"))
+                cur.type = FT_PLAINFILE;
+              else if (BOUNDED_EQUAL_NO_CASE (val, fact_end, "dir"))
+                cur.type = FT_DIRECTORY;
+              else if (BOUNDED_EQUAL_NO_CASE (val, fact_end, "cdir")
+                       || BOUNDED_EQUAL_NO_CASE (val, fact_end, "pdir"))
+                skip = true;
+              else if (BOUNDED_EQUAL_NO_CASE (val, fact_end, "OS.unix=symlink"))
+                cur.type = FT_SYMLINK;
+              else if (fact_end - val > 14
+                       && !strncasecmp (val, "OS.unix=slink:", 14))
+                {
+                  cur.type = FT_SYMLINK;
+                  xfree_null (cur.linkto);
+                  cur.linkto = strdupdelim (val + 14, fact_end);
+                }
+            }
+          else if (BOUNDED_EQUAL_NO_CASE (fact, val, "size"))
+            cur.size = str_to_wgint (val + 1, NULL, 10);
+          else if (BOUNDED_EQUAL_NO_CASE (fact, val, "modify"))
+            cur.tstamp = mlsd_time (val + 1, fact_end);
+          else if (BOUNDED_EQUAL_NO_CASE (fact, val, "unix.mode"))
+            cur.perms = strtol (val + 1, NULL, 8) & 0777;
+          fact = fact_end;
+        }
+
+      if (skip)
+        {
+          xfree_null (cur.linkto);
+          continue;
+        }
+      cur.name = strdupdelim (facts_end + 1, line_end);
+      DEBUGP (("MLSD: %s, type %d, size %s, time-stamp %ld\n", cur.name,
+               cur.type, number_to_static_string (cur.size), cur.tstamp));
+
+      if (!dir)
+        {
+          l = dir = xnew (struct fileinfo);
+          memcpy (l, &cur, sizeof (cur));
+          l->prev = l->next = NULL;
+        }
+      else
+        {
+          cur.prev = l;
+          l->next = xnew (struct fileinfo);
+          l = l->next;
+          memcpy (l, &cur, sizeof (cur));
+          l->next = NULL;
+        }
+    }
+
+  wget_read_file_free (fm);
   return dir;
 }
 
@@ -1044,39 +1207,41 @@ ftp_parse_vms_ls (const char *file)
 struct fileinfo *
 ftp_parse_ls (const char *file, const enum stype system_type)
 {
+  struct listing ls;
+  struct fileinfo *dir;
+
+  if (!listing_open (&ls, file))
+    return NULL;
+
   switch (system_type)
     {
     case ST_UNIX:
-      return ftp_parse_unix_ls (file, 0);
+      dir = ftp_parse_unix_ls (&ls, 0);
+      break;
     case ST_WINNT:
-      {
-        /* Detect whether the listing is simulating the UNIX format */
-        FILE *fp;
-        int   c;
-        fp = fopen (file, "rb");
-        if (!fp)
-        {
-          logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
-          return NULL;
-        }
-        c = fgetc(fp);
-        fclose(fp);
-        /* If the first character of the file is '0'-'9', it's WINNT
-           format. */
-        if (c >= '0' && c <='9')
-          return ftp_parse_winnt_ls (file);
-        else
-          return ftp_parse_unix_ls (file, 1);
-      }
+      /* Detect whether the listing is simulating the UNIX format.  If
+         the first character of the file is '0'-'9', it's WINNT
+         format. */
+      if (ls.pos < ls.end && *ls.pos >= '0' && *ls.pos <= '9')
+        dir = ftp_parse_winnt_ls (&ls);
+      else
+        dir = ftp_parse_unix_ls (&ls, 1);
+      break;
     case ST_VMS:
-      return ftp_parse_vms_ls (file);
+      dir = ftp_parse_vms_ls (&ls);
+      break;
     case ST_MACOS:
-      return ftp_parse_unix_ls (file, 1);
+      dir = ftp_parse_unix_ls (&ls, 1);
+      break;
     default:
       logprintf (LOG_NOTQUIET, _("\
 Unsupported listing type, trying Unix listing parser.\n"));
-      return ftp_parse_unix_ls (file, 0);
+      dir = ftp_parse_unix_ls (&ls, 0);
+      break;
     }
+
+  listing_close (&ls);
+  return dir;
 }
 
 /* Stuff for creating FTP index. */
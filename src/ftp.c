@@ -50,6 +50,11 @@ as that of the covered work.  */
 #include "convert.h"            /* for downloaded_file */
 #include "recur.h"              /* for INFINITE_RECURSION */
 #include "warc.h"
+#include "hash.h"
+#include "parallel.h"
+#include "timing.h"
+#include "stats.h"
+#include "dedup.h"
 
 #ifdef __VMS
 # include "vms.h"
@@ -70,6 +75,8 @@ typedef struct
   int csock;                    /* control connection socket */
   double dltime;                /* time of the download in msecs */
   enum stype rs;                /* remote system reported by ftp server */
+  bool no_mlsd;                 /* the server refused MLSD */
+  bool mlsd;                    /* the last listing was got with MLSD */
   char *id;                     /* initial directory */
   char *target;                 /* target file name */
   struct url *proxy;            /* FTWK-style proxy */
@@ -235,6 +242,7 @@ print_length (wgint size, wgint start, bool authoritative)
 }
 
 static uerr_t ftp_get_listing (struct url *, ccon *, struct fileinfo **);
+static void freefileinfo (struct fileinfo *f);
 
 /* Retrieves a file with denoted parameters through opening an FTP
    connection to the server.  It always closes the data connection,
@@ -242,7 +250,7 @@ static uerr_t ftp_get_listing (struct url *, ccon *, struct fileinfo **);
    is non-NULL, the downloaded data will be written there as well.  */
 static uerr_t
 getftp (struct url *u, wgint passed_expected_bytes, wgint *qtyread,
-        wgint restval, ccon *con, int count, FILE *warc_tmp)
+        wgint restval, ccon *con, int count, struct warc_block *warc_tmp)
 {
   int csock, dtsock, local_sock, res;
   uerr_t err = RETROK;          /* appease the compiler */
@@ -283,7 +291,10 @@ getftp (struct url *u, wgint passed_expected_bytes, wgint *qtyread,
   con->dltime = 0;
 
   if (!(cmd & DO_LOGIN))
-    csock = con->csock;
+    {
+      csock = con->csock;
+      timing_set_reused ();
+    }
   else                          /* cmd & DO_LOGIN */
     {
       char    *host = con->proxy ? con->proxy->host : u->host;
@@ -817,7 +828,9 @@ Error in server response, closing control connection.\n"));
             {
               DEBUGP (("trying to connect to %s port %d\n",
                       print_address (&passive_addr), passive_port));
+              timing_begin (PHASE_CONNECT);
               dtsock = connect_to_ip (&passive_addr, passive_port, NULL);
+              timing_end (PHASE_CONNECT);
               if (dtsock < 0)
                 {
                   int save_errno = errno;
@@ -992,7 +1005,9 @@ Error in server response, closing control connection.\n"));
             }
         }
 
+      timing_begin (PHASE_WAIT);
       err = ftp_retr (csock, u->file);
+      timing_end (PHASE_WAIT);
       /* FTPRERR, WRITEFAILED, FTPNSFOD */
       switch (err)
         {
@@ -1036,12 +1051,24 @@ Error in server response, closing control connection.\n"));
 
   if (cmd & DO_LIST)
     {
+      bool try_mlsd = opt.ftp_mlsd && !con->no_mlsd;
+      bool mlsd = try_mlsd;
+
       if (!opt.server_response)
-        logputs (LOG_VERBOSE, "==> LIST ... ");
+        logputs (LOG_VERBOSE, try_mlsd ? "==> MLSD ... " : "==> LIST ... ");
       /* As Maciej W. Rozycki (macro@ds2.pg.gda.pl) says, `LIST'
          without arguments is better than `LIST .'; confirmed by
          RFC959.  */
-      err = ftp_list (csock, NULL, con->rs);
+      timing_begin (PHASE_WAIT);
+      err = ftp_list (csock, NULL, con->rs, &mlsd);
+      timing_end (PHASE_WAIT);
+      if (err == FTPOK)
+        {
+          /* Don't ask this server again.  */
+          if (try_mlsd && !mlsd)
+            con->no_mlsd = true;
+          con->mlsd = mlsd;
+        }
       /* FTPRERR, WRITEFAILED */
       switch (err)
         {
@@ -1178,7 +1205,9 @@ Error in server response, closing control connection.\n"));
               fp = fopen (con->target, "a", FOPEN_OPT_ARGS);
             }
 #else /* def __VMS */
-          fp = fopen (con->target, "ab");
+          /* The file may be hard-linked to others by --dedup-files,
+             and appending to it must not change them.  */
+          fp = dedup_unshare (con->target) ? fopen (con->target, "ab") : NULL;
 #endif /* def __VMS [else] */
         }
       else if (opt.noclobber || opt.always_rest || opt.timestamping || opt.dirstruct
@@ -1261,9 +1290,12 @@ Error in server response, closing control connection.\n"));
   if (restval && rest_failed)
     flags |= rb_skip_startpos;
   rd_size = 0;
+  if (opt.limit_rate_host)
+    limit_bandwidth_host (u->host, u->port);
   res = fd_read_body (dtsock, fp,
                       expected_bytes ? expected_bytes - restval : 0,
                       restval, &rd_size, qtyread, &con->dltime, flags, warc_tmp);
+  timing_body (con->dltime, rd_size);
 
   tms = datetime_str (time (NULL));
   tmrate = retr_rate (rd_size, con->dltime);
@@ -1392,9 +1424,9 @@ Error in server response, closing control connection.\n"));
    This loop either gets commands from con, or (if ON_YOUR_OWN is
    set), makes them up to retrieve the file given by the URL.  */
 static uerr_t
-ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_file)
+ftp_loop_tries (struct url *u, struct fileinfo *f, ccon *con, char **local_file)
 {
-  int count, orig_lp;
+  int count, resumed_tries, orig_lp;
   wgint restval, len = 0, qtyread = 0;
   char *tms, *locf;
   const char *tmrate = NULL;
@@ -1403,7 +1435,7 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
 
   /* Declare WARC variables. */
   bool warc_enabled = (opt.warc_filename != NULL);
-  FILE *warc_tmp = NULL;
+  struct warc_block *warc_tmp = NULL;
   ip_address *warc_ip = NULL;
 
   /* Get the target, and set the name for the message accordingly. */
@@ -1440,7 +1472,16 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
   /* Remove it if it's a link.  */
   remove_link (con->target);
 
-  count = 0;
+  /* A URL put back in the queue by retrieve_tree goes on counting
+     its tries, and has had its wait in the queue.  Only a file
+     retrieved for its own sake is put back, not the files of a
+     listing, which have no place in the queue.  */
+  count = resumed_tries = 0;
+  if (local_file)
+    {
+      count = resumed_tries = retry_tries;
+      retry_tries = 0;
+    }
 
   if (con->st & ON_YOUR_OWN)
     con->st = ON_YOUR_OWN;
@@ -1448,12 +1489,10 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
   orig_lp = con->cmd & LEAVE_PENDING ? 1 : 0;
 
   /* For file RETR requests, we can write a WARC record.
-     We record the file contents to a temporary file. */
+     We collect the file contents in a WARC block. */
   if (warc_enabled && (con->cmd & DO_RETR))
     {
-      warc_tmp = warc_tempfile ();
-      if (warc_tmp == NULL)
-        return WARC_TMP_FOPENERR;
+      warc_tmp = warc_block_new ();
 
       if (!con->proxy && con->csock != -1)
         {
@@ -1467,7 +1506,8 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
     {
       /* Increment the pass counter.  */
       ++count;
-      sleep_between_retrievals (count);
+      if (!resumed_tries || count > resumed_tries + 1)
+        sleep_between_retrievals (count);
       if (con->st & ON_YOUR_OWN)
         {
           con->cmd = 0;
@@ -1528,8 +1568,11 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
         len = 0;
 
       /* If we are working on a WARC record, getftp should also write
-         to the warc_tmp file. */
+         to the warc_tmp block. */
+      timing_start_transfer ();
       err = getftp (u, len, &qtyread, restval, con, count, warc_tmp);
+      timing_finish_transfer (u->url);
+      stats_note_attempt ();
 
       if (con->csock == -1)
         con->st &= ~DONE_CWD;
@@ -1543,12 +1586,21 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
         case UNLINKERR: case WARC_TMP_FWRITEERR:
           /* Fatal errors, give up.  */
           if (warc_tmp != NULL)
-            fclose (warc_tmp);
+            warc_block_free (warc_tmp);
           return err;
         case CONSOCKERR: case CONERROR: case FTPSRVERR: case FTPRERR:
+        case FTPLOGREFUSED:
+          /* The server may need some time to recover, which a
+             recursive retrieval spends on other URLs.  */
+          if (local_file && retry_defer (count, -1))
+            {
+              if (warc_tmp != NULL)
+                warc_block_free (warc_tmp);
+              return RETRYLATER;
+            }
+          /* fall through */
         case WRITEFAILED: case FTPUNKNOWNTYPE: case FTPSYSERR:
-        case FTPPORTERR: case FTPLOGREFUSED: case FTPINVPASV:
-        case FOPEN_EXCL_ERR:
+        case FTPPORTERR: case FTPINVPASV: case FOPEN_EXCL_ERR:
           printwhat (count, opt.ntry);
           /* non-fatal errors */
           if (err == FOPEN_EXCL_ERR)
@@ -1617,11 +1669,11 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
           bool warc_res;
 
           warc_res = warc_write_resource_record (NULL, u->url, NULL, NULL,
-                                                  warc_ip, NULL, warc_tmp, -1);
+                                                  warc_ip, NULL, warc_tmp);
           if (! warc_res)
             return WARC_ERR;
 
-          /* warc_write_resource_record has also closed warc_tmp. */
+          /* warc_write_resource_record has also freed warc_tmp. */
         }
 
       if ((con->cmd & DO_LIST))
@@ -1652,7 +1704,7 @@ ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_fi
           if (opt.delete_after && !input_file_url (opt.input_filename))
             {
               DEBUGP (("\
-Removing file due to --delete-after in ftp_loop_internal():\n"));
+Removing file due to --delete-after in ftp_loop_tries():\n"));
               logprintf (LOG_VERBOSE, _("Removing %s.\n"), locf);
               if (unlink (locf))
                 logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
@@ -1679,6 +1731,58 @@ Removing file due to --delete-after in ftp_loop_internal():\n"));
   return TRYLIMEXC;
 }
 
+/* Run ftp_loop_tries, and record the retrieval for --stats-file.  */
+static uerr_t
+ftp_loop_internal (struct url *u, struct fileinfo *f, ccon *con, char **local_file)
+{
+  uerr_t err = ftp_loop_tries (u, f, con, local_file);
+  stats_record (u->url, err, 0, false);
+  return err;
+}
+
+/* Listings kept by --ftp-listing-cache, so that a directory is
+   listed only once however many URLs point into it.  */
+struct cached_listing
+{
+  struct fileinfo *f;           /* the parsed listing */
+  enum stype rs;                /* system type of the server */
+  bool mlsd;                    /* whether it was got with MLSD */
+};
+
+/* Maps "user@host:port/dir" to struct cached_listing.  */
+static struct hash_table *listing_cache;
+
+static char *
+listing_cache_key (const struct url *u)
+{
+  return aprintf ("%s@%s:%d/%s", u->user ? u->user : "", u->host, u->port,
+                  u->dir);
+}
+
+/* Return a copy of the file list F.  */
+static struct fileinfo *
+copyfileinfo (const struct fileinfo *f)
+{
+  struct fileinfo *start = NULL, *prev = NULL;
+
+  for (; f; f = f->next)
+    {
+      struct fileinfo *copy = xnew (struct fileinfo);
+      *copy = *f;
+      copy->name = xstrdup (f->name);
+      if (f->linkto)
+        copy->linkto = xstrdup (f->linkto);
+      copy->prev = prev;
+      copy->next = NULL;
+      if (prev)
+        prev->next = copy;
+      else
+        start = copy;
+      prev = copy;
+    }
+  return start;
+}
+
 /* Return the directory listing in a reusable format.  The directory
    is specifed in u->dir.  */
 static uerr_t
@@ -1693,6 +1797,25 @@ ftp_get_listing (struct url *u, ccon *con, struct fileinfo **f)
   con->cmd |= (DO_LIST | LEAVE_PENDING);
   con->cmd &= ~DO_RETR;
 
+  if (opt.ftp_listing_cache && listing_cache)
+    {
+      struct cached_listing *cl;
+      char *key = listing_cache_key (u);
+
+      cl = hash_table_get (listing_cache, key);
+      xfree (key);
+      if (cl)
+        {
+          logprintf (LOG_VERBOSE, _("Using the cached listing of %s.\n"),
+                     quote (*u->dir ? u->dir : "/"));
+          *f = copyfileinfo (cl->f);
+          con->rs = cl->rs;
+          con->mlsd = cl->mlsd;
+          con->cmd &= ~DO_LIST;
+          return RETROK;
+        }
+    }
+
   /* Find the listing file name.  We do it by taking the file name of
      the URL and replacing the last component with the listing file
      name.  */
@@ -1710,7 +1833,20 @@ ftp_get_listing (struct url *u, ccon *con, struct fileinfo **f)
 
   if (err == RETROK)
     {
-      *f = ftp_parse_ls (lf, con->rs);
+      if (con->mlsd)
+        *f = ftp_parse_mlsd (lf);
+      else
+        *f = ftp_parse_ls (lf, con->rs);
+      if (opt.ftp_listing_cache)
+        {
+          struct cached_listing *cl = xnew (struct cached_listing);
+          cl->f = copyfileinfo (*f);
+          cl->rs = con->rs;
+          cl->mlsd = con->mlsd;
+          if (!listing_cache)
+            listing_cache = make_string_hash_table (0);
+          hash_table_put (listing_cache, listing_cache_key (u), cl);
+        }
       if (opt.remove_listing)
         {
           if (unlink (lf))
@@ -1729,7 +1865,157 @@ ftp_get_listing (struct url *u, ccon *con, struct fileinfo **f)
 static uerr_t ftp_retrieve_dirs (struct url *, struct fileinfo *, ccon *);
 static uerr_t ftp_retrieve_glob (struct url *, ccon *, int);
 static struct fileinfo *delelement (struct fileinfo *, struct fileinfo **);
-static void freefileinfo (struct fileinfo *f);
+
+/* Pool of --ftp-connections workers, while ftp_loop runs.  The
+   parent keeps listing directories over its own connection and hands
+   the plain files to the workers, each of which stays logged in over
+   its own control connection.  */
+static struct parallel_pool *ftp_pool;
+
+/* A file handed to ftp_pool, with what is needed to finish it when
+   its worker is done.  */
+struct ftp_job
+{
+  char *target;                 /* local file name */
+  enum ftype type;
+  long tstamp;
+  int perms;
+};
+
+/* Set the permissions and the time-stamp of the file TARGET, of type
+   TYPE, from the listing.  DLTHIS tells whether it was retrieved.  */
+static void
+ftp_set_file_attributes (const char *target, enum ftype type, long tstamp,
+                         int perms, bool dlthis)
+{
+  const char *actual_target = NULL;
+
+  /* 2004-12-15 SMS.
+   * Set permissions _before_ setting the times, as setting the
+   * permissions changes the modified-time, at least on VMS.
+   * Also, use the opt.output_document name here, too, as
+   * appropriate.  (Do the test once, and save the result.)
+   */
+
+  set_local_file (&actual_target, target);
+
+  /* If downloading a plain file, and the user requested it, then
+     set valid (non-zero) permissions. */
+  if (dlthis && (actual_target != NULL) &&
+   (type == FT_PLAINFILE) && opt.preserve_perm)
+    {
+      if (perms)
+        chmod (actual_target, perms);
+      else
+        DEBUGP (("Unrecognized permissions for %s.\n", actual_target));
+    }
+
+  /* Set the time-stamp information to the local file.  Symlinks
+     are not to be stamped because it sets the stamp on the
+     original.  :( */
+  if (actual_target != NULL)
+    {
+      if (opt.useservertimestamps
+          && !(type == FT_SYMLINK && !opt.retr_symlinks)
+          && tstamp != -1
+          && dlthis
+          && file_exists_p (target))
+        {
+          touch (actual_target, tstamp);
+        }
+      else if (tstamp == -1)
+        logprintf (LOG_NOTQUIET, _("%s: corrupt time-stamp.\n"),
+                   actual_target);
+    }
+}
+
+/* Wait for a worker of ftp_pool to finish a file, and finish it the
+   way ftp_retrieve_list does.  The status of the retrieval is stored
+   to *ERR.  Returns false if no file was pending.  */
+static bool
+ftp_pool_wait (uerr_t *err)
+{
+  struct parallel_result res;
+  struct ftp_job *job;
+
+  if (!parallel_wait (ftp_pool, &res))
+    return false;
+  job = res.closure;
+  if (!job)
+    return true;
+
+  if (res.lost)
+    *err = FTPRETRINT;
+  else
+    {
+      *err = res.status;
+      ftp_set_file_attributes (job->target, job->type, job->tstamp,
+                               job->perms, res.status == RETROK);
+    }
+  xfree_null (res.file);
+  xfree_null (res.newloc);
+  xfree_null (res.content_encoding);
+  xfree (job->target);
+  xfree (job);
+  return true;
+}
+
+/* Whether ERR should stop the retrieval of a file list.  */
+static bool
+ftp_fatal_error_p (uerr_t err)
+{
+  return (err == QUOTEXC || err == HOSTERR || err == FWRITEERR
+          || err == WARC_ERR || err == WARC_TMP_FOPENERR
+          || err == WARC_TMP_FWRITEERR);
+}
+
+/* Wait for all the files handed to ftp_pool.  *ERR is set to the
+   status of the last one, unless it already holds a fatal error.  */
+static void
+ftp_pool_drain (uerr_t *err)
+{
+  uerr_t res;
+
+  if (!ftp_pool)
+    return;
+  while (ftp_pool_wait (&res))
+    if (!ftp_fatal_error_p (*err))
+      *err = res;
+}
+
+/* Hand the plain file F of the URL U, to be saved as TARGET, to a
+   worker of ftp_pool, waiting for one to become idle if need be.
+   The status of files finished meanwhile is stored to *ERR.  Returns
+   false if no worker took the file, which is then to be retrieved
+   as usual.  */
+static bool
+ftp_pool_submit (struct url *u, struct fileinfo *f, const char *target,
+                 uerr_t *err)
+{
+  struct ftp_job *job;
+  char *url;
+  bool submitted;
+
+  while (parallel_idle (ftp_pool) == 0)
+    if (!ftp_pool_wait (err))
+      return false;
+
+  job = xnew0 (struct ftp_job);
+  job->target = xstrdup (target);
+  job->type = f->type;
+  job->tstamp = f->tstamp;
+  job->perms = f->perms;
+
+  url = url_string (u, URL_AUTH_SHOW);
+  submitted = parallel_submit_ftp (ftp_pool, url, f->size, job);
+  xfree (url);
+  if (!submitted)
+    {
+      xfree (job->target);
+      xfree (job);
+    }
+  return submitted;
+}
 
 /* Retrieve a list of files given in struct fileinfo linked list.  If
    a file is a symbolic link, do not retrieve it, but rather try to
@@ -1747,7 +2033,6 @@ ftp_retrieve_list (struct url *u, struct fileinfo *f, ccon *con)
   wgint local_size;
   time_t tml;
   bool dlthis; /* Download this (file). */
-  const char *actual_target = NULL;
 
   /* Increase the depth.  */
   ++depth;
@@ -1782,6 +2067,7 @@ ftp_retrieve_list (struct url *u, struct fileinfo *f, ccon *con)
 
       if (opt.quota && total_downloaded_bytes > opt.quota)
         {
+          ftp_pool_drain (&err);
           --depth;
           return QUOTEXC;
         }
@@ -1817,7 +2103,8 @@ ftp_retrieve_list (struct url *u, struct fileinfo *f, ccon *con)
               /* Compare file sizes only for servers that tell us correct
                  values. Assume sizes being equal for servers that lie
                  about file size.  */
-              cor_val = (con->rs == ST_UNIX || con->rs == ST_WINNT);
+              cor_val = (con->mlsd
+                         || con->rs == ST_UNIX || con->rs == ST_WINNT);
               eq_size = cor_val ? (local_size == f->size) : true;
               if (f->tstamp <= tml && eq_size)
                 {
@@ -1907,8 +2194,11 @@ Already have correct symlink %s -> %s\n\n"),
                        quote (f->name));
           break;
         case FT_PLAINFILE:
-          /* Call the retrieve loop.  */
-          if (dlthis)
+          /* Call the retrieve loop, or have a worker do it; the
+             worker's file is finished by ftp_pool_wait.  */
+          if (dlthis && ftp_pool && ftp_pool_submit (u, f, con->target, &err))
+            dlthis = false;
+          else if (dlthis)
             err = ftp_loop_internal (u, f, con, NULL);
           break;
         case FT_UNKNOWN:
@@ -1917,44 +2207,8 @@ Already have correct symlink %s -> %s\n\n"),
           break;
         }       /* switch */
 
-
-      /* 2004-12-15 SMS.
-       * Set permissions _before_ setting the times, as setting the
-       * permissions changes the modified-time, at least on VMS.
-       * Also, use the opt.output_document name here, too, as
-       * appropriate.  (Do the test once, and save the result.)
-       */
-
-      set_local_file (&actual_target, con->target);
-
-      /* If downloading a plain file, and the user requested it, then
-         set valid (non-zero) permissions. */
-      if (dlthis && (actual_target != NULL) &&
-       (f->type == FT_PLAINFILE) && opt.preserve_perm)
-        {
-          if (f->perms)
-            chmod (actual_target, f->perms);
-          else
-            DEBUGP (("Unrecognized permissions for %s.\n", actual_target));
-        }
-
-      /* Set the time-stamp information to the local file.  Symlinks
-         are not to be stamped because it sets the stamp on the
-         original.  :( */
-      if (actual_target != NULL)
-        {
-          if (opt.useservertimestamps
-              && !(f->type == FT_SYMLINK && !opt.retr_symlinks)
-              && f->tstamp != -1
-              && dlthis
-              && file_exists_p (con->target))
-            {
-              touch (actual_target, f->tstamp);
-            }
-          else if (f->tstamp == -1)
-            logprintf (LOG_NOTQUIET, _("%s: corrupt time-stamp.\n"),
-                       actual_target);
-        }
+      ftp_set_file_attributes (con->target, f->type, f->tstamp, f->perms,
+                               dlthis);
 
       xfree (con->target);
       con->target = old_target;
@@ -1963,14 +2217,15 @@ Already have correct symlink %s -> %s\n\n"),
       xfree (ofile);
 
       /* Break on fatals.  */
-      if (err == QUOTEXC || err == HOSTERR || err == FWRITEERR
-          || err == WARC_ERR || err == WARC_TMP_FOPENERR
-          || err == WARC_TMP_FWRITEERR)
+      if (ftp_fatal_error_p (err))
         break;
       con->cmd &= ~ (DO_CWD | DO_LOGIN);
       f = f->next;
     }
 
+  /* Finish the files of this directory before going down.  */
+  ftp_pool_drain (&err);
+
   /* We do not want to call ftp_retrieve_dirs here */
   if (opt.recursive &&
       !(opt.reclevel != INFINITE_RECURSION && depth >= opt.reclevel))
@@ -2285,11 +2540,22 @@ ftp_loop (struct url *u, char **local_file, int *dt, struct url *proxy,
         }
       if (ispattern || recursive || opt.timestamping)
         {
+          /* Only lists of files are worth the workers.  */
+          if (opt.ftp_connections > 1 && (ispattern || recursive)
+              && !parallel_worker_p ())
+            ftp_pool = parallel_pool_new (opt.ftp_connections);
+
           /* ftp_retrieve_glob is a catch-all function that gets called
              if we need globbing, time-stamping or recursion.  Its
              third argument is just what we really need.  */
           res = ftp_retrieve_glob (u, &con,
                                    ispattern ? GLOB_GLOBALL : GLOB_GETONE);
+
+          if (ftp_pool)
+            {
+              parallel_pool_delete (ftp_pool);
+              ftp_pool = NULL;
+            }
         }
       else
         res = ftp_loop_internal (u, NULL, &con, local_file);
@@ -2308,6 +2574,108 @@ ftp_loop (struct url *u, char **local_file, int *dt, struct url *proxy,
   return res;
 }
 
+/* The control connection left by the last ftp_retrieve_file, so
+   that a --ftp-connections worker logs in only once.  */
+static struct
+{
+  int csock;                    /* the socket, or -1 */
+  char *key;                    /* what the connection is good for */
+  enum stype rs;
+  bool no_mlsd;
+  char *id;                     /* initial directory */
+  char *dir;                    /* current directory, or NULL */
+} idle_con = { -1 };
+
+/* Return the key of idle_con suitable for retrieving U: the login,
+   and the transfer type set right after it.  */
+static char *
+idle_con_key (const struct url *u)
+{
+  return aprintf ("%s@%s:%d;%c", u->user ? u->user : "", u->host, u->port,
+                  ftp_process_type (u->params));
+}
+
+static void
+idle_con_clear (void)
+{
+  idle_con.csock = -1;
+  xfree_null (idle_con.key);
+  idle_con.key = NULL;
+  xfree_null (idle_con.id);
+  idle_con.id = NULL;
+  xfree_null (idle_con.dir);
+  idle_con.dir = NULL;
+}
+
+/* Retrieve the plain file of the URL U, which is SIZE bytes long
+   according to the listing of its directory.  This is what a worker
+   of --ftp-connections does with each file its parent hands it: the
+   file was chosen from the parent's listing, so no listing is asked
+   for, and the control connection is kept for the next file.  */
+uerr_t
+ftp_retrieve_file (struct url *u, wgint size, char **local_file, int *dt)
+{
+  ccon con;
+  struct fileinfo f;
+  char *key = idle_con_key (u);
+  uerr_t res;
+
+  *dt = 0;
+
+  xzero (con);
+  con.csock = -1;
+  con.rs = ST_UNIX;
+
+  if (idle_con.csock != -1)
+    {
+      if (!strcmp (idle_con.key, key) && test_socket_open (idle_con.csock))
+        {
+          DEBUGP (("Reusing the FTP control connection %d.\n",
+                   idle_con.csock));
+          con.csock = idle_con.csock;
+          con.rs = idle_con.rs;
+          con.no_mlsd = idle_con.no_mlsd;
+          con.id = idle_con.id;
+          idle_con.id = NULL;
+          if (idle_con.dir && !strcmp (idle_con.dir, u->dir))
+            con.st |= DONE_CWD;
+        }
+      else
+        fd_close (idle_con.csock);
+      idle_con_clear ();
+    }
+
+  xzero (f);
+  f.type = FT_PLAINFILE;
+  f.name = u->file;
+  f.size = size;
+  f.tstamp = -1;
+
+  con.cmd = DO_RETR | LEAVE_PENDING;
+  res = ftp_loop_internal (u, &f, &con, local_file);
+  if (res == FTPOK)
+    res = RETROK;
+  if (res == RETROK)
+    *dt |= RETROKF;
+
+  if (con.csock != -1)
+    {
+      idle_con.csock = con.csock;
+      idle_con.key = key;
+      idle_con.rs = con.rs;
+      idle_con.no_mlsd = con.no_mlsd;
+      idle_con.id = con.id;
+      if (con.st & DONE_CWD)
+        idle_con.dir = xstrdup (u->dir);
+      key = NULL;
+      con.id = NULL;
+    }
+  xfree_null (key);
+  xfree_null (con.id);
+  xfree_null (con.target);
+  return res;
+}
+
 /* Delete an element from the fileinfo linked list.  Returns the
    address of the next element, or NULL if the list is exhausted.  It
    can modify the start of the list.  */
@@ -2344,3 +2712,31 @@ freefileinfo (struct fileinfo *f)
       f = next;
     }
 }
+
+/* Free the listings kept by --ftp-listing-cache, and close the
+   connection left by ftp_retrieve_file.  */
+void
+ftp_cleanup (void)
+{
+  if (idle_con.csock != -1)
+    {
+      fd_close (idle_con.csock);
+      idle_con_clear ();
+    }
+
+  if (listing_cache)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (listing_cache, &iter);
+           hash_table_iter_next (&iter);
+           )
+        {
+          struct cached_listing *cl = iter.value;
+          xfree (iter.key);
+          freefileinfo (cl->f);
+          xfree (cl);
+        }
+      hash_table_destroy (listing_cache);
+      listing_cache = NULL;
+    }
+}
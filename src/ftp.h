@@ -61,7 +61,7 @@ uerr_t ftp_type (int, int);
 uerr_t ftp_cwd (int, const char *);
 uerr_t ftp_retr (int, const char *);
 uerr_t ftp_rest (int, wgint);
-uerr_t ftp_list (int, const char *, enum stype);
+uerr_t ftp_list (int, const char *, enum stype, bool *);
 uerr_t ftp_syst (int, enum stype *);
 uerr_t ftp_pwd (int, char **);
 uerr_t ftp_size (int, const char *, wgint *);
@@ -129,7 +129,10 @@ enum wget_ftp_fstatus
 };
 
 struct fileinfo *ftp_parse_ls (const char *, const enum stype);
+struct fileinfo *ftp_parse_mlsd (const char *);
 uerr_t ftp_loop (struct url *, char **, int *, struct url *, bool, bool);
+uerr_t ftp_retrieve_file (struct url *, wgint, char **, int *);
+void ftp_cleanup (void);
 
 uerr_t ftp_index (const char *, struct url *, struct fileinfo *);
 
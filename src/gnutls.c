@@ -43,10 +43,12 @@ as that of the covered work.  */
 #include <sys/ioctl.h>
 
 #include "utils.h"
+#include "hash.h"
 #include "connect.h"
 #include "url.h"
 #include "ptimer.h"
 #include "ssl.h"
+#include "counters.h"
 
 #include <sys/fcntl.h>
 
@@ -76,6 +78,54 @@ key_type_to_gnutls_type (enum keyfile_type type)
    preprocessor macro.  */
 
 static gnutls_certificate_credentials_t credentials;
+
+/* Add the certificates in CA_DIRECTORY to the trusted ones.  Besides
+   the certificate files, such a directory usually has links to them
+   under their hashed names, and each file is read only once however
+   many names it has.  Returns false if the directory can't be
+   opened.  */
+static bool
+load_ca_directory (const char *ca_directory)
+{
+  struct hash_table *seen;
+  struct dirent *dent;
+  DIR *dir;
+
+  dir = opendir (ca_directory);
+  if (dir == NULL)
+    return false;
+
+  seen = make_string_hash_table (0);
+  while ((dent = readdir (dir)) != NULL)
+    {
+      struct stat st;
+      char *ca_file;
+      char id[64];
+      asprintf (&ca_file, "%s/%s", ca_directory, dent->d_name);
+
+      if (stat (ca_file, &st) == 0 && S_ISREG (st.st_mode))
+        {
+          snprintf (id, sizeof id, "%lu:%lu",
+                    (unsigned long) st.st_dev, (unsigned long) st.st_ino);
+          if (!string_set_contains (seen, id))
+            {
+              string_set_add (seen, id);
+              gnutls_certificate_set_x509_trust_file (credentials, ca_file,
+                                                      GNUTLS_X509_FMT_PEM);
+            }
+        }
+
+      free (ca_file);
+    }
+
+  closedir (dir);
+  string_set_free (seen);
+  return true;
+}
+
+/* Set up the credentials shared by all connections.  Called the first
+   time an HTTPS download is attempted, so runs without one never pay
+   for reading the certificates.  */
 bool
 ssl_init (void)
 {
@@ -86,42 +136,25 @@ ssl_init (void)
   if (ssl_initialized)
     return true;
 
-  const char *ca_directory;
-  DIR *dir;
-
   gnutls_global_init ();
   gnutls_certificate_allocate_credentials (&credentials);
   gnutls_certificate_set_verify_flags(credentials,
                                       GNUTLS_VERIFY_ALLOW_X509_V1_CA_CRT);
 
-  ca_directory = opt.ca_directory ? opt.ca_directory : "/etc/ssl/certs";
-
-  dir = opendir (ca_directory);
-  if (dir == NULL)
+  if (opt.ca_directory)
     {
-      if (opt.ca_directory && *opt.ca_directory)
+      if (!load_ca_directory (opt.ca_directory) && *opt.ca_directory)
         logprintf (LOG_NOTQUIET, _("ERROR: Cannot open directory %s.\n"),
                    opt.ca_directory);
     }
   else
     {
-      struct dirent *dent;
-      while ((dent = readdir (dir)) != NULL)
-        {
-          struct stat st;
-          char *ca_file;
-          asprintf (&ca_file, "%s/%s", ca_directory, dent->d_name);
-
-          stat (ca_file, &st);
-
-          if (S_ISREG (st.st_mode))
-            gnutls_certificate_set_x509_trust_file (credentials, ca_file,
-                                                    GNUTLS_X509_FMT_PEM);
-
-          free (ca_file);
-        }
-
-      closedir (dir);
+#if GNUTLS_VERSION_NUMBER >= 0x030000
+      /* The system's trust store is usually a single bundle, much
+         cheaper to load than each of the files in /etc/ssl/certs.  */
+      if (gnutls_certificate_set_x509_system_trust (credentials) <= 0)
+#endif
+        load_ca_directory ("/etc/ssl/certs");
     }
 
   /* Use the private key from the cert file unless otherwise specified. */
@@ -166,6 +199,7 @@ cert to be of the same type.\n"));
 struct wgnutls_transport_context
 {
   gnutls_session_t session;       /* GnuTLS session handle */
+  char *host;                   /* host the session was established with */
   int last_error;               /* last error returned by read/write/... */
 
   /* Since GnuTLS doesn't support the equivalent to recv(...,
@@ -302,6 +336,13 @@ wgnutls_poll (int fd, double timeout, int wait_for, void *arg)
     return ctx->peeklen || gnutls_record_check_pending (ctx->session);
 }
 
+static int
+wgnutls_pending (int fd, void *arg)
+{
+  struct wgnutls_transport_context *ctx = arg;
+  return ctx->peeklen || gnutls_record_check_pending (ctx->session);
+}
+
 static int
 wgnutls_peek (int fd, char *buf, int bufsize, void *arg)
 {
@@ -356,8 +397,20 @@ static void
 wgnutls_close (int fd, void *arg)
 {
   struct wgnutls_transport_context *ctx = arg;
+  gnutls_datum_t data;
   /*gnutls_bye (ctx->session, GNUTLS_SHUT_RDWR);*/
+
+  /* Save the session for resumption.  This is done at close rather
+     than after the handshake because TLS 1.3 servers send their
+     session tickets after it.  */
+  if (gnutls_session_get_data2 (ctx->session, &data) == GNUTLS_E_SUCCESS)
+    {
+      if (data.size > 0)
+        ssl_session_put (ctx->host, data.data, data.size);
+      gnutls_free (data.data);
+    }
   gnutls_deinit (ctx->session);
+  xfree (ctx->host);
   xfree (ctx);
   close (fd);
 }
@@ -368,7 +421,7 @@ wgnutls_close (int fd, void *arg)
 static struct transport_implementation wgnutls_transport =
 {
   wgnutls_read, wgnutls_write, wgnutls_poll,
-  wgnutls_peek, wgnutls_errstr, wgnutls_close
+  wgnutls_peek, wgnutls_errstr, wgnutls_close, wgnutls_pending
 };
 
 bool
@@ -376,6 +429,8 @@ ssl_connect_wget (int fd, const char *hostname)
 {
   struct wgnutls_transport_context *ctx;
   gnutls_session_t session;
+  const void *cached;
+  int cached_len;
   int err;
   gnutls_init (&session, GNUTLS_CLIENT);
 
@@ -440,20 +495,68 @@ ssl_connect_wget (int fd, const char *hostname)
       return false;
     }
 
+  /* Offer the session last established with this host, if any.  */
+  cached = ssl_session_get (hostname, &cached_len);
+  if (cached)
+    if (gnutls_session_set_data (session, cached, cached_len) < 0)
+      {
+        ssl_session_forget (hostname);
+        cached = NULL;
+      }
+
+#if defined ENABLE_HTTP2 && defined HAVE_GNUTLS_ALPN_SET_PROTOCOLS
+  /* Offer HTTP/2, and HTTP/1.1 as the fallback.  */
+  if (opt.http2)
+    {
+      gnutls_datum_t protos[2];
+      protos[0].data = (unsigned char *) "h2";
+      protos[0].size = 2;
+      protos[1].data = (unsigned char *) "http/1.1";
+      protos[1].size = 8;
+      gnutls_alpn_set_protocols (session, protos, 2, 0);
+    }
+#endif
+
   err = gnutls_handshake (session);
   if (err < 0)
     {
       logprintf (LOG_NOTQUIET, "GnuTLS: %s\n", gnutls_strerror (err));
+      /* Don't offer the session again if it was the culprit.  */
+      if (cached)
+        ssl_session_forget (hostname);
       gnutls_deinit (session);
       return false;
     }
+  COUNTER_ADD (tls_handshakes, 1);
+  if (gnutls_session_is_resumed (session))
+    COUNTER_ADD (tls_resumed, 1);
+  if (cached)
+    DEBUGP (("TLS session for %s %s.\n", hostname,
+             gnutls_session_is_resumed (session) ? "resumed" : "not resumed"));
 
   ctx = xnew0 (struct wgnutls_transport_context);
   ctx->session = session;
+  ctx->host = xstrdup (hostname);
   fd_register_transport (fd, &wgnutls_transport, ctx);
   return true;
 }
 
+/* Return true if the server on FD chose HTTP/2 during the handshake.  */
+
+bool
+ssl_http2_p (int fd)
+{
+#if defined ENABLE_HTTP2 && defined HAVE_GNUTLS_ALPN_SET_PROTOCOLS
+  struct wgnutls_transport_context *ctx = fd_transport_context (fd);
+  gnutls_datum_t proto;
+
+  return (gnutls_alpn_get_selected_protocol (ctx->session, &proto) == 0
+          && proto.size == 2 && !memcmp (proto.data, "h2", 2));
+#else
+  return false;
+#endif
+}
+
 bool
 ssl_check_certificate (int fd, const char *host)
 {
@@ -59,11 +59,16 @@ as that of the covered work.  */
 #  include <stdint.h>
 # else
    typedef unsigned long uintptr_t;
+   typedef unsigned long long uint64_t;
 # endif
 #endif
 
 #include "hash.h"
 
+#ifdef TESTING
+#include "test.h"
+#endif
+
 /* INTERFACE:
 
    Hash tables are a technique used to implement mapping between
@@ -89,7 +94,8 @@ as that of the covered work.  */
    The hash table grows internally as new entries are added and is not
    limited in size, except by available memory.  The table doubles
    with each resize, which ensures that the amortized time per
-   operation remains constant.
+   operation remains constant.  The order in which entries are
+   iterated over is unspecified.
 
    If not instructed otherwise, tables created by hash_table_new
    consider the keys to be equal if their pointer values are the same.
@@ -113,13 +119,22 @@ as that of the covered work.  */
    The hash table is implemented as an open-addressed table with
    linear probing collision resolution.
 
-   The above means that all the cells (each cell containing a key and
-   a value pointer) are stored in a contiguous array.  Array position
-   of each cell is determined by the hash value of its key and the
-   size of the table: location := hash(key) % size.  If two different
-   keys end up on the same position (collide), the one that came
-   second is stored in the first unoccupied cell that follows it.
-   This collision resolution technique is called "linear probing".
+   The above means that all the cells (each cell containing a key, a
+   value pointer and the hash of the key) are stored in a contiguous
+   array.  Array position of each cell is determined by the hash value
+   of its key and the size of the table, which is always a power of
+   two: location := (hash(key) * K) >> (bits - log2(size)), K being
+   the golden ratio scaled to the number of bits.  The multiplication
+   spreads the hash over the high bits, so that even a mediocre hash
+   function doesn't cause clustering.  If two different keys end up on
+   the same position (collide), the one that came second is stored in
+   the first unoccupied cell that follows it.  This collision
+   resolution technique is called "linear probing".
+
+   Keeping the hash in the cell means that the test function is only
+   called for keys whose hashes are equal, which nearly always means
+   that they are equal, and that the hash function is not called at
+   all when the table grows or an entry is removed.
 
    There are more advanced collision resolution methods (quadratic
    probing, double hashing), but we don't use them because they incur
@@ -140,14 +155,18 @@ as that of the covered work.  */
    value, the table is resized.  */
 #define HASH_MAX_FULLNESS 0.75
 
-/* The hash table size is multiplied by this factor (and then rounded
-   to the next prime) with each resize.  This guarantees infrequent
-   resizes.  */
+/* The hash table size is multiplied by this factor with each resize.
+   This guarantees infrequent resizes.  */
 #define HASH_RESIZE_FACTOR 2
 
+/* Sizes of the table are powers of two between these.  */
+#define HASH_MIN_BITS 4
+#define HASH_MAX_BITS 30
+
 struct cell {
   void *key;
   void *value;
+  unsigned int hash;            /* folded hash of KEY */
 };
 
 typedef unsigned long (*hashfun_t) (const void *);
@@ -163,8 +182,7 @@ struct hash_table {
   int count;                    /* number of occupied entries. */
   int resize_threshold;         /* after size exceeds this number of
                                    entries, resize the table.  */
-  int prime_offset;             /* the offset of the current prime in
-                                   the prime table. */
+  int shift;                    /* 32 minus log2 of size. */
 };
 
 /* We use the all-bits-set constant (INVALID_PTR) marker to mean that
@@ -199,48 +217,34 @@ struct hash_table {
 #define FOREACH_OCCUPIED_ADJACENT(c, cells, size)                               \
   for (; CELL_OCCUPIED (c); c = NEXT_CELL (c, cells, size))
 
-/* Return the position of KEY in hash table SIZE large, hash function
-   being HASHFUN.  */
-#define HASH_POSITION(key, hashfun, size) ((hashfun) (key) % size)
+/* Fold the hash of KEY computed by HT's hash function to the 32 bits
+   kept in the cells.  */
+static inline unsigned int
+hash_key (const struct hash_table *ht, const void *key)
+{
+  unsigned long h = ht->hash_function (key);
+#if ULONG_MAX > 0xffffffffUL
+  h ^= h >> 32;
+#endif
+  return (unsigned int) h;
+}
 
-/* Find a prime near, but greather than or equal to SIZE.  The primes
-   are looked up from a table with a selection of primes convenient
-   for this purpose.
+/* Return the position of the key with the folded hash H in a table
+   whose shift is SHIFT.  2654435769 is 2^32 divided by the golden
+   ratio.  */
+#define HASH_POSITION(h, shift) \
+  ((unsigned int) (((h) * 2654435769U) & 0xffffffffU) >> (shift))
 
-   PRIME_OFFSET is a minor optimization: it specifies start position
-   for the search for the large enough prime.  The final offset is
-   stored in the same variable.  That way the list of primes does not
-   have to be scanned from the beginning each time around.  */
+/* Return the number of bits of the smallest table that can hold ITEMS
+   items without exceeding HASH_MAX_FULLNESS.  */
 
 static int
-prime_size (int size, int *prime_offset)
+table_bits (int items)
 {
-  static const int primes[] = {
-    13, 19, 29, 41, 59, 79, 107, 149, 197, 263, 347, 457, 599, 787, 1031,
-    1361, 1777, 2333, 3037, 3967, 5167, 6719, 8737, 11369, 14783,
-    19219, 24989, 32491, 42257, 54941, 71429, 92861, 120721, 156941,
-    204047, 265271, 344857, 448321, 582821, 757693, 985003, 1280519,
-    1664681, 2164111, 2813353, 3657361, 4754591, 6180989, 8035301,
-    10445899, 13579681, 17653589, 22949669, 29834603, 38784989,
-    50420551, 65546729, 85210757, 110774011, 144006217, 187208107,
-    243370577, 316381771, 411296309, 534685237, 695090819, 903618083,
-    1174703521, 1527114613, 1837299131, 2147483647
-  };
-  size_t i;
-
-  for (i = *prime_offset; i < countof (primes); i++)
-    if (primes[i] >= size)
-      {
-        /* Set the offset to the next prime.  That is safe because,
-           next time we are called, it will be with a larger SIZE,
-           which means we could never return the same prime anyway.
-           (If that is not the case, the caller can simply reset
-           *prime_offset.)  */
-        *prime_offset = i + 1;
-        return primes[i];
-      }
-
-  abort ();
+  int bits = HASH_MIN_BITS;
+  while (bits < HASH_MAX_BITS && (1 << bits) * HASH_MAX_FULLNESS < items)
+    ++bits;
+  return bits;
 }
 
 static int cmp_pointer (const void *, const void *);
@@ -257,8 +261,8 @@ static int cmp_pointer (const void *, const void *);
 
    Note that hash tables grow dynamically regardless of ITEMS.  The
    only use of ITEMS is to preallocate the table and avoid unnecessary
-   dynamic regrows.  Don't bother making ITEMS prime because it's not
-   used as size unchanged.  To start with a small table that grows as
+   dynamic regrows.  Don't bother making ITEMS a power of two because
+   it's not used as size unchanged.  To start with a small table that grows as
    needed, simply specify zero ITEMS.
 
    If hash and test callbacks are not specified, identity mapping is
@@ -274,21 +278,18 @@ hash_table_new (int items,
                 unsigned long (*hash_function) (const void *),
                 int (*test_function) (const void *, const void *))
 {
-  int size;
+  int size, bits;
   struct hash_table *ht = xnew (struct hash_table);
 
   ht->hash_function = hash_function ? hash_function : hash_pointer;
   ht->test_function = test_function ? test_function : cmp_pointer;
 
-  /* If the size of struct hash_table ever becomes a concern, this
-     field can go.  (Wget doesn't create many hashes.)  */
-  ht->prime_offset = 0;
-
   /* Calculate the size that ensures that the table will store at
      least ITEMS keys without the need to resize.  */
-  size = 1 + items / HASH_MAX_FULLNESS;
-  size = prime_size (size, &ht->prime_offset);
+  bits = table_bits (items);
+  size = 1 << bits;
   ht->size = size;
+  ht->shift = 32 - bits;
   ht->resize_threshold = size * HASH_MAX_FULLNESS;
   /*assert (ht->resize_threshold >= items);*/
 
@@ -313,19 +314,20 @@ hash_table_destroy (struct hash_table *ht)
 }
 
 /* The heart of most functions in this file -- find the cell whose
-   KEY is equal to key, using linear probing.  Returns the cell
-   that matches KEY, or the first empty cell if none matches.  */
+   KEY is equal to key, using linear probing.  H is the folded hash
+   of KEY.  Returns the cell that matches KEY, or the first empty cell
+   if none matches.  */
 
 static inline struct cell *
-find_cell (const struct hash_table *ht, const void *key)
+find_cell (const struct hash_table *ht, const void *key, unsigned int h)
 {
   struct cell *cells = ht->cells;
   int size = ht->size;
-  struct cell *c = cells + HASH_POSITION (key, ht->hash_function, size);
+  struct cell *c = cells + HASH_POSITION (h, ht->shift);
   testfun_t equals = ht->test_function;
 
   FOREACH_OCCUPIED_ADJACENT (c, cells, size)
-    if (equals (key, c->key))
+    if (c->hash == h && equals (key, c->key))
       break;
   return c;
 }
@@ -340,7 +342,7 @@ find_cell (const struct hash_table *ht, const void *key)
 void *
 hash_table_get (const struct hash_table *ht, const void *key)
 {
-  struct cell *c = find_cell (ht, key);
+  struct cell *c = find_cell (ht, key, hash_key (ht, key));
   if (CELL_OCCUPIED (c))
     return c->value;
   else
@@ -354,7 +356,7 @@ int
 hash_table_get_pair (const struct hash_table *ht, const void *lookup_key,
                      void *orig_key, void *value)
 {
-  struct cell *c = find_cell (ht, lookup_key);
+  struct cell *c = find_cell (ht, lookup_key, hash_key (ht, lookup_key));
   if (CELL_OCCUPIED (c))
     {
       if (orig_key)
@@ -372,7 +374,7 @@ hash_table_get_pair (const struct hash_table *ht, const void *lookup_key,
 int
 hash_table_contains (const struct hash_table *ht, const void *key)
 {
-  struct cell *c = find_cell (ht, key);
+  struct cell *c = find_cell (ht, key, hash_key (ht, key));
   return CELL_OCCUPIED (c);
 }
 
@@ -382,13 +384,15 @@ hash_table_contains (const struct hash_table *ht, const void *key)
 static void
 grow_hash_table (struct hash_table *ht)
 {
-  hashfun_t hasher = ht->hash_function;
   struct cell *old_cells = ht->cells;
   struct cell *old_end   = ht->cells + ht->size;
   struct cell *c, *cells;
   int newsize;
 
-  newsize = prime_size (ht->size * HASH_RESIZE_FACTOR, &ht->prime_offset);
+  if (ht->shift <= 32 - HASH_MAX_BITS)
+    abort ();
+  newsize = ht->size * HASH_RESIZE_FACTOR;
+  ht->shift -= 1;
 #if 0
   printf ("growing from %d to %d; fullness %.2f%% to %.2f%%\n",
           ht->size, newsize,
@@ -410,7 +414,7 @@ grow_hash_table (struct hash_table *ht)
         /* We don't need to test for uniqueness of keys because they
            come from the hash table and are therefore known to be
            unique.  */
-        new_c = cells + HASH_POSITION (c->key, hasher, newsize);
+        new_c = cells + HASH_POSITION (c->hash, ht->shift);
         FOREACH_OCCUPIED_ADJACENT (new_c, cells, newsize)
           ;
         *new_c = *c;
@@ -425,7 +429,8 @@ grow_hash_table (struct hash_table *ht)
 void
 hash_table_put (struct hash_table *ht, const void *key, const void *value)
 {
-  struct cell *c = find_cell (ht, key);
+  unsigned int h = hash_key (ht, key);
+  struct cell *c = find_cell (ht, key, h);
   if (CELL_OCCUPIED (c))
     {
       /* update existing item */
@@ -439,13 +444,14 @@ hash_table_put (struct hash_table *ht, const void *key, const void *value)
   if (ht->count >= ht->resize_threshold)
     {
       grow_hash_table (ht);
-      c = find_cell (ht, key);
+      c = find_cell (ht, key, h);
     }
 
   /* add new item */
   ++ht->count;
   c->key   = (void *)key;       /* const? */
   c->value = (void *)value;
+  c->hash  = h;
 }
 
 /* Remove KEY->value mapping from HT.  Return 0 if there was no such
@@ -454,14 +460,13 @@ hash_table_put (struct hash_table *ht, const void *key, const void *value)
 int
 hash_table_remove (struct hash_table *ht, const void *key)
 {
-  struct cell *c = find_cell (ht, key);
+  struct cell *c = find_cell (ht, key, hash_key (ht, key));
   if (!CELL_OCCUPIED (c))
     return 0;
   else
     {
       int size = ht->size;
       struct cell *cells = ht->cells;
-      hashfun_t hasher = ht->hash_function;
 
       CLEAR_CELL (c);
       --ht->count;
@@ -478,7 +483,7 @@ hash_table_remove (struct hash_table *ht, const void *key)
           struct cell *c_new;
 
           /* Find the new location for the key. */
-          c_new = cells + HASH_POSITION (key2, hasher, size);
+          c_new = cells + HASH_POSITION (c->hash, ht->shift);
           FOREACH_OCCUPIED_ADJACENT (c_new, cells, size)
             if (key2 == c_new->key)
               /* The cell C (key2) is already where we want it (in
@@ -589,6 +594,15 @@ hash_table_count (const struct hash_table *ht)
 {
   return ht->count;
 }
+
+/* Return the number of bytes taken by HT, not counting what its keys
+   and values point to.  */
+
+size_t
+hash_table_memory (const struct hash_table *ht)
+{
+  return sizeof *ht + ht->size * sizeof (struct cell);
+}
 
 /* Functions from this point onward are meant for convenience and
    don't strictly belong to this file.  However, this is as good a
@@ -631,24 +645,79 @@ hash_table_count (const struct hash_table *ht)
  *
  */
 
-/* Base 31 hash function.  Taken from Gnome's glib, modified to use
-   standard C types.
+/* Hash functions for strings.
 
-   We used to use the popular hash function from the Dragon Book, but
-   this one seems to perform much better, both by being faster and by
-   generating less collisions.  */
+   We used to use the base 31 hash function from Gnome's glib, which
+   consumes a character at a time.  Hashing eight bytes at a time, with
+   the mixing steps of MurmurHash3 and its finalizer, is several times
+   faster on the URLs and file names that make up most of Wget's keys,
+   and spreads them much better.  */
 
-static unsigned long
-hash_string (const void *key)
+#define HASH_K1 0x87c37b91114253d5ULL
+#define HASH_K2 0x4cf5ad432745937fULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* The byte lanes of a 64-bit word.  */
+#define LANES_01 0x0101010101010101ULL
+#define LANES_7F 0x7f7f7f7f7f7f7f7fULL
+#define LANES_80 0x8080808080808080ULL
+
+/* Return W with the ASCII upper-case letters among its bytes turned
+   to lower case, as c_tolower would.  */
+
+static inline uint64_t
+word_tolower (uint64_t w)
 {
-  const char *p = key;
-  unsigned int h = *p;
+  uint64_t low7 = w & LANES_7F;
+  uint64_t above_z = low7 + LANES_01 * (0x7f - 'Z');
+  uint64_t from_a = low7 + LANES_01 * (0x80 - 'A');
+  uint64_t upper = ~w & (from_a ^ above_z) & LANES_80;
+  return w | (upper >> 2);
+}
 
-  if (h)
-    for (p += 1; *p != '\0'; p++)
-      h = (h << 5) - h + *p;
+static inline unsigned long
+hash_string_1 (const char *p, int nocase)
+{
+  size_t len = strlen (p);
+  uint64_t h = len * HASH_K2;
+  uint64_t w;
 
-  return h;
+  for (; len >= 8; p += 8, len -= 8)
+    {
+      memcpy (&w, p, 8);
+      if (nocase)
+        w = word_tolower (w);
+      w *= HASH_K1;
+      w = ROTL64 (w, 31);
+      w *= HASH_K2;
+      h ^= w;
+      h = ROTL64 (h, 27) * 5 + 0x52dce729;
+    }
+  if (len)
+    {
+      w = 0;
+      memcpy (&w, p, len);
+      if (nocase)
+        w = word_tolower (w);
+      w *= HASH_K1;
+      w = ROTL64 (w, 31);
+      w *= HASH_K2;
+      h ^= w;
+    }
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return (unsigned long) h;
+}
+
+static unsigned long
+hash_string (const void *key)
+{
+  return hash_string_1 (key, 0);
 }
 
 /* Frontend for strcmp usable for hash tables. */
@@ -656,7 +725,8 @@ hash_string (const void *key)
 static int
 cmp_string (const void *s1, const void *s2)
 {
-  return !strcmp ((const char *)s1, (const char *)s2);
+  /* Interned strings are only ever equal to themselves.  */
+  return s1 == s2 || !strcmp ((const char *)s1, (const char *)s2);
 }
 
 /* Return a hash table of preallocated to store at least ITEMS items
@@ -679,14 +749,7 @@ make_string_hash_table (int items)
 static unsigned long
 hash_string_nocase (const void *key)
 {
-  const char *p = key;
-  unsigned int h = c_tolower (*p);
-
-  if (h)
-    for (p += 1; *p != '\0'; p++)
-      h = (h << 5) - h + c_tolower (*p);
-
-  return h;
+  return hash_string_1 (key, 1);
 }
 
 /* Like string_cmp, but doing case-insensitive compareison. */
@@ -745,6 +808,80 @@ cmp_pointer (const void *ptr1, const void *ptr2)
   return ptr1 == ptr2;
 }
 
+#ifdef TESTING
+
+const char *
+test_hash_table (void)
+{
+  struct hash_table *ht = make_string_hash_table (0);
+  struct hash_table *nc = make_nocase_string_hash_table (0);
+  char key[64], *orig;
+  int i;
+  unsigned j, pos;
+
+  /* Enough keys to grow the table many times over, some of them
+     removed again to exercise the shifting of the following cells.  */
+  for (i = 0; i < 50000; i++)
+    {
+      sprintf (key, "http://www.example.com/dir/%d.html", i);
+      hash_table_put (ht, xstrdup (key), (void *) (intptr_t) i);
+    }
+  for (i = 0; i < 50000; i += 3)
+    {
+      sprintf (key, "http://www.example.com/dir/%d.html", i);
+      mu_assert ("test_hash_table: key not found",
+                 hash_table_get_pair (ht, key, &orig, NULL));
+      mu_assert ("test_hash_table: key not removed",
+                 hash_table_remove (ht, key));
+      xfree (orig);
+    }
+  for (i = 0; i < 50000; i++)
+    {
+      void *value;
+      sprintf (key, "http://www.example.com/dir/%d.html", i);
+      if (i % 3 == 0)
+        mu_assert ("test_hash_table: removed key found",
+                   !hash_table_contains (ht, key));
+      else
+        mu_assert ("test_hash_table: wrong value",
+                   hash_table_get_pair (ht, key, NULL, &value)
+                   && (intptr_t) value == i);
+    }
+  mu_assert ("test_hash_table: wrong count",
+             hash_table_count (ht) == 50000 - 16667);
+
+  /* Case folding must agree with c_tolower in every byte of a word,
+     and must not be confused by the bytes around.  */
+  for (j = 1; j < 256; j++)
+    for (pos = 0; pos < 9; pos++)
+      {
+        char s1[11], s2[11];
+        memset (s1, 'x', 10);
+        s1[10] = '\0';
+        s1[pos] = j;
+        strcpy (s2, s1);
+        s2[pos] = c_tolower (j);
+        mu_assert ("test_hash_table: case folding differs",
+                   hash_string_nocase (s1) == hash_string_nocase (s2));
+      }
+  hash_table_put (nc, "Content-Type", "1");
+  mu_assert ("test_hash_table: nocase lookup failed",
+             hash_table_contains (nc, "content-TYPE"));
+  mu_assert ("test_hash_table: nocase false match",
+             !hash_table_contains (nc, "content-typf"));
+
+  {
+    hash_table_iterator iter;
+    for (hash_table_iterate (ht, &iter); hash_table_iter_next (&iter); )
+      xfree (iter.key);
+  }
+  hash_table_destroy (ht);
+  hash_table_destroy (nc);
+  return NULL;
+}
+
+#endif /* TESTING */
+
 #ifdef TEST
 
 #include <stdio.h>
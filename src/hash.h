@@ -57,6 +57,7 @@ void hash_table_iterate (struct hash_table *, hash_table_iterator *);
 int hash_table_iter_next (hash_table_iterator *);
 
 int hash_table_count (const struct hash_table *);
+size_t hash_table_memory (const struct hash_table *);
 
 struct hash_table *make_string_hash_table (int);
 struct hash_table *make_nocase_string_hash_table (int);
@@ -35,6 +35,7 @@ as that of the covered work.  */
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #ifndef WINDOWS
 # include <sys/types.h>
@@ -61,6 +62,16 @@ as that of the covered work.  */
 #include "host.h"
 #include "url.h"
 #include "hash.h"
+#include "ptimer.h"
+#include "parallel.h"
+#include "counters.h"
+
+/* getaddrinfo_a lets lookups run in the background, which is used to
+   resolve hosts before their URLs are retrieved.  */
+#if defined ENABLE_IPV6 && defined HAVE_GETADDRINFO_A
+# define ENABLE_DNS_PREFETCH
+# include <unistd.h>
+#endif
 
 #ifndef NO_ADDRESS
 # define NO_ADDRESS NO_DATA
@@ -85,6 +96,12 @@ struct address_list {
 
   int refcount;                 /* reference count; when it drops to
                                    0, the entry is freed. */
+
+  time_t expires;               /* when the entry in the DNS cache
+                                   expires, or 0 if it never does.  A
+                                   cached list without addresses
+                                   records a host that doesn't
+                                   exist. */
 };
 
 /* Get the bounds of the address list.  */
@@ -183,6 +200,34 @@ address_list_connected_p (const struct address_list *al)
 /* Create an address_list from the addresses in the given struct
    addrinfo.  */
 
+/* Store the address of AI in IP.  Returns false for families other
+   than AF_INET and AF_INET6.  */
+
+static bool
+ip_address_from_addrinfo (const struct addrinfo *ai, ip_address *ip)
+{
+  if (ai->ai_family == AF_INET6)
+    {
+      const struct sockaddr_in6 *sin6 =
+        (const struct sockaddr_in6 *)ai->ai_addr;
+      ip->family = AF_INET6;
+      ip->data.d6 = sin6->sin6_addr;
+#ifdef HAVE_SOCKADDR_IN6_SCOPE_ID
+      ip->ipv6_scope = sin6->sin6_scope_id;
+#endif
+      return true;
+    }
+  else if (ai->ai_family == AF_INET)
+    {
+      const struct sockaddr_in *sin =
+        (const struct sockaddr_in *)ai->ai_addr;
+      ip->family = AF_INET;
+      ip->data.d4 = sin->sin_addr;
+      return true;
+    }
+  return false;
+}
+
 static struct address_list *
 address_list_from_addrinfo (const struct addrinfo *ai)
 {
@@ -205,25 +250,8 @@ address_list_from_addrinfo (const struct addrinfo *ai)
 
   ip = al->addresses;
   for (ptr = ai; ptr != NULL; ptr = ptr->ai_next)
-    if (ptr->ai_family == AF_INET6)
-      {
-        const struct sockaddr_in6 *sin6 =
-          (const struct sockaddr_in6 *)ptr->ai_addr;
-        ip->family = AF_INET6;
-        ip->data.d6 = sin6->sin6_addr;
-#ifdef HAVE_SOCKADDR_IN6_SCOPE_ID
-        ip->ipv6_scope = sin6->sin6_scope_id;
-#endif
-        ++ip;
-      }
-    else if (ptr->ai_family == AF_INET)
-      {
-        const struct sockaddr_in *sin =
-          (const struct sockaddr_in *)ptr->ai_addr;
-        ip->family = AF_INET;
-        ip->data.d4 = sin->sin_addr;
-        ++ip;
-      }
+    if (ip_address_from_addrinfo (ptr, ip))
+      ++ip;
   assert (ip - al->addresses == cnt);
   return al;
 }
@@ -254,6 +282,41 @@ cmp_prefer_ipv6 (const void *addr1, const void *addr2)
   return !IS_IPV6 (addr1) - !IS_IPV6 (addr2);
 }
 
+/* Reorder addresses so that IPv4 ones (or IPv6 ones, as per
+   --prefer-family) come first.  Sorting is stable so the order of the
+   addresses with the same family is undisturbed.  */
+
+static void
+address_list_sort (struct address_list *al)
+{
+  if (al->count > 1 && opt.prefer_family != prefer_none)
+    stable_sort (al->addresses, al->count, sizeof (ip_address),
+                 opt.prefer_family == prefer_ipv4
+                 ? cmp_prefer_ipv4 : cmp_prefer_ipv6);
+}
+
+/* Fill HINTS for looking up a host as specified by the LH_* FLAGS and
+   the address family options.  */
+
+static void
+lookup_hints (struct addrinfo *hints, int flags)
+{
+  xzero (*hints);
+  hints->ai_socktype = SOCK_STREAM;
+  if (opt.ipv4_only)
+    hints->ai_family = AF_INET;
+  else if (opt.ipv6_only)
+    hints->ai_family = AF_INET6;
+  else
+    /* We tried using AI_ADDRCONFIG, but removed it because: it
+       misinterprets IPv6 loopbacks, it is broken on AIX 5.1, and
+       it's unneeded since we sort the addresses anyway.  */
+      hints->ai_family = AF_UNSPEC;
+
+  if (flags & LH_BIND)
+    hints->ai_flags |= AI_PASSIVE;
+}
+
 #else  /* not ENABLE_IPV6 */
 
 /* Create an address_list from a NULL-terminated vector of IPv4
@@ -571,25 +634,44 @@ is_valid_ipv6_address (const char *str, const char *end)
   return true;
 }
 
-/* Simple host cache, used by lookup_host to speed up resolving.  The
-   cache doesn't handle TTL because Wget is a fairly short-lived
-   application.  Refreshing is attempted when connect fails, though --
-   see connect_to_host.  */
+/* Simple host cache, used by lookup_host to speed up resolving.
+   getaddrinfo doesn't tell us the TTL of the records it found, so
+   entries are kept for opt.dns_cache_ttl seconds instead.  Hosts that
+   don't exist are cached too, as entries without addresses.
+   Refreshing is attempted when connect fails, though -- see
+   connect_to_host.
+
+   With --dns-cache-file, the cache is loaded from a file on first use
+   and saved there at exit by host_cache_save, so that the next run
+   needn't resolve the same hosts again.  */
 
 /* Mapping between known hosts and to lists of their addresses. */
 static struct hash_table *host_name_addresses_map;
 
+static bool cache_loaded_p;
+static void cache_load (void);
+
 
 /* Return the host's resolved addresses from the cache, if
    available.  */
 
+static void cache_remove (const char *);
+
 static struct address_list *
 cache_query (const char *host)
 {
   struct address_list *al;
+  if (!cache_loaded_p)
+    cache_load ();
   if (!host_name_addresses_map)
     return NULL;
   al = hash_table_get (host_name_addresses_map, host);
+  if (al && al->expires && al->expires <= time (NULL))
+    {
+      DEBUGP (("Cached entry of %s has expired.\n", host));
+      cache_remove (host);
+      return NULL;
+    }
   if (al)
     {
       DEBUGP (("Found %s in host_name_addresses_map (%p)\n", host, al));
@@ -599,8 +681,11 @@ cache_query (const char *host)
   return NULL;
 }
 
+static char *cache_entry_string (const struct address_list *);
+
 /* Cache the DNS lookup of HOST.  Subsequent invocations of
-   lookup_host will return the cached value.  */
+   lookup_host will return the cached value.  If AL has no expiry
+   time yet, it expires opt.dns_cache_ttl seconds from now.  */
 
 static void
 cache_store (const char *host, struct address_list *al)
@@ -608,6 +693,9 @@ cache_store (const char *host, struct address_list *al)
   if (!host_name_addresses_map)
     host_name_addresses_map = make_nocase_string_hash_table (0);
 
+  if (!al->expires && opt.dns_cache_ttl)
+    al->expires = time (NULL) + (time_t) opt.dns_cache_ttl;
+
   ++al->refcount;
   hash_table_put (host_name_addresses_map, xstrdup_lower (host), al);
 
@@ -617,8 +705,30 @@ cache_store (const char *host, struct address_list *al)
       debug_logprintf ("Caching %s =>", host);
       for (i = 0; i < al->count; i++)
         debug_logprintf (" %s", print_address (al->addresses + i));
+      if (!al->count)
+        debug_logprintf (" (no such host)");
       debug_logprintf ("\n");
     }
+
+  /* The parent process saves the cache file, so it must know what
+     the workers found.  */
+  if (opt.dns_cache_file && al->expires && parallel_worker_p ())
+    {
+      char *entry = cache_entry_string (al);
+      parallel_forward (PEV_DNS_CACHE, host, entry);
+      xfree (entry);
+    }
+}
+
+/* Remember that HOST doesn't exist.  */
+
+static void
+cache_store_negative (const char *host)
+{
+  struct address_list *al = xnew0 (struct address_list);
+  al->refcount = 1;
+  cache_store (host, al);
+  address_list_release (al);
 }
 
 /* Remove HOST from the DNS cache.  Does nothing is HOST is not in
@@ -627,17 +737,433 @@ cache_store (const char *host, struct address_list *al)
 static void
 cache_remove (const char *host)
 {
+  char *key;
   struct address_list *al;
   if (!host_name_addresses_map)
     return;
-  al = hash_table_get (host_name_addresses_map, host);
-  if (al)
+  if (hash_table_get_pair (host_name_addresses_map, host, &key, &al))
     {
-      address_list_release (al);
       hash_table_remove (host_name_addresses_map, host);
+      xfree (key);
+      address_list_release (al);
+    }
+}
+
+/* Return the text describing the cache entry AL in the cache file:
+   its expiry time followed by its addresses, or by "-" for a host
+   that doesn't exist.  */
+
+static char *
+cache_entry_string (const struct address_list *al)
+{
+  int i, size = 32 + al->count * 48;
+  char *entry = xmalloc (size);
+  char *p = entry;
+
+  p += sprintf (p, "%ld", (long) al->expires);
+  for (i = 0; i < al->count; i++)
+    p += snprintf (p, size - (p - entry), " %s",
+                   print_address (al->addresses + i));
+  if (!al->count)
+    strcpy (p, " -");
+  return entry;
+}
+
+/* Parse the numeric address STR into IP.  */
+
+static bool
+parse_numeric_address (const char *str, ip_address *ip)
+{
+#ifdef ENABLE_IPV6
+  struct addrinfo hints, *res;
+  bool ok;
+
+  xzero (hints);
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST;
+  if (getaddrinfo (str, NULL, &hints, &res) != 0)
+    return false;
+  ok = res && ip_address_from_addrinfo (res, ip);
+  if (res)
+    freeaddrinfo (res);
+  return ok;
+#else
+  uint32_t addr_ipv4 = (uint32_t) inet_addr (str);
+  if (addr_ipv4 == (uint32_t) -1)
+    return false;
+  ip->family = AF_INET;
+  memcpy (&ip->data.d4, &addr_ipv4, 4);
+  return true;
+#endif
+}
+
+/* Add HOST to the cache, as described by ENTRY, the text written by
+   cache_entry_string.  Returns false if ENTRY is malformed; expired
+   entries are silently ignored.  */
+
+static bool
+cache_add_entry (const char *host, const char *entry)
+{
+  struct address_list *al;
+  char *copy, *tok, *end;
+  long expires;
+  bool negative = false;
+
+  expires = strtol (entry, &end, 10);
+  if (end == entry || expires <= 0)
+    return false;
+  if (expires <= time (NULL))
+    return true;
+
+  al = xnew0 (struct address_list);
+  al->refcount = 1;
+  al->expires = (time_t) expires;
+  copy = xstrdup (end);
+  for (tok = strtok (copy, " \t\r\n"); tok; tok = strtok (NULL, " \t\r\n"))
+    {
+      if (!strcmp (tok, "-"))
+        {
+          negative = true;
+          continue;
+        }
+      al->addresses = xrealloc (al->addresses,
+                                (al->count + 1) * sizeof (ip_address));
+      if (!parse_numeric_address (tok, al->addresses + al->count))
+        {
+          xfree (copy);
+          xfree_null (al->addresses);
+          xfree (al);
+          return false;
+        }
+      ++al->count;
+    }
+  xfree (copy);
+  if (!al->count && !negative)
+    {
+      xfree (al);
+      return false;
+    }
+
+#ifdef ENABLE_IPV6
+  address_list_sort (al);
+#endif
+  cache_remove (host);
+  cache_store (host, al);
+  address_list_release (al);
+  return true;
+}
+
+/* Load the entries of the cache file, if there is one.  */
+
+static void
+cache_load (void)
+{
+  FILE *fp;
+  char *line;
+  int lineno = 0;
+
+  cache_loaded_p = true;
+  if (!opt.dns_cache_file || !opt.dns_cache)
+    return;
+  fp = fopen (opt.dns_cache_file, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot open DNS cache file %s: %s\n"),
+                   quote (opt.dns_cache_file), strerror (errno));
+      return;
+    }
+  while ((line = read_whole_line (fp)) != NULL)
+    {
+      char *p = line, *host;
+      ++lineno;
+      while (c_isspace (*p))
+        ++p;
+      if (!*p || *p == '#')
+        {
+          xfree (line);
+          continue;
+        }
+      host = p;
+      while (*p && !c_isspace (*p))
+        ++p;
+      if (*p)
+        *p++ = '\0';
+      if (!cache_add_entry (host, p))
+        logprintf (LOG_NOTQUIET, _("%s: Invalid entry at line %d.\n"),
+                   quote (opt.dns_cache_file), lineno);
+      xfree (line);
+    }
+  fclose (fp);
+}
+
+/* Add the cache entry found by a parallel worker.  */
+
+void
+host_cache_add (const char *host, const char *entry)
+{
+  if (!cache_loaded_p)
+    cache_load ();
+  cache_add_entry (host, entry);
+}
+
+/* Write the cache entries that haven't expired to the cache file.
+   Entries that never expire, with a TTL of 0, are not written.  */
+
+void
+host_cache_save (void)
+{
+  FILE *fp;
+  time_t now = time (NULL);
+  hash_table_iterator iter;
+
+  if (!opt.dns_cache_file || !opt.dns_cache)
+    return;
+  fp = fopen (opt.dns_cache_file, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot open DNS cache file %s: %s\n"),
+                 quote (opt.dns_cache_file), strerror (errno));
+      return;
     }
+  fputs ("# Wget DNS cache file.  Each line holds a host name, the time\n"
+         "# its entry expires, and its addresses, or - for no such host.\n",
+         fp);
+  if (host_name_addresses_map)
+    for (hash_table_iterate (host_name_addresses_map, &iter);
+         hash_table_iter_next (&iter); )
+      {
+        const struct address_list *al = iter.value;
+        char *entry;
+        if (!al->expires || al->expires <= now)
+          continue;
+        entry = cache_entry_string (al);
+        fprintf (fp, "%s %s\n", (const char *) iter.key, entry);
+        xfree (entry);
+      }
+  if (fclose (fp) < 0)
+    logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
+               quote (opt.dns_cache_file), strerror (errno));
+  else
+    DEBUGP (("Saved DNS cache to %s.\n", opt.dns_cache_file));
 }
 
+#ifdef ENABLE_DNS_PREFETCH
+
+/* Lookups started by host_prefetch, which run in the background while
+   other URLs are being retrieved.  */
+
+struct prefetch {
+  struct gaicb cb;
+  struct addrinfo hints;
+  char *host;                   /* the name being resolved, in lower
+                                   case */
+};
+
+/* At most this many lookups run at the same time; hosts discovered
+   meanwhile are resolved when they are needed.  */
+#define PREFETCH_MAX 32
+
+static struct prefetch *prefetches[PREFETCH_MAX];
+static int prefetch_count;
+
+/* The process that started the lookups.  A child created by fork
+   doesn't inherit the threads that run them, and doesn't start any
+   lookups of its own.  */
+static pid_t prefetch_pid;
+
+static void
+prefetch_free (struct prefetch *p)
+{
+  if (p->cb.ar_result)
+    freeaddrinfo (p->cb.ar_result);
+  xfree (p->host);
+  xfree (p);
+}
+
+/* Remove the prefetch at index I, without freeing it.  */
+
+static struct prefetch *
+prefetch_take (int i)
+{
+  struct prefetch *p = prefetches[i];
+  prefetches[i] = prefetches[--prefetch_count];
+  return p;
+}
+
+/* Forget the lookups if we are a forked child, where they will never
+   finish.  Their memory is our copy, so it can be freed.  */
+
+static void
+prefetch_check_fork (void)
+{
+  if (prefetch_count && prefetch_pid != getpid ())
+    {
+      int i;
+      for (i = 0; i < prefetch_count; i++)
+        {
+          prefetches[i]->cb.ar_result = NULL;
+          prefetch_free (prefetches[i]);
+        }
+      prefetch_count = 0;
+    }
+}
+
+/* Return the index of the lookup of HOST, or -1 if there is none.  */
+
+static int
+prefetch_find (const char *host)
+{
+  int i;
+  prefetch_check_fork ();
+  for (i = 0; i < prefetch_count; i++)
+    if (!strcasecmp (prefetches[i]->host, host))
+      return i;
+  return -1;
+}
+
+/* Move the finished lookups to the cache.  */
+
+static void
+prefetch_reap (void)
+{
+  int i;
+  prefetch_check_fork ();
+  for (i = 0; i < prefetch_count; )
+    {
+      struct prefetch *p = prefetches[i];
+      struct address_list *al = NULL;
+      int err = gai_error (&p->cb);
+      if (err == EAI_INPROGRESS)
+        {
+          ++i;
+          continue;
+        }
+      prefetch_take (i);
+      if (err == 0 && p->cb.ar_result)
+        al = address_list_from_addrinfo (p->cb.ar_result);
+      if (al)
+        {
+          address_list_sort (al);
+          if (!host_name_addresses_map
+              || !hash_table_contains (host_name_addresses_map, p->host))
+            cache_store (p->host, al);
+          address_list_release (al);
+        }
+      else
+        {
+          DEBUGP (("Prefetching %s failed: %s\n", p->host,
+                   err != EAI_SYSTEM ? gai_strerror (err) : strerror (errno)));
+          if (err == EAI_NONAME
+              && (!host_name_addresses_map
+                  || !hash_table_contains (host_name_addresses_map, p->host)))
+            cache_store_negative (p->host);
+        }
+      prefetch_free (p);
+    }
+}
+
+/* If HOST is being prefetched, wait for the lookup to finish, but no
+   longer than TIMEOUT seconds, and store its result in *RES and its
+   getaddrinfo return value in *ERR.  Returns false if HOST is not
+   being prefetched.  */
+
+static bool
+prefetch_wait (const char *host, struct addrinfo **res, int *err,
+               double timeout)
+{
+  int i = prefetch_find (host);
+  struct prefetch *p;
+  struct ptimer *timer;
+
+  if (i < 0)
+    return false;
+  p = prefetches[i];
+
+  timer = ptimer_new ();
+  while ((*err = gai_error (&p->cb)) == EAI_INPROGRESS)
+    {
+      const struct gaicb *list[1];
+      struct timespec ts, *tsp = NULL;
+      if (timeout)
+        {
+          double left = timeout - ptimer_measure (timer);
+          if (left <= 0)
+            break;
+          ts.tv_sec = (time_t) left;
+          ts.tv_nsec = (long) ((left - ts.tv_sec) * 1e9);
+          tsp = &ts;
+        }
+      list[0] = &p->cb;
+      gai_suspend (list, 1, tsp);
+    }
+  ptimer_destroy (timer);
+
+  if (*err == EAI_INPROGRESS)
+    {
+      /* Timed out.  A lookup that is already running can't be
+         cancelled; it is left to finish in the background.  */
+      if (gai_cancel (&p->cb) == EAI_CANCELED)
+        prefetch_free (prefetch_take (i));
+      errno = ETIMEDOUT;
+      *err = EAI_SYSTEM;
+      *res = NULL;
+      return true;
+    }
+
+  prefetch_take (i);
+  *res = p->cb.ar_result;
+  p->cb.ar_result = NULL;
+  prefetch_free (p);
+  return true;
+}
+
+#endif /* ENABLE_DNS_PREFETCH */
+
+/* Start looking up HOST in the background, so that its addresses are
+   in the cache by the time lookup_host is asked for them.  This is
+   called when a URL is added to the queue of a recursive retrieval.
+   Numeric addresses, hosts already in the cache and hosts being looked
+   up are ignored, as are all hosts when caching is turned off.  */
+
+void
+host_prefetch (const char *host)
+{
+#ifdef ENABLE_DNS_PREFETCH
+  struct prefetch *p;
+  struct gaicb *list[1];
+  const char *end = host + strlen (host);
+
+  if (!opt.dns_cache || (prefetch_pid && prefetch_pid != getpid ())
+      || is_valid_ipv4_address (host, end) || is_valid_ipv6_address (host, end))
+    return;
+  if (!cache_loaded_p)
+    cache_load ();
+  if (host_name_addresses_map
+      && hash_table_contains (host_name_addresses_map, host))
+    return;
+  prefetch_reap ();
+  if (prefetch_count == PREFETCH_MAX || prefetch_find (host) >= 0)
+    return;
+
+  p = xnew0 (struct prefetch);
+  p->host = xstrdup_lower (host);
+  lookup_hints (&p->hints, 0);
+  p->cb.ar_name = p->host;
+  p->cb.ar_request = &p->hints;
+  list[0] = &p->cb;
+  if (getaddrinfo_a (GAI_NOWAIT, list, 1, NULL) != 0)
+    {
+      prefetch_free (p);
+      return;
+    }
+  DEBUGP (("Prefetching addresses of %s.\n", p->host));
+  if (!prefetch_pid)
+    prefetch_pid = getpid ();
+  prefetches[prefetch_count++] = p;
+#endif /* ENABLE_DNS_PREFETCH */
+}
+
 /* Look up HOST in DNS and return a list of IP addresses.
 
    This function caches its result so that, if the same host is passed
@@ -699,6 +1225,9 @@ lookup_host (const char *host, int flags)
   }
 #endif
 
+  if (!numeric_address)
+    COUNTER_ADD (dns_lookups, 1);
+
   /* Cache is normally on, but can be turned off with --no-dns-cache.
      Don't cache passive lookups under IPv6.  */
   use_cache = opt.dns_cache;
@@ -715,8 +1244,20 @@ lookup_host (const char *host, int flags)
       if (!(flags & LH_REFRESH))
         {
           al = cache_query (host);
+          if (al && !al->count)
+            {
+              address_list_release (al);
+              if (!silent)
+                logprintf (LOG_VERBOSE,
+                           _("Resolving %s... failed: host not found (cached).\n"),
+                           quotearg_style (escape_quoting_style, host));
+              return NULL;
+            }
           if (al)
-            return al;
+            {
+              COUNTER_ADD (dns_hits, 1);
+              return al;
+            }
         }
       else
         cache_remove (host);
@@ -749,20 +1290,7 @@ lookup_host (const char *host, int flags)
     int err;
     struct addrinfo hints, *res;
 
-    xzero (hints);
-    hints.ai_socktype = SOCK_STREAM;
-    if (opt.ipv4_only)
-      hints.ai_family = AF_INET;
-    else if (opt.ipv6_only)
-      hints.ai_family = AF_INET6;
-    else
-      /* We tried using AI_ADDRCONFIG, but removed it because: it
-         misinterprets IPv6 loopbacks, it is broken on AIX 5.1, and
-         it's unneeded since we sort the addresses anyway.  */
-        hints.ai_family = AF_UNSPEC;
-
-    if (flags & LH_BIND)
-      hints.ai_flags |= AI_PASSIVE;
+    lookup_hints (&hints, flags);
 
 #ifdef AI_NUMERICHOST
     if (numeric_address)
@@ -776,9 +1304,14 @@ lookup_host (const char *host, int flags)
       }
 #endif
 
-    err = getaddrinfo_with_timeout (host, NULL, &hints, &res, timeout);
+#ifdef ENABLE_DNS_PREFETCH
+    if (!use_cache || !prefetch_wait (host, &res, &err, timeout))
+#endif
+      err = getaddrinfo_with_timeout (host, NULL, &hints, &res, timeout);
     if (err != 0 || res == NULL)
       {
+        if (use_cache && err == EAI_NONAME)
+          cache_store_negative (host);
         if (!silent)
           logprintf (LOG_VERBOSE, _("failed: %s.\n"),
                      err != EAI_SYSTEM ? gai_strerror (err) : strerror (errno));
@@ -793,19 +1326,15 @@ lookup_host (const char *host, int flags)
         return NULL;
       }
 
-    /* Reorder addresses so that IPv4 ones (or IPv6 ones, as per
-       --prefer-family) come first.  Sorting is stable so the order of
-       the addresses with the same family is undisturbed.  */
-    if (al->count > 1 && opt.prefer_family != prefer_none)
-      stable_sort (al->addresses, al->count, sizeof (ip_address),
-                   opt.prefer_family == prefer_ipv4
-                   ? cmp_prefer_ipv4 : cmp_prefer_ipv6);
+    address_list_sort (al);
   }
 #else  /* not ENABLE_IPV6 */
   {
     struct hostent *hptr = gethostbyname_with_timeout (host, timeout);
     if (!hptr)
       {
+        if (use_cache && errno != ETIMEDOUT && h_errno == HOST_NOT_FOUND)
+          cache_store_negative (host);
         if (!silent)
           {
             if (errno != ETIMEDOUT)
@@ -894,9 +1423,40 @@ sufmatch (const char **list, const char *what)
   return false;
 }
 
+/* Return the number of bytes taken by the DNS cache.  */
+
+size_t
+host_cache_memory (void)
+{
+  hash_table_iterator iter;
+  size_t size;
+
+  if (!host_name_addresses_map)
+    return 0;
+  size = hash_table_memory (host_name_addresses_map);
+  for (hash_table_iterate (host_name_addresses_map, &iter);
+       hash_table_iter_next (&iter); )
+    {
+      const struct address_list *al = iter.value;
+      size += strlen (iter.key) + 1 + sizeof *al
+        + al->count * sizeof (ip_address);
+    }
+  return size;
+}
+
 void
 host_cleanup (void)
 {
+#ifdef ENABLE_DNS_PREFETCH
+  /* Lookups still running can't be freed; they go away with us.  */
+  prefetch_check_fork ();
+  while (prefetch_count)
+    {
+      struct prefetch *p = prefetch_take (0);
+      if (gai_cancel (&p->cb) != EAI_NOTCANCELED)
+        prefetch_free (p);
+    }
+#endif
   if (host_name_addresses_map)
     {
       hash_table_iterator iter;
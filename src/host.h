@@ -84,6 +84,7 @@ enum {
   LH_REFRESH = 4
 };
 struct address_list *lookup_host (const char *, int);
+void host_prefetch (const char *);
 
 void address_list_get_bounds (const struct address_list *, int *, int *);
 const ip_address *address_list_address_at (const struct address_list *, int);
@@ -103,6 +104,9 @@ bool is_valid_ip_address (const char *name);
 bool accept_domain (struct url *);
 bool sufmatch (const char **, const char *);
 
+void host_cache_add (const char *, const char *);
+void host_cache_save (void);
 void host_cleanup (void);
+size_t host_cache_memory (void);
 
 #endif /* HOST_H */
@@ -100,6 +100,14 @@ as that of the covered work.  */
 #include <string.h>
 #include <assert.h>
 
+#if defined __SSE2__ && defined __GNUC__
+# include <emmintrin.h>
+# define SCAN_SSE2
+#elif defined __ARM_NEON && defined __aarch64__
+# include <arm_neon.h>
+# define SCAN_NEON
+#endif
+
 #include "utils.h"
 #include "html-parse.h"
 
@@ -126,17 +134,6 @@ as that of the covered work.  */
 # define c_isalnum(x) isalnum (x)
 # define c_tolower(x) tolower (x)
 # define c_toupper(x) toupper (x)
-
-struct hash_table {
-  int dummy;
-};
-static void *
-hash_table_get (const struct hash_table *ht, void *ptr)
-{
-  return ptr;
-}
-#else  /* not STANDALONE */
-# include "hash.h"
 #endif
 
 /* Pool support.  A pool is a resizable chunk of memory.  It is first
@@ -280,10 +277,19 @@ struct tagstack_item {
   struct tagstack_item *next;
 };
 
+/* Items popped off the tag stack are kept on the SPARE list and
+   reused by later pushes, so that a document costs only as many
+   allocations as its tags are deeply nested.  */
+
 static struct tagstack_item *
-tagstack_push (struct tagstack_item **head, struct tagstack_item **tail)
+tagstack_push (struct tagstack_item **head, struct tagstack_item **tail,
+               struct tagstack_item **spare)
 {
-  struct tagstack_item *ts = xmalloc(sizeof(struct tagstack_item));
+  struct tagstack_item *ts = *spare;
+  if (ts)
+    *spare = ts->next;
+  else
+    ts = xmalloc (sizeof (struct tagstack_item));
   if (*head == NULL)
     {
       *head = *tail = ts;
@@ -303,43 +309,35 @@ tagstack_push (struct tagstack_item **head, struct tagstack_item **tail)
 /* remove ts and everything after it from the stack */
 static void
 tagstack_pop (struct tagstack_item **head, struct tagstack_item **tail,
-              struct tagstack_item *ts)
+              struct tagstack_item **spare, struct tagstack_item *ts)
 {
+  struct tagstack_item *last;
+
   if (*head == NULL)
     return;
 
-  if (ts == *tail)
-    {
-      if (ts == *head)
-        {
-          xfree (ts);
-          *head = *tail = NULL;
-        }
-      else
-        {
-          ts->prev->next = NULL;
-          *tail = ts->prev;
-          xfree (ts);
-        }
-    }
+  last = *tail;
+  if (ts == *head)
+    *head = *tail = NULL;
   else
     {
-      if (ts == *head)
-        {
-          *head = NULL;
-        }
+      ts->prev->next = NULL;
       *tail = ts->prev;
+    }
 
-      if (ts->prev)
-        {
-          ts->prev->next = NULL;
-        }
-      while (ts)
-        {
-          struct tagstack_item *p = ts->next;
-          xfree (ts);
-          ts = p;
-        }
+  /* ts..last is still linked through next; put it on the spare list. */
+  last->next = *spare;
+  *spare = ts;
+}
+
+static void
+tagstack_free (struct tagstack_item *ts)
+{
+  while (ts)
+    {
+      struct tagstack_item *next = ts->next;
+      xfree (ts);
+      ts = next;
     }
 }
 
@@ -558,7 +556,9 @@ static int comment_backout_count;
 
    Whitespace is allowed between and after the comments, but not
    before the first comment.  Additionally, this function attempts to
-   handle double quotes in SGML declarations correctly.  */
+   handle double quotes in SGML declarations correctly.
+
+   NULL is returned if the declaration is cut short by END.  */
 
 static const char *
 advance_declaration (const char *beg, const char *end)
@@ -566,6 +566,7 @@ advance_declaration (const char *beg, const char *end)
   const char *p = beg;
   char quote_char = '\0';       /* shut up, gcc! */
   char ch;
+  bool truncated = false;
 
   enum {
     AC_S_DONE,
@@ -593,7 +594,12 @@ advance_declaration (const char *beg, const char *end)
   while (state != AC_S_DONE && state != AC_S_BACKOUT)
     {
       if (p == end)
-        state = AC_S_BACKOUT;
+        {
+          /* The declaration may continue past END; let the caller
+             decide.  */
+          truncated = true;
+          state = AC_S_BACKOUT;
+        }
       switch (state)
         {
         case AC_S_DONE:
@@ -658,7 +664,17 @@ advance_declaration (const char *beg, const char *end)
           if (ch == quote_char)
             state = AC_S_QUOTE2;
           else
-            ch = *p++;
+            {
+              /* Skip to the closing quote in one go.  */
+              const char *q = memchr (p, quote_char, end - p);
+              if (q)
+                {
+                  ch = *q;
+                  p = q + 1;
+                }
+              else
+                p = end;
+            }
           break;
         case AC_S_QUOTE2:
           assert (ch == quote_char);
@@ -688,7 +704,17 @@ advance_declaration (const char *beg, const char *end)
               state = AC_S_DASH3;
               break;
             default:
-              ch = *p++;
+              {
+                /* Likewise, skip to the next dash.  */
+                const char *q = memchr (p, '-', end - p);
+                if (q)
+                  {
+                    ch = *q;
+                    p = q + 1;
+                  }
+                else
+                  p = end;
+              }
               break;
             }
           break;
@@ -717,7 +743,7 @@ advance_declaration (const char *beg, const char *end)
 #ifdef STANDALONE
       ++comment_backout_count;
 #endif
-      return beg + 1;
+      return truncated ? NULL : beg + 1;
     }
   return p;
 }
@@ -729,59 +755,66 @@ advance_declaration (const char *beg, const char *end)
 static const char *
 find_comment_end (const char *beg, const char *end)
 {
-  /* Open-coded Boyer-Moore search for "-->".  Examine the third char;
-     if it's not '>' or '-', advance by three characters.  Otherwise,
-     look at the preceding characters and try to find a match.  */
+  /* Every "-->" ends in a '>', so let memchr, which is vectorized in
+     any serious libc, skip to each '>' and look behind it.  This is
+     much faster than examining every third character ourselves.  */
 
-  const char *p = beg - 1;
+  const char *p = beg;
 
-  while ((p += 3) < end)
-    switch (p[0])
-      {
-      case '>':
-        if (p[-1] == '-' && p[-2] == '-')
-          return p + 1;
-        break;
-      case '-':
-      at_dash:
-        if (p[-1] == '-')
-          {
-          at_dash_dash:
-            if (++p == end) return NULL;
-            switch (p[0])
-              {
-              case '>': return p + 1;
-              case '-': goto at_dash_dash;
-              }
-          }
-        else
-          {
-            if ((p += 2) >= end) return NULL;
-            switch (p[0])
-              {
-              case '>':
-                if (p[-1] == '-')
-                  return p + 1;
-                break;
-              case '-':
-                goto at_dash;
-              }
-          }
-      }
+  while ((p = memchr (p, '>', end - p)) != NULL)
+    {
+      if (p - beg >= 2 && p[-1] == '-' && p[-2] == '-')
+        return p + 1;
+      ++p;
+    }
   return NULL;
 }
-
+
+/* Return the first position in [P, END) holding either C1 or C2, or
+   END if there is none.  This is memchr for two characters, used to
+   get through attribute values, which are the longest stretches
+   scanned within a tag.  Where the compiler targets SSE2 or NEON, 16
+   bytes are compared at a time.  */
+
+static const char *
+find_either (const char *p, const char *end, char c1, char c2)
+{
+#if defined SCAN_SSE2
+  const __m128i v1 = _mm_set1_epi8 (c1);
+  const __m128i v2 = _mm_set1_epi8 (c2);
+  while (end - p >= 16)
+    {
+      __m128i chunk = _mm_loadu_si128 ((const __m128i *) p);
+      int mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (chunk, v1),
+                                                  _mm_cmpeq_epi8 (chunk, v2)));
+      if (mask)
+        return p + __builtin_ctz (mask);
+      p += 16;
+    }
+#elif defined SCAN_NEON
+  const uint8x16_t v1 = vdupq_n_u8 ((uint8_t) c1);
+  const uint8x16_t v2 = vdupq_n_u8 ((uint8_t) c2);
+  while (end - p >= 16)
+    {
+      uint8x16_t chunk = vld1q_u8 ((const uint8_t *) p);
+      uint8x16_t hit = vorrq_u8 (vceqq_u8 (chunk, v1), vceqq_u8 (chunk, v2));
+      if (vmaxvq_u8 (hit))
+        break;                  /* the loop below finds it */
+      p += 16;
+    }
+#endif
+  while (p < end && *p != c1 && *p != c2)
+    ++p;
+  return p;
+}
+
 /* Return true if the string containing of characters inside [b, e) is
-   present in hash table HT.  */
+   accepted by FILTER, or if there is no FILTER.  */
 
 static bool
-name_allowed (const struct hash_table *ht, const char *b, const char *e)
+name_allowed (html_name_filter_t filter, const char *b, const char *e)
 {
-  char *copy;
-  if (!ht)
-    return true;
-  BOUNDED_TO_ALLOCA (b, e, copy);
-  return hash_table_get (ht, copy) != NULL;
+  return !filter || filter (b, e - b);
 }
 
 /* Advance P (a char pointer), with the explicit intent of being able
@@ -817,22 +850,31 @@ static int tag_backout_count;
    MAPFUN will be called with two arguments: pointer to an initialized
    struct taginfo, and MAPARG.
 
-   ALLOWED_TAGS and ALLOWED_ATTRIBUTES are hash tables the keys of
-   which are the tags and attribute names that this function should
-   use.  If ALLOWED_TAGS is NULL, all tags are processed; if
-   ALLOWED_ATTRIBUTES is NULL, all attributes are returned.
+   ALLOWED_TAGS and ALLOWED_ATTRIBUTES tell which tags and attribute
+   names this function should use.  If ALLOWED_TAGS is NULL, all tags
+   are processed; if ALLOWED_ATTRIBUTES is NULL, all attributes are
+   returned.
 
    (Obviously, the caller can filter out unwanted tags and attributes
    just as well, but this is just an optimization designed to avoid
    unnecessary copying of tags/attributes which the caller doesn't
-   care about.)  */
-
-void
+   care about.)
+
+   With MHT_PARTIAL in FLAGS, TEXT is taken to be the part of a
+   document that has arrived so far.  Parsing then stops at the first
+   tag, comment or declaration that isn't complete within TEXT, so
+   that every tag reported is one that the whole document would
+   report as well.  The return value is the number of characters of
+   TEXT that have been dealt with; the caller passes the rest again,
+   with more data appended, to continue.  Tags whose start was in an
+   earlier call get no contents.  */
+
+int
 map_html_tags (const char *text, int size,
                void (*mapfun) (struct taginfo *, void *), void *maparg,
                int flags,
-               const struct hash_table *allowed_tags,
-               const struct hash_table *allowed_attributes)
+               html_name_filter_t allowed_tags,
+               html_name_filter_t allowed_attributes)
 {
   /* storage for strings passed to MAPFUN callback; if 256 bytes is
      too little, POOL_APPEND allocates more with malloc. */
@@ -849,9 +891,14 @@ map_html_tags (const char *text, int size,
 
   struct tagstack_item *head = NULL;
   struct tagstack_item *tail = NULL;
+  struct tagstack_item *spare = NULL;
+
+  /* Everything before this has been parsed for good.  */
+  const char *done = text;
+  bool partial = !!(flags & MHT_PARTIAL);
 
   if (!size)
-    return;
+    return 0;
 
   POOL_INIT (&pool, pool_initial_storage, countof (pool_initial_storage));
 
@@ -863,6 +910,7 @@ map_html_tags (const char *text, int size,
 
   look_for_tag:
     POOL_REWIND (&pool);
+    done = p;
 
     nattrs = 0;
     end_tag = 0;
@@ -880,6 +928,8 @@ map_html_tags (const char *text, int size,
        declaration).  */
     if (*p == '!')
       {
+        if (partial && end - p < 3)
+          goto finish;
         if (!(flags & MHT_STRICT_COMMENTS)
             && p < end + 3 && p[1] == '-' && p[2] == '-')
           {
@@ -891,6 +941,8 @@ map_html_tags (const char *text, int size,
             const char *comment_end = find_comment_end (p + 3, end);
             if (comment_end)
               p = comment_end;
+            else if (partial)
+              goto finish;
           }
         else
           {
@@ -898,10 +950,20 @@ map_html_tags (const char *text, int size,
                declaration.  Real declarations are much less likely to
                be misused the way comments are, so advance over them
                properly regardless of strictness.  */
-            p = advance_declaration (p, end);
+            const char *decl_end = advance_declaration (p, end);
+            if (!decl_end)
+              {
+                if (partial)
+                  goto finish;
+                decl_end = p + 1;
+              }
+            p = decl_end;
           }
         if (p == end)
-          goto finish;
+          {
+            done = p;
+            goto finish;
+          }
         goto look_for_tag;
       }
     else if (*p == '/')
@@ -919,7 +981,7 @@ map_html_tags (const char *text, int size,
 
     if (!end_tag)
       {
-        struct tagstack_item *ts = tagstack_push (&head, &tail);
+        struct tagstack_item *ts = tagstack_push (&head, &tail, &spare);
         if (ts)
           {
             ts->tagname_begin  = tag_name_begin;
@@ -1005,6 +1067,14 @@ map_html_tags (const char *text, int size,
                                       /*           ^     */
                 while (*p != quote_char)
                   {
+                    if (!newline_seen)
+                      {
+                        p = find_either (p, end, quote_char, '\n');
+                        if (p == end)
+                          goto finish;
+                        if (*p == quote_char)
+                          break;
+                      }
                     if (!newline_seen && *p == '\n')
                       {
                         /* If a newline is seen within the quotes, it
@@ -1095,9 +1165,12 @@ map_html_tags (const char *text, int size,
         tail->contents_begin = p+1;
       }
 
+    /* Here and below, P is advanced past the end of the tag without
+       ADVANCE, so that reaching the end of TEXT is noticed only at
+       look_for_tag, with the tag counted as done.  */
     if (uninteresting_tag)
       {
-        ADVANCE (p);
+        ++p;
         goto look_for_tag;
       }
 
@@ -1136,13 +1209,13 @@ map_html_tags (const char *text, int size,
                   taginfo.contents_begin = ts->contents_begin;
                   taginfo.contents_end   = tag_start_position;
                 }
-              tagstack_pop (&head, &tail, ts);
+              tagstack_pop (&head, &tail, &spare, ts);
             }
         }
 
       mapfun (&taginfo, maparg);
       if (*p != '<')
-        ADVANCE (p);
+        ++p;
     }
     goto look_for_tag;
 
@@ -1160,8 +1233,10 @@ map_html_tags (const char *text, int size,
   POOL_FREE (&pool);
   if (attr_pair_resized)
     xfree (pairs);
-  /* pop any tag stack that's left */
-  tagstack_pop (&head, &tail, head);
+  /* free any tag stack that's left, and the spare items */
+  tagstack_free (head);
+  tagstack_free (spare);
+  return partial ? done - text : size;
 }
 
 #undef ADVANCE
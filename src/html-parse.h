@@ -57,15 +57,20 @@ struct taginfo {
   const char *contents_end;     /* only valid if end_tag_p */
 };
 
-struct hash_table;		/* forward declaration */
+/* Return true if the tag or attribute name of the given length is of
+   interest.  The name is as found in the document, in any case.  */
+typedef bool (*html_name_filter_t) (const char *, int);
 
 /* Flags for map_html_tags: */
 #define MHT_STRICT_COMMENTS  1  /* use strict comment interpretation */
 #define MHT_TRIM_VALUES      2  /* trim attribute values, e.g. interpret
                                    <a href=" foo "> as "foo" */
+#define MHT_PARTIAL          4  /* the text is only the beginning of the
+                                   document; stop at the first construct
+                                   that may continue past its end */
 
-void map_html_tags (const char *, int,
-		    void (*) (struct taginfo *, void *), void *, int,
-		    const struct hash_table *, const struct hash_table *);
+int map_html_tags (const char *, int,
+		   void (*) (struct taginfo *, void *), void *, int,
+		   html_name_filter_t, html_name_filter_t);
 
 #endif /* HTML_PARSE_H */
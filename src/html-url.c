@@ -45,6 +45,13 @@ as that of the covered work.  */
 #include "recur.h"
 #include "html-url.h"
 #include "css-url.h"
+#include "arena.h"
+#include "parallel.h"
+#include "retr.h"
+
+#ifdef TESTING
+#include "test.h"
+#endif
 
 typedef void (*tag_handler_t) (int, struct taginfo *, struct map_context *);
 
@@ -160,9 +167,8 @@ static struct {
   { TAG_TH,             "background",   ATTR_INLINE }
 };
 
-/* The lists of interesting tags and attributes are built dynamically,
-   from the information above.  However, some places in the code refer
-   to the attributes not mentioned here.  We add them manually.  */
+/* Besides those in tag_url_attributes, some places in the code refer
+   to the attributes not mentioned there.  They are listed here.  */
 static const char *additional_attributes[] = {
   "rel",                        /* used by tag_handle_link  */
   "type",                       /* used by tag_handle_link  */
@@ -173,8 +179,103 @@ static const char *additional_attributes[] = {
   "style"                       /* used by check_style_attr */
 };
 
-static struct hash_table *interesting_tags;
-static struct hash_table *interesting_attributes;
+/* The names in known_tags, and the attributes in tag_url_attributes
+   and additional_attributes, are looked up with perfect hashes in the
+   style of gperf: the hash of a name is its length plus the values
+   assigned to its first and last letters, which were chosen so that
+   no two names of a list collide.  A lookup is then a computation and
+   a comparison, and there are no tables to build at startup.  When
+   adding to the lists, the values have to be chosen anew;
+   test_html_name_hashes checks them.  */
+
+static const unsigned char tag_letter_values[26] = {
+  3, 0, 0, 5, 9, 13, 34, 2, 10, 0, 32, 6, 23,
+  0, 13, 0, 0, 25, 33, 2, 0, 0, 0, 0, 4, 0
+};
+
+/* Indices into known_tags, by hash.  */
+static const signed char tag_hash_table[] = {
+  -1, -1, -1, -1, -1, -1, 21, 0, 5, 20, 2, 1, 4,
+  3, -1, -1, 19, 12, -1, 6, -1, 16, -1, -1, 17, 10,
+  -1, 9, -1, -1, 15, -1, -1, -1, -1, -1, 13, -1, -1,
+  -1, 8, 18, 14, -1, -1, -1, -1, 11, -1, -1, 7
+};
+
+static const unsigned char attr_letter_values[26] = {
+  4, 21, 15, 2, 17, 9, 0, 5, 0, 0, 0, 1, 0,
+  5, 0, 0, 0, 8, 2, 9, 0, 22, 0, 0, 0, 0
+};
+
+static const char *const attr_hash_table[] = {
+  NULL, NULL, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, NULL, "data", NULL,
+  "rel", NULL, NULL, "action", NULL, NULL,
+  "href", NULL, "src", NULL, "lowsrc", NULL,
+  "style", NULL, "name", NULL, NULL, NULL,
+  "type", "content", NULL, "background", NULL, NULL,
+  "code", "http-equiv"
+};
+
+/* Return the hash of NAME, LEN characters long, computed with
+   VALUES, or -1 if NAME can't be in a table of SIZE entries.  */
+
+static int
+html_name_hash (const char *name, int len, const unsigned char *values,
+                int size)
+{
+  int first, last, hash;
+  if (len <= 0)
+    return -1;
+  first = c_tolower (name[0]);
+  last = c_tolower (name[len - 1]);
+  if (first < 'a' || first > 'z' || last < 'a' || last > 'z')
+    return -1;
+  hash = len + values[first - 'a'] + values[last - 'a'];
+  return hash < size ? hash : -1;
+}
+
+/* Return true if NAME, LEN characters long and in any case, is KNOWN,
+   which is in lower case.  */
+
+static bool
+html_name_equal (const char *name, int len, const char *known)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    if (c_tolower (name[i]) != known[i])
+      return false;
+  return known[len] == '\0';
+}
+
+/* Return the entry of known_tags for the tag NAME, LEN characters
+   long, or NULL if there is none.  */
+
+static struct known_tag *
+known_tag_lookup (const char *name, int len)
+{
+  int hash = html_name_hash (name, len, tag_letter_values,
+                             countof (tag_hash_table));
+  struct known_tag *t;
+  if (hash < 0 || tag_hash_table[hash] < 0)
+    return NULL;
+  t = &known_tags[(int) tag_hash_table[hash]];
+  return html_name_equal (name, len, t->name) ? t : NULL;
+}
+
+/* The attribute filter for map_html_tags.  */
+
+static bool
+interesting_attribute_p (const char *name, int len)
+{
+  int hash = html_name_hash (name, len, attr_letter_values,
+                             countof (attr_hash_table));
+  return (hash >= 0 && attr_hash_table[hash]
+          && html_name_equal (name, len, attr_hash_table[hash]));
+}
+
+/* Tags removed through --ignore-tags and --follow-tags, by tagid.  */
+static bool tag_ignored[countof (known_tags)];
+static bool tags_initialized;
 
 /* Will contains the (last) charset found in 'http-equiv=content-type'
    meta tags  */
@@ -183,56 +284,46 @@ static char *meta_charset;
 static void
 init_interesting (void)
 {
-  /* Init the variables interesting_tags and interesting_attributes
-     that are used by the HTML parser to know which tags and
-     attributes we're interested in.  We initialize this only once,
-     for performance reasons.
-
-     Here we also make sure that what we put in interesting_tags
-     matches the user's preferences as specified through --ignore-tags
-     and --follow-tags.  */
+  /* Make sure that the tags we handle match the user's preferences
+     as specified through --ignore-tags and --follow-tags.  This is
+     done only once.  */
 
   size_t i;
-  interesting_tags = make_nocase_string_hash_table (countof (known_tags));
 
-  /* First, add all the tags we know hot to handle, mapped to their
-     respective entries in known_tags.  */
-  for (i = 0; i < countof (known_tags); i++)
-    hash_table_put (interesting_tags, known_tags[i].name, known_tags + i);
+  if (tags_initialized)
+    return;
+  tags_initialized = true;
 
-  /* Then remove the tags ignored through --ignore-tags.  */
+  /* Remove the tags ignored through --ignore-tags.  */
   if (opt.ignore_tags)
     {
       char **ignored;
       for (ignored = opt.ignore_tags; *ignored; ignored++)
-        hash_table_remove (interesting_tags, *ignored);
+        {
+          struct known_tag *t = known_tag_lookup (*ignored, strlen (*ignored));
+          if (t)
+            tag_ignored[t->tagid] = true;
+        }
     }
 
-  /* If --follow-tags is specified, use only those tags.  */
+  /* If --follow-tags is specified, use only those of the remaining
+     tags.  Unknown --follow-tags entries are ignored.  */
   if (opt.follow_tags)
     {
-      /* Create a new table intersecting --follow-tags and known_tags,
-         and use it as interesting_tags.  */
-      struct hash_table *intersect = make_nocase_string_hash_table (0);
+      bool followed_p[countof (known_tags)];
       char **followed;
+      xzero (followed_p);
       for (followed = opt.follow_tags; *followed; followed++)
         {
-          struct known_tag *t = hash_table_get (interesting_tags, *followed);
-          if (!t)
-            continue;           /* ignore unknown --follow-tags entries. */
-          hash_table_put (intersect, *followed, t);
+          struct known_tag *t = known_tag_lookup (*followed,
+                                                  strlen (*followed));
+          if (t)
+            followed_p[t->tagid] = true;
         }
-      hash_table_destroy (interesting_tags);
-      interesting_tags = intersect;
+      for (i = 0; i < countof (known_tags); i++)
+        if (!followed_p[i])
+          tag_ignored[i] = true;
     }
-
-  /* Add the attributes we care about. */
-  interesting_attributes = make_nocase_string_hash_table (10);
-  for (i = 0; i < countof (additional_attributes); i++)
-    hash_table_put (interesting_attributes, additional_attributes[i], "1");
-  for (i = 0; i < countof (tag_url_attributes); i++)
-    hash_table_put (interesting_attributes,
-                    tag_url_attributes[i].attr_name, "1");
 }
 
 /* Find the value of attribute named NAME in the taginfo TAG.  If the
@@ -325,7 +416,8 @@ append_url (const char *link_uri, int position, int size,
 
   DEBUGP (("appending %s to urlpos.\n", quote (url->url)));
 
-  newel = xnew0 (struct urlpos);
+  newel = arena_alloc0 (ctx->arena, sizeof *newel);
+  newel->arena = ctx->arena;
   newel->url = url;
   newel->pos = position;
   newel->size = size;
@@ -337,9 +429,15 @@ append_url (const char *link_uri, int position, int size,
   else if (link_has_scheme)
     newel->link_complete_p = 1;
 
-  /* Append the new URL maintaining the order by position.  */
+  /* Append the new URL maintaining the order by position.  Links
+     almost always come in document order, so check the tail first.  */
   if (ctx->head == NULL)
-    ctx->head = newel;
+    ctx->head = ctx->tail = newel;
+  else if (position >= ctx->tail->pos)
+    {
+      ctx->tail->next = newel;
+      ctx->tail = newel;
+    }
   else
     {
       struct urlpos *it, *prev = NULL;
@@ -661,16 +759,12 @@ collect_tags_mapper (struct taginfo *tag, void *arg)
 {
   struct map_context *ctx = (struct map_context *)arg;
 
-  /* Find the tag in our table of tags.  This must not fail because
-     map_html_tags only returns tags found in interesting_tags.
-
-     I've changed this for now, I'm passing NULL as interesting_tags
-     to map_html_tags.  This way we can check all tags for a style
-     attribute.
-  */
-  struct known_tag *t = hash_table_get (interesting_tags, tag->name);
+  /* Find the tag in our table of tags.  map_html_tags is given no
+     tag filter, so that all tags can be checked for a style
+     attribute.  */
+  struct known_tag *t = known_tag_lookup (tag->name, strlen (tag->name));
 
-  if (t != NULL)
+  if (t != NULL && !tag_ignored[t->tagid])
     t->handler (t->tagid, tag, ctx);
 
   check_style_attr (tag, ctx);
@@ -685,6 +779,25 @@ collect_tags_mapper (struct taginfo *tag, void *arg)
   }
 }
 
+/* Return the flags with which documents are passed to map_html_tags.
+
+   Specify MHT_TRIM_VALUES because of buggy HTML generators that
+   generate <a href=" foo"> instead of <a href="foo"> (browsers ignore
+   spaces as well.)  If you really mean space, use &32; or %20.
+   MHT_TRIM_VALUES also causes squashing of embedded newlines,
+   e.g. in <img src="foo.[newline]html">.  Such newlines are also
+   ignored by IE and Mozilla and are presumably introduced by writing
+   HTML with editors that force word wrap.  */
+
+static int
+html_parse_flags (void)
+{
+  int flags = MHT_TRIM_VALUES;
+  if (opt.strict_comments)
+    flags |= MHT_STRICT_COMMENTS;
+  return flags;
+}
+
 /* Analyze HTML tags FILE and construct a list of URLs referenced from
    it.  It merges relative links in FILE with URL.  It is aware of
    <base href=...> and does the right thing.  */
@@ -695,10 +808,9 @@ get_urls_html (const char *file, const char *url, bool *meta_disallow_follow,
 {
   struct file_memory *fm;
   struct map_context ctx;
-  int flags;
 
   /* Load the file. */
-  fm = wget_read_file (file);
+  fm = link_stream_read_file (file);
   if (!fm)
     {
       logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
@@ -707,29 +819,17 @@ get_urls_html (const char *file, const char *url, bool *meta_disallow_follow,
   DEBUGP (("Loaded %s (size %s).\n", file, number_to_static_string (fm->length)));
 
   ctx.text = fm->content;
-  ctx.head = NULL;
+  ctx.head = ctx.tail = NULL;
+  ctx.arena = arena_new ();
   ctx.base = NULL;
   ctx.parent_base = url ? url : opt.base_href;
   ctx.document_file = file;
   ctx.nofollow = false;
 
-  if (!interesting_tags)
-    init_interesting ();
-
-  /* Specify MHT_TRIM_VALUES because of buggy HTML generators that
-     generate <a href=" foo"> instead of <a href="foo"> (browsers
-     ignore spaces as well.)  If you really mean space, use &32; or
-     %20.  MHT_TRIM_VALUES also causes squashing of embedded newlines,
-     e.g. in <img src="foo.[newline]html">.  Such newlines are also
-     ignored by IE and Mozilla and are presumably introduced by
-     writing HTML with editors that force word wrap.  */
-  flags = MHT_TRIM_VALUES;
-  if (opt.strict_comments)
-    flags |= MHT_STRICT_COMMENTS;
+  init_interesting ();
 
-  /* the NULL here used to be interesting_tags */
-  map_html_tags (fm->content, fm->length, collect_tags_mapper, &ctx, flags,
-                 NULL, interesting_attributes);
+  map_html_tags (fm->content, fm->length, collect_tags_mapper, &ctx,
+                 html_parse_flags (), NULL, interesting_attribute_p);
 
   /* If meta charset isn't null, override content encoding */
   if (iri && meta_charset)
@@ -741,45 +841,331 @@ get_urls_html (const char *file, const char *url, bool *meta_disallow_follow,
 
   xfree_null (ctx.base);
   wget_read_file_free (fm);
+  if (!ctx.head)
+    arena_free (ctx.arena);
   return ctx.head;
 }
 
-/* This doesn't really have anything to do with HTML, but it's similar
-   to get_urls_html, so we put it here.  */
+/* Documents are captured in memory while they are being downloaded,
+   so that their links can be extracted without reading them back
+   from disk.  In a parallel worker, the links of an HTML document are
+   also passed to the parent as they are found, so that it can hand
+   them to other workers before the document is complete.  */
+
+/* Whether http.c should capture the documents it downloads.  */
+bool link_capture;
+
+/* Larger documents are read back from disk.  */
+#define LINK_STREAM_MAX (64 * 1024 * 1024)
+
+/* Links are not announced if the head of the document is longer than
+   this, or has no end that can be recognized.  */
+#define LINK_STREAM_HEAD_MAX (256 * 1024)
+
+struct link_stream {
+  char *file;			/* the file the document is saved to */
+  char *url;			/* the document's URL */
+  char *buf;			/* the data received so far */
+  int len, size;
+  bool overflow;		/* too large to keep */
+
+  /* Whether the document is only kept here, without being saved.  If
+     it turns out too large, it is written out to FILE after all,
+     through SPILL.  */
+  bool in_memory;
+  FILE *spill;
+
+  /* Used when announcing links to the parent.  BUF then only holds
+     what map_html_tags hasn't finished with.  */
+  bool announce;
+  bool head_done;		/* whether the <head> is over */
+  struct map_context ctx;
+};
 
-struct urlpos *
-get_urls_file (const char *file)
+/* The last document captured, ready for link_stream_read_file.  */
+static struct link_stream *captured;
+
+static void
+link_stream_free (struct link_stream *ls)
+{
+  if (ls->announce)
+    {
+      free_urlpos (ls->ctx.head);
+      if (!ls->ctx.head)
+        arena_free (ls->ctx.arena);
+      xfree_null (ls->ctx.base);
+    }
+  if (ls->spill)
+    fclose (ls->spill);
+  xfree (ls->file);
+  xfree (ls->url);
+  xfree_null (ls->buf);
+  xfree (ls);
+}
+
+/* Start capturing the document at URL, which is being saved to FILE.
+   IS_CSS tells whether it is CSS rather than HTML.  If IN_MEMORY is
+   true, the document is not being saved, and the capture is all
+   there is of it unless it grows too large.  */
+
+struct link_stream *
+link_stream_new (const char *file, const char *url, bool is_css,
+                 bool in_memory)
+{
+  struct link_stream *ls = xnew0 (struct link_stream);
+  ls->file = xstrdup (file);
+  ls->url = xstrdup (url);
+  ls->in_memory = in_memory;
+
+  /* A charset found in the document changes how its links are
+     encoded, so with IRI support they are left to the parent.  */
+  if (parallel_worker_p () && !is_css && !opt.enable_iri)
+    {
+      ls->announce = true;
+      ls->ctx.arena = arena_new ();
+      ls->ctx.parent_base = ls->url;
+      ls->ctx.document_file = ls->file;
+      init_interesting ();
+    }
+  return ls;
+}
+
+/* Stop capturing LS and release what it holds.  */
+
+static void
+link_stream_drop (struct link_stream *ls)
+{
+  xfree_null (ls->buf);
+  ls->buf = NULL;
+  ls->len = ls->size = 0;
+  ls->overflow = true;
+}
+
+static void
+stream_tags_mapper (struct taginfo *tag, void *arg)
+{
+  struct link_stream *ls = arg;
+
+  /* A <meta> in the head may still change what is to be done with
+     the links, so only announce them once it is over.  */
+  if (!ls->head_done
+      && ((!tag->end_tag_p && 0 == strcasecmp (tag->name, "body"))
+          || (tag->end_tag_p && 0 == strcasecmp (tag->name, "head"))))
+    ls->head_done = true;
+
+  collect_tags_mapper (tag, &ls->ctx);
+}
+
+/* Parse what has arrived of the document and announce the links
+   found in it.  */
+
+static void
+link_stream_announce (struct link_stream *ls)
+{
+  struct urlpos *up;
+  int done;
+
+  ls->ctx.text = ls->buf;
+  done = map_html_tags (ls->buf, ls->len, stream_tags_mapper, ls,
+                        html_parse_flags () | MHT_PARTIAL,
+                        NULL, interesting_attribute_p);
+  if (opt.use_robots && ls->ctx.nofollow)
+    {
+      /* <meta name=robots content=nofollow>: there is nothing to
+         announce, now or later.  */
+      link_stream_drop (ls);
+      return;
+    }
+  if (!ls->head_done)
+    {
+      /* Keep the links, and the text their positions refer to, until
+         the head is over.  */
+      if (ls->len > LINK_STREAM_HEAD_MAX)
+        link_stream_drop (ls);
+      return;
+    }
+
+  for (up = ls->ctx.head; up; up = up->next)
+    if (!up->ignore_when_downloading)
+      parallel_forward_link (ls->url, up->url->url,
+                             (up->link_relative_p ? PLINK_RELATIVE : 0)
+                             | (up->link_inline_p ? PLINK_INLINE : 0)
+                             | (up->link_expect_html ? PLINK_EXPECT_HTML : 0)
+                             | (up->link_expect_css ? PLINK_EXPECT_CSS : 0));
+  if (ls->ctx.head)
+    {
+      free_urlpos (ls->ctx.head);
+      ls->ctx.head = ls->ctx.tail = NULL;
+      ls->ctx.arena = arena_new ();
+    }
+
+  ls->len -= done;
+  memmove (ls->buf, ls->buf + done, ls->len);
+}
+
+/* Write the document captured by LS out to its file, which it has
+   grown too large to be kept in memory.  */
+
+static bool
+link_stream_spill (struct link_stream *ls)
+{
+  DEBUGP (("Writing out %s, too large to keep in memory.\n", ls->file));
+  mkalldirs (ls->file);
+  ls->spill = fopen (ls->file, "wb");
+  if (!ls->spill)
+    return false;
+  if (ls->len)
+    fwrite (ls->buf, 1, ls->len, ls->spill);
+  link_stream_drop (ls);
+  return !ferror (ls->spill);
+}
+
+/* Add the LEN bytes at BUF to the document captured by LS.  Returns
+   false if the document had to be written out, and that failed.  */
+
+bool
+link_stream_feed (struct link_stream *ls, const char *buf, int len)
+{
+  if (ls->spill)
+    {
+      fwrite (buf, 1, len, ls->spill);
+      return !ferror (ls->spill);
+    }
+  if (ls->overflow)
+    return true;
+  if (ls->len + len > LINK_STREAM_MAX)
+    {
+      if (ls->in_memory)
+        return link_stream_spill (ls) && link_stream_feed (ls, buf, len);
+      link_stream_drop (ls);
+      return true;
+    }
+  /* One more byte, for the parsers that peek past the end.  */
+  DO_REALLOC (ls->buf, ls->size, ls->len + len + 1, char);
+  memcpy (ls->buf + ls->len, buf, len);
+  ls->len += len;
+  ls->buf[ls->len] = '\0';
+
+  if (ls->announce)
+    link_stream_announce (ls);
+  return true;
+}
+
+/* Finish capturing.  COMPLETE tells whether the whole document was
+   received; if so, link_stream_read_file will be able to use it.
+   Returns true if the document was only kept in memory, so that there
+   is no file of it.  */
+
+bool
+link_stream_finish (struct link_stream *ls, bool complete)
+{
+  bool unsaved = ls->in_memory && !ls->spill;
+
+  if (!complete || ls->overflow || ls->announce)
+    {
+      link_stream_free (ls);
+      return unsaved;
+    }
+  if (captured)
+    link_stream_free (captured);
+  captured = ls;
+  return unsaved;
+}
+
+/* Return the contents of FILE like wget_read_file, but without
+   reading it when it is the document just captured.  */
+
+struct file_memory *
+link_stream_read_file (const char *file)
 {
   struct file_memory *fm;
-  struct urlpos *head, *tail;
-  const char *text, *text_end;
+  struct link_stream *ls = captured;
+
+  if (!ls || 0 != strcmp (ls->file, file))
+    return wget_read_file (file);
+
+  DEBUGP (("Using the copy of %s captured during download.\n", file));
+  captured = NULL;
+  fm = xnew (struct file_memory);
+  fm->content = ls->buf ? ls->buf : xstrdup ("");
+  fm->length = ls->len;
+  fm->mmap_p = 0;
+  ls->buf = NULL;
+  link_stream_free (ls);
+  return fm;
+}
 
-  /* Load the file.  */
-  fm = wget_read_file (file);
-  if (!fm)
+/* Return the number of bytes taken by the documents being parsed.  */
+
+size_t
+link_stream_memory (void)
+{
+  size_t size = 0;
+  if (captured)
+    size += sizeof *captured + captured->size;
+  if (body_link_stream)
+    size += sizeof *body_link_stream + body_link_stream->size;
+  return size;
+}
+
+/* Drop the captured document, if any.  */
+
+void
+link_stream_cleanup (void)
+{
+  if (captured)
+    link_stream_free (captured);
+  captured = NULL;
+}
+
+/* A file of URLs, one per line, read a line at a time so that a list
+   of millions of URLs needn't be held in memory, and the first
+   download can start before the whole list has been read.  */
+
+struct urls_file {
+  FILE *fp;
+  char *name;
+};
+
+/* Open FILE, or the standard input if FILE is "-", for reading URLs
+   with urls_file_next.  Returns NULL, after printing an error, if the
+   file cannot be opened.  */
+
+struct urls_file *
+urls_file_open (const char *file)
+{
+  struct urls_file *uf;
+  FILE *fp = HYPHENP (file) ? stdin : fopen (file, "r");
+
+  if (!fp)
     {
       logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
       return NULL;
     }
-  DEBUGP (("Loaded %s (size %s).\n", file, number_to_static_string (fm->length)));
+  uf = xnew (struct urls_file);
+  uf->fp = fp;
+  uf->name = xstrdup (file);
+  return uf;
+}
 
-  head = tail = NULL;
-  text = fm->content;
-  text_end = fm->content + fm->length;
-  while (text < text_end)
+/* Return the next URL of UF, as a freshly allocated urlpos with a NULL
+   next pointer, or NULL at the end of the file.  Empty lines are
+   skipped, and invalid URLs are reported and skipped.  */
+
+struct urlpos *
+urls_file_next (struct urls_file *uf)
+{
+  char *line;
+
+  while ((line = read_whole_line (uf->fp)) != NULL)
     {
       int up_error_code;
       char *url_text;
       struct urlpos *entry;
       struct url *url;
 
-      const char *line_beg = text;
-      const char *line_end = memchr (text, '\n', text_end - text);
-      if (!line_end)
-        line_end = text_end;
-      else
-        ++line_end;
-      text = line_end;
+      const char *line_beg = line;
+      const char *line_end = line + strlen (line);
 
       /* Strip whitespace from the beginning and end of line. */
       while (line_beg < line_end && c_isspace (*line_beg))
@@ -788,13 +1174,14 @@ get_urls_file (const char *file)
         --line_end;
 
       if (line_beg == line_end)
-        continue;
+        {
+          xfree (line);
+          continue;
+        }
 
       /* The URL is in the [line_beg, line_end) region. */
-
-      /* We must copy the URL to a zero-terminated string, and we
-         can't use alloca because we're in a loop.  *sigh*.  */
       url_text = strdupdelim (line_beg, line_end);
+      xfree (line);
 
       if (opt.base_href)
         {
@@ -809,7 +1196,7 @@ get_urls_file (const char *file)
         {
           char *error = url_error (url_text, up_error_code);
           logprintf (LOG_NOTQUIET, _("%s: Invalid URL %s: %s\n"),
-                     file, url_text, error);
+                     uf->name, url_text, error);
           xfree (url_text);
           xfree (error);
           inform_exit_status (URLERROR);
@@ -819,24 +1206,121 @@ get_urls_file (const char *file)
 
       entry = xnew0 (struct urlpos);
       entry->url = url;
+      return entry;
+    }
+  if (ferror (uf->fp))
+    logprintf (LOG_NOTQUIET, "%s: %s\n", uf->name, strerror (errno));
+  return NULL;
+}
+
+/* Close UF.  */
+
+void
+urls_file_close (struct urls_file *uf)
+{
+  if (uf->fp != stdin)
+    fclose (uf->fp);
+  xfree (uf->name);
+  xfree (uf);
+}
+
+/* This doesn't really have anything to do with HTML, but it's similar
+   to get_urls_html, so we put it here.  */
 
+struct urlpos *
+get_urls_file (const char *file)
+{
+  struct urls_file *uf;
+  struct urlpos *head, *tail, *entry;
+
+  uf = urls_file_open (file);
+  if (!uf)
+    return NULL;
+
+  head = tail = NULL;
+  while ((entry = urls_file_next (uf)) != NULL)
+    {
       if (!head)
         head = entry;
       else
         tail->next = entry;
       tail = entry;
     }
-  wget_read_file_free (fm);
+  urls_file_close (uf);
   return head;
 }
 
 void
 cleanup_html_url (void)
 {
-  /* Destroy the hash tables.  The hash table keys and values are not
-     allocated by this code, so we don't need to free them here.  */
-  if (interesting_tags)
-    hash_table_destroy (interesting_tags);
-  if (interesting_attributes)
-    hash_table_destroy (interesting_attributes);
+  xfree_null (meta_charset);
+  meta_charset = NULL;
+}
+
+#ifdef TESTING
+
+const char *
+test_html_name_hashes (void)
+{
+  size_t i, j, count = 0;
+
+  for (i = 0; i < countof (known_tags); i++)
+    {
+      const char *name = known_tags[i].name;
+      char upper[16];
+      mu_assert ("test_html_name_hashes: tagid is not the index",
+                 known_tags[i].tagid == (int) i);
+      mu_assert ("test_html_name_hashes: tag not found",
+                 known_tag_lookup (name, strlen (name)) == &known_tags[i]);
+      for (j = 0; name[j]; j++)
+        upper[j] = c_toupper (name[j]);
+      mu_assert ("test_html_name_hashes: upper-case tag not found",
+                 known_tag_lookup (upper, j) == &known_tags[i]);
+    }
+  for (i = 0; i < countof (tag_hash_table); i++)
+    if (tag_hash_table[i] >= 0)
+      ++count;
+  mu_assert ("test_html_name_hashes: stray entries in tag_hash_table",
+             count == countof (known_tags));
+
+  for (i = 0; i < countof (tag_url_attributes); i++)
+    {
+      const char *name = tag_url_attributes[i].attr_name;
+      mu_assert ("test_html_name_hashes: URL attribute not found",
+                 interesting_attribute_p (name, strlen (name)));
+    }
+  for (i = 0; i < countof (additional_attributes); i++)
+    {
+      const char *name = additional_attributes[i];
+      mu_assert ("test_html_name_hashes: additional attribute not found",
+                 interesting_attribute_p (name, strlen (name)));
+    }
+  for (i = 0; i < countof (attr_hash_table); i++)
+    {
+      const char *name = attr_hash_table[i];
+      bool listed = false;
+      if (!name)
+        continue;
+      for (j = 0; j < countof (tag_url_attributes); j++)
+        if (!strcmp (name, tag_url_attributes[j].attr_name))
+          listed = true;
+      for (j = 0; j < countof (additional_attributes); j++)
+        if (!strcmp (name, additional_attributes[j]))
+          listed = true;
+      mu_assert ("test_html_name_hashes: stray entry in attr_hash_table",
+                 listed);
+    }
+
+  mu_assert ("test_html_name_hashes: HREF",
+             interesting_attribute_p ("HREF", 4));
+  mu_assert ("test_html_name_hashes: prefix accepted",
+             !interesting_attribute_p ("hre", 3));
+  mu_assert ("test_html_name_hashes: longer name accepted",
+             !interesting_attribute_p ("hrefs", 5));
+  mu_assert ("test_html_name_hashes: unknown tag found",
+             !known_tag_lookup ("abbr", 4) && !known_tag_lookup ("", 0)
+             && !known_tag_lookup ("a1", 2));
+  return NULL;
 }
+
+#endif /* TESTING */
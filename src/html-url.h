@@ -41,11 +41,26 @@ struct map_context {
                                    <meta name=robots> tag. */
 
   struct urlpos *head;	/* List of URLs that is being built. */
+  struct urlpos *tail;		/* Its last element. */
+  struct arena *arena;		/* Arena the list is allocated from. */
 };
 
+struct urls_file;
+struct urls_file *urls_file_open (const char *);
+struct urlpos *urls_file_next (struct urls_file *);
+void urls_file_close (struct urls_file *);
 struct urlpos *get_urls_file (const char *);
 struct urlpos *get_urls_html (const char *, const char *, bool *, struct iri *);
 struct urlpos *append_url (const char *, int, int, struct map_context *);
 void free_urlpos (struct urlpos *);
 
+extern bool link_capture;
+struct link_stream;
+struct link_stream *link_stream_new (const char *, const char *, bool, bool);
+bool link_stream_feed (struct link_stream *, const char *, int);
+bool link_stream_finish (struct link_stream *, bool);
+struct file_memory *link_stream_read_file (const char *);
+void link_stream_cleanup (void);
+size_t link_stream_memory (void);
+
 #endif /* HTML_URL_H */
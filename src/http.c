@@ -40,8 +40,19 @@ as that of the covered work.  */
 #include <time.h>
 #include <locale.h>
 
+#if defined HAVE_FORK && defined HAVE_MMAP
+# define ENABLE_SEGMENTS
+# include <sys/types.h>
+# include <sys/mman.h>
+# include <sys/wait.h>
+# ifndef MAP_ANONYMOUS
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+#endif
+
 #include "hash.h"
 #include "http.h"
+#include "http2.h"
 #include "utils.h"
 #include "url.h"
 #include "host.h"
@@ -59,6 +70,16 @@ as that of the covered work.  */
 #include "convert.h"
 #include "spider.h"
 #include "warc.h"
+#include "html-url.h"
+#include "parallel.h"
+#include "progress.h"
+#include "ptimer.h"
+#include "timing.h"
+#include "stats.h"
+#include "manifest.h"
+#include "dedup.h"
+#include "sha1-hw.h"
+#include "counters.h"
 
 #ifdef TESTING
 #include "test.h"
@@ -74,11 +95,20 @@ extern char *version_string;
 struct http_stat;
 static char *create_authorization_line (const char *, const char *,
                                         const char *, const char *,
-                                        const char *, bool *);
+                                        const char *, const struct url *,
+                                        int, bool *);
 static char *basic_authentication_encode (const char *, const char *);
 static bool known_authentication_scheme_p (const char *, const char *);
+#ifdef ENABLE_DIGEST
+static char *digest_preemptive (const struct url *, const char *,
+                                const char *, const char *, const char *);
+static void digest_next_nonce (const struct url *, const char *);
+static void digest_forget (const struct url *);
+static void digest_cleanup (void);
+#endif
 static void ensure_extension (struct http_stat *, const char *, int *);
 static void load_cookies (void);
+static double parse_retry_after (const char *);
 
 #ifndef MIN
 # define MIN(x, y) ((x) > (y) ? (y) : (x))
@@ -88,6 +118,10 @@ static void load_cookies (void);
 static bool cookies_loaded_p;
 static struct cookie_jar *wget_cookie_jar;
 
+/* Validators of the conditional request set by http_set_conditional,
+   or NULL.  */
+static struct http_validators *conditional;
+
 #define TEXTHTML_S "text/html"
 #define TEXTXHTML_S "application/xhtml+xml"
 #define TEXTCSS_S "text/css"
@@ -123,12 +157,17 @@ static struct cookie_jar *wget_cookie_jar;
 #define HTTP_STATUS_FORBIDDEN             403
 #define HTTP_STATUS_NOT_FOUND             404
 #define HTTP_STATUS_RANGE_NOT_SATISFIABLE 416
+#define HTTP_STATUS_TOO_MANY_REQUESTS     429 /* from RFC 6585 */
 
 /* Server errors 5xx.  */
 #define HTTP_STATUS_INTERNAL              500
 #define HTTP_STATUS_NOT_IMPLEMENTED       501
 #define HTTP_STATUS_BAD_GATEWAY           502
 #define HTTP_STATUS_UNAVAILABLE           503
+
+/* The longest Retry-After of a 429 or 503 response that is waited
+   for; the retrieval fails at once when the server asks for more.  */
+#define RETRY_AFTER_MAX 600
 
 enum rp {
   rel_none, rel_name, rel_value, rel_both
@@ -322,11 +361,11 @@ request_remove_header (struct request *req, const char *name)
 } while (0)
 
 /* Construct the request and write it to FD using fd_write.
-   If warc_tmp is set to a file pointer, the request string will
-   also be written to that file. */
+   If warc_tmp is set to a WARC block, the request string will
+   also be added to that block. */
 
 static int
-request_send (const struct request *req, int fd, FILE *warc_tmp)
+request_send (const struct request *req, int fd, struct warc_block *warc_tmp)
 {
   char *request_string, *p;
   int i, size, write_error;
@@ -380,8 +419,7 @@ request_send (const struct request *req, int fd, FILE *warc_tmp)
   else if (warc_tmp != NULL)
     {
       /* Write a copy of the data to the WARC record. */
-      int warc_tmp_written = fwrite (request_string, 1, size - 1, warc_tmp);
-      if (warc_tmp_written != size - 1)
+      if (!warc_block_write (warc_tmp, request_string, size - 1))
         return -2;
     }
   return write_error;
@@ -452,18 +490,50 @@ register_basic_auth_host (const char *hostname)
 }
 
 
+#ifdef HAVE_SENDFILE
+/* Send PROMISED_SIZE bytes of the file FD to SOCK with sendfile,
+   adding the number of bytes sent to *WRITTEN.  Returns 1 if they
+   were sent or the file ended first, 0 if sendfile can't be used, in
+   which case nothing has been sent, and -1 on error.  */
+
+static int
+post_file_sendfile (int sock, int fd, wgint promised_size, wgint *written)
+{
+  wgint offset = 0;
+
+  while (*written < promised_size)
+    {
+      int res = fd_sendfile (sock, fd, &offset,
+                             MIN (promised_size - *written, 1 << 30), -1);
+      if (res == 0)
+        break;
+      if (res < 0)
+        {
+          if (*written == 0
+              && (errno == EOPNOTSUPP || errno == EINVAL || errno == ENOSYS))
+            return 0;
+          return -1;
+        }
+      *written += res;
+    }
+  return 1;
+}
+#endif
+
 /* Send the contents of FILE_NAME to SOCK.  Make sure that exactly
    PROMISED_SIZE bytes are sent over the wire -- if the file is
    longer, read only that much; if the file is shorter, report an error.
-   If warc_tmp is set to a file pointer, the post data will
-   also be written to that file.  */
+   If warc_tmp is set to a WARC block, the post data will
+   also be added to that block.  */
 
 static int
-post_file (int sock, const char *file_name, wgint promised_size, FILE *warc_tmp)
+post_file (int sock, const char *file_name, wgint promised_size,
+           struct warc_block *warc_tmp)
 {
   static char chunk[8192];
   wgint written = 0;
   int write_error;
+  int sent = 0;
   FILE *fp;
 
   DEBUGP (("[writing POST file %s ... ", file_name));
@@ -471,7 +541,19 @@ post_file (int sock, const char *file_name, wgint promised_size, FILE *warc_tmp)
   fp = fopen (file_name, "rb");
   if (!fp)
     return -1;
-  while (!feof (fp) && written < promised_size)
+#ifdef HAVE_SENDFILE
+  /* Unless a copy is needed for the WARC record, let the kernel send
+     the file.  That isn't possible through transports that encrypt
+     the data themselves; see fd_sendfile.  */
+  if (!warc_tmp)
+    sent = post_file_sendfile (sock, fileno (fp), promised_size, &written);
+  if (sent < 0)
+    {
+      fclose (fp);
+      return -1;
+    }
+#endif
+  while (!sent && !feof (fp) && written < promised_size)
     {
       int towrite;
       int length = fread (chunk, 1, sizeof (chunk), fp);
@@ -487,8 +569,7 @@ post_file (int sock, const char *file_name, wgint promised_size, FILE *warc_tmp)
       if (warc_tmp != NULL)
         {
           /* Write a copy of the data to the WARC record. */
-          int warc_tmp_written = fwrite (chunk, 1, towrite, warc_tmp);
-          if (warc_tmp_written != towrite)
+          if (!warc_block_write (warc_tmp, chunk, towrite))
             {
               fclose (fp);
               return -2;
@@ -514,17 +595,17 @@ post_file (int sock, const char *file_name, wgint promised_size, FILE *warc_tmp)
 /* Determine whether [START, PEEKED + PEEKLEN) contains an empty line.
    If so, return the pointer to the position after the line, otherwise
    return NULL.  This is used as callback to fd_read_hunk.  The data
-   between START and PEEKED has been read and cannot be "unread"; the
-   data after PEEKED has only been peeked.  */
+   between START and PEEKED was seen by earlier calls; the data after
+   PEEKED has just arrived.  */
 
 static const char *
 response_head_terminator (const char *start, const char *peeked, int peeklen)
 {
   const char *p, *end;
 
-  /* If at first peek, verify whether HUNK starts with "HTTP".  If
-     not, this is a HTTP/0.9 request and we must bail out without
-     reading anything.  */
+  /* If at first read, verify whether HUNK starts with "HTTP".  If
+     not, this is a HTTP/0.9 request and we must bail out, leaving
+     everything read to the body.  */
   if (start == peeked && 0 != memcmp (start, "HTTP", MIN (peeklen, 4)))
     return start;
 
@@ -597,8 +678,96 @@ struct response {
      beginning of the second one, etc.  */
 
   const char **headers;
+
+  /* Open-addressed index of the header names, built by resp_new so
+     that resp_header_locate doesn't scan HEADERS.  NAME_INDEX has
+     NAME_MASK + 1 slots, each holding the position in HEADERS of the
+     first header with a given name, or 0.  NAME_NEXT[i] is the
+     position of the next header with the same name as headers[i], or
+     0.  */
+  int *name_index;
+  int *name_next;
+  unsigned int name_mask;
 };
 
+/* Return the length of the name of the header line at HDR, which ends
+   at END, or -1 if the line contains no colon.  */
+
+static int
+header_name_length (const char *hdr, const char *end)
+{
+  const char *colon = memchr (hdr, ':', end - hdr);
+  return colon ? colon - hdr : -1;
+}
+
+/* Hash the LEN characters of the header name NAME, ignoring case.  */
+
+static unsigned int
+header_name_hash (const char *name, int len)
+{
+  unsigned int h = 2166136261U;
+  int i;
+  for (i = 0; i < len; i++)
+    h = (h ^ (unsigned char) c_tolower (name[i])) * 16777619U;
+  return h;
+}
+
+/* Return the position of the index slot for the header name NAME of
+   length LEN in RESP: either the slot of that name, or the empty
+   slot where it belongs.  */
+
+static unsigned int
+resp_name_slot (const struct response *resp, const char *name, int len)
+{
+  unsigned int slot = header_name_hash (name, len) & resp->name_mask;
+  int pos;
+
+  while ((pos = resp->name_index[slot]) != 0)
+    {
+      const char *hdr = resp->headers[pos];
+      if (0 == strncasecmp (hdr, name, len) && hdr[len] == ':')
+        break;
+      slot = (slot + 1) & resp->name_mask;
+    }
+  return slot;
+}
+
+/* Build the header name index of RESP, which has COUNT header lines
+   including the status line.  */
+
+static void
+resp_index_names (struct response *resp, int count)
+{
+  unsigned int size = 8;
+  int i;
+  int *last;
+
+  while (size < 2 * (unsigned int) count)
+    size <<= 1;
+  resp->name_mask = size - 1;
+  resp->name_index = xnew0_array (int, size);
+  resp->name_next = xnew0_array (int, count);
+
+  /* LAST[slot] is the last header seen with the name of SLOT, for
+     chaining duplicates in order.  */
+  last = xnew0_array (int, size);
+  for (i = 1; i < count; i++)
+    {
+      const char *b = resp->headers[i];
+      int len = header_name_length (b, resp->headers[i + 1]);
+      unsigned int slot;
+      if (len < 0)
+        continue;
+      slot = resp_name_slot (resp, b, len);
+      if (resp->name_index[slot] == 0)
+        resp->name_index[slot] = i;
+      else
+        resp->name_next[last[slot]] = i;
+      last[slot] = i;
+    }
+  xfree (last);
+}
+
 /* Create a new response object from the text of the HTTP response,
    available in HEAD.  That text is automatically split into
    constituent header lines for fast retrieval using
@@ -649,6 +818,9 @@ resp_new (const char *head)
   DO_REALLOC (resp->headers, size, count + 1, const char *);
   resp->headers[count] = NULL;
 
+  /* headers[count - 1] is the empty line ending the head.  */
+  resp_index_names (resp, count - 1);
+
   return resp;
 }
 
@@ -676,30 +848,23 @@ resp_header_locate (const struct response *resp, const char *name, int start,
     return -1;
 
   name_len = strlen (name);
-  if (start > 0)
-    i = start;
-  else
-    i = 1;
+  i = resp->name_index[resp_name_slot (resp, name, name_len)];
+  while (i && i < start)
+    i = resp->name_next[i];
+  if (!i)
+    return -1;
 
-  for (; headers[i + 1]; i++)
-    {
-      const char *b = headers[i];
-      const char *e = headers[i + 1];
-      if (e - b > name_len
-          && b[name_len] == ':'
-          && 0 == strncasecmp (b, name, name_len))
-        {
-          b += name_len + 1;
-          while (b < e && c_isspace (*b))
-            ++b;
-          while (b < e && c_isspace (e[-1]))
-            --e;
-          *begptr = b;
-          *endptr = e;
-          return i;
-        }
-    }
-  return -1;
+  {
+    const char *b = headers[i] + name_len + 1;
+    const char *e = headers[i + 1];
+    while (b < e && c_isspace (*b))
+      ++b;
+    while (b < e && c_isspace (e[-1]))
+      --e;
+    *begptr = b;
+    *endptr = e;
+  }
+  return i;
 }
 
 /* Find and retrieve the header named NAME in the request data.  If
@@ -825,6 +990,8 @@ static void
 resp_free (struct response *resp)
 {
   xfree_null (resp->headers);
+  xfree_null (resp->name_index);
+  xfree_null (resp->name_next);
   xfree (resp);
 }
 
@@ -1214,161 +1381,357 @@ parse_content_disposition (const char *hdr, char **filename)
 }
 
 
-/* Persistent connections.  Currently, we cache the most recently used
-   connection as persistent, provided that the HTTP server agrees to
-   make it such.  The persistence data is stored in the variables
-   below.  Ideally, it should be possible to cache an arbitrary fixed
-   number of these connections.  */
-
-/* Whether a persistent connection is active. */
-static bool pconn_active;
-
-static struct {
+/* Persistent connections.  Connections the HTTP server agreed to keep
+   open are cached in a pool, keyed by the host and port they talk to,
+   whether SSL is used, and the proxy they go through, if any.  The
+   pool is a list kept in least-recently-used order, so that the
+   connection we drop when one of the limits is reached is the one
+   that has been idle the longest.
+
+   A connection stays in the pool while a request is in progress on
+   it; IN_USE tells such connections apart from the idle ones, which
+   are the only ones offered for reuse.  */
+
+struct pconn {
   /* The socket of the connection.  */
   int socket;
 
-  /* Host and port of the currently active persistent connection. */
+  /* Host and port the connection talks to.  */
   char *host;
   int port;
 
   /* Whether a ssl handshake has occoured on this connection.  */
   bool ssl;
 
+  /* "HOST:PORT" of the proxy the connection goes through, or NULL
+     for direct connections.  */
+  char *proxy;
+
   /* Whether the connection was authorized.  This is only done by
      NTLM, which authorizes *connections* rather than individual
      requests.  (That practice is peculiar for HTTP, but it is a
      useful optimization.)  */
   bool authorized;
 
+  /* Whether a request is currently being served over the
+     connection.  */
+  bool in_use;
+
+  /* When the connection was last released.  */
+  time_t last_used;
+
+  /* URLs whose requests were pipelined on the connection, in the
+     order their responses are expected, and their count.  */
+  char **pipelined;
+  int npipelined;
+
 #ifdef ENABLE_NTLM
-  /* NTLM data of the current connection.  */
+  /* NTLM data of the connection.  */
   struct ntlmdata ntlm;
 #endif
-} pconn;
 
-/* Mark the persistent connection as invalid and free the resources it
-   uses.  This is used by the CLOSE_* macros after they forcefully
-   close a registered persistent connection.  */
+  /* Neighbors in the LRU list; the head is the most recently
+     used.  */
+  struct pconn *prev, *next;
+};
+
+static struct pconn *pconn_head, *pconn_tail;
+static int pconn_count;
+
+#ifdef ENABLE_NTLM
+/* NTLM state used for connections that are not in the pool.  */
+static struct ntlmdata pconn_ntlm_fallback;
+#endif
 
 static void
-invalidate_persistent (void)
+pconn_unlink (struct pconn *pc)
 {
-  DEBUGP (("Disabling further reuse of socket %d.\n", pconn.socket));
-  pconn_active = false;
-  fd_close (pconn.socket);
-  xfree (pconn.host);
-  xzero (pconn);
+  if (pc->prev)
+    pc->prev->next = pc->next;
+  else
+    pconn_head = pc->next;
+  if (pc->next)
+    pc->next->prev = pc->prev;
+  else
+    pconn_tail = pc->prev;
+  pc->prev = pc->next = NULL;
 }
 
-/* Register FD, which should be a TCP/IP connection to HOST:PORT, as
-   persistent.  This will enable someone to use the same connection
-   later.  In the context of HTTP, this must be called only AFTER the
-   response has been received and the server has promised that the
-   connection will remain alive.
+static void
+pconn_push_front (struct pconn *pc)
+{
+  pc->prev = NULL;
+  pc->next = pconn_head;
+  if (pconn_head)
+    pconn_head->prev = pc;
+  pconn_head = pc;
+  if (!pconn_tail)
+    pconn_tail = pc;
+}
+
+/* Return the pool entry for socket FD, or NULL if FD was not
+   registered as persistent.  */
+
+static struct pconn *
+pconn_find (int fd)
+{
+  struct pconn *pc;
+  if (fd < 0)
+    return NULL;
+  for (pc = pconn_head; pc; pc = pc->next)
+    if (pc->socket == fd)
+      return pc;
+  return NULL;
+}
+
+/* Remove PC from the pool and return its socket, which is left
+   open.  */
+
+static int
+pconn_detach (struct pconn *pc)
+{
+  int fd = pc->socket;
+  pconn_unlink (pc);
+  --pconn_count;
+  while (pc->npipelined)
+    xfree (pc->pipelined[--pc->npipelined]);
+  xfree_null (pc->pipelined);
+  xfree (pc->host);
+  xfree_null (pc->proxy);
+  xfree (pc);
+  return fd;
+}
+
+/* Close the connection PC and remove it from the pool.  This is used
+   by the CLOSE_* macros after they forcefully close a registered
+   persistent connection, and when evicting connections.  */
+
+static void
+invalidate_persistent (struct pconn *pc)
+{
+  DEBUGP (("Disabling further reuse of socket %d.\n", pc->socket));
+  fd_close (pconn_detach (pc));
+}
+
+/* Close the idle connections that have not been used for longer than
+   --http-keep-alive-timeout.  */
+
+static void
+pconn_expire (void)
+{
+  struct pconn *pc, *prev;
+  time_t now;
+
+  if (opt.http_keep_alive_timeout <= 0)
+    return;
+  now = time (NULL);
+  for (pc = pconn_tail; pc; pc = prev)
+    {
+      prev = pc->prev;
+      if (!pc->in_use && now - pc->last_used > opt.http_keep_alive_timeout)
+        invalidate_persistent (pc);
+    }
+}
 
-   If a previous connection was persistent, it is closed. */
+/* Make room in the pool for a new connection to HOST:PORT, evicting
+   the least recently used idle connections that exceed the per-host
+   or total limit.  */
 
 static void
-register_persistent (const char *host, int port, int fd, bool ssl)
+pconn_make_room (const char *host, int port)
 {
-  if (pconn_active)
+  struct pconn *pc, *prev;
+  int same_host = 0;
+
+  for (pc = pconn_head; pc; pc = pc->next)
+    if (pc->port == port && 0 == strcasecmp (pc->host, host))
+      ++same_host;
+
+  for (pc = pconn_tail; pc; pc = prev)
     {
-      if (pconn.socket == fd)
+      bool mine = pc->port == port && 0 == strcasecmp (pc->host, host);
+      prev = pc->prev;
+      if (pc->in_use)
+        continue;
+      if (mine && opt.http_keep_alive_per_host > 0
+          && same_host >= opt.http_keep_alive_per_host)
         {
-          /* The connection FD is already registered. */
-          return;
+          --same_host;
+          invalidate_persistent (pc);
         }
-      else
+      else if (opt.http_keep_alive_max > 0
+               && pconn_count >= opt.http_keep_alive_max)
         {
-          /* The old persistent connection is still active; close it
-             first.  This situation arises whenever a persistent
-             connection exists, but we then connect to a different
-             host, and try to register a persistent connection to that
-             one.  */
-          invalidate_persistent ();
+          if (mine)
+            --same_host;
+          invalidate_persistent (pc);
         }
     }
+}
+
+/* Register FD, which should be a TCP/IP connection to HOST:PORT, as
+   persistent.  This will enable someone to use the same connection
+   later.  In the context of HTTP, this must be called only AFTER the
+   response has been received and the server has promised that the
+   connection will remain alive.
+
+   If the pool is full, the least recently used idle connection is
+   closed.  */
 
-  pconn_active = true;
-  pconn.socket = fd;
-  pconn.host = xstrdup (host);
-  pconn.port = port;
-  pconn.ssl = ssl;
-  pconn.authorized = false;
+static void
+register_persistent (const char *host, int port, int fd, bool ssl,
+                     const char *proxy)
+{
+  struct pconn *pc = pconn_find (fd);
+
+  if (pc)
+    {
+      /* The connection FD is already registered. */
+      pc->in_use = true;
+      return;
+    }
 
-  DEBUGP (("Registered socket %d for persistent reuse.\n", fd));
+  pconn_expire ();
+  pconn_make_room (host, port);
+
+  pc = xnew0 (struct pconn);
+  pc->socket = fd;
+  pc->host = xstrdup (host);
+  pc->port = port;
+  pc->ssl = ssl;
+  pc->proxy = proxy ? xstrdup (proxy) : NULL;
+  pc->authorized = false;
+  pc->in_use = true;
+  pc->last_used = time (NULL);
+  pconn_push_front (pc);
+  ++pconn_count;
+
+  DEBUGP (("Registered socket %d for persistent reuse (%d in pool).\n",
+           fd, pconn_count));
 }
 
-/* Return true if a persistent connection is available for connecting
-   to HOST:PORT.  */
+/* Mark the connection FD as idle, making it available for the next
+   request to its host.  */
+
+static void
+release_persistent (int fd)
+{
+  struct pconn *pc = pconn_find (fd);
+  if (!pc)
+    return;
+  pc->in_use = false;
+  pc->last_used = time (NULL);
+  pconn_unlink (pc);
+  pconn_push_front (pc);
+}
 
 static bool
-persistent_available_p (const char *host, int port, bool ssl,
-                        bool *host_lookup_failed)
+pconn_key_matches (const struct pconn *pc, int port, bool ssl,
+                   const char *proxy)
 {
-  /* First, check whether a persistent connection is active at all.  */
-  if (!pconn_active)
+  /* If we want SSL and the connection isn't or vice versa, don't use
+     it.  Checking for host and port is not enough because HTTP and
+     HTTPS can apparently coexist on the same port.  */
+  if (pc->in_use || ssl != pc->ssl || port != pc->port)
     return false;
-
-  /* If we want SSL and the last connection wasn't or vice versa,
-     don't use it.  Checking for host and port is not enough because
-     HTTP and HTTPS can apparently coexist on the same port.  */
-  if (ssl != pconn.ssl)
+  if (!proxy != !pc->proxy)
     return false;
+  return !proxy || 0 == strcmp (proxy, pc->proxy);
+}
 
-  /* If we're not connecting to the same port, we're not interested. */
-  if (port != pconn.port)
-    return false;
+/* Return an idle persistent connection for connecting to HOST:PORT
+   through PROXY, or NULL if there is none.  The connection is marked
+   as being in use.
 
-  /* If the host is the same, we're in business.  If not, there is
-     still hope -- read below.  */
-  if (0 != strcasecmp (host, pconn.host))
-    {
-      /* Check if pconn.socket is talking to HOST under another name.
-         This happens often when both sites are virtual hosts
-         distinguished only by name and served by the same network
-         interface, and hence the same web server (possibly set up by
-         the ISP and serving many different web sites).  This
-         admittedly unconventional optimization does not contradict
-         HTTP and works well with popular server software.  */
-
-      bool found;
-      ip_address ip;
-      struct address_list *al;
-
-      if (ssl)
-        /* Don't try to talk to two different SSL sites over the same
-           secure connection!  (Besides, it's not clear that
-           name-based virtual hosting is even possible with SSL.)  */
-        return false;
+   URL is the URL about to be requested.  A connection with pipelined
+   requests is only good for the URL whose response comes next on it;
+   if that is not URL, the connection is closed, since the responses
+   waiting on it will never be read.  */
+
+static struct pconn *
+persistent_available_p (const char *host, int port, bool ssl,
+                        const char *proxy, const char *url,
+                        bool *host_lookup_failed)
+{
+  struct pconn *pc, *next;
 
-      /* If pconn.socket's peer is one of the IP addresses HOST
-         resolves to, pconn.socket is for all intents and purposes
-         already talking to HOST.  */
+  pconn_expire ();
 
-      if (!socket_ip_address (pconn.socket, &ip, ENDPOINT_PEER))
-        {
-          /* Can't get the peer's address -- something must be very
-             wrong with the connection.  */
-          invalidate_persistent ();
-          return false;
-        }
-      al = lookup_host (host, 0);
-      if (!al)
+  /* Look for a connection to the same host first.  */
+  for (pc = pconn_head; pc; pc = pc->next)
+    if (pconn_key_matches (pc, port, ssl, proxy)
+        && 0 == strcasecmp (host, pc->host))
+      break;
+
+  if (!pc && !ssl)
+    {
+      /* Check if one of the connections is talking to HOST under
+         another name.  This happens often when both sites are
+         virtual hosts distinguished only by name and served by the
+         same network interface, and hence the same web server
+         (possibly set up by the ISP and serving many different web
+         sites).  This admittedly unconventional optimization does
+         not contradict HTTP and works well with popular server
+         software.
+
+         This is not done for SSL: don't try to talk to two different
+         SSL sites over the same secure connection!  (Besides, it's
+         not clear that name-based virtual hosting is even possible
+         with SSL.)  */
+      struct address_list *al = NULL;
+
+      for (pc = pconn_head; pc; pc = next)
         {
-          *host_lookup_failed = true;
-          return false;
-        }
+          ip_address ip;
+          next = pc->next;
+          if (!pconn_key_matches (pc, port, ssl, proxy) || pc->npipelined)
+            continue;
 
-      found = address_list_contains (al, &ip);
-      address_list_release (al);
+          if (!socket_ip_address (pc->socket, &ip, ENDPOINT_PEER))
+            {
+              /* Can't get the peer's address -- something must be
+                 very wrong with the connection.  */
+              invalidate_persistent (pc);
+              continue;
+            }
+          if (!al)
+            {
+              al = lookup_host (host, 0);
+              if (!al)
+                {
+                  *host_lookup_failed = true;
+                  return NULL;
+                }
+            }
 
-      if (!found)
-        return false;
+          /* If the connection's peer is one of the IP addresses HOST
+             resolves to, it is for all intents and purposes already
+             talking to HOST.  */
+          if (address_list_contains (al, &ip))
+            break;
+        }
+      if (al)
+        address_list_release (al);
+    }
+
+  if (!pc)
+    return NULL;
 
-      /* The persistent connection's peer address was found among the
-         addresses HOST resolved to; therefore, pconn.sock is in fact
-         already talking to HOST -- no need to reconnect.  */
+  if (pc->npipelined)
+    {
+      if (0 == strcmp (pc->pipelined[0], url))
+        {
+          /* The response is (or will shortly be) waiting on the
+             socket, so test_socket_open would consider the
+             connection closed.  */
+          pc->in_use = true;
+          return pc;
+        }
+      DEBUGP (("Pipelined response on fd %d is not for %s.\n",
+               pc->socket, url));
+      invalidate_persistent (pc);
+      return persistent_available_p (host, port, ssl, proxy, url,
+                                     host_lookup_failed);
     }
 
   /* Finally, check whether the connection is still open.  This is
@@ -1384,17 +1747,52 @@ persistent_available_p (const char *host, int port, bool ssl,
      body in response to HEAD, or if it sends more than conent-length
      data, we won't reuse the corrupted connection.)  */
 
-  if (!test_socket_open (pconn.socket))
+  if (http2_p (pc->socket)
+      ? !http2_open_p (pc->socket)
+      : !test_socket_open (pc->socket))
     {
       /* Oops, the socket is no longer open.  Now that we know that,
-         let's invalidate the persistent connection before returning
-         0.  */
-      invalidate_persistent ();
-      return false;
+         let's invalidate the persistent connection and try the
+         others.  */
+      invalidate_persistent (pc);
+      return persistent_available_p (host, port, ssl, proxy, url,
+                                     host_lookup_failed);
     }
 
-  return true;
+  pc->in_use = true;
+  return pc;
+}
+
+#ifdef HAVE_SSL
+/* Take an idle connection to the proxy PROXY_KEY out of the pool, so
+   that a tunnel can be opened over it with CONNECT, and return its
+   socket, or -1 if there is none.  Once it is a tunnel, the
+   connection is registered as one to the server at its end, like any
+   other tunnel.  */
+
+static int
+pconn_take_proxy (const char *proxy_key)
+{
+  struct pconn *pc, *next;
+
+  pconn_expire ();
+  for (pc = pconn_head; pc; pc = next)
+    {
+      next = pc->next;
+      if (pc->in_use || pc->ssl || pc->npipelined || !pc->proxy
+          || 0 != strcmp (pc->proxy, proxy_key))
+        continue;
+      if (!test_socket_open (pc->socket))
+        {
+          invalidate_persistent (pc);
+          continue;
+        }
+      DEBUGP (("Opening a tunnel over socket %d.\n", pc->socket));
+      return pconn_detach (pc);
+    }
+  return -1;
 }
+#endif /* HAVE_SSL */
 
 /* The idea behind these two CLOSE macros is to distinguish between
    two cases: one when the job we've been doing is finished, and we
@@ -1403,35 +1801,40 @@ persistent_available_p (const char *host, int port, bool ssl,
    cleanup.
 
    In case of keep_alive, CLOSE_FINISH should leave the connection
-   open, while CLOSE_INVALIDATE should still close it.
+   open and return it to the pool, while CLOSE_INVALIDATE should
+   still close it.
 
    Note that the semantics of the flag `keep_alive' is "this
    connection *will* be reused (the server has promised not to close
    the connection once we're done)", while the semantics of
-   `pc_active_p && (fd) == pc_last_fd' is "we're *now* using an
-   active, registered connection".  */
+   `pconn_find (fd) != NULL' is "we're *now* using a registered
+   connection".  */
 
 #define CLOSE_FINISH(fd) do {                   \
   if (!keep_alive)                              \
     {                                           \
-      if (pconn_active && (fd) == pconn.socket) \
-        invalidate_persistent ();               \
+      struct pconn *pc_ = pconn_find (fd);      \
+      if (pc_)                                  \
+        invalidate_persistent (pc_);            \
       else                                      \
         {                                       \
           fd_close (fd);                        \
           fd = -1;                              \
         }                                       \
     }                                           \
+  else                                          \
+    release_persistent (fd);                    \
 } while (0)
 
 #define CLOSE_INVALIDATE(fd) do {               \
-  if (pconn_active && (fd) == pconn.socket)     \
-    invalidate_persistent ();                   \
+  struct pconn *pc_ = pconn_find (fd);          \
+  if (pc_)                                      \
+    invalidate_persistent (pc_);                \
   else                                          \
     fd_close (fd);                              \
   fd = -1;                                      \
 } while (0)
-
+
 struct http_stat
 {
   wgint len;                    /* received length */
@@ -1459,8 +1862,116 @@ struct http_stat
   wgint orig_file_size;         /* size of file to compare for time-stamping */
   time_t orig_file_tstamp;      /* time-stamp of file to compare for
                                  * time-stamping */
+  int remote_encoding;          /* content coding of the body, ENC_* */
+  bool decompressed;            /* whether the body is written out
+                                   decompressed */
+  char *etag;                   /* ETag of the response, or NULL */
+  const struct manifest_entry *known; /* manifest entry of the local
+                                         file, if the file is listed */
+  bool has_digest;              /* whether DIGEST is that of the file */
+  unsigned char digest[MANIFEST_DIGEST_SIZE]; /* SHA-1 of the body */
+  bool in_memory;               /* whether the body was only kept in
+                                   memory, leaving no local file */
+  double retry_after;           /* seconds to wait given by Retry-After,
+                                   or -1 */
 };
 
+/* Content codings of a response body.  */
+enum {
+  ENC_NONE,
+  ENC_GZIP,
+  ENC_DEFLATE,
+  ENC_OTHER
+};
+
+/* Record the size and time-stamp of the local copy of HS's file, or
+   of its .orig backup with -K, for the time-stamping checks.  */
+
+static void
+stat_local_copy (struct http_stat *hs)
+{
+  size_t filename_len = strlen (hs->local_file);
+  char *filename_plus_orig_suffix = alloca (filename_len + sizeof (ORIG_SFX));
+  bool local_dot_orig_file_exists = false;
+  char *local_filename = NULL;
+  struct_stat st;
+
+  if (opt.backup_converted)
+    /* If -K is specified, we'll act on the assumption that it was specified
+       last time these files were downloaded as well, and instead of just
+       comparing local file X against server file X, we'll compare local
+       file X.orig (if extant, else X) against server file X.  If -K
+       _wasn't_ specified last time, or the server contains files called
+       *.orig, -N will be back to not operating correctly with -k. */
+    {
+      /* Would a single s[n]printf() call be faster?  --dan
+
+         Definitely not.  sprintf() is horribly slow.  It's a
+         different question whether the difference between the two
+         affects a program.  Usually I'd say "no", but at one
+         point I profiled Wget, and found that a measurable and
+         non-negligible amount of time was lost calling sprintf()
+         in url.c.  Replacing sprintf with inline calls to
+         strcpy() and number_to_string() made a difference.
+         --hniksic */
+      memcpy (filename_plus_orig_suffix, hs->local_file, filename_len);
+      memcpy (filename_plus_orig_suffix + filename_len,
+              ORIG_SFX, sizeof (ORIG_SFX));
+
+      /* Try to stat() the .orig file. */
+      if (stat (filename_plus_orig_suffix, &st) == 0)
+        {
+          local_dot_orig_file_exists = true;
+          local_filename = filename_plus_orig_suffix;
+        }
+    }
+
+  if (!local_dot_orig_file_exists)
+    /* Couldn't stat() <file>.orig, so try to stat() <file>. */
+    if (stat (hs->local_file, &st) == 0)
+      local_filename = hs->local_file;
+
+  xfree_null (hs->orig_file_name);
+  hs->orig_file_name = NULL;
+  if (local_filename != NULL)
+    /* There was a local file, so we'll check later to see if the version
+       the server has is the same version we already have, allowing us to
+       skip a download. */
+    {
+      hs->orig_file_name = xstrdup (local_filename);
+      hs->orig_file_size = st.st_size;
+      hs->orig_file_tstamp = st.st_mtime;
+#ifdef WINDOWS
+      /* Modification time granularity is 2 seconds for Windows, so
+         increase local time by 1 second for later comparison. */
+      ++hs->orig_file_tstamp;
+#endif
+    }
+}
+
+/* Format T as an HTTP date, such as "Sun, 06 Nov 1994 08:49:37 GMT".
+   The names are spelled out rather than left to strftime, which
+   would use the names of the locale.  */
+
+static char *
+http_date (time_t t)
+{
+  static const char *days[] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+  };
+  static const char *months[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+  };
+  struct tm *tm = gmtime (&t);
+
+  if (!tm)
+    return NULL;
+  return aprintf ("%s, %02d %s %04d %02d:%02d:%02d GMT", days[tm->tm_wday],
+                  tm->tm_mday, months[tm->tm_mon], tm->tm_year + 1900,
+                  tm->tm_hour, tm->tm_min, tm->tm_sec);
+}
+
 static void
 free_hstat (struct http_stat *hs)
 {
@@ -1471,11 +1982,49 @@ free_hstat (struct http_stat *hs)
   xfree_null (hs->local_file);
   xfree_null (hs->orig_file_name);
   xfree_null (hs->message);
+  xfree_null (hs->etag);
 
   /* Guard against being called twice. */
   hs->newloc = NULL;
   hs->remote_time = NULL;
   hs->error = NULL;
+  hs->etag = NULL;
+}
+
+/* Set the TEXTHTML and TEXTCSS bits of *DT from the Content-Type
+   TYPE of a response, which may be NULL.  */
+static void
+set_type_flags (const char *type, int *dt)
+{
+  /* If content-type is not given, assume text/html.  This is because
+     of the multitude of broken CGI's that "forget" to generate the
+     content-type.  */
+  if (!type ||
+        0 == strncasecmp (type, TEXTHTML_S, strlen (TEXTHTML_S)) ||
+        0 == strncasecmp (type, TEXTXHTML_S, strlen (TEXTXHTML_S)))
+    *dt |= TEXTHTML;
+  else
+    *dt &= ~TEXTHTML;
+
+  if (type &&
+      0 == strncasecmp (type, TEXTCSS_S, strlen (TEXTCSS_S)))
+    *dt |= TEXTCSS;
+  else
+    *dt &= ~TEXTCSS;
+}
+
+/* Set the TEXTHTML and TEXTCSS bits of *DT from the suffix of FILE,
+   for responses that don't describe the file, such as 304.  */
+static void
+set_file_type_flags (const char *file, int *dt)
+{
+  const char *suf = suffix (file);
+
+  *dt &= ~(TEXTHTML | TEXTCSS);
+  if (has_html_suffix_p (file))
+    *dt |= TEXTHTML;
+  else if (suf && !strcasecmp (suf, "css"))
+    *dt |= TEXTCSS;
 }
 
 static void
@@ -1518,34 +2067,19 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
                     char *url, char *warc_timestamp_str, char *warc_request_uuid,
                     ip_address *warc_ip, char *type, int statcode, char *head)
 {
-  int warc_payload_offset = 0;
-  FILE *warc_tmp = NULL;
-  int warcerr = 0;
+  struct warc_block *warc_tmp = NULL;
 
   if (opt.warc_filename != NULL)
     {
-      /* Open a temporary file where we can write the response before we
-         add it to the WARC record.  */
-      warc_tmp = warc_tempfile ();
-      if (warc_tmp == NULL)
-        warcerr = WARC_TMP_FOPENERR;
-
-      if (warcerr == 0)
+      /* Collect the response for the WARC record, digesting it as it
+         arrives.  We should keep the response headers as well.  */
+      warc_tmp = warc_block_new ();
+      if (!warc_block_write (warc_tmp, head, strlen (head)))
         {
-          /* We should keep the response headers for the WARC record.  */
-          int head_len = strlen (head);
-          int warc_tmp_written = fwrite (head, 1, head_len, warc_tmp);
-          if (warc_tmp_written != head_len)
-            warcerr = WARC_TMP_FWRITEERR;
-          warc_payload_offset = head_len;
-        }
-
-      if (warcerr != 0)
-        {
-          if (warc_tmp != NULL)
-            fclose (warc_tmp);
-          return warcerr;
+          warc_block_free (warc_tmp);
+          return WARC_TMP_FWRITEERR;
         }
+      warc_block_start_payload (warc_tmp);
     }
 
   if (fp != NULL)
@@ -1569,6 +2103,9 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
     flags |= rb_skip_startpos;
   if (chunked_transfer_encoding)
     flags |= rb_chunked_transfer_encoding;
+  if ((fp != NULL || body_link_stream != NULL) && hs->decompressed)
+    flags |= (hs->remote_encoding == ENC_GZIP
+              ? rb_compressed_gzip : rb_compressed_deflate);
 
   hs->len = hs->restval;
   hs->rd_size = 0;
@@ -1578,6 +2115,7 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
   hs->res = fd_read_body (sock, fp, contlen != -1 ? contlen : 0,
                           hs->restval, &hs->rd_size, &hs->len, &hs->dltime,
                           flags, warc_tmp);
+  timing_body (hs->dltime, hs->rd_size);
   if (hs->res >= 0)
     {
       if (warc_tmp != NULL)
@@ -1588,10 +2126,10 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
              The response record should also refer to the uuid of the request.  */
           bool r = warc_write_response_record (url, warc_timestamp_str,
                                                warc_request_uuid, warc_ip,
-                                               warc_tmp, warc_payload_offset,
-                                               type, statcode, hs->newloc);
+                                               warc_tmp, type, statcode,
+                                               hs->newloc);
 
-          /* warc_write_response_record has closed warc_tmp. */
+          /* warc_write_response_record has freed warc_tmp. */
 
           if (! r)
             return WARC_ERR;
@@ -1601,7 +2139,7 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
     }
   
   if (warc_tmp != NULL)
-    fclose (warc_tmp);
+    warc_block_free (warc_tmp);
 
   if (hs->res == -2)
     {
@@ -1613,6 +2151,13 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
       /* Error while writing to warc_tmp. */
       return WARC_TMP_FWRITEERR;
     }
+  else if (hs->res == -4)
+    {
+      /* The compressed body could not be decompressed.  */
+      hs->res = -1;
+      hs->rderrmsg = xstrdup (_("Corrupt or truncated compressed data"));
+      return RETRFINISHED;
+    }
   else
     {
       /* A read error! */
@@ -1648,16 +2193,538 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
 } while (0)
 #endif /* def __VMS [else] */
 
-/* The flags that allow clobbering the file (opening with "wb").
-   Defined here to avoid repetition later.  #### This will require
-   rework.  */
-#define ALLOW_CLOBBER (opt.noclobber || opt.always_rest || opt.timestamping \
-                       || opt.dirstruct || opt.output_document)
+/* Generate the Host header, HOST:PORT.  Take into account that:
 
-/* Retrieve a document through HTTP protocol.  It recognizes status
-   code, and correctly handles redirections.  It closes the network
-   socket.  If it receives an error from the functions below it, it
-   will print it if there is enough information to do so (almost
+   - Broken server-side software often doesn't recognize the PORT
+     argument, so we must generate "Host: www.server.com" instead of
+     "Host: www.server.com:80" (and likewise for https port).
+
+   - IPv6 addresses contain ":", so "Host: 3ffe:8100:200:2::2:1234"
+     becomes ambiguous and needs to be rewritten as "Host:
+     [3ffe:8100:200:2::2]:1234".  */
+
+static void
+request_set_host_header (struct request *req, const struct url *u)
+{
+  /* Formats arranged for hfmt[add_port][add_squares].  */
+  static const char *hfmt[][2] = {
+    { "%s", "[%s]" }, { "%s:%d", "[%s]:%d" }
+  };
+  int add_port = u->port != scheme_default_port (u->scheme);
+  int add_squares = strchr (u->host, ':') != NULL;
+  request_set_header (req, "Host",
+                      aprintf (hfmt[add_port][add_squares], u->host, u->port),
+                      rel_value);
+}
+
+/* HTTP/1.1 pipelining.
+
+   With --pipeline=DEPTH, the recursive retrieval announces the URLs
+   it will retrieve next through http_set_pipeline_hint.  When a
+   request is sent over a reused persistent connection, the requests
+   for the announced URLs on the same host are written right after
+   it, up to DEPTH requests in flight.  The URLs are remembered on the
+   connection, and when gethttp later gets to one of them, it finds
+   the connection through persistent_available_p and reads the
+   response without sending anything.
+
+   Only plain GET requests whose headers don't depend on the response
+   to the previous request are pipelined; see pipeline_allowed_p.
+   With --spider, which starts every retrieval with a HEAD request,
+   HEAD requests are pipelined instead.
+   Requests are only pipelined on a connection that has already been
+   kept alive once, because only then do we know that the server
+   won't close it after the first response.  If the server closes the
+   connection anyway, the outstanding requests are simply sent again
+   on a new one.  If a pipelined response can't be read, pipelining
+   is turned off for that host.  */
+
+/* The URLs to be retrieved after the current one, and the referers
+   to send with them.  */
+static char **pipeline_hint_urls;
+static char **pipeline_hint_referers;
+static int pipeline_hint_count;
+
+/* Hosts on which pipelining has failed.  */
+static struct hash_table *pipeline_broken_hosts;
+
+/* Announce that the COUNT URLs in URLS, with referers REFERERS, are
+   to be retrieved next, in that order.  This replaces the previous
+   announcement.  */
+
+void
+http_set_pipeline_hint (const char **urls, const char **referers, int count)
+{
+  int i;
+  for (i = 0; i < pipeline_hint_count; i++)
+    {
+      xfree (pipeline_hint_urls[i]);
+      xfree_null (pipeline_hint_referers[i]);
+    }
+  xfree_null (pipeline_hint_urls);
+  xfree_null (pipeline_hint_referers);
+  pipeline_hint_urls = pipeline_hint_referers = NULL;
+  pipeline_hint_count = 0;
+  if (count <= 0)
+    return;
+
+  pipeline_hint_urls = xnew_array (char *, count);
+  pipeline_hint_referers = xnew_array (char *, count);
+  for (i = 0; i < count; i++)
+    {
+      pipeline_hint_urls[i] = xstrdup (urls[i]);
+      pipeline_hint_referers[i] = referers[i] ? xstrdup (referers[i]) : NULL;
+    }
+  pipeline_hint_count = count;
+}
+
+/* Whether requests for announced URLs may be pipelined after the
+   request for U.  HEAD_ONLY and AUTH describe that request.  */
+
+static bool
+pipeline_allowed_p (const struct url *u, bool head_only, bool auth)
+{
+  return (opt.pipeline > 1
+          && pipeline_hint_count > 0
+          && (!head_only || opt.spider)
+          && !auth
+          && !opt.timestamping
+          && !opt.always_rest
+          && !opt.post_data && !opt.post_file_name
+          && !opt.warc_filename
+          && !conditional
+          && !(pipeline_broken_hosts
+               && hash_table_contains (pipeline_broken_hosts, u->host)));
+}
+
+/* Stop pipelining requests to HOST.  */
+
+static void
+pipeline_disable (const char *host)
+{
+  if (!pipeline_broken_hosts)
+    pipeline_broken_hosts = make_nocase_string_hash_table (1);
+  if (!hash_table_contains (pipeline_broken_hosts, host))
+    {
+      hash_table_put (pipeline_broken_hosts, xstrdup (host), NULL);
+      logprintf (LOG_VERBOSE, _("\
+Pipelined response from %s failed, disabling pipelining.\n"),
+                 quote (host));
+    }
+}
+
+/* Create the GET request for the announced URL U with REFERER, with
+   the headers gethttp would send for it.  */
+
+static struct request *
+pipeline_request (const struct url *u, const char *referer)
+{
+  struct request *req = request_new ();
+
+  request_set_method (req, opt.spider ? "HEAD" : "GET", url_full_path (u));
+  request_set_header (req, "Referer", (char *) referer, rel_none);
+  if (!opt.allow_cache)
+    {
+      request_set_header (req, "Cache-Control", "no-cache, must-revalidate",
+                          rel_none);
+      request_set_header (req, "Pragma", "no-cache", rel_none);
+    }
+  SET_USER_AGENT (req);
+  request_set_header (req, "Accept", "*/*", rel_none);
+#ifdef HAVE_LIBZ
+  if (opt.compression != compression_none && !opt.spider)
+    request_set_header (req, "Accept-Encoding", "gzip, deflate", rel_none);
+#endif
+  request_set_host_header (req, u);
+  request_set_header (req, "Connection", "Keep-Alive", rel_none);
+  if (opt.cookies)
+    request_set_header (req, "Cookie",
+                        cookie_header (wget_cookie_jar,
+                                       u->host, u->port, u->path,
+#ifdef HAVE_SSL
+                                       u->scheme == SCHEME_HTTPS
+#else
+                                       0
+#endif
+                                       ),
+                        rel_value);
+  if (opt.user_headers)
+    {
+      int i;
+      for (i = 0; opt.user_headers[i]; i++)
+        request_set_user_header (req, opt.user_headers[i]);
+    }
+  return req;
+}
+
+/* Send requests for the announced URLs on the same host as U over
+   the connection PC, keeping at most opt.pipeline requests in
+   flight.  The request for U itself has just been sent.  Returns
+   false if writing failed, in which case the connection must not be
+   reused.  */
+
+static bool
+pipeline_requests (struct pconn *pc, const struct url *u)
+{
+  int i, matched = 0;
+
+  if (!pc->pipelined)
+    pc->pipelined = xnew_array (char *, opt.pipeline - 1);
+
+  for (i = 0; i < pipeline_hint_count && pc->npipelined < opt.pipeline - 1;
+       i++)
+    {
+      struct url *hu;
+      struct request *req;
+      int write_error;
+
+      hu = url_parse (pipeline_hint_urls[i], NULL, NULL, false);
+      if (!hu)
+        continue;
+      if (hu->scheme != u->scheme || hu->port != u->port
+          || 0 != strcasecmp (hu->host, u->host))
+        {
+          url_free (hu);
+          continue;
+        }
+
+      /* The announced URLs for this host start with the ones that
+         were pipelined before.  */
+      if (matched < pc->npipelined)
+        {
+          bool same = 0 == strcmp (pc->pipelined[matched], hu->url);
+          url_free (hu);
+          if (!same)
+            return true;
+          ++matched;
+          continue;
+        }
+
+      req = pipeline_request (hu, pipeline_hint_referers[i]);
+      write_error = request_send (req, pc->socket, NULL);
+      request_free (req);
+
+      if (write_error < 0)
+        {
+          url_free (hu);
+          return false;
+        }
+      DEBUGP (("Pipelined request for %s on fd %d.\n", hu->url, pc->socket));
+      pc->pipelined[pc->npipelined++] = xstrdup (hu->url);
+      ++matched;
+      url_free (hu);
+    }
+  return true;
+}
+
+#ifdef HAVE_LIBZ
+/* Whether the document at U, of Content-Type TYPE, is a compressed
+   file, whose compression is not just a content coding.  */
+
+static bool
+compressed_file_p (const struct url *u, const char *type)
+{
+  static const char *suffixes[] = { ".gz", ".tgz", ".svgz" };
+  const char *file = u->file;
+  int len = strlen (file);
+  size_t i;
+
+  if (type && (0 == strcasecmp (type, "application/x-gzip")
+               || 0 == strcasecmp (type, "application/gzip")
+               || 0 == strcasecmp (type, "application/x-gunzip")))
+    return true;
+  for (i = 0; i < countof (suffixes); i++)
+    {
+      int slen = strlen (suffixes[i]);
+      if (len >= slen && 0 == strcasecmp (file + len - slen, suffixes[i]))
+        return true;
+    }
+  return false;
+}
+#endif
+
+#ifdef ENABLE_SEGMENTS
+/* Segmented retrieval.
+
+   With --segments=N, a large body whose server accepts byte ranges
+   is split into up to N ranges, each retrieved by a child process
+   over a connection of its own.  The child runs gethttp with a
+   bounded Range request and writes the data at its offset in the
+   output file, which the parent has already extended to its full
+   size.  A child retries its range until it is complete or the
+   tries are exhausted, resuming where the previous try stopped.
+
+   The children report their progress through a shared memory table,
+   from which the parent drives the progress gauge.  If a range can't
+   be completed, the file is cut back to the data that precedes it,
+   and http_loop resumes the download from there as usual.  */
+
+/* Bodies are not split into ranges smaller than this.  */
+#define SEGMENT_MIN_SIZE (1024 * 1024)
+
+/* One range of a segmented retrieval, in memory shared between the
+   parent and the children.  */
+struct segment {
+  wgint first, last;		/* the range, both inclusive */
+  wgint read;			/* bytes read so far, for progress */
+  wgint reached;		/* bytes before this offset are written */
+};
+
+/* In a child retrieving a range, the last byte of the range;
+   otherwise -1.  */
+static wgint segment_end = -1;
+
+static uerr_t gethttp (struct url *, struct http_stat *, int *, struct url *,
+                       struct iri *, int);
+
+/* Return the number of ranges to split the body described by HS,
+   STATCODE, CONTLEN and CONTRANGE into.  ACCEPT_RANGES is whether the
+   server said it understands byte ranges.  A return value of 1 means
+   that the body is to be read from the current connection.  */
+
+static int
+segment_count (const struct http_stat *hs, int statcode, wgint contlen,
+               wgint contrange, bool accept_ranges)
+{
+  if (opt.segments < 2 || segment_end >= 0
+      || !(statcode == HTTP_STATUS_OK ? accept_ranges : H_PARTIAL (statcode))
+      || contlen < 2 * SEGMENT_MIN_SIZE
+      || contrange != hs->restval
+      || hs->remote_encoding != ENC_NONE
+      || output_stream
+      || opt.save_headers
+      || opt.warc_filename
+      || opt.spider
+      || parallel_worker_p ())
+    return 1;
+  return MIN (opt.segments, contlen / SEGMENT_MIN_SIZE);
+}
+
+/* Retrieve the range described by SEG of the file FILE in a child
+   process, and exit.  The exit status is zero if the whole range has
+   been written.  */
+
+static void
+segment_worker (struct url *u, struct url *proxy, struct iri *iri,
+                const char *file, const char *referer, struct segment *seg,
+                int segments)
+{
+  FILE *fp = fopen (file, "r+b");
+  int count = 0;
+  bool fatal = false;
+
+  if (!fp)
+    logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+
+  /* Only the parent reports on the retrieval, and the transfer must
+     produce the bytes as they are on the server.  */
+  opt.verbose = false;
+  opt.server_response = false;
+  opt.noclobber = opt.timestamping = opt.always_rest = false;
+  opt.adjust_extension = false;
+#ifdef HAVE_LIBZ
+  opt.compression = compression_none;
+#endif
+  output_stream = fp;
+  output_stream_regular = true;
+  body_read_tally = &seg->read;
+  segment_end = seg->last;
+
+  while (fp && !fatal && seg->reached <= seg->last
+         && (!opt.ntry || count < opt.ntry))
+    {
+      struct http_stat hs;
+      int dt = 0;
+      uerr_t err;
+
+      if (count++)
+        sleep_between_retrievals (count);
+
+      xzero (hs);
+      hs.restval = seg->reached;
+      hs.referer = referer;
+      hs.local_file = xstrdup (file);
+      hs.existence_checked = hs.timestamp_checked = true;
+      if (fseeko (fp, seg->reached, SEEK_SET) < 0)
+        break;
+
+      err = gethttp (u, &hs, &dt, proxy, iri, count);
+      if (fflush (fp) != 0)
+        break;
+      if (hs.len > seg->reached)
+        seg->reached = hs.len;
+
+      switch (err)
+        {
+        case RETRFINISHED:
+          /* As in http_loop, an error response is final.  */
+          fatal = !(dt & RETROKF);
+          break;
+        case CONERROR: case WRITEFAILED: case HERR: case HEOF:
+        case CONSSLERR:
+          break;
+        default:
+          fatal = true;
+          break;
+        }
+      if (seg->reached <= seg->last)
+        DEBUGP (("Segment %s-%s stopped at %s: %s\n",
+                 number_to_static_string (seg->first),
+                 number_to_static_string (seg->last),
+                 number_to_static_string (seg->reached),
+                 hs.rderrmsg ? hs.rderrmsg
+                 : hs.error ? hs.error : "(no error message)"));
+      free_hstat (&hs);
+    }
+
+  if (fp)
+    fclose (fp);
+  logflush ();
+  _exit (seg->reached > seg->last ? 0 : 1);
+}
+
+/* Retrieve the LENGTH bytes of the body of U starting at offset
+   START over SEGMENTS connections, and store them to FP.  PROXY and
+   IRI are as for gethttp, and HS is updated as read_response_body
+   would.  */
+
+static uerr_t
+read_segmented_body (struct url *u, struct url *proxy, struct iri *iri,
+                     struct http_stat *hs, FILE *fp, wgint start,
+                     wgint length, int segments)
+{
+  struct segment *seg;
+  pid_t *pids;
+  void *progress = NULL;
+  struct ptimer *timer;
+  wgint shown = 0, prefix;
+  int i, running = 0;
+  bool complete = true;
+
+  hs->len = start;
+  hs->rd_size = 0;
+  hs->res = -1;
+
+  seg = mmap (NULL, segments * sizeof *seg, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (seg == MAP_FAILED)
+    {
+      hs->rderrmsg = xstrdup (strerror (errno));
+      return RETRFINISHED;
+    }
+
+  /* Make room for the whole body, so that every range can be written
+     in place.  */
+  if (fflush (fp) != 0 || ftruncate (fileno (fp), start + length) < 0)
+    {
+      munmap (seg, segments * sizeof *seg);
+      hs->res = -2;
+      return FWRITEERR;
+    }
+
+  logprintf (LOG_VERBOSE, _("Retrieving over %d connections.\n"), segments);
+
+  /* Children must not share the parent's keep-alive connections nor
+     repeat its buffered output.  */
+  http_close_persistent ();
+  logflush ();
+  fflush (stdout);
+
+  pids = xnew_array (pid_t, segments);
+  for (i = 0; i < segments; i++)
+    {
+      seg[i].first = start + length / segments * i;
+      seg[i].last = (i == segments - 1
+                     ? start + length - 1
+                     : start + length / segments * (i + 1) - 1);
+      seg[i].read = 0;
+      seg[i].reached = seg[i].first;
+      pids[i] = fork ();
+      if (pids[i] == 0)
+        segment_worker (u, proxy, iri, hs->local_file, hs->referer, seg + i,
+                        segments);
+      else if (pids[i] < 0)
+        logprintf (LOG_NOTQUIET, _("Cannot start worker process: %s\n"),
+                   strerror (errno));
+      else
+        ++running;
+    }
+
+  if (opt.verbose)
+    progress = progress_create (start, start + length);
+  timer = ptimer_new ();
+
+  while (running)
+    {
+      wgint sum = 0;
+      xsleep (0.1);
+      for (i = 0; i < segments; i++)
+        {
+          int status;
+          sum += seg[i].read;
+          if (pids[i] > 0 && waitpid (pids[i], &status, WNOHANG) == pids[i])
+            {
+              if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+                complete = false;
+              pids[i] = 0;
+              --running;
+            }
+        }
+      ptimer_measure (timer);
+      if (progress)
+        {
+          progress_set_connections (progress, running);
+          progress_update (progress, sum - shown, ptimer_read (timer));
+        }
+      shown = sum;
+    }
+  if (progress)
+    progress_finish (progress, ptimer_read (timer));
+  hs->dltime = ptimer_read (timer);
+  ptimer_destroy (timer);
+  hs->rd_size = shown;
+  timing_body (hs->dltime, hs->rd_size);
+
+  /* The data is complete up to the first range that isn't.  */
+  prefix = start + length;
+  for (i = 0; i < segments; i++)
+    if (seg[i].reached <= seg[i].last)
+      {
+        prefix = seg[i].reached;
+        complete = false;
+        break;
+      }
+
+  xfree (pids);
+  munmap (seg, segments * sizeof *seg);
+
+  hs->len = prefix;
+  if (!complete)
+    {
+      if (ftruncate (fileno (fp), prefix) < 0)
+        {
+          hs->res = -2;
+          return FWRITEERR;
+        }
+      hs->rderrmsg = xstrdup (_("Not all segments could be retrieved"));
+    }
+  else
+    hs->res = 0;
+  fseeko (fp, prefix, SEEK_SET);
+  return RETRFINISHED;
+}
+#endif /* ENABLE_SEGMENTS */
+
+/* The flags that allow clobbering the file (opening with "wb").
+   Defined here to avoid repetition later.  #### This will require
+   rework.  */
+#define ALLOW_CLOBBER (opt.noclobber || opt.always_rest || opt.timestamping \
+                       || opt.dirstruct || opt.output_document)
+
+/* Retrieve a document through HTTP protocol.  It recognizes status
+   code, and correctly handles redirections.  It closes the network
+   socket.  If it receives an error from the functions below it, it
+   will print it if there is enough information to do so (almost
    always), returning the error to the caller (i.e. http_loop).
 
    Various HTTP parameters are stored to hs.
@@ -1701,6 +2768,10 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
      POST). */
   bool head_only = !!(*dt & HEAD_ONLY);
 
+  /* Whether only the first byte is asked for, to learn the status of
+     a file whose server rejects HEAD requests.  */
+  bool probe = !!(*dt & RANGE_PROBE);
+
   char *head;
   struct response *resp;
   char hdrval[256];
@@ -1708,11 +2779,10 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
 
   /* Declare WARC variables. */
   bool warc_enabled = (opt.warc_filename != NULL);
-  FILE *warc_tmp = NULL;
+  struct warc_block *warc_tmp = NULL;
   char warc_timestamp_str [21];
   char warc_request_uuid [48];
   ip_address *warc_ip = NULL;
-  off_t warc_payload_offset = -1;
 
   /* Whether this connection will be kept alive after the HTTP request
      is done. */
@@ -1721,6 +2791,15 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
   /* Is the server using the chunked transfer encoding?  */
   bool chunked_transfer_encoding = false;
 
+  /* Whether the server accepts byte ranges.  */
+  bool accept_ranges = false;
+
+  /* Whether the server got our Range request wrong.  */
+  bool range_error;
+
+  /* Whether the body is only kept in memory, for its links.  */
+  bool in_memory;
+
   /* Whether keep-alive should be inhibited.  */
   bool inhibit_keep_alive =
     !opt.http_keep_alive || opt.ignore_length;
@@ -1730,6 +2809,19 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
 
   bool host_lookup_failed = false;
 
+  /* Whether the request was pipelined earlier, and its response is
+     to be read from the connection without sending anything.  */
+  bool pipelined_request = false;
+
+  /* "HOST:PORT" of the proxy, identifying proxied connections in the
+     connection pool.  */
+  char *proxy_key = NULL;
+
+#ifdef ENABLE_SEGMENTS
+  /* Number of connections the body is retrieved over.  */
+  int segments;
+#endif
+
 #ifdef HAVE_SSL
   if (u->scheme == SCHEME_HTTPS)
     {
@@ -1745,15 +2837,27 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
     }
 #endif /* HAVE_SSL */
 
+  /* The body is charged to the origin server's bandwidth limit, even
+     when it comes through a proxy.  */
+  if (opt.limit_rate_host)
+    limit_bandwidth_host (u->host, u->port);
+
   /* Initialize certain elements of struct http_stat.  */
   hs->len = 0;
   hs->contlen = -1;
   hs->res = -1;
   hs->rderrmsg = NULL;
+  hs->retry_after = -1;
   hs->newloc = NULL;
   hs->remote_time = NULL;
   hs->error = NULL;
   hs->message = NULL;
+  hs->remote_encoding = ENC_NONE;
+  hs->decompressed = false;
+  xfree_null (hs->etag);
+  hs->etag = NULL;
+  hs->has_digest = false;
+  hs->in_memory = false;
 
   conn = u;
 
@@ -1793,13 +2897,78 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
       /* ... but some HTTP/1.0 caches doesn't implement Cache-Control.  */
       request_set_header (req, "Pragma", "no-cache", rel_none);
     }
-  if (hs->restval)
+#ifdef ENABLE_SEGMENTS
+  if (segment_end >= 0)
+    request_set_header (req, "Range",
+                        aprintf ("bytes=%s-%s",
+                                 number_to_static_string (hs->restval),
+                                 number_to_static_string (segment_end)),
+                        rel_value);
+  else
+#endif
+  if (probe)
+    request_set_header (req, "Range", "bytes=0-0", rel_none);
+  else if (hs->restval)
     request_set_header (req, "Range",
                         aprintf ("bytes=%s-",
                                  number_to_static_string (hs->restval)),
                         rel_value);
   SET_USER_AGENT (req);
   request_set_header (req, "Accept", "*/*", rel_none);
+#ifdef HAVE_LIBZ
+  /* The bodies of HEAD responses are never decompressed, and asking
+     for compression would make -N compare the length of the
+     compressed remote file to the size of the local one.  A range
+     would be taken of the compressed body, while the local file, and
+     hence RESTVAL, holds the decompressed one.  */
+  if (opt.compression != compression_none && !head_only && !probe
+      && !hs->restval
+#ifdef ENABLE_SEGMENTS
+      && segment_end < 0
+#endif
+      )
+    request_set_header (req, "Accept-Encoding", "gzip, deflate", rel_none);
+#endif
+  if (*dt & IF_MODIFIED_SINCE)
+    {
+      /* Ask for the body only if it is newer than the local copy,
+         which saves -N the HEAD request it would otherwise send.  */
+      char *date = NULL;
+      if (hs->known)
+        {
+          /* The manifest vouches for the local file, and has the
+             validators the server sent with it.  */
+          xfree_null (hs->orig_file_name);
+          hs->orig_file_name = xstrdup (hs->known->file);
+          hs->orig_file_size = hs->known->size;
+          hs->orig_file_tstamp = hs->known->mtime;
+          if (hs->known->etag)
+            request_set_header (req, "If-None-Match", hs->known->etag,
+                                rel_none);
+          date = (hs->known->last_modified
+                  ? xstrdup (hs->known->last_modified)
+                  : http_date (hs->known->mtime));
+        }
+      else
+        {
+          stat_local_copy (hs);
+          if (hs->orig_file_name)
+            date = http_date (hs->orig_file_tstamp);
+        }
+      if (date)
+        request_set_header (req, "If-Modified-Since", date, rel_value);
+      else
+        *dt &= ~IF_MODIFIED_SINCE;
+    }
+  if (conditional && !head_only)
+    {
+      if (conditional->etag)
+        request_set_header (req, "If-None-Match", conditional->etag,
+                            rel_none);
+      if (conditional->last_modified)
+        request_set_header (req, "If-Modified-Since",
+                            conditional->last_modified, rel_none);
+    }
 
   /* Find the username and password for authentication. */
   user = u->user;
@@ -1818,32 +2987,33 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
       basic_auth_finished = maybe_send_basic_creds(u->host, user, passwd, req);
     }
 
-  /* Generate the Host header, HOST:PORT.  Take into account that:
-
-     - Broken server-side software often doesn't recognize the PORT
-       argument, so we must generate "Host: www.server.com" instead of
-       "Host: www.server.com:80" (and likewise for https port).
+#ifdef ENABLE_DIGEST
+  /* If the server has already sent us a Digest challenge, answer it
+     right away instead of waiting for the 401.  */
+  if (user && passwd && !basic_auth_finished)
+    {
+      char *pth = url_full_path (u);
+      char *value = digest_preemptive (u, user, passwd,
+                                       request_method (req), pth);
+      if (value)
+        request_set_header (req, "Authorization", value, rel_value);
+      xfree (pth);
+    }
+#endif
 
-     - IPv6 addresses contain ":", so "Host: 3ffe:8100:200:2::2:1234"
-       becomes ambiguous and needs to be rewritten as "Host:
-       [3ffe:8100:200:2::2]:1234".  */
-  {
-    /* Formats arranged for hfmt[add_port][add_squares].  */
-    static const char *hfmt[][2] = {
-      { "%s", "[%s]" }, { "%s:%d", "[%s]:%d" }
-    };
-    int add_port = u->port != scheme_default_port (u->scheme);
-    int add_squares = strchr (u->host, ':') != NULL;
-    request_set_header (req, "Host",
-                        aprintf (hfmt[add_port][add_squares], u->host, u->port),
-                        rel_value);
-  }
+  request_set_host_header (req, u);
 
   if (inhibit_keep_alive)
     request_set_header (req, "Connection", "Close", rel_none);
   else
     {
-      if (proxy == NULL)
+      /* Through a CONNECT tunnel, the request goes to the server
+         itself, which is what keeps the tunnel open.  */
+      if (proxy == NULL
+#ifdef HAVE_SSL
+          || u->scheme == SCHEME_HTTPS
+#endif
+          )
         request_set_header (req, "Connection", "Keep-Alive", rel_none);
       else
         {
@@ -1925,6 +3095,8 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
       /* If we're using a proxy, we will be connecting to the proxy
          server.  */
       conn = proxy;
+      proxy_key = alloca (strlen (proxy->host) + 1 + numdigit (proxy->port) + 1);
+      sprintf (proxy_key, "%s:%d", proxy->host, proxy->port);
 
       /* Proxy authorization over SSL is handled below. */
 #ifdef HAVE_SSL
@@ -1946,34 +3118,48 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
          case the proxy is nothing but a passthrough to the target
          host, registered as a connection to the latter.  */
       struct url *relevant = conn;
+      struct pconn *pc;
 #ifdef HAVE_SSL
       if (u->scheme == SCHEME_HTTPS)
         relevant = u;
 #endif
 
-      if (persistent_available_p (relevant->host, relevant->port,
+      pc = persistent_available_p (relevant->host, relevant->port,
 #ifdef HAVE_SSL
-                                  relevant->scheme == SCHEME_HTTPS,
+                                   relevant->scheme == SCHEME_HTTPS,
 #else
-                                  0,
+                                   0,
 #endif
-                                  &host_lookup_failed))
+                                   proxy_key, u->url, &host_lookup_failed);
+      if (pc)
         {
-          int family = socket_family (pconn.socket, ENDPOINT_PEER);
-          sock = pconn.socket;
-          using_ssl = pconn.ssl;
+          int family = socket_family (pc->socket, ENDPOINT_PEER);
+          sock = pc->socket;
+          using_ssl = pc->ssl;
 #if ENABLE_IPV6
           if (family == AF_INET6)
              logprintf (LOG_VERBOSE, _("Reusing existing connection to [%s]:%d.\n"),
-                        quotearg_style (escape_quoting_style, pconn.host),
-                         pconn.port);
+                        quotearg_style (escape_quoting_style, pc->host),
+                         pc->port);
           else
 #endif
              logprintf (LOG_VERBOSE, _("Reusing existing connection to %s:%d.\n"),
-                        quotearg_style (escape_quoting_style, pconn.host),
-                        pconn.port);
+                        quotearg_style (escape_quoting_style, pc->host),
+                        pc->port);
           DEBUGP (("Reusing fd %d.\n", sock));
-          if (pconn.authorized)
+          timing_set_reused ();
+          COUNTER_ADD (reused, 1);
+          if (pc->npipelined)
+            {
+              /* Our request was the first of those pipelined on the
+                 connection.  */
+              pipelined_request = true;
+              xfree (pc->pipelined[0]);
+              --pc->npipelined;
+              memmove (pc->pipelined, pc->pipelined + 1,
+                       pc->npipelined * sizeof (char *));
+            }
+          if (pc->authorized)
             /* If the connection is already authorized, the "Basic"
                authorization added by code above is unnecessary and
                only hurts us.  */
@@ -1991,7 +3177,21 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
 
   if (sock < 0)
     {
-      sock = connect_to_host (conn->host, conn->port);
+#ifdef HAVE_SSL
+      /* Open a tunnel over an idle connection to the proxy, if there
+         is one, rather than connect to the proxy again.  */
+      if (proxy && u->scheme == SCHEME_HTTPS && !inhibit_keep_alive)
+        {
+          sock = pconn_take_proxy (proxy_key);
+          if (sock >= 0)
+            logprintf (LOG_VERBOSE,
+                       _("Reusing existing connection to %s:%d.\n"),
+                       quotearg_style (escape_quoting_style, proxy->host),
+                       proxy->port);
+        }
+      if (sock < 0)
+#endif
+        sock = connect_to_host (conn->host, conn->port);
       if (sock == E_HOST)
         {
           request_free (req);
@@ -2010,6 +3210,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
           /* When requesting SSL URLs through proxies, use the
              CONNECT method to request passthrough.  */
           struct request *connreq = request_new ();
+          timing_begin (PHASE_CONNECT);
           request_set_method (connreq, "CONNECT",
                               aprintf ("%s:%d", u->host, u->port));
           SET_USER_AGENT (connreq);
@@ -2084,10 +3285,12 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
              to reflect this.  That way register_persistent will
              register SOCK as being connected to u->host:u->port.  */
           conn = u;
+          timing_end (PHASE_CONNECT);
         }
 
       if (conn->scheme == SCHEME_HTTPS)
         {
+          timing_begin (PHASE_TLS);
           if (!ssl_connect_wget (sock, u->host))
             {
               fd_close (sock);
@@ -2100,21 +3303,26 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
               request_free (req);
               return VERIFCERTERR;
             }
+#ifdef ENABLE_HTTP2
+          if (opt.http2 && ssl_http2_p (sock) && !http2_attach (sock, u->host))
+            {
+              logprintf (LOG_NOTQUIET, _("Could not start HTTP/2 with %s.\n"),
+                         u->host);
+              fd_close (sock);
+              request_free (req);
+              return CONERROR;
+            }
+#endif
+          timing_end (PHASE_TLS);
           using_ssl = true;
         }
 #endif /* HAVE_SSL */
     }
 
-  /* Open the temporary file where we will write the request. */
+  /* Collect the request for the WARC record. */
   if (warc_enabled)
     {
-      warc_tmp = warc_tempfile ();
-      if (warc_tmp == NULL)
-        {
-          CLOSE_INVALIDATE (sock);
-          request_free (req);
-          return WARC_TMP_FOPENERR;
-        }
+      warc_tmp = warc_block_new ();
 
       if (! proxy)
         {
@@ -2123,8 +3331,25 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
         }
     }
 
-  /* Send the request to server.  */
-  write_error = request_send (req, sock, warc_tmp);
+  /* Send the request to server, unless that was done earlier.  */
+  if (pipelined_request)
+    {
+      DEBUGP (("Request for %s was pipelined.\n", u->url));
+      write_error = 0;
+    }
+  else
+    write_error = request_send (req, sock, warc_tmp);
+
+  /* Pipeline the requests for the URLs that come next.  */
+  if (write_error >= 0 && keep_alive && !proxy
+      && pipeline_allowed_p (u, head_only, user && passwd))
+    {
+      /* A connection coming from the pool has been kept alive by
+         the server before.  */
+      struct pconn *pc = pconn_find (sock);
+      if (pc && !pipeline_requests (pc, u))
+        keep_alive = false;
+    }
 
   if (write_error >= 0)
     {
@@ -2135,11 +3360,10 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
           if (write_error >= 0 && warc_tmp != NULL)
             {
               /* Remember end of headers / start of payload. */
-              warc_payload_offset = ftello (warc_tmp);
+              warc_block_start_payload (warc_tmp);
 
               /* Write a copy of the data to the WARC record. */
-              int warc_tmp_written = fwrite (opt.post_data, 1, post_data_size, warc_tmp);
-              if (warc_tmp_written != post_data_size)
+              if (!warc_block_write (warc_tmp, opt.post_data, post_data_size))
                 write_error = -2;
             }
         }
@@ -2147,7 +3371,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
         {
           if (warc_tmp != NULL)
             /* Remember end of headers / start of payload. */
-            warc_payload_offset = ftello (warc_tmp);
+            warc_block_start_payload (warc_tmp);
 
           write_error = post_file (sock, opt.post_file_name, post_data_size, warc_tmp);
         }
@@ -2159,7 +3383,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
       request_free (req);
 
       if (warc_tmp != NULL)
-        fclose (warc_tmp);
+        warc_block_free (warc_tmp);
 
       if (write_error == -2)
         return WARC_TMP_FWRITEERR;
@@ -2183,7 +3407,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
       /* Create a request record and store it in the WARC file. */
       warc_result = warc_write_request_record (u->url, warc_timestamp_str,
                                                warc_request_uuid, warc_ip,
-                                               warc_tmp, warc_payload_offset);
+                                               warc_tmp);
       if (! warc_result)
         {
           CLOSE_INVALIDATE (sock);
@@ -2191,14 +3415,18 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
           return WARC_ERR;
         }
 
-      /* warc_write_request_record has also closed warc_tmp. */
+      /* warc_write_request_record has also freed warc_tmp. */
     }
 
+  timing_begin (PHASE_WAIT);
 
 read_header:
   head = read_http_response_head (sock);
+  timing_end (PHASE_WAIT);
   if (!head)
     {
+      if (pipelined_request)
+        pipeline_disable (u->host);
       if (errno == 0)
         {
           logputs (LOG_NOTQUIET, _("No data received.\n"));
@@ -2294,6 +3522,31 @@ read_header:
       && 0 == strcasecmp (hdrval, "chunked"))
     chunked_transfer_encoding = true;
 
+  accept_ranges = (resp_header_copy (resp, "Accept-Ranges",
+                                     hdrval, sizeof (hdrval))
+                   && 0 == strcasecmp (hdrval, "bytes"));
+
+  hs->remote_encoding = ENC_NONE;
+  if (resp_header_copy (resp, "Content-Encoding", hdrval, sizeof (hdrval)))
+    {
+      if (0 == strcasecmp (hdrval, "gzip")
+          || 0 == strcasecmp (hdrval, "x-gzip"))
+        hs->remote_encoding = ENC_GZIP;
+      else if (0 == strcasecmp (hdrval, "deflate"))
+        hs->remote_encoding = ENC_DEFLATE;
+      else if (0 != strcasecmp (hdrval, "identity"))
+        hs->remote_encoding = ENC_OTHER;
+    }
+
+  /* A body that extends to the end of the connection leaves no room
+     for the responses to pipelined requests.  */
+  if (keep_alive && contlen == -1 && !chunked_transfer_encoding && !head_only)
+    {
+      struct pconn *pc = pconn_find (sock);
+      if (pc && pc->npipelined)
+        keep_alive = false;
+    }
+
   /* Handle (possibly multiple instances of) the Set-Cookie header. */
   if (opt.cookies)
     {
@@ -2309,13 +3562,15 @@ read_header:
           char *set_cookie; BOUNDED_TO_ALLOCA (scbeg, scend, set_cookie);
           cookie_handle_set_cookie (wget_cookie_jar, u->host, u->port,
                                     u->path, set_cookie);
+          if (parallel_worker_p ())
+            parallel_forward_cookie (u->host, u->port, u->path, set_cookie);
         }
     }
 
   if (keep_alive)
     /* The server has promised that it will not close the connection
        when we're done.  This means that we can register it.  */
-    register_persistent (conn->host, conn->port, sock, using_ssl);
+    register_persistent (conn->host, conn->port, sock, using_ssl, proxy_key);
 
   if (statcode == HTTP_STATUS_UNAUTHORIZED)
     {
@@ -2356,7 +3611,11 @@ read_header:
             CLOSE_INVALIDATE (sock);
         }
 
-      pconn.authorized = false;
+      {
+        struct pconn *pc = pconn_find (sock);
+        if (pc)
+          pc->authorized = false;
+      }
       if (!auth_finished && (user && passwd))
         {
           /* IIS sends multiple copies of WWW-Authenticate, one with
@@ -2390,7 +3649,7 @@ read_header:
                                   create_authorization_line (www_authenticate,
                                                              user, passwd,
                                                              request_method (req),
-                                                             pth,
+                                                             pth, u, sock,
                                                              &auth_finished),
                                   rel_value);
               if (BEGINS_WITH (www_authenticate, "NTLM"))
@@ -2414,6 +3673,9 @@ read_header:
             }
         }
       logputs (LOG_NOTQUIET, _("Authorization failed.\n"));
+#ifdef ENABLE_DIGEST
+      digest_forget (u);
+#endif
       request_free (req);
       xfree_null (message);
       resp_free (resp);
@@ -2424,7 +3686,16 @@ read_header:
     {
       /* Kludge: if NTLM is used, mark the TCP connection as authorized. */
       if (ntlm_seen)
-        pconn.authorized = true;
+        {
+          struct pconn *pc = pconn_find (sock);
+          if (pc)
+            pc->authorized = true;
+        }
+#ifdef ENABLE_DIGEST
+      if (resp_header_copy (resp, "Authentication-Info",
+                            hdrval, sizeof (hdrval)))
+        digest_next_nonce (u, hdrval);
+#endif
     }
 
   /* Determine the local filename if needed. Notice that if -O is used
@@ -2477,65 +3748,9 @@ read_header:
   hs->existence_checked = true;
 
   /* Support timestamping */
-  /* TODO: move this code out of gethttp. */
-  if (opt.timestamping && !hs->timestamp_checked)
-    {
-      size_t filename_len = strlen (hs->local_file);
-      char *filename_plus_orig_suffix = alloca (filename_len + sizeof (ORIG_SFX));
-      bool local_dot_orig_file_exists = false;
-      char *local_filename = NULL;
-      struct_stat st;
-
-      if (opt.backup_converted)
-        /* If -K is specified, we'll act on the assumption that it was specified
-           last time these files were downloaded as well, and instead of just
-           comparing local file X against server file X, we'll compare local
-           file X.orig (if extant, else X) against server file X.  If -K
-           _wasn't_ specified last time, or the server contains files called
-           *.orig, -N will be back to not operating correctly with -k. */
-        {
-          /* Would a single s[n]printf() call be faster?  --dan
-
-             Definitely not.  sprintf() is horribly slow.  It's a
-             different question whether the difference between the two
-             affects a program.  Usually I'd say "no", but at one
-             point I profiled Wget, and found that a measurable and
-             non-negligible amount of time was lost calling sprintf()
-             in url.c.  Replacing sprintf with inline calls to
-             strcpy() and number_to_string() made a difference.
-             --hniksic */
-          memcpy (filename_plus_orig_suffix, hs->local_file, filename_len);
-          memcpy (filename_plus_orig_suffix + filename_len,
-                  ORIG_SFX, sizeof (ORIG_SFX));
-
-          /* Try to stat() the .orig file. */
-          if (stat (filename_plus_orig_suffix, &st) == 0)
-            {
-              local_dot_orig_file_exists = true;
-              local_filename = filename_plus_orig_suffix;
-            }
-        }
-
-      if (!local_dot_orig_file_exists)
-        /* Couldn't stat() <file>.orig, so try to stat() <file>. */
-        if (stat (hs->local_file, &st) == 0)
-          local_filename = hs->local_file;
-
-      if (local_filename != NULL)
-        /* There was a local file, so we'll check later to see if the version
-           the server has is the same version we already have, allowing us to
-           skip a download. */
-        {
-          hs->orig_file_name = xstrdup (local_filename);
-          hs->orig_file_size = st.st_size;
-          hs->orig_file_tstamp = st.st_mtime;
-#ifdef WINDOWS
-          /* Modification time granularity is 2 seconds for Windows, so
-             increase local time by 1 second for later comparison. */
-          ++hs->orig_file_tstamp;
-#endif
-        }
-    }
+  if (opt.timestamping && !hs->timestamp_checked
+      && !(*dt & IF_MODIFIED_SINCE))
+    stat_local_copy (hs);
 
   request_free (req);
 
@@ -2570,8 +3785,33 @@ read_header:
             }
         }
     }
-  hs->newloc = resp_header_strdup (resp, "Location");
-  hs->remote_time = resp_header_strdup (resp, "Last-Modified");
+  hs->newloc = resp_header_strdup (resp, "Location");
+  hs->remote_time = resp_header_strdup (resp, "Last-Modified");
+  if (statcode == HTTP_STATUS_TOO_MANY_REQUESTS
+      || statcode == HTTP_STATUS_UNAVAILABLE)
+    {
+      char *retry_after = resp_header_strdup (resp, "Retry-After");
+      if (retry_after)
+        {
+          hs->retry_after = parse_retry_after (retry_after);
+          xfree (retry_after);
+        }
+    }
+  xfree_null (hs->etag);
+  hs->etag = resp_header_strdup (resp, "ETag");
+
+  if (conditional && !head_only)
+    {
+      conditional->statcode = statcode;
+      if (H_20X (statcode))
+        {
+          xfree_null (conditional->etag);
+          xfree_null (conditional->last_modified);
+          conditional->etag = resp_header_strdup (resp, "ETag");
+          conditional->last_modified = hs->remote_time
+            ? xstrdup (hs->remote_time) : NULL;
+        }
+    }
 
   if (resp_header_copy (resp, "Content-Range", hdrval, sizeof (hdrval)))
     {
@@ -2656,21 +3896,62 @@ read_header:
         }
     }
 
-  /* If content-type is not given, assume text/html.  This is because
-     of the multitude of broken CGI's that "forget" to generate the
-     content-type.  */
-  if (!type ||
-        0 == strncasecmp (type, TEXTHTML_S, strlen (TEXTHTML_S)) ||
-        0 == strncasecmp (type, TEXTXHTML_S, strlen (TEXTXHTML_S)))
-    *dt |= TEXTHTML;
-  else
-    *dt &= ~TEXTHTML;
+  if (conditional && !head_only && statcode == HTTP_STATUS_NOT_MODIFIED)
+    {
+      /* The conditional request found the caller's copy current.  */
+      set_file_type_flags (hs->local_file, dt);
+      logputs (LOG_VERBOSE, _("\
+\n    The file has not been modified; nothing to do.\n\n"));
+      hs->len = 0;
+      hs->res = 0;
+      *dt |= RETROKF;
+      xfree_null (type);
+      CLOSE_FINISH (sock);
+      xfree (head);
+      return RETRUNNEEDED;
+    }
 
-  if (type &&
-      0 == strncasecmp (type, TEXTCSS_S, strlen (TEXTCSS_S)))
-    *dt |= TEXTCSS;
-  else
-    *dt &= ~TEXTCSS;
+  if (*dt & IF_MODIFIED_SINCE)
+    {
+      /* A server that ignores If-Modified-Since sends the whole body
+         again, which is not needed if it is the local one.  */
+      time_t tmr = hs->remote_time ? http_atotm (hs->remote_time) : -1;
+      bool same_etag = (hs->known && hs->known->etag && hs->etag
+                        && !strcmp (hs->known->etag, hs->etag));
+      bool unchanged = (statcode == HTTP_STATUS_OK
+                        && contlen == hs->orig_file_size
+                        && (same_etag
+                            || (tmr != (time_t) -1
+                                && tmr <= hs->orig_file_tstamp)));
+
+      if (statcode == HTTP_STATUS_NOT_MODIFIED || unchanged)
+        {
+          logprintf (LOG_VERBOSE, _("\
+\nServer file no newer than local file %s -- not retrieving.\n\n"),
+                     quote (hs->orig_file_name));
+          hs->len = 0;
+          hs->res = 0;
+          *dt |= RETROKF;
+          /* A 304 response need not say what the file is, so that it
+             must be guessed from the local file as for -nc.  */
+          if (unchanged)
+            set_type_flags (type, dt);
+          else
+            set_file_type_flags (hs->local_file, dt);
+          xfree_null (type);
+          if (unchanged)
+            CLOSE_INVALIDATE (sock);
+          else
+            CLOSE_FINISH (sock);
+          xfree (head);
+          return RETRUNNEEDED;
+        }
+      /* Should this try fail, the next one resumes the download
+         rather than ask again.  */
+      *dt &= ~IF_MODIFIED_SINCE;
+    }
+
+  set_type_flags (type, dt);
 
   if (opt.adjust_extension)
     {
@@ -2688,6 +3969,25 @@ read_header:
         }
     }
 
+  if (probe)
+    {
+      /* The status is all we wanted to know.  A 416 response means
+         that the file is empty.  */
+      if (statcode == HTTP_STATUS_RANGE_NOT_SATISFIABLE)
+        *dt |= RETROKF;
+      hs->len = 0;
+      hs->res = 0;
+      hs->restval = 0;
+      if (keep_alive
+          && skip_short_body (sock, contlen, chunked_transfer_encoding))
+        CLOSE_FINISH (sock);
+      else
+        CLOSE_INVALIDATE (sock);
+      xfree (head);
+      xfree_null (type);
+      return RETRFINISHED;
+    }
+
   if (statcode == HTTP_STATUS_RANGE_NOT_SATISFIABLE
       || (!opt.timestamping && hs->restval > 0 && statcode == HTTP_STATUS_OK
           && contrange == 0 && contlen >= 0 && hs->restval >= contlen))
@@ -2709,8 +4009,16 @@ read_header:
       xfree (head);
       return RETRUNNEEDED;
     }
-  if ((contrange != 0 && contrange != hs->restval)
-      || (H_PARTIAL (statcode) && !contrange))
+#ifdef ENABLE_SEGMENTS
+  if (segment_end >= 0)
+    /* A segment is useless unless it starts where we asked, and it
+       may well start at byte 0.  */
+    range_error = !H_PARTIAL (statcode) || contrange != hs->restval;
+  else
+#endif
+    range_error = ((contrange != 0 && contrange != hs->restval)
+                   || (H_PARTIAL (statcode) && !contrange));
+  if (range_error)
     {
       /* The Range request was somehow misunderstood by the server.
          Bail out.  */
@@ -2719,7 +4027,20 @@ read_header:
       xfree (head);
       return RANGEERR;
     }
-  if (contlen == -1)
+#ifdef HAVE_LIBZ
+  /* With --compression=auto, files that are compressed in their own
+     right, and which broken servers claim to be gzip encoded, are
+     saved as they are.  */
+  hs->decompressed = (opt.compression != compression_none
+                      && (hs->remote_encoding == ENC_GZIP
+                          || hs->remote_encoding == ENC_DEFLATE)
+                      && contlen != 0
+                      && !(opt.compression == compression_auto
+                           && compressed_file_p (u, type)));
+#endif
+
+  if (contlen == -1 || hs->decompressed)
+    /* The length of the decompressed body is not known.  */
     hs->contlen = -1;
   else
     hs->contlen = contlen + contrange;
@@ -2820,8 +4141,19 @@ read_header:
 # define FOPEN_BIN_FLAG true
 #endif /* def __VMS [else] */
 
+  /* A document that recursion only wants the links of, and deletes
+     right after, isn't saved at all: the capture of it is parsed
+     instead, and it is only written out if it is too large to keep.  */
+  in_memory = (link_capture && !output_stream && !hs->restval
+               && !opt.save_headers && !parallel_worker_p ()
+               && (*dt & (TEXTHTML | TEXTCSS))
+               && (opt.delete_after || opt.spider
+                   || !acceptable (hs->local_file)));
+
   /* Open the local file.  */
-  if (!output_stream)
+  if (in_memory)
+    fp = NULL;
+  else if (!output_stream)
     {
       mkalldirs (hs->local_file);
       if (opt.backups)
@@ -2834,12 +4166,18 @@ read_header:
           open_id = 21;
           fp = fopen (hs->local_file, "ab", FOPEN_OPT_ARGS);
 #else /* def __VMS */
-          fp = fopen (hs->local_file, "ab");
+          /* The file may be hard-linked to others by --dedup-files,
+             and appending to it must not change them.  */
+          fp = dedup_unshare (hs->local_file)
+               ? fopen (hs->local_file, "ab") : NULL;
 #endif /* def __VMS [else] */
         }
       else if (ALLOW_CLOBBER || count > 0)
         {
-	  if (opt.unlink && file_exists_p (hs->local_file))
+	  /* With --dedup-files, the file may be linked to others that
+	     are not to be overwritten.  */
+	  if ((opt.unlink || opt.dedup_files)
+	      && file_exists_p (hs->local_file))
 	    {
 	      int res = unlink (hs->local_file);
 	      if (res < 0)
@@ -2900,27 +4238,108 @@ read_header:
     }
 
 
-  err = read_response_body (hs, sock, fp, contlen, contrange,
-                            chunked_transfer_encoding,
-                            u->url, warc_timestamp_str,
-                            warc_request_uuid, warc_ip, type,
-                            statcode, head);
+#ifdef ENABLE_SEGMENTS
+  if (!in_memory && !chunked_transfer_encoding && !head_only
+      && (segments = segment_count (hs, statcode, contlen, contrange,
+                                    accept_ranges)) > 1)
+    {
+      /* The body is retrieved over new connections; drop this one.  */
+      CLOSE_INVALIDATE (sock);
+      err = read_segmented_body (u, proxy, iri, hs, fp, contrange, contlen,
+                                 segments);
+    }
+  else
+#endif
+    {
+      /* Capture a document that recursion will look for links in,
+         unless the file will hold more than the document.  */
+      struct sha1_ctx digest_ctx;
+
+      if (link_capture && !output_stream && !hs->restval
+          && !opt.save_headers && (*dt & (TEXTHTML | TEXTCSS)))
+        body_link_stream = link_stream_new (hs->local_file, u->url,
+                                            !(*dt & TEXTHTML), in_memory);
+      /* The manifest keeps the digest of whole files, and
+         --dedup-files looks for identical ones by it.  */
+      if ((opt.manifest || opt.dedup_files) && !output_stream && !in_memory && !hs->restval
+          && !opt.save_headers)
+        {
+          sha1_init_ctx (&digest_ctx);
+          body_digest = &digest_ctx;
+        }
+      err = read_response_body (hs, sock, fp, contlen, contrange,
+                                chunked_transfer_encoding,
+                                u->url, warc_timestamp_str,
+                                warc_request_uuid, warc_ip, type,
+                                statcode, head);
+      if (body_link_stream)
+        {
+          hs->in_memory = link_stream_finish (body_link_stream,
+                                              hs->res >= 0);
+          body_link_stream = NULL;
+        }
+      if (body_digest)
+        {
+          sha1_finish_ctx (&digest_ctx, hs->digest);
+          hs->has_digest = hs->res >= 0;
+          body_digest = NULL;
+        }
+    }
 
   /* Now we no longer need to store the response header. */
   xfree (head);
   xfree_null (type);
 
-  if (hs->res >= 0)
+  if (sock < 0)
+    /* Already closed.  */
+    ;
+  else if (hs->res >= 0)
     CLOSE_FINISH (sock);
   else
     CLOSE_INVALIDATE (sock);
 
-  if (!output_stream)
+  if (fp && !output_stream)
     fclose (fp);
 
   return err;
 }
 
+/* Record in the manifest the local copy of U described by HS, which
+   was just retrieved or found current.  */
+
+static void
+manifest_note (const struct url *u, const struct http_stat *hs)
+{
+  struct manifest_entry e;
+  struct_stat st;
+
+  if (!opt.manifest || opt.output_document || opt.delete_after
+      || opt.spider || !hs->local_file
+      || stat (hs->local_file, &st) != 0)
+    return;
+  xzero (e);
+  e.file = hs->local_file;
+  e.size = st.st_size;
+  e.mtime = st.st_mtime;
+  e.etag = hs->etag;
+  e.last_modified = hs->remote_time;
+  e.has_digest = hs->has_digest;
+  memcpy (e.digest, hs->digest, sizeof e.digest);
+  manifest_record (u->url, &e);
+}
+
+/* With --dedup-files, have the file just saved as described by HS
+   share the storage of an identical file saved before.  */
+
+static void
+dedup_note (const struct http_stat *hs)
+{
+  if (!opt.dedup_files || !hs->has_digest || !hs->local_file
+      || opt.output_document || opt.delete_after || opt.spider)
+    return;
+  dedup_file (hs->local_file, hs->digest);
+}
+
 /* The genuine HTTP loop!  This is the part where the retrieval is
    retried, and retried, and retried, and...  */
 uerr_t
@@ -2928,7 +4347,7 @@ http_loop (struct url *u, struct url *original_url, char **newloc,
            char **local_file, const char *referer, int *dt, struct url *proxy,
            struct iri *iri)
 {
-  int count;
+  int count, resumed_tries;
   bool got_head = false;         /* used for time-stamping and filename detection */
   bool time_came_from_head = false;
   bool got_name = false;
@@ -2984,7 +4403,16 @@ http_loop (struct url *u, struct url *original_url, char **newloc,
       got_name = true;
     }
 
-  if (got_name && file_exists_p (hstat.local_file) && opt.noclobber && !opt.output_document)
+  /* A file listed in the manifest need not be looked for.  */
+  if (opt.manifest && got_name && !opt.output_document)
+    {
+      const struct manifest_entry *e = manifest_lookup (u->url);
+      if (e && !strcmp (e->file, hstat.local_file))
+        hstat.known = e;
+    }
+
+  if (got_name && (hstat.known || file_exists_p (hstat.local_file))
+      && opt.noclobber && !opt.output_document)
     {
       /* If opt.noclobber is turned on and file already exists, do not
          retrieve the file. But if the output_document was given, then this
@@ -2994,9 +4422,6 @@ http_loop (struct url *u, struct url *original_url, char **newloc,
       goto exit;
     }
 
-  /* Reset the counter. */
-  count = 0;
-
   /* Reset the document type. */
   *dt = 0;
 
@@ -3009,20 +4434,32 @@ http_loop (struct url *u, struct url *original_url, char **newloc,
   if (opt.content_disposition && opt.always_rest)
     send_head_first = true;
 
-  /* Send preliminary HEAD request if -N is given and we have an existing
-   * destination file. */
+  /* If -N is given and we have an existing destination file, make the
+     GET conditional on its time-stamp, or send a preliminary HEAD
+     request if the name of the file depends on the response.  */
   file_name = url_file_name (opt.trustservernames ? u : original_url, NULL);
-  if (opt.timestamping && (file_exists_p (file_name)
+  if (opt.timestamping && (hstat.known || file_exists_p (file_name)
                            || opt.content_disposition))
-    send_head_first = true;
+    {
+      if (opt.if_modified_since && got_name && !opt.spider && !conditional)
+        *dt |= IF_MODIFIED_SINCE;
+      else
+        send_head_first = true;
+    }
   xfree (file_name);
 
+  /* A URL put back in the queue by retrieve_tree goes on counting
+     its tries, and has had its wait in the queue.  */
+  count = resumed_tries = retry_tries;
+  retry_tries = 0;
+
   /* THE loop */
   do
     {
       /* Increment the pass counter.  */
       ++count;
-      sleep_between_retrievals (count);
+      if (!resumed_tries || count > resumed_tries + 1)
+        sleep_between_retrievals (count);
 
       /* Get the current time string.  */
       tms = datetime_str (time (NULL));
@@ -3074,7 +4511,7 @@ Spider mode enabled. Check if remote file exists.\n"));
            hstat.len even if count>1 because we don't want a failed
            first attempt to clobber existing data.)  */
         hstat.restval = st.st_size;
-      else if (count > 1)
+      else if (count > 1 && !hstat.decompressed)
         /* otherwise, continue where the previous try left off */
         hstat.restval = hstat.len;
       else
@@ -3093,7 +4530,10 @@ Spider mode enabled. Check if remote file exists.\n"));
         *dt &= ~SEND_NOCACHE;
 
       /* Try fetching the document, or at least its head.  */
+      timing_start_transfer ();
       err = gethttp (u, &hstat, dt, proxy, iri, count);
+      timing_finish_transfer (u->url);
+      stats_note_attempt ();
 
       /* Time?  */
       tms = datetime_str (time (NULL));
@@ -3105,8 +4545,16 @@ Spider mode enabled. Check if remote file exists.\n"));
       switch (err)
         {
         case HERR: case HEOF: case CONSOCKERR: case CONCLOSED:
-        case CONERROR: case READERR: case WRITEFAILED:
-        case RANGEERR: case FOPEN_EXCL_ERR:
+        case CONERROR: case READERR:
+          /* The host may need some time to recover, which a
+             recursive retrieval spends on other URLs.  */
+          if (retry_defer (count, -1))
+            {
+              ret = RETRYLATER;
+              goto exit;
+            }
+          /* fall through */
+        case WRITEFAILED: case RANGEERR: case FOPEN_EXCL_ERR:
           /* Non-fatal errors continue executing the loop, which will
              bring them to "while" statement at the end, to judge
              whether the number of tries was exceeded.  */
@@ -3163,6 +4611,8 @@ Spider mode enabled. Check if remote file exists.\n"));
           goto exit;
         case RETRUNNEEDED:
           /* The file was already fully retrieved. */
+          if (opt.timestamping && !hstat.known)
+            manifest_note (u, &hstat);
           ret = RETROK;
           goto exit;
         case RETRFINISHED:
@@ -3183,11 +4633,38 @@ Spider mode enabled. Check if remote file exists.\n"));
               logprintf (LOG_NONVERBOSE, "%s:\n", hurl);
             }
 
-          /* Fall back to GET if HEAD fails with a 500 or 501 error code. */
+          /* An overloaded server may say when to come back.  */
+          if ((hstat.statcode == HTTP_STATUS_TOO_MANY_REQUESTS
+               || hstat.statcode == HTTP_STATUS_UNAVAILABLE)
+              && hstat.retry_after >= 0
+              && hstat.retry_after <= RETRY_AFTER_MAX
+              && (!opt.ntry || count < opt.ntry))
+            {
+              logprintf (LOG_NOTQUIET, _("%s ERROR %d: %s.\n"),
+                         tms, hstat.statcode,
+                         quotearg_style (escape_quoting_style, hstat.error));
+              xfree_null (hurl);
+              if (retry_defer (count, hstat.retry_after))
+                {
+                  ret = RETRYLATER;
+                  goto exit;
+                }
+              printwhat (count, opt.ntry);
+              xsleep (hstat.retry_after);
+              continue;
+            }
+
+          /* Fall back to GET if HEAD fails with a 405, 500 or 501
+             error code.  A spider that won't look into the file only
+             asks for its first byte.  */
           if (*dt & HEAD_ONLY
-              && (hstat.statcode == 500 || hstat.statcode == 501))
+              && (hstat.statcode == 405 || hstat.statcode == 500
+                  || hstat.statcode == 501))
             {
               got_head = true;
+              if (opt.spider && !opt.recursive)
+                *dt |= RANGE_PROBE;
+              xfree_null (hurl);
               continue;
             }
           /* Maybe we should always keep track of broken links, not just in
@@ -3215,6 +4692,18 @@ Remote file does not exist -- broken link!!!\n"));
           goto exit;
         }
 
+      if (*dt & RANGE_PROBE)
+        {
+          /* The server rejected HEAD, but the file is there.  */
+          logprintf (LOG_VERBOSE, _("Remote file exists.\n\n"));
+          logprintf (LOG_NONVERBOSE, _("%s URL: %s %2d %s\n"),
+                     tms, u->url, hstat.statcode,
+                     hstat.message ? quotearg_style (escape_quoting_style, hstat.message) : "");
+          *dt &= ~RANGE_PROBE;
+          ret = RETROK;
+          goto exit;
+        }
+
       /* Did we get the time-stamp? */
       if (!got_head)
         {
@@ -3342,11 +4831,11 @@ Remote file exists.\n\n"));
       if (opt.useservertimestamps
           && (tmr != (time_t) (-1))
           && ((hstat.len == hstat.contlen) ||
-              ((hstat.res == 0) && (hstat.contlen == -1))))
+              ((hstat.res >= 0) && (hstat.contlen == -1))))
         {
           const char *fl = NULL;
           set_local_file (&fl, hstat.local_file);
-          if (fl)
+          if (fl && !hstat.in_memory)
             {
               time_t newtmr = -1;
               /* Reparse time header, in case it's changed. */
@@ -3388,6 +4877,8 @@ Remote file exists.\n\n"));
             }
           ++numurls;
           total_downloaded_bytes += hstat.rd_size;
+          manifest_note (u, &hstat);
+          dedup_note (&hstat);
 
           /* Remember that we downloaded the file for later ".orig" code. */
           if (*dt & ADDED_HTML_EXTENSION)
@@ -3398,7 +4889,7 @@ Remote file exists.\n\n"));
           ret = RETROK;
           goto exit;
         }
-      else if (hstat.res == 0) /* No read error */
+      else if (hstat.res >= 0) /* No read error */
         {
           if (hstat.contlen == -1)  /* We don't know how much we were supposed
                                        to get, so assume we succeeded. */
@@ -3421,6 +4912,8 @@ Remote file exists.\n\n"));
                 }
               ++numurls;
               total_downloaded_bytes += hstat.rd_size;
+              manifest_note (u, &hstat);
+              dedup_note (&hstat);
 
               /* Remember that we downloaded the file for later ".orig" code. */
               if (*dt & ADDED_HTML_EXTENSION)
@@ -3483,6 +4976,8 @@ Remote file exists.\n\n"));
 exit:
   if (ret == RETROK && local_file)
     *local_file = xstrdup (hstat.local_file);
+  stats_record (u->url, ret, hstat.statcode,
+                hstat.remote_encoding != ENC_NONE);
   free_hstat (&hstat);
 
   return ret;
@@ -3598,6 +5093,33 @@ http_atotm (const char *time_string)
 
   return ret;
 }
+
+/* Return the seconds to wait given by the value of a Retry-After
+   header, which is either a number of seconds or a date, or -1 if it
+   can't be parsed.  */
+
+static double
+parse_retry_after (const char *value)
+{
+  const char *p = value;
+  time_t when;
+
+  while (c_isspace (*p))
+    ++p;
+  if (c_isdigit (*p))
+    {
+      double secs = 0;
+      for (; c_isdigit (*p); p++)
+        secs = secs * 10 + (*p - '0');
+      while (c_isspace (*p))
+        ++p;
+      return *p ? -1 : secs;
+    }
+  when = http_atotm (value);
+  if (when == (time_t) -1)
+    return -1;
+  return when > time (NULL) ? difftime (when, time (NULL)) : 0;
+}
 
 /* Authorization support: We support three authorization schemes:
 
@@ -3655,158 +5177,324 @@ dump_hash (char *buf, const unsigned char *hash)
   *buf = '\0';
 }
 
-/* Take the line apart to find the challenge, and compose a digest
-   authorization header.  See RFC2069 section 2.1.2.  */
-static char *
-digest_authentication_encode (const char *au, const char *user,
-                              const char *passwd, const char *method,
-                              const char *path)
-{
-  static char *realm, *opaque, *nonce, *qop;
-  static struct {
-    const char *name;
-    char **variable;
-  } options[] = {
-    { "realm", &realm },
-    { "opaque", &opaque },
-    { "nonce", &nonce },
-    { "qop", &qop }
-  };
-  char cnonce[16] = "";
-  char *res;
-  size_t res_size;
-  param_token name, value;
+/* A Digest challenge, kept per server so that later requests to the
+   same protection space can be answered without first drawing a 401.
+   NC counts the requests made with NONCE, as RFC 2617 3.2.2 wants.  */
+struct digest_challenge {
+  char *realm;
+  char *nonce;
+  char *opaque;
+  bool qop_auth;                /* server offered qop=auth */
+  bool stale;                   /* the previous nonce merely expired */
+  unsigned long nc;             /* nonce count */
+  char *user;                   /* who answered the challenge */
+};
 
+/* Challenges received so far, keyed by "host:port".  */
+static struct hash_table *digest_challenges;
+
+static void
+digest_challenge_free (struct digest_challenge *dc)
+{
+  xfree_null (dc->realm);
+  xfree_null (dc->nonce);
+  xfree_null (dc->opaque);
+  xfree_null (dc->user);
+  xfree (dc);
+}
 
-  realm = opaque = nonce = qop = NULL;
+/* Take the line apart to find the challenge.  Returns NULL if the
+   challenge lacks a realm or nonce, or asks for an unsupported
+   quality of protection.  */
+static struct digest_challenge *
+digest_parse_challenge (const char *au)
+{
+  struct digest_challenge *dc = xnew0 (struct digest_challenge);
+  char *qop = NULL;
+  param_token name, value;
 
   au += 6;                      /* skip over `Digest' */
   while (extract_param (&au, &name, &value, ','))
     {
-      size_t i;
       size_t namelen = name.e - name.b;
-      for (i = 0; i < countof (options); i++)
-        if (namelen == strlen (options[i].name)
-            && 0 == strncmp (name.b, options[i].name,
-                             namelen))
-          {
-            *options[i].variable = strdupdelim (value.b, value.e);
-            break;
-          }
+      char **variable = NULL;
+      if (namelen == 5 && 0 == strncasecmp (name.b, "realm", 5))
+        variable = &dc->realm;
+      else if (namelen == 5 && 0 == strncasecmp (name.b, "nonce", 5))
+        variable = &dc->nonce;
+      else if (namelen == 6 && 0 == strncasecmp (name.b, "opaque", 6))
+        variable = &dc->opaque;
+      else if (namelen == 3 && 0 == strncasecmp (name.b, "qop", 3))
+        variable = &qop;
+      else if (namelen == 5 && 0 == strncasecmp (name.b, "stale", 5))
+        dc->stale = (value.e - value.b == 4
+                     && 0 == strncasecmp (value.b, "true", 4));
+      if (variable)
+        {
+          xfree_null (*variable);
+          *variable = strdupdelim (value.b, value.e);
+        }
     }
 
-  if (qop != NULL && strcmp(qop,"auth"))
+  if (qop)
     {
-      logprintf (LOG_NOTQUIET, _("Unsupported quality of protection '%s'.\n"), qop);
-      user = NULL; /* force freeing mem and return */
+      /* QOP is a comma-separated list; all we can do is "auth".  */
+      const char *p = qop;
+      while (*p && !dc->qop_auth)
+        {
+          const char *b, *e;
+          while (*p == ',' || c_isspace (*p))
+            ++p;
+          b = p;
+          while (*p && *p != ',' && !c_isspace (*p))
+            ++p;
+          e = p;
+          dc->qop_auth = (e - b == 4 && 0 == strncasecmp (b, "auth", 4));
+        }
+      if (!dc->qop_auth)
+        {
+          logprintf (LOG_NOTQUIET,
+                     _("Unsupported quality of protection '%s'.\n"), qop);
+          xfree (qop);
+          digest_challenge_free (dc);
+          return NULL;
+        }
+      xfree (qop);
     }
 
-  if (!realm || !nonce || !user || !passwd || !path || !method)
+  if (!dc->realm || !dc->nonce)
     {
-      xfree_null (realm);
-      xfree_null (opaque);
-      xfree_null (nonce);
-      xfree_null (qop);
+      digest_challenge_free (dc);
       return NULL;
     }
+  return dc;
+}
 
-  /* Calculate the digest value.  */
-  {
-    struct md5_ctx ctx;
-    unsigned char hash[MD5_DIGEST_SIZE];
-    char a1buf[MD5_DIGEST_SIZE * 2 + 1], a2buf[MD5_DIGEST_SIZE * 2 + 1];
-    char response_digest[MD5_DIGEST_SIZE * 2 + 1];
-
-    /* A1BUF = H(user ":" realm ":" password) */
-    md5_init_ctx (&ctx);
-    md5_process_bytes ((unsigned char *)user, strlen (user), &ctx);
-    md5_process_bytes ((unsigned char *)":", 1, &ctx);
-    md5_process_bytes ((unsigned char *)realm, strlen (realm), &ctx);
-    md5_process_bytes ((unsigned char *)":", 1, &ctx);
-    md5_process_bytes ((unsigned char *)passwd, strlen (passwd), &ctx);
-    md5_finish_ctx (&ctx, hash);
-    dump_hash (a1buf, hash);
-
-    /* A2BUF = H(method ":" path) */
-    md5_init_ctx (&ctx);
-    md5_process_bytes ((unsigned char *)method, strlen (method), &ctx);
-    md5_process_bytes ((unsigned char *)":", 1, &ctx);
-    md5_process_bytes ((unsigned char *)path, strlen (path), &ctx);
-    md5_finish_ctx (&ctx, hash);
-    dump_hash (a2buf, hash);
-
-    if (!strcmp(qop,"auth"))
-      {
-        /* RFC 2617 Digest Access Authentication */
-        /* generate random hex string */
-        snprintf(cnonce, sizeof(cnonce), "%08x", random_number(INT_MAX));
-
-        /* RESPONSE_DIGEST = H(A1BUF ":" nonce ":" noncecount ":" clientnonce ":" qop ": " A2BUF) */
-        md5_init_ctx (&ctx);
-        md5_process_bytes ((unsigned char *)a1buf, MD5_DIGEST_SIZE * 2, &ctx);
-        md5_process_bytes ((unsigned char *)":", 1, &ctx);
-        md5_process_bytes ((unsigned char *)nonce, strlen (nonce), &ctx);
-        md5_process_bytes ((unsigned char *)":", 1, &ctx);
-        md5_process_bytes ((unsigned char *)"00000001", 8, &ctx); /* TODO: keep track of server nonce values */
-        md5_process_bytes ((unsigned char *)":", 1, &ctx);
-        md5_process_bytes ((unsigned char *)cnonce, strlen(cnonce), &ctx);
-        md5_process_bytes ((unsigned char *)":", 1, &ctx);
-        md5_process_bytes ((unsigned char *)qop, strlen(qop), &ctx);
-        md5_process_bytes ((unsigned char *)":", 1, &ctx);
-        md5_process_bytes ((unsigned char *)a2buf, MD5_DIGEST_SIZE * 2, &ctx);
-        md5_finish_ctx (&ctx, hash);
-      }
-    else
-      {
-        /* RFC 2069 Digest Access Authentication */
-        /* RESPONSE_DIGEST = H(A1BUF ":" nonce ":" A2BUF) */
-        md5_init_ctx (&ctx);
-        md5_process_bytes ((unsigned char *)a1buf, MD5_DIGEST_SIZE * 2, &ctx);
-        md5_process_bytes ((unsigned char *)":", 1, &ctx);
-        md5_process_bytes ((unsigned char *)nonce, strlen (nonce), &ctx);
-        md5_process_bytes ((unsigned char *)":", 1, &ctx);
-        md5_process_bytes ((unsigned char *)a2buf, MD5_DIGEST_SIZE * 2, &ctx);
-        md5_finish_ctx (&ctx, hash);
-      }
+/* Compose a digest authorization header answering DC, counting one
+   more use of its nonce.  See RFC 2069 section 2.1.2 and RFC 2617
+   section 3.2.2.  */
+static char *
+digest_response (struct digest_challenge *dc, const char *user,
+                 const char *passwd, const char *method, const char *path)
+{
+  char cnonce[16] = "";
+  char nc[16] = "";
+  char *res;
+  size_t res_size;
+  struct md5_ctx ctx;
+  unsigned char hash[MD5_DIGEST_SIZE];
+  char a1buf[MD5_DIGEST_SIZE * 2 + 1], a2buf[MD5_DIGEST_SIZE * 2 + 1];
+  char response_digest[MD5_DIGEST_SIZE * 2 + 1];
+
+  /* A1BUF = H(user ":" realm ":" password) */
+  md5_init_ctx (&ctx);
+  md5_process_bytes ((unsigned char *)user, strlen (user), &ctx);
+  md5_process_bytes ((unsigned char *)":", 1, &ctx);
+  md5_process_bytes ((unsigned char *)dc->realm, strlen (dc->realm), &ctx);
+  md5_process_bytes ((unsigned char *)":", 1, &ctx);
+  md5_process_bytes ((unsigned char *)passwd, strlen (passwd), &ctx);
+  md5_finish_ctx (&ctx, hash);
+  dump_hash (a1buf, hash);
+
+  /* A2BUF = H(method ":" path) */
+  md5_init_ctx (&ctx);
+  md5_process_bytes ((unsigned char *)method, strlen (method), &ctx);
+  md5_process_bytes ((unsigned char *)":", 1, &ctx);
+  md5_process_bytes ((unsigned char *)path, strlen (path), &ctx);
+  md5_finish_ctx (&ctx, hash);
+  dump_hash (a2buf, hash);
+
+  if (dc->qop_auth)
+    {
+      /* RFC 2617 Digest Access Authentication */
+      /* generate random hex string */
+      snprintf (cnonce, sizeof (cnonce), "%08x", random_number (INT_MAX));
+      snprintf (nc, sizeof (nc), "%08lx", ++dc->nc);
+
+      /* RESPONSE_DIGEST = H(A1BUF ":" nonce ":" noncecount ":" clientnonce ":" qop ": " A2BUF) */
+      md5_init_ctx (&ctx);
+      md5_process_bytes ((unsigned char *)a1buf, MD5_DIGEST_SIZE * 2, &ctx);
+      md5_process_bytes ((unsigned char *)":", 1, &ctx);
+      md5_process_bytes ((unsigned char *)dc->nonce, strlen (dc->nonce), &ctx);
+      md5_process_bytes ((unsigned char *)":", 1, &ctx);
+      md5_process_bytes ((unsigned char *)nc, strlen (nc), &ctx);
+      md5_process_bytes ((unsigned char *)":", 1, &ctx);
+      md5_process_bytes ((unsigned char *)cnonce, strlen (cnonce), &ctx);
+      md5_process_bytes ((unsigned char *)":", 1, &ctx);
+      md5_process_bytes ((unsigned char *)"auth", 4, &ctx);
+      md5_process_bytes ((unsigned char *)":", 1, &ctx);
+      md5_process_bytes ((unsigned char *)a2buf, MD5_DIGEST_SIZE * 2, &ctx);
+      md5_finish_ctx (&ctx, hash);
+    }
+  else
+    {
+      /* RFC 2069 Digest Access Authentication */
+      /* RESPONSE_DIGEST = H(A1BUF ":" nonce ":" A2BUF) */
+      md5_init_ctx (&ctx);
+      md5_process_bytes ((unsigned char *)a1buf, MD5_DIGEST_SIZE * 2, &ctx);
+      md5_process_bytes ((unsigned char *)":", 1, &ctx);
+      md5_process_bytes ((unsigned char *)dc->nonce, strlen (dc->nonce), &ctx);
+      md5_process_bytes ((unsigned char *)":", 1, &ctx);
+      md5_process_bytes ((unsigned char *)a2buf, MD5_DIGEST_SIZE * 2, &ctx);
+      md5_finish_ctx (&ctx, hash);
+    }
 
-    dump_hash (response_digest, hash);
+  dump_hash (response_digest, hash);
 
-    res_size = strlen (user)
-             + strlen (user)
-             + strlen (realm)
-             + strlen (nonce)
-             + strlen (path)
-             + 2 * MD5_DIGEST_SIZE /*strlen (response_digest)*/
-             + (opaque ? strlen (opaque) : 0)
-             + (qop ? 128: 0)
-             + 128;
+  res_size = strlen (user)
+           + strlen (dc->realm)
+           + strlen (dc->nonce)
+           + strlen (path)
+           + 2 * MD5_DIGEST_SIZE /*strlen (response_digest)*/
+           + (dc->opaque ? strlen (dc->opaque) + 16 : 0)
+           + (dc->qop_auth ? 128 : 0)
+           + 128;
 
-    res = xmalloc (res_size);
+  res = xmalloc (res_size);
 
-    if (!strcmp(qop,"auth"))
-      {
-        snprintf (res, res_size, "Digest "\
-                "username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"%s\", response=\"%s\""\
-                ", qop=auth, nc=00000001, cnonce=\"%s\"",
-                  user, realm, nonce, path, response_digest, cnonce);
+  if (dc->qop_auth)
+    snprintf (res, res_size, "Digest "\
+              "username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"%s\", response=\"%s\""\
+              ", qop=auth, nc=%s, cnonce=\"%s\"",
+              user, dc->realm, dc->nonce, path, response_digest, nc, cnonce);
+  else
+    snprintf (res, res_size, "Digest "\
+              "username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"%s\", response=\"%s\"",
+              user, dc->realm, dc->nonce, path, response_digest);
 
-      }
-    else
-      {
-        snprintf (res, res_size, "Digest "\
-                "username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"%s\", response=\"%s\"",
-                  user, realm, nonce, path, response_digest);
-      }
+  if (dc->opaque)
+    {
+      char *p = res + strlen (res);
+      strcat (p, ", opaque=\"");
+      strcat (p, dc->opaque);
+      strcat (p, "\"");
+    }
+  return res;
+}
+
+/* Return the key under which challenges from U's server are kept.  */
+static char *
+digest_key (const struct url *u)
+{
+  return aprintf ("%s:%d", u->host, u->port);
+}
+
+/* Drop the challenge remembered for U's server, if any.  */
+static void
+digest_forget (const struct url *u)
+{
+  char *key, *oldkey;
+  struct digest_challenge *olddc;
+
+  if (!digest_challenges)
+    return;
+  key = digest_key (u);
+  if (hash_table_get_pair (digest_challenges, key, &oldkey, &olddc))
+    {
+      hash_table_remove (digest_challenges, key);
+      xfree (oldkey);
+      digest_challenge_free (olddc);
+    }
+  xfree (key);
+}
+
+/* Answer the challenge AU and, if U is given, remember it so that
+   further requests to the same server can answer it preemptively.  */
+static char *
+digest_authentication_encode (const char *au, const char *user,
+                              const char *passwd, const char *method,
+                              const char *path, const struct url *u)
+{
+  struct digest_challenge *dc;
+  char *res;
+
+  if (!user || !passwd || !path || !method)
+    return NULL;
+  dc = digest_parse_challenge (au);
+  if (!dc)
+    return NULL;
+  if (dc->stale)
+    DEBUGP (("Digest nonce is stale, answering the new one.\n"));
+
+  res = digest_response (dc, user, passwd, method, path);
+  if (!u)
+    {
+      digest_challenge_free (dc);
+      return res;
+    }
+
+  digest_forget (u);
+  if (!digest_challenges)
+    digest_challenges = make_string_hash_table (0);
+  dc->user = xstrdup (user);
+  hash_table_put (digest_challenges, digest_key (u), dc);
+  return res;
+}
+
+/* If U's server has challenged USER before, answer that challenge
+   now, so that the request need not first be refused.  Returns NULL
+   if there is nothing to answer.  */
+static char *
+digest_preemptive (const struct url *u, const char *user,
+                   const char *passwd, const char *method, const char *path)
+{
+  struct digest_challenge *dc;
+  char *key;
+
+  if (!digest_challenges)
+    return NULL;
+  key = digest_key (u);
+  dc = hash_table_get (digest_challenges, key);
+  xfree (key);
+  if (!dc || 0 != strcmp (dc->user, user))
+    return NULL;
+  DEBUGP (("Answering the cached Digest challenge for %s.\n",
+           quote (u->host)));
+  return digest_response (dc, user, passwd, method, path);
+}
+
+/* Pick up the nextnonce the server may send with a successful answer
+   (RFC 2617 3.2.3), which replaces the nonce it gave us earlier.  */
+static void
+digest_next_nonce (const struct url *u, const char *info)
+{
+  struct digest_challenge *dc;
+  param_token name, value;
+  char *key;
+
+  if (!digest_challenges)
+    return;
+  key = digest_key (u);
+  dc = hash_table_get (digest_challenges, key);
+  xfree (key);
+  if (!dc)
+    return;
 
-    if (opaque)
+  while (extract_param (&info, &name, &value, ','))
+    if (name.e - name.b == 9 && 0 == strncasecmp (name.b, "nextnonce", 9))
       {
-        char *p = res + strlen (res);
-        strcat (p, ", opaque=\"");
-        strcat (p, opaque);
-        strcat (p, "\"");
+        xfree (dc->nonce);
+        dc->nonce = strdupdelim (value.b, value.e);
+        dc->nc = 0;
+        break;
       }
-  }
-  return res;
+}
+
+static void
+digest_cleanup (void)
+{
+  hash_table_iterator iter;
+
+  if (!digest_challenges)
+    return;
+  for (hash_table_iterate (digest_challenges, &iter);
+       hash_table_iter_next (&iter); )
+    {
+      xfree (iter.key);
+      digest_challenge_free (iter.value);
+    }
+  hash_table_destroy (digest_challenges);
+  digest_challenges = NULL;
 }
 #endif /* ENABLE_DIGEST */
 
@@ -3843,11 +5531,15 @@ known_authentication_scheme_p (const char *hdrbeg, const char *hdrend)
    `WWW-Authenticate' response header is seen, according to the
    authorization scheme specified in that header (`Basic' and `Digest'
    are supported by the current implementation), produce an
-   appropriate HTTP authorization request header.  */
+   appropriate HTTP authorization request header.  U is the URL that
+   drew the challenge, under which Digest challenges are remembered.
+   SOCK is the connection the challenge was received on, which matters
+   for NTLM.  */
 static char *
 create_authorization_line (const char *au, const char *user,
                            const char *passwd, const char *method,
-                           const char *path, bool *finished)
+                           const char *path, const struct url *u,
+                           int sock, bool *finished)
 {
   /* We are called only with known schemes, so we can dispatch on the
      first letter. */
@@ -3859,16 +5551,21 @@ create_authorization_line (const char *au, const char *user,
 #ifdef ENABLE_DIGEST
     case 'D':                   /* Digest */
       *finished = true;
-      return digest_authentication_encode (au, user, passwd, method, path);
+      return digest_authentication_encode (au, user, passwd, method, path,
+                                           u);
 #endif
 #ifdef ENABLE_NTLM
     case 'N':                   /* NTLM */
-      if (!ntlm_input (&pconn.ntlm, au))
-        {
-          *finished = true;
-          return NULL;
-        }
-      return ntlm_output (&pconn.ntlm, user, passwd, finished);
+      {
+        struct pconn *pc = pconn_find (sock);
+        struct ntlmdata *ntlm = pc ? &pc->ntlm : &pconn_ntlm_fallback;
+        if (!ntlm_input (ntlm, au))
+          {
+            *finished = true;
+            return NULL;
+          }
+        return ntlm_output (ntlm, user, passwd, finished);
+      }
 #endif
     default:
       /* We shouldn't get here -- this function should be only called
@@ -3887,6 +5584,32 @@ load_cookies (void)
       cookie_jar_load (wget_cookie_jar, opt.cookies_input);
       cookies_loaded_p = true;
     }
+  if (opt.journal_cookies && opt.cookies_output)
+    cookie_jar_journal (wget_cookie_jar, opt.cookies_output);
+}
+
+/* Make the following GET requests conditional on V, until called
+   with NULL.  The requests carry V's entity tag and modification date
+   as If-None-Match and If-Modified-Since.  The status code of the
+   response is stored to V->statcode.  If it is 304, http_loop returns
+   RETROK without retrieving anything; if it is 2xx, the validators
+   of the new contents are stored to V.  */
+
+void
+http_set_conditional (struct http_validators *v)
+{
+  conditional = v;
+}
+
+/* Handle a Set-Cookie header received by a parallel worker from
+   HOST:PORT when fetching PATH, as if it had been received here.  */
+
+void
+http_set_cookie (const char *host, int port, const char *path,
+                 const char *set_cookie)
+{
+  load_cookies ();
+  cookie_handle_set_cookie (wget_cookie_jar, host, port, path, set_cookie);
 }
 
 void
@@ -3896,12 +5619,34 @@ save_cookies (void)
     cookie_jar_save (wget_cookie_jar, opt.cookies_output);
 }
 
+/* Close the persistent connections, if any are open.  This is called
+   before forking parallel workers, which must not inherit
+   connections the parent keeps using.  */
+
+void
+http_close_persistent (void)
+{
+  while (pconn_head)
+    invalidate_persistent (pconn_head);
+}
+
+/* Return the number of bytes taken by the cookies.  */
+
+size_t
+http_cookies_memory (void)
+{
+  return wget_cookie_jar ? cookie_jar_memory (wget_cookie_jar) : 0;
+}
+
 void
 http_cleanup (void)
 {
-  xfree_null (pconn.host);
+  http_close_persistent ();
   if (wget_cookie_jar)
     cookie_jar_delete (wget_cookie_jar);
+#ifdef ENABLE_DIGEST
+  digest_cleanup ();
+#endif
 }
 
 void
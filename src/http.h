@@ -35,8 +35,20 @@ struct url;
 
 uerr_t http_loop (struct url *, struct url *, char **, char **, const char *,
                   int *, struct url *, struct iri *);
+void http_set_cookie (const char *, int, const char *, const char *);
+void http_set_pipeline_hint (const char **, const char **, int);
+
+/* Validators for a conditional GET, see http_set_conditional.  */
+struct http_validators {
+  char *etag;                   /* entity tag, or NULL */
+  char *last_modified;          /* Last-Modified date, or NULL */
+  int statcode;                 /* status of the response, 0 if none */
+};
+void http_set_conditional (struct http_validators *);
 void save_cookies (void);
+void http_close_persistent (void);
 void http_cleanup (void);
+size_t http_cookies_memory (void);
 time_t http_atotm (const char *);
 
 typedef struct {
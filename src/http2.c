@@ -0,0 +1,822 @@
+/* HTTP/2 transport.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* When the server chooses HTTP/2 during the TLS handshake,
+   http2_attach stacks this transport on top of the TLS one.  The rest
+   of Wget keeps speaking HTTP/1.1 through it: the requests written to
+   the socket are parsed and submitted as HTTP/2 streams, and each
+   response is read back as an HTTP/1.1 one -- a status line, the
+   header fields and the body, chunked if the server gave no length.
+   gethttp, persistent connections and --pipeline work unchanged, and
+   pipelined requests become streams the server serves concurrently.
+   Their responses are read back in the order of the requests.
+
+   nghttp2 does the framing, header compression and flow control.  The
+   responses not being read yet are buffered, and the window of a
+   stream is no longer extended once H2_BUFFER_MAX bytes of it are
+   waiting, so a stream that isn't read can't make its buffer grow
+   without bound.  */
+
+#include "wget.h"
+
+#ifdef ENABLE_HTTP2
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <nghttp2/nghttp2.h>
+
+#include "utils.h"
+#include "connect.h"
+#include "http2.h"
+
+/* Initial window of each stream and of the whole connection.  */
+#define H2_STREAM_WINDOW (1024 * 1024)
+#define H2_CONNECTION_WINDOW (16 * 1024 * 1024)
+
+/* How much of a response may be buffered before its window stops
+   being extended.  */
+#define H2_BUFFER_MAX (1024 * 1024)
+
+struct h2_buf {
+  char *data;
+  int pos, len, size;           /* data[pos..len) is unread */
+};
+
+struct h2_stream {
+  int32_t id;
+  bool head_only;               /* the request was HEAD */
+  int status;                   /* response status, from :status */
+  struct h2_buf fields;         /* response header fields so far */
+  bool has_length;              /* they include Content-Length */
+  bool head_done;               /* the response head is in OUT */
+  bool chunked;                 /* the body is passed on chunked */
+  bool closed;                  /* the stream is finished */
+  bool failed;                  /* ... and didn't finish normally */
+  int fail_errno;               /* what reading it then reports */
+  struct h2_buf out;            /* the response, as HTTP/1.1 */
+  int unconsumed;               /* bytes received but not acknowledged */
+  char *body;                   /* the request body */
+  size_t body_len, body_pos;
+  struct h2_stream *next;
+};
+
+struct h2_conn {
+  int fd;
+  nghttp2_session *session;
+  struct transport_implementation *lower; /* the TLS transport */
+  void *lower_ctx;
+  char *host;
+  struct h2_buf req;            /* request bytes not submitted yet */
+  struct h2_stream *streams;    /* in the order of the requests; the */
+  struct h2_stream *last;       /*   first one is being read */
+  int unconsumed;               /* connection-level, likewise */
+  bool dead;                    /* the connection failed */
+  const char *error;            /* message for h2_errstr */
+};
+
+static void
+h2_buf_add (struct h2_buf *b, const char *data, int len)
+{
+  if (b->pos == b->len)
+    b->pos = b->len = 0;
+  DO_REALLOC (b->data, b->size, b->len + len, char);
+  memcpy (b->data + b->len, data, len);
+  b->len += len;
+}
+
+static void
+h2_buf_free (struct h2_buf *b)
+{
+  xfree_null (b->data);
+  b->data = NULL;
+  b->pos = b->len = b->size = 0;
+}
+
+/* Mark C as failed with errno ERR (0 for end of file), failing the
+   streams that are still open.  */
+
+static void
+h2_fail (struct h2_conn *c, int err)
+{
+  struct h2_stream *s;
+  c->dead = true;
+  for (s = c->streams; s; s = s->next)
+    if (!s->closed)
+      {
+        s->closed = s->failed = true;
+        s->fail_errno = s->head_done ? err : 0;
+      }
+}
+
+/* Send the frames nghttp2 has queued.  */
+
+static bool
+h2_flush (struct h2_conn *c)
+{
+  int err;
+  if (c->dead)
+    return false;
+  err = nghttp2_session_send (c->session);
+  if (err != 0)
+    {
+      if (!c->error)
+        c->error = nghttp2_strerror (err);
+      h2_fail (c, ECONNRESET);
+      return false;
+    }
+  return true;
+}
+
+/* Extend the windows by what has been received, except for the
+   streams with too much of their response waiting to be read.  */
+
+static void
+h2_consume (struct h2_conn *c)
+{
+  struct h2_stream *s;
+  if (c->unconsumed)
+    {
+      nghttp2_session_consume_connection (c->session, c->unconsumed);
+      c->unconsumed = 0;
+    }
+  for (s = c->streams; s; s = s->next)
+    if (s->unconsumed && !s->closed && s->out.len - s->out.pos <= H2_BUFFER_MAX)
+      {
+        nghttp2_session_consume_stream (c->session, s->id, s->unconsumed);
+        s->unconsumed = 0;
+      }
+}
+
+/* Read from the TLS connection and process what was read.  If TIMEOUT
+   is non-zero, wait no longer than that for it to arrive.  Returns 1
+   if something was read, 0 on timeout and -1 if the connection
+   failed.  */
+
+static int
+h2_receive (struct h2_conn *c, double timeout)
+{
+  char buf[16384];
+  int n;
+  ssize_t used;
+
+  if (c->dead)
+    return -1;
+  if (timeout)
+    {
+      int test = c->lower->poller (c->fd, timeout, WAIT_FOR_READ, c->lower_ctx);
+      if (test == 0)
+        errno = ETIMEDOUT;
+      if (test <= 0)
+        return test;
+    }
+  n = c->lower->reader (c->fd, buf, sizeof buf, c->lower_ctx);
+  if (n <= 0)
+    {
+      DEBUGP (("HTTP/2 connection on socket %d %s.\n", c->fd,
+               n == 0 ? "closed" : "failed"));
+      h2_fail (c, n == 0 ? 0 : errno);
+      return -1;
+    }
+  used = nghttp2_session_mem_recv (c->session, (uint8_t *) buf, n);
+  if (used < 0)
+    {
+      c->error = nghttp2_strerror (used);
+      h2_fail (c, ECONNRESET);
+      return -1;
+    }
+  h2_consume (c);
+  return h2_flush (c) ? 1 : -1;
+}
+
+static const char *
+status_phrase (int status)
+{
+  switch (status)
+    {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 307: return "Temporary Redirect";
+    case 308: return "Permanent Redirect";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 410: return "Gone";
+    case 416: return "Requested Range Not Satisfiable";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default:  return "";
+    }
+}
+
+/* nghttp2 callbacks.  */
+
+static ssize_t
+send_callback (nghttp2_session *session, const uint8_t *data, size_t length,
+               int flags, void *user_data)
+{
+  struct h2_conn *c = user_data;
+  int res = c->lower->writer (c->fd, (char *) data, length, c->lower_ctx);
+  if (res <= 0)
+    return NGHTTP2_ERR_CALLBACK_FAILURE;
+  return res;
+}
+
+static int
+on_header_callback (nghttp2_session *session, const nghttp2_frame *frame,
+                    const uint8_t *name, size_t namelen,
+                    const uint8_t *value, size_t valuelen,
+                    uint8_t flags, void *user_data)
+{
+  struct h2_stream *s;
+
+  if (frame->hd.type != NGHTTP2_HEADERS)
+    return 0;
+  s = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+  /* Trailer fields are dropped.  */
+  if (!s || s->head_done)
+    return 0;
+  /* nghttp2 has checked the fields, and NUL-terminates them.  */
+  if (namelen == 7 && !memcmp (name, ":status", 7))
+    s->status = atoi ((const char *) value);
+  else if (*name != ':')
+    {
+      h2_buf_add (&s->fields, (const char *) name, namelen);
+      h2_buf_add (&s->fields, ": ", 2);
+      h2_buf_add (&s->fields, (const char *) value, valuelen);
+      h2_buf_add (&s->fields, "\r\n", 2);
+      if (namelen == 14 && !memcmp (name, "content-length", 14))
+        s->has_length = true;
+    }
+  return 0;
+}
+
+/* Put the HTTP/1.1 response head of S in its output.  */
+
+static void
+finish_head (struct h2_stream *s)
+{
+  char line[64];
+  int len = snprintf (line, sizeof line, "HTTP/1.1 %d %s\r\n",
+                      s->status, status_phrase (s->status));
+  h2_buf_add (&s->out, line, len);
+  if (s->fields.len)
+    h2_buf_add (&s->out, s->fields.data, s->fields.len);
+  s->chunked = (!s->has_length && !s->head_only
+                && s->status != 204 && s->status != 304);
+  if (s->chunked)
+    h2_buf_add (&s->out, "Transfer-Encoding: chunked\r\n", 28);
+  h2_buf_add (&s->out, "\r\n", 2);
+  h2_buf_free (&s->fields);
+  s->head_done = true;
+}
+
+static int
+on_frame_recv_callback (nghttp2_session *session, const nghttp2_frame *frame,
+                        void *user_data)
+{
+  struct h2_stream *s;
+
+  if (frame->hd.type == NGHTTP2_GOAWAY)
+    DEBUGP (("HTTP/2 server is going away, last stream %d.\n",
+             (int) frame->goaway.last_stream_id));
+  if (frame->hd.type != NGHTTP2_HEADERS
+      || !(frame->hd.flags & NGHTTP2_FLAG_END_HEADERS))
+    return 0;
+  s = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+  if (!s || s->head_done)
+    return 0;
+  if (s->status >= 100 && s->status < 200)
+    {
+      /* Interim responses are of no interest.  */
+      h2_buf_free (&s->fields);
+      s->has_length = false;
+      s->status = 0;
+      return 0;
+    }
+  finish_head (s);
+  return 0;
+}
+
+static int
+on_data_chunk_recv_callback (nghttp2_session *session, uint8_t flags,
+                             int32_t stream_id, const uint8_t *data,
+                             size_t len, void *user_data)
+{
+  struct h2_conn *c = user_data;
+  struct h2_stream *s = nghttp2_session_get_stream_user_data (session,
+                                                              stream_id);
+  c->unconsumed += len;
+  if (!s || !len)
+    return 0;
+  if (s->chunked)
+    {
+      char size[16];
+      int n = snprintf (size, sizeof size, "%x\r\n", (unsigned int) len);
+      h2_buf_add (&s->out, size, n);
+      h2_buf_add (&s->out, (const char *) data, len);
+      h2_buf_add (&s->out, "\r\n", 2);
+    }
+  else
+    h2_buf_add (&s->out, (const char *) data, len);
+  s->unconsumed += len;
+  return 0;
+}
+
+static int
+on_stream_close_callback (nghttp2_session *session, int32_t stream_id,
+                          uint32_t error_code, void *user_data)
+{
+  struct h2_conn *c = user_data;
+  struct h2_stream *s = nghttp2_session_get_stream_user_data (session,
+                                                              stream_id);
+  if (!s)
+    return 0;
+  s->closed = true;
+  if (error_code == NGHTTP2_NO_ERROR && s->head_done)
+    {
+      if (s->chunked)
+        h2_buf_add (&s->out, "0\r\n\r\n", 5);
+      return 0;
+    }
+  DEBUGP (("HTTP/2 stream %d closed: %s.\n", (int) stream_id,
+           nghttp2_http2_strerror (error_code)));
+  s->failed = true;
+  /* A stream refused or reset before it got a response reads like a
+     persistent connection the server has closed, so the request is
+     simply retried; one reset in the middle of the body is an
+     error.  */
+  if (!s->head_done || error_code == NGHTTP2_REFUSED_STREAM)
+    s->fail_errno = 0;
+  else
+    {
+      s->fail_errno = ECONNRESET;
+      c->error = _("Stream reset by the server");
+    }
+  return 0;
+}
+
+static ssize_t
+read_body_callback (nghttp2_session *session, int32_t stream_id,
+                    uint8_t *buf, size_t length, uint32_t *data_flags,
+                    nghttp2_data_source *source, void *user_data)
+{
+  struct h2_stream *s = source->ptr;
+  size_t n = s->body_len - s->body_pos;
+  if (n > length)
+    n = length;
+  memcpy (buf, s->body + s->body_pos, n);
+  s->body_pos += n;
+  if (s->body_pos == s->body_len)
+    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+  return n;
+}
+
+/* Submitting requests.  */
+
+/* Return the end of the request head at the start of C->req, just
+   past its empty line, or NULL if it isn't all there yet.  */
+
+static char *
+request_head_end (struct h2_conn *c)
+{
+  char *p = c->req.data + c->req.pos, *end = c->req.data + c->req.len;
+  for (; end - p >= 4; p++)
+    if (p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n')
+      return p + 4;
+  return NULL;
+}
+
+#define SET_NV(nv, n, nlen, v, vlen) do {       \
+  (nv).name = (uint8_t *) (n);                  \
+  (nv).namelen = (nlen);                        \
+  (nv).value = (uint8_t *) (v);                 \
+  (nv).valuelen = (vlen);                       \
+  (nv).flags = NGHTTP2_NV_FLAG_NONE;            \
+} while (0)
+
+/* Submit the HTTP/1.1 request at the start of C->req as a stream, if
+   all of it, body included, has been written.  Returns 1 if it was
+   submitted, 0 if more of it is needed and -1 on error.  */
+
+static int
+h2_submit (struct h2_conn *c)
+{
+  char *beg = c->req.data + c->req.pos;
+  char *head_end = request_head_end (c);
+  char *line, *eol, *method_end, *path, *path_end, *p;
+  const char *authority = c->host;
+  size_t authority_len = strlen (c->host);
+  wgint body_len = 0;
+  nghttp2_nv *nva;
+  int nvlen = 4, lines = 0;
+  nghttp2_data_provider provider;
+  struct h2_stream *s;
+  int32_t id;
+
+  if (!head_end)
+    return 0;
+  for (p = beg; p < head_end; p++)
+    if (*p == '\n')
+      ++lines;
+
+  /* The request line gives :method and :path.  */
+  eol = memchr (beg, '\r', head_end - beg);
+  method_end = memchr (beg, ' ', eol - beg);
+  path = method_end ? method_end + 1 : NULL;
+  path_end = path ? memchr (path, ' ', eol - path) : NULL;
+  if (!path_end)
+    return -1;
+
+  /* The header fields are passed on with lower-case names, except for
+     Host, which becomes :authority, and the ones describing the
+     HTTP/1.1 connection.  */
+  nva = xnew_array (nghttp2_nv, lines + 4);
+  for (line = eol + 2; line < head_end - 2; line = eol + 2)
+    {
+      char *colon, *value, *vend;
+      size_t namelen;
+
+      eol = memchr (line, '\r', head_end - line);
+      colon = memchr (line, ':', eol - line);
+      if (!colon)
+        continue;
+      for (p = line; p < colon; p++)
+        *p = c_tolower (*p);
+      for (value = colon + 1; value < eol && c_isspace (*value); value++)
+        ;
+      for (vend = eol; vend > value && c_isspace (vend[-1]); vend--)
+        ;
+      namelen = colon - line;
+#define NAME_IS(s) (namelen == sizeof (s) - 1 && !memcmp (line, s, namelen))
+      if (NAME_IS ("host"))
+        {
+          authority = value;
+          authority_len = vend - value;
+          continue;
+        }
+      if (NAME_IS ("connection") || NAME_IS ("keep-alive")
+          || NAME_IS ("proxy-connection") || NAME_IS ("transfer-encoding")
+          || NAME_IS ("upgrade") || NAME_IS ("te"))
+        continue;
+      if (NAME_IS ("content-length"))
+        body_len = str_to_wgint (value, NULL, 10);
+#undef NAME_IS
+      SET_NV (nva[nvlen], line, namelen, value, vend - value);
+      ++nvlen;
+    }
+
+  if (body_len < 0 || body_len > c->req.len - c->req.pos - (head_end - beg))
+    {
+      /* Wait for the rest of the body.  */
+      xfree (nva);
+      return body_len < 0 ? -1 : 0;
+    }
+
+  SET_NV (nva[0], ":method", 7, beg, method_end - beg);
+  SET_NV (nva[1], ":scheme", 7, "https", 5);
+  SET_NV (nva[2], ":authority", 10, authority, authority_len);
+  SET_NV (nva[3], ":path", 5, path, path_end - path);
+
+  s = xnew0 (struct h2_stream);
+  s->head_only = (method_end - beg == 4 && !memcmp (beg, "HEAD", 4));
+  if (body_len)
+    {
+      s->body = xmalloc (body_len);
+      memcpy (s->body, head_end, body_len);
+      s->body_len = body_len;
+      provider.source.ptr = s;
+      provider.read_callback = read_body_callback;
+    }
+  id = nghttp2_submit_request (c->session, NULL, nva, nvlen,
+                               body_len ? &provider : NULL, s);
+  xfree (nva);
+  c->req.pos += (head_end - beg) + body_len;
+  if (id < 0)
+    {
+      c->error = nghttp2_strerror (id);
+      xfree_null (s->body);
+      xfree (s);
+      return -1;
+    }
+  s->id = id;
+  if (c->last)
+    c->last->next = s;
+  else
+    c->streams = s;
+  c->last = s;
+  DEBUGP (("Submitted %.*s %.*s as HTTP/2 stream %d.\n",
+           (int) (method_end - beg), beg, (int) (path_end - path), path,
+           (int) id));
+  return 1;
+}
+
+static void
+free_stream (struct h2_stream *s)
+{
+  h2_buf_free (&s->fields);
+  h2_buf_free (&s->out);
+  xfree_null (s->body);
+  xfree (s);
+}
+
+/* Wait until the response being read has something to offer, or is
+   over.  TIMEOUT is as for h2_receive.  Returns 1 when it does, 0 on
+   timeout and -1 on error.  */
+
+static int
+h2_wait (struct h2_conn *c, double timeout)
+{
+  while (1)
+    {
+      struct h2_stream *s = c->streams;
+      /* Once a response has been read, go on to the next one.  */
+      if (s && s->closed && !s->failed && s->out.pos == s->out.len && s->next)
+        {
+          c->streams = s->next;
+          free_stream (s);
+          continue;
+        }
+      if (!s || s->out.pos < s->out.len || s->closed || c->dead)
+        return 1;
+      if (h2_receive (c, timeout) == 0)
+        return 0;
+    }
+}
+
+/* The transport.  */
+
+static int
+h2_read (int fd, char *buf, int bufsize, void *arg)
+{
+  struct h2_conn *c = arg;
+  struct h2_stream *s;
+  int n;
+
+  if (h2_wait (c, 0) <= 0)
+    return -1;
+  s = c->streams;
+  if (!s || s->out.pos == s->out.len)
+    {
+      if (s && s->failed && s->fail_errno)
+        {
+          errno = s->fail_errno;
+          return -1;
+        }
+      return 0;
+    }
+  n = s->out.len - s->out.pos;
+  if (n > bufsize)
+    n = bufsize;
+  memcpy (buf, s->out.data + s->out.pos, n);
+  s->out.pos += n;
+  if (s->unconsumed)
+    {
+      h2_consume (c);
+      h2_flush (c);
+    }
+  return n;
+}
+
+static int
+h2_write (int fd, char *buf, int bufsize, void *arg)
+{
+  struct h2_conn *c = arg;
+  int res;
+
+  if (c->dead)
+    {
+      errno = EPIPE;
+      return -1;
+    }
+  h2_buf_add (&c->req, buf, bufsize);
+  while ((res = h2_submit (c)) > 0)
+    ;
+  if (res < 0 || !h2_flush (c))
+    {
+      errno = EPIPE;
+      return -1;
+    }
+  return bufsize;
+}
+
+static int
+h2_poll (int fd, double timeout, int wait_for, void *arg)
+{
+  struct h2_conn *c = arg;
+  if (!(wait_for & WAIT_FOR_READ))
+    return 1;
+  return h2_wait (c, timeout);
+}
+
+static int
+h2_peek (int fd, char *buf, int bufsize, void *arg)
+{
+  struct h2_conn *c = arg;
+  struct h2_stream *s;
+  int n;
+
+  if (h2_wait (c, 0) <= 0)
+    return -1;
+  s = c->streams;
+  if (!s)
+    return 0;
+  n = s->out.len - s->out.pos;
+  if (n > bufsize)
+    n = bufsize;
+  if (n)
+    memcpy (buf, s->out.data + s->out.pos, n);
+  return n;
+}
+
+static int
+h2_pending (int fd, void *arg)
+{
+  struct h2_conn *c = arg;
+  return c->streams && c->streams->out.pos < c->streams->out.len;
+}
+
+static const char *
+h2_errstr (int fd, void *arg)
+{
+  struct h2_conn *c = arg;
+  if (c->error)
+    return c->error;
+  if (c->lower->errstr)
+    return c->lower->errstr (fd, c->lower_ctx);
+  return NULL;
+}
+
+static void
+h2_close (int fd, void *arg)
+{
+  struct h2_conn *c = arg;
+  struct h2_stream *s;
+
+  if (!c->dead)
+    {
+      nghttp2_session_terminate_session (c->session, NGHTTP2_NO_ERROR);
+      h2_flush (c);
+    }
+  nghttp2_session_del (c->session);
+  while ((s = c->streams) != NULL)
+    {
+      c->streams = s->next;
+      free_stream (s);
+    }
+  h2_buf_free (&c->req);
+  if (c->lower->closer)
+    c->lower->closer (fd, c->lower_ctx);
+  else
+    close (fd);
+  DEBUGP (("Closed HTTP/2 connection on socket %d.\n", fd));
+  xfree (c->host);
+  xfree (c);
+}
+
+static struct transport_implementation h2_transport =
+{
+  h2_read, h2_write, h2_poll,
+  h2_peek, h2_errstr, h2_close, h2_pending
+};
+
+/* Start speaking HTTP/2 on FD, a TLS connection to HOST whose server
+   chose it during the handshake.  */
+
+bool
+http2_attach (int fd, const char *host)
+{
+  nghttp2_settings_entry settings[] = {
+    { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+    { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, H2_STREAM_WINDOW },
+  };
+  nghttp2_session_callbacks *callbacks;
+  nghttp2_option *option;
+  struct h2_conn *c;
+  void *lower_ctx;
+  struct transport_implementation *lower = fd_transport (fd, &lower_ctx);
+  int err;
+
+  if (!lower)
+    return false;
+  if (nghttp2_session_callbacks_new (&callbacks) != 0)
+    return false;
+  nghttp2_session_callbacks_set_send_callback (callbacks, send_callback);
+  nghttp2_session_callbacks_set_on_header_callback (callbacks,
+                                                    on_header_callback);
+  nghttp2_session_callbacks_set_on_frame_recv_callback
+    (callbacks, on_frame_recv_callback);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback
+    (callbacks, on_data_chunk_recv_callback);
+  nghttp2_session_callbacks_set_on_stream_close_callback
+    (callbacks, on_stream_close_callback);
+  if (nghttp2_option_new (&option) != 0)
+    {
+      nghttp2_session_callbacks_del (callbacks);
+      return false;
+    }
+  /* The windows are extended by h2_consume.  */
+  nghttp2_option_set_no_auto_window_update (option, 1);
+
+  c = xnew0 (struct h2_conn);
+  err = nghttp2_session_client_new2 (&c->session, callbacks, c, option);
+  nghttp2_option_del (option);
+  nghttp2_session_callbacks_del (callbacks);
+  if (err != 0)
+    {
+      xfree (c);
+      return false;
+    }
+  nghttp2_submit_settings (c->session, NGHTTP2_FLAG_NONE,
+                           settings, countof (settings));
+  nghttp2_session_set_local_window_size (c->session, NGHTTP2_FLAG_NONE, 0,
+                                         H2_CONNECTION_WINDOW);
+  c->fd = fd;
+  c->lower = lower;
+  c->lower_ctx = lower_ctx;
+  c->host = xstrdup (host);
+  fd_register_transport (fd, &h2_transport, c);
+
+  DEBUGP (("Speaking HTTP/2 with %s on socket %d.\n", host, fd));
+  /* Send the connection preface right away.  */
+  return h2_flush (c);
+}
+
+/* Return true if FD is an HTTP/2 connection.  */
+
+bool
+http2_p (int fd)
+{
+  void *ctx;
+  return fd_transport (fd, &ctx) == &h2_transport;
+}
+
+/* Return true if the HTTP/2 connection on FD can take another request.
+   Unlike with HTTP/1.1, the server may send frames between responses,
+   so the socket being readable doesn't mean it has been closed; what
+   it has sent is processed here instead.  */
+
+bool
+http2_open_p (int fd)
+{
+  void *arg;
+  struct h2_conn *c;
+  struct h2_stream *s;
+
+  if (fd_transport (fd, &arg) != &h2_transport)
+    return false;
+  c = arg;
+  while (!c->dead
+         && ((c->lower->pending && c->lower->pending (fd, c->lower_ctx))
+             || select_fd (fd, 0, WAIT_FOR_READ) > 0))
+    h2_receive (c, 0);
+  if (c->dead || nghttp2_session_check_request_allowed (c->session) == 0)
+    return false;
+  /* Like test_socket_open, don't reuse a connection with an unread or
+     unfinished response.  */
+  for (s = c->streams; s; s = s->next)
+    if (!s->closed || s->failed || s->out.pos < s->out.len)
+      return false;
+  return true;
+}
+
+#endif /* ENABLE_HTTP2 */
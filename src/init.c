@@ -68,6 +68,14 @@ as that of the covered work.  */
 #include "http.h"               /* for http_cleanup */
 #include "retr.h"               /* for output_stream */
 #include "warc.h"               /* for warc_close */
+#include "intern.h"             /* for intern_cleanup */
+#include "ftp.h"                /* for ftp_cleanup */
+#include "manifest.h"           /* for manifest_cleanup */
+#include "dedup.h"              /* for dedup_cleanup */
+#include "shard.h"              /* for shard_cleanup */
+#ifdef HAVE_SSL
+# include "ssl.h"               /* for ssl_session_cleanup */
+#endif
 
 #ifdef TESTING
 #include "test.h"
@@ -92,9 +100,14 @@ CMD_DECLARE (cmd_directory);
 CMD_DECLARE (cmd_time);
 CMD_DECLARE (cmd_vector);
 
+#ifdef HAVE_LIBZ
+CMD_DECLARE (cmd_spec_compression);
+#endif
 CMD_DECLARE (cmd_spec_dirstruct);
+CMD_DECLARE (cmd_spec_fsync);
 CMD_DECLARE (cmd_spec_header);
 CMD_DECLARE (cmd_spec_warc_header);
+CMD_DECLARE (cmd_spec_warc_compression);
 CMD_DECLARE (cmd_spec_htmlify);
 CMD_DECLARE (cmd_spec_mirror);
 CMD_DECLARE (cmd_spec_prefer_family);
@@ -106,9 +119,11 @@ CMD_DECLARE (cmd_spec_report_speed);
 #ifdef HAVE_SSL
 CMD_DECLARE (cmd_spec_secure_protocol);
 #endif
+CMD_DECLARE (cmd_spec_shard);
 CMD_DECLARE (cmd_spec_timeout);
 CMD_DECLARE (cmd_spec_useragent);
 CMD_DECLARE (cmd_spec_verbose);
+CMD_DECLARE (cmd_spec_visited_set);
 
 /* List of recognized commands, each consisting of name, place and
    function.  When adding a new command, simply add it to the list,
@@ -136,6 +151,7 @@ static const struct {
   { "backups",          &opt.backups,           cmd_number },
   { "base",             &opt.base_href,         cmd_string },
   { "bindaddress",      &opt.bind_address,      cmd_string },
+  { "brokenlinks",      &opt.broken_links_file, cmd_file },
 #ifdef HAVE_SSL
   { "cacertificate",    &opt.ca_cert,           cmd_file },
 #endif
@@ -147,21 +163,32 @@ static const struct {
   { "checkcertificate", &opt.check_cert,        cmd_boolean },
 #endif
   { "chooseconfig",     &opt.choose_config,	cmd_file },
+#ifdef HAVE_LIBZ
+  { "compression",      &opt.compression,       cmd_spec_compression },
+#endif
   { "connecttimeout",   &opt.connect_timeout,   cmd_time },
   { "contentdisposition", &opt.content_disposition, cmd_boolean },
   { "contentonerror",   &opt.content_on_error,  cmd_boolean },
   { "continue",         &opt.always_rest,       cmd_boolean },
+  { "convertjobs",      &opt.convert_jobs,      cmd_number },
   { "convertlinks",     &opt.convert_links,     cmd_boolean },
   { "cookies",          &opt.cookies,           cmd_boolean },
   { "cutdirs",          &opt.cut_dirs,          cmd_number },
+  { "daemon",           &opt.daemon_socket,     cmd_file },
 #ifdef ENABLE_DEBUG
   { "debug",            &opt.debug,             cmd_boolean },
 #endif
+  { "dedupfiles",       &opt.dedup_files,       cmd_boolean },
   { "defaultpage", 	&opt.default_page,      cmd_string},
   { "deleteafter",      &opt.delete_after,      cmd_boolean },
+#ifdef HAVE_LIBURING
+  { "directio",         &opt.direct_io,         cmd_boolean },
+#endif
   { "dirprefix",        &opt.dir_prefix,        cmd_directory },
   { "dirstruct",        NULL,                   cmd_spec_dirstruct },
   { "dnscache",         &opt.dns_cache,         cmd_boolean },
+  { "dnscachefile",     &opt.dns_cache_file,    cmd_file },
+  { "dnscachettl",      &opt.dns_cache_ttl,     cmd_time },
   { "dnstimeout",       &opt.dns_timeout,       cmd_time },
   { "domains",          &opt.domains,           cmd_vector },
   { "dotbytes",         &opt.dot_bytes,         cmd_bytes },
@@ -176,6 +203,10 @@ static const struct {
   { "followftp",        &opt.follow_ftp,        cmd_boolean },
   { "followtags",       &opt.follow_tags,       cmd_vector },
   { "forcehtml",        &opt.force_html,        cmd_boolean },
+  { "fsync",            NULL,                   cmd_spec_fsync },
+  { "ftpconnections",   &opt.ftp_connections,   cmd_number },
+  { "ftplistingcache",  &opt.ftp_listing_cache, cmd_boolean },
+  { "ftpmlsd",          &opt.ftp_mlsd,          cmd_boolean },
   { "ftppasswd",        &opt.ftp_passwd,        cmd_string }, /* deprecated */
   { "ftppassword",      &opt.ftp_passwd,        cmd_string },
   { "ftpproxy",         &opt.ftp_proxy,         cmd_string },
@@ -185,14 +216,22 @@ static const struct {
   { "ftpuser",          &opt.ftp_user,          cmd_string },
   { "glob",             &opt.ftp_glob,          cmd_boolean },
   { "header",           NULL,                   cmd_spec_header },
+  { "hostconnections",  &opt.host_connections,  cmd_number },
   { "htmlextension",    &opt.adjust_extension,  cmd_boolean }, /* deprecated */
   { "htmlify",          NULL,                   cmd_spec_htmlify },
+#ifdef ENABLE_HTTP2
+  { "http2",            &opt.http2,             cmd_boolean },
+#endif
   { "httpkeepalive",    &opt.http_keep_alive,   cmd_boolean },
+  { "httpkeepalivemax", &opt.http_keep_alive_max, cmd_number },
+  { "httpkeepaliveperhost", &opt.http_keep_alive_per_host, cmd_number },
+  { "httpkeepalivetimeout", &opt.http_keep_alive_timeout, cmd_time },
   { "httppasswd",       &opt.http_passwd,       cmd_string }, /* deprecated */
   { "httppassword",     &opt.http_passwd,       cmd_string },
   { "httpproxy",        &opt.http_proxy,        cmd_string },
   { "httpsproxy",       &opt.https_proxy,       cmd_string },
   { "httpuser",         &opt.http_user,         cmd_string },
+  { "ifmodifiedsince",  &opt.if_modified_since, cmd_boolean },
   { "ignorecase",       &opt.ignore_case,       cmd_boolean },
   { "ignorelength",     &opt.ignore_length,     cmd_boolean },
   { "ignoretags",       &opt.ignore_tags,       cmd_vector },
@@ -202,14 +241,26 @@ static const struct {
   { "inet6only",        &opt.ipv6_only,         cmd_boolean },
 #endif
   { "input",            &opt.input_filename,    cmd_file },
+#ifdef HAVE_LIBURING
+  { "iouring",          &opt.io_uring,          cmd_boolean },
+#endif
   { "iri",              &opt.enable_iri,        cmd_boolean },
+  { "journalcookies",   &opt.journal_cookies,   cmd_boolean },
   { "keepsessioncookies", &opt.keep_session_cookies, cmd_boolean },
+#ifdef HAVE_SSL
+  { "ktls",             &opt.ktls,              cmd_boolean },
+#endif
   { "limitrate",        &opt.limit_rate,        cmd_bytes },
+  { "limitrateperhost", &opt.limit_rate_host,   cmd_bytes },
   { "loadcookies",      &opt.cookies_input,     cmd_file },
   { "localencoding",    &opt.locale,            cmd_string },
   { "logfile",          &opt.lfilename,         cmd_file },
   { "login",            &opt.ftp_user,          cmd_string },/* deprecated*/
+  { "manifest",         &opt.manifest,          cmd_boolean },
+  { "maxmemory",        &opt.max_memory,        cmd_bytes },
   { "maxredirect",      &opt.max_redirect,      cmd_number },
+  { "metricsfile",      &opt.metrics_file,      cmd_file },
+  { "minrate",          &opt.min_rate,          cmd_bytes },
   { "mirror",           NULL,                   cmd_spec_mirror },
   { "netrc",            &opt.netrc,             cmd_boolean },
   { "noclobber",        &opt.noclobber,         cmd_boolean },
@@ -218,9 +269,12 @@ static const struct {
   { "numtries",         &opt.ntry,              cmd_number_inf },/* deprecated*/
   { "outputdocument",   &opt.output_document,   cmd_file },
   { "pagerequisites",   &opt.page_requisites,   cmd_boolean },
+  { "parallel",         &opt.parallel,          cmd_number },
   { "passiveftp",       &opt.ftp_pasv,          cmd_boolean },
   { "passwd",           &opt.ftp_passwd,        cmd_string },/* deprecated*/
   { "password",         &opt.passwd,            cmd_string },
+  { "phasetiming",      &opt.phase_timing,      cmd_boolean },
+  { "pipeline",         &opt.pipeline,          cmd_number },
   { "postdata",         &opt.post_data,         cmd_string },
   { "postfile",         &opt.post_file_name,    cmd_file },
   { "preferfamily",     NULL,                   cmd_spec_prefer_family },
@@ -234,6 +288,7 @@ static const struct {
   { "proxypasswd",      &opt.proxy_passwd,      cmd_string }, /* deprecated */
   { "proxypassword",    &opt.proxy_passwd,      cmd_string },
   { "proxyuser",        &opt.proxy_user,        cmd_string },
+  { "queuememory",      &opt.queue_memory,      cmd_bytes },
   { "quiet",            &opt.quiet,             cmd_boolean },
   { "quota",            &opt.quota,             cmd_bytes_sum },
 #ifdef HAVE_SSL
@@ -242,6 +297,7 @@ static const struct {
   { "randomwait",       &opt.random_wait,       cmd_boolean },
   { "readtimeout",      &opt.read_timeout,      cmd_time },
   { "reclevel",         &opt.reclevel,          cmd_number_inf },
+  { "recvbuffer",       &opt.recv_buffer,       cmd_bytes },
   { "recursive",        NULL,                   cmd_spec_recursive },
   { "referer",          &opt.referer,           cmd_string },
   { "regextype",        &opt.regex_type,        cmd_spec_regex_type },
@@ -255,18 +311,31 @@ static const struct {
   { "retrsymlinks",     &opt.retr_symlinks,     cmd_boolean },
   { "retryconnrefused", &opt.retry_connrefused, cmd_boolean },
   { "robots",           &opt.use_robots,        cmd_boolean },
+  { "robotscachefile",  &opt.robots_cache_file, cmd_file },
+  { "robotscachettl",   &opt.robots_cache_ttl,  cmd_time },
   { "savecookies",      &opt.cookies_output,    cmd_file },
   { "saveheaders",      &opt.save_headers,      cmd_boolean },
 #ifdef HAVE_SSL
   { "secureprotocol",   &opt.secure_protocol,   cmd_spec_secure_protocol },
 #endif
+  { "segments",         &opt.segments,          cmd_number },
   { "serverresponse",   &opt.server_response,   cmd_boolean },
+  { "shard",            NULL,                   cmd_spec_shard },
+  { "shardspool",       &opt.shard_spool,       cmd_directory },
   { "showalldnsentries", &opt.show_all_dns_entries, cmd_boolean },
   { "spanhosts",        &opt.spanhost,          cmd_boolean },
   { "spider",           &opt.spider,            cmd_boolean },
+  { "statefile",        &opt.state_file,        cmd_file },
+  { "stateinterval",    &opt.state_interval,    cmd_time },
+  { "statsfile",        &opt.stats_file,        cmd_file },
   { "strictcomments",   &opt.strict_comments,   cmd_boolean },
+  { "tcpfastopen",      &opt.tcp_fastopen,      cmd_boolean },
+  { "tcpnodelay",       &opt.tcp_nodelay,       cmd_boolean },
   { "timeout",          NULL,                   cmd_spec_timeout },
   { "timestamping",     &opt.timestamping,      cmd_boolean },
+#ifdef HAVE_SSL
+  { "tlssessionfile",   &opt.tls_session_file,  cmd_file },
+#endif
   { "tries",            &opt.ntry,              cmd_number_inf },
   { "trustservernames", &opt.trustservernames,  cmd_boolean },
   { "unlink",           &opt.unlink,            cmd_boolean },
@@ -275,12 +344,16 @@ static const struct {
   { "useragent",        NULL,                   cmd_spec_useragent },
   { "useservertimestamps", &opt.useservertimestamps, cmd_boolean },
   { "verbose",          NULL,                   cmd_spec_verbose },
+  { "visitedset",       NULL,                   cmd_spec_visited_set },
   { "wait",             &opt.wait,              cmd_time },
   { "waitretry",        &opt.waitretry,         cmd_time },
   { "warccdx",          &opt.warc_cdx_enabled,  cmd_boolean },
   { "warccdxdedup",     &opt.warc_cdx_dedup_filename,  cmd_file },
+  { "warccdxdedupindex", &opt.warc_cdx_dedup_index, cmd_file },
 #ifdef HAVE_LIBZ
-  { "warccompression",  &opt.warc_compression_enabled, cmd_boolean },
+  { "warccompression",  NULL,                   cmd_spec_warc_compression },
+  { "warccompressionlevel", &opt.warc_compression_level, cmd_number },
+  { "warccompressionthreads", &opt.warc_compression_threads, cmd_number },
 #endif
   { "warcdigests",      &opt.warc_digests_enabled, cmd_boolean },
   { "warcfile",         &opt.warc_filename,     cmd_file },
@@ -288,6 +361,9 @@ static const struct {
   { "warckeeplog",      &opt.warc_keep_log,     cmd_boolean },
   { "warcmaxsize",      &opt.warc_maxsize,      cmd_bytes },
   { "warctempdir",      &opt.warc_tempdir,      cmd_directory },
+#ifdef HAVE_LIBZSTD
+  { "warczstddictionary", &opt.warc_zstd_dictionary, cmd_file },
+#endif
 #ifdef USE_WATT32
   { "wdebug",           &opt.wdebug,            cmd_boolean },
 #endif
@@ -338,7 +414,12 @@ defaults (void)
   opt.netrc = true;
   opt.ftp_glob = true;
   opt.htmlify = true;
+  opt.if_modified_since = true;
+  opt.fsync = fsync_never;
   opt.http_keep_alive = true;
+  opt.http_keep_alive_max = 8;
+  opt.http_keep_alive_per_host = 2;
+  opt.http_keep_alive_timeout = 30;
   opt.use_proxy = true;
   tmp = getenv ("no_proxy");
   if (tmp)
@@ -348,6 +429,7 @@ defaults (void)
 
   opt.read_timeout = 900;
   opt.use_robots = true;
+  opt.robots_cache_ttl = 86400;
 
   opt.remove_listing = true;
 
@@ -356,7 +438,10 @@ defaults (void)
   opt.dots_in_line = 50;
 
   opt.dns_cache = true;
+  opt.dns_cache_ttl = 900;
+  opt.state_interval = 60;
   opt.ftp_pasv = true;
+  opt.ftp_mlsd = true;
 
 #ifdef HAVE_SSL
   opt.check_cert = true;
@@ -391,10 +476,12 @@ defaults (void)
 
   opt.warc_maxsize = 0; /* 1024 * 1024 * 1024; */
 #ifdef HAVE_LIBZ
+  opt.compression = compression_none;
   opt.warc_compression_enabled = true;
 #else
   opt.warc_compression_enabled = false;
 #endif
+  opt.warc_compression_level = -1;
   opt.warc_digests_enabled = true;
   opt.warc_cdx_enabled = false;
   opt.warc_cdx_dedup_filename = NULL;
@@ -869,6 +956,137 @@ run_command (const char *opt)
     }
 }
 
+/* The options of --daemon, which each job starts from, and the
+   commands a job has run on top of them.  */
+static struct options job_defaults;
+static bool job_set[countof (commands)];
+
+/* Commands that only take effect as Wget starts, and so cannot be
+   given to a single job.  */
+static const char *const startup_commands[] = {
+  "acceptregex", "background", "daemon", "limitrate", "limitrateperhost",
+  "logfile", "parallel", "rejectregex", "statsfile", "warcfile"
+};
+
+/* Return a copy of the vector VEC.  */
+
+static char **
+copy_vec (char **vec)
+{
+  char **copy = NULL;
+  for (; vec && *vec; vec++)
+    copy = vec_append (copy, *vec);
+  return copy;
+}
+
+/* Whether commands[COMIND] can be run for a single job: it must not
+   be a startup command, and all the memory it sets must be known to
+   job_option and job_options_end.  */
+
+static bool
+job_command_p (int comind)
+{
+  bool (*action) (const char *, const char *, void *)
+    = commands[comind].action;
+  size_t i;
+
+  for (i = 0; i < countof (startup_commands); i++)
+    if (!strcasecmp (commands[comind].name, startup_commands[i]))
+      return false;
+
+  return (action == cmd_boolean || action == cmd_number
+          || action == cmd_number_inf || action == cmd_bytes
+          || action == cmd_bytes_sum || action == cmd_time
+          || action == cmd_string || action == cmd_file
+          || action == cmd_directory || action == cmd_vector
+          || action == cmd_directory_vector
+          || action == cmd_spec_dirstruct || action == cmd_spec_header
+          || action == cmd_spec_mirror || action == cmd_spec_recursive
+          || action == cmd_spec_timeout);
+}
+
+/* Start a job of --daemon, remembering the options so that those the
+   job changes can be restored by job_options_end.  */
+
+void
+job_options_begin (void)
+{
+  job_defaults = opt;
+  xzero (job_set);
+}
+
+/* Run the wgetrc command LINE for the current job only.  Unlike
+   run_command, an error is reported to the caller, by returning
+   false, rather than by exiting.  */
+
+bool
+job_option (const char *line)
+{
+  char *com, *val;
+  int comind;
+  bool ok;
+
+  if (parse_line (line, &com, &val, &comind) != line_ok)
+    return false;
+  if (!job_command_p (comind))
+    {
+      xfree (com);
+      xfree (val);
+      return false;
+    }
+
+  /* The first time the job sets a string or a vector, give it a copy
+     of its own to change, so that JOB_DEFAULTS still holds the one
+     the command would otherwise free.  */
+  if (!job_set[comind])
+    {
+      bool (*action) (const char *, const char *, void *)
+        = commands[comind].action;
+      void *place = commands[comind].place;
+
+      if (action == cmd_string || action == cmd_file
+          || action == cmd_directory)
+        *(char **) place = NULL;
+      else if (action == cmd_vector || action == cmd_directory_vector)
+        *(char ***) place = copy_vec (*(char ***) place);
+      else if (action == cmd_spec_header)
+        opt.user_headers = copy_vec (opt.user_headers);
+      job_set[comind] = true;
+    }
+
+  ok = setval_internal (comind, com, val);
+  xfree (com);
+  xfree (val);
+  return ok;
+}
+
+/* Free what the current job has allocated, and restore the options
+   saved by job_options_begin.  */
+
+void
+job_options_end (void)
+{
+  size_t i;
+
+  for (i = 0; i < countof (commands); i++)
+    {
+      bool (*action) (const char *, const char *, void *);
+      void *place = commands[i].place;
+
+      if (!job_set[i])
+        continue;
+      action = commands[i].action;
+      if (action == cmd_string || action == cmd_file
+          || action == cmd_directory)
+        xfree_null (*(char **) place);
+      else if (action == cmd_vector || action == cmd_directory_vector)
+        free_vec (*(char ***) place);
+      else if (action == cmd_spec_header)
+        free_vec (opt.user_headers);
+    }
+  opt = job_defaults;
+}
+
 /* Generic helper functions, for use with `commands'. */
 
 /* Forward declarations: */
@@ -1294,6 +1512,53 @@ cmd_spec_warc_header (const char *com, const char *val, void *place_ignored)
   return true;
 }
 
+/* Set the WARC compression from VAL: a boolean, or the format, "gzip"
+   or "zstd", optionally followed by ":LEVEL".  */
+static bool
+cmd_spec_warc_compression (const char *com, const char *val,
+                           void *place_ignored)
+{
+  const char *level = strchr (val, ':');
+  size_t len = level ? (size_t) (level - val) : strlen (val);
+  bool zstd;
+
+  if (len == 4 && 0 == strncasecmp (val, "gzip", 4))
+    zstd = false;
+  else if (len == 4 && 0 == strncasecmp (val, "zstd", 4))
+    zstd = true;
+  else if (!level)
+    return cmd_boolean (com, val, &opt.warc_compression_enabled);
+  else
+    {
+      fprintf (stderr, _("%s: %s: Invalid value %s.\n"),
+               exec_name, com, quote (val));
+      return false;
+    }
+
+#ifndef HAVE_LIBZ
+  if (!zstd)
+    {
+      fprintf (stderr, _("%s: %s: This version does not have support "
+                         "for gzip.\n"), exec_name, com);
+      return false;
+    }
+#endif
+#ifndef HAVE_LIBZSTD
+  if (zstd)
+    {
+      fprintf (stderr, _("%s: %s: This version does not have support "
+                         "for zstd.\n"), exec_name, com);
+      return false;
+    }
+#endif
+
+  if (level && !cmd_number (com, level + 1, &opt.warc_compression_level))
+    return false;
+  opt.warc_compression_enabled = true;
+  opt.warc_zstd = zstd;
+  return true;
+}
+
 static bool
 cmd_spec_htmlify (const char *com, const char *val, void *place_ignored)
 {
@@ -1344,6 +1609,22 @@ cmd_spec_prefer_family (const char *com, const char *val, void *place_ignored)
   return ok;
 }
 
+static bool
+cmd_spec_fsync (const char *com, const char *val, void *place_ignored)
+{
+  static const struct decode_item choices[] = {
+    { "never", fsync_never },
+    { "end", fsync_end },
+    { "interval", fsync_interval },
+  };
+  int fsync_policy = fsync_never;
+  int ok = decode_string (val, choices, countof (choices), &fsync_policy);
+  if (!ok)
+    fprintf (stderr, _("%s: %s: Invalid value %s.\n"), exec_name, com, quote (val));
+  opt.fsync = fsync_policy;
+  return ok;
+}
+
 /* Set progress.type to VAL, but verify that it's a valid progress
    implementation before that.  */
 
@@ -1463,6 +1744,22 @@ cmd_spec_report_speed (const char *com, const char *val, void *place_ignored)
   return opt.report_bps;
 }
 
+#ifdef HAVE_LIBZ
+static bool
+cmd_spec_compression (const char *com, const char *val, void *place)
+{
+  static const struct decode_item choices[] = {
+    { "auto", compression_auto },
+    { "gzip", compression_gzip },
+    { "none", compression_none },
+  };
+  int ok = decode_string (val, choices, countof (choices), place);
+  if (!ok)
+    fprintf (stderr, _("%s: %s: Invalid value %s.\n"), exec_name, com, quote (val));
+  return ok;
+}
+#endif
+
 #ifdef HAVE_SSL
 static bool
 cmd_spec_secure_protocol (const char *com, const char *val, void *place)
@@ -1480,6 +1777,28 @@ cmd_spec_secure_protocol (const char *com, const char *val, void *place)
 }
 #endif
 
+/* Set the shard of the crawl from VAL, which is "K/N".  */
+
+static bool
+cmd_spec_shard (const char *com, const char *val, void *place_ignored)
+{
+  const char *slash = strchr (val, '/');
+  int index, count;
+
+  if (!slash
+      || !simple_atoi (val, slash, &index)
+      || !simple_atoi (slash + 1, val + strlen (val), &count)
+      || index < 1 || index > count)
+    {
+      fprintf (stderr, _("%s: %s: Invalid shard %s; use K/N.\n"),
+               exec_name, com, quote (val));
+      return false;
+    }
+  opt.shard_index = index;
+  opt.shard_count = count;
+  return true;
+}
+
 /* Set all three timeout values. */
 
 static bool
@@ -1524,6 +1843,22 @@ cmd_spec_verbose (const char *com, const char *val, void *place_ignored)
     }
   return false;
 }
+
+static bool
+cmd_spec_visited_set (const char *com, const char *val, void *place_ignored)
+{
+  static const struct decode_item choices[] = {
+    { "exact", visited_exact },
+    { "compact", visited_compact },
+    { "bloom", visited_bloom },
+  };
+  int visited_set = visited_exact;
+  int ok = decode_string (val, choices, countof (choices), &visited_set);
+  if (!ok)
+    fprintf (stderr, _("%s: %s: Invalid value %s.\n"), exec_name, com, quote (val));
+  opt.visited_set = visited_set;
+  return ok;
+}
 
 /* Miscellaneous useful routines.  */
 
@@ -1682,6 +2017,9 @@ cleanup (void)
   if (opt.warc_filename != 0)
     warc_close ();
 
+  /* Tell the other shards this one is gone.  */
+  shard_cleanup ();
+
   log_close ();
 
   if (output_stream)
@@ -1703,9 +2041,20 @@ cleanup (void)
   convert_cleanup ();
   res_cleanup ();
   http_cleanup ();
+  retr_cleanup ();
   cleanup_html_url ();
   spider_cleanup ();
   host_cleanup ();
+  intern_cleanup ();
+  ftp_cleanup ();
+  manifest_cleanup ();
+  dedup_cleanup ();
+  directory_cache_cleanup ();
+  unique_name_cleanup ();
+  iri_cleanup ();
+#ifdef HAVE_SSL
+  ssl_session_cleanup ();
+#endif
   log_cleanup ();
 
   for (i = 0; i < nurl; i++)
@@ -1719,7 +2068,9 @@ cleanup (void)
   xfree_null (opt.lfilename);
   xfree_null (opt.dir_prefix);
   xfree_null (opt.input_filename);
+  xfree_null (opt.daemon_socket);
   xfree_null (opt.output_document);
+  free_acclists ();
   free_vec (opt.accepts);
   free_vec (opt.rejects);
   free_vec (opt.excludes);
@@ -1747,8 +2098,16 @@ cleanup (void)
   xfree_null (opt.ca_cert);
   xfree_null (opt.random_file);
   xfree_null (opt.egd_file);
+  xfree_null (opt.tls_session_file);
 # endif
   xfree_null (opt.bind_address);
+  xfree_null (opt.broken_links_file);
+  xfree_null (opt.dns_cache_file);
+  xfree_null (opt.robots_cache_file);
+  xfree_null (opt.state_file);
+  xfree_null (opt.shard_spool);
+  xfree_null (opt.stats_file);
+  xfree_null (opt.metrics_file);
   xfree_null (opt.cookies_input);
   xfree_null (opt.cookies_output);
   xfree_null (opt.user);
@@ -42,5 +42,8 @@ char *home_dir (void);
 void cleanup (void);
 void defaults (void);
 bool run_wgetrc (const char *file);
+void job_options_begin (void);
+bool job_option (const char *);
+void job_options_end (void);
 
 #endif /* INIT_H */
@@ -0,0 +1,100 @@
+/* Interning of URLs and file names.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* A recursive retrieval keeps the same URL in several places: the
+   set of seen URLs, the URL/file maps of convert.c, and the referer
+   of every document found in it.  Each of them used to have its own
+   copy.  intern_string returns a single shared copy of a string
+   instead, kept in an arena until the program exits.
+
+   Only strings that would be kept until the end anyway should be
+   interned, because an interned string is never freed.  Two interned
+   strings are equal exactly when they are the same pointer.  Since
+   the string hash tables compare pointers before contents, looking
+   up an interned string in a table of interned strings needs no
+   strcmp.  */
+
+#include "wget.h"
+
+#include <string.h>
+
+#include "intern.h"
+#include "arena.h"
+#include "hash.h"
+
+static struct hash_table *interned;
+static struct arena *intern_arena;
+
+/* Return the interned copy of S, which must not be modified or freed.
+   NULL is returned for NULL.  */
+
+const char *
+intern_string (const char *s)
+{
+  char *copy;
+
+  if (!s)
+    return NULL;
+  if (!interned)
+    {
+      interned = make_string_hash_table (0);
+      intern_arena = arena_new ();
+    }
+  copy = hash_table_get (interned, s);
+  if (!copy)
+    {
+      copy = arena_strdup (intern_arena, s);
+      hash_table_put (interned, copy, copy);
+    }
+  return copy;
+}
+
+/* Return the number of bytes taken by the interned strings.  */
+
+size_t
+intern_memory (void)
+{
+  if (!interned)
+    return 0;
+  return hash_table_memory (interned) + arena_memory (intern_arena);
+}
+
+/* Free all the interned strings.  */
+
+void
+intern_cleanup (void)
+{
+  if (!interned)
+    return;
+  hash_table_destroy (interned);
+  arena_free (intern_arena);
+  interned = NULL;
+  intern_arena = NULL;
+}
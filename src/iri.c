@@ -38,6 +38,7 @@ as that of the covered work.  */
 #include <errno.h>
 
 #include "utils.h"
+#include "hash.h"
 
 /* RFC3987 section 3.1 mandates STD3 ASCII RULES */
 #define IDNA_FLAGS  IDNA_USE_STD3_ASCII_RULES
@@ -46,6 +47,93 @@ as that of the covered work.  */
 
 static bool do_conversion (iconv_t cd, char *in, size_t inlen, char **out);
 
+/* Conversion descriptors opened so far, keyed by "FROM>TO".  Links are
+   converted one at a time, but almost always between the same few
+   charsets, so each descriptor is opened once and reused.  */
+static struct hash_table *converters;
+
+/* Return a descriptor converting from FROMCODE to TOCODE, or
+   (iconv_t)(-1) if the conversion isn't supported.  Failures are
+   remembered too.  */
+
+static iconv_t
+converter (const char *tocode, const char *fromcode)
+{
+  char *key = concat_strings (fromcode, ">", tocode, (char *) 0);
+  iconv_t *cd;
+
+  if (!converters)
+    converters = make_nocase_string_hash_table (0);
+  cd = hash_table_get (converters, key);
+  if (cd)
+    {
+      xfree (key);
+      /* Start from the initial shift state.  */
+      if (*cd != (iconv_t)(-1))
+        iconv (*cd, NULL, NULL, NULL, NULL);
+      return *cd;
+    }
+  cd = xnew (iconv_t);
+  *cd = iconv_open (tocode, fromcode);
+  hash_table_put (converters, key, cd);
+  return *cd;
+}
+
+/* Return true if STR consists of ASCII characters only.  */
+
+static bool
+ascii_p (const char *str)
+{
+  for (; *str; str++)
+    if ((unsigned char) *str >= 0x80)
+      return false;
+  return true;
+}
+
+/* Return true if an ASCII string in CHARSET reads the same in UTF-8,
+   which is the case unless CHARSET is a stateful 7-bit encoding such
+   as ISO-2022-JP or UTF-7, or encodes ASCII differently.  */
+
+static bool
+ascii_compatible_p (const char *charset)
+{
+  static const char *const exceptions[] = {
+    "ISO-2022", "ISO2022", "UTF-7", "UTF7", "HZ", "UTF-16", "UTF16",
+    "UTF-32", "UTF32", "UCS-2", "UCS2", "UCS-4", "UCS4", "EBCDIC",
+    "IBM0", "CP0", "IBM1", "CP1"
+  };
+  int i;
+  for (i = 0; i < countof (exceptions); i++)
+    if (!strncasecmp (charset, exceptions[i], strlen (exceptions[i])))
+      {
+        /* The Windows code pages CP1250 to CP1258 are fine.  */
+        if (!strncasecmp (charset, "CP125", 5))
+          return true;
+        return false;
+      }
+  return true;
+}
+
+/* Close the descriptors opened by converter.  */
+
+void
+iri_cleanup (void)
+{
+  hash_table_iterator iter;
+  if (!converters)
+    return;
+  for (hash_table_iterate (converters, &iter); hash_table_iter_next (&iter); )
+    {
+      iconv_t *cd = iter.value;
+      if (*cd != (iconv_t)(-1))
+        iconv_close (*cd);
+      xfree (iter.key);
+      xfree (cd);
+    }
+  hash_table_destroy (converters);
+  converters = NULL;
+}
+
 
 /* Given a string containing "charset=XXX", return the encoding if found,
    or NULL otherwise */
@@ -128,8 +216,11 @@ locale_to_utf8 (const char *str)
   if (!opt.locale || !strcasecmp (opt.locale, "utf-8"))
     return str;
 
-  l2u = iconv_open ("UTF-8", opt.locale);
-  if (l2u != (iconv_t)(-1))
+  if (ascii_p (str) && ascii_compatible_p (opt.locale))
+    return str;
+
+  l2u = converter ("UTF-8", opt.locale);
+  if (l2u == (iconv_t)(-1))
     {
       logprintf (LOG_VERBOSE, _("Conversion from %s to %s isn't supported\n"),
                  quote (opt.locale), quote ("UTF-8"));
@@ -260,6 +351,7 @@ remote_to_utf8 (struct iri *i, const char *str, const char **new)
 {
   iconv_t cd;
   bool ret = false;
+  bool ascii;
 
   if (!i->uri_encoding)
     return false;
@@ -267,27 +359,29 @@ remote_to_utf8 (struct iri *i, const char *str, const char **new)
   /* When `i->uri_encoding' == "UTF-8" there is nothing to convert.  But we must
      test for non-ASCII symbols for correct hostname processing in `idn_encode'
      function. */
+  ascii = ascii_p (str);
   if (!strcmp (i->uri_encoding, "UTF-8"))
     {
-      int i, len = strlen (str);
-      for (i = 0; i < len; i++)
-        if ((unsigned char) str[i] >= (unsigned char) '\200')
-          {
-            *new = strdup (str);
-            return true;
-          }
+      if (!ascii)
+        {
+          *new = strdup (str);
+          return true;
+        }
       return false;
     }
 
-  cd = iconv_open ("UTF-8", i->uri_encoding);
+  /* Most links are plain ASCII, which most charsets share with UTF-8,
+     so there is nothing to convert either.  */
+  if (ascii && ascii_compatible_p (i->uri_encoding))
+    return false;
+
+  cd = converter ("UTF-8", i->uri_encoding);
   if (cd == (iconv_t)(-1))
     return false;
 
   if (do_conversion (cd, (char *) str, strlen ((char *) str), (char **) new))
     ret = true;
 
-  iconv_close (cd);
-
   /* Test if something was converted */
   if (!strcmp (str, *new))
     {
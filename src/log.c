@@ -37,6 +37,7 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
 
 #include "utils.h"
 #include "log.h"
@@ -104,167 +105,116 @@ static bool needs_flushing;
    output, and dump them as context when the time comes.  */
 #define SAVED_LOG_LINES 24
 
-/* log_lines is a circular buffer that stores SAVED_LOG_LINES lines of
-   output.  log_line_current always points to the position in the
-   buffer that will be written to next.  When log_line_current reaches
-   SAVED_LOG_LINES, it is reset to zero.
-
-   The problem here is that we'd have to either (re)allocate and free
-   strings all the time, or limit the lines to an arbitrary number of
-   characters.  Instead of settling for either of these, we do both:
-   if the line is smaller than a certain "usual" line length (128
-   chars by default), a preallocated memory is used.  The rare lines
-   that are longer than 128 characters are malloc'ed and freed
-   separately.  This gives good performance with minimum memory
-   consumption and fragmentation.  */
-
-#define STATIC_LENGTH 128
-
-static struct log_ln {
-  char static_line[STATIC_LENGTH + 1]; /* statically allocated
-                                          line. */
-  char *malloced_line;          /* malloc'ed line, for lines of output
-                                   larger than 80 characters. */
-  char *content;                /* this points either to malloced_line
-                                   or to the appropriate static_line.
-                                   If this is NULL, it means the line
-                                   has not yet been used. */
-} log_lines[SAVED_LOG_LINES];
-
-/* The current position in the ring. */
-static int log_line_current = -1;
-
-/* Whether the most recently written line was "trailing", i.e. did not
-   finish with \n.  This is an important piece of information because
-   the code is always careful to append data to trailing lines, rather
-   than create new ones.  */
-static bool trailing_line;
+/* The output is saved as it is written, in saved_log, a circular
+   buffer of SAVED_LOG_SIZE bytes.  That is enough for SAVED_LOG_LINES
+   lines of any usual length, and saving output only ever copies it:
+   nothing is allocated, and the lines need not be told apart until
+   the context is dumped.  If the last lines are very long, only their
+   ends are kept.
+
+   saved_log_total counts the bytes ever saved, so that saved_log holds
+   the last MIN (saved_log_total, SAVED_LOG_SIZE) of them, the last one
+   just before saved_log_total % SAVED_LOG_SIZE.  */
+
+#define SAVED_LOG_SIZE 8192
+
+#ifndef MIN
+# define MIN(i, j) ((i) <= (j) ? (i) : (j))
+#endif
+
+static char saved_log[SAVED_LOG_SIZE];
+static wgint saved_log_total;
+
+/* When the log does not go to a terminal, the messages are collected
+   in log_buffer and written out together, rather than flushed one by
+   one; with -d, flushing every message would cost more than anything
+   else Wget does.  The buffer is written when it fills up, when a
+   second has passed since it was last written, and whenever logflush
+   is called, which includes before the process forks or exits.  Since
+   it is only written between messages, the messages of the processes
+   of --parallel that share the log still come out whole.  */
+
+#define LOG_BUFFER_SIZE 65536
+
+static char *log_buffer;        /* NULL unless buffering */
+static int log_buffer_len;
+static time_t log_buffer_written;
 
 static void check_redirect_output (void);
-
-#define ROT_ADVANCE(num) do {                   \
-  if (++num >= SAVED_LOG_LINES)                 \
-    num = 0;                                    \
-} while (0)
 
-/* Free the log line index with NUM.  This calls free on
-   ln->malloced_line if it's non-NULL, and it also resets
-   ln->malloced_line and ln->content to NULL.  */
+/* Save LEN bytes of output at S, as explained above.  */
 
 static void
-free_log_line (int num)
+saved_append (const char *s, int len)
 {
-  struct log_ln *ln = log_lines + num;
-  if (ln->malloced_line)
+  if (len > SAVED_LOG_SIZE)
     {
-      xfree (ln->malloced_line);
-      ln->malloced_line = NULL;
+      saved_log_total += len - SAVED_LOG_SIZE;
+      s += len - SAVED_LOG_SIZE;
+      len = SAVED_LOG_SIZE;
+    }
+  while (len > 0)
+    {
+      int pos = saved_log_total % SAVED_LOG_SIZE;
+      int chunk = MIN (len, SAVED_LOG_SIZE - pos);
+      memcpy (saved_log + pos, s, chunk);
+      saved_log_total += chunk;
+      s += chunk;
+      len -= chunk;
     }
-  ln->content = NULL;
 }
 
-/* Append bytes in the range [start, end) to one line in the log.  The
-   region is not supposed to contain newlines, except for the last
-   character (at end[-1]).  */
+/* Write S to FP, or to log_buffer if FP is the log being buffered.  */
 
 static void
-saved_append_1 (const char *start, const char *end)
+log_write (const char *s, FILE *fp)
 {
-  int len = end - start;
-  if (!len)
-    return;
+  int len;
 
-  /* First, check whether we need to append to an existing line or to
-     create a new one.  */
-  if (!trailing_line)
+  if (!log_buffer || fp != logfp)
     {
-      /* Create a new line. */
-      struct log_ln *ln;
-
-      if (log_line_current == -1)
-        log_line_current = 0;
-      else
-        free_log_line (log_line_current);
-      ln = log_lines + log_line_current;
-      if (len > STATIC_LENGTH)
-        {
-          ln->malloced_line = strdupdelim (start, end);
-          ln->content = ln->malloced_line;
-        }
-      else
-        {
-          memcpy (ln->static_line, start, len);
-          ln->static_line[len] = '\0';
-          ln->content = ln->static_line;
-        }
+      FPUTS (s, fp);
+      return;
     }
-  else
+  len = strlen (s);
+  if (log_buffer_len + len > LOG_BUFFER_SIZE)
     {
-      /* Append to the last line.  If the line is malloc'ed, we just
-         call realloc and append the new string.  If the line is
-         static, we have to check whether appending the new string
-         would make it exceed STATIC_LENGTH characters, and if so,
-         convert it to malloc(). */
-      struct log_ln *ln = log_lines + log_line_current;
-      if (ln->malloced_line)
+      logflush ();
+      if (len > LOG_BUFFER_SIZE)
         {
-          /* Resize malloc'ed line and append. */
-          int old_len = strlen (ln->malloced_line);
-          ln->malloced_line = xrealloc (ln->malloced_line, old_len + len + 1);
-          memcpy (ln->malloced_line + old_len, start, len);
-          ln->malloced_line[old_len + len] = '\0';
-          /* might have changed due to realloc */
-          ln->content = ln->malloced_line;
-        }
-      else
-        {
-          int old_len = strlen (ln->static_line);
-          if (old_len + len > STATIC_LENGTH)
-            {
-              /* Allocate memory and concatenate the old and the new
-                 contents. */
-              ln->malloced_line = xmalloc (old_len + len + 1);
-              memcpy (ln->malloced_line, ln->static_line,
-                      old_len);
-              memcpy (ln->malloced_line + old_len, start, len);
-              ln->malloced_line[old_len + len] = '\0';
-              ln->content = ln->malloced_line;
-            }
-          else
-            {
-              /* Just append to the old, statically allocated
-                 contents.  */
-              memcpy (ln->static_line + old_len, start, len);
-              ln->static_line[old_len + len] = '\0';
-              ln->content = ln->static_line;
-            }
+          FPUTS (s, fp);
+          return;
         }
     }
-  trailing_line = !(end[-1] == '\n');
-  if (!trailing_line)
-    ROT_ADVANCE (log_line_current);
+  memcpy (log_buffer + log_buffer_len, s, len);
+  log_buffer_len += len;
 }
 
-/* Log the contents of S, as explained above.  If S consists of
-   multiple lines, they are logged separately.  If S does not end with
-   a newline, it will form a "trailing" line, to which things will get
-   appended the next time this function is called.  */
+/* Flush the log after a message, unless flushing is disabled or, for
+   a buffered log, was done less than a second ago.  */
 
 static void
-saved_append (const char *s)
+log_flush_after_message (void)
 {
-  while (*s)
-    {
-      const char *end = strchr (s, '\n');
-      if (!end)
-        end = s + strlen (s);
-      else
-        ++end;
-      saved_append_1 (s, end);
-      s = end;
-    }
+  if (flush_log_p
+      && (!log_buffer || time (NULL) != log_buffer_written))
+    logflush ();
+  else
+    needs_flushing = true;
 }
-
+
+/* Write out a buffered log if it has waited for a second.  This is
+   called while a download goes on, so that the last messages do not
+   wait for the next one.  */
+
+void
+log_poll_flush (void)
+{
+  if (log_buffer && log_buffer_len && flush_log_p
+      && time (NULL) != log_buffer_written)
+    logflush ();
+}
+
 /* Check X against opt.verbose and opt.quiet.  The semantics is as
    follows:
 
@@ -349,21 +299,19 @@ logputs (enum log_options o, const char *s)
   warcfp = get_warc_log_fp ();
   CHECK_VERBOSE (o);
 
-  FPUTS (s, fp);
+  log_write (s, fp);
   if (warcfp != NULL)
     FPUTS (s, warcfp);
   if (save_context_p)
-    saved_append (s);
-  if (flush_log_p)
-    logflush ();
-  else
-    needs_flushing = true;
+    saved_append (s, strlen (s));
+  log_flush_after_message ();
 }
 
 struct logvprintf_state {
   char *bigmsg;
   int expected_size;
   int allocated;
+  bool bypass_buffer;           /* too long for log_buffer */
 };
 
 /* Print a message to the log.  A copy of message will be saved to
@@ -378,7 +326,12 @@ struct logvprintf_state {
    to logvprintf_state and signals the parent to call it again.
 
    (An alternative approach would be to use va_copy, but that's not
-   portable.)  */
+   portable.)
+
+   A buffered log is formatted right into log_buffer.  If the message
+   does not fit, the buffer is written out and the message formatted
+   again; a message that does not fit the empty buffer either is
+   formatted as above and written out directly.  */
 
 static bool
 log_vprintf_internal (struct logvprintf_state *state, const char *fmt,
@@ -391,6 +344,28 @@ log_vprintf_internal (struct logvprintf_state *state, const char *fmt,
   FILE *fp = get_log_fp ();
   FILE *warcfp = get_warc_log_fp ();
 
+  if (log_buffer && fp == logfp && !state->bypass_buffer)
+    {
+      char *msg = log_buffer + log_buffer_len;
+      int room = LOG_BUFFER_SIZE - log_buffer_len;
+
+      numwritten = vsnprintf (msg, room + 1, fmt, args);
+      if (numwritten < 0 || numwritten > room)
+        {
+          if (log_buffer_len)
+            logflush ();
+          else
+            state->bypass_buffer = true;
+          return false;
+        }
+      log_buffer_len += numwritten;
+      if (save_context_p)
+        saved_append (msg, numwritten);
+      if (warcfp != NULL)
+        FPUTS (msg, warcfp);
+      goto flush;
+    }
+
   if (!save_context_p && warcfp == NULL)
     {
       /* In the simple case just call vfprintf(), to avoid needless
@@ -442,28 +417,34 @@ log_vprintf_internal (struct logvprintf_state *state, const char *fmt,
 
   /* Writing succeeded. */
   if (save_context_p)
-    saved_append (write_ptr);
-  FPUTS (write_ptr, fp);
+    saved_append (write_ptr, numwritten);
+  log_write (write_ptr, fp);
   if (warcfp != NULL)
     FPUTS (write_ptr, warcfp);
   if (state->bigmsg)
     xfree (state->bigmsg);
 
  flush:
-  if (flush_log_p)
-    logflush ();
-  else
-    needs_flushing = true;
+  log_flush_after_message ();
 
   return true;
 }
 
-/* Flush LOGFP.  Useful while flushing is disabled.  */
+/* Flush LOGFP, writing out log_buffer first.  Useful while flushing
+   is disabled, and needed before forking, so that the child does not
+   inherit the buffered messages and write them a second time.  */
 void
 logflush (void)
 {
   FILE *fp = get_log_fp ();
   FILE *warcfp = get_warc_log_fp ();
+  if (log_buffer && logfp)
+    {
+      if (log_buffer_len)
+        fwrite (log_buffer, 1, log_buffer_len, logfp);
+      log_buffer_len = 0;
+      log_buffer_written = time (NULL);
+    }
   if (fp)
     {
 /* 2005-10-25 SMS.
@@ -538,6 +519,9 @@ logprintf (enum log_options o, const char *fmt, ...)
   xzero (lpstate);
   do
     {
+      /* Don't mistake an EPIPE left over from writing to a socket
+         for the log stream having been closed.  */
+      errno = 0;
       va_start (args, fmt);
       done = log_vprintf_internal (&lpstate, fmt, args);
       va_end (args);
@@ -613,6 +597,13 @@ log_init (const char *file, bool appendp)
           save_context_p = true;
         }
     }
+
+  if (!save_context_p)
+    {
+      log_buffer = xmalloc (LOG_BUFFER_SIZE + 1);
+      log_buffer_written = time (NULL);
+      atexit (logflush);
+    }
 }
 
 /* Close LOGFP (only if we opened it, not if it's stderr), inhibit
@@ -620,55 +611,60 @@ log_init (const char *file, bool appendp)
 void
 log_close (void)
 {
-  int i;
+  logflush ();
+  xfree_null (log_buffer);
+  log_buffer = NULL;
 
   if (logfp && (logfp != stderr))
     fclose (logfp);
   logfp = NULL;
   inhibit_logging = true;
   save_context_p = false;
-
-  for (i = 0; i < SAVED_LOG_LINES; i++)
-    free_log_line (i);
-  log_line_current = -1;
-  trailing_line = false;
+  saved_log_total = 0;
 }
 
-/* Dump saved lines to logfp. */
+/* Dump the last SAVED_LOG_LINES saved lines to logfp.  A last line
+   without a newline counts as one of them.  */
 static void
 log_dump_context (void)
 {
-  int num = log_line_current;
+  char text[SAVED_LOG_SIZE + 1];
+  wgint end = saved_log_total, start, p;
+  int lines = 0, len = 0;
   FILE *fp = get_log_fp ();
   FILE *warcfp = get_warc_log_fp ();
   if (!fp)
     return;
 
-  if (num == -1)
-    return;
-  if (trailing_line)
-    ROT_ADVANCE (num);
-  do
+  start = end > SAVED_LOG_SIZE ? end - SAVED_LOG_SIZE : 0;
+  for (p = end - 2; p >= start; p--)
+    if (saved_log[p % SAVED_LOG_SIZE] == '\n' && ++lines == SAVED_LOG_LINES)
+      break;
+  if (p >= start)
+    start = p + 1;
+  else if (start > 0)
     {
-      struct log_ln *ln = log_lines + num;
-      if (ln->content)
-        {
-          FPUTS (ln->content, fp);
-          if (warcfp != NULL)
-            FPUTS (ln->content, warcfp);
-        }
-      ROT_ADVANCE (num);
+      /* The oldest saved line lost its beginning; skip it.  */
+      for (p = start; p < end - 1; p++)
+        if (saved_log[p % SAVED_LOG_SIZE] == '\n')
+          {
+            start = p + 1;
+            break;
+          }
     }
-  while (num != log_line_current);
-  if (trailing_line)
-    if (log_lines[log_line_current].content)
-      {
-        FPUTS (log_lines[log_line_current].content, fp);
-        if (warcfp != NULL)
-          FPUTS (log_lines[log_line_current].content, warcfp);
-      }
+
+  for (p = start; p < end; p++)
+    text[len++] = saved_log[p % SAVED_LOG_SIZE];
+  text[len] = '\0';
+  if (!len)
+    return;
+
+  FPUTS (text, fp);
+  if (warcfp != NULL)
+    FPUTS (text, warcfp);
   fflush (fp);
-  fflush (warcfp);
+  if (warcfp != NULL)
+    fflush (warcfp);
 }
 
 /* String escape functions. */
@@ -856,6 +852,7 @@ static void
 redirect_output (void)
 {
   char *logfile;
+  logflush ();
   logfp = unique_create (DEFAULT_LOGFILE, false, &logfile);
   if (logfp)
     {
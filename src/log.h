@@ -45,6 +45,7 @@ void logprintf (enum log_options, const char *, ...)
 void debug_logprintf (const char *, ...) GCC_FORMAT_ATTR (1, 2);
 void logputs (enum log_options, const char *);
 void logflush (void);
+void log_poll_flush (void);
 void log_set_flush (bool);
 bool log_set_save_context (bool);
 
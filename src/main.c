@@ -49,6 +49,7 @@ as that of the covered work.  */
 #include "retr.h"
 #include "recur.h"
 #include "host.h"
+#include "res.h"
 #include "url.h"
 #include "progress.h"           /* for progress_handle_sigwinch */
 #include "convert.h"
@@ -56,6 +57,15 @@ as that of the covered work.  */
 #include "http.h"               /* for save_cookies */
 #include "ptimer.h"
 #include "warc.h"
+#include "timing.h"
+#include "stats.h"
+#include "manifest.h"
+#include "memory.h"
+#include "daemon.h"
+#include "counters.h"
+#ifdef HAVE_SSL
+# include "ssl.h"
+#endif
 #include <getopt.h>
 #include <getpass.h>
 #include <quote.h>
@@ -93,6 +103,9 @@ extern const char *compiled_features[];
 #if defined(SIGHUP) || defined(SIGUSR1)
 static void redirect_output_signal (int);
 #endif
+#if defined(SIGUSR2) || defined(SIGINFO)
+static void report_signal (int);
+#endif
 
 const char *exec_name;
 
@@ -167,6 +180,7 @@ static struct cmdline_option option_data[] =
     { "backups", 0, OPT_BOOLEAN, "backups", -1 },
     { "base", 'B', OPT_VALUE, "base", -1 },
     { "bind-address", 0, OPT_VALUE, "bindaddress", -1 },
+    { "broken-links", 0, OPT_VALUE, "brokenlinks", -1 },
     { IF_SSL ("ca-certificate"), 0, OPT_VALUE, "cacertificate", -1 },
     { IF_SSL ("ca-directory"), 0, OPT_VALUE, "cadirectory", -1 },
     { "cache", 0, OPT_BOOLEAN, "cache", -1 },
@@ -174,20 +188,31 @@ static struct cmdline_option option_data[] =
     { IF_SSL ("certificate-type"), 0, OPT_VALUE, "certificatetype", -1 },
     { IF_SSL ("check-certificate"), 0, OPT_BOOLEAN, "checkcertificate", -1 },
     { "clobber", 0, OPT__CLOBBER, NULL, optional_argument },
+#ifdef HAVE_LIBZ
+    { "compression", 0, OPT_VALUE, "compression", -1 },
+#endif
     { "config", 0, OPT_VALUE, "chooseconfig", -1 },
     { "connect-timeout", 0, OPT_VALUE, "connecttimeout", -1 },
     { "continue", 'c', OPT_BOOLEAN, "continue", -1 },
+    { "convert-jobs", 0, OPT_VALUE, "convertjobs", -1 },
     { "convert-links", 'k', OPT_BOOLEAN, "convertlinks", -1 },
     { "content-disposition", 0, OPT_BOOLEAN, "contentdisposition", -1 },
     { "content-on-error", 0, OPT_BOOLEAN, "contentonerror", -1 },
     { "cookies", 0, OPT_BOOLEAN, "cookies", -1 },
     { "cut-dirs", 0, OPT_VALUE, "cutdirs", -1 },
+    { "daemon", 0, OPT_VALUE, "daemon", -1 },
     { WHEN_DEBUG ("debug"), 'd', OPT_BOOLEAN, "debug", -1 },
+    { "dedup-files", 0, OPT_BOOLEAN, "dedupfiles", -1 },
     { "default-page", 0, OPT_VALUE, "defaultpage", -1 },
     { "delete-after", 0, OPT_BOOLEAN, "deleteafter", -1 },
+#ifdef HAVE_LIBURING
+    { "direct-io", 0, OPT_BOOLEAN, "directio", -1 },
+#endif
     { "directories", 0, OPT_BOOLEAN, "dirstruct", -1 },
     { "directory-prefix", 'P', OPT_VALUE, "dirprefix", -1 },
     { "dns-cache", 0, OPT_BOOLEAN, "dnscache", -1 },
+    { "dns-cache-file", 0, OPT_VALUE, "dnscachefile", -1 },
+    { "dns-cache-ttl", 0, OPT_VALUE, "dnscachettl", -1 },
     { "dns-timeout", 0, OPT_VALUE, "dnstimeout", -1 },
     { "domains", 'D', OPT_VALUE, "domains", -1 },
     { "dont-remove-listing", 0, OPT__DONT_REMOVE_LISTING, NULL, no_argument },
@@ -200,6 +225,10 @@ static struct cmdline_option option_data[] =
     { "follow-tags", 0, OPT_VALUE, "followtags", -1 },
     { "force-directories", 'x', OPT_BOOLEAN, "dirstruct", -1 },
     { "force-html", 'F', OPT_BOOLEAN, "forcehtml", -1 },
+    { "fsync", 0, OPT_VALUE, "fsync", -1 },
+    { "ftp-connections", 0, OPT_VALUE, "ftpconnections", -1 },
+    { "ftp-listing-cache", 0, OPT_BOOLEAN, "ftplistingcache", -1 },
+    { "ftp-mlsd", 0, OPT_BOOLEAN, "ftpmlsd", -1 },
     { "ftp-password", 0, OPT_VALUE, "ftppassword", -1 },
 #ifdef __VMS
     { "ftp-stmlf", 0, OPT_BOOLEAN, "ftpstmlf", -1 },
@@ -208,13 +237,21 @@ static struct cmdline_option option_data[] =
     { "glob", 0, OPT_BOOLEAN, "glob", -1 },
     { "header", 0, OPT_VALUE, "header", -1 },
     { "help", 'h', OPT_FUNCALL, (void *)print_help, no_argument },
+    { "host-connections", 0, OPT_VALUE, "hostconnections", -1 },
     { "host-directories", 0, OPT_BOOLEAN, "addhostdir", -1 },
     { "html-extension", 'E', OPT_BOOLEAN, "adjustextension", -1 }, /* deprecated */
     { "htmlify", 0, OPT_BOOLEAN, "htmlify", -1 },
     { "http-keep-alive", 0, OPT_BOOLEAN, "httpkeepalive", -1 },
+    { "http-keep-alive-max", 0, OPT_VALUE, "httpkeepalivemax", -1 },
+    { "http-keep-alive-per-host", 0, OPT_VALUE, "httpkeepaliveperhost", -1 },
+    { "http-keep-alive-timeout", 0, OPT_VALUE, "httpkeepalivetimeout", -1 },
     { "http-passwd", 0, OPT_VALUE, "httppassword", -1 }, /* deprecated */
     { "http-password", 0, OPT_VALUE, "httppassword", -1 },
     { "http-user", 0, OPT_VALUE, "httpuser", -1 },
+#ifdef ENABLE_HTTP2
+    { "http2", 0, OPT_BOOLEAN, "http2", -1 },
+#endif
+    { "if-modified-since", 0, OPT_BOOLEAN, "ifmodifiedsince", -1 },
     { "ignore-case", 0, OPT_BOOLEAN, "ignorecase", -1 },
     { "ignore-length", 0, OPT_BOOLEAN, "ignorelength", -1 },
     { "ignore-tags", 0, OPT_VALUE, "ignoretags", -1 },
@@ -224,13 +261,23 @@ static struct cmdline_option option_data[] =
     { "inet6-only", '6', OPT_BOOLEAN, "inet6only", -1 },
 #endif
     { "input-file", 'i', OPT_VALUE, "input", -1 },
+#ifdef HAVE_LIBURING
+    { "io-uring", 0, OPT_BOOLEAN, "iouring", -1 },
+#endif
     { "iri", 0, OPT_BOOLEAN, "iri", -1 },
+    { "journal-cookies", 0, OPT_BOOLEAN, "journalcookies", -1 },
     { "keep-session-cookies", 0, OPT_BOOLEAN, "keepsessioncookies", -1 },
+    { IF_SSL ("ktls"), 0, OPT_BOOLEAN, "ktls", -1 },
     { "level", 'l', OPT_VALUE, "reclevel", -1 },
     { "limit-rate", 0, OPT_VALUE, "limitrate", -1 },
+    { "limit-rate-per-host", 0, OPT_VALUE, "limitrateperhost", -1 },
     { "load-cookies", 0, OPT_VALUE, "loadcookies", -1 },
     { "local-encoding", 0, OPT_VALUE, "localencoding", -1 },
+    { "manifest", 0, OPT_BOOLEAN, "manifest", -1 },
+    { "max-memory", 0, OPT_VALUE, "maxmemory", -1 },
     { "max-redirect", 0, OPT_VALUE, "maxredirect", -1 },
+    { "metrics-file", 0, OPT_VALUE, "metricsfile", -1 },
+    { "min-rate", 0, OPT_VALUE, "minrate", -1 },
     { "mirror", 'm', OPT_BOOLEAN, "mirror", -1 },
     { "no", 'n', OPT__NO, NULL, required_argument },
     { "no-clobber", 0, OPT_BOOLEAN, "noclobber", -1 },
@@ -238,9 +285,12 @@ static struct cmdline_option option_data[] =
     { "output-document", 'O', OPT_VALUE, "outputdocument", -1 },
     { "output-file", 'o', OPT_VALUE, "logfile", -1 },
     { "page-requisites", 'p', OPT_BOOLEAN, "pagerequisites", -1 },
+    { "parallel", 0, OPT_VALUE, "parallel", -1 },
     { "parent", 0, OPT__PARENT, NULL, optional_argument },
     { "passive-ftp", 0, OPT_BOOLEAN, "passiveftp", -1 },
     { "password", 0, OPT_VALUE, "password", -1 },
+    { "phase-timing", 0, OPT_BOOLEAN, "phasetiming", -1 },
+    { "pipeline", 0, OPT_VALUE, "pipeline", -1 },
     { "post-data", 0, OPT_VALUE, "postdata", -1 },
     { "post-file", 0, OPT_VALUE, "postfile", -1 },
     { "prefer-family", 0, OPT_VALUE, "preferfamily", -1 },
@@ -254,12 +304,14 @@ static struct cmdline_option option_data[] =
     { "proxy-passwd", 0, OPT_VALUE, "proxypassword", -1 }, /* deprecated */
     { "proxy-password", 0, OPT_VALUE, "proxypassword", -1 },
     { "proxy-user", 0, OPT_VALUE, "proxyuser", -1 },
+    { "queue-memory", 0, OPT_VALUE, "queuememory", -1 },
     { "quiet", 'q', OPT_BOOLEAN, "quiet", -1 },
     { "quota", 'Q', OPT_VALUE, "quota", -1 },
     { "random-file", 0, OPT_VALUE, "randomfile", -1 },
     { "random-wait", 0, OPT_BOOLEAN, "randomwait", -1 },
     { "read-timeout", 0, OPT_VALUE, "readtimeout", -1 },
     { "recursive", 'r', OPT_BOOLEAN, "recursive", -1 },
+    { "recv-buffer", 0, OPT_VALUE, "recvbuffer", -1 },
     { "referer", 0, OPT_VALUE, "referer", -1 },
     { "regex-type", 0, OPT_VALUE, "regextype", -1 },
     { "reject", 'R', OPT_VALUE, "reject", -1 },
@@ -271,15 +323,26 @@ static struct cmdline_option option_data[] =
     { "restrict-file-names", 0, OPT_BOOLEAN, "restrictfilenames", -1 },
     { "retr-symlinks", 0, OPT_BOOLEAN, "retrsymlinks", -1 },
     { "retry-connrefused", 0, OPT_BOOLEAN, "retryconnrefused", -1 },
+    { "robots-cache-file", 0, OPT_VALUE, "robotscachefile", -1 },
+    { "robots-cache-ttl", 0, OPT_VALUE, "robotscachettl", -1 },
     { "save-cookies", 0, OPT_VALUE, "savecookies", -1 },
     { "save-headers", 0, OPT_BOOLEAN, "saveheaders", -1 },
     { IF_SSL ("secure-protocol"), 0, OPT_VALUE, "secureprotocol", -1 },
+    { "segments", 0, OPT_VALUE, "segments", -1 },
     { "server-response", 'S', OPT_BOOLEAN, "serverresponse", -1 },
+    { "shard", 0, OPT_VALUE, "shard", -1 },
+    { "shard-spool", 0, OPT_VALUE, "shardspool", -1 },
     { "span-hosts", 'H', OPT_BOOLEAN, "spanhosts", -1 },
     { "spider", 0, OPT_BOOLEAN, "spider", -1 },
+    { "state-file", 0, OPT_VALUE, "statefile", -1 },
+    { "state-interval", 0, OPT_VALUE, "stateinterval", -1 },
+    { "stats-file", 0, OPT_VALUE, "statsfile", -1 },
     { "strict-comments", 0, OPT_BOOLEAN, "strictcomments", -1 },
+    { "tcp-fastopen", 0, OPT_BOOLEAN, "tcpfastopen", -1 },
+    { "tcp-nodelay", 0, OPT_BOOLEAN, "tcpnodelay", -1 },
     { "timeout", 'T', OPT_VALUE, "timeout", -1 },
     { "timestamping", 'N', OPT_BOOLEAN, "timestamping", -1 },
+    { IF_SSL ("tls-session-file"), 0, OPT_VALUE, "tlssessionfile", -1 },
     { "tries", 't', OPT_VALUE, "tries", -1 },
     { "unlink", 0, OPT_BOOLEAN, "unlink", -1 },
     { "trust-server-names", 0, OPT_BOOLEAN, "trustservernames", -1 },
@@ -289,19 +352,26 @@ static struct cmdline_option option_data[] =
     { "verbose", 'v', OPT_BOOLEAN, "verbose", -1 },
     { "verbose", 0, OPT_BOOLEAN, "verbose", -1 },
     { "version", 'V', OPT_FUNCALL, (void *) print_version, no_argument },
+    { "visited-set", 0, OPT_VALUE, "visitedset", -1 },
     { "wait", 'w', OPT_VALUE, "wait", -1 },
     { "waitretry", 0, OPT_VALUE, "waitretry", -1 },
     { "warc-cdx", 0, OPT_BOOLEAN, "warccdx", -1 },
-#ifdef HAVE_LIBZ
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
     { "warc-compression", 0, OPT_BOOLEAN, "warccompression", -1 },
+    { "warc-compression-level", 0, OPT_VALUE, "warccompressionlevel", -1 },
+    { "warc-compression-threads", 0, OPT_VALUE, "warccompressionthreads", -1 },
 #endif
     { "warc-dedup", 0, OPT_VALUE, "warccdxdedup", -1 },
+    { "warc-dedup-index", 0, OPT_VALUE, "warccdxdedupindex", -1 },
     { "warc-digests", 0, OPT_BOOLEAN, "warcdigests", -1 },
     { "warc-file", 0, OPT_VALUE, "warcfile", -1 },
     { "warc-header", 0, OPT_VALUE, "warcheader", -1 },
     { "warc-keep-log", 0, OPT_BOOLEAN, "warckeeplog", -1 },
     { "warc-max-size", 0, OPT_VALUE, "warcmaxsize", -1 },
     { "warc-tempdir", 0, OPT_VALUE, "warctempdir", -1 },
+#ifdef HAVE_LIBZSTD
+    { "warc-zstd-dictionary", 0, OPT_VALUE, "warczstddictionary", -1 },
+#endif
 #ifdef USE_WATT32
     { "wdebug", 0, OPT_BOOLEAN, "wdebug", -1 },
 #endif
@@ -435,6 +505,8 @@ Startup:\n"),
   -h,  --help              print this help.\n"),
     N_("\
   -b,  --background        go to background after startup.\n"),
+    N_("\
+       --daemon=SOCKET     run the jobs sent to the UNIX socket SOCKET.\n"),
     N_("\
   -e,  --execute=COMMAND   execute a `.wgetrc'-style command.\n"),
     "\n",
@@ -461,6 +533,13 @@ Logging and input file:\n"),
   -nv, --no-verbose          turn off verboseness, without being quiet.\n"),
     N_("\
        --report-speed=TYPE   Output bandwidth as TYPE.  TYPE can be bits.\n"),
+    N_("\
+       --phase-timing        log the time spent in each phase of every\n\
+                             transfer, and histograms of them at exit.\n"),
+    N_("\
+       --stats-file=FILE     write a JSON record of each retrieval to FILE.\n"),
+    N_("\
+       --metrics-file=FILE   keep live statistics in FILE for Prometheus.\n"),
     N_("\
   -i,  --input-file=FILE     download URLs found in local or external FILE.\n"),
     N_("\
@@ -485,11 +564,30 @@ Download:\n"),
                                  existing files (overwriting them).\n"),
     N_("\
   -c,  --continue                resume getting a partially-downloaded file.\n"),
+    N_("\
+       --fsync=WHEN              sync downloaded files to disk WHEN: never,\n\
+                                 at the end, or at intervals.\n"),
+#ifdef HAVE_LIBURING
+    N_("\
+       --io-uring                write files in the background with io_uring.\n"),
+    N_("\
+       --direct-io               with --io-uring, bypass the page cache for\n\
+                                 large files.\n"),
+#endif
     N_("\
        --progress=TYPE           select progress gauge type.\n"),
     N_("\
   -N,  --timestamping            don't re-retrieve files unless newer than\n\
                                  local.\n"),
+    N_("\
+       --no-if-modified-since    with -N, send a HEAD request first instead\n\
+                                 of a conditional GET.\n"),
+    N_("\
+       --manifest                keep a list of the files saved, with their\n\
+                                 validators, for -N and -nc to use.\n"),
+    N_("\
+       --dedup-files             link files with identical contents\n\
+                                 together.\n"),
     N_("\
   --no-use-server-timestamps     don't set the local file's timestamp by\n\
                                  the one on the server.\n"),
@@ -497,6 +595,9 @@ Download:\n"),
   -S,  --server-response         print server response.\n"),
     N_("\
        --spider                  don't download anything.\n"),
+    N_("\
+       --broken-links=FILE       with --spider, list broken links in FILE\n\
+                                 as they are found.\n"),
     N_("\
   -T,  --timeout=SECONDS         set all timeout values to SECONDS.\n"),
     N_("\
@@ -517,10 +618,24 @@ Download:\n"),
   -Q,  --quota=NUMBER            set retrieval quota to NUMBER.\n"),
     N_("\
        --bind-address=ADDRESS    bind to ADDRESS (hostname or IP) on local host.\n"),
+    N_("\
+       --recv-buffer=SIZE        set the socket receive buffer to SIZE.\n"),
+    N_("\
+       --tcp-nodelay             send requests without delay (no Nagle).\n"),
+    N_("\
+       --tcp-fastopen            send requests in the SYN with TCP Fast Open.\n"),
     N_("\
        --limit-rate=RATE         limit download rate to RATE.\n"),
+    N_("\
+       --limit-rate-per-host=RATE  limit download rate from each host to RATE.\n"),
+    N_("\
+       --min-rate=RATE           retry transfers slower than RATE.\n"),
     N_("\
        --no-dns-cache            disable caching DNS lookups.\n"),
+    N_("\
+       --dns-cache-ttl=SECS      keep cached DNS lookups for SECS seconds.\n"),
+    N_("\
+       --dns-cache-file=FILE     load the DNS cache from FILE and save it there.\n"),
     N_("\
        --restrict-file-names=OS  restrict chars in file names to ones OS allows.\n"),
     N_("\
@@ -597,6 +712,30 @@ HTTP options:\n"),
   -U,  --user-agent=AGENT      identify as AGENT instead of Wget/VERSION.\n"),
     N_("\
        --no-http-keep-alive    disable HTTP keep-alive (persistent connections).\n"),
+    N_("\
+       --http-keep-alive-max=NUMBER\n\
+                               keep at most NUMBER idle persistent connections.\n"),
+    N_("\
+       --http-keep-alive-per-host=NUMBER\n\
+                               keep at most NUMBER connections per host.\n"),
+    N_("\
+       --http-keep-alive-timeout=SECS\n\
+                               close persistent connections idle for SECS.\n"),
+    N_("\
+       --pipeline=DEPTH        pipeline up to DEPTH requests on a persistent\n\
+                               connection when retrieving recursively.\n"),
+#ifdef ENABLE_HTTP2
+    N_("\
+       --http2                 use HTTP/2 with HTTPS servers that support it.\n"),
+#endif
+    N_("\
+       --segments=NUMBER       retrieve large files over up to NUMBER\n\
+                               connections at once.\n"),
+#ifdef HAVE_LIBZ
+    N_("\
+       --compression=TYPE      request compressed bodies and decompress\n\
+                               them; TYPE is auto, gzip or none.\n"),
+#endif
     N_("\
        --no-cookies            don't use cookies.\n"),
     N_("\
@@ -605,6 +744,9 @@ HTTP options:\n"),
        --save-cookies=FILE     save cookies to FILE after session.\n"),
     N_("\
        --keep-session-cookies  load and save session (non-permanent) cookies.\n"),
+    N_("\
+       --journal-cookies       append cookie changes to the --save-cookies\n\
+                               file as they happen.\n"),
     N_("\
        --post-data=STRING      use the POST method; send STRING as the data.\n"),
     N_("\
@@ -644,6 +786,12 @@ HTTPS (SSL/TLS) options:\n"),
        --random-file=FILE       file with random data for seeding the SSL PRNG.\n"),
     N_("\
        --egd-file=FILE          file naming the EGD socket with random data.\n"),
+    N_("\
+       --tls-session-file=FILE  keep TLS sessions in FILE for resumption\n\
+                                across runs.\n"),
+    N_("\
+       --ktls                   let the kernel decrypt TLS where it can, so\n\
+                                that files are received without copying.\n"),
     "\n",
 #endif /* HAVE_SSL */
 
@@ -659,6 +807,14 @@ FTP options:\n"),
        --ftp-password=PASS     set ftp password to PASS.\n"),
     N_("\
        --no-remove-listing     don't remove `.listing' files.\n"),
+    N_("\
+       --no-ftp-mlsd           use LIST even if the server supports MLSD.\n"),
+    N_("\
+       --ftp-listing-cache     list each directory only once per run.\n"),
+    N_("\
+       --ftp-connections=NUMBER\n\
+                               retrieve the files of a listing over NUMBER\n\
+                               connections at the same time.\n"),
     N_("\
        --no-glob               turn off FTP file name globbing.\n"),
     N_("\
@@ -681,9 +837,25 @@ WARC options:\n"),
        --warc-cdx                write CDX index files.\n"),
     N_("\
        --warc-dedup=FILENAME     do not store records listed in this CDX file.\n"),
-#ifdef HAVE_LIBZ
+    N_("\
+       --warc-dedup-index=FILENAME  keep an index of the --warc-dedup file\n\
+                                 in FILENAME, to start faster next time.\n"),
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
     N_("\
        --no-warc-compression     do not compress WARC files with GZIP.\n"),
+#ifdef HAVE_LIBZSTD
+    N_("\
+       --warc-compression=zstd[:LEVEL]  compress WARC files with zstd.\n"),
+    N_("\
+       --warc-zstd-dictionary=FILE  compress WARC records with the zstd\n\
+                                 dictionary in FILE.\n"),
+#endif
+    N_("\
+       --warc-compression-level=NUMBER  compress WARC files at level NUMBER\n\
+                                 (0 to 9 for GZIP).\n"),
+    N_("\
+       --warc-compression-threads=NUMBER  compress WARC records in NUMBER\n\
+                                 threads.\n"),
 #endif
     N_("\
        --no-warc-digests         do not calculate SHA1 digests.\n"),
@@ -705,6 +877,9 @@ Recursive download:\n"),
     N_("\
   -k,  --convert-links      make links in downloaded HTML or CSS point to\n\
                             local files.\n"),
+    N_("\
+       --convert-jobs=NUMBER\n\
+                            convert the links of NUMBER files at a time.\n"),
 #ifdef __VMS
     N_("\
   -K,  --backup-converted   before converting file X, back up as X_orig.\n"),
@@ -718,6 +893,25 @@ Recursive download:\n"),
   -p,  --page-requisites    get all images, etc. needed to display HTML page.\n"),
     N_("\
        --strict-comments    turn on strict (SGML) handling of HTML comments.\n"),
+    N_("\
+       --parallel=NUMBER    retrieve up to NUMBER files at the same time.\n"),
+    N_("\
+       --host-connections=NUMBER  of those, at most NUMBER from one host.\n"),
+    N_("\
+       --visited-set=TYPE   remember seen URLs as exact, compact, or bloom.\n"),
+    N_("\
+       --queue-memory=SIZE  keep at most SIZE of queued URLs in memory.\n"),
+    N_("\
+       --max-memory=SIZE    spill the queue to disk when using over SIZE.\n"),
+    N_("\
+       --state-file=FILE    save the crawl state to FILE, resume from it.\n"),
+    N_("\
+       --state-interval=SECS  save the crawl state every SECS seconds.\n"),
+    N_("\
+       --shard=K/N          crawl as shard K of N, retrieving only the\n\
+                            hosts of this shard.\n"),
+    N_("\
+       --shard-spool=DIR    forward links to the other shards through DIR.\n"),
     "\n",
 
     N_("\
@@ -760,6 +954,11 @@ Recursive accept/reject:\n"),
   -X,  --exclude-directories=LIST  list of excluded directories.\n"),
     N_("\
   -np, --no-parent                 don't ascend to the parent directory.\n"),
+    N_("\
+       --robots-cache-file=FILE    cache robots.txt rules in FILE.\n"),
+    N_("\
+       --robots-cache-ttl=SECS     use cached robots.txt rules for SECS seconds\n\
+                                   before revalidating them.\n"),
     "\n",
     N_("Mail bug reports and suggestions to <bug-wget@gnu.org>.\n")
   };
@@ -1298,7 +1497,15 @@ for details.\n\n"));
                      "--continue will be disabled.\n"));
           opt.always_rest = false;
         }
-      if (opt.warc_cdx_dedup_filename != 0 && !opt.warc_digests_enabled)
+      if (opt.http2)
+        {
+          fprintf (stderr,
+                   _("WARC output does not work with --http2, "
+                     "--http2 will be disabled.\n"));
+          opt.http2 = false;
+        }
+      if ((opt.warc_cdx_dedup_filename != 0 || opt.warc_cdx_dedup_index != 0)
+          && !opt.warc_digests_enabled)
         {
           fprintf (stderr,
                    _("Digests are disabled; WARC deduplication will "
@@ -1308,6 +1515,70 @@ for details.\n\n"));
         {
           opt.progress_type = xstrdup ("dot");
         }
+      if (opt.warc_compression_level < 0)
+        opt.warc_compression_level = opt.warc_zstd ? 3 : 9;
+      if (!opt.warc_zstd && opt.warc_compression_level > 9)
+        {
+          fprintf (stderr,
+                   _("--warc-compression-level must be between 0 and 9.\n"));
+          exit (1);
+        }
+      if (opt.warc_zstd && opt.warc_compression_level > 22)
+        {
+          fprintf (stderr,
+                   _("--warc-compression-level must be between 0 and 22 "
+                     "for zstd.\n"));
+          exit (1);
+        }
+      if (opt.parallel > 1)
+        {
+          fprintf (stderr,
+                   _("WARC output does not work with --parallel, "
+                     "--parallel will be disabled.\n"));
+          opt.parallel = 0;
+        }
+      if (opt.ftp_connections > 1)
+        {
+          fprintf (stderr,
+                   _("WARC output does not work with --ftp-connections, "
+                     "--ftp-connections will be disabled.\n"));
+          opt.ftp_connections = 0;
+        }
+    }
+
+#ifdef HAVE_LIBZ
+  if (opt.always_rest && opt.compression != compression_none)
+    {
+      /* A compressed body can't be resumed at the size of the
+         decompressed file.  */
+      if (opt.compression == compression_gzip)
+        fprintf (stderr,
+                 _("--compression does not work with --continue, "
+                   "--compression will be disabled.\n"));
+      opt.compression = compression_none;
+    }
+#endif
+
+  if (opt.shard_count > 1 && !opt.shard_spool)
+    {
+      fprintf (stderr, _("--shard requires --shard-spool.\n"));
+      exit (1);
+    }
+
+  if (opt.parallel > 1 && opt.output_document)
+    {
+      fprintf (stderr,
+               _("--parallel does not work with -O, "
+                 "--parallel will be disabled.\n"));
+      opt.parallel = 0;
+    }
+
+  if (opt.ftp_connections > 1 && opt.output_document)
+    {
+      fprintf (stderr,
+               _("--ftp-connections does not work with -O, "
+                 "--ftp-connections will be disabled.\n"));
+      opt.ftp_connections = 0;
     }
 
   if (opt.ask_passwd && opt.passwd)
@@ -1318,7 +1589,14 @@ for details.\n\n"));
       exit (1);
     }
 
-  if (!nurl && !opt.input_filename)
+  if (opt.daemon_socket && (nurl || opt.input_filename))
+    {
+      fprintf (stderr, _("\
+--daemon takes no URLs; they are sent to it as jobs.\n"));
+      exit (1);
+    }
+
+  if (!nurl && !opt.input_filename && !opt.daemon_socket)
     {
       /* No URL specified.  */
       fprintf (stderr, _("%s: missing URL\n"), exec_name);
@@ -1358,6 +1636,7 @@ for details.\n\n"));
       if (!opt.rejectregex)
         exit (1);
     }
+  compile_acclists ();
 
 #ifdef ENABLE_IRI
   if (opt.enable_iri)
@@ -1427,6 +1706,9 @@ for details.\n\n"));
   if (opt.warc_filename != 0)
     warc_init ();
 
+  if (opt.stats_file)
+    stats_open ();
+
   DEBUGP (("DEBUG output created by Wget %s on %s.\n\n",
            version_string, OS_TYPE));
 
@@ -1507,6 +1789,14 @@ outputting to a regular file.\n"));
 #ifdef SIGUSR1
   signal (SIGUSR1, redirect_output_signal);
 #endif
+#ifdef SIGUSR2
+  /* SIGUSR2 logs the live statistics, and the memory use of a
+     recursive retrieval.  */
+  signal (SIGUSR2, report_signal);
+#endif
+#ifdef SIGINFO
+  signal (SIGINFO, report_signal);
+#endif
 #ifdef SIGPIPE
   /* Writing to a closed socket normally signals SIGPIPE, and the
      process exits.  What we want is to ignore SIGPIPE and just check
@@ -1517,61 +1807,30 @@ outputting to a regular file.\n"));
   signal (SIGWINCH, progress_handle_sigwinch);
 #endif
 
-  /* Retrieve the URLs from argument list.  */
-  for (t = url; *t; t++)
-    {
-      char *filename = NULL, *redirected_URL = NULL;
-      int dt, url_err;
-      /* Need to do a new struct iri every time, because
-       * retrieve_url may modify it in some circumstances,
-       * currently. */
-      struct iri *iri = iri_new ();
-      struct url *url_parsed;
-
-      set_uri_encoding (iri, opt.locale, true);
-      url_parsed = url_parse (*t, &url_err, iri, true);
-
-      if (!url_parsed)
-        {
-          char *error = url_error (*t, url_err);
-          logprintf (LOG_NOTQUIET, "%s: %s.\n",*t, error);
-          xfree (error);
-          inform_exit_status (URLERROR);
-        }
-      else
-        {
-          if ((opt.recursive || opt.page_requisites)
-              && (url_scheme (*t) != SCHEME_FTP || url_uses_proxy (url_parsed)))
-            {
-              int old_follow_ftp = opt.follow_ftp;
+  /* The counters of the live statistics and the bandwidth limits
+     are shared by all transfers, so they must be in place before any
+     worker is forked.  */
+  counters_init ();
+  if (opt.limit_rate || opt.limit_rate_host)
+    limit_bandwidth_init ();
 
-              /* Turn opt.follow_ftp on in case of recursive FTP retrieval */
-              if (url_scheme (*t) == SCHEME_FTP)
-                opt.follow_ftp = 1;
+  /* Likewise, the workers look up the manifest loaded here.  */
+  if (opt.manifest)
+    manifest_load ();
 
-              retrieve_tree (url_parsed, NULL);
+  /* With a single crawl, the links of a document can be converted
+     as soon as it is known which of them are downloaded, rather than
+     all of them at the end.  */
+  if (opt.convert_links && !opt.delete_after
+      && nurl == 1 && !opt.input_filename)
+    convert_incrementally = true;
 
-              opt.follow_ftp = old_follow_ftp;
-            }
-          else
-          {
-            retrieve_url (url_parsed, *t, &filename, &redirected_URL, NULL,
-                          &dt, opt.recursive, iri, true);
-          }
+  /* Retrieve the URLs from argument list.  */
+  if (opt.daemon_socket && !daemon_run (opt.daemon_socket))
+    exit (1);
 
-          if (opt.delete_after && filename != NULL && file_exists_p (filename))
-            {
-              DEBUGP (("Removing file due to --delete-after in main():\n"));
-              logprintf (LOG_VERBOSE, _("Removing %s.\n"), filename);
-              if (unlink (filename))
-                logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
-            }
-          xfree_null (redirected_URL);
-          xfree_null (filename);
-          url_free (url_parsed);
-        }
-      iri_free (iri);
-    }
+  for (t = url; *t; t++)
+    retrieve_from_arg (*t);
 
   /* And then from the input file, if any.  */
   if (opt.input_filename)
@@ -1585,6 +1844,8 @@ outputting to a regular file.\n"));
                    opt.input_filename);
     }
 
+  progress_job_done ();
+
   /* Print broken links. */
   if (opt.recursive && opt.spider)
     print_broken_links ();
@@ -1597,7 +1858,6 @@ outputting to a regular file.\n"));
       total_downloaded_bytes != 0)
     {
       double end_time = ptimer_measure (timer);
-      ptimer_destroy (timer);
 
       char *wall_time = xstrdup (secs_to_human_time (end_time - start_time));
       char *download_time = xstrdup (secs_to_human_time (total_download_time));
@@ -1623,9 +1883,31 @@ outputting to a regular file.\n"));
   if (opt.cookies_output)
     save_cookies ();
 
+  if (opt.dns_cache_file)
+    host_cache_save ();
+
+  if (opt.manifest)
+    manifest_save ();
+
+  if (opt.robots_cache_file)
+    res_cache_save ();
+
+#ifdef HAVE_SSL
+  if (opt.tls_session_file)
+    ssl_session_save ();
+#endif
+
   if (opt.convert_links && !opt.delete_after)
     convert_all_links ();
 
+  /* These come last, so that the conversion is accounted for.  */
+  counters_finish ();
+  if (opt.stats_file)
+    stats_close (ptimer_measure (timer) - start_time);
+  if (opt.phase_timing)
+    timing_print_summary ();
+  ptimer_destroy (timer);
+
   cleanup ();
 
   exit (get_exit_status ());
@@ -1658,6 +1940,19 @@ redirect_output_signal (int sig)
 }
 #endif
 
+#if defined(SIGUSR2) || defined(SIGINFO)
+/* SIGUSR2 and SIGINFO handler: have the live statistics and the
+   memory use logged.  */
+
+static void
+report_signal (int sig)
+{
+  counters_request_report ();
+  memory_request_report ();
+  signal (sig, report_signal);
+}
+#endif
+
 /*
  * vim: et ts=2 sw=2
  */
@@ -0,0 +1,353 @@
+/* Manifest of the local copies of a mirror.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* With --manifest, Wget keeps a file listing, for every URL it has
+   saved, the local file, its size and modification time, the entity
+   tag and Last-Modified date the server sent with it, and the SHA-1
+   digest of its contents.  The manifest is loaded into a hash table
+   at startup and written back at exit.
+
+   -N and -nc trust the manifest about the files it lists: they don't
+   look for them on disk, and -N makes its requests conditional on
+   the server's own validators rather than on the local time-stamp.
+   A file changed or removed behind Wget's back is therefore not
+   noticed until the manifest is removed.
+
+   The manifest is a text file with one entry per line, whose fields
+   are separated by tabs; "-" stands for an unknown entity tag, date
+   or digest.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "hash.h"
+#include "parallel.h"
+#include "manifest.h"
+
+#define MANIFEST_NAME ".wget-manifest"
+
+/* URL -> struct manifest_entry.  */
+static struct hash_table *entries;
+
+/* Whether ENTRIES differs from the manifest file.  */
+static bool dirty;
+
+static char *
+manifest_file (void)
+{
+  return aprintf ("%s/%s", opt.dir_prefix ? opt.dir_prefix : ".",
+                  MANIFEST_NAME);
+}
+
+static void
+free_entry (struct manifest_entry *e)
+{
+  xfree (e->file);
+  xfree_null (e->etag);
+  xfree_null (e->last_modified);
+}
+
+/* Whether S can be written as a field: it must not be empty, nor
+   contain separators.  */
+
+static bool
+field_ok (const char *s)
+{
+  return *s && !strpbrk (s, "\t\r\n");
+}
+
+/* Return the fields of E, except the URL, as a line without the
+   newline, or NULL if they cannot be written.  */
+
+static char *
+entry_string (const struct manifest_entry *e)
+{
+  char digest[MANIFEST_DIGEST_SIZE * 2 + 1] = "-";
+  int i;
+
+  if (!field_ok (e->file)
+      || (e->etag && !field_ok (e->etag))
+      || (e->last_modified && !field_ok (e->last_modified)))
+    return NULL;
+  if (e->has_digest)
+    for (i = 0; i < MANIFEST_DIGEST_SIZE; i++)
+      sprintf (digest + 2 * i, "%02x", e->digest[i]);
+  return aprintf ("%s\t%s\t%s\t%s\t%s\t%s", e->file,
+                  number_to_static_string (e->size),
+                  number_to_static_string ((wgint) e->mtime),
+                  e->etag ? e->etag : "-",
+                  e->last_modified ? e->last_modified : "-", digest);
+}
+
+/* Parse the fields written by entry_string from LINE, which is
+   modified, into E.  */
+
+static bool
+parse_entry (char *line, struct manifest_entry *e)
+{
+  char *field[6];
+  char *end;
+  int i;
+
+  for (i = 0; i < 6; i++)
+    {
+      field[i] = line;
+      line += strcspn (line, "\t\r\n");
+      if ((i < 5) != (*line == '\t'))
+        return false;
+      *line++ = '\0';
+    }
+  if (!*field[0])
+    return false;
+
+  xzero (*e);
+  e->size = str_to_wgint (field[1], &end, 10);
+  if (*end || end == field[1] || e->size < 0)
+    return false;
+  e->mtime = (time_t) str_to_wgint (field[2], &end, 10);
+  if (*end || end == field[2])
+    return false;
+  if (strcmp (field[5], "-"))
+    {
+      if (strlen (field[5]) != 2 * MANIFEST_DIGEST_SIZE)
+        return false;
+      for (i = 0; i < MANIFEST_DIGEST_SIZE; i++)
+        {
+          if (!c_isxdigit (field[5][2 * i])
+              || !c_isxdigit (field[5][2 * i + 1]))
+            return false;
+          e->digest[i] = X2DIGITS_TO_NUM (field[5][2 * i],
+                                          field[5][2 * i + 1]);
+        }
+      e->has_digest = true;
+    }
+  e->file = xstrdup (field[0]);
+  e->etag = strcmp (field[3], "-") ? xstrdup (field[3]) : NULL;
+  e->last_modified = strcmp (field[4], "-") ? xstrdup (field[4]) : NULL;
+  return true;
+}
+
+/* Store E, whose strings are taken over, as the entry of URL.  An
+   existing entry is updated in place, so that pointers to it remain
+   valid.  */
+
+static void
+store_entry (const char *url, struct manifest_entry *e)
+{
+  struct manifest_entry *old;
+
+  if (!entries)
+    entries = make_string_hash_table (0);
+  old = hash_table_get (entries, url);
+  if (old)
+    {
+      free_entry (old);
+      *old = *e;
+    }
+  else
+    {
+      struct manifest_entry *new = xnew (struct manifest_entry);
+      *new = *e;
+      hash_table_put (entries, xstrdup (url), new);
+    }
+  dirty = true;
+}
+
+/* Load the manifest of the output directory, if there is one.  */
+
+void
+manifest_load (void)
+{
+  char *file = manifest_file ();
+  FILE *fp = fopen (file, "r");
+  char *line;
+  int lineno = 0;
+
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot open manifest %s: %s\n"),
+                   quote (file), strerror (errno));
+      xfree (file);
+      return;
+    }
+  while ((line = read_whole_line (fp)) != NULL)
+    {
+      struct manifest_entry e;
+      char *tab = strchr (line, '\t');
+
+      ++lineno;
+      if (*line == '#')
+        {
+          xfree (line);
+          continue;
+        }
+      if (tab)
+        *tab = '\0';
+      if (!tab || !*line || !parse_entry (tab + 1, &e))
+        logprintf (LOG_NOTQUIET, _("%s: Invalid entry at line %d.\n"),
+                   quote (file), lineno);
+      else
+        store_entry (line, &e);
+      xfree (line);
+    }
+  fclose (fp);
+  dirty = false;
+  DEBUGP (("Loaded %d entries from manifest %s.\n",
+           entries ? hash_table_count (entries) : 0, file));
+  xfree (file);
+}
+
+/* Return the entry of URL, or NULL.  */
+
+const struct manifest_entry *
+manifest_lookup (const char *url)
+{
+  return entries ? hash_table_get (entries, url) : NULL;
+}
+
+/* Make E, whose strings are copied, the entry of URL.  Parallel
+   workers forward it to the parent, which saves the manifest.  */
+
+void
+manifest_record (const char *url, const struct manifest_entry *e)
+{
+  struct manifest_entry copy;
+
+  if (parallel_worker_p ())
+    {
+      char *line = entry_string (e);
+      if (line)
+        parallel_forward (PEV_MANIFEST, url, line);
+      xfree_null (line);
+      return;
+    }
+  if (!field_ok (url) || !field_ok (e->file)
+      || (e->etag && !field_ok (e->etag))
+      || (e->last_modified && !field_ok (e->last_modified)))
+    return;
+  copy = *e;
+  copy.file = xstrdup (e->file);
+  copy.etag = e->etag ? xstrdup (e->etag) : NULL;
+  copy.last_modified = e->last_modified ? xstrdup (e->last_modified) : NULL;
+  store_entry (url, &copy);
+}
+
+/* Add the entry of URL forwarded by a parallel worker as LINE.  */
+
+void
+manifest_add (const char *url, const char *line)
+{
+  struct manifest_entry e;
+  char *copy = xstrdup (line);
+
+  if (parse_entry (copy, &e))
+    store_entry (url, &e);
+  xfree (copy);
+}
+
+/* Write the manifest, if it has changed.  A new manifest replaces
+   the old one only once it is complete.  */
+
+void
+manifest_save (void)
+{
+  char *file, *tmp;
+  hash_table_iterator iter;
+  FILE *fp;
+  bool ok;
+
+  if (!dirty || !entries)
+    return;
+  file = manifest_file ();
+  tmp = concat_strings (file, ".tmp", (char *) 0);
+  fp = fopen (tmp, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write manifest %s: %s\n"),
+                 quote (tmp), strerror (errno));
+      xfree (tmp);
+      xfree (file);
+      return;
+    }
+  fputs ("# Wget manifest.  Each line holds a URL, its local file, the\n"
+         "# file's size and modification time, the entity tag and\n"
+         "# Last-Modified date of the remote file, and the SHA-1 digest\n"
+         "# of the contents, separated by tabs.\n", fp);
+  for (hash_table_iterate (entries, &iter); hash_table_iter_next (&iter); )
+    {
+      char *line = entry_string (iter.value);
+      if (line)
+        fprintf (fp, "%s\t%s\n", (char *) iter.key, line);
+      xfree_null (line);
+    }
+  ok = !ferror (fp);
+  if (fclose (fp) != 0)
+    ok = false;
+  if (ok && rename (tmp, file) != 0)
+    ok = false;
+  if (ok)
+    {
+      dirty = false;
+      DEBUGP (("Saved %d entries to manifest %s.\n",
+               hash_table_count (entries), file));
+    }
+  else
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write manifest %s: %s\n"),
+                 quote (file), strerror (errno));
+      unlink (tmp);
+    }
+  xfree (tmp);
+  xfree (file);
+}
+
+void
+manifest_cleanup (void)
+{
+  hash_table_iterator iter;
+
+  if (!entries)
+    return;
+  for (hash_table_iterate (entries, &iter); hash_table_iter_next (&iter); )
+    {
+      free_entry (iter.value);
+      xfree (iter.value);
+      xfree (iter.key);
+    }
+  hash_table_destroy (entries);
+  entries = NULL;
+}
@@ -0,0 +1,55 @@
+/* Declarations for manifest.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#define MANIFEST_DIGEST_SIZE 20
+
+/* What the manifest knows of the local copy of a URL.  */
+struct manifest_entry {
+  char *file;                   /* local file name */
+  wgint size;                   /* its size */
+  time_t mtime;                 /* its modification time */
+  char *etag;                   /* entity tag of the remote file, or NULL */
+  char *last_modified;          /* Last-Modified of the remote file, or
+                                   NULL */
+  bool has_digest;              /* whether DIGEST is known */
+  unsigned char digest[MANIFEST_DIGEST_SIZE]; /* SHA-1 of the contents */
+};
+
+void manifest_load (void);
+const struct manifest_entry *manifest_lookup (const char *);
+void manifest_record (const char *, const struct manifest_entry *);
+void manifest_add (const char *, const char *);
+void manifest_save (void);
+void manifest_cleanup (void);
+
+#endif /* MANIFEST_H */
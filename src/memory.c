@@ -0,0 +1,214 @@
+/* Accounting of memory use.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* Accounting of the memory taken by the parts of Wget that grow with
+   the size of a crawl.  Wget doesn't tag its allocations, so each
+   part estimates its own size from its data structures; the resident
+   size of the process is read from the system where possible.
+
+   With --max-memory, a recursive crawl that goes over the limit
+   spills its queue to disk and switches its blacklist to compact
+   fingerprints (see retrieve_tree).  SIGUSR2 logs a report of the
+   estimates.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "ptimer.h"
+#include "hash.h"
+#include "intern.h"
+#include "convert.h"
+#include "http.h"
+#include "host.h"
+#include "html-url.h"
+#include "recur.h"
+#include "memory.h"
+
+#ifndef MAX
+# define MAX(i, j) ((i) >= (j) ? (i) : (j))
+#endif
+
+/* Seconds between two samples taken by memory_check.  */
+#define MEMORY_CHECK_INTERVAL 1.0
+
+/* Seconds to leave to the measures taken against going over
+   --max-memory before taking them again.  */
+#define MEMORY_ACTION_INTERVAL 30.0
+
+const char *const memory_part_names[MEMORY_COUNT] = {
+  "frontier", "blacklist", "convert", "cookies", "dns", "parser", "strings"
+};
+
+/* The largest value seen of each field, with a resident size of 0 if
+   it is unknown.  */
+static struct memory_usage peak;
+
+/* Set by the SIGUSR2 handler.  */
+static volatile sig_atomic_t report_requested;
+
+static struct ptimer *timer;
+static double last_check, last_action;
+static bool acted;
+
+/* Return the resident size of the process, or -1 if it can't be
+   found out.  */
+
+static wgint
+memory_resident (void)
+{
+#if defined(_SC_PAGESIZE)
+  FILE *fp = fopen ("/proc/self/statm", "r");
+  long size, resident;
+  int n;
+
+  if (!fp)
+    return -1;
+  n = fscanf (fp, "%ld %ld", &size, &resident);
+  fclose (fp);
+  if (n != 2)
+    return -1;
+  return (wgint) resident * sysconf (_SC_PAGESIZE);
+#else
+  return -1;
+#endif
+}
+
+/* Fill in *MU with the current memory use, and update the peak.  */
+
+void
+memory_sample (struct memory_usage *mu)
+{
+  int i;
+
+  recur_memory (&mu->part[MEMORY_FRONTIER], &mu->part[MEMORY_BLACKLIST]);
+  mu->part[MEMORY_CONVERT] = convert_memory ();
+  mu->part[MEMORY_COOKIES] = http_cookies_memory ();
+  mu->part[MEMORY_DNS] = host_cache_memory ();
+  mu->part[MEMORY_PARSER] = link_stream_memory ();
+  mu->part[MEMORY_STRINGS] = intern_memory ();
+  mu->resident = memory_resident ();
+
+  mu->total = 0;
+  for (i = 0; i < MEMORY_COUNT; i++)
+    {
+      mu->total += mu->part[i];
+      peak.part[i] = MAX (peak.part[i], mu->part[i]);
+    }
+  peak.total = MAX (peak.total, mu->total);
+  peak.resident = MAX (peak.resident, mu->resident);
+}
+
+/* Store the peak memory use to *MU.  */
+
+void
+memory_get_peak (struct memory_usage *mu)
+{
+  struct memory_usage now;
+  memory_sample (&now);
+  *mu = peak;
+}
+
+/* Log the memory use in MU.  */
+
+static void
+memory_report (const struct memory_usage *mu)
+{
+  int i;
+
+  logputs (LOG_NOTQUIET, _("Memory use (estimated bytes):\n"));
+  for (i = 0; i < MEMORY_COUNT; i++)
+    logprintf (LOG_NOTQUIET, "  %-10s %s\n", memory_part_names[i],
+               number_to_static_string (mu->part[i]));
+  logprintf (LOG_NOTQUIET, "  %-10s %s\n", "total",
+             number_to_static_string (mu->total));
+  if (mu->resident >= 0)
+    logprintf (LOG_NOTQUIET, _("Resident size: %s bytes.\n"),
+               number_to_static_string (mu->resident));
+}
+
+/* Ask for a report of the memory use to be logged at the next call
+   to memory_check.  Safe to call from a signal handler.  */
+
+void
+memory_request_report (void)
+{
+  report_requested = 1;
+}
+
+/* Sample the memory use if it hasn't been done for a while, log it if
+   a report was asked for, and return whether it is over --max-memory.
+   The resident size is what counts, or the sum of the estimates if it
+   is unknown.  Once true has been returned, false is returned for a
+   while, to give the caller's measures a chance to work.  */
+
+bool
+memory_check (void)
+{
+  struct memory_usage mu;
+  double now;
+  wgint used;
+
+  if (!opt.max_memory && !report_requested)
+    return false;
+  if (!timer)
+    timer = ptimer_new ();
+  now = ptimer_measure (timer);
+  if (!report_requested && now - last_check < MEMORY_CHECK_INTERVAL)
+    return false;
+  last_check = now;
+
+  memory_sample (&mu);
+  if (report_requested)
+    {
+      report_requested = 0;
+      memory_report (&mu);
+    }
+
+  if (!opt.max_memory
+      || (acted && now - last_action < MEMORY_ACTION_INTERVAL))
+    return false;
+  used = mu.resident >= 0 ? mu.resident : (wgint) mu.total;
+  if (used <= opt.max_memory)
+    return false;
+
+  logprintf (LOG_NOTQUIET,
+             _("Memory use of %s bytes is over the limit of %s bytes; "
+               "moving the URL queue to disk.\n"),
+             number_to_static_string (used),
+             number_to_static_string (opt.max_memory));
+  memory_report (&mu);
+  acted = true;
+  last_action = now;
+  return true;
+}
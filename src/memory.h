@@ -0,0 +1,58 @@
+/* Declarations for memory.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+/* The parts of Wget whose memory is accounted for.  */
+enum {
+  MEMORY_FRONTIER,              /* the queue of a recursive crawl */
+  MEMORY_BLACKLIST,             /* the URLs already queued */
+  MEMORY_CONVERT,               /* the tables used by -k */
+  MEMORY_COOKIES,
+  MEMORY_DNS,                   /* the cache of host addresses */
+  MEMORY_PARSER,                /* the documents being parsed */
+  MEMORY_STRINGS,               /* the interned strings */
+  MEMORY_COUNT
+};
+
+struct memory_usage {
+  size_t part[MEMORY_COUNT];    /* estimated bytes of each part */
+  size_t total;                 /* their sum */
+  wgint resident;               /* the resident size, or -1 */
+};
+
+extern const char *const memory_part_names[MEMORY_COUNT];
+
+void memory_sample (struct memory_usage *);
+void memory_get_peak (struct memory_usage *);
+bool memory_check (void);
+void memory_request_report (void);
+
+#endif /* MEMORY_H */
@@ -45,11 +45,19 @@ as that of the covered work.  */
 #include "connect.h"
 #include "url.h"
 #include "ssl.h"
+#include "counters.h"
 
 #ifdef WINDOWS
 # include <w32sock.h>
 #endif
 
+/* Kernel TLS, in OpenSSL 3 on Linux.  It is only of use where bodies
+   can be spliced from the socket, or files sent to it.  */
+#if defined SSL_OP_ENABLE_KTLS && defined BIO_get_ktls_recv \
+  && (defined HAVE_SPLICE || defined HAVE_SENDFILE)
+# define USE_KTLS
+#endif
+
 /* Application-wide SSL context.  This is common to all SSL
    connections.  */
 static SSL_CTX *ssl_ctx;
@@ -154,7 +162,8 @@ key_type_to_ssl_type (enum keyfile_type type)
 }
 
 /* Create an SSL Context and set default paths etc.  Called the first
-   time an HTTP download is attempted.
+   time an HTTPS download is attempted; the context, and with it the
+   trusted certificates, is then shared by all connections.
 
    Returns true on success, false otherwise.  */
 
@@ -207,8 +216,12 @@ ssl_init (void)
   if (!ssl_ctx)
     goto error;
 
+  /* A CA directory is a hashed-dir lookup: OpenSSL reads the
+     certificates it needs from there as it verifies, and caches
+     them in the store.  */
   SSL_CTX_set_default_verify_paths (ssl_ctx);
-  SSL_CTX_load_verify_locations (ssl_ctx, opt.ca_cert, opt.ca_directory);
+  if (opt.ca_cert || opt.ca_directory)
+    SSL_CTX_load_verify_locations (ssl_ctx, opt.ca_cert, opt.ca_directory);
 
   /* SSL_VERIFY_NONE instructs OpenSSL not to abort SSL_connect if the
      certificate is invalid.  We verify the certificate separately in
@@ -253,7 +266,10 @@ ssl_init (void)
 
 struct openssl_transport_context {
   SSL *conn;                    /* SSL connection handle */
+  char *host;                   /* host the session was established with */
   char *last_error;             /* last error printed with openssl_errstr */
+  bool ktls_recv;               /* the kernel decrypts what is received */
+  bool ktls_send;               /* ... and encrypts what is sent */
 };
 
 static int
@@ -297,6 +313,13 @@ openssl_poll (int fd, double timeout, int wait_for, void *arg)
   return select_fd (fd, timeout, wait_for);
 }
 
+static int
+openssl_pending (int fd, void *arg)
+{
+  struct openssl_transport_context *ctx = arg;
+  return SSL_pending (ctx->conn);
+}
+
 static int
 openssl_peek (int fd, char *buf, int bufsize, void *arg)
 {
@@ -367,9 +390,28 @@ openssl_close (int fd, void *arg)
 {
   struct openssl_transport_context *ctx = arg;
   SSL *conn = ctx->conn;
+  SSL_SESSION *session;
+
+  /* Save the session for resumption.  This is done at close rather
+     than after the handshake because TLS 1.3 servers send their
+     session tickets after it.  */
+  session = SSL_get1_session (conn);
+  if (session)
+    {
+      int len = i2d_SSL_SESSION (session, NULL);
+      if (len > 0)
+        {
+          unsigned char *data = xmalloc (len), *p = data;
+          i2d_SSL_SESSION (session, &p);
+          ssl_session_put (ctx->host, data, len);
+          xfree (data);
+        }
+      SSL_SESSION_free (session);
+    }
 
   SSL_shutdown (conn);
   SSL_free (conn);
+  xfree (ctx->host);
   xfree_null (ctx->last_error);
   xfree (ctx);
 
@@ -381,9 +423,43 @@ openssl_close (int fd, void *arg)
 /* openssl_transport is the singleton that describes the SSL transport
    methods provided by this file.  */
 
+/* With kernel TLS, application data can be read straight from the
+   socket, as long as OpenSSL holds none of it.  */
+
+static bool
+openssl_plaintext (int fd, void *arg)
+{
+  struct openssl_transport_context *ctx = arg;
+  return ctx->ktls_recv;
+}
+
+#if defined USE_KTLS && defined HAVE_SENDFILE
+/* With kernel TLS, files can be sent with sendfile too.  */
+
+static int
+openssl_sendfile (int fd, int infd, wgint *offset, int count, void *arg)
+{
+  struct openssl_transport_context *ctx = arg;
+  ossl_ssize_t res;
+
+  if (!ctx->ktls_send)
+    {
+      errno = EOPNOTSUPP;
+      return -1;
+    }
+  res = SSL_sendfile (ctx->conn, infd, *offset, count, 0);
+  if (res > 0)
+    *offset += res;
+  return res;
+}
+#else
+# define openssl_sendfile NULL
+#endif
+
 static struct transport_implementation openssl_transport = {
   openssl_read, openssl_write, openssl_poll,
-  openssl_peek, openssl_errstr, openssl_close
+  openssl_peek, openssl_errstr, openssl_close, openssl_pending,
+  openssl_plaintext, openssl_sendfile
 };
 
 /* Perform the SSL handshake on file descriptor FD, which is assumed
@@ -399,6 +475,9 @@ ssl_connect_wget (int fd, const char *hostname)
 {
   SSL *conn;
   struct openssl_transport_context *ctx;
+  const void *cached;
+  int cached_len;
+  bool offered = false;
 
   DEBUGP (("Initiating SSL handshake.\n"));
 
@@ -424,12 +503,59 @@ ssl_connect_wget (int fd, const char *hostname)
 #endif
   if (!SSL_set_fd (conn, FD_TO_SOCKET (fd)))
     goto error;
+
+  /* Offer the session last established with this host, if any.  */
+  cached = ssl_session_get (hostname, &cached_len);
+  if (cached)
+    {
+      const unsigned char *p = cached;
+      SSL_SESSION *session = d2i_SSL_SESSION (NULL, &p, cached_len);
+      if (session && SSL_set_session (conn, session))
+        offered = true;
+      else
+        ssl_session_forget (hostname);
+      if (session)
+        SSL_SESSION_free (session);
+    }
+
+#if defined ENABLE_HTTP2 && defined HAVE_SSL_SET_ALPN_PROTOS
+  /* Offer HTTP/2, and HTTP/1.1 as the fallback.  */
+  if (opt.http2)
+    SSL_set_alpn_protos (conn, (const unsigned char *) "\x02h2\x08http/1.1",
+                         12);
+#endif
+
+#ifdef USE_KTLS
+  /* Have the kernel do the record layer where it can, so that bodies
+     can be spliced from the socket to the file and files posted with
+     sendfile.  OpenSSL does it
+     itself when the kernel or the cipher doesn't allow it.  */
+  if (opt.ktls)
+    SSL_set_options (conn, SSL_OP_ENABLE_KTLS);
+#endif
+
   SSL_set_connect_state (conn);
   if (SSL_connect (conn) <= 0 || conn->state != SSL_ST_OK)
     goto error;
+  COUNTER_ADD (tls_handshakes, 1);
+  if (SSL_session_reused (conn))
+    COUNTER_ADD (tls_resumed, 1);
+  if (offered)
+    DEBUGP (("TLS session for %s %s.\n", hostname,
+             SSL_session_reused (conn) ? "resumed" : "not resumed"));
 
   ctx = xnew0 (struct openssl_transport_context);
   ctx->conn = conn;
+  ctx->host = xstrdup (hostname);
+#ifdef USE_KTLS
+  if (opt.ktls)
+    {
+      ctx->ktls_recv = BIO_get_ktls_recv (SSL_get_rbio (conn));
+      ctx->ktls_send = BIO_get_ktls_send (SSL_get_wbio (conn));
+      DEBUGP (("Kernel TLS on socket %d: receive %s, send %s.\n", fd,
+               ctx->ktls_recv ? "yes" : "no", ctx->ktls_send ? "yes" : "no"));
+    }
+#endif
 
   /* Register FD with Wget's transport layer, i.e. arrange that our
      functions are used for reading, writing, and polling.  */
@@ -441,6 +567,9 @@ ssl_connect_wget (int fd, const char *hostname)
  error:
   DEBUGP (("SSL handshake failed.\n"));
   print_errors ();
+  /* Don't offer the session again if it was the culprit.  */
+  if (offered)
+    ssl_session_forget (hostname);
   if (conn)
     SSL_free (conn);
   return false;
@@ -503,6 +632,23 @@ pattern_match (const char *pattern, const char *string)
    function always returns 1, but should still be called because it
    warns the user about any problems with the certificate.  */
 
+/* Return true if the server on FD chose HTTP/2 during the handshake.  */
+
+bool
+ssl_http2_p (int fd)
+{
+#if defined ENABLE_HTTP2 && defined HAVE_SSL_SET_ALPN_PROTOS
+  struct openssl_transport_context *ctx = fd_transport_context (fd);
+  const unsigned char *proto;
+  unsigned int len;
+
+  SSL_get0_alpn_selected (ctx->conn, &proto, &len);
+  return len == 2 && !memcmp (proto, "h2", 2);
+#else
+  return false;
+#endif
+}
+
 bool
 ssl_check_certificate (int fd, const char *host)
 {
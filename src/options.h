@@ -37,6 +37,7 @@ struct options
   int ntry;			/* Number of tries per URL */
   bool retry_connrefused;	/* Treat CONNREFUSED as non-fatal. */
   bool background;		/* Whether we should work in background. */
+  char *daemon_socket;		/* The socket --daemon takes jobs on. */
   bool ignore_length;		/* Do we heed content-length at all?  */
   bool recursive;		/* Are we recursive? */
   bool spanhost;		/* Do we span across hosts in
@@ -47,6 +48,29 @@ struct options
   bool no_parent;		/* Restrict access to the parent
 				   directory.  */
   int reclevel;			/* Maximum level of recursion */
+  int parallel;			/* Number of URLs retrieved at the same
+                                   time in recursive mode. */
+  int host_connections;		/* Of those, the number of URLs of a
+                                   single host; 0 for no limit. */
+  enum {
+    visited_exact,
+    visited_compact,
+    visited_bloom
+  } visited_set;		/* How recursion remembers seen URLs. */
+  wgint queue_memory;		/* Memory for the URL queue, beyond
+				   which it spills to disk; 0 for no
+				   limit. */
+  wgint max_memory;		/* Memory beyond which a recursive
+				   crawl cuts down on its own; 0 for
+				   no limit. */
+  char *state_file;		/* Where to checkpoint the crawl. */
+  double state_interval;	/* Seconds between checkpoints. */
+  int shard_index;		/* The shard of the crawl this process
+				   is, counting from 1. */
+  int shard_count;		/* The number of shards; 0 without
+				   --shard. */
+  char *shard_spool;		/* The directory the shards forward
+				   links through. */
   bool dirstruct;		/* Do we build the directory structure
 				  as we go along? */
   bool no_dirstruct;		/* Do we hate dirstruct? */
@@ -65,6 +89,8 @@ struct options
   char *default_page;           /* Alternative default page (index file) */
 
   bool spider;			/* Is Wget in spider mode? */
+  char *broken_links_file;	/* File listing broken links as
+				   they are found. */
 
   char **accepts;		/* List of patterns to accept. */
   char **rejects;		/* List of patterns to reject. */
@@ -90,6 +116,10 @@ struct options
   char **domains;		/* See host.c */
   char **exclude_domains;
   bool dns_cache;		/* whether we cache DNS lookups. */
+  char *dns_cache_file;		/* file the DNS cache is loaded from
+                                   and saved to. */
+  double dns_cache_ttl;		/* how long cached lookups are kept,
+                                   in seconds; 0 for ever. */
 
   char **follow_tags;           /* List of HTML tags to recursively follow. */
   char **ignore_tags;           /* List of HTML tags to ignore if recursing. */
@@ -103,8 +133,16 @@ struct options
   char *warc_filename;		/* WARC output filename */
   char *warc_tempdir;	/* WARC temp dir */
   char *warc_cdx_dedup_filename;	/* CDX file to be used for deduplication. */
+  char *warc_cdx_dedup_index;	/* Index of that file, kept across runs. */
   wgint warc_maxsize;           /* WARC max archive size */
   bool warc_compression_enabled;  /* For GZIP compression. */
+  bool warc_zstd;		/* Compress with zstd instead of GZIP. */
+  char *warc_zstd_dictionary;	/* zstd dictionary for the records. */
+  int warc_compression_level;	/* Compression level, or -1 for the
+                                   default of the format. */
+  int warc_compression_threads;	/* Threads compressing WARC records,
+                                   or 0 to compress as they are
+                                   written. */
   bool warc_digests_enabled;  /* For SHA1 digests. */
   bool warc_cdx_enabled;      /* Create CDX files? */
   bool warc_keep_log;         /* Store the log file in a WARC record. */
@@ -120,11 +158,35 @@ struct options
   bool netrc;			/* Whether to read .netrc. */
   bool ftp_glob;		/* FTP globbing */
   bool ftp_pasv;			/* Passive FTP. */
+  bool ftp_mlsd;		/* Ask for MLSD listings first. */
+  bool ftp_listing_cache;	/* List each FTP directory only once. */
+  int ftp_connections;		/* Number of FTP control connections
+                                   retrieving the files of a listing. */
 
   char *http_user;		/* HTTP username. */
   char *http_passwd;		/* HTTP password. */
   char **user_headers;		/* User-defined header(s). */
   bool http_keep_alive;		/* whether we use keep-alive */
+  int http_keep_alive_max;	/* max. number of cached persistent
+                                   connections */
+  int http_keep_alive_per_host;	/* max. number of cached persistent
+                                   connections to one host */
+  double http_keep_alive_timeout; /* how long an idle persistent
+                                     connection is kept */
+  int pipeline;			/* max. number of requests in flight
+                                   on a persistent connection */
+  bool http2;			/* Speak HTTP/2 with servers that
+                                   choose it? */
+  int segments;			/* max. number of connections one
+                                   file is retrieved over */
+#ifdef HAVE_LIBZ
+  enum {
+    compression_auto,
+    compression_gzip,
+    compression_none
+  } compression;		/* whether to request and decompress
+                                   compressed HTTP bodies */
+#endif
 
   bool use_proxy;		/* Do we use proxy? */
   bool allow_cache;		/* Do we allow server-side caching? */
@@ -143,13 +205,30 @@ struct options
   double wait;			/* The wait period between retrievals. */
   double waitretry;		/* The wait period between retries. - HEH */
   bool use_robots;		/* Do we heed robots.txt? */
+  char *robots_cache_file;	/* file robots.txt specs are cached in */
+  double robots_cache_ttl;	/* how long cached specs are used
+				   without revalidation */
 
   wgint limit_rate;		/* Limit the download rate to this
 				   many bps. */
+  wgint limit_rate_host;	/* Limit the download rate from each
+				   host to this many bps. */
+  wgint min_rate;		/* Give up a transfer slower than this
+				   many bps, to resume it anew. */
+  wgint recv_buffer;		/* Size of the socket receive buffer,
+				   0 for the system default. */
+  bool tcp_fastopen;		/* Send requests in the SYN with TCP
+				   Fast Open. */
+  bool tcp_nodelay;		/* Disable Nagle's algorithm. */
   SUM_SIZE_INT quota;		/* Maximum file size to download and
 				   store. */
 
   bool server_response;		/* Do we print server response? */
+  bool phase_timing;		/* Time the phases of each transfer. */
+  char *stats_file;		/* Write a JSON record of each
+				   retrieval to this file. */
+  char *metrics_file;		/* Keep the live statistics in this
+				   file. */
   bool save_headers;		/* Do we save headers together with
 				   file? */
   bool content_on_error;	/* Do we output the content when the HTTP
@@ -164,6 +243,21 @@ struct options
 #endif
 
   bool timestamping;		/* Whether to use time-stamping. */
+  bool if_modified_since;	/* Whether -N sends a conditional GET
+				   rather than HEAD first. */
+  bool manifest;		/* Whether to keep a manifest of the
+				   local files in dir_prefix. */
+  bool dedup_files;		/* Whether to link identical files
+				   together. */
+  enum {
+    fsync_never,
+    fsync_end,
+    fsync_interval
+  } fsync;			/* When to sync downloaded files to
+				   disk. */
+  bool io_uring;		/* Write files through io_uring? */
+  bool direct_io;		/* With io_uring, write large files
+				   with O_DIRECT? */
 
   bool backup_converted;	/* Do we save pre-converted files as *.orig? */
   bool backups;			/* Are numeric backups made? */
@@ -175,6 +269,8 @@ struct options
 				   NULL. */
   bool convert_links;		/* Will the links be converted
 				   locally? */
+  int convert_jobs;		/* Number of processes converting
+				   links at the end. */
   bool remove_listing;		/* Do we remove .listing files
 				   generated by FTP? */
   bool htmlify;			/* Do we HTML-ify the OS-dependent
@@ -218,6 +314,8 @@ struct options
 
   char *random_file;		/* file with random data to seed the PRNG */
   char *egd_file;		/* file name of the egd daemon socket */
+  char *tls_session_file;	/* file to keep TLS sessions in */
+  bool ktls;			/* let the kernel do TLS if it can */
 #endif /* HAVE_SSL */
 
   bool cookies;			/* whether cookies are used. */
@@ -225,6 +323,8 @@ struct options
   char *cookies_output;		/* file we're saving the cookies to. */
   bool keep_session_cookies;	/* whether session cookies should be
 				   saved and loaded. */
+  bool journal_cookies;		/* whether cookie changes are appended
+				   to cookies_output as they happen. */
 
   char *post_data;		/* POST query string */
   char *post_file_name;		/* File to post */
@@ -0,0 +1,1087 @@
+/* Parallel retrieval of URLs by worker processes.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* This file implements the --parallel option.  Recursive retrieval
+   keeps a single frontier of URLs in the parent process, which hands
+   them out to a pool of worker processes created with fork().  A
+   worker retrieves one URL at a time using retrieve_url and reports
+   the outcome back to the parent.
+
+   The parent remains the sole owner of the data structures consulted
+   by retrieve_tree and convert_all_links: the blacklist, the
+   URL/file maps of convert.c, the set of broken links and the cookie
+   jar.  Whenever code running in a worker would update one of those,
+   it calls parallel_forward instead, and the parent replays the
+   update when it reads the message.  Cookies are additionally relayed
+   to the other workers before they are given their next URL.
+
+   Workers and parent talk over a socketpair using messages of the
+   form [type:1][payload length:4][payload], the payload being a
+   sequence of length-prefixed fields.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_FORK
+# include <unistd.h>
+# include <signal.h>
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <sys/wait.h>
+#endif
+
+#include "parallel.h"
+#include "utils.h"
+#include "url.h"
+#include "retr.h"
+#include "http.h"
+#include "convert.h"
+#include "spider.h"
+#include "iri.h"
+#include "host.h"
+#include "connect.h"
+#include "evloop.h"
+#include "ptimer.h"
+#include "ftp.h"
+#include "timing.h"
+#include "progress.h"
+#include "manifest.h"
+
+#ifdef HAVE_FORK
+
+extern int numurls;
+
+/* Message types.  */
+enum {
+  PMSG_JOB = 'J',		/* parent -> worker: retrieve a URL */
+  PMSG_FTP_JOB = 'F',		/* parent -> worker: retrieve a file
+                                   chosen from an FTP listing */
+  PMSG_COOKIE = 'C',		/* parent -> worker: relayed Set-Cookie */
+  PMSG_EVENT = 'E',		/* worker -> parent: forwarded side effect */
+  PMSG_RESULT = 'R'		/* worker -> parent: retrieval finished */
+};
+
+#define PMSG_HEADER_SIZE 5
+
+struct pmsg {
+  char *data;			/* header followed by payload */
+  int size;			/* bytes used in DATA */
+  int capacity;			/* bytes allocated in DATA */
+  int pos;			/* read position when decoding */
+};
+
+static void
+pmsg_start (struct pmsg *m, int type)
+{
+  DO_REALLOC (m->data, m->capacity, PMSG_HEADER_SIZE, char);
+  m->data[0] = type;
+  m->size = PMSG_HEADER_SIZE;
+  m->pos = PMSG_HEADER_SIZE;
+}
+
+/* Append a field of LEN bytes to M.  A NULL BUF is encoded as a
+   field of length -1.  */
+
+static void
+pmsg_add (struct pmsg *m, const void *buf, int len)
+{
+  int flen = buf ? len : -1;
+  int needed = m->size + sizeof (flen) + (buf ? len : 0);
+  DO_REALLOC (m->data, m->capacity, needed, char);
+  memcpy (m->data + m->size, &flen, sizeof (flen));
+  m->size += sizeof (flen);
+  if (buf)
+    {
+      memcpy (m->data + m->size, buf, len);
+      m->size += len;
+    }
+}
+
+/* Strings are stored with their terminating NUL so that they can be
+   used in place when decoding.  */
+
+static void
+pmsg_add_string (struct pmsg *m, const char *s)
+{
+  pmsg_add (m, s, s ? strlen (s) + 1 : 0);
+}
+
+/* Return a pointer to the next field of M, storing its length to
+   LEN.  Returns NULL for fields encoded from NULL, and for reads past
+   the end of a malformed message.  */
+
+static const char *
+pmsg_get (struct pmsg *m, int *len)
+{
+  int flen;
+  const char *field;
+  if (m->pos + (int) sizeof (flen) > m->size)
+    return NULL;
+  memcpy (&flen, m->data + m->pos, sizeof (flen));
+  m->pos += sizeof (flen);
+  if (flen < 0 || m->pos + flen > m->size)
+    return NULL;
+  field = m->data + m->pos;
+  m->pos += flen;
+  if (len)
+    *len = flen;
+  return field;
+}
+
+static const char *
+pmsg_get_string (struct pmsg *m)
+{
+  int len;
+  const char *s = pmsg_get (m, &len);
+  if (!s || len == 0 || s[len - 1] != '\0')
+    return NULL;
+  return s;
+}
+
+/* Copy the next field of M to BUF, which is SIZE bytes long.  The
+   destination is zeroed if the field is missing.  */
+
+static void
+pmsg_get_value (struct pmsg *m, void *buf, int size)
+{
+  int len;
+  const char *field = pmsg_get (m, &len);
+  if (field && len == size)
+    memcpy (buf, field, size);
+  else
+    memset (buf, 0, size);
+}
+
+static int
+pmsg_type (const struct pmsg *m)
+{
+  return m->data[0];
+}
+
+static bool
+write_all (int fd, const char *buf, int len)
+{
+  while (len > 0)
+    {
+      int ret = write (fd, buf, len);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return false;
+      buf += ret;
+      len -= ret;
+    }
+  return true;
+}
+
+static bool
+read_all (int fd, char *buf, int len)
+{
+  while (len > 0)
+    {
+      int ret = read (fd, buf, len);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return false;
+      buf += ret;
+      len -= ret;
+    }
+  return true;
+}
+
+static bool
+pmsg_send (int fd, struct pmsg *m)
+{
+  int len = m->size - PMSG_HEADER_SIZE;
+  memcpy (m->data + 1, &len, sizeof (len));
+  return write_all (fd, m->data, m->size);
+}
+
+/* Read a whole message from FD into M.  Returns false on EOF or
+   error.  */
+
+static bool
+pmsg_recv (int fd, struct pmsg *m)
+{
+  int len;
+  DO_REALLOC (m->data, m->capacity, PMSG_HEADER_SIZE, char);
+  if (!read_all (fd, m->data, PMSG_HEADER_SIZE))
+    return false;
+  memcpy (&len, m->data + 1, sizeof (len));
+  if (len < 0)
+    return false;
+  DO_REALLOC (m->data, m->capacity, PMSG_HEADER_SIZE + len, char);
+  if (!read_all (fd, m->data + PMSG_HEADER_SIZE, len))
+    return false;
+  m->size = PMSG_HEADER_SIZE + len;
+  m->pos = PMSG_HEADER_SIZE;
+  return true;
+}
+
+/* Worker side.  */
+
+/* The worker's end of the socketpair, or -1 in the parent.  */
+static int worker_fd = -1;
+
+/* Return true if we are running in a parallel worker.  */
+
+bool
+parallel_worker_p (void)
+{
+  return worker_fd != -1;
+}
+
+/* Forward the side effect EV with arguments A and B to the
+   parent.  */
+
+void
+parallel_forward (enum parallel_event ev, const char *a, const char *b)
+{
+  struct pmsg m;
+  int code = ev;
+  xzero (m);
+  pmsg_start (&m, PMSG_EVENT);
+  pmsg_add (&m, &code, sizeof (code));
+  pmsg_add_string (&m, a);
+  pmsg_add_string (&m, b);
+  if (!pmsg_send (worker_fd, &m))
+    DEBUGP (("Failed to forward event %d to parent: %s\n",
+             ev, strerror (errno)));
+  xfree (m.data);
+}
+
+/* Forward a Set-Cookie header received from HOST:PORT for PATH.  */
+
+void
+parallel_forward_cookie (const char *host, int port, const char *path,
+                         const char *set_cookie)
+{
+  struct pmsg m;
+  int code = PEV_SET_COOKIE;
+  int port32 = port;
+  xzero (m);
+  pmsg_start (&m, PMSG_EVENT);
+  pmsg_add (&m, &code, sizeof (code));
+  pmsg_add_string (&m, host);
+  pmsg_add_string (&m, path);
+  pmsg_add_string (&m, set_cookie);
+  pmsg_add (&m, &port32, sizeof (port32));
+  if (!pmsg_send (worker_fd, &m))
+    DEBUGP (("Failed to forward cookie to parent: %s\n", strerror (errno)));
+  xfree (m.data);
+}
+
+/* Forward LINK, found in the document at BASE with FLAGS, to the
+   parent while the document is still being downloaded.  */
+
+void
+parallel_forward_link (const char *base, const char *link, int flags)
+{
+  struct pmsg m;
+  int code = PEV_LINK;
+  xzero (m);
+  pmsg_start (&m, PMSG_EVENT);
+  pmsg_add (&m, &code, sizeof (code));
+  pmsg_add_string (&m, base);
+  pmsg_add_string (&m, link);
+  pmsg_add (&m, &flags, sizeof (flags));
+  if (!pmsg_send (worker_fd, &m))
+    DEBUGP (("Failed to forward link to parent: %s\n", strerror (errno)));
+  xfree (m.data);
+}
+
+/* Forward the change EV, with arguments A and B, of the totals shown
+   by the aggregate progress display to the parent.  */
+
+void
+parallel_forward_progress (int ev, wgint a, wgint b)
+{
+  struct pmsg m;
+  int code = PEV_PROGRESS;
+  xzero (m);
+  pmsg_start (&m, PMSG_EVENT);
+  pmsg_add (&m, &code, sizeof (code));
+  pmsg_add_string (&m, NULL);
+  pmsg_add_string (&m, NULL);
+  pmsg_add (&m, &ev, sizeof (ev));
+  pmsg_add (&m, &a, sizeof (a));
+  pmsg_add (&m, &b, sizeof (b));
+  if (!pmsg_send (worker_fd, &m))
+    DEBUGP (("Failed to forward progress to parent: %s\n",
+             strerror (errno)));
+  xfree (m.data);
+}
+
+/* Totals of the worker before a job, so that the job's share can be
+   reported to the parent.  */
+struct worker_totals {
+  SUM_SIZE_INT bytes;
+  double dltime;
+  int urls;
+  struct timing_totals timing;
+};
+
+static void
+worker_totals_start (struct worker_totals *t)
+{
+  t->bytes = total_downloaded_bytes;
+  t->dltime = total_download_time;
+  t->urls = numurls;
+  timing_get_totals (&t->timing);
+}
+
+/* Report the result of a job to the parent.  */
+
+static void
+worker_send_result (const struct worker_totals *t, uerr_t status, int dt,
+                    const char *file, const char *redirected,
+                    const char *content_encoding)
+{
+  SUM_SIZE_INT bytes = total_downloaded_bytes - t->bytes;
+  double dltime = total_download_time - t->dltime;
+  int urls = numurls - t->urls, status32 = status, dt32 = dt;
+  struct timing_totals timing;
+  struct pmsg reply;
+
+  timing_get_totals (&timing);
+  xzero (reply);
+  pmsg_start (&reply, PMSG_RESULT);
+  pmsg_add (&reply, &status32, sizeof (status32));
+  pmsg_add (&reply, &dt32, sizeof (dt32));
+  pmsg_add_string (&reply, file);
+  pmsg_add_string (&reply, redirected);
+  pmsg_add_string (&reply, content_encoding);
+  pmsg_add (&reply, &bytes, sizeof (bytes));
+  pmsg_add (&reply, &dltime, sizeof (dltime));
+  pmsg_add (&reply, &urls, sizeof (urls));
+  pmsg_add (&reply, &t->timing, sizeof (t->timing));
+  pmsg_add (&reply, &timing, sizeof (timing));
+  if (!pmsg_send (worker_fd, &reply))
+    {
+      logflush ();
+      _exit (1);
+    }
+  xfree (reply.data);
+}
+
+/* Retrieve the URL described by the PMSG_JOB message M and report the
+   result.  */
+
+static void
+worker_run_job (struct pmsg *m)
+{
+  const char *url = pmsg_get_string (m);
+  const char *referer = pmsg_get_string (m);
+  const char *uri_encoding = pmsg_get_string (m);
+  const char *content_encoding = pmsg_get_string (m);
+  bool utf8_encode;
+  struct iri *i = iri_new ();
+  struct url *url_parsed;
+  int url_err, dt = 0;
+  char *file = NULL, *redirected = NULL;
+  uerr_t status = URLERROR;
+  struct worker_totals totals;
+
+  worker_totals_start (&totals);
+  pmsg_get_value (m, &utf8_encode, sizeof (utf8_encode));
+  i->uri_encoding = uri_encoding ? xstrdup (uri_encoding) : NULL;
+  i->content_encoding = content_encoding ? xstrdup (content_encoding) : NULL;
+  i->utf8_encode = utf8_encode;
+
+  if (url)
+    {
+      url_parsed = url_parse (url, &url_err, i, true);
+      if (url_parsed)
+        {
+          status = retrieve_url (url_parsed, url, &file, &redirected,
+                                 referer, &dt, false, i, false);
+          url_free (url_parsed);
+        }
+    }
+
+  worker_send_result (&totals, status, dt, file, redirected,
+                      i->content_encoding);
+
+  xfree_null (file);
+  xfree_null (redirected);
+  iri_free (i);
+}
+
+/* Retrieve the FTP file described by the PMSG_FTP_JOB message M and
+   report the result.  */
+
+static void
+worker_run_ftp_job (struct pmsg *m)
+{
+  const char *url = pmsg_get_string (m);
+  wgint size = 0;
+  struct url *url_parsed = NULL;
+  int url_err, dt = 0;
+  char *file = NULL;
+  uerr_t status = URLERROR;
+  struct worker_totals totals;
+
+  worker_totals_start (&totals);
+  pmsg_get_value (m, &size, sizeof (size));
+
+  if (url)
+    url_parsed = url_parse (url, &url_err, NULL, true);
+  if (url_parsed)
+    {
+      status = ftp_retrieve_file (url_parsed, size, &file, &dt);
+      url_free (url_parsed);
+    }
+
+  worker_send_result (&totals, status, dt, file, NULL, NULL);
+  xfree_null (file);
+}
+
+/* Main loop of a worker: serve jobs until the parent closes its end
+   of the socketpair.  */
+
+static void
+worker_loop (void)
+{
+  struct pmsg m;
+  xzero (m);
+
+  while (pmsg_recv (worker_fd, &m))
+    {
+      switch (pmsg_type (&m))
+        {
+        case PMSG_COOKIE:
+          {
+            const char *host = pmsg_get_string (&m);
+            const char *path = pmsg_get_string (&m);
+            const char *set_cookie = pmsg_get_string (&m);
+            int port;
+            pmsg_get_value (&m, &port, sizeof (port));
+            if (host && path && set_cookie)
+              http_set_cookie (host, port, path, set_cookie);
+          }
+          break;
+        case PMSG_JOB:
+          worker_run_job (&m);
+          break;
+        case PMSG_FTP_JOB:
+          worker_run_ftp_job (&m);
+          break;
+        default:
+          DEBUGP (("Worker %ld: unexpected message type %d.\n",
+                   (long) getpid (), pmsg_type (&m)));
+          break;
+        }
+    }
+
+  /* Skip atexit handlers and stdio buffers inherited from the
+     parent.  */
+  logflush ();
+  _exit (0);
+}
+
+/* Parent side.  */
+
+struct worker {
+  pid_t pid;
+  int fd;			/* parent's end of the socketpair, -1
+                                   once the worker is gone */
+  bool busy;			/* whether a job has been handed out */
+  bool ready;			/* whether FD has become readable */
+  void *closure;		/* caller's data for the current job */
+  int cookies_sent;		/* number of relayed cookies sent */
+};
+
+struct parallel_pool {
+  struct worker *workers;
+  int count;
+  struct evloop *loop;		/* watches the sockets of busy workers */
+  parallel_link_fn link_hook;	/* called for PEV_LINK events */
+  void *link_hook_arg;
+  struct ptimer *clock;		/* measures the wakeup time */
+  double wakeup;		/* when parallel_wait should return at
+                                   the latest, or -1 */
+};
+
+/* Set-Cookie messages received from workers, ready to be relayed to
+   the others as PMSG_COOKIE messages.  */
+struct relayed_cookie {
+  struct pmsg msg;
+  int origin;			/* index of the worker that sent it */
+};
+
+static struct relayed_cookie *relayed_cookies;
+static int relayed_count, relayed_size;
+
+/* Create a pool of COUNT workers.  Returns NULL if no worker could be
+   started, in which case the caller should retrieve serially.  */
+
+struct parallel_pool *
+parallel_pool_new (int count)
+{
+  struct parallel_pool *pool = xnew0 (struct parallel_pool);
+  int i;
+
+  pool->workers = xnew_array (struct worker, count);
+
+  /* Children must not share the parent's keep-alive connection nor
+     repeat its buffered output.  */
+  http_close_persistent ();
+  logflush ();
+  fflush (stdout);
+
+  for (i = 0; i < count; i++)
+    {
+      int sv[2];
+      pid_t pid;
+
+      if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        {
+          logprintf (LOG_NOTQUIET, _("Cannot create worker socket: %s\n"),
+                     strerror (errno));
+          break;
+        }
+      pid = fork ();
+      if (pid < 0)
+        {
+          logprintf (LOG_NOTQUIET, _("Cannot start worker process: %s\n"),
+                     strerror (errno));
+          close (sv[0]);
+          close (sv[1]);
+          break;
+        }
+      if (pid == 0)
+        {
+          int j;
+          for (j = 0; j < pool->count; j++)
+            close (pool->workers[j].fd);
+          close (sv[0]);
+          worker_fd = sv[1];
+          worker_loop ();
+          /* not reached */
+        }
+      close (sv[1]);
+      xzero (pool->workers[i]);
+      pool->workers[i].pid = pid;
+      pool->workers[i].fd = sv[0];
+      pool->count++;
+    }
+
+  if (!pool->count)
+    {
+      xfree (pool->workers);
+      xfree (pool);
+      return NULL;
+    }
+  pool->loop = evloop_new ();
+  pool->clock = ptimer_new ();
+  pool->wakeup = -1;
+  DEBUGP (("Started %d parallel workers, waiting with %s.\n", pool->count,
+           evloop_backend (pool->loop)));
+  return pool;
+}
+
+static void
+worker_close (struct parallel_pool *pool, struct worker *w)
+{
+  if (w->fd < 0)
+    return;
+  evloop_unwatch (pool->loop, w->fd);
+  close (w->fd);
+  w->fd = -1;
+  while (waitpid (w->pid, NULL, 0) < 0 && errno == EINTR)
+    ;
+}
+
+/* Shut down the workers of POOL, waiting for jobs in progress to
+   finish.  Their results are discarded.  */
+
+void
+parallel_pool_delete (struct parallel_pool *pool)
+{
+  int i;
+  for (i = 0; i < pool->count; i++)
+    worker_close (pool, &pool->workers[i]);
+  evloop_delete (pool->loop);
+  ptimer_destroy (pool->clock);
+  xfree (pool->workers);
+  xfree (pool);
+
+  for (i = 0; i < relayed_count; i++)
+    xfree (relayed_cookies[i].msg.data);
+  xfree_null (relayed_cookies);
+  relayed_cookies = NULL;
+  relayed_count = relayed_size = 0;
+}
+
+/* Return the number of workers waiting for a job.  */
+
+int
+parallel_idle (const struct parallel_pool *pool)
+{
+  int i, idle = 0;
+  for (i = 0; i < pool->count; i++)
+    if (pool->workers[i].fd >= 0 && !pool->workers[i].busy)
+      ++idle;
+  return idle;
+}
+
+/* Send the cookies W hasn't seen yet.  */
+
+static bool
+relay_cookies (struct parallel_pool *pool, struct worker *w)
+{
+  for (; w->cookies_sent < relayed_count; w->cookies_sent++)
+    {
+      struct relayed_cookie *rc = &relayed_cookies[w->cookies_sent];
+      if (rc->origin == w - pool->workers)
+        continue;
+      if (!pmsg_send (w->fd, &rc->msg))
+        return false;
+    }
+  return true;
+}
+
+/* Called by the event loop when the socket of a busy worker becomes
+   readable.  */
+
+static void
+worker_readable (int fd, int events, void *arg)
+{
+  struct worker *w = arg;
+  w->ready = true;
+}
+
+/* Hand the job message M to an idle worker, remembering CLOSURE.
+   Frees the contents of M.  */
+
+static bool
+submit_job (struct parallel_pool *pool, struct pmsg *m, void *closure)
+{
+  bool submitted = false;
+  int i;
+
+  for (i = 0; i < pool->count && !submitted; i++)
+    {
+      struct worker *w = &pool->workers[i];
+      if (w->fd < 0 || w->busy)
+        continue;
+      if (!relay_cookies (pool, w) || !pmsg_send (w->fd, m)
+          || !evloop_watch (pool->loop, w->fd, WAIT_FOR_READ,
+                            worker_readable, w))
+        {
+          logprintf (LOG_NOTQUIET, _("Lost worker process %ld.\n"),
+                     (long) w->pid);
+          worker_close (pool, w);
+          continue;
+        }
+      w->busy = true;
+      w->closure = closure;
+      submitted = true;
+    }
+
+  xfree (m->data);
+  return submitted;
+}
+
+/* Hand URL, with REFERER and IRI, to an idle worker.  CLOSURE will be
+   returned with the result.  Returns false if no worker could accept
+   the job.  */
+
+bool
+parallel_submit (struct parallel_pool *pool, const char *url,
+                 const char *referer, struct iri *iri, void *closure)
+{
+  struct pmsg m;
+
+  xzero (m);
+  pmsg_start (&m, PMSG_JOB);
+  pmsg_add_string (&m, url);
+  pmsg_add_string (&m, referer);
+  pmsg_add_string (&m, iri->uri_encoding);
+  pmsg_add_string (&m, iri->content_encoding);
+  pmsg_add (&m, &iri->utf8_encode, sizeof (iri->utf8_encode));
+  return submit_job (pool, &m, closure);
+}
+
+/* Like parallel_submit, but have the worker retrieve URL with
+   ftp_retrieve_file, as a plain file of SIZE bytes.  */
+
+bool
+parallel_submit_ftp (struct parallel_pool *pool, const char *url, wgint size,
+                     void *closure)
+{
+  struct pmsg m;
+
+  xzero (m);
+  pmsg_start (&m, PMSG_FTP_JOB);
+  pmsg_add_string (&m, url);
+  pmsg_add (&m, &size, sizeof (size));
+  return submit_job (pool, &m, closure);
+}
+
+/* Have HOOK called, with ARG, for the links that workers find in
+   HTML documents while they are downloading them.  */
+
+void
+parallel_set_link_hook (struct parallel_pool *pool, parallel_link_fn hook,
+                        void *arg)
+{
+  pool->link_hook = hook;
+  pool->link_hook_arg = arg;
+}
+
+/* Make the next parallel_wait on POOL return after SECONDS, with a
+   NULL closure, if no job has finished by then.  */
+
+void
+parallel_set_wakeup (struct parallel_pool *pool, double seconds)
+{
+  pool->wakeup = ptimer_measure (pool->clock) + seconds;
+}
+
+/* Replay the side effect described by the PMSG_EVENT message M,
+   received from worker number ORIGIN of POOL.  Returns true if a
+   link event made the link hook enqueue something.  */
+
+static bool
+handle_event (struct parallel_pool *pool, struct pmsg *m, int origin)
+{
+  int code;
+  const char *a, *b;
+  bool enqueued = false;
+
+  pmsg_get_value (m, &code, sizeof (code));
+  a = pmsg_get_string (m);
+  b = pmsg_get_string (m);
+  if (code == PEV_PROGRESS)
+    {
+      int ev;
+      wgint va, vb;
+      pmsg_get_value (m, &ev, sizeof (ev));
+      pmsg_get_value (m, &va, sizeof (va));
+      pmsg_get_value (m, &vb, sizeof (vb));
+      progress_job_update ((enum progress_job_event) ev, va, vb);
+      return false;
+    }
+  if (!a)
+    return false;
+
+  switch (code)
+    {
+    case PEV_REGISTER_DOWNLOAD:
+      if (b)
+        register_download (a, b);
+      break;
+    case PEV_REGISTER_REDIRECTION:
+      if (b)
+        register_redirection (a, b);
+      break;
+    case PEV_REGISTER_HTML:
+      register_html (a);
+      break;
+    case PEV_REGISTER_CSS:
+      register_css (a);
+      break;
+    case PEV_REGISTER_DELETE_FILE:
+      register_delete_file (a);
+      break;
+    case PEV_DOWNLOADED_FILE:
+      if (b)
+        downloaded_file ((downloaded_file_t) atoi (b), a);
+      break;
+    case PEV_NONEXISTING_URL:
+      nonexisting_url (a);
+      break;
+    case PEV_DNS_CACHE:
+      if (b)
+        host_cache_add (a, b);
+      break;
+    case PEV_MANIFEST:
+      if (b)
+        manifest_add (a, b);
+      break;
+    case PEV_LINK:
+      {
+        struct worker *w = &pool->workers[origin];
+        int flags;
+        pmsg_get_value (m, &flags, sizeof (flags));
+        if (b && pool->link_hook && w->closure)
+          {
+            double task_start = timing_task_begin ();
+            enqueued = pool->link_hook (w->closure, a, b, flags,
+                                        pool->link_hook_arg);
+            timing_task_end (TASK_QUEUE, task_start);
+          }
+      }
+      break;
+    case PEV_SET_COOKIE:
+      {
+        const char *set_cookie = pmsg_get_string (m);
+        int port;
+        struct relayed_cookie *rc;
+
+        pmsg_get_value (m, &port, sizeof (port));
+        if (!b || !set_cookie)
+          break;
+        http_set_cookie (a, port, b, set_cookie);
+
+        if (relayed_count >= relayed_size)
+          {
+            relayed_size = relayed_size ? relayed_size * 2 : 16;
+            relayed_cookies = xrealloc (relayed_cookies,
+                                        relayed_size * sizeof *relayed_cookies);
+          }
+        rc = &relayed_cookies[relayed_count++];
+        xzero (*rc);
+        rc->origin = origin;
+        pmsg_start (&rc->msg, PMSG_COOKIE);
+        pmsg_add_string (&rc->msg, a);
+        pmsg_add_string (&rc->msg, b);
+        pmsg_add_string (&rc->msg, set_cookie);
+        pmsg_add (&rc->msg, &port, sizeof (port));
+      }
+      break;
+    default:
+      DEBUGP (("Ignoring unknown event %d from worker.\n", (int) code));
+      break;
+    }
+  return enqueued;
+}
+
+static char *
+dup_or_null (const char *s)
+{
+  return s ? xstrdup (s) : NULL;
+}
+
+/* Wait until a worker finishes its job and store the outcome to
+   RESULT, replaying any side effects reported in the meantime.
+   Returns false if no job is in progress.  */
+
+bool
+parallel_wait (struct parallel_pool *pool, struct parallel_result *result)
+{
+  struct pmsg m;
+  double wakeup = pool->wakeup;
+  xzero (m);
+  pool->wakeup = -1;
+
+  while (1)
+    {
+      int i, busy = 0;
+      double maxtime = -1;
+
+      for (i = 0; i < pool->count; i++)
+        if (pool->workers[i].fd >= 0 && pool->workers[i].busy)
+          ++busy;
+      if (!busy)
+        {
+          xfree_null (m.data);
+          return false;
+        }
+
+      if (wakeup >= 0)
+        {
+          maxtime = wakeup - ptimer_measure (pool->clock);
+          if (maxtime <= 0)
+            {
+              xzero (*result);
+              xfree_null (m.data);
+              return true;
+            }
+        }
+
+      if (evloop_run_once (pool->loop, maxtime) < 0)
+        {
+          logprintf (LOG_NOTQUIET, "evloop: %s\n", strerror (errno));
+          abort ();
+        }
+
+      for (i = 0; i < pool->count; i++)
+        {
+          struct worker *w = &pool->workers[i];
+          if (w->fd < 0 || !w->busy || !w->ready)
+            continue;
+          w->ready = false;
+
+          xzero (*result);
+          if (!pmsg_recv (w->fd, &m))
+            {
+              logprintf (LOG_NOTQUIET, _("Lost worker process %ld.\n"),
+                         (long) w->pid);
+              worker_close (pool, w);
+              w->busy = false;
+              result->closure = w->closure;
+              result->lost = true;
+              xfree_null (m.data);
+              return true;
+            }
+
+          if (pmsg_type (&m) == PMSG_EVENT)
+            {
+              /* Let the caller hand out new work right away rather
+                 than when the next job finishes.  */
+              if (handle_event (pool, &m, i) && parallel_idle (pool) > 0)
+                {
+                  xfree_null (m.data);
+                  return true;
+                }
+              continue;
+            }
+          if (pmsg_type (&m) == PMSG_RESULT)
+            {
+              int status, dt, urls;
+              SUM_SIZE_INT bytes;
+              double dltime;
+              struct timing_totals timing_before, timing;
+
+              pmsg_get_value (&m, &status, sizeof (status));
+              pmsg_get_value (&m, &dt, sizeof (dt));
+              result->file = dup_or_null (pmsg_get_string (&m));
+              result->newloc = dup_or_null (pmsg_get_string (&m));
+              result->content_encoding = dup_or_null (pmsg_get_string (&m));
+              pmsg_get_value (&m, &bytes, sizeof (bytes));
+              pmsg_get_value (&m, &dltime, sizeof (dltime));
+              pmsg_get_value (&m, &urls, sizeof (urls));
+              pmsg_get_value (&m, &timing_before, sizeof (timing_before));
+              pmsg_get_value (&m, &timing, sizeof (timing));
+
+              result->status = (uerr_t) status;
+              result->dt = dt;
+              result->closure = w->closure;
+              total_downloaded_bytes += bytes;
+              total_download_time += dltime;
+              numurls += urls;
+              timing_add_totals (&timing, &timing_before);
+
+              evloop_unwatch (pool->loop, w->fd);
+              w->busy = false;
+              w->closure = NULL;
+              xfree_null (m.data);
+              return true;
+            }
+          DEBUGP (("Unexpected message type %d from worker %ld.\n",
+                   pmsg_type (&m), (long) w->pid));
+        }
+    }
+}
+
+#else /* not HAVE_FORK */
+
+/* Without fork(), --parallel has no effect and everything is
+   retrieved by the main process.  */
+
+bool
+parallel_worker_p (void)
+{
+  return false;
+}
+
+void
+parallel_forward (enum parallel_event ev, const char *a, const char *b)
+{
+  abort ();
+}
+
+void
+parallel_forward_cookie (const char *host, int port, const char *path,
+                         const char *set_cookie)
+{
+  abort ();
+}
+
+void
+parallel_forward_link (const char *base, const char *link, int flags)
+{
+  abort ();
+}
+
+void
+parallel_forward_progress (int ev, wgint a, wgint b)
+{
+  abort ();
+}
+
+struct parallel_pool *
+parallel_pool_new (int count)
+{
+  logputs (LOG_VERBOSE,
+           _("Parallel retrieval is not supported on this system.\n"));
+  return NULL;
+}
+
+void
+parallel_pool_delete (struct parallel_pool *pool)
+{
+}
+
+int
+parallel_idle (const struct parallel_pool *pool)
+{
+  return 0;
+}
+
+bool
+parallel_submit (struct parallel_pool *pool, const char *url,
+                 const char *referer, struct iri *iri, void *closure)
+{
+  return false;
+}
+
+bool
+parallel_submit_ftp (struct parallel_pool *pool, const char *url, wgint size,
+                     void *closure)
+{
+  return false;
+}
+
+bool
+parallel_wait (struct parallel_pool *pool, struct parallel_result *result)
+{
+  return false;
+}
+
+void
+parallel_set_wakeup (struct parallel_pool *pool, double seconds)
+{
+}
+
+void
+parallel_set_link_hook (struct parallel_pool *pool, parallel_link_fn hook,
+                        void *arg)
+{
+}
+
+#endif /* not HAVE_FORK */
@@ -0,0 +1,102 @@
+/* Declarations for parallel.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+struct iri;
+struct parallel_pool;		/* forward declaration; all struct
+                                   members are private */
+
+/* Result of a retrieval performed by a worker, as returned by
+   parallel_wait.  FILE, NEWLOC and CONTENT_ENCODING are malloc'ed
+   and owned by the caller.  A NULL CLOSURE means that no retrieval
+   finished, but the link hook has enqueued URLs that an idle worker
+   could take, or the time given to parallel_set_wakeup is up.  */
+struct parallel_result {
+  void *closure;		/* the value passed to parallel_submit */
+  bool lost;			/* the worker died before reporting;
+                                   nothing else is meaningful */
+  uerr_t status;		/* return value of retrieve_url */
+  int dt;			/* document type flags */
+  char *file;			/* local file name, or NULL */
+  char *newloc;			/* final URL after redirections */
+  char *content_encoding;	/* charset found by the worker */
+};
+
+/* Side effects of a retrieval that workers forward to the parent,
+   which owns the corresponding registries.  */
+enum parallel_event {
+  PEV_REGISTER_DOWNLOAD,	/* register_download (URL, FILE) */
+  PEV_REGISTER_REDIRECTION,	/* register_redirection (FROM, TO) */
+  PEV_REGISTER_HTML,		/* register_html (FILE) */
+  PEV_REGISTER_CSS,		/* register_css (FILE) */
+  PEV_REGISTER_DELETE_FILE,	/* register_delete_file (FILE) */
+  PEV_DOWNLOADED_FILE,		/* downloaded_file (MODE, FILE) */
+  PEV_NONEXISTING_URL,		/* nonexisting_url (URL) */
+  PEV_SET_COOKIE,		/* Set-Cookie received from a server */
+  PEV_DNS_CACHE,		/* host_cache_add (HOST, ENTRY) */
+  PEV_MANIFEST,			/* manifest_add (URL, ENTRY) */
+  PEV_LINK,			/* link found before the job finished */
+  PEV_PROGRESS			/* progress_job_update (EV, A, B) */
+};
+
+/* Flags describing a link passed to the link hook.  */
+enum {
+  PLINK_RELATIVE = 1,		/* link_relative_p */
+  PLINK_INLINE = 2,		/* link_inline_p */
+  PLINK_EXPECT_HTML = 4,	/* link_expect_html */
+  PLINK_EXPECT_CSS = 8		/* link_expect_css */
+};
+
+/* Called in the parent with the closure of a job whose HTML is still
+   being downloaded, the URL of the document, a link found in it so
+   far, and its PLINK_* flags.  Returns true if it enqueued
+   anything.  */
+typedef bool (*parallel_link_fn) (void *, const char *, const char *, int,
+                                  void *);
+
+struct parallel_pool *parallel_pool_new (int);
+void parallel_pool_delete (struct parallel_pool *);
+int parallel_idle (const struct parallel_pool *);
+bool parallel_submit (struct parallel_pool *, const char *, const char *,
+                      struct iri *, void *);
+bool parallel_submit_ftp (struct parallel_pool *, const char *, wgint, void *);
+bool parallel_wait (struct parallel_pool *, struct parallel_result *);
+void parallel_set_wakeup (struct parallel_pool *, double);
+void parallel_set_link_hook (struct parallel_pool *, parallel_link_fn, void *);
+
+bool parallel_worker_p (void);
+void parallel_forward (enum parallel_event, const char *, const char *);
+void parallel_forward_cookie (const char *, int, const char *, const char *);
+void parallel_forward_link (const char *, const char *, int);
+void parallel_forward_progress (int, wgint, wgint);
+
+#endif /* PARALLEL_H */
@@ -43,6 +43,8 @@ as that of the covered work.  */
 #include "progress.h"
 #include "utils.h"
 #include "retr.h"
+#include "ptimer.h"
+#include "parallel.h"
 
 struct progress_implementation {
   const char *name;
@@ -65,13 +67,36 @@ static void bar_update (void *, wgint, double);
 static void bar_finish (void *, double);
 static void bar_set_params (const char *);
 
+static void *aggregate_create (wgint, wgint);
+static void aggregate_update (void *, wgint, double);
+static void aggregate_finish (void *, double);
+static void aggregate_set_params (const char *);
+static void aggregate_set_connections (void *, int);
+
 static struct progress_implementation implementations[] = {
   { "dot", 0, dot_create, dot_update, dot_finish, dot_set_params },
-  { "bar", 1, bar_create, bar_update, bar_finish, bar_set_params }
+  { "bar", 1, bar_create, bar_update, bar_finish, bar_set_params },
+  { "aggregate", 1, aggregate_create, aggregate_update, aggregate_finish,
+    aggregate_set_params }
 };
 static struct progress_implementation *current_impl;
 static int current_impl_locked;
 
+/* The gauge returned by progress_create.  The data that arrives is
+   passed on to the implementation only every PROGRESS_TICK seconds,
+   however small the reads are, so that in between progress_update
+   does no more than add to PENDING.  The implementations, which keep
+   the speed history and draw the gauge, then run five times a second
+   instead of once per read, which also keeps Wget from swamping the
+   TTY with output.  */
+struct progress {
+  void *data;                   /* the implementation's gauge */
+  wgint pending;                /* bytes not yet passed on */
+  double next_tick;             /* when to pass them on */
+};
+
+#define PROGRESS_TICK 0.2
+
 /* Progress implementation used by default.  Can be overriden in
    wgetrc or by the fallback one.  */
 
@@ -153,6 +178,8 @@ progress_schedule_redirect (void)
 void *
 progress_create (wgint initial, wgint total)
 {
+  struct progress *p;
+
   /* Check if the log status has changed under our feet. */
   if (output_redirected)
     {
@@ -161,7 +188,9 @@ progress_create (wgint initial, wgint total)
       output_redirected = 0;
     }
 
-  return current_impl->create (initial, total);
+  p = xnew0 (struct progress);
+  p->data = current_impl->create (initial, total);
+  return p;
 }
 
 /* Return true if the progress gauge is "interactive", i.e. if it can
@@ -181,7 +210,27 @@ progress_interactive_p (void *progress)
 void
 progress_update (void *progress, wgint howmuch, double dltime)
 {
-  current_impl->update (progress, howmuch, dltime);
+  struct progress *p = progress;
+
+  p->pending += howmuch;
+  if (dltime < p->next_tick)
+    return;
+  current_impl->update (p->data, p->pending, dltime);
+  p->pending = 0;
+  p->next_tick = dltime + PROGRESS_TICK;
+}
+
+/* Tell the progress gauge that COUNT connections now feed it, as
+   they do for segmented downloads.  Only the aggregate display shows
+   the number of connections.  */
+
+void
+progress_set_connections (void *progress, int count)
+{
+  struct progress *p = progress;
+
+  if (current_impl->create == aggregate_create)
+    aggregate_set_connections (p->data, count);
 }
 
 /* Tell the progress gauge to clean up.  Calling this will free the
@@ -190,7 +239,12 @@ progress_update (void *progress, wgint howmuch, double dltime)
 void
 progress_finish (void *progress, double dltime)
 {
-  current_impl->finish (progress, dltime);
+  struct progress *p = progress;
+
+  if (p->pending)
+    current_impl->update (p->data, p->pending, dltime);
+  current_impl->finish (p->data, dltime);
+  xfree (p);
 }
 
 /* Dot-printing. */
@@ -486,10 +540,6 @@ static volatile sig_atomic_t received_sigwinch;
    download speeds are scratched.  */
 #define STALL_START_TIME 5
 
-/* Time between screen refreshes will not be shorter than this, so
-   that Wget doesn't swamp the TTY with output.  */
-#define REFRESH_INTERVAL 0.2
-
 /* Don't refresh the ETA too often to avoid jerkiness in predictions.
    This allows ETA to change approximately once per second.  */
 #define ETA_REFRESH_INTERVAL 0.99
@@ -501,10 +551,6 @@ struct bar_progress {
                                    download finishes */
   wgint count;                  /* bytes downloaded so far */
 
-  double last_screen_update;    /* time of the last screen update,
-                                   measured since the beginning of
-                                   download. */
-
   int width;                    /* screen width we're using at the
                                    time the progress gauge was
                                    created.  this is different from
@@ -595,7 +641,6 @@ static void
 bar_update (void *progress, wgint howmuch, double dltime)
 {
   struct bar_progress *bp = progress;
-  bool force_screen_update = false;
 
   bp->count += howmuch;
   if (bp->total_length > 0
@@ -623,18 +668,13 @@ bar_update (void *progress, wgint howmuch, double dltime)
         {
           bp->width = screen_width - 1;
           bp->buffer = xrealloc (bp->buffer, bp->width + 100);
-          force_screen_update = true;
         }
       received_sigwinch = 0;
     }
 
-  if (dltime - bp->last_screen_update < REFRESH_INTERVAL && !force_screen_update)
-    /* Don't update more often than five times per second. */
-    return;
-
+  /* progress_update calls this only five times per second.  */
   create_image (bp, dltime, false);
   display_image (bp->buffer);
-  bp->last_screen_update = dltime;
 }
 
 static void
@@ -1110,6 +1150,311 @@ bar_set_params (const char *params)
     }
 }
 
+/* Aggregate progress.
+
+   Instead of a gauge per transfer, a single status line describes the
+   whole job: the transfers in progress and the connections they use,
+   the URLs waiting in the recursion queue, the bytes received, the
+   recent throughput and an estimate of the time left.  The gauges of
+   the individual transfers only feed the job totals; in parallel
+   workers they forward their changes to the parent, which owns the
+   display (see progress_job_update).  */
+
+/* The time span over which the throughput is measured is roughly
+   AGGREGATE_SAMPLES * AGGREGATE_SAMPLE_INTERVAL seconds.  */
+#define AGGREGATE_SAMPLES 10
+#define AGGREGATE_SAMPLE_INTERVAL 0.5
+
+/* When the log is not a TTY, the status is printed as a line of its
+   own this often rather than redrawn in place.  */
+#define AGGREGATE_LOG_INTERVAL 10
+
+#ifndef MIN
+# define MIN(a, b) ((a) <= (b) ? (a) : (b))
+#endif
+
+static struct {
+  int transfers;                /* transfers in progress */
+  int connections;              /* connections used by them */
+  int queued;                   /* URLs waiting in the queue */
+  int files;                    /* transfers finished */
+  SUM_SIZE_INT bytes;           /* bytes received by the whole job */
+  SUM_SIZE_INT finished_bytes;  /* the share of finished transfers */
+  SUM_SIZE_INT remaining;       /* bytes the transfers in progress
+                                   still expect, where known */
+
+  struct ptimer *timer;
+  double next_draw;
+  bool line_open;               /* the status line awaits a newline */
+
+  /* Ring of recent (time, bytes) samples for the throughput.  */
+  double sample_time[AGGREGATE_SAMPLES];
+  SUM_SIZE_INT sample_bytes[AGGREGATE_SAMPLES];
+  int sample_pos, sample_count;
+  double next_sample;
+} job;
+
+/* Whether the status line is redrawn in place.  */
+static bool aggregate_in_place;
+
+struct aggregate_progress {
+  wgint expected;               /* bytes still expected, or 0 if the
+                                   size is not known */
+  wgint received;               /* bytes received so far */
+  int connections;              /* connections feeding this transfer */
+};
+
+static void aggregate_draw (bool);
+static void aggregate_end_line (void);
+
+/* Apply the job change EV to the totals, either here or, in a
+   parallel worker, in the parent.  */
+
+static void
+aggregate_event (enum progress_job_event ev, wgint a, wgint b)
+{
+  if (parallel_worker_p ())
+    parallel_forward_progress (ev, a, b);
+  else
+    progress_job_update (ev, a, b);
+}
+
+static void *
+aggregate_create (wgint initial, wgint total)
+{
+  struct aggregate_progress *ap = xnew0 (struct aggregate_progress);
+
+  if (total > initial)
+    ap->expected = total - initial;
+  ap->connections = 1;
+  aggregate_event (PJOB_START, ap->expected, 0);
+  return ap;
+}
+
+static void
+aggregate_update (void *progress, wgint howmuch, double dltime)
+{
+  struct aggregate_progress *ap = progress;
+  wgint counted = MIN (howmuch, ap->expected);
+
+  ap->expected -= counted;
+  ap->received += howmuch;
+  aggregate_event (PJOB_DATA, howmuch, counted);
+}
+
+static void
+aggregate_set_connections (void *progress, int count)
+{
+  struct aggregate_progress *ap = progress;
+
+  if (count < 1 || count == ap->connections)
+    return;
+  aggregate_event (PJOB_CONNECTIONS, count - ap->connections, 0);
+  ap->connections = count;
+}
+
+static void
+aggregate_finish (void *progress, double dltime)
+{
+  struct aggregate_progress *ap = progress;
+
+  aggregate_set_connections (ap, 1);
+  aggregate_event (PJOB_FINISH, ap->expected, ap->received);
+  xfree (ap);
+
+  /* Whatever is logged next about this transfer goes on a line of its
+     own.  */
+  aggregate_end_line ();
+}
+
+static void
+aggregate_set_params (const char *params)
+{
+  aggregate_in_place = !opt.lfilename;
+#ifdef HAVE_ISATTY
+  if (!isatty (fileno (stderr)))
+    aggregate_in_place = false;
+#endif
+}
+
+/* Bring the status line up to date and end it, so that whatever is
+   logged next starts on a line of its own.  */
+
+static void
+aggregate_end_line (void)
+{
+  if (!job.line_open)
+    return;
+  aggregate_draw (true);
+  logputs (LOG_VERBOSE, "\n");
+  job.line_open = false;
+}
+
+/* Compose the status line into BUF, which is SIZE bytes long.  NOW
+   is the time since the job started.  */
+
+static void
+aggregate_image (char *buf, int size, double now)
+{
+  SUM_SIZE_INT bytes = job.bytes;
+  double span = now;
+  int n;
+
+  /* Throughput since the oldest sample in the ring.  */
+  if (job.sample_count > 0)
+    {
+      int oldest = (job.sample_count < AGGREGATE_SAMPLES
+                    ? 0 : job.sample_pos);
+      bytes -= job.sample_bytes[oldest];
+      span -= job.sample_time[oldest];
+    }
+
+  n = snprintf (buf, size, _("[%d active, %d conn, %d queued, %d done] %s"),
+                job.transfers, job.connections, job.queued, job.files,
+                human_readable (job.bytes));
+  if (n < 0 || n >= size)
+    return;
+  n += snprintf (buf + n, size - n, "  %s", retr_rate (bytes, span));
+  if (n >= size)
+    return;
+
+  if (bytes > 0 && span > 0)
+    {
+      /* Queued URLs are assumed to be as large as the files
+         retrieved so far, on average.  */
+      double left = job.remaining;
+      if (job.queued && job.files)
+        left += (double) job.queued * job.finished_bytes / job.files;
+      if ((job.remaining > 0 || (job.queued && job.files))
+          && left * span / bytes < INT_MAX - 1)
+        snprintf (buf + n, size - n, _("  eta %s"),
+                  eta_to_human_short ((int) (left * span / bytes + 0.5),
+                                      false));
+    }
+}
+
+/* Draw the status line, at most every PROGRESS_TICK seconds unless
+   FORCE is set.  */
+
+static void
+aggregate_draw (bool force)
+{
+  double now;
+  int width;
+  char buf[512];
+
+  if (!job.timer)
+    job.timer = ptimer_new ();
+  now = ptimer_measure (job.timer);
+
+  if (now >= job.next_sample)
+    {
+      job.sample_time[job.sample_pos] = now;
+      job.sample_bytes[job.sample_pos] = job.bytes;
+      job.sample_pos = (job.sample_pos + 1) % AGGREGATE_SAMPLES;
+      if (job.sample_count < AGGREGATE_SAMPLES)
+        ++job.sample_count;
+      job.next_sample = now + AGGREGATE_SAMPLE_INTERVAL;
+    }
+
+  if (!force && now < job.next_draw)
+    return;
+  job.next_draw = now + (aggregate_in_place
+                         ? PROGRESS_TICK : AGGREGATE_LOG_INTERVAL);
+
+  if (!aggregate_in_place)
+    {
+      char line[256];
+      aggregate_image (line, sizeof line, now);
+      logprintf (LOG_VERBOSE, "%s\n", line);
+      return;
+    }
+
+  if (!screen_width || received_sigwinch)
+    {
+      screen_width = determine_screen_width ();
+      if (!screen_width)
+        screen_width = DEFAULT_SCREEN_WIDTH;
+      else if (screen_width < MINIMUM_SCREEN_WIDTH)
+        screen_width = MINIMUM_SCREEN_WIDTH;
+      received_sigwinch = 0;
+    }
+  /* - 1 because we don't want to use the last screen column, and pad
+     with spaces so that a shorter line erases the previous one.  */
+  width = MIN (screen_width - 1, (int) sizeof buf - 1);
+  aggregate_image (buf, width + 1, now);
+  memset (buf + strlen (buf), ' ', width - strlen (buf));
+  buf[width] = '\0';
+  display_image (buf);
+  job.line_open = true;
+}
+
+/* Apply the change EV to the job totals shown by the aggregate
+   display.  For PJOB_START, A is the number of bytes the transfer
+   expects, or 0 if unknown.  For PJOB_DATA, A bytes were received, B
+   of which were expected.  For PJOB_CONNECTIONS, A connections were
+   added.  For PJOB_FINISH, A expected bytes never arrived and the
+   transfer received B bytes in all.  */
+
+void
+progress_job_update (enum progress_job_event ev, wgint a, wgint b)
+{
+  switch (ev)
+    {
+    case PJOB_START:
+      ++job.transfers;
+      ++job.connections;
+      job.remaining += a;
+      break;
+    case PJOB_DATA:
+      job.bytes += a;
+      job.remaining -= b;
+      break;
+    case PJOB_CONNECTIONS:
+      job.connections += a;
+      break;
+    case PJOB_FINISH:
+      --job.transfers;
+      --job.connections;
+      job.remaining -= a;
+      ++job.files;
+      job.finished_bytes += b;
+      break;
+    }
+  if (progress_aggregate_p ())
+    aggregate_draw (aggregate_in_place && ev != PJOB_DATA);
+}
+
+/* Return true if the aggregate display is in use.  */
+
+bool
+progress_aggregate_p (void)
+{
+  return current_impl && current_impl->create == aggregate_create;
+}
+
+/* Record that QUEUED URLs wait to be retrieved.  */
+
+void
+progress_job_queued (int queued)
+{
+  job.queued = queued;
+}
+
+/* Show the final state of the job, if the aggregate display has
+   shown anything at all.  */
+
+void
+progress_job_done (void)
+{
+  if (!job.timer)
+    return;
+  if (aggregate_in_place)
+    aggregate_end_line ();
+  else
+    aggregate_draw (true);
+}
+
 #ifdef SIGWINCH
 void
 progress_handle_sigwinch (int sig)
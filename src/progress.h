@@ -38,8 +38,24 @@ void progress_schedule_redirect (void);
 void *progress_create (wgint, wgint);
 bool progress_interactive_p (void *);
 void progress_update (void *, wgint, double);
+void progress_set_connections (void *, int);
 void progress_finish (void *, double);
 
+/* Changes to the job totals shown by the aggregate progress display,
+   which parallel workers forward to the parent.  */
+enum progress_job_event {
+  PJOB_START,			/* a transfer started */
+  PJOB_DATA,			/* a transfer received data */
+  PJOB_CONNECTIONS,		/* a transfer opened or closed
+                                   connections */
+  PJOB_FINISH			/* a transfer finished */
+};
+
+bool progress_aggregate_p (void);
+void progress_job_update (enum progress_job_event, wgint, wgint);
+void progress_job_queued (int);
+void progress_job_done (void);
+
 void progress_handle_sigwinch (int);
 
 #endif /* PROGRESS_H */
@@ -37,12 +37,14 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <tmpdir.h>
 
 #include "url.h"
 #include "recur.h"
 #include "utils.h"
 #include "retr.h"
 #include "ftp.h"
+#include "http.h"
 #include "host.h"
 #include "hash.h"
 #include "res.h"
@@ -50,25 +52,100 @@ as that of the covered work.  */
 #include "html-url.h"
 #include "css-url.h"
 #include "spider.h"
+#include "parallel.h"
+#include "visited.h"
+#include "intern.h"
+#include "state.h"
+#include "shard.h"
+#include "ptimer.h"
+#include "exits.h"
+#include "progress.h"
+#include "timing.h"
+#include "memory.h"
+#include "counters.h"
+
+#ifndef MAX
+# define MAX(i, j) ((i) >= (j) ? (i) : (j))
+#endif
 
 /* Functions for maintaining the URL queue.  */
 
+struct host_queue;
+
+/* The queue has two priorities: the URLs of the page requisites are
+   retrieved before the other URLs, so that the pages they belong to
+   are complete, and with -k converted, as soon as possible.  */
+enum {
+  PRIORITY_REQUISITE,
+  PRIORITY_NORMAL,
+  PRIORITY_COUNT
+};
+
 struct queue_element {
   const char *url;              /* the URL to download */
-  const char *referer;          /* the referring document */
+  const char *referer;          /* the referring document, interned */
   int depth;                    /* the depth */
   bool html_allowed;            /* whether the document is allowed to
                                    be treated as HTML. */
   struct iri *iri;                /* sXXXav */
   bool css_allowed;             /* whether the document is allowed to
                                    be treated as CSS. */
+  bool requisite;               /* whether the document is needed to
+                                   display the referring page */
+  int tries;                    /* tries made already, for a URL put
+                                   back after a failure */
   struct queue_element *next;   /* next element in queue */
+
+  /* The following are only meaningful for elements in memory.  */
+  struct queue_element *prev;   /* previous element in queue */
+  struct host_queue *host;      /* the host of URL */
+  struct queue_element *host_next; /* next element of the same host
+                                      and priority */
+  int priority;                 /* PRIORITY_* */
+  unsigned long seq;            /* position in the order of enqueuing */
+};
+
+/* The elements of the queue are also kept in lists per host and
+   priority, so that the requests to each host can be spaced out by
+   --wait and the Crawl-delay of its robots.txt, and their number
+   limited by --host-connections, without holding back the other
+   hosts.  */
+
+struct host_queue {
+  char *host;                   /* the host name, or NULL if unknown, */
+  int port;                     /* and port, to look up robots.txt */
+  struct queue_element *head[PRIORITY_COUNT]; /* the host's elements in */
+  struct queue_element *tail[PRIORITY_COUNT]; /* memory, linked through
+                                                 host_next */
+  int active;                   /* retrievals in progress */
+  double next_time;             /* when the host may be contacted next */
+  struct host_queue *prev;      /* neighbors in the list of hosts */
+  struct host_queue *next;      /* with elements in memory */
 };
 
 struct url_queue {
   struct queue_element *head;
   struct queue_element *tail;
   int count, maxcount;
+
+  struct hash_table *hosts;     /* host part of URL -> host_queue */
+  struct host_queue *pending;   /* hosts with elements in memory */
+  int requisites;               /* elements in memory with
+                                   PRIORITY_REQUISITE */
+  unsigned long seq;            /* sequence number of the next element */
+  struct ptimer *timer;         /* the clock of next_time */
+
+  /* With --queue-memory, the elements that don't fit in memory are
+     appended to SPILL_FP and read back in batches when the elements
+     in memory run out.  Once something has been spilled, new elements
+     go to the file too, so that the order is kept.  */
+  wgint memory;                 /* bytes taken by the elements in memory */
+  wgint memory_limit;           /* --queue-memory, lowered by
+                                   url_queue_shrink */
+  FILE *spill_fp;
+  int spill_count;              /* elements in the file not read back */
+  off_t spill_read_pos;         /* where to read the next one from */
+  bool spill_failed;            /* set when the file couldn't be used */
 };
 
 /* Create a URL queue. */
@@ -77,80 +154,656 @@ static struct url_queue *
 url_queue_new (void)
 {
   struct url_queue *queue = xnew0 (struct url_queue);
+  queue->hosts = make_nocase_string_hash_table (0);
+  queue->timer = ptimer_new ();
+  queue->memory_limit = opt.queue_memory;
   return queue;
 }
 
-/* Delete a URL queue. */
+static void queue_element_free (struct queue_element *);
+
+/* Free the elements of QUEUE, including those spilled to the
+   file.  */
+
+static void
+url_queue_clear (struct url_queue *queue)
+{
+  struct queue_element *qel, *next;
+  struct host_queue *hq, *hnext;
+
+  for (qel = queue->head; qel; qel = next)
+    {
+      next = qel->next;
+      queue_element_free (qel);
+    }
+  for (hq = queue->pending; hq; hq = hnext)
+    {
+      hnext = hq->next;
+      xzero (hq->head);
+      xzero (hq->tail);
+      hq->prev = hq->next = NULL;
+    }
+  queue->head = queue->tail = NULL;
+  queue->pending = NULL;
+  queue->requisites = 0;
+  queue->memory = 0;
+  queue->count = 0;
+  if (queue->spill_count > 0)
+    {
+      queue->spill_count = 0;
+      queue->spill_read_pos = 0;
+      if (ftruncate (fileno (queue->spill_fp), 0) < 0)
+        queue->spill_failed = true;
+    }
+  progress_job_queued (0);
+}
+
+/* Delete a URL queue, with what is left in it. */
 
 static void
 url_queue_delete (struct url_queue *queue)
 {
+  hash_table_iterator iter;
+
+  url_queue_clear (queue);
+  for (hash_table_iterate (queue->hosts, &iter); hash_table_iter_next (&iter); )
+    {
+      struct host_queue *hq = iter.value;
+      xfree (iter.key);
+      xfree_null (hq->host);
+      xfree (hq);
+    }
+  hash_table_destroy (queue->hosts);
+  ptimer_destroy (queue->timer);
+  if (queue->spill_fp)
+    fclose (queue->spill_fp);
   xfree (queue);
 }
 
+/* Return the host queue of URL, creating it if needed.  The URLs in
+   the queue are canonical, so the host part of the URL, with the
+   port if it is not the default one, is enough to tell the hosts
+   apart.  */
+
+static struct host_queue *
+queue_host (struct url_queue *queue, const char *url)
+{
+  const char *beg = strstr (url, "://"), *end, *p;
+  struct host_queue *hq;
+  char *key;
+
+  beg = beg ? beg + 3 : url;
+  end = beg + strcspn (beg, "/?#");
+  for (p = beg; p < end; p++)
+    if (*p == '@')
+      beg = p + 1;
+  key = alloca (end - beg + 1);
+  memcpy (key, beg, end - beg);
+  key[end - beg] = '\0';
+
+  hq = hash_table_get (queue->hosts, key);
+  if (!hq)
+    {
+      struct url *u = url_parse (url, NULL, NULL, false);
+      hq = xnew0 (struct host_queue);
+      if (u)
+        {
+          hq->host = xstrdup (u->host);
+          hq->port = u->port;
+          url_free (u);
+        }
+      hash_table_put (queue->hosts, xstrdup (key), hq);
+    }
+  return hq;
+}
+
+/* Return the Crawl-delay of the host of HQ, if robots.txt is
+   obeyed.  */
+
+static double
+host_crawl_delay (const struct host_queue *hq)
+{
+  if (!opt.use_robots || !hq->host)
+    return 0;
+  return res_crawl_delay (hq->host, hq->port);
+}
+
+/* Return the element of HQ to be retrieved first, or NULL if it has
+   none in memory.  */
+
+static struct queue_element *
+host_first (const struct host_queue *hq)
+{
+  int p;
+  for (p = 0; p < PRIORITY_COUNT; p++)
+    if (hq->head[p])
+      return hq->head[p];
+  return NULL;
+}
+
+/* Return whether a URL of HQ may be retrieved at time NOW.  */
+
+static bool
+host_ready_p (const struct host_queue *hq, double now)
+{
+  return (hq->next_time <= now
+          && (!opt.host_connections || hq->active < opt.host_connections));
+}
+
+/* Return an estimate of the memory taken by QEL and its strings.  */
+
+static wgint
+queue_element_size (const struct queue_element *qel)
+{
+  /* The referer is shared with the other links of its document.  */
+  wgint size = sizeof *qel + strlen (qel->url) + 1;
+#ifdef ENABLE_IRI
+  size += sizeof *qel->iri;
+  if (qel->iri->uri_encoding)
+    size += strlen (qel->iri->uri_encoding) + 1;
+  if (qel->iri->content_encoding)
+    size += strlen (qel->iri->content_encoding) + 1;
+  if (qel->iri->orig_url)
+    size += strlen (qel->iri->orig_url) + 1;
+#endif
+  return size;
+}
+
+/* Write QEL to FP, in the encoding of state.c.  */
+
+static void
+queue_element_save (FILE *fp, const struct queue_element *qel)
+{
+  state_put_string (fp, qel->url);
+  state_put_string (fp, qel->referer);
+  state_put_number (fp, qel->depth);
+  state_put_number (fp, (qel->html_allowed | qel->css_allowed << 1
+                         | qel->requisite << 2 | qel->tries << 3));
+#ifdef ENABLE_IRI
+  state_put_string (fp, qel->iri->uri_encoding);
+  state_put_string (fp, qel->iri->content_encoding);
+  state_put_string (fp, qel->iri->orig_url);
+  state_put_number (fp, qel->iri->utf8_encode);
+#else
+  state_put_string (fp, NULL);
+  state_put_string (fp, NULL);
+  state_put_string (fp, NULL);
+  state_put_number (fp, 0);
+#endif
+}
+
+/* Read an element written by queue_element_save from FP, or return
+   NULL on error.  */
+
+static struct queue_element *
+queue_element_load (FILE *fp)
+{
+  char *url = NULL, *referer = NULL, *encodings[3] = { NULL, NULL, NULL };
+  wgint depth, flags, utf8_encode;
+  struct queue_element *qel;
+
+  if (!state_get_string (fp, &url) || !url
+      || !state_get_string (fp, &referer)
+      || !state_get_number (fp, &depth)
+      || !state_get_number (fp, &flags)
+      || !state_get_string (fp, &encodings[0])
+      || !state_get_string (fp, &encodings[1])
+      || !state_get_string (fp, &encodings[2])
+      || !state_get_number (fp, &utf8_encode))
+    {
+      xfree_null (url);
+      xfree_null (referer);
+      xfree_null (encodings[0]);
+      xfree_null (encodings[1]);
+      xfree_null (encodings[2]);
+      return NULL;
+    }
+
+  qel = xnew0 (struct queue_element);
+  qel->url = url;
+  qel->referer = intern_string (referer);
+  xfree_null (referer);
+  qel->depth = depth;
+  qel->html_allowed = flags & 1;
+  qel->css_allowed = (flags & 2) != 0;
+  qel->requisite = (flags & 4) != 0;
+  qel->tries = flags >> 3;
+  qel->iri = iri_new ();
+#ifdef ENABLE_IRI
+  xfree_null (qel->iri->uri_encoding);
+  qel->iri->uri_encoding = encodings[0];
+  qel->iri->content_encoding = encodings[1];
+  qel->iri->orig_url = encodings[2];
+  qel->iri->utf8_encode = utf8_encode;
+#else
+  xfree_null (encodings[0]);
+  xfree_null (encodings[1]);
+  xfree_null (encodings[2]);
+#endif
+  return qel;
+}
+
+static void
+queue_element_free (struct queue_element *qel)
+{
+  iri_free (qel->iri);
+  xfree ((char *) qel->url);
+  xfree (qel);
+}
+
+static FILE *
+spill_file_open (void)
+{
+  char filename[100];
+  int fd;
+
+  if (path_search (filename, sizeof filename, NULL, "wget", true) == -1)
+    return NULL;
+  fd = mkstemp (filename);
+  if (fd < 0)
+    return NULL;
+  unlink (filename);
+  return fdopen (fd, "wb+");
+}
+
+static void spill_refill (struct url_queue *, bool);
+
+/* Append QEL to the spill file of QUEUE and free it.  Return false,
+   leaving QEL alone, if that couldn't be done; what was spilled
+   before is then read back, so that QEL can be appended to the
+   memory after it.  */
+
+static bool
+spill_write (struct url_queue *queue, struct queue_element *qel)
+{
+  if (queue->spill_failed)
+    return false;
+  if (!queue->spill_fp)
+    {
+      queue->spill_fp = spill_file_open ();
+      if (!queue->spill_fp)
+        goto fail;
+      DEBUGP (("Spilling the URL queue to a temporary file.\n"));
+    }
+
+  if (fseeko (queue->spill_fp, 0, SEEK_END) < 0)
+    goto fail;
+  queue_element_save (queue->spill_fp, qel);
+  if (ferror (queue->spill_fp))
+    goto fail;
+
+  ++queue->spill_count;
+  queue_element_free (qel);
+  return true;
+
+ fail:
+  /* A partly written element is harmless as long as nothing else
+     gets written after it.  */
+  logprintf (LOG_NOTQUIET,
+             _("Cannot spill the URL queue to a temporary file: %s\n"),
+             strerror (errno));
+  logputs (LOG_NOTQUIET, _("Keeping the whole queue in memory.\n"));
+  queue->spill_failed = true;
+  if (queue->spill_count > 0)
+    spill_refill (queue, true);
+  return false;
+}
+
+/* Append QEL to the elements of QUEUE kept in memory.  */
+
+static void
+queue_append (struct url_queue *queue, struct queue_element *qel)
+{
+  struct host_queue *hq = queue_host (queue, qel->url);
+  int p;
+
+  qel->next = NULL;
+  qel->prev = queue->tail;
+  qel->host = hq;
+  qel->host_next = NULL;
+  qel->priority = p = qel->requisite ? PRIORITY_REQUISITE : PRIORITY_NORMAL;
+  qel->seq = queue->seq++;
+  queue->memory += queue_element_size (qel);
+  if (queue->tail)
+    queue->tail->next = qel;
+  queue->tail = qel;
+
+  if (!queue->head)
+    queue->head = queue->tail;
+
+  if (p == PRIORITY_REQUISITE)
+    ++queue->requisites;
+
+  if (!host_first (hq))
+    {
+      /* The host has something to retrieve again.  */
+      hq->prev = NULL;
+      hq->next = queue->pending;
+      if (queue->pending)
+        queue->pending->prev = hq;
+      queue->pending = hq;
+    }
+  if (hq->tail[p])
+    hq->tail[p]->host_next = qel;
+  else
+    hq->head[p] = qel;
+  hq->tail[p] = qel;
+}
+
+/* Take HQ out of the pending hosts of QUEUE if it has no elements in
+   memory left.  */
+
+static void
+host_update_pending (struct url_queue *queue, struct host_queue *hq)
+{
+  if (!host_first (hq))
+    {
+      if (hq->prev)
+        hq->prev->next = hq->next;
+      else
+        queue->pending = hq->next;
+      if (hq->next)
+        hq->next->prev = hq->prev;
+      hq->prev = hq->next = NULL;
+    }
+}
+
+/* Remove QEL, the first element of its host and priority, from the
+   elements of QUEUE kept in memory.  */
+
+static void
+queue_remove (struct url_queue *queue, struct queue_element *qel)
+{
+  struct host_queue *hq = qel->host;
+  int p = qel->priority;
+
+  if (qel->prev)
+    qel->prev->next = qel->next;
+  else
+    queue->head = qel->next;
+  if (qel->next)
+    qel->next->prev = qel->prev;
+  else
+    queue->tail = qel->prev;
+  queue->memory -= queue_element_size (qel);
+  if (p == PRIORITY_REQUISITE)
+    --queue->requisites;
+
+  hq->head[p] = qel->host_next;
+  if (!hq->head[p])
+    hq->tail[p] = NULL;
+  host_update_pending (queue, hq);
+}
+
+/* Read spilled elements of QUEUE back into memory, until half of
+   the allowed memory is used, or all of them if ALL is true.  When
+   the file has been read in full, it is emptied.  */
+
+static void
+spill_refill (struct url_queue *queue, bool all)
+{
+  int nread = 0;
+
+  if (fseeko (queue->spill_fp, queue->spill_read_pos, SEEK_SET) < 0)
+    goto fail;
+  while (queue->spill_count > 0
+         && (all || nread == 0
+             || queue->memory < queue->memory_limit / 2))
+    {
+      struct queue_element *qel = queue_element_load (queue->spill_fp);
+      if (!qel)
+        goto fail;
+      queue_append (queue, qel);
+      --queue->spill_count;
+      ++nread;
+    }
+  queue->spill_read_pos = ftello (queue->spill_fp);
+  DEBUGP (("Read %d URLs back from the queue file, %d left there.\n",
+           nread, queue->spill_count));
+
+  if (queue->spill_count == 0)
+    {
+      queue->spill_read_pos = 0;
+      if (ftruncate (fileno (queue->spill_fp), 0) < 0)
+        goto fail;
+    }
+  return;
+
+ fail:
+  logprintf (LOG_NOTQUIET,
+             _("Cannot read the URL queue back from its temporary file: %s\n"),
+             strerror (errno));
+  logprintf (LOG_NOTQUIET, _("%d queued URLs are lost.\n"), queue->spill_count);
+  queue->count -= queue->spill_count;
+  queue->spill_count = 0;
+  queue->spill_failed = true;
+}
+
+static void queue_add (struct url_queue *, struct queue_element *);
+
 /* Enqueue a URL in the queue.  The queue is FIFO: the items will be
    retrieved ("dequeued") from the queue in the order they were placed
-   into it.  */
+   into it, except that with -p or -k, the REQUISITE ones are
+   retrieved before the others, and the requests to each host are
+   spaced out (see url_dequeue).  The queue takes over URL, but
+   interns REFERER.  */
 
 static void
 url_enqueue (struct url_queue *queue, struct iri *i,
              const char *url, const char *referer, int depth,
-             bool html_allowed, bool css_allowed)
+             bool html_allowed, bool css_allowed, bool requisite)
+{
+  struct queue_element *qel = xnew (struct queue_element);
+  qel->iri = i;
+  qel->url = url;
+  qel->referer = intern_string (referer);
+  qel->depth = depth;
+  qel->html_allowed = html_allowed;
+  qel->css_allowed = css_allowed;
+  qel->requisite = requisite && (opt.page_requisites || opt.convert_links);
+  qel->tries = 0;
+  qel->next = NULL;
+  queue_add (queue, qel);
+}
+
+/* Put a URL that couldn't be retrieved after TRIES tries back in the
+   queue, like url_enqueue.  */
+
+static void
+url_requeue (struct url_queue *queue, struct iri *i,
+             const char *url, const char *referer, int depth,
+             bool html_allowed, bool css_allowed, int tries)
 {
   struct queue_element *qel = xnew (struct queue_element);
   qel->iri = i;
   qel->url = url;
-  qel->referer = referer;
+  qel->referer = intern_string (referer);
   qel->depth = depth;
   qel->html_allowed = html_allowed;
   qel->css_allowed = css_allowed;
+  qel->requisite = false;
+  qel->tries = tries;
   qel->next = NULL;
+  queue_add (queue, qel);
+}
+
+/* Add QEL to QUEUE, in memory or in the spill file.  */
 
+static void
+queue_add (struct url_queue *queue, struct queue_element *qel)
+{
   ++queue->count;
   if (queue->count > queue->maxcount)
     queue->maxcount = queue->count;
+  progress_job_queued (queue->count);
 
   DEBUGP (("Enqueuing %s at depth %d\n",
-           quotearg_n_style (0, escape_quoting_style, url), depth));
+           quotearg_n_style (0, escape_quoting_style, qel->url), qel->depth));
   DEBUGP (("Queue count %d, maxcount %d.\n", queue->count, queue->maxcount));
 
-  if (i)
-    DEBUGP (("[IRI Enqueuing %s with %s\n", quote_n (0, url),
-             i->uri_encoding ? quote_n (1, i->uri_encoding) : "None"));
+  if (qel->iri)
+    DEBUGP (("[IRI Enqueuing %s with %s\n", quote_n (0, qel->url),
+             qel->iri->uri_encoding
+             ? quote_n (1, qel->iri->uri_encoding) : "None"));
+
+  if (convert_incrementally)
+    convert_url_queued (qel->url);
+
+  /* The requisites are never spilled, to get the pages that wait for
+     them done with.  */
+  if (!qel->requisite
+      && (queue->spill_count > 0
+          || (queue->memory_limit
+              && (queue->memory + queue_element_size (qel)
+                  > queue->memory_limit)))
+      && spill_write (queue, qel))
+    return;
+
+  queue_append (queue, qel);
+}
 
-  if (queue->tail)
-    queue->tail->next = qel;
-  queue->tail = qel;
+/* Halve the memory QUEUE may keep its elements in, down to
+   QUEUE_MEMORY_FLOOR, and spill the newest elements that are over the
+   new limit to the file.  Called when --max-memory is exceeded.  */
 
-  if (!queue->head)
-    queue->head = queue->tail;
+#define QUEUE_MEMORY_FLOOR (1024 * 1024)
+
+static void
+url_queue_shrink (struct url_queue *queue)
+{
+  struct queue_element *qel, *cut = NULL, *next;
+  struct queue_element *spill = NULL, **spill_tail = &spill;
+  hash_table_iterator iter;
+  wgint excess;
+  int nspilled = 0;
+
+  queue->memory_limit = MAX (queue->memory / 2, QUEUE_MEMORY_FLOOR);
+  if (queue->spill_failed || queue->spill_count > 0
+      || queue->memory <= queue->memory_limit)
+    return;
+
+  /* Find the oldest element of the newest run of normal elements that
+     is over the limit.  */
+  excess = queue->memory - queue->memory_limit;
+  for (qel = queue->tail; qel && excess > 0; qel = qel->prev)
+    if (qel->priority == PRIORITY_NORMAL)
+      {
+        excess -= queue_element_size (qel);
+        cut = qel;
+      }
+  if (!cut)
+    return;
+
+  /* Those elements are at the end of the list of their host.  */
+  for (hash_table_iterate (queue->hosts, &iter); hash_table_iter_next (&iter); )
+    {
+      struct host_queue *hq = iter.value;
+      struct queue_element *last = NULL;
+      for (qel = hq->head[PRIORITY_NORMAL]; qel && qel->seq < cut->seq;
+           qel = qel->host_next)
+        last = qel;
+      if (!qel)
+        continue;
+      if (last)
+        last->host_next = NULL;
+      else
+        hq->head[PRIORITY_NORMAL] = NULL;
+      hq->tail[PRIORITY_NORMAL] = last;
+      host_update_pending (queue, hq);
+    }
+
+  for (qel = cut; qel; qel = next)
+    {
+      next = qel->next;
+      if (qel->priority != PRIORITY_NORMAL)
+        continue;
+      if (qel->prev)
+        qel->prev->next = qel->next;
+      else
+        queue->head = qel->next;
+      if (qel->next)
+        qel->next->prev = qel->prev;
+      else
+        queue->tail = qel->prev;
+      queue->memory -= queue_element_size (qel);
+      qel->next = NULL;
+      *spill_tail = qel;
+      spill_tail = &qel->next;
+    }
+
+  /* What can't be spilled goes back, still after the others.  */
+  for (qel = spill; qel; qel = next)
+    {
+      next = qel->next;
+      if (spill_write (queue, qel))
+        ++nspilled;
+      else
+        queue_append (queue, qel);
+    }
+  DEBUGP (("Spilled %d URLs to keep the queue under %s bytes.\n",
+           nspilled, number_to_static_string (queue->memory_limit)));
 }
 
-/* Take a URL out of the queue.  Return true if this operation
-   succeeded, or false if the queue is empty.  */
+/* Take a URL out of the queue.  This is the oldest URL of the
+   highest priority whose host may be contacted now; the host is
+   stored to *HOST, and must be
+   passed to url_queue_done once the URL has been dealt with.  Return
+   true if this operation succeeded, or false if the queue is empty or
+   all of its hosts have to be waited for (see url_queue_wait).
+
+   URLs spilled to the file are only read back once those in memory
+   are exhausted, so they can be held back by the hosts in memory.  */
 
 static bool
-url_dequeue (struct url_queue *queue, struct iri **i,
-             const char **url, const char **referer, int *depth,
-             bool *html_allowed, bool *css_allowed)
+url_dequeue (struct url_queue *queue, struct host_queue **host,
+             struct iri **i, const char **url, const char **referer,
+             int *depth, bool *html_allowed, bool *css_allowed, int *tries)
 {
-  struct queue_element *qel = queue->head;
+  struct queue_element *qel;
+  double now;
+
+  if (!queue->head && queue->spill_count > 0)
+    spill_refill (queue, false);
 
+  qel = queue->head;
   if (!qel)
     return false;
 
-  queue->head = queue->head->next;
-  if (!queue->head)
-    queue->tail = NULL;
+  /* Usually there are no requisites and the host of the oldest URL
+     can be contacted.  Otherwise take the best URL of the hosts that
+     can.  */
+  now = ptimer_measure (queue->timer);
+  if (queue->requisites > 0 || !host_ready_p (qel->host, now))
+    {
+      struct host_queue *hq;
+      qel = NULL;
+      for (hq = queue->pending; hq; hq = hq->next)
+        {
+          struct queue_element *first = host_first (hq);
+          if (host_ready_p (hq, now)
+              && (!qel || first->priority < qel->priority
+                  || (first->priority == qel->priority
+                      && first->seq < qel->seq)))
+            qel = first;
+        }
+      if (!qel)
+        return false;
+    }
+
+  queue_remove (queue, qel);
+  ++qel->host->active;
 
+  *host = qel->host;
   *i = qel->iri;
   *url = qel->url;
   *referer = qel->referer;
   *depth = qel->depth;
   *html_allowed = qel->html_allowed;
   *css_allowed = qel->css_allowed;
+  *tries = qel->tries;
 
   --queue->count;
+  progress_job_queued (queue->count);
 
   DEBUGP (("Dequeuing %s at depth %d\n",
            quotearg_n_style (0, escape_quoting_style, qel->url), qel->depth));
@@ -159,12 +812,405 @@ url_dequeue (struct url_queue *queue, struct iri **i,
   xfree (qel);
   return true;
 }
-
+
+/* Tell QUEUE that the URL of HOST taken out by url_dequeue has been
+   dealt with.  If CONTACTED, the host has been sent a request, and
+   the next one has to wait for --wait seconds or the Crawl-delay of
+   the host.  */
+
+static void
+url_queue_done (struct url_queue *queue, struct host_queue *host,
+                bool contacted)
+{
+  double delay;
+
+  --host->active;
+  if (!contacted)
+    return;
+
+  delay = opt.wait;
+  if (opt.random_wait)
+    /* Vary the delay between 0.5 and 1.5 times --wait, as
+       sleep_between_retrievals does.  */
+    delay *= 0.5 + random_float ();
+  delay = MAX (delay, host_crawl_delay (host));
+  if (delay > 0)
+    {
+      host->next_time = ptimer_measure (queue->timer) + delay;
+      DEBUGP (("Waiting %.2f seconds before contacting %s again.\n",
+               delay, host->host ? host->host : "the host"));
+    }
+}
+
+/* Keep HOST from being contacted for DELAY seconds, after a
+   retrieval from it failed.  */
+
+static void
+url_queue_defer (struct url_queue *queue, struct host_queue *host,
+                 double delay)
+{
+  host->next_time = MAX (host->next_time,
+                         ptimer_measure (queue->timer) + delay);
+  DEBUGP (("Waiting %.2f seconds before retrying %s.\n",
+           delay, host->host ? host->host : "the host"));
+}
+
+/* Return the number of seconds until url_dequeue can take a URL out
+   of QUEUE, or -1 if QUEUE is empty or its hosts only wait for
+   retrievals in progress to finish.  */
+
+static double
+url_queue_wait (struct url_queue *queue)
+{
+  struct host_queue *hq;
+  double now, wait = -1;
+
+  if (!queue->head)
+    return queue->spill_count > 0 ? 0 : -1;
+  now = ptimer_measure (queue->timer);
+  for (hq = queue->pending; hq; hq = hq->next)
+    if (!opt.host_connections || hq->active < opt.host_connections)
+      {
+        double w = MAX (hq->next_time - now, 0);
+        if (wait < 0 || w < wait)
+          wait = w;
+      }
+  return wait;
+}
+
+/* The state file starts with this line.  */
+#define STATE_MAGIC "Wget crawl state 2\n"
+
+/* Write the state of the crawl started at START_URL to the state
+   file: the URLs handed to workers but not finished (INFLIGHT), those
+   in QUEUE, the set of seen URLs and the registries of convert.c.  */
+
+static void
+save_state (const char *start_url, struct url_queue *queue,
+            const struct queue_element *inflight,
+            const struct visited_set *blacklist)
+{
+  const struct queue_element *qel;
+  FILE *fp = state_create (opt.state_file);
+  int count = queue->count, i;
+
+  if (!fp)
+    return;
+  for (qel = inflight; qel; qel = qel->next)
+    ++count;
+
+  fputs (STATE_MAGIC, fp);
+  state_put_string (fp, start_url);
+  state_put_number (fp, total_downloaded_bytes);
+  state_put_number (fp, count);
+  for (qel = inflight; qel; qel = qel->next)
+    queue_element_save (fp, qel);
+  for (qel = queue->head; qel; qel = qel->next)
+    queue_element_save (fp, qel);
+  if (queue->spill_count > 0)
+    {
+      if (fseeko (queue->spill_fp, queue->spill_read_pos, SEEK_SET) < 0)
+        goto fail;
+      for (i = 0; i < queue->spill_count; i++)
+        {
+          struct queue_element *spilled = queue_element_load (queue->spill_fp);
+          if (!spilled)
+            goto fail;
+          queue_element_save (fp, spilled);
+          queue_element_free (spilled);
+        }
+    }
+  visited_set_save (fp, blacklist);
+  convert_state_save (fp);
+
+  if (state_commit (fp, opt.state_file))
+    DEBUGP (("Saved the crawl state to %s, %d URLs queued.\n",
+             opt.state_file, count));
+  return;
+
+ fail:
+  logprintf (LOG_NOTQUIET,
+             _("Cannot read the URL queue back from its temporary file: %s\n"),
+             strerror (errno));
+  state_abandon (fp, opt.state_file);
+}
+
+/* Restore the state of the crawl started at START_URL from the state
+   file, if there is one for it.  The saved URLs are put in QUEUE and
+   the set of seen URLs is stored to *BLACKLIST.  */
+
+static bool
+load_state (const char *start_url, struct url_queue *queue,
+            struct visited_set **blacklist)
+{
+  char magic[sizeof STATE_MAGIC - 1];
+  char *saved_url = NULL;
+  wgint downloaded, count, n;
+  FILE *fp = state_open (opt.state_file);
+
+  if (!fp)
+    return false;
+  if (fread (magic, sizeof magic, 1, fp) != 1
+      || memcmp (magic, STATE_MAGIC, sizeof magic) != 0
+      || !state_get_string (fp, &saved_url) || !saved_url)
+    goto fail;
+  if (strcmp (saved_url, start_url) != 0)
+    {
+      logprintf (LOG_VERBOSE,
+                 _("State file %s is for %s; not resuming.\n"),
+                 quote_n (0, opt.state_file), quote_n (1, saved_url));
+      xfree (saved_url);
+      fclose (fp);
+      return false;
+    }
+  if (!state_get_number (fp, &downloaded) || !state_get_number (fp, &count))
+    goto fail;
+
+  for (n = 0; n < count; n++)
+    {
+      struct queue_element *qel = queue_element_load (fp);
+      if (!qel)
+        goto fail;
+      url_enqueue (queue, qel->iri, qel->url, qel->referer, qel->depth,
+                   qel->html_allowed, qel->css_allowed, qel->requisite);
+      xfree (qel);
+    }
+
+  *blacklist = visited_set_load (fp);
+  if (!*blacklist)
+    goto fail;
+  if (!convert_state_load (fp))
+    goto fail;
+
+  total_downloaded_bytes += downloaded;
+  logprintf (LOG_VERBOSE,
+             _("Resuming the crawl of %s from %s, %s URLs queued.\n"),
+             quote_n (0, start_url), quote_n (1, opt.state_file),
+             number_to_static_string (count));
+  xfree (saved_url);
+  fclose (fp);
+  return true;
+
+ fail:
+  logprintf (LOG_NOTQUIET, _("State file %s is invalid; not resuming.\n"),
+             quote (opt.state_file));
+  if (*blacklist)
+    {
+      visited_set_free (*blacklist);
+      *blacklist = NULL;
+    }
+  url_queue_clear (queue);
+  xfree_null (saved_url);
+  fclose (fp);
+  return false;
+}
+
+/* Tell the HTTP code which URLs of HOST, the host of the current
+   URL, will be retrieved after it, so that it can pipeline the
+   requests for them.  Only the URLs up to the first one that was
+   already downloaded are announced, because retrieve_tree won't
+   request that one again.  Nothing is announced when the requests to
+   HOST have to be spaced out.  */
+
+static void
+announce_pipeline (const struct host_queue *host)
+{
+  const char **urls = xnew_array (const char *, opt.pipeline);
+  const char **referers = xnew_array (const char *, opt.pipeline);
+  const struct queue_element *qel;
+  int count = 0, p;
+
+  if (opt.wait || host_crawl_delay (host) > 0)
+    goto done;
+  for (p = 0; p < PRIORITY_COUNT; p++)
+    for (qel = host->head[p]; qel && count < opt.pipeline - 1;
+         qel = qel->host_next)
+      {
+        if (dl_url_file_map && hash_table_contains (dl_url_file_map, qel->url))
+          goto done;
+        urls[count] = qel->url;
+        referers[count] = qel->referer;
+        ++count;
+      }
+
+ done:
+  http_set_pipeline_hint (urls, referers, count);
+  xfree (urls);
+  xfree (referers);
+}
+
+static void prefetch_hosts (struct urlpos *, struct url *,
+                            struct visited_set *);
 static bool download_child_p (const struct urlpos *, struct url *, int,
-                              struct url *, struct hash_table *, struct iri *);
+                              struct url *, struct visited_set *, struct iri *);
 static bool descend_redirect_p (const char *, struct url *, int,
-                                struct url *, struct hash_table *, struct iri *);
+                                struct url *, struct visited_set *, struct iri *);
 
+/* Return true if the links of a document at DEPTH are to be followed.
+   LEAF is set if only its inline links are.  */
+
+static bool
+descend_depth_p (int depth, bool *leaf)
+{
+  *leaf = false;
+  if (depth < opt.reclevel || opt.reclevel == INFINITE_RECURSION)
+    return true;
+
+  /* When -p is specified, we are allowed to exceed the maximum depth,
+     but only for the "inline" links, i.e. those that are needed to
+     display the page.  Originally this could exceed the depth at most
+     by one, but we allow one more level so that the leaf pages that
+     contain frames can be loaded correctly.  */
+  if (opt.page_requisites
+      && (depth == opt.reclevel || depth == opt.reclevel + 1))
+    {
+      *leaf = true;
+      return true;
+    }
+
+  /* Either -p wasn't specified or it was and we've already spent the
+     two extra (pseudo-)levels that it affords us, so we need to bail
+     out. */
+  return false;
+}
+
+/* What enqueue_early_link needs besides the job.  */
+struct early_link_context {
+  struct url_queue *queue;
+  struct visited_set *blacklist;
+  struct url *start_url_parsed;
+};
+
+/* The link hook of the parallel pool: LINK, with PLINK_* FLAGS, has
+   been found in the HTML document at BASE that a worker is still
+   downloading for JOB.  Enqueue it now if retrieve_tree would enqueue
+   it once the document is complete; those links will then be on the
+   blacklist, and whatever this misses is picked up as usual.  */
+
+static bool
+enqueue_early_link (void *closure, const char *base, const char *link,
+                    int flags, void *arg)
+{
+  struct queue_element *job = closure;
+  struct early_link_context *elc = arg;
+  struct url *parent;
+  struct urlpos upos;
+  bool leaf, enqueued = false;
+
+  /* A document that may be treated as CSS is parsed as such.  */
+  if (!job->html_allowed || job->css_allowed
+      || !descend_depth_p (job->depth, &leaf)
+      || (leaf && !(flags & PLINK_INLINE))
+      || visited_set_contains (elc->blacklist, link))
+    return false;
+
+  parent = url_parse (base, NULL, job->iri, true);
+  if (!parent)
+    return false;
+  xzero (upos);
+  upos.url = url_parse (link, NULL, NULL, false);
+  upos.link_relative_p = !!(flags & PLINK_RELATIVE);
+  upos.link_inline_p = !!(flags & PLINK_INLINE);
+
+  if (upos.url
+      && (0 == strcmp (base, job->url)
+          || descend_redirect_p (base, parent, job->depth,
+                                 elc->start_url_parsed, elc->blacklist,
+                                 job->iri))
+      && download_child_p (&upos, parent, job->depth, elc->start_url_parsed,
+                           elc->blacklist, job->iri))
+    {
+      struct iri *ci = iri_new ();
+      char *referer = (parent->user
+                       ? url_string (parent, URL_AUTH_HIDE)
+                       : xstrdup (base));
+      DEBUGP (("Enqueuing %s before %s is complete.\n", upos.url->url, base));
+      set_uri_encoding (ci, job->iri->content_encoding, false);
+      url_enqueue (elc->queue, ci, xstrdup (upos.url->url), referer,
+                   job->depth + 1, !!(flags & PLINK_EXPECT_HTML),
+                   !!(flags & PLINK_EXPECT_CSS), upos.link_inline_p);
+      xfree (referer);
+      visited_set_add (elc->blacklist, upos.url->url);
+      enqueued = true;
+    }
+
+  if (upos.url)
+    url_free (upos.url);
+  url_free (parent);
+  return enqueued;
+}
+
+
+/* Enqueue the links other shards have forwarded to this one.  They
+   have been through download_child_p in the shard that found them,
+   save for the blacklist and robots.txt, which are this shard's.  */
+
+static void
+enqueue_shard_links (struct url_queue *queue, struct visited_set *blacklist)
+{
+  struct shard_link *sl;
+
+  while ((sl = shard_receive ()) != NULL)
+    {
+      struct url *u;
+
+      if (!visited_set_contains (blacklist, sl->url)
+          && (u = url_parse (sl->url, NULL, NULL, false)) != NULL)
+        {
+          struct iri *ci = iri_new ();
+          bool allowed = true;
+          if (opt.use_robots && schemes_are_similar_p (u->scheme, SCHEME_HTTP))
+            {
+              struct robot_specs *specs = res_get_specs (u->host, u->port);
+              if (!specs)
+                specs = res_retrieve_specs (u->url, u->host, u->port, ci);
+              allowed = res_match_path (specs, u->path);
+            }
+          if (allowed)
+            url_enqueue (queue, ci, xstrdup (u->url), sl->referer,
+                         sl->depth, sl->html_allowed, sl->css_allowed,
+                         sl->requisite);
+          else
+            {
+              DEBUGP (("Not following %s because robots.txt forbids it.\n",
+                       u->url));
+              iri_free (ci);
+            }
+          visited_set_add (blacklist, u->url);
+          url_free (u);
+        }
+      shard_link_free (sl);
+    }
+}
+
+/* The queue and blacklist of the crawl in progress, for
+   recur_memory.  */
+static struct url_queue *current_queue;
+static struct visited_set *current_blacklist;
+
+/* Store the bytes taken by the queue of the crawl in progress to
+   *FRONTIER, and those taken by its blacklist to *BLACKLIST.  */
+
+void
+recur_memory (size_t *frontier, size_t *blacklist)
+{
+  *frontier = *blacklist = 0;
+  if (current_queue)
+    *frontier = sizeof *current_queue + current_queue->memory
+      + hash_table_memory (current_queue->hosts);
+  if (current_blacklist)
+    *blacklist = visited_set_memory (current_blacklist);
+}
+
+/* Store the number of URLs in the queue of the crawl in progress to
+   *QUEUED, and the number of URLs queued so far to *SEEN.  */
+
+void
+recur_counts (int *queued, int *seen)
+{
+  *queued = current_queue ? current_queue->count : 0;
+  *seen = current_blacklist ? visited_set_count (current_blacklist) : 0;
+}
 
 /* Retrieve a part of the web beginning with START_URL.  This used to
    be called "recursive retrieval", because the old function was
@@ -185,7 +1231,22 @@ static bool descend_redirect_p (const char *, struct url *, int,
 
        7. if the URL is not one of those downloaded before, and if it
           satisfies the criteria specified by the various command-line
-          options, add it to the queue. */
+          options, add it to the queue.
+
+   With --parallel, step 4 is carried out by a pool of worker
+   processes (see parallel.c), so that several URLs from the queue are
+   being downloaded at any given time.  Everything else, including
+   the blacklist and the queue itself, stays in this process.
+
+   With --shard, step 7 forwards the URLs of the hosts of other shards
+   to them (see shard.c), and the queue is also fed the URLs forwarded
+   by them.  An empty queue then only ends the retrieval once all the
+   shards are done.
+
+   Step 3 takes the oldest URL whose host may be contacted: --wait
+   and the Crawl-delay of robots.txt space out the requests to each
+   host rather than all of them, and --host-connections limits the
+   URLs of one host the workers retrieve at once.  */
 
 uerr_t
 retrieve_tree (struct url *start_url_parsed, struct iri *pi)
@@ -197,7 +1258,26 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
   /* The URLs we do not wish to enqueue, because they are already in
      the queue, but haven't been downloaded yet.  */
-  struct hash_table *blacklist;
+  struct visited_set *blacklist;
+
+  /* The workers retrieving URLs for us, or NULL when downloading
+     serially.  */
+  struct parallel_pool *pool = NULL;
+
+  /* Set when the workers should not be given any more URLs.  */
+  bool stopping = false;
+
+  /* The URLs the workers are retrieving, linked through their next
+     members, so that they can be saved in the state file.  */
+  struct queue_element *inflight = NULL;
+
+  /* The time since the state file was last written.  */
+  struct ptimer *state_timer = NULL;
+
+  struct early_link_context elc;
+
+  /* The host of the URL being dealt with.  */
+  struct host_queue *host;
 
   struct iri *i = iri_new ();
 
@@ -214,34 +1294,221 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 #undef COPYSTR
 
   queue = url_queue_new ();
-  blacklist = make_string_hash_table (0);
+  blacklist = NULL;
+
+  if (opt.state_file)
+    {
+      state_timer = ptimer_new ();
+      if (load_state (start_url_parsed->url, queue, &blacklist))
+        iri_free (i);
+    }
+
+  if (!blacklist)
+    {
+      blacklist = visited_set_new ();
+
+      /* Enqueue the starting URL.  Use start_url_parsed->url rather
+         than just URL so we enqueue the canonical form of the URL.
+         With --shard, it is left to the shard of its host.  */
+      if (shard_owns_p (start_url_parsed->host))
+        url_enqueue (queue, i, xstrdup (start_url_parsed->url), NULL, 0,
+                     true, false, false);
+      else
+        iri_free (i);
+      visited_set_add (blacklist, start_url_parsed->url);
+    }
+  current_queue = queue;
+  current_blacklist = blacklist;
 
-  /* Enqueue the starting URL.  Use start_url_parsed->url rather than
-     just URL so we enqueue the canonical form of the URL.  */
-  url_enqueue (queue, i, xstrdup (start_url_parsed->url), NULL, 0, true,
-               false);
-  string_set_add (blacklist, start_url_parsed->url);
+  /* Keep documents in memory as they are downloaded, so that their
+     links are found without reading them back.  */
+  link_capture = true;
+  crawl_spacing = true;
+
+  if (opt.shard_count > 1)
+    shard_begin ();
+
+  if (opt.parallel > 1)
+    pool = parallel_pool_new (opt.parallel);
+  if (pool)
+    {
+      elc.queue = queue;
+      elc.blacklist = blacklist;
+      elc.start_url_parsed = start_url_parsed;
+      parallel_set_link_hook (pool, enqueue_early_link, &elc);
+    }
 
   while (1)
     {
       bool descend = false;
       char *url, *referer, *file = NULL;
+      char *dequeued = NULL;
+      struct urlpos *children = NULL;
       int depth;
       bool html_allowed, css_allowed;
       bool is_css = false;
       bool dash_p_leaf_HTML = false;
+      bool retrieved = false;
+      bool contacted = true;
+      int dt = 0, tries = 0;
+      bool retry_host = false;
+      char *redirected = NULL;
+
+      if (state_timer && ptimer_measure (state_timer) >= opt.state_interval)
+        {
+          save_state (start_url_parsed->url, queue, inflight, blacklist);
+          ptimer_reset (state_timer);
+        }
+
+      if (opt.shard_count > 1)
+        enqueue_shard_links (queue, blacklist);
+
+      /* Over --max-memory, move the queue to its file and stop
+         keeping the blacklisted URLs exactly.  */
+      if (memory_check ())
+        {
+          url_queue_shrink (queue);
+          visited_set_compact (blacklist);
+        }
+      counters_poll ();
+
+      if ((opt.quota && total_downloaded_bytes > opt.quota)
+          || status == FWRITEERR)
+        {
+          /* Let the workers finish what they are doing, but don't
+             give them anything new.  */
+          if (!pool)
+            break;
+          stopping = true;
+        }
+
+      if (pool)
+        {
+          struct parallel_result res;
+          struct queue_element *job;
+          bool have_url = false;
+
+          /* Keep the idle workers busy.  A URL that doesn't need to
+             be downloaded, or that no worker would accept, is
+             handled right here.  */
+          while (!stopping && parallel_idle (pool) > 0
+                 && url_dequeue (queue, &host, (struct iri **) &i,
+                                 (const char **)&url, (const char **)&referer,
+                                 &depth, &html_allowed, &css_allowed, &tries))
+            {
+              if (dl_url_file_map && hash_table_contains (dl_url_file_map, url))
+                {
+                  have_url = true;
+                  break;
+                }
+              job = xnew (struct queue_element);
+              job->url = url;
+              job->referer = referer;
+              job->depth = depth;
+              job->html_allowed = html_allowed;
+              job->css_allowed = css_allowed;
+              job->tries = tries;
+              job->iri = i;
+              job->host = host;
+              if (!parallel_submit (pool, url, referer, i, job))
+                {
+                  xfree (job);
+                  have_url = true;
+                  break;
+                }
+              job->next = inflight;
+              inflight = job;
+            }
+
+          if (!have_url)
+            {
+              /* Come back when a host that is waited for may be
+                 contacted again.  */
+              double wait = stopping ? -1 : url_queue_wait (queue);
+              if (wait >= 0 && parallel_idle (pool) > 0)
+                parallel_set_wakeup (pool, wait);
 
-      if (opt.quota && total_downloaded_bytes > opt.quota)
-        break;
-      if (status == FWRITEERR)
-        break;
+              if (!parallel_wait (pool, &res))
+                {
+                  /* Nothing is in progress.  Either we are done, or
+                     we are waiting for a host, or all the workers are
+                     gone and the rest of the queue has to be
+                     retrieved serially.  */
+                  if (wait >= 0 && parallel_idle (pool) > 0)
+                    {
+                      xsleep (wait);
+                      continue;
+                    }
+                  if (!stopping && parallel_idle (pool) > 0 && shard_wait ())
+                    continue;
+                  if (stopping || parallel_idle (pool) > 0)
+                    break;
+                  parallel_pool_delete (pool);
+                  pool = NULL;
+                  continue;
+                }
+
+              /* Links found early have been enqueued; hand them
+                 out.  */
+              if (!res.closure)
+                continue;
+
+              job = res.closure;
+              {
+                struct queue_element **pp = &inflight;
+                while (*pp != job)
+                  pp = &(*pp)->next;
+                *pp = job->next;
+              }
+              url = (char *) job->url;
+              referer = (char *) job->referer;
+              depth = job->depth;
+              html_allowed = job->html_allowed;
+              css_allowed = job->css_allowed;
+              i = job->iri;
+              host = job->host;
+              xfree (job);
+
+              if (!res.lost)
+                {
+                  status = res.status;
+                  dt = res.dt;
+                  file = res.file;
+                  redirected = res.newloc;
+                  if (res.content_encoding)
+                    {
+                      xfree_null (i->content_encoding);
+                      i->content_encoding = res.content_encoding;
+                    }
+                  inform_exit_status (status);
+                  retrieved = true;
+                }
+            }
+        }
 
       /* Get the next URL from the queue... */
 
-      if (!url_dequeue (queue, (struct iri **) &i,
-                        (const char **)&url, (const char **)&referer,
-                        &depth, &html_allowed, &css_allowed))
-        break;
+      else if (!url_dequeue (queue, &host, (struct iri **) &i,
+                             (const char **)&url, (const char **)&referer,
+                             &depth, &html_allowed, &css_allowed, &tries))
+        {
+          /* ...waiting for its host if needed.  */
+          double wait = url_queue_wait (queue);
+          if (wait < 0)
+            {
+              /* Other shards may still have work for this one.  */
+              if (shard_wait ())
+                continue;
+              break;
+            }
+          xsleep (wait);
+          continue;
+        }
+
+      /* Remember the URL as it was queued, to tell convert.c when we
+         are done with it.  */
+      if (convert_incrementally)
+        dequeued = xstrdup (url);
 
       /* ...and download it.  Note that this download is in most cases
          unconditional, as download_child_p already makes sure a file
@@ -251,16 +1518,22 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
          and again under URL2, but at a different (possibly smaller)
          depth, we want the URL's children to be taken into account
          the second time.  */
-      if (dl_url_file_map && hash_table_contains (dl_url_file_map, url))
+      if (!retrieved
+          && dl_url_file_map && hash_table_contains (dl_url_file_map, url))
         {
 	  bool is_css_bool;
 
           file = xstrdup (hash_table_get (dl_url_file_map, url));
+          contacted = false;
 
           DEBUGP (("Already downloaded \"%s\", reusing it from \"%s\".\n",
                    url, file));
 
-	  if ((is_css_bool = (css_allowed
+          /* The links of a file converted already no longer point
+             where they did.  */
+	  if (convert_file_done_p (file))
+	    ;
+	  else if ((is_css_bool = (css_allowed
 			      && downloaded_css_set
 			      && string_set_contains (downloaded_css_set, file)))
 	      || (html_allowed
@@ -273,12 +1546,32 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
         }
       else
         {
-          int dt = 0, url_err;
-          char *redirected = NULL;
+          int url_err;
           struct url *url_parsed = url_parse (url, &url_err, i, true);
 
-          status = retrieve_url (url_parsed, url, &file, &redirected, referer,
-                                 &dt, false, i, true);
+          if (!retrieved)
+            {
+              if (opt.pipeline > 1)
+                announce_pipeline (host);
+              retry_tries = tries;
+              retry_deferral = true;
+              status = retrieve_url (url_parsed, url, &file, &redirected,
+                                     referer, &dt, false, i, true);
+              retry_deferral = false;
+              if (opt.pipeline > 1)
+                http_set_pipeline_hint (NULL, NULL, 0);
+
+              /* Put the URL back, to be tried again once its host has
+                 had some time to recover.  */
+              if (status == RETRYLATER)
+                {
+                  url_requeue (queue, iri_dup (i), xstrdup (url), referer,
+                               depth, html_allowed, css_allowed, retry_tries);
+                  retry_host = true;
+                  xfree_null (redirected);
+                  redirected = NULL;
+                }
+            }
 
           if (html_allowed && file && status == RETROK
               && (dt & RETROKF) && (dt & TEXTHTML))
@@ -311,7 +1604,7 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
                   else
                     /* Make sure that the old pre-redirect form gets
                        blacklisted. */
-                    string_set_add (blacklist, url);
+                    visited_set_add (blacklist, url);
                 }
 
               xfree (url);
@@ -330,30 +1623,11 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
           visited_url (url, referer);
         }
 
-      if (descend
-          && depth >= opt.reclevel && opt.reclevel != INFINITE_RECURSION)
+      if (descend && !descend_depth_p (depth, &dash_p_leaf_HTML))
         {
-          if (opt.page_requisites
-              && (depth == opt.reclevel || depth == opt.reclevel + 1))
-            {
-              /* When -p is specified, we are allowed to exceed the
-                 maximum depth, but only for the "inline" links,
-                 i.e. those that are needed to display the page.
-                 Originally this could exceed the depth at most by
-                 one, but we allow one more level so that the leaf
-                 pages that contain frames can be loaded
-                 correctly.  */
-              dash_p_leaf_HTML = true;
-            }
-          else
-            {
-              /* Either -p wasn't specified or it was and we've
-                 already spent the two extra (pseudo-)levels that it
-                 affords us, so we need to bail out. */
-              DEBUGP (("Not descending further; at depth %d, max. %d.\n",
-                       depth, opt.reclevel));
-              descend = false;
-            }
+          DEBUGP (("Not descending further; at depth %d, max. %d.\n",
+                   depth, opt.reclevel));
+          descend = false;
         }
 
       /* If the downloaded document was HTML or CSS, parse it and enqueue the
@@ -362,9 +1636,10 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
       if (descend)
         {
           bool meta_disallow_follow = false;
-          struct urlpos *children
-            = is_css ? get_urls_css_file (file, url) :
-                       get_urls_html (file, url, &meta_disallow_follow, i);
+          double task_start = timing_task_begin ();
+          children = is_css ? get_urls_css_file (file, url) :
+                              get_urls_html (file, url, &meta_disallow_follow, i);
+          timing_task_end (TASK_PARSE, task_start);
 
           if (opt.use_robots && meta_disallow_follow)
             {
@@ -380,12 +1655,17 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
               char *referer_url = url;
               bool strip_auth = (url_parsed != NULL
                                  && url_parsed->user != NULL);
+              double task_start = timing_task_begin ();
               assert (url_parsed != NULL);
 
               /* Strip auth info if present */
               if (strip_auth)
                 referer_url = url_string (url_parsed, URL_AUTH_HIDE);
 
+              /* Workers do their own lookups.  */
+              if (!pool)
+                prefetch_hosts (child, url_parsed, blacklist);
+
               for (; child; child = child->next)
                 {
                   if (child->ignore_when_downloading)
@@ -398,20 +1678,21 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
                       ci = iri_new ();
                       set_uri_encoding (ci, i->content_encoding, false);
                       url_enqueue (queue, ci, xstrdup (child->url->url),
-                                   xstrdup (referer_url), depth + 1,
+                                   referer_url, depth + 1,
                                    child->link_expect_html,
-                                   child->link_expect_css);
+                                   child->link_expect_css,
+                                   child->link_inline_p);
                       /* We blacklist the URL we have enqueued, because we
                          don't want to enqueue (and hence download) the
                          same URL twice.  */
-                      string_set_add (blacklist, child->url->url);
+                      visited_set_add (blacklist, child->url->url);
                     }
                 }
 
               if (strip_auth)
                 xfree (referer_url);
               url_free (url_parsed);
-              free_urlpos (children);
+              timing_task_end (TASK_QUEUE, task_start);
             }
         }
 
@@ -423,7 +1704,8 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
           /* Either --delete-after was specified, or we loaded this
              (otherwise unneeded because of --spider or rejected by -R)
              HTML file just to harvest its hyperlinks -- in either case,
-             delete the local file. */
+             delete the local file.  It is not there if the document
+             was only kept in memory. */
           DEBUGP (("Removing file due to %s in recursive_retrieve():\n",
                    opt.delete_after ? "--delete-after" :
                    (opt.spider ? "--spider" :
@@ -433,36 +1715,56 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
                       ? _("Removing %s.\n")
                       : _("Removing %s since it should be rejected.\n")),
                      file);
-          if (unlink (file))
+          if (unlink (file) && errno != ENOENT)
             logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
           logputs (LOG_VERBOSE, "\n");
           register_delete_file (file);
         }
 
+      /* Convert the links in the file once the URLs they point to
+         are settled, and say that this URL is.  */
+      if (convert_incrementally)
+        {
+          if (file)
+            convert_file_when_ready (file, url, children, is_css);
+          convert_url_settled (dequeued);
+          xfree (dequeued);
+        }
+      free_urlpos (children);
+      url_queue_done (queue, host, contacted);
+      if (retry_host)
+        url_queue_defer (queue, host, retry_delay);
+
       xfree (url);
-      xfree_null (referer);
       xfree_null (file);
       iri_free (i);
     }
 
-  /* If anything is left of the queue due to a premature exit, free it
-     now.  */
-  {
-    char *d1, *d2;
-    int d3;
-    bool d4, d5;
-    struct iri *d6;
-    while (url_dequeue (queue, (struct iri **)&d6,
-                        (const char **)&d1, (const char **)&d2, &d3, &d4, &d5))
-      {
-        iri_free (d6);
-        xfree (d1);
-        xfree_null (d2);
-      }
-  }
+  /* Keep the state of an unfinished crawl, and drop that of a
+     finished one.  */
+  if (state_timer)
+    {
+      if (queue->count > 0)
+        save_state (start_url_parsed->url, queue, inflight, blacklist);
+      else if (unlink (opt.state_file) < 0 && errno != ENOENT)
+        logprintf (LOG_NOTQUIET, "%s: %s\n", opt.state_file,
+                   strerror (errno));
+      ptimer_destroy (state_timer);
+    }
+
+  /* If anything is left of the queue due to a premature exit, it is
+     freed now.  */
+  current_queue = NULL;
+  current_blacklist = NULL;
   url_queue_delete (queue);
 
-  string_set_free (blacklist);
+  if (pool)
+    parallel_pool_delete (pool);
+  link_capture = false;
+  crawl_spacing = false;
+  link_stream_cleanup ();
+
+  visited_set_free (blacklist);
 
   if (opt.quota && total_downloaded_bytes > opt.quota)
     return QUOTEXC;
@@ -472,6 +1774,35 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
     return RETROK;
 }
 
+/* Start resolving the hosts of the links in CHILDREN, found in the
+   document at PARENT, that download_child_p is about to consider.
+   That function may contact those hosts right away, to get
+   robots.txt, so this is done for all of them first.  Only the cheap
+   checks on the host are made here; the rest are left to
+   download_child_p.  */
+
+static void
+prefetch_hosts (struct urlpos *children, struct url *parent,
+                struct visited_set *blacklist)
+{
+  struct urlpos *child;
+  for (child = children; child; child = child->next)
+    {
+      struct url *u = child->url;
+      if (child->ignore_when_downloading
+          || visited_set_contains (blacklist, u->url))
+        continue;
+      if (!schemes_are_similar_p (u->scheme, SCHEME_HTTP)
+          && !(u->scheme == SCHEME_FTP && opt.follow_ftp))
+        continue;
+      if (!opt.spanhost && 0 != strcasecmp (parent->host, u->host))
+        continue;
+      if (!accept_domain (u) || url_uses_proxy (u))
+        continue;
+      host_prefetch (u->host);
+    }
+}
+
 /* Based on the context provided by retrieve_tree, decide whether a
    URL is to be descended to.  This is only ever called from
    retrieve_tree, but is in a separate function for clarity.
@@ -482,7 +1813,7 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
 static bool
 download_child_p (const struct urlpos *upos, struct url *parent, int depth,
-                  struct url *start_url_parsed, struct hash_table *blacklist,
+                  struct url *start_url_parsed, struct visited_set *blacklist,
                   struct iri *iri)
 {
   struct url *u = upos->url;
@@ -491,7 +1822,7 @@ download_child_p (const struct urlpos *upos, struct url *parent, int depth,
 
   DEBUGP (("Deciding whether to enqueue \"%s\".\n", url));
 
-  if (string_set_contains (blacklist, url))
+  if (visited_set_contains (blacklist, url))
     {
       if (opt.spider)
         {
@@ -513,7 +1844,8 @@ download_child_p (const struct urlpos *upos, struct url *parent, int depth,
      6. check for suffix
      7. check for same host (if spanhost is unset), with possible
      gethostbyname baggage
-     8. check for robots.txt
+     8. check for the shard of the host
+     9. check for robots.txt
 
      Addendum: If the URL is FTP, and it is to be loaded, only the
      domain and suffix settings are "stronger".
@@ -623,45 +1955,32 @@ download_child_p (const struct urlpos *upos, struct url *parent, int depth,
         goto out;
       }
 
-  /* 8. */
+  /* 8. With --shard, the URLs of the hosts of other shards are
+     forwarded to them, robots.txt being checked there.  */
+  if (!shard_owns_p (u->host))
+    {
+      char *referer = url_string (parent, URL_AUTH_HIDE);
+      shard_forward (u->host, url, referer, depth + 1,
+                     upos->link_expect_html, upos->link_expect_css,
+                     upos->link_inline_p);
+      xfree (referer);
+      visited_set_add (blacklist, url);
+      goto out;
+    }
+
+  /* 9. */
   if (opt.use_robots && u_scheme_like_http)
     {
       struct robot_specs *specs = res_get_specs (u->host, u->port);
       if (!specs)
-        {
-          char *rfile;
-          if (res_retrieve_file (url, &rfile, iri))
-            {
-              specs = res_parse_from_file (rfile);
-
-              /* Delete the robots.txt file if we chose to either delete the
-                 files after downloading or we're just running a spider. */
-              if (opt.delete_after || opt.spider)
-                {
-                  logprintf (LOG_VERBOSE, _("Removing %s.\n"), rfile);
-                  if (unlink (rfile))
-                      logprintf (LOG_NOTQUIET, "unlink: %s\n",
-                                 strerror (errno));
-                }
-
-              xfree (rfile);
-            }
-          else
-            {
-              /* If we cannot get real specs, at least produce
-                 dummy ones so that we can register them and stop
-                 trying to retrieve them.  */
-              specs = res_parse ("", 0);
-            }
-          res_register_specs (u->host, u->port, specs);
-        }
+        specs = res_retrieve_specs (url, u->host, u->port, iri);
 
       /* Now that we have (or don't have) robots.txt specs, we can
          check what they say.  */
       if (!res_match_path (specs, u->path))
         {
           DEBUGP (("Not following %s because robots.txt forbids it.\n", url));
-          string_set_add (blacklist, url);
+          visited_set_add (blacklist, url);
           goto out;
         }
     }
@@ -685,7 +2004,7 @@ download_child_p (const struct urlpos *upos, struct url *parent, int depth,
 
 static bool
 descend_redirect_p (const char *redirected, struct url *orig_parsed, int depth,
-                    struct url *start_url_parsed, struct hash_table *blacklist,
+                    struct url *start_url_parsed, struct visited_set *blacklist,
                     struct iri *iri)
 {
   struct url *new_parsed;
@@ -46,5 +46,7 @@ struct urlpos;
 
 void recursive_cleanup (void);
 uerr_t retrieve_tree (struct url *, struct iri *);
+void recur_memory (size_t *, size_t *);
+void recur_counts (int *, int *);
 
 #endif /* RECUR_H */
@@ -64,22 +64,34 @@ as that of the covered work.  */
      whether anyone deploys the recommended expiry scheme for
      robots.txt.
 
+   * As with most current robots, `*' in a path matches any sequence
+     of characters, and a trailing `$' anchors the path at the end of
+     the URL path.
+
+   * The `Crawl-delay' field, not part of the draft, is honored as
+     the number of seconds to wait between requests to the server,
+     up to CRAWL_DELAY_MAX.
+
    Entry points are functions res_parse, res_parse_from_file,
-   res_match_path, res_register_specs, res_get_specs, and
-   res_retrieve_file.  */
+   res_match_path, res_register_specs, res_get_specs,
+   res_crawl_delay, res_retrieve_file, and res_retrieve_specs.  */
 
 #include "wget.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "utils.h"
 #include "hash.h"
 #include "url.h"
 #include "retr.h"
+#include "http.h"
 #include "res.h"
 
 #ifdef TESTING
@@ -92,11 +104,43 @@ struct path_info {
   bool user_agent_exact_p;
 };
 
+/* The paths without wildcards are compiled into a trie of their
+   %-decoded characters, so that a URL path can be matched against
+   all of them in a single walk.  A node's children are linked
+   through SIBLING, 0 ending the list (the root, node 0, is nobody's
+   child).  RULE is the index of the first path ending at the node,
+   or -1.  */
+
+struct trie_node {
+  char c;
+  int child;
+  int sibling;
+  int rule;
+};
+
+/* A path with wildcards, matched separately.  */
+
+struct wildcard_path {
+  int rule;                     /* index of the path */
+  char *pattern;                /* the %-decoded path */
+  int length;
+};
+
 struct robot_specs {
   int count;
   int size;
   struct path_info *paths;
+
+  struct trie_node *nodes;      /* the trie, nodes[0] being the root */
+  int node_count;
+
+  struct wildcard_path *wildcards; /* paths with wildcards, in */
+  int wildcard_count;              /* increasing order of index */
+
+  double crawl_delay;           /* seconds between requests, or 0 */
 };
+
+static void compile_specs (struct robot_specs *);
 
 /* Parsing the robot spec. */
 
@@ -186,6 +230,32 @@ prune_non_exact (struct robot_specs *specs)
 #define FIELD_IS(string_literal)        \
   BOUNDED_EQUAL_NO_CASE (field_b, field_e, string_literal)
 
+/* The longest Crawl-delay honored, in seconds.  The value comes from
+   the server, and a longer one, be it a typo or malice, would stall
+   the crawl of the host.  */
+#define CRAWL_DELAY_MAX 60
+
+/* Parse the Crawl-delay value in S.  Returns the delay in seconds,
+   capped at CRAWL_DELAY_MAX, or -1 if S holds no finite, non-negative
+   number.  */
+
+static double
+parse_crawl_delay (const char *s)
+{
+  char *end;
+  double delay = strtod (s, &end);
+
+  if (end == s || !isfinite (delay) || delay < 0)
+    return -1;
+  if (delay > CRAWL_DELAY_MAX)
+    {
+      DEBUGP (("Capping crawl delay of %g seconds to %d\n",
+               delay, CRAWL_DELAY_MAX));
+      delay = CRAWL_DELAY_MAX;
+    }
+  return delay;
+}
+
 /* Parse textual RES specs beginning with SOURCE of length LENGTH.
    Return a specs objects ready to be fed to res_match_path.
 
@@ -238,6 +308,10 @@ res_parse (const char *source, int length)
      the last `user-agent' instructions.  */
   int record_count = 0;
 
+  /* the crawl delay of the "*" records, used if there is no exact
+     one.  */
+  double crawl_delay_any = 0;
+
   struct robot_specs *specs = xnew0 (struct robot_specs);
 
   while (1)
@@ -349,6 +423,20 @@ res_parse (const char *source, int length)
             }
           ++record_count;
         }
+      else if (FIELD_IS ("crawl-delay"))
+        {
+          char *value = strdupdelim (value_b, value_e);
+          double delay = parse_crawl_delay (value);
+          if (delay < 0)
+            DEBUGP (("Ignoring malformed crawl delay at line %d\n",
+                     line_count));
+          else if (user_agent_exact)
+            specs->crawl_delay = delay;
+          else if (user_agent_applies)
+            crawl_delay_any = delay;
+          xfree (value);
+          ++record_count;
+        }
       else
         {
           DEBUGP (("Ignoring unknown field at line %d\n", line_count));
@@ -366,7 +454,10 @@ res_parse (const char *source, int length)
          all the stuff with user-agent: *.  */
       prune_non_exact (specs);
     }
-  else if (specs->size > specs->count)
+  else
+    specs->crawl_delay = crawl_delay_any;
+
+  if (!found_exact && specs->size > specs->count)
     {
       /* add_path normally over-allocates specs->paths.  Reallocate it
          to the correct size in order to conserve some memory.  */
@@ -375,6 +466,7 @@ res_parse (const char *source, int length)
       specs->size = specs->count;
     }
 
+  compile_specs (specs);
   return specs;
 }
 
@@ -404,6 +496,10 @@ free_specs (struct robot_specs *specs)
   for (i = 0; i < specs->count; i++)
     xfree (specs->paths[i].path);
   xfree_null (specs->paths);
+  xfree_null (specs->nodes);
+  for (i = 0; i < specs->wildcard_count; i++)
+    xfree (specs->wildcards[i].pattern);
+  xfree_null (specs->wildcards);
   xfree (specs);
 }
 
@@ -425,53 +521,201 @@ free_specs (struct robot_specs *specs)
     }                                                           \
 } while (0)
 
-/* The inner matching engine: return true if RECORD_PATH matches
-   URL_PATH.  The rules for matching are described at
+/* Store the %-decoded PATH to DEST, which must have room for
+   strlen (PATH) characters, and return the decoded length.  The rules
+   for decoding are described at
    <http://www.robotstxt.org/wc/norobots-rfc.txt>, section 3.2.2.  */
 
+static int
+decode_path (const char *path, char *dest)
+{
+  const char *p;
+  char *d = dest;
+  for (p = path; *p; p++)
+    {
+      char c = *p;
+      DECODE_MAYBE (c, p);
+      *d++ = c;
+    }
+  return d - dest;
+}
+
+/* Return true if PATH, a path with wildcards, is a prefix of the URL
+   path [S, SE), or equal to it if PATH ends with `$'.  Both are
+   %-decoded.  */
+
 static bool
-matches (const char *record_path, const char *url_path)
+wildcard_matches (const char *p, const char *pe, const char *s,
+                  const char *se)
 {
-  const char *rp = record_path;
-  const char *up = url_path;
+  const char *star_p = NULL, *star_s = NULL;
+  bool anchored = false;
 
-  for (; ; ++rp, ++up)
+  if (pe > p && pe[-1] == '$')
     {
-      char rc = *rp;
-      char uc = *up;
-      if (!rc)
-        return true;
-      if (!uc)
-        return false;
-      DECODE_MAYBE(rc, rp);
-      DECODE_MAYBE(uc, up);
-      if (rc != uc)
+      --pe;
+      anchored = true;
+    }
+
+  for (;;)
+    {
+      if (p == pe)
+        {
+          if (!anchored || s == se)
+            return true;
+        }
+      else if (*p == '*')
+        {
+          star_p = ++p;
+          star_s = s;
+          continue;
+        }
+      else if (s < se && *p == *s)
+        {
+          ++p, ++s;
+          continue;
+        }
+      /* Mismatch: let the last `*' swallow one more character.  */
+      if (!star_p || star_s == se)
         return false;
+      p = star_p;
+      s = ++star_s;
+    }
+}
+
+/* Compile the paths of SPECS for res_match_path: paths with wildcards
+   are listed in SPECS->wildcards, and the others inserted into the
+   trie.  */
+
+static void
+compile_specs (struct robot_specs *specs)
+{
+  int i, size = 1, longest = 0;
+  char *decoded;
+
+  for (i = 0; i < specs->count; i++)
+    {
+      int len = strlen (specs->paths[i].path);
+      size += len;
+      if (len > longest)
+        longest = len;
+    }
+  decoded = xmalloc (longest + 1);
+  specs->nodes = xnew_array (struct trie_node, size);
+  specs->nodes[0].child = 0;
+  specs->nodes[0].rule = -1;
+  specs->node_count = 1;
+  specs->wildcards = NULL;
+  specs->wildcard_count = 0;
+
+  for (i = 0; i < specs->count; i++)
+    {
+      const char *path = specs->paths[i].path;
+      int len, j, node;
+
+      len = decode_path (path, decoded);
+      if (strchr (path, '*') || (*path && path[strlen (path) - 1] == '$'))
+        {
+          struct wildcard_path *w;
+          if (!specs->wildcards)
+            specs->wildcards = xnew_array (struct wildcard_path,
+                                           specs->count);
+          w = &specs->wildcards[specs->wildcard_count++];
+          w->rule = i;
+          w->pattern = xmalloc (len + 1);
+          memcpy (w->pattern, decoded, len);
+          w->pattern[len] = '\0';
+          w->length = len;
+          continue;
+        }
+
+      node = 0;
+      for (j = 0; j < len; j++)
+        {
+          int child;
+          for (child = specs->nodes[node].child; child;
+               child = specs->nodes[child].sibling)
+            if (specs->nodes[child].c == decoded[j])
+              break;
+          if (!child)
+            {
+              struct trie_node *n;
+              child = specs->node_count++;
+              n = &specs->nodes[child];
+              n->c = decoded[j];
+              n->child = 0;
+              n->rule = -1;
+              n->sibling = specs->nodes[node].child;
+              specs->nodes[node].child = child;
+            }
+          node = child;
+        }
+      /* Earlier paths take precedence.  */
+      if (specs->nodes[node].rule == -1)
+        specs->nodes[node].rule = i;
     }
+  xfree (decoded);
 }
 
-/* Iterate through all paths in SPECS.  For the first one that
-   matches, return its allow/reject status.  If none matches,
-   retrieval is by default allowed.  */
+/* Find the first path in SPECS that matches PATH.  For that path,
+   return its allow/reject status.  If none matches, retrieval is by
+   default allowed.
+
+   A path matches if it is a prefix of PATH, so walking the trie along
+   PATH visits exactly the nodes of the wildcard-free paths that
+   match.  */
 
 bool
 res_match_path (const struct robot_specs *specs, const char *path)
 {
-  int i;
+  char *decoded;
+  int len, i, node, rule;
+
   if (!specs)
     return true;
-  for (i = 0; i < specs->count; i++)
-    if (matches (specs->paths[i].path, path))
-      {
-        bool allowedp = specs->paths[i].allowedp;
-        DEBUGP (("%s path %s because of rule %s.\n",
-                 allowedp ? "Allowing" : "Rejecting",
-                 path, quote (specs->paths[i].path)));
-        return allowedp;
-      }
+
+  decoded = (char *) alloca (strlen (path) + 1);
+  len = decode_path (path, decoded);
+
+  node = 0;
+  rule = specs->nodes[0].rule;
+  for (i = 0; i < len; i++)
+    {
+      for (node = specs->nodes[node].child; node;
+           node = specs->nodes[node].sibling)
+        if (specs->nodes[node].c == decoded[i])
+          break;
+      if (!node)
+        break;
+      if (specs->nodes[node].rule != -1
+          && (rule == -1 || specs->nodes[node].rule < rule))
+        rule = specs->nodes[node].rule;
+    }
+
+  for (i = 0; i < specs->wildcard_count; i++)
+    {
+      const struct wildcard_path *w = &specs->wildcards[i];
+      if (rule != -1 && w->rule > rule)
+        break;
+      if (wildcard_matches (w->pattern, w->pattern + w->length,
+                            decoded, decoded + len))
+        {
+          rule = w->rule;
+          break;
+        }
+    }
+
+  if (rule != -1)
+    {
+      bool allowedp = specs->paths[rule].allowedp;
+      DEBUGP (("%s path %s because of rule %s.\n",
+               allowedp ? "Allowing" : "Rejecting",
+               path, quote (specs->paths[rule].path)));
+      return allowedp;
+    }
   return true;
 }
-
+
 /* Registering the specs. */
 
 static struct hash_table *registered_specs;
@@ -522,6 +766,17 @@ res_get_specs (const char *host, int port)
   return hash_table_get (registered_specs, hp);
 }
 
+/* Return the number of seconds the robots.txt of HOST:PORT asks to
+   wait between requests, or 0 if it doesn't say or hasn't been read
+   yet.  */
+
+double
+res_crawl_delay (const char *host, int port)
+{
+  struct robot_specs *specs = res_get_specs (host, port);
+  return specs ? specs->crawl_delay : 0;
+}
+
 /* Loading the robots file.  */
 
 #define RES_SPECS_LOCATION "/robots.txt"
@@ -583,6 +838,339 @@ res_retrieve_file (const char *url, char **file, struct iri *iri)
   return err == RETROK;
 }
 
+/* The robots cache.  With --robots-cache-file, the specs retrieved
+   from each server are kept in a file together with the time they
+   were retrieved and their validators, so that later runs needn't
+   retrieve them again.  Specs older than opt.robots_cache_ttl are
+   revalidated with a conditional request.
+
+   The cache holds the paths of the specs, one per line, preceded by
+   "A" or "D" for allowed and disallowed paths and a TAB, and a crawl
+   delay, if any, preceded by "C" and a TAB.  The paths
+   of one server follow a line holding its host:port, the time of
+   retrieval, the ETag and the Last-Modified date, separated by TABs,
+   with "-" for missing validators.  */
+
+struct cached_robots {
+  time_t fetched;               /* time of retrieval or revalidation */
+  char *etag;
+  char *last_modified;
+  char *rules;                  /* the paths and the crawl delay, in
+                                   the file's format */
+};
+
+static struct hash_table *robots_cache;
+static bool robots_cache_loaded_p;
+
+/* Return the paths and the crawl delay of SPECS in the cache file
+   format.  */
+
+static char *
+specs_to_rules (const struct robot_specs *specs)
+{
+  int i, size = 1 + 2 + 32 + 1;
+  char *rules, *p;
+
+  for (i = 0; i < specs->count; i++)
+    size += 3 + 1 + strlen (specs->paths[i].path);
+  p = rules = xmalloc (size);
+  if (specs->crawl_delay > 0)
+    p += sprintf (p, "C\t%g\n", specs->crawl_delay);
+  for (i = 0; i < specs->count; i++)
+    {
+      int len = strlen (specs->paths[i].path);
+      *p++ = specs->paths[i].allowedp ? 'A' : 'D';
+      *p++ = '\t';
+      *p++ = '/';
+      memcpy (p, specs->paths[i].path, len);
+      p += len;
+      *p++ = '\n';
+    }
+  *p = '\0';
+  return rules;
+}
+
+/* Build specs out of RULES, in the cache file format.  */
+
+static struct robot_specs *
+specs_from_rules (const char *rules)
+{
+  struct robot_specs *specs = xnew0 (struct robot_specs);
+  const char *p = rules;
+
+  while (*p)
+    {
+      const char *eol = strchr (p, '\n');
+      if (!eol)
+        eol = p + strlen (p);
+      if (eol - p >= 2 && p[1] == '\t' && *p == 'C')
+        {
+          double delay = parse_crawl_delay (p + 2);
+          specs->crawl_delay = delay > 0 ? delay : 0;
+        }
+      else if (eol - p >= 2 && p[1] == '\t')
+        add_path (specs, p + 2, eol, *p == 'A', true);
+      p = *eol ? eol + 1 : eol;
+    }
+  compile_specs (specs);
+  return specs;
+}
+
+static void
+free_cached_robots (struct cached_robots *cr)
+{
+  xfree_null (cr->etag);
+  xfree_null (cr->last_modified);
+  xfree_null (cr->rules);
+  xfree (cr);
+}
+
+/* Store CR as the cache entry of HOSTPORT, replacing the old one.  */
+
+static void
+robots_cache_put (const char *hostport, struct cached_robots *cr)
+{
+  char *key;
+  struct cached_robots *old;
+
+  if (!robots_cache)
+    robots_cache = make_nocase_string_hash_table (0);
+  if (hash_table_get_pair (robots_cache, hostport, &key, &old))
+    {
+      free_cached_robots (old);
+      hash_table_put (robots_cache, key, cr);
+    }
+  else
+    hash_table_put (robots_cache, xstrdup (hostport), cr);
+}
+
+static char *
+validator_or_null (const char *s)
+{
+  return strcmp (s, "-") ? xstrdup (s) : NULL;
+}
+
+/* Load the entries of the robots cache file, if there is one.  */
+
+static void
+robots_cache_load (void)
+{
+  FILE *fp;
+  char *line;
+  int lineno = 0;
+  struct cached_robots *cr = NULL;
+  char *hostport = NULL;
+  char *rules = NULL;
+  int rules_len = 0;
+
+  robots_cache_loaded_p = true;
+  fp = fopen (opt.robots_cache_file, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot open robots cache file %s: %s\n"),
+                   quote (opt.robots_cache_file), strerror (errno));
+      return;
+    }
+
+#define FINISH_ENTRY() do {                             \
+  if (cr)                                               \
+    {                                                   \
+      cr->rules = rules ? rules : xstrdup ("");         \
+      robots_cache_put (hostport, cr);                  \
+      xfree (hostport);                                 \
+    }                                                   \
+  cr = NULL, rules = NULL, rules_len = 0;               \
+} while (0)
+
+  for (; (line = read_whole_line (fp)) != NULL; xfree (line))
+    {
+      char *fields[4];
+      char *p = line;
+      int i, len;
+      double fetched;
+
+      ++lineno;
+      len = strlen (line);
+      if (len && line[len - 1] == '\n')
+        line[--len] = '\0';
+      if (!*line || *line == '#')
+        continue;
+
+      if ((*line == 'A' || *line == 'D' || *line == 'C') && line[1] == '\t')
+        {
+          if (!cr)
+            goto invalid;
+          rules = xrealloc (rules, rules_len + len + 2);
+          memcpy (rules + rules_len, line, len);
+          rules_len += len;
+          rules[rules_len++] = '\n';
+          rules[rules_len] = '\0';
+          continue;
+        }
+
+      FINISH_ENTRY ();
+      for (i = 0; i < 4; i++)
+        {
+          fields[i] = p;
+          p = strchr (p, '\t');
+          if (!p)
+            break;
+          *p++ = '\0';
+        }
+      if (i < 3 || p || sscanf (fields[1], "%lf", &fetched) != 1)
+        goto invalid;
+      cr = xnew0 (struct cached_robots);
+      cr->fetched = fetched;
+      cr->etag = validator_or_null (fields[2]);
+      cr->last_modified = validator_or_null (fields[3]);
+      hostport = xstrdup (fields[0]);
+      continue;
+
+    invalid:
+      logprintf (LOG_NOTQUIET, _("%s: Invalid entry at line %d.\n"),
+                 quote (opt.robots_cache_file), lineno);
+    }
+  FINISH_ENTRY ();
+#undef FINISH_ENTRY
+  fclose (fp);
+}
+
+/* Write the robots cache to the cache file.  */
+
+void
+res_cache_save (void)
+{
+  FILE *fp;
+  hash_table_iterator iter;
+
+  if (!opt.robots_cache_file || !robots_cache)
+    return;
+  fp = fopen (opt.robots_cache_file, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot open robots cache file %s: %s\n"),
+                 quote (opt.robots_cache_file), strerror (errno));
+      return;
+    }
+  fputs ("# Wget robots.txt cache file.\n", fp);
+  for (hash_table_iterate (robots_cache, &iter); hash_table_iter_next (&iter); )
+    {
+      const struct cached_robots *cr = iter.value;
+      fprintf (fp, "%s\t%.0f\t%s\t%s\n%s", (const char *) iter.key,
+               (double) cr->fetched,
+               cr->etag ? cr->etag : "-",
+               cr->last_modified ? cr->last_modified : "-",
+               cr->rules);
+    }
+  if (fclose (fp) < 0)
+    logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
+               quote (opt.robots_cache_file), strerror (errno));
+  else
+    DEBUGP (("Saved robots cache to %s.\n", opt.robots_cache_file));
+}
+
+/* Get the specs of the server HOST:PORT that serves URL and register
+   them.  They come from the robots cache if they are recent enough;
+   otherwise robots.txt is retrieved, conditionally if the cache holds
+   an older version of it.  */
+
+struct robot_specs *
+res_retrieve_specs (const char *url, const char *host, int port,
+                    struct iri *iri)
+{
+  struct robot_specs *specs = NULL;
+  struct cached_robots *cr = NULL;
+  struct http_validators v;
+  char *hp, *rfile;
+  time_t now = time (NULL);
+  bool ok, retrieved = false;
+  SET_HOSTPORT (host, port, hp);
+
+  if (opt.robots_cache_file)
+    {
+      if (!robots_cache_loaded_p)
+        robots_cache_load ();
+      if (robots_cache)
+        cr = hash_table_get (robots_cache, hp);
+    }
+  if (cr && cr->fetched + opt.robots_cache_ttl > now)
+    {
+      DEBUGP (("Using cached robots.txt of %s.\n", hp));
+      specs = specs_from_rules (cr->rules);
+      res_register_specs (host, port, specs);
+      return specs;
+    }
+
+  xzero (v);
+  if (cr)
+    {
+      v.etag = cr->etag ? xstrdup (cr->etag) : NULL;
+      v.last_modified = cr->last_modified ? xstrdup (cr->last_modified) : NULL;
+    }
+  if (opt.robots_cache_file)
+    http_set_conditional (&v);
+  ok = res_retrieve_file (url, &rfile, iri);
+  http_set_conditional (NULL);
+
+  if (ok && v.statcode == 304 && cr)
+    {
+      DEBUGP (("Cached robots.txt of %s is still valid.\n", hp));
+      specs = specs_from_rules (cr->rules);
+      cr->fetched = now;
+    }
+  else if (ok)
+    {
+      specs = res_parse_from_file (rfile);
+      retrieved = specs != NULL;
+
+      /* Delete the robots.txt file if we chose to either delete the
+         files after downloading or we're just running a spider. */
+      if (opt.delete_after || opt.spider)
+        {
+          logprintf (LOG_VERBOSE, _("Removing %s.\n"), rfile);
+          if (unlink (rfile))
+              logprintf (LOG_NOTQUIET, "unlink: %s\n",
+                         strerror (errno));
+        }
+    }
+  else if (cr && !(v.statcode >= 400 && v.statcode < 500))
+    {
+      /* The server couldn't be reached or failed; better obey its old
+         specs than none.  */
+      specs = specs_from_rules (cr->rules);
+    }
+  xfree_null (rfile);
+
+  if (!specs)
+    {
+      /* If we cannot get real specs, at least produce dummy ones so
+         that we can register them and stop trying to retrieve
+         them.  */
+      specs = res_parse ("", 0);
+    }
+
+  /* A server without robots.txt has no specs, but that is worth
+     caching as well.  */
+  if (opt.robots_cache_file
+      && (retrieved || (!ok && v.statcode >= 400 && v.statcode < 500)))
+    {
+      cr = xnew (struct cached_robots);
+      cr->fetched = now;
+      cr->etag = retrieved ? v.etag : NULL;
+      cr->last_modified = retrieved ? v.last_modified : NULL;
+      cr->rules = specs_to_rules (specs);
+      robots_cache_put (hp, cr);
+      if (retrieved)
+        v.etag = v.last_modified = NULL;
+    }
+  xfree_null (v.etag);
+  xfree_null (v.last_modified);
+
+  res_register_specs (host, port, specs);
+  return specs;
+}
+
 bool
 is_robots_txt_url (const char *url)
 {
@@ -610,6 +1198,19 @@ res_cleanup (void)
       hash_table_destroy (registered_specs);
       registered_specs = NULL;
     }
+  if (robots_cache)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (robots_cache, &iter);
+           hash_table_iter_next (&iter);
+           )
+        {
+          xfree (iter.key);
+          free_cached_robots (iter.value);
+        }
+      hash_table_destroy (robots_cache);
+      robots_cache = NULL;
+    }
 }
 
 #ifdef TESTING
@@ -636,6 +1237,128 @@ test_is_robots_txt_url()
   return NULL;
 }
 
+const char *
+test_res_match_path (void)
+{
+  static const char robots[] =
+    "User-Agent: *\n"
+    "Disallow: /\n"
+    "\n"
+    "User-Agent: wget\n"
+    "Disallow: /private/\n"
+    "Allow: /private/public\n"
+    "Disallow: /pr\n"
+    "Disallow: /a%62c\n"
+    "Disallow: /x%2fy\n"
+    "Disallow: /*.cgi$\n"
+    "Disallow: /img/*/thumb\n"
+    "Allow: /release\n"
+    "Disallow: /re\n";
+  static const char disallow_all[] =
+    "User-Agent: *\n"
+    "Disallow: /\n";
+  int i;
+  struct {
+    const char *path;
+    bool allowed;
+  } test_array[] = {
+    { "", true },
+    { "index.html", true },
+    { "private/", false },
+    { "private/public", false },        /* Disallow: /private/ comes first */
+    { "privat", false },
+    { "p", true },
+    { "abc/d", false },
+    { "ab%63", false },
+    { "x/y", true },
+    { "x%2fy", false },
+    { "x%2Fy", true },
+    { "bin/run.cgi", false },
+    { "bin/run.cgi?x", true },
+    { "img/a/b/thumb.png", false },
+    { "img/thumb", true },
+    { "release/notes", true },
+    { "rest", false },
+  };
+  struct robot_specs *specs = res_parse (robots, sizeof (robots) - 1);
+
+  for (i = 0; i < countof (test_array); ++i)
+    mu_assert ("test_res_match_path: wrong result",
+               res_match_path (specs, test_array[i].path)
+               == test_array[i].allowed);
+  free_specs (specs);
+
+  specs = res_parse (disallow_all, strlen (disallow_all));
+  mu_assert ("test_res_match_path: Disallow: / allows",
+             !res_match_path (specs, "anything"));
+  free_specs (specs);
+
+  return NULL;
+}
+
+const char *
+test_res_crawl_delay (void)
+{
+  static const char robots[] =
+    "User-Agent: *\n"
+    "Crawl-delay: 10\n"
+    "\n"
+    "User-Agent: wget\n"
+    "Crawl-delay: 2.5\n"
+    "Disallow: /tmp\n";
+  static const char any_only[] =
+    "User-Agent: google\n"
+    "Crawl-delay: 30\n"
+    "\n"
+    "User-Agent: *\n"
+    "Crawl-delay: 4 # seconds\n";
+  static const char infinite[] =
+    "User-Agent: *\n"
+    "Crawl-delay: inf\n";
+  static const char huge[] =
+    "User-Agent: *\n"
+    "Crawl-delay: 1e9\n";
+  struct robot_specs *specs;
+  char *rules;
+
+  specs = res_parse (robots, sizeof (robots) - 1);
+  mu_assert ("test_res_crawl_delay: exact record not preferred",
+             specs->crawl_delay == 2.5);
+  rules = specs_to_rules (specs);
+  free_specs (specs);
+  specs = specs_from_rules (rules);
+  mu_assert ("test_res_crawl_delay: not kept in the cache format",
+             specs->crawl_delay == 2.5 && !res_match_path (specs, "tmp"));
+  xfree (rules);
+  free_specs (specs);
+
+  specs = res_parse (any_only, sizeof (any_only) - 1);
+  mu_assert ("test_res_crawl_delay: wrong delay of the * record",
+             specs->crawl_delay == 4);
+  free_specs (specs);
+
+  specs = res_parse (infinite, sizeof (infinite) - 1);
+  mu_assert ("test_res_crawl_delay: infinite delay accepted",
+             specs->crawl_delay == 0);
+  free_specs (specs);
+
+  specs = res_parse (huge, sizeof (huge) - 1);
+  mu_assert ("test_res_crawl_delay: huge delay not capped",
+             specs->crawl_delay == CRAWL_DELAY_MAX);
+  free_specs (specs);
+
+  specs = specs_from_rules ("C\t1e9\nD\t/tmp\n");
+  mu_assert ("test_res_crawl_delay: cached delay not capped",
+             specs->crawl_delay == CRAWL_DELAY_MAX);
+  free_specs (specs);
+  specs = specs_from_rules ("C\tinf\n");
+  mu_assert ("test_res_crawl_delay: infinite cached delay accepted",
+             specs->crawl_delay == 0);
+  free_specs (specs);
+
+  return NULL;
+}
+
 #endif /* TESTING */
 
 /*
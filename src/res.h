@@ -40,8 +40,12 @@ bool res_match_path (const struct robot_specs *, const char *);
 
 void res_register_specs (const char *, int, struct robot_specs *);
 struct robot_specs *res_get_specs (const char *, int);
+double res_crawl_delay (const char *, int);
 
 bool res_retrieve_file (const char *, char **, struct iri *);
+struct robot_specs *res_retrieve_specs (const char *, const char *, int,
+                                        struct iri *);
+void res_cache_save (void);
 
 bool is_robots_txt_url (const char *);
 
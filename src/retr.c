@@ -36,6 +36,7 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
 #include <assert.h>
 
 #include "exits.h"
@@ -53,6 +54,28 @@ as that of the covered work.  */
 #include "ptimer.h"
 #include "html-url.h"
 #include "iri.h"
+#include "parallel.h"
+#include "arena.h"
+#include "warc.h"
+#include "timing.h"
+#include "sha1-hw.h"
+#include "uring.h"
+#include "counters.h"
+
+#ifdef TESTING
+#include "test.h"
+#endif
+
+#ifdef HAVE_LIBZ
+# include <zlib.h>
+#endif
+
+#if defined HAVE_FORK && defined HAVE_MMAP
+# include <sys/mman.h>
+# ifndef MAP_ANONYMOUS
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+#endif
 
 /* Total size of downloaded files.  Used to enforce quota.  */
 SUM_SIZE_INT total_downloaded_bytes;
@@ -67,88 +90,204 @@ FILE *output_stream;
 /* Whether output_document is a regular file we can manipulate,
    i.e. not `-' or a device file. */
 bool output_stream_regular;
+
+/* If non-NULL, fd_read_body adds the number of body bytes to this
+   variable as they are read, so that another process sharing it can
+   follow the progress of the download.  */
+wgint *body_read_tally;
+
+/* If non-NULL, fd_read_body also passes the data it writes to OUT to
+   this link stream.  OUT may then be NULL, if the document is only
+   kept in memory.  */
+struct link_stream *body_link_stream;
+
+/* If non-NULL, fd_read_body also adds the data it writes to OUT to
+   this digest.  */
+struct sha1_ctx *body_digest;
+
+/* Set while retrieve_tree spaces out the requests to each host
+   itself; sleep_between_retrievals then only waits between
+   retries.  */
+bool crawl_spacing;
+
+/* Set by retrieve_tree while it retrieves a URL it can put back in
+   its queue.  When connecting to the host or reading its response
+   fails, http_loop and ftp_loop then return RETRYLATER, leaving the
+   retry to the queue, instead of waiting for it while nothing else
+   gets done.  */
+bool retry_deferral;
+
+/* The tries made at a URL put back in the queue, which the next
+   retrieval of the URL continues counting from.  Set by retrieve_tree
+   before that retrieval, and by retry_defer along with RETRYLATER.  */
+int retry_tries;
+
+/* With RETRYLATER, the seconds to wait before trying the URL
+   again.  */
+double retry_delay;
+
+#ifdef HAVE_LIBURING
+/* With --io-uring, the writes of the body fd_read_body is reading,
+   which write_data passes on here instead of to stdio.  */
+static struct uring_out *out_uring;
+#endif
 
-static struct {
-  wgint chunk_bytes;
-  double chunk_start;
-  double sleep_adjust;
-} limit_data;
+/* Bandwidth limiting.  --limit-rate and --limit-rate-per-host are
+   enforced with token buckets shared by every transfer, including
+   those run by --parallel and --segments workers, which inherit the
+   state mapped by limit_bandwidth_init.
+
+   Each bucket is kept as the time at which it will have drained (the
+   "theoretical arrival time" of the generic cell rate algorithm):
+   charging it with N bytes advances that time by N/RATE seconds, and
+   the reader sleeps until the bucket has drained to within
+   LIMIT_SLACK of being empty.  Because the drain time is absolute,
+   oversleeping is accounted for automatically, and the readers
+   sharing a bucket are throttled in aggregate.  */
+
+/* Number of per-host buckets.  Hosts whose keys map to the same slot
+   take the slot over from each other, which can only make the limit
+   less strict.  */
+#define LIMIT_HOST_BUCKETS 256
+
+/* How far ahead of the allowed rate a reader may get before it is
+   made to sleep.  */
+#define LIMIT_SLACK 0.01
+
+struct limit_bucket {
+  unsigned int key;		/* host key, 0 if the slot is free */
+  double drained;		/* when the bucket will be empty */
+};
+
+struct limit_state {
+  volatile int lock;
+  double drained;		/* the --limit-rate bucket */
+  struct limit_bucket hosts[LIMIT_HOST_BUCKETS];
+};
+
+static struct limit_state *limit_state;
+
+/* Timer measuring the drain times.  Created before any worker is
+   forked, so every process reads the same clock origin.  */
+static struct ptimer *limit_timer;
+
+/* Key of the host the current transfer is from, or 0.  */
+static unsigned int limit_host_key;
+
+#if defined __GNUC__ && defined HAVE_FORK
+# define LIMIT_LOCK(s) do {                             \
+  while (__sync_lock_test_and_set (&(s)->lock, 1))      \
+    ;                                                   \
+} while (0)
+# define LIMIT_UNLOCK(s) __sync_lock_release (&(s)->lock)
+#else
+# define LIMIT_LOCK(s) do { } while (0)
+# define LIMIT_UNLOCK(s) do { } while (0)
+#endif
 
-static void
-limit_bandwidth_reset (void)
+/* Set up the buckets for --limit-rate and --limit-rate-per-host.
+   Must be called before any process that retrieves is forked.  */
+
+void
+limit_bandwidth_init (void)
 {
-  xzero (limit_data);
+  if (limit_state)
+    return;
+#if defined HAVE_FORK && defined HAVE_MMAP
+  limit_state = mmap (NULL, sizeof *limit_state, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (limit_state == MAP_FAILED)
+#endif
+    limit_state = xnew0 (struct limit_state);
+  limit_timer = ptimer_new ();
 }
 
-/* Limit the bandwidth by pausing the download for an amount of time.
-   BYTES is the number of bytes received from the network, and TIMER
-   is the timer that started at the beginning of download.  */
+/* Charge subsequent reads to the per-host bucket of HOST:PORT.  */
 
-static void
-limit_bandwidth (wgint bytes, struct ptimer *timer)
+void
+limit_bandwidth_host (const char *host, int port)
 {
-  double delta_t = ptimer_read (timer) - limit_data.chunk_start;
-  double expected;
+  unsigned int key = 2166136261U;
+  const char *p;
 
-  limit_data.chunk_bytes += bytes;
+  for (p = host; *p; p++)
+    key = (key ^ c_tolower (*p)) * 16777619U;
+  key = (key ^ port) * 16777619U;
+  limit_host_key = key ? key : 1;
+}
 
-  /* Calculate the amount of time we expect downloading the chunk
-     should take.  If in reality it took less time, sleep to
-     compensate for the difference.  */
-  expected = (double) limit_data.chunk_bytes / opt.limit_rate;
+/* Charge the bucket whose drain time is *DRAINED, and whose rate is
+   RATE, with BYTES.  Returns how long the reader has to wait for the
+   bucket to drain.  */
 
-  if (expected > delta_t)
+static double
+limit_charge (double *drained, wgint bytes, wgint rate, double now)
+{
+  if (*drained < now)
+    *drained = now;
+  *drained += (double) bytes / rate;
+  return *drained - now;
+}
+
+/* Limit the bandwidth by charging BYTES, the number of bytes received
+   from the network, to the buckets and pausing the download until
+   they allow more.  */
+
+static void
+limit_bandwidth (wgint bytes)
+{
+  struct limit_state *s = limit_state;
+  double now = ptimer_measure (limit_timer);
+  double wait = 0;
+
+  LIMIT_LOCK (s);
+  if (opt.limit_rate)
+    wait = limit_charge (&s->drained, bytes, opt.limit_rate, now);
+  if (opt.limit_rate_host && limit_host_key)
     {
-      double slp = expected - delta_t + limit_data.sleep_adjust;
-      double t0, t1;
-      if (slp < 0.2)
+      struct limit_bucket *b =
+        &s->hosts[limit_host_key % LIMIT_HOST_BUCKETS];
+      double host_wait;
+      if (b->key != limit_host_key)
         {
-          DEBUGP (("deferring a %.2f ms sleep (%s/%.2f).\n",
-                   slp * 1000, number_to_static_string (limit_data.chunk_bytes),
-                   delta_t));
-          return;
+          b->key = limit_host_key;
+          b->drained = now;
         }
-      DEBUGP (("\nsleeping %.2f ms for %s bytes, adjust %.2f ms\n",
-               slp * 1000, number_to_static_string (limit_data.chunk_bytes),
-               limit_data.sleep_adjust));
-
-      t0 = ptimer_read (timer);
-      xsleep (slp);
-      t1 = ptimer_measure (timer);
-
-      /* Due to scheduling, we probably slept slightly longer (or
-         shorter) than desired.  Calculate the difference between the
-         desired and the actual sleep, and adjust the next sleep by
-         that amount.  */
-      limit_data.sleep_adjust = slp - (t1 - t0);
-      /* If sleep_adjust is very large, it's likely due to suspension
-         and not clock inaccuracy.  Don't enforce those.  */
-      if (limit_data.sleep_adjust > 0.5)
-        limit_data.sleep_adjust = 0.5;
-      else if (limit_data.sleep_adjust < -0.5)
-        limit_data.sleep_adjust = -0.5;
+      host_wait = limit_charge (&b->drained, bytes, opt.limit_rate_host, now);
+      if (host_wait > wait)
+        wait = host_wait;
     }
+  LIMIT_UNLOCK (s);
 
-  limit_data.chunk_bytes = 0;
-  limit_data.chunk_start = ptimer_read (timer);
+  if (wait > LIMIT_SLACK)
+    {
+      DEBUGP (("\nsleeping %.2f ms for %s bytes\n",
+               (wait - LIMIT_SLACK) * 1000, number_to_static_string (bytes)));
+      xsleep (wait - LIMIT_SLACK);
+    }
 }
 
 #ifndef MIN
 # define MIN(i, j) ((i) <= (j) ? (i) : (j))
 #endif
+#ifndef MAX
+# define MAX(i, j) ((i) >= (j) ? (i) : (j))
+#endif
 
 /* Write data in BUF to OUT.  However, if *SKIP is non-zero, skip that
    amount of data and decrease SKIP.  Increment *TOTAL by the amount
    of data written.  If OUT2 is not NULL, also write BUF to OUT2.
    In case of error writing to OUT, -1 is returned.  In case of error
-   writing to OUT2, -2 is returned.  In case of any other error,
+   writing to OUT2, -3 is returned.  In case of any other error,
    1 is returned.  */
 
 static int
-write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
+write_data (FILE *out, struct warc_block *out2, const char *buf, int bufsize,
             wgint *skip, wgint *written)
 {
-  if (out == NULL && out2 == NULL)
+  bool out_failed = false, out2_failed = false;
+
+  if (out == NULL && out2 == NULL && body_link_stream == NULL)
     return 1;
   if (*skip > bufsize)
     {
@@ -165,9 +304,25 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
     }
 
   if (out != NULL)
-    fwrite (buf, 1, bufsize, out);
-  if (out2 != NULL)
-    fwrite (buf, 1, bufsize, out2);
+    {
+#ifdef HAVE_LIBURING
+      if (out_uring)
+        out_failed = !uring_out_write (out_uring, buf, bufsize);
+      else
+#endif
+        fwrite (buf, 1, bufsize, out);
+    }
+  if (out2 != NULL && !warc_block_write (out2, buf, bufsize))
+    out2_failed = true;
+  if (out != NULL && body_digest)
+    sha1_hw_process_bytes (buf, bufsize, body_digest);
+  if (body_link_stream)
+    {
+      double task_start = timing_task_begin ();
+      if (!link_stream_feed (body_link_stream, buf, bufsize))
+        out_failed = true;
+      timing_task_end (TASK_PARSE, task_start);
+    }
   *written += bufsize;
 
   /* Immediately flush the downloaded data.  This should not hinder
@@ -186,17 +341,479 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
 #ifndef __VMS
   if (out != NULL)
     fflush (out);
-  if (out2 != NULL)
-    fflush (out2);
 #endif /* ndef __VMS */
-  if (out != NULL && ferror (out))
+  if (out_failed || (out != NULL && ferror (out)))
     return -1;
-  else if (out2 != NULL && ferror (out2))
-    return -2;
+  else if (out2_failed)
+    return -3;
   else
     return 0;
 }
 
+#ifdef HAVE_LIBZ
+/* State for decompressing a gzip or deflate encoded body.  */
+
+struct body_inflater {
+  z_stream zs;
+  char *buf;                    /* buffer for the decompressed data */
+  int bufsize;
+  bool deflate;                 /* "deflate" rather than "gzip" */
+  bool raw;                     /* deflate data without zlib wrapper */
+  bool done;                    /* whether the end of stream was seen */
+};
+
+static bool
+body_inflater_init (struct body_inflater *bi, bool deflate, int bufsize)
+{
+  xzero (*bi);
+  bi->deflate = deflate;
+  /* 16 + MAX_WBITS accepts the gzip format only, 32 + MAX_WBITS
+     detects both the zlib and the gzip format.  */
+  if (inflateInit2 (&bi->zs, deflate ? 32 + MAX_WBITS : 16 + MAX_WBITS)
+      != Z_OK)
+    return false;
+  bi->bufsize = bufsize;
+  bi->buf = xmalloc (bufsize);
+  return true;
+}
+
+static void
+body_inflater_free (struct body_inflater *bi)
+{
+  inflateEnd (&bi->zs);
+  xfree (bi->buf);
+}
+
+/* Write BUF, BUFSIZE bytes of encoded body, to OUT2, and write it
+   decompressed to OUT, incrementing *WRITTEN by the amount of
+   decompressed data.  The return values are those of write_data, and
+   -4 if the data can't be decompressed.  */
+
+/* The first byte of a gzip member.  */
+#define GZIP_MAGIC 0x1f
+
+static int
+write_inflated (struct body_inflater *bi, FILE *out, struct warc_block *out2,
+                const char *buf, int bufsize, wgint *written)
+{
+  wgint noskip = 0;
+  bool first = bi->zs.total_in == 0;
+  int err, res;
+
+  if (out2 != NULL && !warc_block_write (out2, buf, bufsize))
+    return -3;
+  if (bi->done && !bi->deflate && bufsize > 0 && buf[0] == GZIP_MAGIC)
+    {
+      /* Another member of a multi-member gzip body.  */
+      if (inflateReset (&bi->zs) != Z_OK)
+        return -4;
+      bi->done = false;
+    }
+  if (bi->done)
+    /* Ignore anything following the compressed stream.  */
+    return 0;
+
+  bi->zs.next_in = (Bytef *) buf;
+  bi->zs.avail_in = bufsize;
+  do
+    {
+      int produced;
+      bi->zs.next_out = (Bytef *) bi->buf;
+      bi->zs.avail_out = bi->bufsize;
+      err = inflate (&bi->zs, Z_NO_FLUSH);
+      if (err == Z_DATA_ERROR && first && bi->deflate && !bi->raw)
+        {
+          /* Some servers send "deflate" bodies without the zlib
+             wrapper RFC 2616 calls for.  Start over, treating the
+             data as raw deflate.  */
+          inflateEnd (&bi->zs);
+          xzero (bi->zs);
+          if (inflateInit2 (&bi->zs, -MAX_WBITS) != Z_OK)
+            return -4;
+          bi->raw = true;
+          bi->zs.next_in = (Bytef *) buf;
+          bi->zs.avail_in = bufsize;
+          err = Z_OK;
+          continue;
+        }
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+        {
+          DEBUGP (("inflate failed: %s\n", bi->zs.msg ? bi->zs.msg : "?"));
+          return -4;
+        }
+      produced = bi->bufsize - bi->zs.avail_out;
+      if (produced > 0 && (out != NULL || body_link_stream != NULL))
+        {
+          res = write_data (out, NULL, bi->buf, produced, &noskip, written);
+          if (res != 0)
+            return res;
+        }
+      if (err == Z_STREAM_END)
+        {
+          bi->done = true;
+          /* A gzip body may consist of several members, each ending
+             the stream; carry on with the next one, if any.  */
+          if (!bi->deflate && bi->zs.avail_in > 0
+              && *bi->zs.next_in == GZIP_MAGIC)
+            {
+              if (inflateReset (&bi->zs) != Z_OK)
+                return -4;
+              bi->done = false;
+              err = Z_OK;
+            }
+        }
+    }
+  while (err == Z_OK && (bi->zs.avail_in > 0 || bi->zs.avail_out == 0));
+  return 0;
+}
+#endif /* HAVE_LIBZ */
+
+/* The buffer fd_read_body reads into.  It is kept from one body to
+   the next, rather than allocated for each, and only ever grows.  */
+static char *dlbuf;
+static int dlbuf_alloc;
+
+/* The smallest and the largest amount of data fd_read_body asks for in
+   one read.  It starts with the smallest, and doubles the amount each
+   time a read fills the buffer, i.e. when the data comes in faster
+   than it is being read.  */
+#define DLBUF_MIN (BUFSIZ > 8 * 1024 ? BUFSIZ : 8 * 1024)
+#define DLBUF_MAX (1024 * 1024)
+
+/* Make sure the buffer in DLBUF can hold SIZE bytes.  */
+
+static void
+dlbuf_reserve (int size)
+{
+  if (size <= dlbuf_alloc)
+    return;
+  xfree_null (dlbuf);
+  dlbuf = xmalloc (size);
+  dlbuf_alloc = size;
+}
+
+/* Release the read buffer.  */
+
+static struct hash_table *peer_rates;
+
+void
+retr_cleanup (void)
+{
+  xfree_null (dlbuf);
+  dlbuf = NULL;
+  dlbuf_alloc = 0;
+  if (peer_rates)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (peer_rates, &iter);
+           hash_table_iter_next (&iter); )
+        {
+          xfree (iter.key);
+          xfree (iter.value);
+        }
+      hash_table_destroy (peer_rates);
+      peer_rates = NULL;
+    }
+}
+
+/* The size of the pieces in which a large download is flushed and
+   dropped from the page cache as it is written.  */
+#define WRITE_BEHIND_CHUNK (8 * 1024 * 1024)
+
+/* Downloads shorter than this are left alone in the page cache: they
+   cost little memory and may well be read again, e.g. to convert
+   their links.  */
+#define WRITE_BEHIND_MIN (32 * 1024 * 1024)
+
+/* State for handing a download over to the disk as it is written.  */
+struct write_behind {
+  int fd;                       /* descriptor of the output, or -1 */
+  wgint start;                  /* file offset where the body starts */
+  wgint done;                   /* bytes already handed over */
+};
+
+/* Prepare WB for writing a body of TOREAD bytes (0 if unknown) to
+   OUT.  Nothing is done unless OUT is a regular file.  */
+
+static void
+write_behind_init (struct write_behind *wb, FILE *out, wgint toread)
+{
+  struct_stat st;
+
+  wb->fd = -1;
+  wb->start = wb->done = 0;
+  if (!out || fflush (out) != 0
+      || fstat (fileno (out), &st) != 0 || !S_ISREG (st.st_mode))
+    return;
+  wb->fd = fileno (out);
+  wb->start = lseek (wb->fd, 0, SEEK_CUR);
+  if (wb->start < 0)
+    {
+      wb->fd = -1;
+      return;
+    }
+
+#if defined HAVE_FALLOCATE && defined FALLOC_FL_KEEP_SIZE
+  /* Reserve the space for the whole body up front so that the file
+     system can lay it out in one piece.  The file size is left alone,
+     so that an interrupted download can still be continued with
+     -c.  */
+  if (toread > 0)
+    fallocate (wb->fd, FALLOC_FL_KEEP_SIZE, wb->start, toread);
+#else
+  (void) toread;
+#endif
+}
+
+/* Note that WRITTEN bytes of the body have been written.  Once per
+   WRITE_BEHIND_CHUNK, and when FINAL is set, sync the file as
+   requested by --fsync and, for large downloads, start writing out
+   the new data and drop the data written out before from the page
+   cache.  */
+
+static void
+write_behind_update (struct write_behind *wb, wgint written, bool final)
+{
+  bool synced = false;
+
+  if (wb->fd < 0 || (!final && written - wb->done < WRITE_BEHIND_CHUNK))
+    return;
+
+  if (opt.fsync == fsync_interval || (final && opt.fsync == fsync_end))
+    {
+#ifdef HAVE_FDATASYNC
+      synced = fdatasync (wb->fd) == 0;
+#else
+      synced = fsync (wb->fd) == 0;
+#endif
+    }
+
+  if (written >= WRITE_BEHIND_MIN)
+    {
+#ifdef HAVE_SYNC_FILE_RANGE
+      if (!synced)
+        sync_file_range (wb->fd, wb->start + wb->done, written - wb->done,
+                         SYNC_FILE_RANGE_WRITE);
+#endif
+#ifdef HAVE_POSIX_FADVISE
+      /* Unless the file was just synced, the new data is still being
+         written out, so only drop what was written before it.  */
+      {
+        wgint upto = synced ? written : wb->done;
+        if (upto > 0)
+          posix_fadvise (wb->fd, wb->start, upto, POSIX_FADV_DONTNEED);
+      }
+#endif
+    }
+  wb->done = written;
+}
+
+/* Decoding of the chunked transfer encoding.  The framing is stripped
+   from each buffer as it is read, so that a body sent in many small
+   chunks is read in as few calls as one that isn't.  */
+
+enum chunk_state {
+  CHUNK_SIZE,                   /* reading the hex size of a chunk */
+  CHUNK_SIZE_LINE,              /* skipping the rest of the size line */
+  CHUNK_DATA,                   /* SIZE bytes of data to go */
+  CHUNK_DATA_END,               /* skipping the CRLF after the data */
+  CHUNK_TRAILER,                /* at the start of a trailer line */
+  CHUNK_TRAILER_LINE,           /* inside a trailer line */
+  CHUNK_DONE                    /* the empty line ending the body */
+};
+
+struct chunk_decoder {
+  enum chunk_state state;
+  wgint size;
+};
+
+/* Strip the chunk framing from the LEN bytes at BUF, moving the data
+   they hold to the front of BUF, and return the amount of that data.
+   *USED is set to the number of bytes that belong to the body, which
+   is less than LEN only if the body ended.  Returns -1 if a chunk
+   size is too large.  */
+
+static int
+chunk_decode (struct chunk_decoder *cd, char *buf, int len, int *used)
+{
+  char *p = buf, *end = buf + len, *out = buf;
+
+  while (p < end && cd->state != CHUNK_DONE)
+    switch (cd->state)
+      {
+      case CHUNK_SIZE:
+        if (!c_isxdigit (*p))
+          {
+            /* Like strtol, take what doesn't parse as the end of the
+               size, and a missing size as 0.  */
+            cd->state = CHUNK_SIZE_LINE;
+            break;
+          }
+        if (cd->size > WGINT_MAX >> 4)
+          return -1;
+        cd->size = (cd->size << 4) + XDIGIT_TO_NUM (*p);
+        ++p;
+        break;
+      case CHUNK_SIZE_LINE:
+        if (*p++ == '\n')
+          cd->state = cd->size ? CHUNK_DATA : CHUNK_TRAILER;
+        break;
+      case CHUNK_DATA:
+        {
+          int n = MIN (cd->size, end - p);
+          memmove (out, p, n);
+          out += n;
+          p += n;
+          cd->size -= n;
+          if (!cd->size)
+            cd->state = CHUNK_DATA_END;
+        }
+        break;
+      case CHUNK_DATA_END:
+        if (*p++ == '\n')
+          cd->state = CHUNK_SIZE;
+        break;
+      case CHUNK_TRAILER:
+        if (*p == '\n')
+          cd->state = CHUNK_DONE;
+        else if (*p != '\r')
+          cd->state = CHUNK_TRAILER_LINE;
+        ++p;
+        break;
+      case CHUNK_TRAILER_LINE:
+        if (*p++ == '\n')
+          cd->state = CHUNK_TRAILER;
+        break;
+      case CHUNK_DONE:
+        break;
+      }
+  *used = p - buf;
+  return out - buf;
+}
+
+/* The rate of a transfer is sampled about this often (in seconds),
+   and this many samples are kept, so that the samples span the last
+   ten seconds or so.  */
+#define RATE_SAMPLE 1.0
+#define RATE_RING_SIZE 10
+
+/* A transfer idle for less than this many seconds is never taken to
+   be stalled, however fast it had been going.  */
+#define STALL_MIN_TIME 10
+
+/* A transfer is taken to be stalled once it has been idle this many
+   times as long as it took, at its usual rate, to fill the read
+   buffer.  */
+#define STALL_FACTOR 10
+
+/* The recent rate of a transfer, kept much as update_speed_ring in
+   progress.c keeps the rate the progress bar shows.  Unlike there,
+   the idle periods are sampled as well, so that a crawling transfer
+   shows as such.  */
+struct rate_ring {
+  int pos;
+  double times[RATE_RING_SIZE];
+  wgint bytes[RATE_RING_SIZE];
+
+  /* The sum of times and bytes respectively.  */
+  double total_time;
+  wgint total_bytes;
+
+  double recent_start;          /* when the current sample began */
+  wgint recent_bytes;           /* bytes read in the current sample */
+};
+
+/* Add HOWMUCH bytes, read at time NOW, to the rate of RING.  */
+
+static void
+rate_ring_update (struct rate_ring *ring, wgint howmuch, double now)
+{
+  double age = now - ring->recent_start;
+
+  ring->recent_bytes += howmuch;
+  if (age < RATE_SAMPLE)
+    return;
+
+  ring->total_time  -= ring->times[ring->pos];
+  ring->total_bytes -= ring->bytes[ring->pos];
+  ring->times[ring->pos] = age;
+  ring->bytes[ring->pos] = ring->recent_bytes;
+  ring->total_time  += age;
+  ring->total_bytes += ring->recent_bytes;
+
+  ring->recent_start = now;
+  ring->recent_bytes = 0;
+  if (++ring->pos == RATE_RING_SIZE)
+    ring->pos = 0;
+}
+
+/* Return the rate of RING over its samples and the current one.  */
+
+static double
+rate_ring_rate (const struct rate_ring *ring, double now)
+{
+  double t = ring->total_time + (now - ring->recent_start);
+  return t > 0 ? (ring->total_bytes + ring->recent_bytes) / t : 0;
+}
+
+/* The rates at which each server has sent bodies so far, keyed by
+   its address, so that a transfer can be judged stalled before it
+   has a rate of its own.  */
+
+static double
+peer_rate (const char *peer)
+{
+  double *rate = peer_rates ? hash_table_get (peer_rates, peer) : NULL;
+  return rate ? *rate : 0;
+}
+
+static void
+peer_rate_note (const char *peer, double rate)
+{
+  double *old;
+
+  if (!peer_rates)
+    peer_rates = make_string_hash_table (0);
+  old = hash_table_get (peer_rates, peer);
+  if (old)
+    /* Follow changes in the rate, but not every hiccup.  */
+    *old = 0.7 * *old + 0.3 * rate;
+  else
+    {
+      old = xnew (double);
+      *old = rate;
+      hash_table_put (peer_rates, xstrdup (peer), old);
+    }
+}
+
+enum stall_type {
+  STALL_NONE,
+  STALL_IDLE,                   /* idle far longer than usual */
+  STALL_SLOW                    /* below --min-rate */
+};
+
+/* Decide whether a transfer is better given up, so that it is retried
+   and resumed on a new connection.  It is when it has been IDLE much
+   longer than its RATE suggests a buffer of BUFSIZE takes to fill, or
+   when its rate over the last seconds, as kept in RING, has fallen
+   below --min-rate.  NOW is the time since the transfer began.  */
+
+static enum stall_type
+transfer_stalled (const struct rate_ring *ring, double now, double idle,
+                  double rate, int bufsize)
+{
+  if (rate > 0 && opt.read_timeout)
+    {
+      double limit = MAX (STALL_MIN_TIME, STALL_FACTOR * bufsize / rate);
+      if (limit < opt.read_timeout && idle > limit)
+        return STALL_IDLE;
+    }
+  if (opt.min_rate && now >= RATE_RING_SIZE * RATE_SAMPLE
+      && rate_ring_rate (ring, now) < opt.min_rate)
+    return STALL_SLOW;
+  return STALL_NONE;
+}
+
 /* Read the contents of file descriptor FD until it the connection
    terminates or a read error occurs.  The data is read in portions of
    up to 16K and written to OUT as it arrives.  If opt.verbose is set,
@@ -218,20 +835,22 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
    to OUT2.  (OUT will only get the unchunked response.)
 
    The function exits and returns the amount of data read.  In case of
-   error while reading data, -1 is returned.  In case of error while
-   writing data to OUT, -2 is returned.  In case of error while writing
-   data to OUT2, -3 is returned.  */
+   error while reading data, -1 is returned; so it is when the
+   transfer stalls or falls below --min-rate, see transfer_stalled.
+   In case of error while writing data to OUT, -2 is returned.  In
+   case of error while writing data to OUT2, -3 is returned.  If the
+   body is to be decompressed (rb_compressed_gzip or
+   rb_compressed_deflate) and it is corrupt or truncated, -4 is
+   returned.  */
 
 int
 fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
               wgint *qtyread, wgint *qtywritten, double *elapsed, int flags,
-              FILE *out2)
+              struct warc_block *out2)
 {
   int ret = 0;
-#undef max
-#define max(a,b) ((a) > (b) ? (a) : (b))
-  int dlbufsize = max (BUFSIZ, 8 * 1024);
-  char *dlbuf = xmalloc (dlbufsize);
+  int dlbufsize = DLBUF_MIN;
+  int dlbufmax = DLBUF_MAX;
 
   struct ptimer *timer = NULL;
   double last_successful_read_tm = 0;
@@ -245,21 +864,88 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
      data arrives slowly. */
   bool progress_interactive = false;
 
+  /* Whether to look out for the transfer stalling, and if so, the
+     address of the server, its rate, and when data last came.  */
+  bool watch = opt.min_rate || opt.read_timeout > STALL_MIN_TIME;
+  char peer[64] = "";
+  struct rate_ring ring;
+  double busy_rate = 0;
+  double last_data_tm = 0;
+  enum stall_type stall = STALL_NONE;
+
   bool exact = !!(flags & rb_read_exactly);
 
   /* Used only by HTTP/HTTPS chunked transfer encoding.  */
   bool chunked = flags & rb_chunked_transfer_encoding;
+  struct chunk_decoder chunks = { CHUNK_SIZE, 0 };
   wgint skip = 0;
 
+  /* The strictest of the bandwidth limits.  */
+  wgint limit;
+
+#ifdef HAVE_LIBZ
+  /* Used only by HTTP/HTTPS content encoding.  */
+  bool inflating = !!(flags & (rb_compressed_gzip | rb_compressed_deflate));
+  struct body_inflater inflater;
+#endif
+
+#ifdef HAVE_SPLICE
+  /* Whether the body is moved straight from the socket to the file
+     with splice, bypassing DLBUF.  */
+  bool splicing = false;
+#endif
+
+  struct write_behind wb;
+
   /* How much data we've read/written.  */
   wgint sum_read = 0;
   wgint sum_written = 0;
-  wgint remaining_chunk_size = 0;
 
   if (flags & rb_skip_startpos)
     skip = startpos;
 
-  if (opt.verbose)
+#ifdef HAVE_LIBZ
+  if (inflating
+      && !body_inflater_init (&inflater, !!(flags & rb_compressed_deflate),
+                              4 * dlbufsize))
+    return -4;
+#endif
+
+#ifdef HAVE_SPLICE
+  /* The plain case -- an identity-encoded body going only to a
+     regular file -- needs no look at the data, so let the kernel move
+     it.  Flush OUT first so that whatever stdio holds lands before
+     the spliced data.  splice(2) refuses files opened for appending,
+     as resumed downloads are, so those take the write_data path.  */
+  if (out && !out2 && !chunked && !skip && !body_link_stream && !body_digest
+      && !opt.io_uring
+#ifdef HAVE_LIBZ
+      && !inflating
+#endif
+      && fd_splice_p (fd))
+    {
+      struct_stat st;
+      if (fflush (out) == 0
+          && fstat (fileno (out), &st) == 0 && S_ISREG (st.st_mode)
+          && !(fcntl (fileno (out), F_GETFL) & O_APPEND))
+        splicing = true;
+    }
+#endif
+
+  write_behind_init (&wb, out, toread);
+#ifdef HAVE_LIBURING
+  /* Write the body from the background, so that a slow disk doesn't
+     hold up reading the network.  O_DIRECT is only worth it for large
+     files.  */
+  if (opt.io_uring && wb.fd >= 0)
+    out_uring = uring_out_new (wb.fd, wb.start,
+                               opt.direct_io && toread >= WRITE_BEHIND_MIN);
+#endif
+
+  /* Parallel workers share the terminal, so they don't draw their
+     own progress gauges.  The aggregate display is drawn by the
+     parent from what the workers' gauges forward to it.  */
+  if (opt.verbose && (!parallel_worker_p () || progress_aggregate_p ()))
     {
       /* If we're skipping STARTPOS bytes, pass 0 as the INITIAL
          argument to progress_create because the indicator doesn't
@@ -269,13 +955,19 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
       progress_interactive = progress_interactive_p (progress);
     }
 
-  if (opt.limit_rate)
-    limit_bandwidth_reset ();
+  if (watch)
+    {
+      ip_address ip;
+      if (socket_ip_address (fd, &ip, ENDPOINT_PEER))
+        snprintf (peer, sizeof peer, "%s", print_address (&ip));
+      busy_rate = peer[0] ? peer_rate (peer) : 0;
+      xzero (ring);
+    }
 
-  /* A timer is needed for tracking progress, for throttling, and for
-     tracking elapsed time.  If either of these are requested, start
-     the timer.  */
-  if (progress || opt.limit_rate || elapsed)
+  /* A timer is needed for tracking progress, for throttling, for
+     tracking elapsed time, and for spotting stalls.  If any of these
+     are requested, start the timer.  */
+  if (progress || elapsed || watch)
     {
       timer = ptimer_new ();
       last_successful_read_tm = 0;
@@ -284,9 +976,18 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
   /* Use a smaller buffer for low requested bandwidths.  For example,
      with --limit-rate=2k, it doesn't make sense to slurp in 16K of
      data and then sleep for 8s.  With buffer size equal to the limit,
-     we never have to sleep for more than one second.  */
-  if (opt.limit_rate && opt.limit_rate < dlbufsize)
-    dlbufsize = opt.limit_rate;
+     we never have to sleep for more than one second.  The same limit
+     applies when the buffer grows.  */
+  limit = opt.limit_rate;
+  if (opt.limit_rate_host && (!limit || opt.limit_rate_host < limit))
+    limit = opt.limit_rate_host;
+  if (limit && limit < dlbufsize)
+    dlbufsize = limit;
+  if (limit && limit < dlbufmax)
+    dlbufmax = MAX (dlbufsize, limit);
+  dlbuf_reserve (dlbufsize);
+
+  COUNTER_ADD (active, 1);
 
   /* Read from FD while there is data to read.  Normally toread==0
      means that it is unknown how much data is to arrive.  However, if
@@ -294,52 +995,29 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
      should be read.  */
   while (!exact || (sum_read < toread))
     {
-      int rdsize;
+      int rdsize, nread;
       double tmout = opt.read_timeout;
 
       if (chunked)
         {
-          if (remaining_chunk_size == 0)
+          if (chunks.state == CHUNK_DONE)
             {
-              char *line = fd_read_line (fd);
-              char *endl;
-              if (line == NULL)
-                {
-                  ret = -1;
-                  break;
-                }
-              else if (out2 != NULL)
-                fwrite (line, 1, strlen (line), out2);
-
-              remaining_chunk_size = strtol (line, &endl, 16);
-              xfree (line);
-
-              if (remaining_chunk_size == 0)
-                {
-                  ret = 0;
-                  line = fd_read_line (fd);
-                  if (line == NULL)
-                    ret = -1;
-                  else
-                    {
-                      if (out2 != NULL)
-                        fwrite (line, 1, strlen (line), out2);
-                      xfree (line);
-                    }
-                  break;
-                }
+              ret = 0;
+              break;
             }
-
-          rdsize = MIN (remaining_chunk_size, dlbufsize);
+          /* Read as much as fits, whatever the chunk sizes; what
+             follows the body is given back below.  */
+          rdsize = dlbufsize;
         }
       else
         rdsize = exact ? MIN (toread - sum_read, dlbufsize) : dlbufsize;
 
-      if (progress_interactive)
+      if (progress_interactive || watch)
         {
           /* For interactive progress gauges, always specify a ~1s
              timeout, so that the gauge can be updated regularly even
-             when the data arrives very slowly or stalls.  */
+             when the data arrives very slowly or stalls.  The same
+             goes for looking out for stalls.  */
           tmout = 0.95;
           if (opt.read_timeout)
             {
@@ -358,68 +1036,198 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
                 }
             }
         }
-      ret = fd_read (fd, dlbuf, rdsize, tmout);
+#ifdef HAVE_SPLICE
+      if (splicing)
+        {
+          ret = fd_splice (fd, fileno (out), rdsize, tmout);
+          if (ret == -2)
+            goto out;
+        }
+      else
+#endif
+        ret = fd_read (fd, dlbuf, rdsize, tmout);
 
-      if (progress_interactive && ret < 0 && errno == ETIMEDOUT)
+      if ((progress_interactive || watch) && ret < 0 && errno == ETIMEDOUT)
         ret = 0;                /* interactive timeout, handled above */
       else if (ret <= 0)
         break;                  /* EOF or read error */
+      nread = ret;
+
+      if (chunked && ret > 0)
+        {
+          int used;
+          /* The WARC record gets the response as it was sent, but
+             only up to its end.  Decoding is done in place, so keep
+             a copy of what was read.  */
+          char *raw = out2 != NULL ? xmemdup (dlbuf, nread) : NULL;
+          ret = chunk_decode (&chunks, dlbuf, nread, &used);
+          if (ret < 0)
+            {
+              xfree_null (raw);
+              errno = EINVAL;
+              break;
+            }
+          if (raw)
+            {
+              bool written = warc_block_write (out2, raw, used);
+              xfree (raw);
+              if (!written)
+                {
+                  ret = -3;
+                  goto out;
+                }
+            }
+          /* Give back what follows the body, such as a pipelined
+             response.  */
+          fd_unread (fd, dlbuf + used, nread - used);
+        }
 
-      if (progress || opt.limit_rate || elapsed)
+      if (timer)
         {
           ptimer_measure (timer);
           if (ret > 0)
             last_successful_read_tm = ptimer_read (timer);
         }
 
+      if (watch)
+        {
+          double now = ptimer_read (timer);
+          rate_ring_update (&ring, nread, now);
+          if (nread > 0)
+            {
+              last_data_tm = now;
+              busy_rate = rate_ring_rate (&ring, now);
+            }
+          stall = transfer_stalled (&ring, now, now - last_data_tm,
+                                    busy_rate, dlbufsize);
+          if (stall != STALL_NONE)
+            {
+              ret = -1;
+              break;
+            }
+        }
+
       if (ret > 0)
         {
           sum_read += ret;
-          int write_res = write_data (out, out2, dlbuf, ret, &skip, &sum_written);
-          if (write_res != 0)
+          COUNTER_ADD (bytes, ret);
+          if (body_read_tally)
+            *body_read_tally += ret;
+          int write_res;
+#ifdef HAVE_SPLICE
+          if (splicing)
             {
-              ret = (write_res == -3) ? -3 : -2;
+              sum_written += ret;
+              write_res = 0;
+            }
+          else
+#endif
+#ifdef HAVE_LIBZ
+          if (inflating)
+            write_res = write_inflated (&inflater, out, chunked ? NULL : out2,
+                                        dlbuf, ret, &sum_written);
+          else
+#endif
+            write_res = write_data (out, chunked ? NULL : out2, dlbuf, ret,
+                                    &skip, &sum_written);
+#ifdef HAVE_LIBZ
+          if (write_res == -4)
+            {
+              ret = -4;
               goto out;
             }
-          if (chunked)
+#endif
+          if (write_res != 0)
             {
-              remaining_chunk_size -= ret;
-              if (remaining_chunk_size == 0)
-                {
-                  char *line = fd_read_line (fd);
-                  if (line == NULL)
-                    {
-                      ret = -1;
-                      break;
-                    }
-                  else
-                    {
-                      if (out2 != NULL)
-                        fwrite (line, 1, strlen (line), out2);
-                      xfree (line);
-                    }
-                }
+              ret = (write_res == -3) ? -3 : -2;
+              goto out;
             }
+          write_behind_update (&wb, sum_written, false);
         }
 
-      if (opt.limit_rate)
-        limit_bandwidth (ret, timer);
+      if (limit_state && ret > 0)
+        limit_bandwidth (ret);
 
       if (progress)
         progress_update (progress, ret, ptimer_read (timer));
+      log_poll_flush ();
+      counters_poll ();
 #ifdef WINDOWS
       if (toread > 0 && !opt.quiet)
         ws_percenttitle (100.0 *
                          (startpos + sum_read) / (startpos + toread));
 #endif
+
+      if (nread == dlbufsize && dlbufsize < dlbufmax)
+        {
+          /* The data is arriving faster than we are reading it; read
+             more at once.  */
+          dlbufsize = MIN (2 * dlbufsize, dlbufmax);
+#ifdef HAVE_SPLICE
+          if (!splicing)
+#endif
+            dlbuf_reserve (dlbufsize);
+        }
     }
   if (ret < -1)
     ret = -1;
+  if (chunked && ret == 0 && chunks.state != CHUNK_DONE)
+    /* The connection was closed before the last chunk.  */
+    ret = -1;
+#ifdef HAVE_LIBZ
+  if (inflating && ret >= 0 && !inflater.done)
+    /* The body ended before the compressed stream did.  */
+    ret = -4;
+#endif
 
  out:
+  COUNTER_ADD (active, -1);
+  COUNTER_ADD (transfers, 1);
+#ifdef HAVE_LIBZ
+  if (inflating)
+    body_inflater_free (&inflater);
+#endif
+#ifdef HAVE_SPLICE
+  /* The file offset moved behind stdio's back; tell it where it is
+     now.  */
+  if (splicing)
+    fseeko (out, lseek (fileno (out), 0, SEEK_CUR), SEEK_SET);
+#endif
+#ifdef HAVE_LIBURING
+  if (out_uring)
+    {
+      wgint end;
+      bool ok = uring_out_finish (out_uring, &end);
+      int saved_errno = errno;
+      out_uring = NULL;
+      /* As with splice, the file offset is not where stdio left it.  */
+      fseeko (out, end, SEEK_SET);
+      if (!ok && ret >= 0)
+        {
+          ret = -2;
+          errno = saved_errno;
+        }
+    }
+#endif
+  if (wb.fd >= 0 && fflush (out) == 0)
+    write_behind_update (&wb, sum_written, true);
   if (progress)
     progress_finish (progress, ptimer_read (timer));
 
+  if (stall == STALL_IDLE)
+    logprintf (LOG_VERBOSE,
+               _("No data for %.0f seconds, far longer than usual.\n"),
+               ptimer_read (timer) - last_data_tm);
+  else if (stall == STALL_SLOW)
+    logprintf (LOG_VERBOSE,
+               _("Slower than --min-rate over the last %d seconds.\n"),
+               (int) (RATE_RING_SIZE * RATE_SAMPLE));
+  if (stall != STALL_NONE)
+    errno = ETIMEDOUT;
+  else if (watch && peer[0] && ret >= 0 && sum_read > 0
+           && ptimer_read (timer) >= RATE_SAMPLE)
+    peer_rate_note (peer, sum_read / ptimer_read (timer));
+
   if (elapsed)
     *elapsed = ptimer_read (timer);
   if (timer)
@@ -430,8 +1238,6 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
   if (qtywritten)
     *qtywritten += sum_written;
 
-  free (dlbuf);
-
   return ret;
 }
 
@@ -450,8 +1256,8 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
    not contain the terminator.
 
    The TERMINATOR function is called with three arguments: the
-   beginning of the data read so far, the beginning of the current
-   block of peeked-at data, and the length of the current block.
+   beginning of the data read so far, the beginning of the block of
+   newly read data, and the length of that block.
    Depending on its needs, the function is free to choose whether to
    analyze all data or just the newly arrived data.  If TERMINATOR
    returns NULL, it means that the terminator has not been seen.
@@ -463,20 +1269,19 @@ fd_read_body (int fd, FILE *out, wgint toread, wgint startpos,
    boundary, so that the next call to fd_read etc. reads the data
    after the hunk.  To achieve that, this function does the following:
 
-   1. Peek at incoming data.
+   1. Read the available data.
 
-   2. Determine whether the peeked data, along with the previously
-      read data, includes the terminator.
+   2. Determine whether the data read, along with the previously read
+      data, includes the terminator.
 
-      2a. If yes, read the data until the end of the terminator, and
-          exit.
+      2a. If yes, give the data after the terminator back to the
+          connection with fd_unread, and exit.
 
-      2b. If no, read the peeked data and goto 1.
+      2b. If no, goto 1.
 
-   The function is careful to assume as little as possible about the
-   implementation of peeking.  For example, every peek is followed by
-   a read.  If the read returns a different amount of data, the
-   process is retried until all data arrives safely.
+   Data given back is kept with the connection, so the body that
+   follows a response head is read from memory rather than read from
+   the socket a second time, as it would be after peeking.
 
    SIZEHINT is the buffer size sufficient to hold all the data in the
    typical case (it is used as the initial buffer size).  MAXSIZE is
@@ -498,55 +1303,17 @@ fd_read_hunk (int fd, hunk_terminator_t terminator, long sizehint, long maxsize)
   while (1)
     {
       const char *end;
-      int pklen, rdlen, remain;
-
-      /* First, peek at the available data. */
+      int rdlen;
 
-      pklen = fd_peek (fd, hunk + tail, bufsize - 1 - tail, -1);
-      if (pklen < 0)
-        {
-          xfree (hunk);
-          return NULL;
-        }
-      end = terminator (hunk, hunk + tail, pklen);
-      if (end)
-        {
-          /* The data contains the terminator: we'll drain the data up
-             to the end of the terminator.  */
-          remain = end - (hunk + tail);
-          assert (remain >= 0);
-          if (remain == 0)
-            {
-              /* No more data needs to be read. */
-              hunk[tail] = '\0';
-              return hunk;
-            }
-          if (bufsize - 1 < tail + remain)
-            {
-              bufsize = tail + remain + 1;
-              hunk = xrealloc (hunk, bufsize);
-            }
-        }
-      else
-        /* No terminator: simply read the data we know is (or should
-           be) available.  */
-        remain = pklen;
-
-      /* Now, read the data.  Note that we make no assumptions about
-         how much data we'll get.  (Some TCP stacks are notorious for
-         read returning less data than the previous MSG_PEEK.)  */
-
-      rdlen = fd_read (fd, hunk + tail, remain, 0);
+      rdlen = fd_read (fd, hunk + tail, bufsize - 1 - tail, -1);
       if (rdlen < 0)
         {
-          xfree_null (hunk);
+          xfree (hunk);
           return NULL;
         }
-      tail += rdlen;
-      hunk[tail] = '\0';
-
       if (rdlen == 0)
         {
+          hunk[tail] = '\0';
           if (tail == 0)
             {
               /* EOF without anything having been read */
@@ -558,10 +1325,19 @@ fd_read_hunk (int fd, hunk_terminator_t terminator, long sizehint, long maxsize)
             /* EOF seen: return the data we've read. */
             return hunk;
         }
-      if (end && rdlen == remain)
-        /* The terminator was seen and the remaining data drained --
-           we got what we came for.  */
-        return hunk;
+
+      end = terminator (hunk, hunk + tail, rdlen);
+      tail += rdlen;
+      if (end)
+        {
+          /* The data contains the terminator: keep what follows it
+             for the next reader.  */
+          assert (end >= hunk && end <= hunk + tail);
+          fd_unread (fd, end, hunk + tail - end);
+          hunk[end - hunk] = '\0';
+          return hunk;
+        }
+      hunk[tail] = '\0';
 
       /* Keep looping until all the data arrives. */
 
@@ -905,7 +1681,7 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
     }
 
   /* Try to not encode in UTF-8 if fetching failed */
-  if (!(*dt & RETROKF) && iri->utf8_encode)
+  if (!(*dt & RETROKF) && iri->utf8_encode && result != RETRYLATER)
     {
       iri->utf8_encode = false;
       if (orig_parsed != u)
@@ -970,6 +1746,268 @@ bail:
   return result;
 }
 
+/* Retrieve CUR_URL, one of the URLs of an input file, storing the
+   status to *STATUS.  Returns false if the quota has been exceeded
+   and no more URLs should be retrieved.  */
+
+static bool
+retrieve_input_url (struct urlpos *cur_url, struct iri *iri, uerr_t *status)
+{
+  char *filename = NULL, *new_file = NULL;
+  int dt;
+  struct iri *tmpiri;
+  struct url *parsed_url = NULL;
+
+  if (cur_url->ignore_when_downloading)
+    return true;
+
+  if (opt.quota && total_downloaded_bytes > opt.quota)
+    {
+      *status = QUOTEXC;
+      return false;
+    }
+
+  tmpiri = iri_dup (iri);
+  parsed_url = url_parse (cur_url->url->url, NULL, tmpiri, true);
+
+  if ((opt.recursive || opt.page_requisites)
+      && (cur_url->url->scheme != SCHEME_FTP || getproxy (cur_url->url)))
+    {
+      int old_follow_ftp = opt.follow_ftp;
+
+      /* Turn opt.follow_ftp on in case of recursive FTP retrieval */
+      if (cur_url->url->scheme == SCHEME_FTP)
+        opt.follow_ftp = 1;
+
+      *status = retrieve_tree (parsed_url ? parsed_url : cur_url->url,
+                               tmpiri);
+
+      opt.follow_ftp = old_follow_ftp;
+    }
+  else
+    *status = retrieve_url (parsed_url ? parsed_url : cur_url->url,
+                            cur_url->url->url, &filename,
+                            &new_file, NULL, &dt, opt.recursive, tmpiri,
+                            true);
+
+  if (parsed_url)
+      url_free (parsed_url);
+
+  if (filename && opt.delete_after && file_exists_p (filename))
+    {
+      DEBUGP (("\
+Removing file due to --delete-after in retrieve_from_file():\n"));
+      logprintf (LOG_VERBOSE, _("Removing %s.\n"), filename);
+      if (unlink (filename))
+        logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
+      dt &= ~RETROKF;
+    }
+
+  xfree_null (new_file);
+  xfree_null (filename);
+  iri_free (tmpiri);
+  return true;
+}
+
+/* Retrieve the URLs read from UF one after another, counting them in
+   *COUNT.  With --pipeline, the URLs following the current one are
+   read ahead and announced to the HTTP code, so that their requests
+   can be pipelined.  Returns the status of the last retrieval.  */
+
+static uerr_t
+retrieve_list_serially (struct urls_file *uf, struct iri *iri, int *count)
+{
+  uerr_t status = RETROK;
+  struct urlpos *ahead = NULL, *ahead_tail = NULL, *cur_url;
+  int nahead = 0;
+  bool hint = opt.pipeline > 1 && !opt.recursive && !opt.page_requisites;
+  int lookahead = hint ? opt.pipeline : 1;
+
+  for (;;)
+    {
+      bool go_on;
+
+      while (nahead < lookahead && (cur_url = urls_file_next (uf)) != NULL)
+        {
+          if (ahead_tail)
+            ahead_tail->next = cur_url;
+          else
+            ahead = cur_url;
+          ahead_tail = cur_url;
+          ++nahead;
+        }
+      if (!ahead)
+        break;
+
+      cur_url = ahead;
+      ahead = ahead->next;
+      if (!ahead)
+        ahead_tail = NULL;
+      cur_url->next = NULL;
+      --nahead;
+
+      if (hint && ahead)
+        {
+          const char **urls = xnew_array (const char *, nahead);
+          const char **referers = xnew0_array (const char *, nahead);
+          struct urlpos *p;
+          int i = 0;
+          for (p = ahead; p; p = p->next)
+            urls[i++] = p->url->url;
+          http_set_pipeline_hint (urls, referers, nahead);
+          xfree (urls);
+          xfree (referers);
+        }
+      go_on = retrieve_input_url (cur_url, iri, &status);
+      if (hint && ahead)
+        http_set_pipeline_hint (NULL, NULL, 0);
+      free_urlpos (cur_url);
+      if (!go_on)
+        break;
+      ++*count;
+    }
+  free_urlpos (ahead);
+  return status;
+}
+
+/* Like retrieve_list_serially, but hand the URLs to a pool of
+   --parallel workers.  Only as many URLs are read from UF as there
+   are idle workers, so that the memory used doesn't depend on the
+   length of the list.  */
+
+static uerr_t
+retrieve_list_parallel (struct urls_file *uf, struct iri *iri, int *count)
+{
+  uerr_t status = RETROK;
+  struct parallel_pool *pool = parallel_pool_new (opt.parallel);
+  struct urlpos *cur_url;
+  bool stopping = false;
+
+  if (!pool)
+    return retrieve_list_serially (uf, iri, count);
+
+  for (;;)
+    {
+      struct parallel_result res;
+
+      while (!stopping && parallel_idle (pool) > 0
+             && (cur_url = urls_file_next (uf)) != NULL)
+        {
+          if (!parallel_submit (pool, cur_url->url->url, NULL, iri, cur_url))
+            {
+              /* No worker took it; retrieve it here.  */
+              if (!retrieve_input_url (cur_url, iri, &status))
+                stopping = true;
+              else
+                ++*count;
+              free_urlpos (cur_url);
+            }
+        }
+
+      if (!parallel_wait (pool, &res))
+        {
+          /* Nothing is in progress.  Either the list is done, or all
+             the workers are gone and the rest of it has to be
+             retrieved serially.  */
+          if (stopping || parallel_idle (pool) > 0)
+            break;
+          parallel_pool_delete (pool);
+          pool = NULL;
+          status = retrieve_list_serially (uf, iri, count);
+          break;
+        }
+      if (!res.closure)
+        continue;
+
+      cur_url = res.closure;
+      if (!res.lost)
+        {
+          status = res.status;
+          if (res.file && opt.delete_after && file_exists_p (res.file))
+            {
+              DEBUGP (("\
+Removing file due to --delete-after in retrieve_list_parallel():\n"));
+              logprintf (LOG_VERBOSE, _("Removing %s.\n"), res.file);
+              if (unlink (res.file))
+                logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
+            }
+        }
+      xfree_null (res.file);
+      xfree_null (res.newloc);
+      xfree_null (res.content_encoding);
+      free_urlpos (cur_url);
+      ++*count;
+
+      if (opt.quota && total_downloaded_bytes > opt.quota)
+        {
+          status = QUOTEXC;
+          stopping = true;
+        }
+    }
+  if (pool)
+    parallel_pool_delete (pool);
+  return status;
+}
+
+/* Retrieve URL given on the command line (or in a job of --daemon):
+   recursively if requested, else by itself.  */
+
+void
+retrieve_from_arg (const char *arg)
+{
+  char *filename = NULL, *redirected_URL = NULL;
+  int dt, url_err;
+  /* Need to do a new struct iri every time, because
+   * retrieve_url may modify it in some circumstances,
+   * currently. */
+  struct iri *iri = iri_new ();
+  struct url *url_parsed;
+
+  set_uri_encoding (iri, opt.locale, true);
+  url_parsed = url_parse (arg, &url_err, iri, true);
+
+  if (!url_parsed)
+    {
+      char *error = url_error (arg, url_err);
+      logprintf (LOG_NOTQUIET, "%s: %s.\n", arg, error);
+      xfree (error);
+      inform_exit_status (URLERROR);
+    }
+  else
+    {
+      if ((opt.recursive || opt.page_requisites)
+          && (url_scheme (arg) != SCHEME_FTP || url_uses_proxy (url_parsed)))
+        {
+          int old_follow_ftp = opt.follow_ftp;
+
+          /* Turn opt.follow_ftp on in case of recursive FTP retrieval */
+          if (url_scheme (arg) == SCHEME_FTP)
+            opt.follow_ftp = 1;
+
+          retrieve_tree (url_parsed, NULL);
+
+          opt.follow_ftp = old_follow_ftp;
+        }
+      else
+        {
+          retrieve_url (url_parsed, arg, &filename, &redirected_URL, NULL,
+                        &dt, opt.recursive, iri, true);
+        }
+
+      if (opt.delete_after && filename != NULL && file_exists_p (filename))
+        {
+          DEBUGP (("Removing file due to --delete-after in main():\n"));
+          logprintf (LOG_VERBOSE, _("Removing %s.\n"), filename);
+          if (unlink (filename))
+            logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
+        }
+      xfree_null (redirected_URL);
+      xfree_null (filename);
+      url_free (url_parsed);
+    }
+  iri_free (iri);
+}
+
 /* Find the URLs in the file and call retrieve_url() for each of them.
    If HTML is true, treat the file as HTML, and construct the URLs
    accordingly.
@@ -981,6 +2019,7 @@ retrieve_from_file (const char *file, bool html, int *count)
 {
   uerr_t status;
   struct urlpos *url_list, *cur_url;
+  struct urls_file *uf = NULL;
   struct iri *iri = iri_new();
 
   char *input_file, *url_file = NULL;
@@ -1034,69 +2073,39 @@ retrieve_from_file (const char *file, bool html, int *count)
   else
     input_file = (char *) file;
 
-  url_list = (html ? get_urls_html (input_file, NULL, NULL, iri)
-              : get_urls_file (input_file));
+  /* A plain list of URLs is read a line at a time, so that the
+     downloads start at once and a huge list doesn't have to fit in
+     memory.  An HTML file is parsed as a whole.  */
+  if (html)
+    url_list = get_urls_html (input_file, NULL, NULL, iri);
+  else
+    {
+      url_list = NULL;
+      uf = urls_file_open (input_file);
+    }
 
   xfree_null (url_file);
 
-  for (cur_url = url_list; cur_url; cur_url = cur_url->next, ++*count)
+  if (uf)
     {
-      char *filename = NULL, *new_file = NULL;
-      int dt;
-      struct iri *tmpiri = iri_dup (iri);
-      struct url *parsed_url = NULL;
-
-      if (cur_url->ignore_when_downloading)
-        continue;
-
-      if (opt.quota && total_downloaded_bytes > opt.quota)
-        {
-          status = QUOTEXC;
-          break;
-        }
-
-      parsed_url = url_parse (cur_url->url->url, NULL, tmpiri, true);
-
-      if ((opt.recursive || opt.page_requisites)
-          && (cur_url->url->scheme != SCHEME_FTP || getproxy (cur_url->url)))
-        {
-          int old_follow_ftp = opt.follow_ftp;
-
-          /* Turn opt.follow_ftp on in case of recursive FTP retrieval */
-          if (cur_url->url->scheme == SCHEME_FTP)
-            opt.follow_ftp = 1;
-
-          status = retrieve_tree (parsed_url ? parsed_url : cur_url->url,
-                                  tmpiri);
-
-          opt.follow_ftp = old_follow_ftp;
-        }
+      /* Each URL in the list is retrieved on its own, so the list can
+         be spread over --parallel workers unless the retrievals are
+         recursive, which retrieve_tree parallelizes in turn.  */
+      if (opt.parallel > 1 && !opt.recursive && !opt.page_requisites)
+        status = retrieve_list_parallel (uf, iri, count);
       else
-        status = retrieve_url (parsed_url ? parsed_url : cur_url->url,
-                               cur_url->url->url, &filename,
-                               &new_file, NULL, &dt, opt.recursive, tmpiri,
-                               true);
-
-      if (parsed_url)
-          url_free (parsed_url);
-
-      if (filename && opt.delete_after && file_exists_p (filename))
-        {
-          DEBUGP (("\
-Removing file due to --delete-after in retrieve_from_file():\n"));
-          logprintf (LOG_VERBOSE, _("Removing %s.\n"), filename);
-          if (unlink (filename))
-            logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
-          dt &= ~RETROKF;
-        }
-
-      xfree_null (new_file);
-      xfree_null (filename);
-      iri_free (tmpiri);
+        status = retrieve_list_serially (uf, iri, count);
+      urls_file_close (uf);
     }
+  else
+    {
+      for (cur_url = url_list; cur_url; cur_url = cur_url->next, ++*count)
+        if (!retrieve_input_url (cur_url, iri, &status))
+          break;
 
-  /* Free the linked list of URL-s.  */
-  free_urlpos (url_list);
+      /* Free the linked list of URL-s.  */
+      free_urlpos (url_list);
+    }
 
   iri_free (iri);
 
@@ -1111,6 +2120,40 @@ printwhat (int n1, int n2)
   logputs (LOG_VERBOSE, (n1 == n2) ? _("Giving up.\n\n") : _("Retrying.\n\n"));
 }
 
+/* Called when try COUNT of a URL failed in a way worth retrying,
+   with RETRY_AFTER the seconds the server asked to wait, or -1.  If
+   the retry can be left to retrieve_tree, set retry_tries and
+   retry_delay for it and return true.
+
+   The delay starts at a second and doubles with every try, up to
+   --waitretry.  It is then spread between half and one and a half
+   times that, so that the URLs of a host that failed together are not
+   all tried again at once, and raised to RETRY_AFTER.  */
+
+bool
+retry_defer (int count, double retry_after)
+{
+  double delay = 1;
+  int n;
+
+  if (!retry_deferral || (opt.ntry && count >= opt.ntry))
+    return false;
+
+  for (n = 1; n < count && delay < opt.waitretry; n++)
+    delay *= 2;
+  if (delay > opt.waitretry)
+    delay = opt.waitretry;
+  delay *= 0.5 + random_float ();
+  if (delay < retry_after)
+    delay = retry_after;
+
+  retry_tries = count;
+  retry_delay = delay;
+  logprintf (LOG_VERBOSE, _("Retrying in %.1f seconds, after other URLs.\n\n"),
+             delay);
+  return true;
+}
+
 /* If opt.wait or opt.waitretry are specified, and if certain
    conditions are met, sleep the appropriate number of seconds.  See
    the documentation of --wait and --waitretry for more information.
@@ -1122,6 +2165,9 @@ sleep_between_retrievals (int count)
 {
   static bool first_retrieval = true;
 
+  if (crawl_spacing && count <= 1)
+    return;
+
   if (first_retrieval)
     {
       /* Don't sleep before the very first retrieval. */
@@ -1158,19 +2204,26 @@ sleep_between_retrievals (int count)
     }
 }
 
-/* Free the linked list of urlpos.  */
+/* Free the linked list of urlpos.  Elements that come from an arena
+   all share it, so it is released once, after the last of them.  */
 void
 free_urlpos (struct urlpos *l)
 {
+  struct arena *arena = NULL;
   while (l)
     {
       struct urlpos *next = l->next;
       if (l->url)
         url_free (l->url);
       xfree_null (l->local_name);
-      xfree (l);
+      if (l->arena)
+        arena = l->arena;
+      else
+        xfree (l);
       l = next;
     }
+  if (arena)
+    arena_free (arena);
 }
 
 /* Rotate FNAME opt.backups times */
@@ -1297,3 +2350,56 @@ input_file_url (const char *input_file)
   else
     return false;
 }
+
+#ifdef TESTING
+
+const char *
+test_chunk_decode (void)
+{
+  static const char body[] =
+    "4\r\nWiki\r\n5;name=value\r\npedia\r\n0\r\n"
+    "X-Checksum: 1\r\n\r\nHTTP/1.1 200 OK\r\n";
+  int len = strlen (body), body_len = strstr (body, "HTTP/") - body;
+  char buf[sizeof (body)], data[sizeof (body)];
+  struct chunk_decoder cd = { CHUNK_SIZE, 0 };
+  int n, used, step, total;
+
+  /* All at once.  */
+  memcpy (buf, body, len);
+  n = chunk_decode (&cd, buf, len, &used);
+  mu_assert ("test_chunk_decode: wrong data",
+             n == 9 && !memcmp (buf, "Wikipedia", 9));
+  mu_assert ("test_chunk_decode: wrong end", used == body_len);
+  mu_assert ("test_chunk_decode: not done", cd.state == CHUNK_DONE);
+
+  /* In pieces of every size.  */
+  for (step = 1; step < len; step++)
+    {
+      int pos;
+      cd.state = CHUNK_SIZE;
+      cd.size = 0;
+      total = 0;
+      for (pos = 0; pos < len && cd.state != CHUNK_DONE; pos += used)
+        {
+          int piece = MIN (step, len - pos);
+          memcpy (buf, body + pos, piece);
+          n = chunk_decode (&cd, buf, piece, &used);
+          memcpy (data + total, buf, n);
+          total += n;
+        }
+      mu_assert ("test_chunk_decode: wrong data in pieces",
+                 total == 9 && !memcmp (data, "Wikipedia", 9));
+      mu_assert ("test_chunk_decode: wrong end in pieces", pos == body_len);
+    }
+
+  /* A size that doesn't fit.  */
+  memcpy (buf, "ffffffffffffffffff\r\n", 20);
+  cd.state = CHUNK_SIZE;
+  cd.size = 0;
+  mu_assert ("test_chunk_decode: overflow not caught",
+             chunk_decode (&cd, buf, 20, &used) < 0);
+
+  return NULL;
+}
+
+#endif /* TESTING */
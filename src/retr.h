@@ -40,6 +40,13 @@ extern SUM_SIZE_INT total_downloaded_bytes;
 extern double total_download_time;
 extern FILE *output_stream;
 extern bool output_stream_regular;
+extern wgint *body_read_tally;
+extern struct link_stream *body_link_stream;
+extern struct sha1_ctx *body_digest;
+extern bool crawl_spacing;
+extern bool retry_deferral;
+extern int retry_tries;
+extern double retry_delay;
 
 /* Flags for fd_read_body. */
 enum {
@@ -47,10 +54,20 @@ enum {
   rb_skip_startpos = 2,
 
   /* Used by HTTP/HTTPS*/
-  rb_chunked_transfer_encoding = 4
+  rb_chunked_transfer_encoding = 4,
+
+  /* Decompress the body, which has the gzip or deflate content
+     coding.  */
+  rb_compressed_gzip = 8,
+  rb_compressed_deflate = 16
 };
 
-int fd_read_body (int, FILE *, wgint, wgint, wgint *, wgint *, double *, int, FILE *);
+struct warc_block;
+int fd_read_body (int, FILE *, wgint, wgint, wgint *, wgint *, double *, int,
+                  struct warc_block *);
+void limit_bandwidth_init (void);
+void limit_bandwidth_host (const char *, int);
+void retr_cleanup (void);
 
 typedef const char *(*hunk_terminator_t) (const char *, const char *, int);
 
@@ -59,6 +76,7 @@ char *fd_read_line (int);
 
 uerr_t retrieve_url (struct url *, const char *, char **, char **,
                      const char *, int *, bool, struct iri *, bool);
+void retrieve_from_arg (const char *);
 uerr_t retrieve_from_file (const char *, bool, int *);
 
 const char *retr_rate (wgint, double);
@@ -66,6 +84,7 @@ double calc_rate (wgint, double, int *);
 void printwhat (int, int);
 
 void sleep_between_retrievals (int);
+bool retry_defer (int, double);
 
 void rotate_backups (const char *);
 
@@ -0,0 +1,316 @@
+/* SHA-1 using the instructions of the processor, when it has them.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* Every byte of a WARC record goes through SHA-1, most of them twice
+   (once for the block digest and once for the payload digest), so
+   with a fast network the digests take more time than anything else
+   Wget does with the data.  Recent x86 processors (the SHA extensions)
+   and ARMv8 processors (the cryptography extensions) can compute
+   SHA-1 several times faster than the portable code of gnulib.
+
+   sha1_hw_process_bytes is a replacement for sha1_process_bytes.  It
+   works on the same struct sha1_ctx, so that sha1_init_ctx and
+   sha1_finish_ctx can still be used with it, and falls back to
+   sha1_process_bytes when the processor has no SHA-1 instructions.
+   The x86 instructions are looked for at run time; the ARM ones are
+   used when the compiler was told that it can use them.  */
+
+#include "wget.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sha1-hw.h"
+
+#if defined __GNUC__ && (__GNUC__ >= 5 || defined __clang__) \
+    && (defined __x86_64__ || defined __i386__)
+# define SHA1_HW_X86
+# include <cpuid.h>
+# include <immintrin.h>
+#elif defined __aarch64__ \
+    && (defined __ARM_FEATURE_CRYPTO || defined __ARM_FEATURE_SHA2)
+# define SHA1_HW_ARM
+# include <arm_neon.h>
+#endif
+
+/* Processes BLOCKS 64-byte blocks at DATA, updating the five words
+   of the hash in STATE.  */
+typedef void (*sha1_blocks_fn) (uint32_t *state, const unsigned char *data,
+                                size_t blocks);
+
+#ifdef SHA1_HW_X86
+
+/* One group of four rounds.  E is computed from the value ABCD had
+   before the previous group, which is then saved for the next one.  */
+#define SHA1_X86_ROUNDS(func, msg) do {                         \
+  e = _mm_sha1nexte_epu32 (abcd_prev, msg);                     \
+  abcd_prev = abcd;                                             \
+  abcd = _mm_sha1rnds4_epu32 (abcd, e, func);                   \
+} while (0)
+
+/* The next four words of the message schedule, in W[I & 3].  */
+#define SHA1_X86_SCHEDULE(i)                                            \
+  (w[(i) & 3] = _mm_sha1msg2_epu32                                      \
+   (_mm_xor_si128 (_mm_sha1msg1_epu32 (w[(i) & 3], w[((i) + 1) & 3]),   \
+                   w[((i) + 2) & 3]),                                   \
+    w[((i) + 3) & 3]))
+
+__attribute__ ((target ("sha,sse4.1,ssse3")))
+static void
+sha1_x86_blocks (uint32_t *state, const unsigned char *data, size_t blocks)
+{
+  const __m128i bswap = _mm_set_epi64x (0x0001020304050607ULL,
+                                        0x08090a0b0c0d0e0fULL);
+  __m128i abcd, e0;
+
+  /* The instructions keep A in the highest word.  */
+  abcd = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) state), 0x1b);
+  e0 = _mm_set_epi32 (state[4], 0, 0, 0);
+
+  while (blocks--)
+    {
+      __m128i w[4], e, abcd_prev;
+      __m128i abcd_save = abcd, e0_save = e0;
+      int i;
+
+      for (i = 0; i < 4; i++)
+        w[i] = _mm_shuffle_epi8
+          (_mm_loadu_si128 ((const __m128i *) (data + 16 * i)), bswap);
+
+      e = _mm_add_epi32 (e0, w[0]);
+      abcd_prev = abcd;
+      abcd = _mm_sha1rnds4_epu32 (abcd, e, 0);
+      for (i = 1; i < 4; i++)
+        SHA1_X86_ROUNDS (0, w[i]);
+      SHA1_X86_ROUNDS (0, SHA1_X86_SCHEDULE (4));
+      for (i = 5; i < 10; i++)
+        SHA1_X86_ROUNDS (1, SHA1_X86_SCHEDULE (i));
+      for (; i < 15; i++)
+        SHA1_X86_ROUNDS (2, SHA1_X86_SCHEDULE (i));
+      for (; i < 20; i++)
+        SHA1_X86_ROUNDS (3, SHA1_X86_SCHEDULE (i));
+
+      e0 = _mm_sha1nexte_epu32 (abcd_prev, e0_save);
+      abcd = _mm_add_epi32 (abcd, abcd_save);
+      data += 64;
+    }
+
+  _mm_storeu_si128 ((__m128i *) state, _mm_shuffle_epi32 (abcd, 0x1b));
+  state[4] = _mm_extract_epi32 (e0, 3);
+}
+
+/* Returns sha1_x86_blocks if the processor has the SHA extensions
+   (and SSSE3 and SSE4.1, which the code above uses as well).  */
+static sha1_blocks_fn
+sha1_hw_detect (void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid (1, &eax, &ebx, &ecx, &edx)
+      || !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+    return NULL;
+  if (__get_cpuid_max (0, NULL) < 7)
+    return NULL;
+  __cpuid_count (7, 0, eax, ebx, ecx, edx);
+  if (!(ebx & (1u << 29)))
+    return NULL;
+  return sha1_x86_blocks;
+}
+
+static const char sha1_hw_impl[] = "x86 SHA extensions";
+
+#elif defined SHA1_HW_ARM
+
+static void
+sha1_arm_blocks (uint32_t *state, const unsigned char *data, size_t blocks)
+{
+  static const uint32_t k[4] = {
+    0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6
+  };
+  uint32x4_t abcd = vld1q_u32 (state);
+  uint32_t e0 = state[4];
+
+  while (blocks--)
+    {
+      uint32x4_t w[4];
+      uint32x4_t abcd_save = abcd;
+      uint32_t e = e0;
+      int i;
+
+      for (i = 0; i < 4; i++)
+        w[i] = vreinterpretq_u32_u8 (vrev32q_u8 (vld1q_u8 (data + 16 * i)));
+
+      for (i = 0; i < 20; i++)
+        {
+          uint32x4_t wk;
+          uint32_t e_next;
+
+          if (i >= 4)
+            w[i & 3] = vsha1su1q_u32 (vsha1su0q_u32 (w[i & 3],
+                                                     w[(i + 1) & 3],
+                                                     w[(i + 2) & 3]),
+                                      w[(i + 3) & 3]);
+          wk = vaddq_u32 (w[i & 3], vdupq_n_u32 (k[i / 5]));
+          e_next = vsha1h_u32 (vgetq_lane_u32 (abcd, 0));
+          if (i < 5)
+            abcd = vsha1cq_u32 (abcd, e, wk);
+          else if (i >= 10 && i < 15)
+            abcd = vsha1mq_u32 (abcd, e, wk);
+          else
+            abcd = vsha1pq_u32 (abcd, e, wk);
+          e = e_next;
+        }
+
+      e0 += e;
+      abcd = vaddq_u32 (abcd, abcd_save);
+      data += 64;
+    }
+
+  vst1q_u32 (state, abcd);
+  state[4] = e0;
+}
+
+static sha1_blocks_fn
+sha1_hw_detect (void)
+{
+  return sha1_arm_blocks;
+}
+
+static const char sha1_hw_impl[] = "ARMv8 cryptography extensions";
+
+#endif /* SHA1_HW_ARM */
+
+#if defined SHA1_HW_X86 || defined SHA1_HW_ARM
+
+static sha1_blocks_fn sha1_hw_blocks;
+static bool sha1_hw_checked;
+
+/* Returns the accelerated block function, or NULL if there is none.  */
+static sha1_blocks_fn
+sha1_hw_get (void)
+{
+  /* Racing threads would all store the same value.  */
+  if (!sha1_hw_checked)
+    {
+      sha1_hw_blocks = sha1_hw_detect ();
+      sha1_hw_checked = true;
+    }
+  return sha1_hw_blocks;
+}
+
+/* Runs BLOCKS blocks at DATA through FN, and accounts for them in
+   CTX the way gnulib's sha1_process_block does.  */
+static void
+sha1_hw_process_blocks (sha1_blocks_fn fn, const unsigned char *data,
+                        size_t blocks, struct sha1_ctx *ctx)
+{
+  uint32_t state[5];
+  uint64_t total;
+
+  state[0] = ctx->A;
+  state[1] = ctx->B;
+  state[2] = ctx->C;
+  state[3] = ctx->D;
+  state[4] = ctx->E;
+  fn (state, data, blocks);
+  ctx->A = state[0];
+  ctx->B = state[1];
+  ctx->C = state[2];
+  ctx->D = state[3];
+  ctx->E = state[4];
+
+  total = ((uint64_t) ctx->total[1] << 32 | ctx->total[0])
+    + (uint64_t) blocks * 64;
+  ctx->total[0] = (uint32_t) total;
+  ctx->total[1] = (uint32_t) (total >> 32);
+}
+
+#endif /* SHA1_HW_X86 || SHA1_HW_ARM */
+
+/* Adds the LEN bytes at BUFFER to the digest in CTX, like
+   sha1_process_bytes.  */
+void
+sha1_hw_process_bytes (const void *buffer, size_t len, struct sha1_ctx *ctx)
+{
+#if defined SHA1_HW_X86 || defined SHA1_HW_ARM
+  const unsigned char *p = buffer;
+  sha1_blocks_fn fn = sha1_hw_get ();
+  size_t blocks;
+
+  if (!fn)
+    {
+      sha1_process_bytes (buffer, len, ctx);
+      return;
+    }
+
+  /* sha1_process_bytes never leaves a whole block in the buffer.  */
+  if (ctx->buflen > 0)
+    {
+      size_t fill = 64 - ctx->buflen;
+      if (fill > len)
+        fill = len;
+      memcpy ((char *) ctx->buffer + ctx->buflen, p, fill);
+      ctx->buflen += fill;
+      p += fill;
+      len -= fill;
+      if (ctx->buflen < 64)
+        return;
+      sha1_hw_process_blocks (fn, (unsigned char *) ctx->buffer, 1, ctx);
+      ctx->buflen = 0;
+    }
+
+  blocks = len / 64;
+  if (blocks > 0)
+    {
+      sha1_hw_process_blocks (fn, p, blocks, ctx);
+      p += blocks * 64;
+      len -= blocks * 64;
+    }
+
+  if (len > 0)
+    {
+      memcpy (ctx->buffer, p, len);
+      ctx->buflen = len;
+    }
+#else
+  sha1_process_bytes (buffer, len, ctx);
+#endif
+}
+
+/* Returns a description of the SHA-1 code in use, for debug output.  */
+const char *
+sha1_hw_name (void)
+{
+#if defined SHA1_HW_X86 || defined SHA1_HW_ARM
+  if (sha1_hw_get ())
+    return sha1_hw_impl;
+#endif
+  return "portable code";
+}
@@ -0,0 +1,521 @@
+/* Crawling in shards across processes.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --shard=K/N, this process is shard K of N shards taking part
+   in one recursive crawl, possibly on different machines.  The hosts
+   are divided among the shards by a hash of their names, and each
+   shard only retrieves the URLs of its own hosts.  The links it finds
+   to the hosts of other shards are forwarded to them through the
+   directory given by --shard-spool, which all the shards share.  Each
+   shard keeps its own queue and blacklist.
+
+   For each pair of shards, the spool holds a file "links.TO.FROM" of
+   the links FROM has forwarded to TO, one per line:
+
+     DEPTH <TAB> FLAGS <TAB> URL <TAB> REFERER
+
+   It is only ever appended to by FROM, and is read by TO as it grows.
+
+   Each shard also has a file "status.K" telling whether it is busy,
+   idle or gone, and how many links it has sent to and received from
+   each shard.  A shard is idle when its queue is empty, and gone once
+   it has exited.  The crawl is over when no shard is busy and every
+   link sent to a shard that is still there has been received.  An
+   idle shard only concludes that after finding the same statuses
+   twice in a row, so as not to be fooled by statuses that were read
+   at different times.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "ptimer.h"
+#include "parallel.h"
+#include "c-ctype.h"
+#include "shard.h"
+
+/* Seconds between looks at the spool.  */
+#define SHARD_POLL_INTERVAL 1.0
+
+/* This shard, counting from 0, and the number of shards.  */
+static int self, count;
+
+/* The links forwarded to each shard, and read from each.  */
+static FILE **out, **in;
+
+/* How far each file of links received has been read.  */
+static wgint *in_offset;
+
+/* The number of links sent to and received from each shard.  */
+static wgint *sent, *received;
+
+/* The links received and not yet taken by shard_receive.  */
+static struct shard_link *pending_head, *pending_tail;
+
+/* The time since the spool was last looked at.  */
+static struct ptimer *poll_timer;
+
+static char *
+spool_file (const char *kind, int a, int b)
+{
+  if (b < 0)
+    return aprintf ("%s/%s.%d", opt.shard_spool, kind, a + 1);
+  return aprintf ("%s/%s.%d.%d", opt.shard_spool, kind, a + 1, b + 1);
+}
+
+/* Write the status of this shard, STATE being "busy", "idle" or
+   "gone".  The links sent are flushed first, so that they have
+   arrived by the time the status says they were sent.  */
+
+static void
+write_status (const char *state)
+{
+  char *file, *tmp;
+  FILE *fp;
+  int i;
+
+  for (i = 0; i < count; i++)
+    if (out[i])
+      fflush (out[i]);
+
+  file = spool_file ("status", self, -1);
+  tmp = aprintf ("%s.tmp", file);
+  fp = fopen (tmp, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", tmp, strerror (errno));
+      goto out;
+    }
+  fputs (state, fp);
+  for (i = 0; i < count; i++)
+    fprintf (fp, " %s", number_to_static_string (sent[i]));
+  for (i = 0; i < count; i++)
+    fprintf (fp, " %s", number_to_static_string (received[i]));
+  fputc ('\n', fp);
+  /* Replace the status in one go, so that it is never read half
+     written.  */
+  if (fclose (fp) != 0 || rename (tmp, file) != 0)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      unlink (tmp);
+    }
+ out:
+  xfree (tmp);
+  xfree (file);
+}
+
+/* Return the number of lines in FILE, or 0 if it doesn't exist.  */
+
+static wgint
+count_lines (const char *file)
+{
+  FILE *fp = fopen (file, "r");
+  wgint lines = 0;
+  int c;
+
+  if (!fp)
+    return 0;
+  while ((c = getc (fp)) != EOF)
+    if (c == '\n')
+      ++lines;
+  fclose (fp);
+  return lines;
+}
+
+/* Start taking part in the crawl.  */
+
+void
+shard_begin (void)
+{
+  if (!out)
+    {
+      int i;
+
+      self = opt.shard_index - 1;
+      count = opt.shard_count;
+      out = xnew0_array (FILE *, count);
+      in = xnew0_array (FILE *, count);
+      in_offset = xnew0_array (wgint, count);
+      sent = xnew0_array (wgint, count);
+      received = xnew0_array (wgint, count);
+      poll_timer = ptimer_new ();
+
+      /* A shard started again after being interrupted goes on
+         appending to the files of links it sent, and reads those it
+         received from the start.  */
+      for (i = 0; i < count; i++)
+        if (i != self)
+          {
+            char *file = spool_file ("links", i, self);
+            sent[i] = count_lines (file);
+            xfree (file);
+          }
+    }
+  write_status ("busy");
+}
+
+/* Return the shard the host HOST belongs to.  The hash is computed
+   here rather than with hash.c, so that it can't differ between the
+   shards.  */
+
+static int
+host_shard (const char *host)
+{
+  /* 32-bit FNV-1a of the lower-cased name.  */
+  unsigned int h = 2166136261U;
+  for (; *host; host++)
+    {
+      h ^= (unsigned char) c_tolower (*host);
+      h *= 16777619U;
+      h &= 0xffffffffU;
+    }
+  return h % opt.shard_count;
+}
+
+/* Return whether the URLs of HOST are retrieved by this shard.  */
+
+bool
+shard_owns_p (const char *host)
+{
+  return opt.shard_count <= 1 || host_shard (host) == opt.shard_index - 1;
+}
+
+/* Forward URL, of the host HOST, to the shard it belongs to, to be
+   enqueued there with REFERER, DEPTH and the rest, as url_enqueue
+   would.  */
+
+void
+shard_forward (const char *host, const char *url, const char *referer,
+               int depth, bool html_allowed, bool css_allowed,
+               bool requisite)
+{
+  int to = host_shard (host);
+
+  if (!out[to])
+    {
+      char *file = spool_file ("links", to, self);
+      out[to] = fopen (file, "a");
+      if (!out[to])
+        {
+          logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+          xfree (file);
+          return;
+        }
+      xfree (file);
+    }
+  DEBUGP (("Forwarding %s to shard %d.\n", url, to + 1));
+  fprintf (out[to], "%d\t%c%c%c\t%s\t%s\n", depth,
+           html_allowed ? 'h' : '-', css_allowed ? 'c' : '-',
+           requisite ? 'r' : '-', url, referer ? referer : "-");
+  ++sent[to];
+}
+
+/* Parse LINE, a line of a file of links, into a new shard_link.
+   Returns NULL if the line is malformed.  */
+
+static struct shard_link *
+parse_link (char *line)
+{
+  struct shard_link *sl;
+  char *flags, *url, *referer, *end;
+  long depth;
+
+  flags = strchr (line, '\t');
+  url = flags ? strchr (flags + 1, '\t') : NULL;
+  referer = url ? strchr (url + 1, '\t') : NULL;
+  if (!referer)
+    return NULL;
+  *flags++ = *url++ = *referer++ = '\0';
+  depth = strtol (line, &end, 10);
+  if (end == line || *end || strlen (flags) != 3)
+    return NULL;
+  end = strchr (referer, '\n');
+  if (end)
+    *end = '\0';
+
+  sl = xnew0 (struct shard_link);
+  sl->line = line;
+  sl->url = url;
+  sl->referer = strcmp (referer, "-") ? referer : NULL;
+  sl->depth = depth;
+  sl->html_allowed = flags[0] == 'h';
+  sl->css_allowed = flags[1] == 'c';
+  sl->requisite = flags[2] == 'r';
+  return sl;
+}
+
+/* Read the links the other shards have forwarded since the last
+   time, and add them to the pending ones.  */
+
+static void
+poll_spool (void)
+{
+  bool got = false;
+  int i;
+
+  ptimer_reset (poll_timer);
+  for (i = 0; i < count; i++)
+    {
+      char *line;
+
+      if (i == self)
+        continue;
+      if (out[i])
+        fflush (out[i]);
+      if (!in[i])
+        {
+          char *file = spool_file ("links", self, i);
+          in[i] = fopen (file, "r");
+          xfree (file);
+          if (!in[i])
+            continue;
+        }
+
+      while ((line = read_whole_line (in[i])) != NULL)
+        {
+          struct shard_link *sl;
+          size_t len = strlen (line);
+
+          if (line[len - 1] != '\n')
+            {
+              /* The rest of the line has yet to be written.  */
+              xfree (line);
+              fseeko (in[i], in_offset[i], SEEK_SET);
+              break;
+            }
+          in_offset[i] += len;
+          ++received[i];
+          got = true;
+          sl = parse_link (line);
+          if (!sl)
+            {
+              DEBUGP (("Malformed link from shard %d.\n", i + 1));
+              xfree (line);
+              continue;
+            }
+          if (pending_tail)
+            pending_tail->next = sl;
+          else
+            pending_head = sl;
+          pending_tail = sl;
+        }
+      /* Look for more once the file has grown.  */
+      clearerr (in[i]);
+    }
+
+  /* Say that the links were received only along with being busy,
+     until they are dealt with.  */
+  if (got)
+    write_status ("busy");
+}
+
+/* Return the next link another shard has forwarded to this one, or
+   NULL if there is none for now.  The link is to be freed with
+   shard_link_free.  */
+
+struct shard_link *
+shard_receive (void)
+{
+  struct shard_link *sl;
+
+  if (!pending_head && ptimer_measure (poll_timer) >= SHARD_POLL_INTERVAL)
+    poll_spool ();
+  sl = pending_head;
+  if (sl)
+    {
+      pending_head = sl->next;
+      if (!pending_head)
+        pending_tail = NULL;
+    }
+  return sl;
+}
+
+void
+shard_link_free (struct shard_link *sl)
+{
+  xfree (sl->line);
+  xfree (sl);
+}
+
+/* Read the statuses of all the shards into one string, or return
+   NULL if some shard has yet to write its status.  */
+
+static char *
+read_statuses (void)
+{
+  char *all = NULL;
+  int i;
+
+  for (i = 0; i < count; i++)
+    {
+      char *file = spool_file ("status", i, -1);
+      FILE *fp = fopen (file, "r");
+      char *line = fp ? read_whole_line (fp) : NULL;
+
+      if (fp)
+        fclose (fp);
+      xfree (file);
+      if (!line)
+        {
+          xfree_null (all);
+          return NULL;
+        }
+      if (all)
+        {
+          char *both = concat_strings (all, line, (char *) 0);
+          xfree (all);
+          xfree (line);
+          all = both;
+        }
+      else
+        all = line;
+    }
+  return all;
+}
+
+/* Return whether STATUSES, as read by read_statuses, say that the
+   crawl is over.  */
+
+static bool
+crawl_over_p (const char *statuses)
+{
+  bool over = true, *gone = xnew_array (bool, count);
+  wgint *sent_by = xnew_array (wgint, count * count);
+  wgint *received_by = xnew_array (wgint, count * count);
+  const char *p = statuses;
+  int i, j;
+
+  for (i = 0; i < count && over; i++)
+    {
+      char *end;
+      if (0 == strncmp (p, "gone ", 5))
+        gone[i] = true;
+      else if (0 == strncmp (p, "idle ", 5))
+        gone[i] = false;
+      else
+        over = false;
+      p += 4;
+      for (j = 0; j < count && over; j++, p = end)
+        sent_by[i * count + j] = str_to_wgint (p, &end, 10);
+      for (j = 0; j < count && over; j++, p = end)
+        received_by[i * count + j] = str_to_wgint (p, &end, 10);
+      p = strchr (p, '\n');
+      if (!p)
+        over = false;
+      else
+        ++p;
+    }
+
+  /* Links sent to a shard that is gone are lost.  */
+  for (i = 0; i < count && over; i++)
+    for (j = 0; j < count && over; j++)
+      if (i != j && !gone[j]
+          && sent_by[i * count + j] != received_by[j * count + i])
+        over = false;
+
+  xfree (gone);
+  xfree (sent_by);
+  xfree (received_by);
+  return over;
+}
+
+/* The queue of this shard is empty: wait for the other shards to
+   forward links to it.  Returns true when some have arrived, and
+   false when the crawl is over.  */
+
+bool
+shard_wait (void)
+{
+  char *prev = NULL;
+
+  if (opt.shard_count <= 1)
+    return false;
+  write_status ("idle");
+  logputs (LOG_VERBOSE, _("Waiting for links from the other shards.\n"));
+  while (1)
+    {
+      char *cur;
+
+      poll_spool ();
+      if (pending_head)
+        {
+          xfree_null (prev);
+          return true;
+        }
+      cur = read_statuses ();
+      if (cur && prev && 0 == strcmp (cur, prev) && crawl_over_p (cur))
+        {
+          xfree (cur);
+          xfree (prev);
+          return false;
+        }
+      xfree_null (prev);
+      prev = cur;
+      xsleep (SHARD_POLL_INTERVAL);
+    }
+}
+
+/* Stop taking part in the crawl.  */
+
+void
+shard_cleanup (void)
+{
+  int i;
+
+  /* The workers of --parallel have nothing to say about the shard.  */
+  if (!out || parallel_worker_p ())
+    return;
+  write_status ("gone");
+  for (i = 0; i < count; i++)
+    {
+      if (out[i])
+        fclose (out[i]);
+      if (in[i])
+        fclose (in[i]);
+    }
+  while (pending_head)
+    {
+      struct shard_link *next = pending_head->next;
+      shard_link_free (pending_head);
+      pending_head = next;
+    }
+  pending_tail = NULL;
+  xfree (out);
+  xfree (in);
+  xfree (in_offset);
+  xfree (sent);
+  xfree (received);
+  ptimer_destroy (poll_timer);
+  out = in = NULL;
+}
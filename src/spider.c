@@ -31,6 +31,7 @@ as that of the covered work.  */
 #include "wget.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <assert.h>
 
@@ -39,10 +40,15 @@ as that of the covered work.  */
 #include "utils.h"
 #include "hash.h"
 #include "res.h"
+#include "parallel.h"
 
 
 static struct hash_table *nonexisting_urls_set;
 
+/* The --broken-links file, opened when the first broken link is
+   found.  */
+static FILE *broken_links_fp;
+
 /* Cleanup the data structures associated with this file.  */
 
 void
@@ -50,6 +56,32 @@ spider_cleanup (void)
 {
   if (nonexisting_urls_set)
     string_set_free (nonexisting_urls_set);
+  nonexisting_urls_set = NULL;
+  if (broken_links_fp)
+    fclose (broken_links_fp);
+  broken_links_fp = NULL;
+}
+
+/* Append URL to the --broken-links file, so that the results of a
+   long run can be followed while it goes on.  */
+
+static void
+report_broken_link (const char *url)
+{
+  if (!broken_links_fp)
+    {
+      broken_links_fp = fopen (opt.broken_links_file, "w");
+      if (!broken_links_fp)
+        {
+          logprintf (LOG_NOTQUIET, "%s: %s\n", opt.broken_links_file,
+                     strerror (errno));
+          xfree (opt.broken_links_file);
+          opt.broken_links_file = NULL;
+          return;
+        }
+    }
+  fprintf (broken_links_fp, "%s\n", url);
+  fflush (broken_links_fp);
 }
 
 /* Remembers broken links.  */
@@ -59,9 +91,18 @@ nonexisting_url (const char *url)
   /* Ignore robots.txt URLs */
   if (is_robots_txt_url (url))
     return;
+  if (parallel_worker_p ())
+    {
+      parallel_forward (PEV_NONEXISTING_URL, url, NULL);
+      return;
+    }
   if (!nonexisting_urls_set)
     nonexisting_urls_set = make_string_hash_table (0);
+  if (string_set_contains (nonexisting_urls_set, url))
+    return;
   string_set_add (nonexisting_urls_set, url);
+  if (opt.broken_links_file)
+    report_broken_link (url);
 }
 
 void
@@ -0,0 +1,251 @@
+/* Cache of TLS sessions, for resuming them on new connections.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* The SSL backends store the sessions they establish here, keyed by
+   host name, and offer the stored session to the server of the next
+   connection to the same host.  If the server accepts it, the
+   handshake is abbreviated: no certificate is sent and no key
+   exchange is done.  The sessions are opaque data serialized by the
+   backend.
+
+   With --tls-session-file, the cache is loaded from that file on
+   first use and saved there at exit, so that the sessions survive
+   from one run to the next.  The file holds the secrets of the
+   sessions, hence it is created readable only by its owner.  */
+
+#include "wget.h"
+
+#ifdef HAVE_SSL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "hash.h"
+#include "ssl.h"
+
+/* Sessions read from the file are not offered after this many
+   seconds.  Servers seldom accept older ones.  */
+#define SESSION_MAX_AGE (24 * 60 * 60)
+
+struct ssl_session {
+  char *data;
+  int len;
+  time_t stored;                /* when the session was established */
+};
+
+/* Mapping between host names and their sessions.  */
+static struct hash_table *session_map;
+static bool sessions_loaded_p;
+
+static void
+session_free (struct ssl_session *s)
+{
+  xfree (s->data);
+  xfree (s);
+}
+
+static void
+session_put (const char *host, const void *data, int len, time_t stored)
+{
+  struct ssl_session *s;
+  char *key;
+
+  if (!session_map)
+    session_map = make_nocase_string_hash_table (0);
+  if (hash_table_get_pair (session_map, host, &key, &s))
+    {
+      hash_table_remove (session_map, host);
+      xfree (key);
+      session_free (s);
+    }
+  s = xnew (struct ssl_session);
+  s->data = xmalloc (len);
+  memcpy (s->data, data, len);
+  s->len = len;
+  s->stored = stored;
+  hash_table_put (session_map, xstrdup_lower (host), s);
+}
+
+static void
+sessions_load (void)
+{
+  FILE *fp;
+  char *line;
+  time_t now = time (NULL);
+
+  sessions_loaded_p = true;
+  if (!opt.tls_session_file)
+    return;
+  fp = fopen (opt.tls_session_file, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot open TLS session file %s: %s\n"),
+                   quote (opt.tls_session_file), strerror (errno));
+      return;
+    }
+  while ((line = read_whole_line (fp)) != NULL)
+    {
+      char host[256], *encoded;
+      long stored;
+      int n;
+
+      if (*line != '#'
+          && sscanf (line, "%255s %ld %n", host, &stored, &n) == 2
+          && stored <= now && now - stored < SESSION_MAX_AGE)
+        {
+          char *data;
+          int len;
+          encoded = line + n;
+          encoded[strcspn (encoded, " \t\r\n")] = '\0';
+          data = xmalloc (strlen (encoded) * 3 / 4 + 3);
+          len = base64_decode (encoded, data);
+          if (len > 0)
+            session_put (host, data, len, (time_t) stored);
+          xfree (data);
+        }
+      xfree (line);
+    }
+  fclose (fp);
+  DEBUGP (("Loaded TLS sessions from %s.\n", opt.tls_session_file));
+}
+
+/* Store the session of LEN bytes at DATA, established with HOST,
+   replacing the previous one.  */
+
+void
+ssl_session_put (const char *host, const void *data, int len)
+{
+  if (!sessions_loaded_p)
+    sessions_load ();
+  DEBUGP (("Caching TLS session for %s (%d bytes).\n", host, len));
+  session_put (host, data, len, time (NULL));
+}
+
+/* Return the session established with HOST and store its length to
+   *LEN, or return NULL if there is none.  The data belongs to the
+   cache.  */
+
+const void *
+ssl_session_get (const char *host, int *len)
+{
+  struct ssl_session *s;
+  if (!sessions_loaded_p)
+    sessions_load ();
+  if (!session_map)
+    return NULL;
+  s = hash_table_get (session_map, host);
+  if (!s)
+    return NULL;
+  *len = s->len;
+  return s->data;
+}
+
+/* Forget the session of HOST, for example because resuming it
+   failed.  */
+
+void
+ssl_session_forget (const char *host)
+{
+  char *key;
+  struct ssl_session *s;
+  if (session_map && hash_table_get_pair (session_map, host, &key, &s))
+    {
+      hash_table_remove (session_map, host);
+      xfree (key);
+      session_free (s);
+    }
+}
+
+/* Write the sessions to the session file.  */
+
+void
+ssl_session_save (void)
+{
+  FILE *fp;
+  int fd;
+  hash_table_iterator iter;
+
+  if (!opt.tls_session_file)
+    return;
+  /* Don't lose the sessions of hosts not visited in this run.  */
+  if (!sessions_loaded_p)
+    sessions_load ();
+  fd = open (opt.tls_session_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0 || !(fp = fdopen (fd, "w")))
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot open TLS session file %s: %s\n"),
+                 quote (opt.tls_session_file), strerror (errno));
+      if (fd >= 0)
+        close (fd);
+      return;
+    }
+  fputs ("# Wget TLS session file.  Each line holds a host name, the time\n"
+         "# its session was established, and the session in base64.\n"
+         "# Keep this file private.\n", fp);
+  if (session_map)
+    for (hash_table_iterate (session_map, &iter); hash_table_iter_next (&iter); )
+      {
+        struct ssl_session *s = iter.value;
+        char *encoded = xmalloc (BASE64_LENGTH (s->len) + 1);
+        base64_encode (s->data, s->len, encoded);
+        fprintf (fp, "%s %ld %s\n", (const char *) iter.key,
+                 (long) s->stored, encoded);
+        xfree (encoded);
+      }
+  if (fclose (fp) < 0)
+    logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
+               quote (opt.tls_session_file), strerror (errno));
+  else
+    DEBUGP (("Saved TLS sessions to %s.\n", opt.tls_session_file));
+}
+
+void
+ssl_session_cleanup (void)
+{
+  hash_table_iterator iter;
+  if (!session_map)
+    return;
+  for (hash_table_iterate (session_map, &iter); hash_table_iter_next (&iter); )
+    {
+      xfree (iter.key);
+      session_free (iter.value);
+    }
+  hash_table_destroy (session_map);
+  session_map = NULL;
+}
+
+#endif /* HAVE_SSL */
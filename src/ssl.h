@@ -35,5 +35,13 @@ as that of the covered work.  */
 bool ssl_init (void);
 bool ssl_connect_wget (int, const char *);
 bool ssl_check_certificate (int, const char *);
+bool ssl_http2_p (int);
+
+/* Defined in ssl-session.c. */
+void ssl_session_put (const char *, const void *, int);
+const void *ssl_session_get (const char *, int *);
+void ssl_session_forget (const char *);
+void ssl_session_save (void);
+void ssl_session_cleanup (void);
 
 #endif /* GEN_SSLFUNC_H */
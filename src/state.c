@@ -0,0 +1,304 @@
+/* Saving and restoring the state of a recursive retrieval.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* With --state-file, retrieve_tree periodically writes everything it
+   needs to pick up a crawl where it was left: the queue, the set of
+   visited URLs, and the registries of downloaded files kept by
+   convert.c.  Restarting Wget with the same start URL and state file
+   then continues the crawl instead of beginning it anew.
+
+   A new state is written to a temporary file that then replaces the
+   old one, so a crash while saving leaves the previous state
+   intact.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
+#include "utils.h"
+#include "hash.h"
+#include "intern.h"
+#include "state.h"
+
+/* Write N seven bits at a time, least significant group first, with
+   the high bit set on all bytes but the last.  */
+
+void
+state_put_number (FILE *fp, wgint n)
+{
+  unsigned char buf[16];
+  int len = 0;
+  uintmax_t u = n;
+
+  do
+    {
+      buf[len] = u & 0x7f;
+      u >>= 7;
+      if (u)
+        buf[len] |= 0x80;
+      ++len;
+    }
+  while (u);
+  fwrite (buf, 1, len, fp);
+}
+
+/* Write S, or a NULL pointer, so that state_get_string can tell
+   them apart: the length is written plus one, 0 standing for NULL.  */
+
+void
+state_put_string (FILE *fp, const char *s)
+{
+  size_t len;
+  if (!s)
+    {
+      state_put_number (fp, 0);
+      return;
+    }
+  len = strlen (s);
+  state_put_number (fp, len + 1);
+  fwrite (s, 1, len, fp);
+}
+
+void
+state_put_bytes (FILE *fp, const void *data, size_t len)
+{
+  if (len)
+    fwrite (data, 1, len, fp);
+}
+
+/* Write the hash table HT whose keys are strings.  With VALUES_P, the
+   values are strings too and written after the keys; otherwise HT is
+   a string set.  */
+
+void
+state_put_string_table (FILE *fp, struct hash_table *ht, bool values_p)
+{
+  hash_table_iterator iter;
+
+  state_put_number (fp, ht ? hash_table_count (ht) : 0);
+  if (!ht)
+    return;
+  for (hash_table_iterate (ht, &iter); hash_table_iter_next (&iter); )
+    {
+      state_put_string (fp, iter.key);
+      if (values_p)
+        state_put_string (fp, iter.value);
+    }
+}
+
+bool
+state_get_number (FILE *fp, wgint *n)
+{
+  uintmax_t u = 0;
+  int shift = 0, c;
+
+  do
+    {
+      c = getc (fp);
+      if (c == EOF || shift >= 64)
+        return false;
+      u |= (uintmax_t) (c & 0x7f) << shift;
+      shift += 7;
+    }
+  while (c & 0x80);
+  *n = u;
+  return *n >= 0;
+}
+
+bool
+state_get_string (FILE *fp, char **s)
+{
+  wgint len;
+  if (!state_get_number (fp, &len))
+    return false;
+  if (len == 0)
+    {
+      *s = NULL;
+      return true;
+    }
+  --len;
+  /* Guard against a corrupt length before allocating it.  */
+  if (len > 1024 * 1024)
+    return false;
+  *s = xmalloc (len + 1);
+  if (len && fread (*s, len, 1, fp) != 1)
+    {
+      xfree (*s);
+      return false;
+    }
+  (*s)[len] = '\0';
+  return true;
+}
+
+bool
+state_get_bytes (FILE *fp, void *data, size_t len)
+{
+  return len == 0 || fread (data, len, 1, fp) == 1;
+}
+
+/* Read a table written by state_put_string_table and add its entries
+   to *HT, creating it first if it is NULL.  The keys and values are
+   allocated, as with string_set_add.  */
+
+bool
+state_get_string_table (FILE *fp, struct hash_table **ht, bool values_p)
+{
+  wgint count, i;
+
+  if (!state_get_number (fp, &count))
+    return false;
+  if (count && !*ht)
+    *ht = make_string_hash_table (count);
+  for (i = 0; i < count; i++)
+    {
+      char *key, *value = NULL;
+      if (!state_get_string (fp, &key) || !key)
+        return false;
+      if (values_p && !state_get_string (fp, &value))
+        {
+          xfree (key);
+          return false;
+        }
+      if (hash_table_contains (*ht, key) || (values_p && !value))
+        {
+          /* Keep the entry the table already has.  */
+          xfree (key);
+          xfree_null (value);
+          continue;
+        }
+      hash_table_put (*ht, key, values_p ? value : "1");
+    }
+  return true;
+}
+
+/* Like state_get_string_table, but for a table whose keys, and values
+   if VALUES_P, are interned with intern_string.  */
+
+bool
+state_get_interned_table (FILE *fp, struct hash_table **ht, bool values_p)
+{
+  struct hash_table *loaded = NULL;
+  hash_table_iterator iter;
+  bool ok = state_get_string_table (fp, &loaded, values_p);
+
+  if (!loaded)
+    return ok;
+  if (ok && !*ht)
+    *ht = make_string_hash_table (hash_table_count (loaded));
+  for (hash_table_iterate (loaded, &iter); hash_table_iter_next (&iter); )
+    {
+      if (ok && !hash_table_contains (*ht, iter.key))
+        hash_table_put (*ht, intern_string (iter.key),
+                        values_p ? intern_string (iter.value) : "1");
+      xfree (iter.key);
+      if (values_p)
+        xfree (iter.value);
+    }
+  hash_table_destroy (loaded);
+  return ok;
+}
+
+/* Return the name of the temporary file a new state of FILE is
+   written to.  */
+
+static char *
+state_temp_name (const char *file)
+{
+  return concat_strings (file, ".tmp", (char *) 0);
+}
+
+/* Start writing a new state for FILE.  */
+
+FILE *
+state_create (const char *file)
+{
+  char *tmp = state_temp_name (file);
+  FILE *fp = fopen (tmp, "wb");
+  if (!fp)
+    logprintf (LOG_NOTQUIET, _("Cannot write state file %s: %s\n"),
+               quote (tmp), strerror (errno));
+  xfree (tmp);
+  return fp;
+}
+
+/* Finish writing the state started by state_create and make it
+   replace the previous state of FILE.  */
+
+bool
+state_commit (FILE *fp, const char *file)
+{
+  char *tmp = state_temp_name (file);
+  bool ok = !ferror (fp);
+
+  if (fclose (fp) != 0)
+    ok = false;
+  if (ok && rename (tmp, file) != 0)
+    ok = false;
+  if (!ok)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write state file %s: %s\n"),
+                 quote (file), strerror (errno));
+      unlink (tmp);
+    }
+  xfree (tmp);
+  return ok;
+}
+
+/* Give up the state started by state_create, keeping the previous
+   state of FILE.  */
+
+void
+state_abandon (FILE *fp, const char *file)
+{
+  char *tmp = state_temp_name (file);
+  fclose (fp);
+  unlink (tmp);
+  xfree (tmp);
+}
+
+/* Open the state file FILE for reading, or return NULL if there is
+   none.  */
+
+FILE *
+state_open (const char *file)
+{
+  FILE *fp = fopen (file, "rb");
+  if (!fp && errno != ENOENT)
+    logprintf (LOG_NOTQUIET, _("Cannot open state file %s: %s\n"),
+               quote (file), strerror (errno));
+  return fp;
+}
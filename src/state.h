@@ -0,0 +1,58 @@
+/* Declarations for state.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#ifndef STATE_H
+#define STATE_H
+
+struct hash_table;
+
+/* Elementary encoding of the state file, also used by the URL queue
+   for the entries it spills to disk.  Numbers are non-negative and
+   written as variable-length integers; strings are written with
+   their length and may be NULL.  Write errors are left for
+   state_commit to detect.  */
+
+void state_put_number (FILE *, wgint);
+void state_put_string (FILE *, const char *);
+void state_put_bytes (FILE *, const void *, size_t);
+void state_put_string_table (FILE *, struct hash_table *, bool);
+
+bool state_get_number (FILE *, wgint *);
+bool state_get_string (FILE *, char **);
+bool state_get_bytes (FILE *, void *, size_t);
+bool state_get_string_table (FILE *, struct hash_table **, bool);
+bool state_get_interned_table (FILE *, struct hash_table **, bool);
+
+FILE *state_create (const char *);
+bool state_commit (FILE *, const char *);
+void state_abandon (FILE *, const char *);
+FILE *state_open (const char *);
+
+#endif /* STATE_H */
@@ -0,0 +1,251 @@
+/* Machine-readable statistics of retrievals.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* --stats-file writes a JSON object per line for every retrieval,
+   and one with the totals when Wget exits:
+
+     {"type":"retrieval","time":1357000000,"url":"http://...",
+      "ok":true,"status":200,"bytes":1234,"tries":1,"reused":false,
+      "compressed":false,"dns":0.0012,"connect":0.0305,"tls":null,
+      "wait":0.1021,"body":0.0113}
+     {"type":"summary","time":1357000001,"files":1,"bytes":1234,
+      "download_time":0.0113,"wall_time":0.2012,"transfer_time":0.1451,
+      "parse_time":0.0004,"queue_time":0.0001,"convert_time":0}
+
+   The times are in seconds, and null for phases that the last try
+   of the retrieval skipped.  "status" is the HTTP status code, and
+   null for FTP.
+
+   The file is opened once, for appending, and each line is written
+   with a single write.  The workers of --parallel inherit the
+   descriptor and write their own lines, which therefore stay whole.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "stats.h"
+#include "timing.h"
+#include "utils.h"
+#include "retr.h"
+#include "memory.h"
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+extern int numurls;
+
+static int stats_fd = -1;
+
+/* The tries of the retrieval in progress.  */
+static struct {
+  int tries;
+  wgint bytes;
+  struct xfer_timing last;
+} cur;
+
+static const char *phase_keys[PHASE_COUNT] = {
+  "dns", "connect", "tls", "wait", "body"
+};
+
+/* A line being built.  */
+struct stats_line {
+  char *text;
+  int len, size;
+};
+
+static void
+line_printf (struct stats_line *l, const char *fmt, ...)
+{
+  va_list args;
+  int n;
+
+  while (1)
+    {
+      va_start (args, fmt);
+      n = vsnprintf (l->text + l->len, l->size - l->len, fmt, args);
+      va_end (args);
+      if (n >= 0 && n < l->size - l->len)
+        break;
+      l->size = n >= 0 ? l->len + n + 1 : l->size * 2;
+      l->text = xrealloc (l->text, l->size);
+    }
+  l->len += n;
+}
+
+/* Append S as a JSON string.  */
+
+static void
+line_string (struct stats_line *l, const char *s)
+{
+  line_printf (l, "\"");
+  for (; *s; s++)
+    {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\')
+        line_printf (l, "\\%c", c);
+      else if (c < 0x20 || c == 0x7f)
+        line_printf (l, "\\u%04x", c);
+      else
+        line_printf (l, "%c", c);
+    }
+  line_printf (l, "\"");
+}
+
+static void
+line_write (struct stats_line *l)
+{
+  line_printf (l, "}\n");
+  if (write (stats_fd, l->text, l->len) != l->len)
+    DEBUGP (("Failed to write to %s: %s\n", opt.stats_file,
+             strerror (errno)));
+  xfree (l->text);
+}
+
+static void
+line_start (struct stats_line *l, const char *type)
+{
+  l->size = 256;
+  l->len = 0;
+  l->text = xmalloc (l->size);
+  line_printf (l, "{\"type\":\"%s\",\"time\":%ld", type, (long) time (NULL));
+}
+
+/* Open the file given with --stats-file.  */
+
+void
+stats_open (void)
+{
+  stats_fd = open (opt.stats_file,
+                   O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_BINARY, 0666);
+  if (stats_fd < 0)
+    logprintf (LOG_NOTQUIET, _("Cannot open stats file %s: %s\n"),
+               quote (opt.stats_file), strerror (errno));
+}
+
+/* Note a try of the retrieval in progress, whose times are those of
+   the transfer last finished by timing_finish_transfer.  */
+
+void
+stats_note_attempt (void)
+{
+  struct xfer_timing t;
+
+  if (stats_fd < 0)
+    return;
+  timing_last (&t);
+  cur.tries++;
+  cur.bytes += t.bytes;
+  cur.last = t;
+}
+
+/* Write the record of the retrieval of URL, which ended with RESULT.
+   STATUS is the HTTP status code, or 0.  COMPRESSED tells whether the
+   body came with a content coding.  */
+
+void
+stats_record (const char *url, uerr_t result, int status, bool compressed)
+{
+  struct stats_line l;
+  int i;
+
+  if (stats_fd < 0)
+    return;
+
+  line_start (&l, "retrieval");
+  line_printf (&l, ",\"url\":");
+  line_string (&l, url);
+  line_printf (&l, ",\"ok\":%s", result == RETROK ? "true" : "false");
+  if (status)
+    line_printf (&l, ",\"status\":%d", status);
+  else
+    line_printf (&l, ",\"status\":null");
+  line_printf (&l, ",\"bytes\":%s,\"tries\":%d,\"reused\":%s,\"compressed\":%s",
+               number_to_static_string (cur.bytes), cur.tries,
+               cur.tries && cur.last.reused ? "true" : "false",
+               compressed ? "true" : "false");
+  for (i = 0; i < PHASE_COUNT; i++)
+    if (cur.tries && cur.last.phase[i] >= 0)
+      line_printf (&l, ",\"%s\":%.6f", phase_keys[i], cur.last.phase[i]);
+    else
+      line_printf (&l, ",\"%s\":null", phase_keys[i]);
+  line_write (&l);
+
+  xzero (cur);
+}
+
+/* Write the summary of the run, which took WALL_TIME seconds, and
+   close the file.  */
+
+void
+stats_close (double wall_time)
+{
+  struct stats_line l;
+  struct timing_totals t;
+  struct memory_usage mu;
+  double transfer_time = 0;
+  int i;
+
+  if (stats_fd < 0)
+    return;
+
+  timing_get_totals (&t);
+  for (i = 0; i < PHASE_COUNT; i++)
+    transfer_time += t.sum[i];
+
+  line_start (&l, "summary");
+  line_printf (&l, ",\"files\":%d,\"bytes\":%.0f,\"download_time\":%.6f"
+               ",\"wall_time\":%.6f", numurls,
+               (double) total_downloaded_bytes, total_download_time,
+               wall_time);
+  line_printf (&l, ",\"transfer_time\":%.6f,\"parse_time\":%.6f"
+               ",\"queue_time\":%.6f,\"convert_time\":%.6f", transfer_time,
+               t.task[TASK_PARSE], t.task[TASK_QUEUE], t.task[TASK_CONVERT]);
+  memory_get_peak (&mu);
+  for (i = 0; i < MEMORY_COUNT; i++)
+    line_printf (&l, "%s\"%s\":%.0f", i == 0 ? ",\"memory\":{" : ",",
+                 memory_part_names[i], (double) mu.part[i]);
+  line_printf (&l, ",\"total\":%.0f,\"resident\":%.0f}",
+               (double) mu.total, (double) mu.resident);
+  line_write (&l);
+
+  close (stats_fd);
+  stats_fd = -1;
+}
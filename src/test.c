@@ -39,12 +39,24 @@ as that of the covered work.  */
 const char *test_parse_content_disposition();
 const char *test_subdir_p();
 const char *test_dir_matches_p();
+const char *test_acclist();
 const char *test_commands_sorted();
 const char *test_cmd_spec_restrict_file_names();
 const char *test_path_simplify ();
 const char *test_append_uri_pathel();
 const char *test_are_urls_equal();
+const char *test_url_parse_canonical();
 const char *test_is_robots_txt_url();
+const char *test_res_match_path();
+const char *test_res_crawl_delay();
+const char *test_evloop_timers();
+const char *test_visited_set();
+const char *test_arena();
+const char *test_html_name_hashes();
+const char *test_get_urls_css();
+const char *test_hash_table();
+const char *test_cookie_header_cache();
+const char *test_chunk_decode();
 
 const char *program_argstring = "TEST";
 
@@ -56,12 +68,24 @@ all_tests()
   mu_run_test (test_parse_content_disposition);
   mu_run_test (test_subdir_p);
   mu_run_test (test_dir_matches_p);
+  mu_run_test (test_acclist);
   mu_run_test (test_commands_sorted);
   mu_run_test (test_cmd_spec_restrict_file_names);
   mu_run_test (test_path_simplify);
   mu_run_test (test_append_uri_pathel);
   mu_run_test (test_are_urls_equal);
+  mu_run_test (test_url_parse_canonical);
   mu_run_test (test_is_robots_txt_url);
+  mu_run_test (test_res_match_path);
+  mu_run_test (test_res_crawl_delay);
+  mu_run_test (test_evloop_timers);
+  mu_run_test (test_visited_set);
+  mu_run_test (test_arena);
+  mu_run_test (test_html_name_hashes);
+  mu_run_test (test_get_urls_css);
+  mu_run_test (test_hash_table);
+  mu_run_test (test_cookie_header_cache);
+  mu_run_test (test_chunk_decode);
 
   return NULL;
 }
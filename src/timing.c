@@ -0,0 +1,332 @@
+/* Timing of the phases of transfers.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* With --phase-timing, each transfer records how long it spent
+   resolving the host, connecting, in the TLS handshake, waiting for
+   the response, and receiving the body.  The times are logged when
+   the transfer is finished and collected into histograms, which are
+   printed when Wget exits.
+
+   Only one transfer is timed at a time.  The phases are marked by
+   connect_to_host, gethttp and getftp, and the transfer is started
+   and finished around them by http_loop and ftp_loop_internal.  The
+   times of the last transfer are also kept for --stats-file.
+
+   The total time spent in the other work of a recursive retrieval,
+   parsing documents, queueing their links and converting them, is
+   kept as well, so that a crawl can be broken down.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "timing.h"
+#include "ptimer.h"
+
+static const char *phase_names[PHASE_COUNT] = {
+  "dns", "connect", "tls", "wait", "body"
+};
+
+static const char *task_names[TASK_COUNT] = {
+  "parse", "queue", "convert"
+};
+
+static struct ptimer *timer;
+
+/* The transfer being timed.  */
+static struct {
+  bool active;
+  double start[PHASE_COUNT];    /* when the phase began, or -1 */
+  struct xfer_timing t;
+} cur;
+
+/* The last finished transfer.  */
+static struct xfer_timing last;
+
+static struct timing_totals totals;
+
+static double
+timing_now (void)
+{
+  if (!timer)
+    timer = ptimer_new ();
+  return ptimer_measure (timer);
+}
+
+/* Start timing a transfer.  Does nothing without --phase-timing or
+   --stats-file.  */
+
+void
+timing_start_transfer (void)
+{
+  int i;
+
+  if (!opt.phase_timing && !opt.stats_file)
+    return;
+  for (i = 0; i < PHASE_COUNT; i++)
+    cur.start[i] = cur.t.phase[i] = -1;
+  cur.t.bytes = 0;
+  cur.t.reused = false;
+  cur.active = true;
+}
+
+/* Add SECS to the time spent in PHASE.  */
+
+static void
+timing_add (enum xfer_phase phase, double secs)
+{
+  if (cur.t.phase[phase] < 0)
+    cur.t.phase[phase] = 0;
+  cur.t.phase[phase] += secs;
+}
+
+/* Mark the beginning of PHASE of the current transfer.  */
+
+void
+timing_begin (enum xfer_phase phase)
+{
+  if (cur.active)
+    cur.start[phase] = timing_now ();
+}
+
+/* Mark the end of PHASE, which is added to the time spent in it.  */
+
+void
+timing_end (enum xfer_phase phase)
+{
+  if (!cur.active || cur.start[phase] < 0)
+    return;
+  timing_add (phase, timing_now () - cur.start[phase]);
+  cur.start[phase] = -1;
+}
+
+/* Note that BYTES of the body were received in SECS, as measured by
+   fd_read_body.  */
+
+void
+timing_body (double secs, wgint bytes)
+{
+  if (!cur.active)
+    return;
+  timing_add (PHASE_BODY, secs);
+  cur.t.bytes += bytes;
+}
+
+/* Note that the current transfer uses a connection that was already
+   open.  */
+
+void
+timing_set_reused (void)
+{
+  cur.t.reused = true;
+}
+
+static int
+timing_bucket (double secs)
+{
+  double ms = secs * 1000, limit = 2;
+  int b;
+
+  if (ms < 1)
+    return 0;
+  for (b = 1; ms >= limit && b < TIMING_BUCKETS - 1; b++)
+    limit *= 2;
+  return b;
+}
+
+static const char *
+timing_format (double secs, char *buf)
+{
+  if (secs < 1)
+    sprintf (buf, "%.1fms", secs * 1000);
+  else
+    sprintf (buf, "%.2fs", secs);
+  return buf;
+}
+
+/* Finish timing the transfer of URL: log its phases and add them to
+   the histograms.  Phases that were begun but never ended, such as a
+   connection that failed, end now.  */
+
+void
+timing_finish_transfer (const char *url)
+{
+  char line[PHASE_COUNT * 32], *p = line;
+  int i;
+
+  if (!cur.active)
+    return;
+  for (i = 0; i < PHASE_COUNT; i++)
+    timing_end (i);
+  last = cur.t;
+  cur.active = false;
+  if (!opt.phase_timing)
+    return;
+
+  *p = '\0';
+  for (i = 0; i < PHASE_COUNT; i++)
+    {
+      char buf[32];
+      double t = last.phase[i];
+
+      if (t < 0)
+        continue;
+      p += sprintf (p, " %s %s", phase_names[i], timing_format (t, buf));
+
+      totals.count[i][timing_bucket (t)]++;
+      totals.sum[i] += t;
+      if (t > totals.max[i])
+        totals.max[i] = t;
+    }
+  totals.transfers++;
+
+  logprintf (LOG_VERBOSE, _("Phase timing for %s:%s%s\n"), url, line,
+             last.reused ? _(" (reused connection)") : "");
+}
+
+/* Store the times of the last finished transfer in T.  */
+
+void
+timing_last (struct xfer_timing *t)
+{
+  *t = last;
+}
+
+/* Return the time at which a crawl task begins, to be passed to
+   timing_task_end, or -1 if nothing is being timed.  */
+
+double
+timing_task_begin (void)
+{
+  if (!opt.phase_timing && !opt.stats_file)
+    return -1;
+  return timing_now ();
+}
+
+/* Add the time since START, as returned by timing_task_begin, to the
+   time spent in TASK.  */
+
+void
+timing_task_end (enum crawl_task task, double start)
+{
+  if (start >= 0)
+    totals.task[task] += timing_now () - start;
+}
+
+/* Store the totals so far in T.  */
+
+void
+timing_get_totals (struct timing_totals *t)
+{
+  *t = totals;
+}
+
+/* Add to the totals those of T that came after BEFORE, which is
+   either NULL or an earlier copy of T.  This is how the transfers of
+   a parallel worker are added to the totals of the parent.  */
+
+void
+timing_add_totals (const struct timing_totals *t,
+                   const struct timing_totals *before)
+{
+  int i, b;
+
+  totals.transfers += t->transfers - (before ? before->transfers : 0);
+  for (i = 0; i < PHASE_COUNT; i++)
+    {
+      for (b = 0; b < TIMING_BUCKETS; b++)
+        totals.count[i][b] += t->count[i][b] - (before ? before->count[i][b] : 0);
+      totals.sum[i] += t->sum[i] - (before ? before->sum[i] : 0);
+      if (t->max[i] > totals.max[i])
+        totals.max[i] = t->max[i];
+    }
+  for (i = 0; i < TASK_COUNT; i++)
+    totals.task[i] += t->task[i] - (before ? before->task[i] : 0);
+}
+
+/* Print the histograms of the phases of all the transfers.  */
+
+void
+timing_print_summary (void)
+{
+  int i, b;
+
+  if (!totals.transfers)
+    return;
+
+  logprintf (LOG_NOTQUIET, _("Phase timing of %d transfers:\n"),
+             totals.transfers);
+  for (i = 0; i < PHASE_COUNT; i++)
+    {
+      int n = 0, most = 0;
+      char mean[32], max[32];
+
+      for (b = 0; b < TIMING_BUCKETS; b++)
+        {
+          n += totals.count[i][b];
+          if (totals.count[i][b] > most)
+            most = totals.count[i][b];
+        }
+      if (!n)
+        continue;
+
+      logprintf (LOG_NOTQUIET, _("  %s: %d, mean %s, max %s\n"),
+                 phase_names[i], n, timing_format (totals.sum[i] / n, mean),
+                 timing_format (totals.max[i], max));
+      for (b = 0; b < TIMING_BUCKETS; b++)
+        {
+          char range[32], bar[41];
+          int count = totals.count[i][b], len;
+
+          if (!count)
+            continue;
+          if (b == 0)
+            strcpy (range, "<1ms");
+          else if (b == TIMING_BUCKETS - 1)
+            sprintf (range, ">=%ldms", 1L << (b - 1));
+          else
+            sprintf (range, "%ld-%ldms", 1L << (b - 1), 1L << b);
+          len = (int) ((double) count * (sizeof (bar) - 1) / most);
+          if (len < 1)
+            len = 1;
+          memset (bar, '#', len);
+          bar[len] = '\0';
+          logprintf (LOG_NOTQUIET, "    %14s %7d %s\n", range, count, bar);
+        }
+    }
+  for (i = 0; i < TASK_COUNT; i++)
+    if (totals.task[i] > 0)
+      {
+        char total[32];
+        logprintf (LOG_NOTQUIET, _("  %s: total %s\n"), task_names[i],
+                   timing_format (totals.task[i], total));
+      }
+}
@@ -0,0 +1,92 @@
+/* Declarations for timing.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#ifndef TIMING_H
+#define TIMING_H
+
+/* The phases of a transfer that are timed for --phase-timing.  */
+enum xfer_phase {
+  PHASE_DNS,                    /* resolving the host name */
+  PHASE_CONNECT,                /* establishing the TCP connection */
+  PHASE_TLS,                    /* the TLS handshake */
+  PHASE_WAIT,                   /* from the request to the response */
+  PHASE_BODY,                   /* receiving the body */
+  PHASE_COUNT
+};
+
+/* The work of a recursive retrieval besides the transfers, whose
+   total times are also kept.  */
+enum crawl_task {
+  TASK_PARSE,                   /* finding the links in documents */
+  TASK_QUEUE,                   /* deciding which links to follow and
+                                   queueing them */
+  TASK_CONVERT,                 /* converting the links */
+  TASK_COUNT
+};
+
+/* The times of a transfer.  */
+struct xfer_timing {
+  double phase[PHASE_COUNT];    /* time spent in each phase, or -1 */
+  wgint bytes;                  /* bytes of the body received */
+  bool reused;                  /* an existing connection was used */
+};
+
+/* Number of buckets of the histograms.  Bucket 0 counts times below
+   one millisecond, bucket N times from 2^(N-1) to 2^N milliseconds,
+   and the last bucket everything longer.  */
+#define TIMING_BUCKETS 24
+
+/* The histograms of the finished transfers, which a parallel worker
+   reports to its parent.  */
+struct timing_totals {
+  int transfers;
+  int count[PHASE_COUNT][TIMING_BUCKETS];
+  double sum[PHASE_COUNT];
+  double max[PHASE_COUNT];
+  double task[TASK_COUNT];
+};
+
+void timing_start_transfer (void);
+void timing_begin (enum xfer_phase);
+void timing_end (enum xfer_phase);
+void timing_body (double, wgint);
+void timing_set_reused (void);
+void timing_finish_transfer (const char *);
+void timing_last (struct xfer_timing *);
+
+double timing_task_begin (void);
+void timing_task_end (enum crawl_task, double);
+
+void timing_get_totals (struct timing_totals *);
+void timing_add_totals (const struct timing_totals *,
+                        const struct timing_totals *);
+void timing_print_summary (void);
+
+#endif /* TIMING_H */
@@ -0,0 +1,320 @@
+/* Asynchronous file output with io_uring.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#include "wget.h"
+
+#ifdef HAVE_LIBURING
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <liburing.h>
+
+#include "utils.h"
+#include "uring.h"
+
+/* The downloaded data is copied into one of URING_SLOTS buffers of
+   URING_SLOT_SIZE bytes, from which it is written to the file in the
+   background while fd_read_body goes back to reading the socket.  It
+   only waits for the disk when all the buffers are in flight.  */
+#define URING_SLOTS 8
+#define URING_SLOT_SIZE (256 * 1024)
+
+/* The alignment O_DIRECT asks of buffers, offsets and lengths.  */
+#define DIRECT_ALIGN 4096
+
+struct uring_out {
+  struct io_uring ring;
+  int fd;
+  wgint offset;                 /* file offset of the next write */
+  bool direct;                  /* whether FD is in O_DIRECT mode */
+  bool fixed;                   /* whether the slots are registered */
+
+  char *mem;                    /* the allocation holding the slots */
+  char *slots;                  /* MEM aligned to DIRECT_ALIGN */
+  int fill[URING_SLOTS];        /* bytes of data in each slot */
+  wgint pos[URING_SLOTS];       /* file offset each slot is written to */
+  bool busy[URING_SLOTS];       /* whether the slot is being written */
+  int current;                  /* slot being filled, or -1 */
+  int inflight;                 /* number of busy slots */
+
+  int error;                    /* errno of the first failed write */
+};
+
+#ifndef MIN
+# define MIN(i, j) ((i) <= (j) ? (i) : (j))
+#endif
+
+#define SLOT(uo, i) ((uo)->slots + (size_t) (i) * URING_SLOT_SIZE)
+
+/* Set up asynchronous writes to FD, starting at file offset OFFSET.
+   If DIRECT is true, bypass the page cache with O_DIRECT, which is
+   only possible if OFFSET is suitably aligned.  Return NULL if
+   io_uring is not available, in which case the caller should write
+   the data as usual.  */
+
+struct uring_out *
+uring_out_new (int fd, wgint offset, bool direct)
+{
+  struct uring_out *uo = xnew0 (struct uring_out);
+  struct iovec iov[URING_SLOTS];
+  int i;
+
+  if (io_uring_queue_init (URING_SLOTS, &uo->ring, 0) < 0)
+    {
+      xfree (uo);
+      return NULL;
+    }
+  uo->fd = fd;
+  uo->offset = offset;
+  uo->current = -1;
+  uo->mem = xmalloc (URING_SLOTS * URING_SLOT_SIZE + DIRECT_ALIGN);
+  uo->slots = (char *) (((uintptr_t) uo->mem + DIRECT_ALIGN - 1)
+                        & ~(uintptr_t) (DIRECT_ALIGN - 1));
+
+  /* Registering the buffers spares the kernel mapping them for every
+     write.  It can fail for lack of locked memory, in which case the
+     writes simply use the buffers unregistered.  */
+  for (i = 0; i < URING_SLOTS; i++)
+    {
+      iov[i].iov_base = SLOT (uo, i);
+      iov[i].iov_len = URING_SLOT_SIZE;
+    }
+  uo->fixed = io_uring_register_buffers (&uo->ring, iov, URING_SLOTS) == 0;
+
+  if (direct && offset % DIRECT_ALIGN == 0)
+    {
+      int flags = fcntl (fd, F_GETFL);
+      if (flags >= 0 && fcntl (fd, F_SETFL, flags | O_DIRECT) == 0)
+        uo->direct = true;
+    }
+  DEBUGP (("Writing through io_uring%s%s.\n",
+           uo->fixed ? " with registered buffers" : "",
+           uo->direct ? ", O_DIRECT" : ""));
+  return uo;
+}
+
+/* Take note of the completion CQE.  */
+
+static void
+uring_out_complete (struct uring_out *uo, struct io_uring_cqe *cqe)
+{
+  int i = (int) (uintptr_t) io_uring_cqe_get_data (cqe);
+  int res = cqe->res;
+
+  io_uring_cqe_seen (&uo->ring, cqe);
+  if (res >= 0 && res < uo->fill[i])
+    {
+      /* A short write.  Write the rest synchronously rather than
+         resubmitting it.  */
+      ssize_t n = pwrite (uo->fd, SLOT (uo, i) + res, uo->fill[i] - res,
+                          uo->pos[i] + res);
+      if (n < 0)
+        res = -errno;
+      else if (n < uo->fill[i] - res)
+        res = -ENOSPC;
+    }
+  if (res < 0 && !uo->error)
+    uo->error = -res;
+  uo->busy[i] = false;
+  uo->fill[i] = 0;
+  uo->inflight--;
+}
+
+/* Reap the finished writes.  If WAIT is true, wait for at least one
+   if none has finished yet.  */
+
+static void
+uring_out_reap (struct uring_out *uo, bool wait)
+{
+  struct io_uring_cqe *cqe;
+
+  if (wait && uo->inflight)
+    {
+      int err;
+      while ((err = io_uring_wait_cqe (&uo->ring, &cqe)) == -EINTR)
+        ;
+      if (err < 0)
+        {
+          /* This should not happen; give up on the ring.  */
+          if (!uo->error)
+            uo->error = -err;
+          return;
+        }
+      uring_out_complete (uo, cqe);
+    }
+  while (uo->inflight && io_uring_peek_cqe (&uo->ring, &cqe) == 0)
+    uring_out_complete (uo, cqe);
+}
+
+/* Queue the current slot for writing.  */
+
+static void
+uring_out_submit (struct uring_out *uo)
+{
+  int i = uo->current;
+  struct io_uring_sqe *sqe = io_uring_get_sqe (&uo->ring);
+
+  /* There are as many submission entries as slots, so one is always
+     free.  */
+  assert (sqe != NULL);
+  if (uo->fixed)
+    io_uring_prep_write_fixed (sqe, uo->fd, SLOT (uo, i), uo->fill[i],
+                               uo->offset, i);
+  else
+    io_uring_prep_write (sqe, uo->fd, SLOT (uo, i), uo->fill[i], uo->offset);
+  io_uring_sqe_set_data (sqe, (void *) (uintptr_t) i);
+  io_uring_submit (&uo->ring);
+
+  uo->pos[i] = uo->offset;
+  uo->offset += uo->fill[i];
+  uo->busy[i] = true;
+  uo->inflight++;
+  uo->current = -1;
+}
+
+/* Write the SIZE bytes of BUF to the file.  The data is copied, so
+   BUF can be reused as soon as this returns.  Returns false if a
+   previous write has failed, with errno set.  */
+
+bool
+uring_out_write (struct uring_out *uo, const char *buf, int size)
+{
+  while (size > 0 && !uo->error)
+    {
+      int chunk;
+
+      if (uo->current < 0)
+        {
+          int i;
+          uring_out_reap (uo, uo->inflight == URING_SLOTS);
+          for (i = 0; i < URING_SLOTS && uo->busy[i]; i++)
+            ;
+          if (i == URING_SLOTS)
+            break;              /* the wait failed */
+          uo->current = i;
+        }
+
+      chunk = MIN (size, URING_SLOT_SIZE - uo->fill[uo->current]);
+      memcpy (SLOT (uo, uo->current) + uo->fill[uo->current], buf, chunk);
+      uo->fill[uo->current] += chunk;
+      buf += chunk;
+      size -= chunk;
+
+      /* With O_DIRECT, only whole slots can be written.  Otherwise
+         hand the data to the kernel at once, as fwrite and fflush
+         would have.  */
+      if (!uo->direct || uo->fill[uo->current] == URING_SLOT_SIZE)
+        uring_out_submit (uo);
+    }
+  if (uo->error)
+    {
+      errno = uo->error;
+      return false;
+    }
+  return true;
+}
+
+/* Wait for all the writes in flight to finish, successfully or
+   not.  */
+
+static void
+uring_out_drain (struct uring_out *uo)
+{
+  while (uo->inflight)
+    {
+      int pending = uo->inflight;
+      uring_out_reap (uo, true);
+      if (uo->inflight == pending)
+        break;                  /* the wait failed */
+    }
+}
+
+/* Wait for all the writes to finish and free UO.  Store the file
+   offset past the data written to *END.  Returns false if any write
+   failed, with errno set.  */
+
+bool
+uring_out_finish (struct uring_out *uo, wgint *end)
+{
+  int error;
+
+  if (uo->current >= 0 && uo->fill[uo->current])
+    {
+      if (uo->direct)
+        {
+          /* The tail is not a whole number of aligned blocks; leave
+             O_DIRECT and write it through the page cache.  */
+          int i = uo->current;
+          int flags = fcntl (uo->fd, F_GETFL);
+          uring_out_drain (uo);
+          if (flags >= 0)
+            fcntl (uo->fd, F_SETFL, flags & ~O_DIRECT);
+          uo->direct = false;
+          if (!uo->error)
+            {
+              ssize_t n = pwrite (uo->fd, SLOT (uo, i), uo->fill[i],
+                                  uo->offset);
+              if (n < 0)
+                uo->error = errno;
+              else if (n < uo->fill[i])
+                uo->error = ENOSPC;
+              else
+                uo->offset += n;
+            }
+        }
+      else
+        uring_out_submit (uo);
+    }
+  uring_out_drain (uo);
+  if (uo->direct)
+    {
+      int flags = fcntl (uo->fd, F_GETFL);
+      if (flags >= 0)
+        fcntl (uo->fd, F_SETFL, flags & ~O_DIRECT);
+    }
+
+  *end = uo->offset;
+  error = uo->error;
+  io_uring_queue_exit (&uo->ring);
+  xfree (uo->mem);
+  xfree (uo);
+  if (error)
+    {
+      errno = error;
+      return false;
+    }
+  return true;
+}
+
+#endif /* HAVE_LIBURING */
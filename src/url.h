@@ -89,6 +89,11 @@ struct url
   /* Username and password (unquoted). */
   char *user;
   char *passwd;
+
+  /* Private: end of the strings allocated together with the structure
+     by the canonical-URL fast path, NULL if each is allocated
+     separately.  */
+  char *block_end;
 };
 
 /* Function declarations */
@@ -62,6 +62,9 @@ as that of the covered work.  */
 #include <sys/time.h>
 
 #include <sys/stat.h>
+#ifdef UNIQ_SEP
+# include <dirent.h>
+#endif
 
 /* For TIOCGWINSZ and friends: */
 #include <sys/ioctl.h>
@@ -91,6 +94,7 @@ as that of the covered work.  */
 
 #include "utils.h"
 #include "hash.h"
+#include "acclist.h"
 
 #ifdef __VMS
 #include "vms.h"
@@ -466,6 +470,8 @@ fork_to_background (void)
           fclose (new_log_fp);
         }
     }
+  /* Don't let the child repeat the buffered output.  */
+  logflush ();
   pid = fork ();
   if (pid < 0)
     {
@@ -620,23 +626,86 @@ file_size (const char *filename)
 
 #ifdef UNIQ_SEP
 
+/* The next suffix to try for each prefix passed to unique_name_1.
+   Without it, saving the Nth copy of "index.html" into a directory
+   would stat N-1 names first.  */
+static struct hash_table *unique_counters;
+
+/* Return one past the largest N for which PREFIX.N exists, scanning
+   the directory of PREFIX once rather than probing names one by
+   one.  */
+
+static int
+unique_counter_seed (const char *prefix)
+{
+  const char *base = strrchr (prefix, '/');
+  char *dirname;
+  DIR *dir;
+  struct dirent *dent;
+  int blen, max = 0;
+
+  if (base)
+    {
+      dirname = base == prefix ? xstrdup ("/") : strdupdelim (prefix, base);
+      ++base;
+    }
+  else
+    {
+      dirname = xstrdup (".");
+      base = prefix;
+    }
+  blen = strlen (base);
+
+  dir = opendir (dirname);
+  xfree (dirname);
+  if (!dir)
+    return 1;
+  while ((dent = readdir (dir)) != NULL)
+    {
+      const char *p = dent->d_name + blen;
+      int n = 0, digits = 0;
+      if (strncmp (dent->d_name, base, blen) != 0 || *p != UNIQ_SEP)
+        continue;
+      for (++p; c_isdigit (*p) && digits < 9; p++, digits++)
+        n = 10 * n + (*p - '0');
+      if (digits && !*p && n > max)
+        max = n;
+    }
+  closedir (dir);
+  return max + 1;
+}
+
 /* stat file names named PREFIX.1, PREFIX.2, etc., until one that
    doesn't exist is found.  Return a freshly allocated copy of the
-   unused file name.  */
+   unused file name.
+
+   The search for PREFIX starts from where the last one left off (or
+   past the existing names found by unique_counter_seed), so that a
+   name is normally found with a single stat.  */
 
 static char *
 unique_name_1 (const char *prefix)
 {
-  int count = 1;
+  int *count;
   int plen = strlen (prefix);
   char *template = (char *)alloca (plen + 1 + 24);
   char *template_tail = template + plen;
 
+  if (!unique_counters)
+    unique_counters = make_string_hash_table (0);
+  count = hash_table_get (unique_counters, prefix);
+  if (!count)
+    {
+      count = xnew (int);
+      *count = unique_counter_seed (prefix);
+      hash_table_put (unique_counters, xstrdup (prefix), count);
+    }
+
   memcpy (template, prefix, plen);
   *template_tail++ = UNIQ_SEP;
 
   do
-    number_to_string (template_tail, count++);
+    number_to_string (template_tail, (*count)++);
   while (file_exists_p (template));
 
   return xstrdup (template);
@@ -687,6 +756,26 @@ unique_name (const char *file, bool allow_passthrough)
 
 #endif /* def UNIQ_SEP [else] */
 
+/* Free the suffix counters kept by unique_name.  */
+void
+unique_name_cleanup (void)
+{
+#ifdef UNIQ_SEP
+  if (unique_counters)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (unique_counters, &iter);
+           hash_table_iter_next (&iter); )
+        {
+          xfree (iter.key);
+          xfree (iter.value);
+        }
+      hash_table_destroy (unique_counters);
+      unique_counters = NULL;
+    }
+#endif
+}
+
 /* Create a file based on NAME, except without overwriting an existing
    file with that name.  Providing O_EXCL is correctly implemented,
    this function does not have the race condition associated with
@@ -803,10 +892,48 @@ fopen_excl (const char *fname, int binary)
 #endif /* not O_EXCL */
 }
 
+/* Directories known to exist, either because we created them or
+   because stat() found them.  A recursive download saves most files
+   into directories it has already seen, and this spares it a stat()
+   or mkdir() per path component per file.  Only positive results are
+   kept, so a directory removed behind Wget's back merely makes the
+   subsequent open() fail as it would have anyway.  */
+static struct hash_table *known_dirs;
+
+/* Return true if DIRECTORY is known to exist.  */
+bool
+directory_known_p (const char *directory)
+{
+  return known_dirs && hash_table_contains (known_dirs, directory);
+}
+
+/* Record DIRECTORY as existing.  */
+void
+directory_remember (const char *directory)
+{
+  if (!known_dirs)
+    known_dirs = make_string_hash_table (0);
+  string_set_add (known_dirs, directory);
+}
+
+/* Free the cache of known directories.  */
+void
+directory_cache_cleanup (void)
+{
+  if (known_dirs)
+    {
+      string_set_free (known_dirs);
+      known_dirs = NULL;
+    }
+}
+
 /* Create DIRECTORY.  If some of the pathname components of DIRECTORY
    are missing, create them first.  In case any mkdir() call fails,
    return its error status.  Returns 0 on successful completion.
 
+   Components already in the cache of known directories are skipped
+   without a system call.
+
    The behaviour of this function should be identical to the behaviour
    of `mkdir -p' on systems where mkdir supports the `-p' option.  */
 int
@@ -814,6 +941,10 @@ make_directory (const char *directory)
 {
   int i, ret, quit = 0;
   char *dir;
+  struct_stat st;
+
+  if (directory_known_p (directory))
+    return 0;
 
   /* Make a copy of dir, to be able to write to it.  Otherwise, the
      function is unsafe if called with a read-only char *argument.  */
@@ -831,10 +962,20 @@ make_directory (const char *directory)
       /* Check whether the directory already exists.  Allow creation of
          of intermediate directories to fail, as the initial path components
          are not necessarily directories!  */
-      if (!file_exists_p (dir))
-        ret = mkdir (dir, 0777);
-      else
+      if (directory_known_p (dir))
         ret = 0;
+      else if (stat (dir, &st) == 0)
+        {
+          ret = 0;
+          if (S_ISDIR (st.st_mode))
+            directory_remember (dir);
+        }
+      else
+        {
+          ret = mkdir (dir, 0777);
+          if (ret == 0)
+            directory_remember (dir);
+        }
       if (quit)
         break;
       else
@@ -894,6 +1035,58 @@ fnmatch_nocase (const char *pattern, const char *string, int flags)
 }
 
 static bool in_acclist (const char *const *, const char *, bool);
+static bool dir_matches_p (char **, const char *);
+
+/* The -A, -R, -I and -X lists, compiled by compile_acclists.  */
+static struct acclist *accepts_compiled, *rejects_compiled;
+static struct acclist *includes_compiled, *excludes_compiled;
+
+/* Compile the -A, -R, -I and -X lists, which are otherwise matched one
+   pattern at a time.  Called once the options are known.  */
+
+void
+compile_acclists (void)
+{
+  if (opt.accepts)
+    accepts_compiled = acclist_new (opt.accepts, false);
+  if (opt.rejects)
+    rejects_compiled = acclist_new (opt.rejects, false);
+  if (opt.includes)
+    includes_compiled = acclist_new (opt.includes, true);
+  if (opt.excludes)
+    excludes_compiled = acclist_new (opt.excludes, true);
+}
+
+void
+free_acclists (void)
+{
+  struct acclist **lists[] = {
+    &accepts_compiled, &rejects_compiled, &includes_compiled, &excludes_compiled
+  };
+  int i;
+
+  for (i = 0; i < countof (lists); i++)
+    if (*lists[i])
+      {
+        acclist_free (*lists[i]);
+        *lists[i] = NULL;
+      }
+}
+
+/* Return whether S matches LIST, using its compiled form COMPILED if
+   there is one.  DIRS tells whether LIST is -I/-X rather than
+   -A/-R.  */
+
+static bool
+list_match_p (char **list, const struct acclist *compiled, const char *s,
+              bool dirs)
+{
+  if (compiled)
+    return acclist_match (compiled, s);
+  if (dirs)
+    return dir_matches_p (list, s);
+  return in_acclist ((const char *const *) list, s, true);
+}
 
 /* Determine whether a file is acceptable to be followed, according to
    lists of patterns to accept/reject.  */
@@ -912,13 +1105,13 @@ acceptable (const char *s)
   if (opt.accepts)
     {
       if (opt.rejects)
-        return (in_acclist ((const char *const *)opt.accepts, s, true)
-                && !in_acclist ((const char *const *)opt.rejects, s, true));
+        return (list_match_p (opt.accepts, accepts_compiled, s, false)
+                && !list_match_p (opt.rejects, rejects_compiled, s, false));
       else
-        return in_acclist ((const char *const *)opt.accepts, s, true);
+        return list_match_p (opt.accepts, accepts_compiled, s, false);
     }
   else if (opt.rejects)
-    return !in_acclist ((const char *const *)opt.rejects, s, true);
+    return !list_match_p (opt.rejects, rejects_compiled, s, false);
   return true;
 }
 
@@ -996,12 +1189,12 @@ accdir (const char *directory)
     ++directory;
   if (opt.includes)
     {
-      if (!dir_matches_p (opt.includes, directory))
+      if (!list_match_p (opt.includes, includes_compiled, directory, true))
         return false;
     }
   if (opt.excludes)
     {
-      if (dir_matches_p (opt.excludes, directory))
+      if (list_match_p (opt.excludes, excludes_compiled, directory, true))
         return false;
     }
   return true;
@@ -2328,19 +2521,38 @@ base64_decode (const char *base64, void *dest)
 }
 
 #ifdef HAVE_LIBPCRE
+/* A compiled PCRE regex, with what pcre_study learned about it.  */
+struct pcre_regex {
+  pcre *code;
+  pcre_extra *extra;            /* or NULL */
+};
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+# define PCRE_STUDY_FLAGS PCRE_STUDY_JIT_COMPILE
+#else
+# define PCRE_STUDY_FLAGS 0
+#endif
+
 /* Compiles the PCRE regex. */
 void *
 compile_pcre_regex (const char *str)
 {
   const char *errbuf;
   int erroffset;
-  pcre *regex = pcre_compile (str, 0, &errbuf, &erroffset, 0);
-  if (! regex)
+  struct pcre_regex *regex;
+  pcre *code = pcre_compile (str, 0, &errbuf, &erroffset, 0);
+  if (! code)
     {
       fprintf (stderr, _("Invalid regular expression %s, %s\n"),
                quote (str), errbuf);
       return false;
     }
+
+  /* The regex is matched against every URL found, so it is worth
+     studying it, and compiling it to machine code where PCRE can.  */
+  regex = xnew (struct pcre_regex);
+  regex->code = code;
+  regex->extra = pcre_study (code, PCRE_STUDY_FLAGS, &errbuf);
   return regex;
 }
 #endif
@@ -2371,10 +2583,11 @@ compile_posix_regex (const char *str)
 bool
 match_pcre_regex (const void *regex, const char *str)
 {
+  const struct pcre_regex *re = regex;
   int l = strlen (str);
   int ovector[OVECCOUNT];
 
-  int rc = pcre_exec ((pcre *) regex, 0, str, l, 0, 0, ovector, OVECCOUNT);
+  int rc = pcre_exec (re->code, re->extra, str, l, 0, 0, ovector, OVECCOUNT);
   if (rc == PCRE_ERROR_NOMATCH)
     return false;
   else if (rc < 0)
@@ -83,7 +83,11 @@ bool file_exists_p (const char *);
 bool file_non_directory_p (const char *);
 wgint file_size (const char *);
 int make_directory (const char *);
+bool directory_known_p (const char *);
+void directory_remember (const char *);
+void directory_cache_cleanup (void);
 char *unique_name (const char *, bool);
+void unique_name_cleanup (void);
 FILE *unique_create (const char *, bool, char **);
 FILE *fopen_excl (const char *, int);
 char *file_merge (const char *, const char *);
@@ -92,6 +96,8 @@ int fnmatch_nocase (const char *, const char *, int);
 bool acceptable (const char *);
 bool accept_url (const char *);
 bool accdir (const char *s);
+void compile_acclists (void);
+void free_acclists (void);
 char *suffix (const char *s);
 bool match_tail (const char *, const char *, bool);
 bool has_wildcards_p (const char *);
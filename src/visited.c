@@ -0,0 +1,557 @@
+/* Sets of visited URLs.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* Recursive retrieval remembers every URL it has enqueued or
+   rejected, so that no URL is considered twice.  Keeping the URLs
+   themselves costs a hundred bytes or more per URL, which adds up to
+   gigabytes on crawls of millions of URLs.  Two compact
+   representations are offered instead:
+
+   - "compact" keeps a 64-bit fingerprint of each URL in an open
+     addressing table, about 8 to 16 bytes per URL.  Two different
+     URLs can share a fingerprint, but with 64 bits this is not
+     expected to happen in any crawl of realistic size.
+
+   - "bloom" keeps a scalable Bloom filter, about 2 to 4 bytes per
+     URL.  It thinks roughly one URL in five hundred has been seen
+     before when it hasn't, so that URL is skipped.
+
+   The default, "exact", keeps the URLs in a string set.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
+#include "utils.h"
+#include "hash.h"
+#include "visited.h"
+#include "state.h"
+#include "intern.h"
+
+#ifdef TESTING
+#include "test.h"
+#endif
+
+/* Size of the first stage of a Bloom filter, in elements.  Each
+   following stage holds twice as many.  */
+#define BLOOM_FIRST_CAPACITY (1 << 16)
+
+/* The first stage uses this many hash functions, for a false
+   positive rate of 2^-BLOOM_FIRST_HASHES; each following stage uses
+   one more, halving its rate, so that the rate of the whole filter
+   stays below twice that of the first stage.  */
+#define BLOOM_FIRST_HASHES 10
+
+struct bloom_stage {
+  unsigned char *bits;
+  uint64_t nbits;
+  int nhashes;
+  int count;			/* elements added to this stage */
+  int capacity;			/* elements it is sized for */
+};
+
+struct visited_set {
+  int kind;			/* opt.visited_set at creation */
+  int count;			/* number of distinct URLs added */
+
+  /* visited_exact */
+  struct hash_table *strings;
+
+  /* visited_compact: fingerprints, 0 meaning an empty slot */
+  uint64_t *slots;
+  uint64_t mask;		/* table size minus one */
+
+  /* visited_bloom */
+  struct bloom_stage *stages;
+  int nstages;
+};
+
+/* Return the 64-bit fingerprint of S: FNV-1a followed by the MurmurHash3
+   finalizer, which spreads FNV's weak high bits.  Never returns 0.  */
+
+uint64_t
+url_fingerprint (const char *s)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (; *s; s++)
+    {
+      h ^= (unsigned char) *s;
+      h *= 0x100000001b3ULL;
+    }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h ? h : 1;
+}
+
+/* Fingerprint table.  Linear probing; the table is doubled when it
+   is three quarters full.  */
+
+static bool
+fp_insert (struct visited_set *vs, uint64_t fp)
+{
+  uint64_t i = fp & vs->mask;
+  while (vs->slots[i])
+    {
+      if (vs->slots[i] == fp)
+        return false;
+      i = (i + 1) & vs->mask;
+    }
+  vs->slots[i] = fp;
+  return true;
+}
+
+static void
+fp_grow (struct visited_set *vs)
+{
+  uint64_t *old = vs->slots;
+  uint64_t oldsize = vs->mask + 1, i;
+
+  vs->mask = oldsize * 2 - 1;
+  vs->slots = xnew0_array (uint64_t, oldsize * 2);
+  for (i = 0; i < oldsize; i++)
+    if (old[i])
+      fp_insert (vs, old[i]);
+  xfree (old);
+}
+
+static bool
+fp_contains (const struct visited_set *vs, uint64_t fp)
+{
+  uint64_t i = fp & vs->mask;
+  while (vs->slots[i])
+    {
+      if (vs->slots[i] == fp)
+        return true;
+      i = (i + 1) & vs->mask;
+    }
+  return false;
+}
+
+/* Bloom filter.  The bit positions of an element are derived from
+   two hashes with the double hashing scheme of Kirsch and
+   Mitzenmacher.  A full stage is kept and a stage twice its size is
+   added after it.  */
+
+static void
+bloom_add_stage (struct visited_set *vs)
+{
+  struct bloom_stage *st;
+  int n = vs->nstages;
+
+  vs->stages = xrealloc (vs->stages, (n + 1) * sizeof *vs->stages);
+  st = &vs->stages[n];
+  st->capacity = BLOOM_FIRST_CAPACITY << n;
+  st->nhashes = BLOOM_FIRST_HASHES + n;
+  /* The optimal size is capacity * nhashes / ln 2 bits.  */
+  st->nbits = (uint64_t) st->capacity * st->nhashes * 1443 / 1000;
+  st->bits = xnew0_array (unsigned char, (st->nbits + 7) / 8);
+  st->count = 0;
+  ++vs->nstages;
+}
+
+#define BLOOM_POSITION(st, h1, h2, j) (((h1) + (j) * (h2)) % (st)->nbits)
+
+static bool
+bloom_stage_contains (const struct bloom_stage *st, uint64_t h1, uint64_t h2)
+{
+  int j;
+  for (j = 0; j < st->nhashes; j++)
+    {
+      uint64_t bit = BLOOM_POSITION (st, h1, h2, j);
+      if (!(st->bits[bit >> 3] & (1 << (bit & 7))))
+        return false;
+    }
+  return true;
+}
+
+static void
+bloom_stage_add (struct bloom_stage *st, uint64_t h1, uint64_t h2)
+{
+  int j;
+  for (j = 0; j < st->nhashes; j++)
+    {
+      uint64_t bit = BLOOM_POSITION (st, h1, h2, j);
+      st->bits[bit >> 3] |= 1 << (bit & 7);
+    }
+  ++st->count;
+}
+
+static bool
+bloom_contains (const struct visited_set *vs, uint64_t h1, uint64_t h2)
+{
+  int i;
+  for (i = 0; i < vs->nstages; i++)
+    if (bloom_stage_contains (&vs->stages[i], h1, h2))
+      return true;
+  return false;
+}
+
+/* The second hash of the double hashing scheme, derived from the
+   fingerprint.  It is made odd so that it is never zero.  */
+
+static uint64_t
+second_hash (uint64_t fp)
+{
+  fp = (fp ^ (fp >> 31)) * 0x9e3779b97f4a7c15ULL;
+  return (fp ^ (fp >> 29)) | 1;
+}
+
+/* Create an empty set of the kind selected by opt.visited_set.  */
+
+struct visited_set *
+visited_set_new (void)
+{
+  struct visited_set *vs = xnew0 (struct visited_set);
+  vs->kind = opt.visited_set;
+  switch (vs->kind)
+    {
+    case visited_exact:
+      vs->strings = make_string_hash_table (0);
+      break;
+    case visited_compact:
+      vs->mask = 1024 - 1;
+      vs->slots = xnew0_array (uint64_t, vs->mask + 1);
+      break;
+    case visited_bloom:
+      bloom_add_stage (vs);
+      break;
+    default:
+      abort ();
+    }
+  return vs;
+}
+
+/* Add URL to VS.  Return true if it wasn't there already.  */
+
+bool
+visited_set_add (struct visited_set *vs, const char *url)
+{
+  uint64_t fp;
+
+  switch (vs->kind)
+    {
+    case visited_exact:
+      if (string_set_contains (vs->strings, url))
+        return false;
+      /* Most of the URLs end up in the maps of convert.c as well.  */
+      hash_table_put (vs->strings, intern_string (url), "1");
+      break;
+    case visited_compact:
+      if ((uint64_t) vs->count + 1 > (vs->mask + 1) / 4 * 3)
+        fp_grow (vs);
+      if (!fp_insert (vs, url_fingerprint (url)))
+        return false;
+      break;
+    case visited_bloom:
+      {
+        struct bloom_stage *last;
+        uint64_t h2;
+        fp = url_fingerprint (url);
+        h2 = second_hash (fp);
+        if (bloom_contains (vs, fp, h2))
+          return false;
+        last = &vs->stages[vs->nstages - 1];
+        if (last->count >= last->capacity)
+          {
+            bloom_add_stage (vs);
+            last = &vs->stages[vs->nstages - 1];
+          }
+        bloom_stage_add (last, fp, h2);
+      }
+      break;
+    }
+  ++vs->count;
+  return true;
+}
+
+/* Return true if URL has been added to VS.  A compact or Bloom set
+   can also return true for a URL that hasn't been added.  */
+
+bool
+visited_set_contains (const struct visited_set *vs, const char *url)
+{
+  uint64_t fp;
+
+  switch (vs->kind)
+    {
+    case visited_exact:
+      return string_set_contains (vs->strings, url);
+    case visited_compact:
+      return fp_contains (vs, url_fingerprint (url));
+    case visited_bloom:
+      fp = url_fingerprint (url);
+      return bloom_contains (vs, fp, second_hash (fp));
+    }
+  return false;
+}
+
+/* Return the number of distinct URLs added to VS.  */
+
+int
+visited_set_count (const struct visited_set *vs)
+{
+  return vs->count;
+}
+
+/* Return the number of bytes taken by VS.  The URLs of an exact set
+   are interned, and counted with the interned strings.  */
+
+size_t
+visited_set_memory (const struct visited_set *vs)
+{
+  size_t size = sizeof *vs;
+  int i;
+
+  if (vs->strings)
+    size += hash_table_memory (vs->strings);
+  if (vs->slots)
+    size += (vs->mask + 1) * sizeof (uint64_t);
+  for (i = 0; i < vs->nstages; i++)
+    size += sizeof (struct bloom_stage) + (vs->stages[i].nbits + 7) / 8;
+  return size;
+}
+
+/* Switch VS from the exact representation to the compact one, so
+   that the URLs added from now on take 8 to 16 bytes each.  The URLs
+   added so far are interned, and stay in memory anyway.  */
+
+void
+visited_set_compact (struct visited_set *vs)
+{
+  hash_table_iterator iter;
+
+  if (vs->kind != visited_exact)
+    return;
+  DEBUGP (("Compacting the set of %d visited URLs.\n", vs->count));
+  vs->mask = 1024 - 1;
+  while ((uint64_t) vs->count + 1 > (vs->mask + 1) / 4 * 3)
+    vs->mask = vs->mask * 2 + 1;
+  vs->slots = xnew0_array (uint64_t, vs->mask + 1);
+  for (hash_table_iterate (vs->strings, &iter); hash_table_iter_next (&iter); )
+    fp_insert (vs, url_fingerprint (iter.key));
+  hash_table_destroy (vs->strings);
+  vs->strings = NULL;
+  vs->kind = visited_compact;
+}
+
+void
+visited_set_free (struct visited_set *vs)
+{
+  int i;
+
+  DEBUGP (("Visited set held %d URLs.\n", vs->count));
+  if (vs->strings)
+    hash_table_destroy (vs->strings);
+  xfree_null (vs->slots);
+  for (i = 0; i < vs->nstages; i++)
+    xfree (vs->stages[i].bits);
+  xfree_null (vs->stages);
+  xfree (vs);
+}
+
+/* Write VS to the state file STREAM.  */
+
+void
+visited_set_save (FILE *stream, const struct visited_set *vs)
+{
+  int i;
+
+  state_put_number (stream, vs->kind);
+  state_put_number (stream, vs->count);
+  switch (vs->kind)
+    {
+    case visited_exact:
+      state_put_string_table (stream, vs->strings, false);
+      break;
+    case visited_compact:
+      {
+        uint64_t j;
+        for (j = 0; j <= vs->mask; j++)
+          if (vs->slots[j])
+            {
+              state_put_number (stream, vs->slots[j] >> 32);
+              state_put_number (stream, vs->slots[j] & 0xffffffffU);
+            }
+      }
+      break;
+    case visited_bloom:
+      state_put_number (stream, vs->nstages);
+      for (i = 0; i < vs->nstages; i++)
+        {
+          const struct bloom_stage *st = &vs->stages[i];
+          state_put_number (stream, st->count);
+          state_put_bytes (stream, st->bits, (st->nbits + 7) / 8);
+        }
+      break;
+    }
+}
+
+/* Read a set written by visited_set_save from STREAM.  Return NULL if it
+   can't be read.  */
+
+struct visited_set *
+visited_set_load (FILE *stream)
+{
+  struct visited_set *vs;
+  wgint kind, count, n;
+  int i;
+
+  if (!state_get_number (stream, &kind) || !state_get_number (stream, &count)
+      || kind > visited_bloom)
+    return NULL;
+
+  vs = xnew0 (struct visited_set);
+  vs->kind = kind;
+  switch (vs->kind)
+    {
+    case visited_exact:
+      if (!state_get_interned_table (stream, &vs->strings, false))
+        goto fail;
+      if (!vs->strings)
+        vs->strings = make_string_hash_table (0);
+      vs->count = hash_table_count (vs->strings);
+      break;
+    case visited_compact:
+      vs->mask = 1024 - 1;
+      while ((uint64_t) count > (vs->mask + 1) / 4 * 3)
+        vs->mask = vs->mask * 2 + 1;
+      vs->slots = xnew0_array (uint64_t, vs->mask + 1);
+      for (; vs->count < count; vs->count++)
+        {
+          wgint hi, lo;
+          uint64_t fp;
+          if (!state_get_number (stream, &hi) || !state_get_number (stream, &lo))
+            goto fail;
+          fp = (uint64_t) hi << 32 | (uint64_t) lo;
+          if (!fp)
+            goto fail;
+          fp_insert (vs, fp);
+        }
+      break;
+    case visited_bloom:
+      if (!state_get_number (stream, &n) || n < 1 || n > 32)
+        goto fail;
+      for (i = 0; i < n; i++)
+        {
+          wgint stage_count;
+          struct bloom_stage *st;
+          bloom_add_stage (vs);
+          st = &vs->stages[i];
+          if (!state_get_number (stream, &stage_count)
+              || !state_get_bytes (stream, st->bits, (st->nbits + 7) / 8))
+            goto fail;
+          st->count = stage_count;
+        }
+      vs->count = count;
+      break;
+    }
+  return vs;
+
+ fail:
+  visited_set_free (vs);
+  return NULL;
+}
+
+#ifdef TESTING
+
+const char *
+test_visited_set (void)
+{
+  static const int kinds[] = { visited_exact, visited_compact, visited_bloom };
+  int saved = opt.visited_set;
+  unsigned k;
+
+  for (k = 0; k < countof (kinds); k++)
+    {
+      struct visited_set *vs;
+      FILE *fp;
+      char url[64];
+      int i, false_positives = 0;
+
+      opt.visited_set = kinds[k];
+      vs = visited_set_new ();
+
+      /* Enough URLs to grow the fingerprint table and to fill the
+         first Bloom stage.  */
+      for (i = 0; i < 100000; i++)
+        {
+          sprintf (url, "http://example.com/%d.html", i);
+          visited_set_add (vs, url);
+        }
+      for (i = 0; i < 100000; i++)
+        {
+          sprintf (url, "http://example.com/%d.html", i);
+          mu_assert ("test_visited_set: added URL missing",
+                     visited_set_contains (vs, url));
+          mu_assert ("test_visited_set: added URL added again",
+                     !visited_set_add (vs, url));
+        }
+      for (i = 0; i < 100000; i++)
+        {
+          sprintf (url, "http://example.org/%d.html", i);
+          if (visited_set_contains (vs, url))
+            ++false_positives;
+        }
+      mu_assert ("test_visited_set: too many false positives",
+                 kinds[k] == visited_bloom
+                 ? false_positives < 1000 : false_positives == 0);
+
+      /* The set must survive a trip through a state file.  */
+      fp = tmpfile ();
+      visited_set_save (fp, vs);
+      visited_set_free (vs);
+      rewind (fp);
+      vs = visited_set_load (fp);
+      mu_assert ("test_visited_set: cannot load saved set", vs != NULL);
+      mu_assert ("test_visited_set: saved set not read in full",
+                 getc (fp) == EOF);
+      fclose (fp);
+      for (i = 0; i < 100000; i += 7)
+        {
+          sprintf (url, "http://example.com/%d.html", i);
+          mu_assert ("test_visited_set: loaded set lacks URL",
+                     visited_set_contains (vs, url));
+        }
+
+      visited_set_free (vs);
+    }
+  opt.visited_set = saved;
+  return NULL;
+}
+
+#endif /* TESTING */
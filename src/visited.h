@@ -0,0 +1,53 @@
+/* Declarations for visited.c.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+#ifndef VISITED_H
+#define VISITED_H
+
+/* The set of URLs retrieve_tree has seen.  Depending on
+   opt.visited_set, it keeps the URLs themselves, 64-bit fingerprints
+   of them, or a Bloom filter.  */
+
+struct visited_set;
+
+struct visited_set *visited_set_new (void);
+bool visited_set_add (struct visited_set *, const char *);
+bool visited_set_contains (const struct visited_set *, const char *);
+void visited_set_free (struct visited_set *);
+int visited_set_count (const struct visited_set *);
+size_t visited_set_memory (const struct visited_set *);
+void visited_set_compact (struct visited_set *);
+
+void visited_set_save (FILE *, const struct visited_set *);
+struct visited_set *visited_set_load (FILE *);
+
+uint64_t url_fingerprint (const char *);
+
+#endif /* VISITED_H */
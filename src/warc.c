@@ -30,7 +30,6 @@ as that of the covered work.  */
 #define _GNU_SOURCE
 
 #include "wget.h"
-#include "hash.h"
 #include "utils.h"
 
 #include <stdio.h>
@@ -42,9 +41,25 @@ as that of the covered work.  */
 #include <sha1.h>
 #include <base32.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #ifdef HAVE_LIBZ
 #include <zlib.h>
 #endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
+/* Records can be compressed as a whole, by warc_compress_job.  */
+# define WARC_JOBS
+#endif
+#if defined WARC_JOBS && defined HAVE_PTHREAD
+#include <pthread.h>
+/* Records can be compressed by a pool of threads.  */
+# define WARC_THREADS
+#endif
 #ifdef HAVE_LIBUUID
 #include <uuid/uuid.h>
 #endif
@@ -54,6 +69,14 @@ as that of the covered work.  */
 #endif
 
 #include "warc.h"
+#include "sha1-hw.h"
+
+#ifndef MIN
+# define MIN(i, j) ((i) <= (j) ? (i) : (j))
+#endif
+#ifndef MAX
+# define MAX(i, j) ((i) >= (j) ? (i) : (j))
+#endif
 
 extern char *version_string;
 
@@ -72,18 +95,23 @@ static FILE *warc_manifest_fp;
 /* The current WARC file (or NULL, if WARC is disabled). */
 static FILE *warc_current_file;
 
+/* The offset of the current record in the WARC file. */
+static off_t warc_current_record_offset;
+
 #ifdef HAVE_LIBZ
 /* The gzip stream for the current WARC file
    (or NULL, if WARC or gzip is disabled). */
 static gzFile warc_current_gzfile;
 
-/* The offset of the current gzip record in the WARC file. */
-static off_t warc_current_gzfile_offset;
-
 /* The uncompressed size (so far) of the current record. */
 static off_t warc_current_gzfile_uncompressed_size;
 # endif
 
+/* The CDX line of the current record, up to the record's offset, and
+   the record's id (or NULL, if the record is not indexed).  */
+static char *warc_current_cdx_line;
+static char *warc_current_cdx_uuid;
+
 /* This is true until a warc_write_* method fails. */
 static bool warc_write_ok;
 
@@ -101,35 +129,274 @@ static char *warc_current_filename;
    WARC file's filename. */
 static int warc_current_file_number;
 
-/* The table of CDX records, if deduplication is enabled. */
-struct hash_table * warc_cdx_dedup_table;
+/* The index of the CDX records used for deduplication, if it is
+   enabled.  See warc_load_cdx_dedup_file for its layout.  */
+static struct file_memory *warc_cdx_index;
+static wgint warc_cdx_index_count;
 
 static bool warc_start_new_file (bool meta);
+static void warc_write_cdx_line (const char *line, off_t offset,
+                                 const char *uuid);
 
 
+/* A record found in the CDX index.  The strings point into the
+   index.  */
 struct warc_cdx_record
 {
-  char *url;
-  char *uuid;
-  char digest[SHA1_DIGEST_SIZE];
+  const char *url;
+  const char *uuid;
+};
+
+
+/* Blocks up to this size are kept in memory until they are written
+   to the WARC file.  Larger ones are spilled to a temporary file.  */
+#define WARC_BLOCK_MEMORY (1024 * 1024)
+
+/* The block of a WARC record being collected, such as a response
+   that is being downloaded.  The block and payload digests are
+   computed as the data is added, so that the record can be written
+   without reading the data back more than once.  */
+struct warc_block
+{
+  char *data;			/* the contents, until spilled */
+  size_t size, alloc;
+  FILE *spill;			/* the contents, once larger than
+                                   WARC_BLOCK_MEMORY */
+  off_t length;			/* total length of the block */
+  off_t payload_offset;		/* where the payload starts, or -1 */
+  bool digest;			/* whether to compute the digests */
+  bool error;			/* a write failed */
+
+  struct sha1_ctx block_ctx;	/* digest of the whole block */
+  struct sha1_ctx head_ctx;	/* digest of the part before the payload */
+  struct sha1_ctx payload_ctx;	/* digest of the payload */
 };
 
-static unsigned long
-warc_hash_sha1_digest (const void *key)
+/* Creates an empty WARC block.  */
+struct warc_block *
+warc_block_new (void)
 {
-  /* We just use some of the first bytes of the digest. */
-  unsigned long v = 0;
-  memcpy (&v, key, sizeof (unsigned long));
-  return v;
+  struct warc_block *block = xnew0 (struct warc_block);
+  block->payload_offset = -1;
+  block->digest = opt.warc_digests_enabled;
+  if (block->digest)
+    sha1_init_ctx (&block->block_ctx);
+  return block;
 }
 
-static int
-warc_cmp_sha1_digest (const void *digest1, const void *digest2)
+/* Appends the SIZE bytes at BUF to BLOCK.
+   Returns false if the data could not be stored.  */
+bool
+warc_block_write (struct warc_block *block, const char *buf, size_t size)
 {
-  return !memcmp (digest1, digest2, SHA1_DIGEST_SIZE);
+  if (block->error)
+    return false;
+
+  if (block->digest)
+    {
+      sha1_hw_process_bytes (buf, size, &block->block_ctx);
+      if (block->payload_offset >= 0)
+        sha1_hw_process_bytes (buf, size, &block->payload_ctx);
+    }
+  block->length += size;
+
+  if (!block->spill && block->size + size > WARC_BLOCK_MEMORY)
+    {
+      block->spill = warc_tempfile ();
+      if (block->spill == NULL
+          || fwrite (block->data, 1, block->size, block->spill) != block->size)
+        block->error = true;
+      xfree_null (block->data);
+      block->data = NULL;
+      block->size = block->alloc = 0;
+    }
+  if (block->spill)
+    {
+      if (!block->error && fwrite (buf, 1, size, block->spill) != size)
+        block->error = true;
+    }
+  else
+    {
+      if (block->size + size > block->alloc)
+        {
+          block->alloc = MAX (2 * block->alloc, block->size + size);
+          block->alloc = MAX (block->alloc, 4096);
+          block->data = xrealloc (block->data, block->alloc);
+        }
+      memcpy (block->data + block->size, buf, size);
+      block->size += size;
+    }
+  return !block->error;
+}
+
+/* Appends the string STR to BLOCK.  */
+static bool
+warc_block_write_string (struct warc_block *block, const char *str)
+{
+  return warc_block_write (block, str, strlen (str));
+}
+
+/* Marks the end of the data added to BLOCK so far as the start of
+   its payload.  */
+void
+warc_block_start_payload (struct warc_block *block)
+{
+  block->payload_offset = block->length;
+  if (block->digest)
+    {
+      block->head_ctx = block->block_ctx;
+      sha1_init_ctx (&block->payload_ctx);
+    }
+}
+
+/* Frees BLOCK and its contents.  */
+void
+warc_block_free (struct warc_block *block)
+{
+  if (block->spill)
+    fclose (block->spill);
+  xfree_null (block->data);
+  xfree (block);
 }
 
+/* Drops the payload of BLOCK, leaving the part before it.  */
+static void
+warc_block_truncate_payload (struct warc_block *block)
+{
+  if (block->payload_offset < 0)
+    return;
+  block->length = block->payload_offset;
+  if (block->digest)
+    block->block_ctx = block->head_ctx;
+  if (block->spill)
+    {
+      fflush (block->spill);
+      if (ftruncate (fileno (block->spill), block->length) != 0)
+        block->error = true;
+    }
+  else
+    block->size = block->length;
+  block->payload_offset = -1;
+}
 
+/* Creates a WARC block with the contents of FILE, and closes FILE.  */
+static struct warc_block *
+warc_block_from_file (FILE *file)
+{
+  struct warc_block *block = warc_block_new ();
+  char buffer[BUFSIZ];
+  size_t s;
+
+  rewind (file);
+  while ((s = fread (buffer, 1, sizeof buffer, file)) > 0)
+    warc_block_write (block, buffer, s);
+  if (ferror (file))
+    block->error = true;
+  fclose (file);
+  return block;
+}
+
+/* Moves the contents of BLOCK to a new block, leaving BLOCK empty.  */
+static struct warc_block *
+warc_block_take (struct warc_block *block)
+{
+  struct warc_block *copy = xnew (struct warc_block);
+  *copy = *block;
+  block->data = NULL;
+  block->size = block->alloc = 0;
+  block->spill = NULL;
+  return copy;
+}
+
+/* Passes the contents of BLOCK to FN, piece by piece, along with ARG.
+   Returns false as soon as FN does, or if BLOCK cannot be read.  */
+static bool
+warc_block_each (struct warc_block *block,
+                 bool (*fn) (const char *, size_t, void *), void *arg)
+{
+  char buffer[BUFSIZ];
+  size_t s;
+  off_t left = block->length;
+
+  if (!block->spill)
+    return block->size == 0 || fn (block->data, block->size, arg);
+
+  if (fflush (block->spill) != 0 || fseeko (block->spill, 0L, SEEK_SET) != 0)
+    return false;
+  while (left > 0
+         && (s = fread (buffer, 1, MIN (left, BUFSIZ), block->spill)) > 0)
+    {
+      if (!fn (buffer, s, arg))
+        return false;
+      left -= s;
+    }
+  return left == 0;
+}
+
+/* Replaces the SIZE bytes of BLOCK at OFFSET with those at BUF.  */
+static bool
+warc_block_overwrite (struct warc_block *block, off_t offset,
+                      const char *buf, size_t size)
+{
+  if (offset + (off_t) size > block->length)
+    return false;
+  if (!block->spill)
+    {
+      memcpy (block->data + offset, buf, size);
+      return true;
+    }
+  return fflush (block->spill) == 0
+    && fseeko (block->spill, offset, SEEK_SET) == 0
+    && fwrite (buf, 1, size, block->spill) == size
+    && fseeko (block->spill, 0L, SEEK_END) == 0;
+}
+
+
+
+#ifdef WARC_JOBS
+/* A record waiting to be compressed and written to the WARC file.  */
+struct warc_job
+{
+  struct warc_block *head;	/* the version and header lines */
+  struct warc_block *body;	/* the record block, or NULL */
+  struct warc_block *member;	/* the compressed record */
+  char *cdx_line;		/* see warc_current_cdx_line */
+  char *cdx_uuid;
+  bool done;			/* compressed, or failed to */
+  bool error;
+  struct warc_job *next;
+};
+
+/* The record being put together, if records are compressed as a
+   whole: with zstd, or in the compression threads.  */
+static struct warc_job *warc_current_job;
+static bool warc_compress_jobs;
+#endif /* WARC_JOBS */
+
+#ifdef HAVE_LIBZSTD
+/* The dictionary of opt.warc_zstd_dictionary, as read from the file
+   and as prepared for compression.  */
+static struct file_memory *warc_zstd_dict_file;
+static ZSTD_CDict *warc_zstd_dict;
+#endif
+
+#ifdef WARC_THREADS
+/* The compression threads, if opt.warc_compression_threads is set.  */
+static pthread_t *warc_threads;
+static int warc_thread_count;
+
+/* The queue of records that have not been written yet, in the order
+   they must appear in the WARC file.  warc_queue_next is the first
+   one no thread has started compressing.  All of it is protected by
+   warc_queue_lock.  */
+static pthread_mutex_t warc_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t warc_queue_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t warc_queue_done = PTHREAD_COND_INITIALIZER;
+static struct warc_job *warc_queue_head, *warc_queue_tail;
+static struct warc_job *warc_queue_next;
+static int warc_queue_length;
+static bool warc_queue_closing;
+#endif /* WARC_THREADS */
 
 /* Writes SIZE bytes from BUFFER to the current WARC file,
    through gzwrite if compression is enabled.
@@ -137,6 +404,10 @@ warc_cmp_sha1_digest (const void *digest1, const void *digest2)
 static size_t
 warc_write_buffer (const char *buffer, size_t size)
 {
+#ifdef WARC_JOBS
+  if (warc_current_job)
+    return warc_block_write (warc_current_job->head, buffer, size) ? size : 0;
+#endif
 #ifdef HAVE_LIBZ
   if (warc_current_gzfile)
     {
@@ -164,18 +435,391 @@ warc_write_string (const char *str)
   return warc_write_ok;
 }
 
+/* A warc_block_each callback that writes the piece to the record.  */
+static bool
+warc_write_piece (const char *buf, size_t size, void *arg)
+{
+  return warc_write_buffer (buf, size) == size;
+}
+
+/* A warc_block_each callback that writes the piece to the FILE.  */
+static bool
+warc_fwrite_piece (const char *buf, size_t size, void *file)
+{
+  return fwrite (buf, 1, size, (FILE *) file) == size;
+}
+
 
 #define EXTRA_GZIP_HEADER_SIZE 12
 #define GZIP_STATIC_HEADER_SIZE  10
 #define FLG_FEXTRA          0x04
 #define OFF_FLG             3
 
+#ifdef HAVE_LIBZ
+/* Stores the WARC skip length fields of a gzip member in the 8 bytes
+   at FIELD: the size of the whole member, then the size of the record
+   it holds.  */
+static void
+warc_gzip_skip_length (char *field, off_t member_size, off_t record_size)
+{
+  field[0] = (member_size & 255);
+  field[1] = (member_size >> 8) & 255;
+  field[2] = (member_size >> 16) & 255;
+  field[3] = (member_size >> 24) & 255;
+  field[4] = (record_size & 255);
+  field[5] = (record_size >> 8) & 255;
+  field[6] = (record_size >> 16) & 255;
+  field[7] = (record_size >> 24) & 255;
+}
+#endif
+
+#ifdef HAVE_LIBZ
+/* The state of a record being compressed.  */
+struct warc_deflate
+{
+  z_stream z;
+  struct warc_block *out;
+};
+
+/* Compresses SIZE bytes from BUF into the member being built in D.  */
+static bool
+warc_deflate (struct warc_deflate *d, const char *buf, size_t size, int flush)
+{
+  char out[BUFSIZ];
+
+  d->z.next_in = (Bytef *) buf;
+  d->z.avail_in = size;
+  do
+    {
+      d->z.next_out = (Bytef *) out;
+      d->z.avail_out = sizeof out;
+      if (deflate (&d->z, flush) == Z_STREAM_ERROR)
+        return false;
+      if (!warc_block_write (d->out, out, sizeof out - d->z.avail_out))
+        return false;
+    }
+  while (d->z.avail_out == 0);
+  return true;
+}
+
+/* A warc_block_each callback that compresses the piece.  */
+static bool
+warc_deflate_piece (const char *buf, size_t size, void *d)
+{
+  return warc_deflate (d, buf, size, Z_NO_FLUSH);
+}
+
+/* Compresses the record of JOB into a gzip member of its own,
+   carrying the same skip length field as warc_end_gzip_member
+   writes.  */
+static bool
+warc_gzip_job (struct warc_job *job)
+{
+  struct warc_deflate d;
+  gz_header gzh;
+  unsigned char extra[EXTRA_GZIP_HEADER_SIZE - 2];
+  char field[8];
+  off_t record_size;
+  bool ok;
+
+  memset (&d, 0, sizeof d);
+  memset (&gzh, 0, sizeof gzh);
+  memset (extra, 0, sizeof extra);
+  extra[0] = 's';
+  extra[1] = 'l';
+  gzh.extra = extra;
+  gzh.extra_len = sizeof extra;
+  gzh.os = 3;			/* Unix, as gzdopen says */
+
+  job->member = d.out = warc_block_new ();
+  job->member->digest = false;
+  if (deflateInit2 (&d.z, opt.warc_compression_level, Z_DEFLATED,
+                    MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+  ok = deflateSetHeader (&d.z, &gzh) == Z_OK
+    && warc_block_each (job->head, warc_deflate_piece, &d)
+    && (!job->body || warc_block_each (job->body, warc_deflate_piece, &d))
+    && warc_deflate (&d, "\r\n\r\n", 4, Z_FINISH);
+  record_size = d.z.total_in;
+  deflateEnd (&d.z);
+  if (!ok)
+    return false;
+
+  /* The skip length follows the static header, XLEN and "sl".  */
+  warc_gzip_skip_length (field, job->member->length, record_size);
+  return warc_block_overwrite (job->member, GZIP_STATIC_HEADER_SIZE + 4,
+                               field, sizeof field);
+}
+#endif /* HAVE_LIBZ */
+
+#ifdef HAVE_LIBZSTD
+/* The state of a record being compressed with zstd.  */
+struct warc_zstd
+{
+  ZSTD_CCtx *cctx;
+  struct warc_block *out;
+};
+
+/* Compresses SIZE bytes from BUF into the frame being built in Z.  */
+static bool
+warc_zstd (struct warc_zstd *z, const char *buf, size_t size,
+           ZSTD_EndDirective end)
+{
+  char out[BUFSIZ];
+  ZSTD_inBuffer in = { buf, size, 0 };
+  size_t left;
+
+  do
+    {
+      ZSTD_outBuffer o = { out, sizeof out, 0 };
+      left = ZSTD_compressStream2 (z->cctx, &o, &in, end);
+      if (ZSTD_isError (left) || !warc_block_write (z->out, out, o.pos))
+        return false;
+    }
+  while (end == ZSTD_e_end ? left != 0 : in.pos < in.size);
+  return true;
+}
+
+/* A warc_block_each callback that compresses the piece with zstd.  */
+static bool
+warc_zstd_piece (const char *buf, size_t size, void *z)
+{
+  return warc_zstd (z, buf, size, ZSTD_e_continue);
+}
+
+/* Compresses the record of JOB into a zstd frame of its own, using
+   the dictionary of the WARC file, if there is one.  */
+static bool
+warc_zstd_job (struct warc_job *job)
+{
+  struct warc_zstd z;
+  off_t size = job->head->length + (job->body ? job->body->length : 0) + 4;
+  bool ok;
+
+  z.cctx = ZSTD_createCCtx ();
+  if (z.cctx == NULL)
+    return false;
+  job->member = z.out = warc_block_new ();
+  job->member->digest = false;
+
+  /* With the size known up front, small records get small tables.  */
+  ok = !ZSTD_isError (ZSTD_CCtx_setParameter (z.cctx, ZSTD_c_compressionLevel,
+                                              opt.warc_compression_level))
+    && (!warc_zstd_dict
+        || !ZSTD_isError (ZSTD_CCtx_refCDict (z.cctx, warc_zstd_dict)))
+    && !ZSTD_isError (ZSTD_CCtx_setPledgedSrcSize (z.cctx, size))
+    && warc_block_each (job->head, warc_zstd_piece, &z)
+    && (!job->body || warc_block_each (job->body, warc_zstd_piece, &z))
+    && warc_zstd (&z, "\r\n\r\n", 4, ZSTD_e_end);
+  ZSTD_freeCCtx (z.cctx);
+  return ok;
+}
+#endif /* HAVE_LIBZSTD */
+
+#ifdef WARC_JOBS
+/* Compresses the record of JOB into JOB->member, in the format chosen
+   for the WARC file.  Runs in a compression thread, if there are.  */
+static bool
+warc_compress_job (struct warc_job *job)
+{
+#ifdef HAVE_LIBZSTD
+  if (opt.warc_zstd)
+    return warc_zstd_job (job);
+#endif
+#ifdef HAVE_LIBZ
+  return warc_gzip_job (job);
+#else
+  return false;
+#endif
+}
+
+/* Frees JOB and the blocks it holds.  */
+static void
+warc_job_free (struct warc_job *job)
+{
+  if (job->head)
+    warc_block_free (job->head);
+  if (job->body)
+    warc_block_free (job->body);
+  if (job->member)
+    warc_block_free (job->member);
+  xfree_null (job->cdx_line);
+  xfree_null (job->cdx_uuid);
+  xfree (job);
+}
+
+/* Appends the compressed record of JOB to the WARC file, and its line
+   to the CDX file, now that the offset of the record is known.  */
+static void
+warc_write_job (struct warc_job *job)
+{
+  off_t offset;
+
+  fseeko (warc_current_file, 0L, SEEK_END);
+  offset = ftello (warc_current_file);
+  if (job->error
+      || !warc_block_each (job->member, warc_fwrite_piece, warc_current_file))
+    {
+      logprintf (LOG_NOTQUIET, _("Error writing compressed WARC record.\n"));
+      warc_write_ok = false;
+    }
+  else if (job->cdx_line)
+    warc_write_cdx_line (job->cdx_line, offset, job->cdx_uuid);
+  warc_job_free (job);
+}
+#endif /* WARC_JOBS */
+
+#ifdef WARC_THREADS
+/* The compression threads take the records from the queue in order
+   and compress them, until warc_queue_closing is set.  */
+static void *
+warc_compress_thread (void *arg)
+{
+  pthread_mutex_lock (&warc_queue_lock);
+  for (;;)
+    {
+      struct warc_job *job;
+      bool ok;
+
+      while (!warc_queue_next && !warc_queue_closing)
+        pthread_cond_wait (&warc_queue_work, &warc_queue_lock);
+      if (!warc_queue_next)
+        break;
+      job = warc_queue_next;
+      warc_queue_next = job->next;
+      pthread_mutex_unlock (&warc_queue_lock);
+
+      ok = warc_compress_job (job);
+
+      pthread_mutex_lock (&warc_queue_lock);
+      job->error = !ok;
+      job->done = true;
+      pthread_cond_broadcast (&warc_queue_done);
+    }
+  pthread_mutex_unlock (&warc_queue_lock);
+  return NULL;
+}
+
+/* Writes the records at the front of the queue that have been
+   compressed, waiting for the threads until at most MAX_PENDING
+   records are left.  */
+static void
+warc_write_jobs (int max_pending)
+{
+  pthread_mutex_lock (&warc_queue_lock);
+  while (warc_queue_head)
+    {
+      struct warc_job *job = warc_queue_head;
+      if (!job->done)
+        {
+          if (warc_queue_length <= max_pending)
+            break;
+          pthread_cond_wait (&warc_queue_done, &warc_queue_lock);
+          continue;
+        }
+      warc_queue_head = job->next;
+      if (!warc_queue_head)
+        warc_queue_tail = NULL;
+      --warc_queue_length;
+
+      /* The threads only look at the jobs they were given, so the
+         file can be written without holding the lock.  */
+      pthread_mutex_unlock (&warc_queue_lock);
+      warc_write_job (job);
+      pthread_mutex_lock (&warc_queue_lock);
+    }
+  pthread_mutex_unlock (&warc_queue_lock);
+}
+
+/* Hands JOB over to the compression threads.  Writes out what they
+   have finished, and waits for them if too much is queued, so that
+   the records kept in memory stay bounded.  */
+static void
+warc_queue_job (struct warc_job *job)
+{
+  pthread_mutex_lock (&warc_queue_lock);
+  if (warc_queue_tail)
+    warc_queue_tail->next = job;
+  else
+    warc_queue_head = job;
+  warc_queue_tail = job;
+  if (!warc_queue_next)
+    warc_queue_next = job;
+  ++warc_queue_length;
+  pthread_cond_signal (&warc_queue_work);
+  pthread_mutex_unlock (&warc_queue_lock);
+
+  warc_write_jobs (2 * warc_thread_count);
+}
+
+/* Starts opt.warc_compression_threads compression threads.  If none
+   can be started, records are compressed as they are written.  */
+static void
+warc_start_threads (void)
+{
+  int i;
+  int err = 0;
+
+  warc_threads = xnew_array (pthread_t, opt.warc_compression_threads);
+  for (i = 0; i < opt.warc_compression_threads; i++)
+    {
+      /* pthread_create returns the error rather than setting errno.  */
+      err = pthread_create (&warc_threads[i], NULL, warc_compress_thread,
+                            NULL);
+      if (err)
+        break;
+    }
+  warc_thread_count = i;
+  if (warc_thread_count == 0)
+    {
+      logprintf (LOG_NOTQUIET,
+                 _("Could not start WARC compression threads: %s\n"),
+                 strerror (err));
+      xfree (warc_threads);
+      warc_threads = NULL;
+    }
+  else
+    warc_compress_jobs = true;
+}
+
+/* Writes all queued records and stops the compression threads.  */
+static void
+warc_stop_threads (void)
+{
+  int i;
+
+  if (!warc_threads)
+    return;
+  warc_write_jobs (0);
+  pthread_mutex_lock (&warc_queue_lock);
+  warc_queue_closing = true;
+  pthread_cond_broadcast (&warc_queue_work);
+  pthread_mutex_unlock (&warc_queue_lock);
+  for (i = 0; i < warc_thread_count; i++)
+    pthread_join (warc_threads[i], NULL);
+  xfree (warc_threads);
+  warc_threads = NULL;
+}
+#endif /* WARC_THREADS */
+
+/* Writes out the records that are still being compressed, if any,
+   so that the current WARC file is complete.  */
+static void
+warc_flush_records (void)
+{
+#ifdef WARC_THREADS
+  if (warc_threads)
+    warc_write_jobs (0);
+#endif
+}
+
 /* Starts a new WARC record.  Writes the version header.
    If opt.warc_maxsize is set and the current file is becoming
    too large, this will open a new WARC file.
 
    If compression is enabled, this will start a new
-   gzip stream in the current WARC file.
+   gzip stream in the current WARC file, or a new record to be
+   compressed as a whole.
 
    Returns false and set warc_write_ok to false if there
    is an error.  */
@@ -185,26 +829,43 @@ warc_write_start_record (void)
   if (!warc_write_ok)
     return false;
 
+  /* With compression threads, the records still in the queue are not
+     counted, so the file may grow past the limit by that much.  */
   fflush (warc_current_file);
   if (opt.warc_maxsize > 0 && ftello (warc_current_file) >= opt.warc_maxsize)
     warc_start_new_file (false);
 
+#ifdef WARC_JOBS
+  if (warc_compress_jobs)
+    {
+      warc_current_job = xnew0 (struct warc_job);
+      warc_current_job->head = warc_block_new ();
+      warc_current_job->head->digest = false;
+      warc_write_string ("WARC/1.0\r\n");
+      return warc_write_ok;
+    }
+#endif
+
+  /* Record the starting offset of the new record. */
+  fseeko (warc_current_file, 0L, SEEK_END);
+  warc_current_record_offset = ftello (warc_current_file);
+
 #ifdef HAVE_LIBZ
   /* Start a GZIP stream, if required. */
   if (opt.warc_compression_enabled)
     {
-      /* Record the starting offset of the new record. */
-      warc_current_gzfile_offset = ftello (warc_current_file);
+      char mode[8];
 
       /* Reserve space for the extra GZIP header field.
-         In warc_write_end_record we will fill this space
+         In warc_end_gzip_member we will fill this space
          with information about the uncompressed and
          compressed size of the record. */
       fprintf (warc_current_file, "XXXXXXXXXXXX");
       fflush (warc_current_file);
 
       /* Start a new GZIP stream. */
-      warc_current_gzfile = gzdopen (dup (fileno (warc_current_file)), "wb9");
+      sprintf (mode, "wb%d", opt.warc_compression_level);
+      warc_current_gzfile = gzdopen (dup (fileno (warc_current_file)), mode);
       warc_current_gzfile_uncompressed_size = 0;
 
       if (warc_current_gzfile == NULL)
@@ -223,7 +884,7 @@ _("Error opening GZIP stream to WARC file.\n"));
 
 /* Writes a WARC header to the current WARC record.
    This method may be run after warc_write_start_record and
-   before warc_write_block_from_file.  */
+   before warc_write_block.  */
 static bool
 warc_write_header (const char *name, const char *value)
 {
@@ -237,138 +898,170 @@ warc_write_header (const char *name, const char *value)
   return warc_write_ok;
 }
 
-/* Copies the contents of DATA_IN to the WARC record.
+/* Copies the contents of BLOCK to the WARC record.
    Adds a Content-Length header to the WARC record.
    Run this method after warc_write_header,
    then run warc_write_end_record. */
 static bool
-warc_write_block_from_file (FILE *data_in)
+warc_write_block (struct warc_block *block)
 {
   /* Add the Content-Length header. */
-  char *content_length;
-  fseeko (data_in, 0L, SEEK_END);
-  if (! asprintf (&content_length, "%ld", ftello (data_in)))
-    {
-      warc_write_ok = false;
-      return false;
-    }
+  char content_length[24];
+  if (block->error)
+    warc_write_ok = false;
+  sprintf (content_length, "%ld", (long) block->length);
   warc_write_header ("Content-Length", content_length);
-  free (content_length);
 
   /* End of the WARC header section. */
   warc_write_string ("\r\n");
 
-  if (fseeko (data_in, 0L, SEEK_SET) != 0)
-    warc_write_ok = false;
+  if (!warc_write_ok)
+    return false;
 
-  /* Copy the data in the file to the WARC record. */
-  char buffer[BUFSIZ];
-  size_t s;
-  while (warc_write_ok && (s = fread (buffer, 1, BUFSIZ, data_in)) > 0)
+#ifdef WARC_JOBS
+  /* The block is compressed later, so take it from the caller, who
+     is about to free it.  */
+  if (warc_current_job)
     {
-      if (warc_write_buffer (buffer, s) < s)
-        warc_write_ok = false;
+      warc_current_job->body = warc_block_take (block);
+      return warc_write_ok;
     }
+#endif
+
+  if (!warc_block_each (block, warc_write_piece, NULL))
+    warc_write_ok = false;
 
   return warc_write_ok;
 }
 
+#ifdef HAVE_LIBZ
+/* Closes the current GZIP stream and fills the extra GZIP header
+   with the uncompressed and compressed length of the record.  */
+static bool
+warc_end_gzip_member (void)
+{
+  if (gzclose (warc_current_gzfile) != Z_OK)
+    {
+      warc_current_gzfile = NULL;
+      return false;
+    }
+  warc_current_gzfile = NULL;
+
+  fflush (warc_current_file);
+  fseeko (warc_current_file, 0, SEEK_END);
+
+  /* The WARC standard suggests that we add 'skip length' data in the
+     extra header field of the GZIP stream.
+
+     In warc_write_start_record we reserved space for this extra header.
+     This extra space starts at warc_current_record_offset and fills
+     EXTRA_GZIP_HEADER_SIZE bytes.  The static GZIP header starts at
+     warc_current_record_offset + EXTRA_GZIP_HEADER_SIZE.
+
+     We need to do three things:
+     1. Move the static GZIP header to warc_current_record_offset;
+     2. Set the FEXTRA flag in the GZIP header;
+     3. Write the extra GZIP header after the static header, that is,
+        starting at warc_current_record_offset + GZIP_STATIC_HEADER_SIZE.
+  */
+
+  /* Calculate the size of the member and of the record in it. */
+  off_t current_offset = ftello (warc_current_file);
+  off_t member_size = current_offset - warc_current_record_offset;
+  off_t record_size = warc_current_gzfile_uncompressed_size;
+
+  /* Go back to the static GZIP header. */
+  fseeko (warc_current_file, warc_current_record_offset
+          + EXTRA_GZIP_HEADER_SIZE, SEEK_SET);
+
+  /* Read the header. */
+  char static_header[GZIP_STATIC_HEADER_SIZE];
+  size_t result = fread (static_header, 1, GZIP_STATIC_HEADER_SIZE,
+                         warc_current_file);
+  if (result != GZIP_STATIC_HEADER_SIZE)
+    return false;
+
+  /* Set the FEXTRA flag in the flags byte of the header. */
+  static_header[OFF_FLG] = static_header[OFF_FLG] | FLG_FEXTRA;
+
+  /* Write the header back to the file, but starting at
+     warc_current_record_offset. */
+  fseeko (warc_current_file, warc_current_record_offset, SEEK_SET);
+  fwrite (static_header, 1, GZIP_STATIC_HEADER_SIZE, warc_current_file);
+
+  /* Prepare the extra GZIP header. */
+  char extra_header[EXTRA_GZIP_HEADER_SIZE];
+  /* XLEN, the length of the extra header fields.  */
+  extra_header[0]  = ((EXTRA_GZIP_HEADER_SIZE - 2) & 255);
+  extra_header[1]  = ((EXTRA_GZIP_HEADER_SIZE - 2) >> 8) & 255;
+  /* The extra header field identifier for the WARC skip length. */
+  extra_header[2]  = 's';
+  extra_header[3]  = 'l';
+  warc_gzip_skip_length (extra_header + 4, member_size, record_size);
+
+  /* Write the extra header after the static header. */
+  fseeko (warc_current_file, warc_current_record_offset
+          + GZIP_STATIC_HEADER_SIZE, SEEK_SET);
+  fwrite (extra_header, 1, EXTRA_GZIP_HEADER_SIZE, warc_current_file);
+
+  /* Done, move back to the end of the file. */
+  fflush (warc_current_file);
+  fseeko (warc_current_file, 0, SEEK_END);
+  return true;
+}
+#endif /* HAVE_LIBZ */
+
 /* Run this method to close the current WARC record.
 
    If compression is enabled, this method closes the
-   current GZIP stream and fills the extra GZIP header
-   with the uncompressed and compressed length of the
-   record. */
+   current GZIP stream, or compresses the record as a
+   whole, or queues it for the compression threads.  The record's CDX line, if any,
+   is written once the record's offset is known. */
 static bool
 warc_write_end_record (void)
 {
-  warc_write_buffer ("\r\n\r\n", 4);
+  char *cdx_line = warc_current_cdx_line;
+  char *cdx_uuid = warc_current_cdx_uuid;
+  warc_current_cdx_line = warc_current_cdx_uuid = NULL;
 
-#ifdef HAVE_LIBZ
-  /* We start a new gzip stream for each record.  */
-  if (warc_write_ok && warc_current_gzfile)
+#ifdef WARC_JOBS
+  if (warc_current_job)
     {
-      if (gzclose (warc_current_gzfile) != Z_OK)
+      struct warc_job *job = warc_current_job;
+      warc_current_job = NULL;
+      job->cdx_line = cdx_line;
+      job->cdx_uuid = cdx_uuid;
+      if (!warc_write_ok)
+        warc_job_free (job);
+#ifdef WARC_THREADS
+      else if (warc_threads)
+        warc_queue_job (job);
+#endif
+      else
         {
-          warc_write_ok = false;
-          return false;
+          job->error = !warc_compress_job (job);
+          warc_write_job (job);
         }
+      return warc_write_ok;
+    }
+#endif
 
-      fflush (warc_current_file);
-      fseeko (warc_current_file, 0, SEEK_END);
-
-      /* The WARC standard suggests that we add 'skip length' data in the
-         extra header field of the GZIP stream.
-
-         In warc_write_start_record we reserved space for this extra header.
-         This extra space starts at warc_current_gzfile_offset and fills
-         EXTRA_GZIP_HEADER_SIZE bytes.  The static GZIP header starts at
-         warc_current_gzfile_offset + EXTRA_GZIP_HEADER_SIZE.
-
-         We need to do three things:
-         1. Move the static GZIP header to warc_current_gzfile_offset;
-         2. Set the FEXTRA flag in the GZIP header;
-         3. Write the extra GZIP header after the static header, that is,
-            starting at warc_current_gzfile_offset + GZIP_STATIC_HEADER_SIZE.
-      */
-
-      /* Calculate the uncompressed and compressed sizes. */
-      off_t current_offset = ftello (warc_current_file);
-      off_t uncompressed_size = current_offset - warc_current_gzfile_offset;
-      off_t compressed_size = warc_current_gzfile_uncompressed_size;
-
-      /* Go back to the static GZIP header. */
-      fseeko (warc_current_file, warc_current_gzfile_offset
-              + EXTRA_GZIP_HEADER_SIZE, SEEK_SET);
-
-      /* Read the header. */
-      char static_header[GZIP_STATIC_HEADER_SIZE];
-      size_t result = fread (static_header, 1, GZIP_STATIC_HEADER_SIZE,
-                             warc_current_file);
-      if (result != GZIP_STATIC_HEADER_SIZE)
-        {
-          warc_write_ok = false;
-          return false;
-        }
+  warc_write_buffer ("\r\n\r\n", 4);
 
-      /* Set the FEXTRA flag in the flags byte of the header. */
-      static_header[OFF_FLG] = static_header[OFF_FLG] | FLG_FEXTRA;
-
-      /* Write the header back to the file, but starting at
-         warc_current_gzfile_offset. */
-      fseeko (warc_current_file, warc_current_gzfile_offset, SEEK_SET);
-      fwrite (static_header, 1, GZIP_STATIC_HEADER_SIZE, warc_current_file);
-
-      /* Prepare the extra GZIP header. */
-      char extra_header[EXTRA_GZIP_HEADER_SIZE];
-      /* XLEN, the length of the extra header fields.  */
-      extra_header[0]  = ((EXTRA_GZIP_HEADER_SIZE - 2) & 255);
-      extra_header[1]  = ((EXTRA_GZIP_HEADER_SIZE - 2) >> 8) & 255;
-      /* The extra header field identifier for the WARC skip length. */
-      extra_header[2]  = 's';
-      extra_header[3]  = 'l';
-      /* The size of the uncompressed record.  */
-      extra_header[4]  = (uncompressed_size & 255);
-      extra_header[5]  = (uncompressed_size >> 8) & 255;
-      extra_header[6]  = (uncompressed_size >> 16) & 255;
-      extra_header[7]  = (uncompressed_size >> 24) & 255;
-      /* The size of the compressed record.  */
-      extra_header[8]  = (compressed_size & 255);
-      extra_header[9]  = (compressed_size >> 8) & 255;
-      extra_header[10] = (compressed_size >> 16) & 255;
-      extra_header[11] = (compressed_size >> 24) & 255;
-
-      /* Write the extra header after the static header. */
-      fseeko (warc_current_file, warc_current_gzfile_offset
-              + GZIP_STATIC_HEADER_SIZE, SEEK_SET);
-      fwrite (extra_header, 1, EXTRA_GZIP_HEADER_SIZE, warc_current_file);
-
-      /* Done, move back to the end of the file. */
-      fflush (warc_current_file);
-      fseeko (warc_current_file, 0, SEEK_END);
-    }
+#ifdef HAVE_LIBZ
+  /* We start a new gzip stream for each record.  */
+  if (warc_write_ok && warc_current_gzfile && !warc_end_gzip_member ())
+    warc_write_ok = false;
 #endif /* HAVE_LIBZ */
 
+  if (cdx_line)
+    {
+      if (warc_write_ok)
+        warc_write_cdx_line (cdx_line, warc_current_record_offset, cdx_uuid);
+      xfree (cdx_line);
+      xfree (cdx_uuid);
+    }
+
   return warc_write_ok;
 }
 
@@ -401,132 +1094,6 @@ warc_write_ip_header (ip_address *ip)
 }
 
 
-/* warc_sha1_stream_with_payload is a modified copy of sha1_stream
-   from gnulib/sha1.c.  This version calculates two digests in one go.
-
-   Compute SHA1 message digests for bytes read from STREAM.  The
-   digest of the complete file will be written into the 16 bytes
-   beginning at RES_BLOCK.
-
-   If payload_offset >= 0, a second digest will be calculated of the
-   portion of the file starting at payload_offset and continuing to
-   the end of the file.  The digest number will be written into the
-   16 bytes beginning ad RES_PAYLOAD.  */
-static int
-warc_sha1_stream_with_payload (FILE *stream, void *res_block, void *res_payload,
-                               off_t payload_offset)
-{
-#define BLOCKSIZE 32768
-
-  struct sha1_ctx ctx_block;
-  struct sha1_ctx ctx_payload;
-  off_t pos;
-  off_t sum;
-
-  char *buffer = malloc (BLOCKSIZE + 72);
-  if (!buffer)
-    return 1;
-
-  /* Initialize the computation context.  */
-  sha1_init_ctx (&ctx_block);
-  if (payload_offset >= 0)
-    sha1_init_ctx (&ctx_payload);
-
-  pos = 0;
-
-  /* Iterate over full file contents.  */
-  while (1)
-    {
-      /* We read the file in blocks of BLOCKSIZE bytes.  One call of the
-         computation function processes the whole buffer so that with the
-         next round of the loop another block can be read.  */
-      off_t n;
-      sum = 0;
-
-      /* Read block.  Take care for partial reads.  */
-      while (1)
-        {
-          n = fread (buffer + sum, 1, BLOCKSIZE - sum, stream);
-
-          sum += n;
-          pos += n;
-
-          if (sum == BLOCKSIZE)
-            break;
-
-          if (n == 0)
-            {
-              /* Check for the error flag IFF N == 0, so that we don't
-                 exit the loop after a partial read due to e.g., EAGAIN
-                 or EWOULDBLOCK.  */
-              if (ferror (stream))
-                {
-                  free (buffer);
-                  return 1;
-                }
-              goto process_partial_block;
-            }
-
-          /* We've read at least one byte, so ignore errors.  But always
-             check for EOF, since feof may be true even though N > 0.
-             Otherwise, we could end up calling fread after EOF.  */
-          if (feof (stream))
-            goto process_partial_block;
-        }
-
-      /* Process buffer with BLOCKSIZE bytes.  Note that
-                        BLOCKSIZE % 64 == 0
-       */
-      sha1_process_block (buffer, BLOCKSIZE, &ctx_block);
-      if (payload_offset >= 0 && payload_offset < pos)
-        {
-          /* At least part of the buffer contains data from payload. */
-          off_t start_of_payload = payload_offset - (pos - BLOCKSIZE);
-          if (start_of_payload <= 0)
-            /* All bytes in the buffer belong to the payload. */
-            start_of_payload = 0;
-
-          /* Process the payload part of the buffer.
-             Note: we can't use  sha1_process_block  here even if we
-             process the complete buffer.  Because the payload doesn't
-             have to start with a full block, there may still be some
-             bytes left from the previous buffer.  Therefore, we need
-             to continue with  sha1_process_bytes.  */
-          sha1_process_bytes (buffer + start_of_payload,
-                              BLOCKSIZE - start_of_payload, &ctx_payload);
-        }
-    }
-
- process_partial_block:;
-
-  /* Process any remaining bytes.  */
-  if (sum > 0)
-    {
-      sha1_process_bytes (buffer, sum, &ctx_block);
-      if (payload_offset >= 0 && payload_offset < pos)
-        {
-          /* At least part of the buffer contains data from payload. */
-          off_t start_of_payload = payload_offset - (pos - sum);
-          if (start_of_payload <= 0)
-            /* All bytes in the buffer belong to the payload. */
-            start_of_payload = 0;
-
-          /* Process the payload part of the buffer. */
-          sha1_process_bytes (buffer + start_of_payload,
-                              sum - start_of_payload, &ctx_payload);
-        }
-    }
-
-  /* Construct result in desired memory.  */
-  sha1_finish_ctx (&ctx_block,   res_block);
-  if (payload_offset >= 0)
-    sha1_finish_ctx (&ctx_payload, res_payload);
-  free (buffer);
-  return 0;
-
-#undef BLOCKSIZE
-}
-
 /* Converts the SHA1 digest to a base32-encoded string.
    "sha1:DIGEST\0"  (Allocates a new string for the response.)  */
 static char *
@@ -542,35 +1109,46 @@ warc_base32_sha1_digest (char *sha1_digest)
 }
 
 
+/* Finishes the digests of BLOCK, storing the block digest in
+   RES_BLOCK and, if BLOCK has a payload, the payload digest in
+   RES_PAYLOAD.  */
+static void
+warc_block_digests (struct warc_block *block, char *res_block,
+                    char *res_payload)
+{
+  /* Finishing a context consumes it, so work on copies.  */
+  struct sha1_ctx ctx = block->block_ctx;
+  sha1_finish_ctx (&ctx, res_block);
+  if (block->payload_offset >= 0)
+    {
+      ctx = block->payload_ctx;
+      sha1_finish_ctx (&ctx, res_payload);
+    }
+}
+
 /* Sets the digest headers of the record.
-   This method will calculate the block digest and, if payload_offset >= 0,
-   will also calculate the payload digest of the payload starting at the
-   provided offset.  */
+   This method will write the block digest of BLOCK and, if BLOCK has
+   a payload, its payload digest.  */
 static void
-warc_write_digest_headers (FILE *file, long payload_offset)
+warc_write_digest_headers (struct warc_block *block)
 {
   if (opt.warc_digests_enabled)
     {
-      /* Calculate the block and payload digests. */
       char sha1_res_block[SHA1_DIGEST_SIZE];
       char sha1_res_payload[SHA1_DIGEST_SIZE];
+      char *digest;
 
-      rewind (file);
-      if (warc_sha1_stream_with_payload (file, sha1_res_block,
-          sha1_res_payload, payload_offset) == 0)
-        {
-          char *digest;
+      warc_block_digests (block, sha1_res_block, sha1_res_payload);
 
-          digest = warc_base32_sha1_digest (sha1_res_block);
-          warc_write_header ("WARC-Block-Digest", digest);
-          free (digest);
+      digest = warc_base32_sha1_digest (sha1_res_block);
+      warc_write_header ("WARC-Block-Digest", digest);
+      free (digest);
 
-          if (payload_offset >= 0)
-            {
-              digest = warc_base32_sha1_digest (sha1_res_payload);
-              warc_write_header ("WARC-Payload-Digest", digest);
-              free (digest);
-            }
+      if (block->payload_offset >= 0)
+        {
+          digest = warc_base32_sha1_digest (sha1_res_payload);
+          warc_write_header ("WARC-Payload-Digest", digest);
+          free (digest);
         }
     }
 }
@@ -667,31 +1245,34 @@ warc_write_warcinfo_record (char *filename)
   warc_write_header ("WARC-Filename", filename_basename);
 
   /* Create content.  */
-  FILE *warc_tmp = warc_tempfile ();
-  if (warc_tmp == NULL)
-    {
-      free (filename_copy);
-      free (filename_basename);
-      return false;
-    }
-
-  fprintf (warc_tmp, "software: Wget/%s (%s)\r\n", version_string, OS_TYPE);
-  fprintf (warc_tmp, "format: WARC File Format 1.0\r\n");
-  fprintf (warc_tmp,
+  struct warc_block *block = warc_block_new ();
+  char *line;
+
+  line = aprintf ("software: Wget/%s (%s)\r\n", version_string, OS_TYPE);
+  warc_block_write (block, line, strlen (line));
+  xfree (line);
+  warc_block_write_string (block, "format: WARC File Format 1.0\r\n");
+  warc_block_write_string (block,
 "conformsTo: http://bibnum.bnf.fr/WARC/WARC_ISO_28500_version1_latestdraft.pdf\r\n");
-  fprintf (warc_tmp, "robots: %s\r\n", (opt.use_robots ? "classic" : "off"));
-  fprintf (warc_tmp, "wget-arguments: %s\r\n", program_argstring);
+  warc_block_write_string (block, opt.use_robots ? "robots: classic\r\n"
+                                                 : "robots: off\r\n");
+  line = aprintf ("wget-arguments: %s\r\n", program_argstring);
+  warc_block_write (block, line, strlen (line));
+  xfree (line);
   /* Add the user headers, if any. */
   if (opt.warc_user_headers)
     {
       int i;
       for (i = 0; opt.warc_user_headers[i]; i++)
-        fprintf (warc_tmp, "%s\r\n", opt.warc_user_headers[i]);
+        {
+          warc_block_write_string (block, opt.warc_user_headers[i]);
+          warc_block_write_string (block, "\r\n");
+        }
     }
-  fprintf(warc_tmp, "\r\n");
+  warc_block_write_string (block, "\r\n");
 
-  warc_write_digest_headers (warc_tmp, -1);
-  warc_write_block_from_file (warc_tmp);
+  warc_write_digest_headers (block);
+  warc_write_block (block);
   warc_write_end_record ();
 
   if (! warc_write_ok)
@@ -699,10 +1280,49 @@ warc_write_warcinfo_record (char *filename)
 
   free (filename_copy);
   free (filename_basename);
-  fclose (warc_tmp);
+  warc_block_free (block);
   return warc_write_ok;
 }
 
+#ifdef HAVE_LIBZSTD
+/* The magic number of the skippable frame that holds the dictionary
+   at the start of a zstd WARC file.  */
+#define WARC_ZSTD_DICT_MAGIC 0x184D2A5D
+
+/* Reads the zstd dictionary named by opt.warc_zstd_dictionary.  */
+static bool
+warc_load_zstd_dictionary (void)
+{
+  warc_zstd_dict_file = wget_read_file (opt.warc_zstd_dictionary);
+  if (warc_zstd_dict_file == NULL)
+    return false;
+  warc_zstd_dict = ZSTD_createCDict (warc_zstd_dict_file->content,
+                                     warc_zstd_dict_file->length,
+                                     opt.warc_compression_level);
+  return warc_zstd_dict != NULL;
+}
+
+/* Writes the zstd dictionary to the current WARC file, in a skippable
+   frame, so that readers can decompress the records that follow.  */
+static bool
+warc_write_zstd_dictionary (void)
+{
+  unsigned long magic = WARC_ZSTD_DICT_MAGIC;
+  unsigned long size = warc_zstd_dict_file->length;
+  char header[8];
+  int i;
+
+  for (i = 0; i < 4; i++)
+    {
+      header[i] = (magic >> (8 * i)) & 255;
+      header[4 + i] = (size >> (8 * i)) & 255;
+    }
+  return fwrite (header, 1, sizeof header, warc_current_file) == sizeof header
+    && fwrite (warc_zstd_dict_file->content, 1, size,
+               warc_current_file) == size;
+}
+#endif /* HAVE_LIBZSTD */
+
 /* Opens a new WARC file.
    If META is true, generates a filename ending with 'meta.warc.gz'.
 
@@ -721,7 +1341,10 @@ warc_start_new_file (bool meta)
     return false;
 
   if (warc_current_file != NULL)
-    fclose (warc_current_file);
+    {
+      warc_flush_records ();
+      fclose (warc_current_file);
+    }
   if (warc_current_warcinfo_uuid_str)
     free (warc_current_warcinfo_uuid_str);
   if (warc_current_filename)
@@ -734,11 +1357,9 @@ warc_start_new_file (bool meta)
   char *new_filename = malloc (base_filename_length + 1 + 5 + 8 + 1);
   warc_current_filename = new_filename;
 
-#ifdef HAVE_LIBZ
-  const char *extension = (opt.warc_compression_enabled ? "warc.gz" : "warc");
-#else
   const char *extension = "warc";
-#endif
+  if (opt.warc_compression_enabled)
+    extension = (opt.warc_zstd ? "warc.zst" : "warc.gz");
 
   /* If max size is enabled, we add a serial number to the file names. */
   if (meta)
@@ -762,6 +1383,15 @@ warc_start_new_file (bool meta)
       return false;
     }
 
+#ifdef HAVE_LIBZSTD
+  if (warc_zstd_dict && ! warc_write_zstd_dictionary ())
+    {
+      logprintf (LOG_NOTQUIET,
+                 _("Error writing zstd dictionary to WARC file.\n"));
+      return false;
+    }
+#endif
+
   if (! warc_write_warcinfo_record (new_filename))
     return false;
 
@@ -849,10 +1479,58 @@ warc_parse_cdx_header (char *lineptr, int *field_num_original_url,
          && *field_num_record_id != -1;
 }
 
-/* Parse the CDX record and add it to the warc_cdx_dedup_table hash table. */
+/* The CDX index starts with a header: WARC_CDX_INDEX_MAGIC, followed by
+   the number of records as 8 little-endian bytes.  Then come the
+   records, sorted by payload digest, each WARC_CDX_INDEX_ENTRY bytes:
+   the digest, followed by 8 little-endian bytes giving the offset of
+   the record's strings, relative to the end of the records.  The
+   strings are the original url and the record id, each terminated by
+   a null byte.  */
+#define WARC_CDX_INDEX_MAGIC "WGETCDX1"
+#define WARC_CDX_INDEX_HEADER 16
+#define WARC_CDX_INDEX_ENTRY (SHA1_DIGEST_SIZE + 8)
+
+/* A CDX record, while the index is being built.  */
+struct warc_cdx_entry
+{
+  char digest[SHA1_DIGEST_SIZE];
+  wgint offset;
+};
+
+/* The state of the index being built from a CDX file.  */
+struct warc_cdx_build
+{
+  struct warc_cdx_entry *entries;
+  wgint count, size;
+  FILE *strings;		/* the strings of the records */
+  wgint strings_length;
+};
+
+/* Stores the 8 little-endian bytes of N at BUF.  */
+static void
+warc_put_uint64 (char *buf, wgint n)
+{
+  int i;
+  for (i = 0; i < 8; i++)
+    buf[i] = ((uint64_t) n >> (8 * i)) & 255;
+}
+
+/* Returns the number stored at BUF by warc_put_uint64.  */
+static wgint
+warc_get_uint64 (const char *buf)
+{
+  uint64_t n = 0;
+  int i;
+  for (i = 7; i >= 0; i--)
+    n = (n << 8) | (unsigned char) buf[i];
+  return n;
+}
+
+/* Parse the CDX record and add it to the index being built in B. */
 static void
 warc_process_cdx_line (char *lineptr, int field_num_original_url,
-                       int field_num_checksum, int field_num_record_id)
+                       int field_num_checksum, int field_num_record_id,
+                       struct warc_cdx_build *b)
 {
   char *original_url = NULL;
   char *checksum = NULL;
@@ -862,74 +1540,69 @@ warc_process_cdx_line (char *lineptr, int field_num_original_url,
   char *save_ptr;
   token = strtok_r (lineptr, CDX_FIELDSEP, &save_ptr);
 
-  /* Read this line to get the fields we need. */
+  /* Read this line to get the fields we need.  The tokens point into
+     LINEPTR, which outlives them. */
   int field_num = 0;
   while (token != NULL)
     {
-      char **val;
       if (field_num == field_num_original_url)
-        val = &original_url;
+        original_url = token;
       else if (field_num == field_num_checksum)
-        val = &checksum;
+        checksum = token;
       else if (field_num == field_num_record_id)
-        val = &record_id;
-      else
-        val = NULL;
-
-      if (val != NULL)
-        *val = strdup (token);
+        record_id = token;
 
       token = strtok_r (NULL, CDX_FIELDSEP, &save_ptr);
       field_num++;
     }
 
-  if (original_url != NULL && checksum != NULL && record_id != NULL)
+  if (original_url == NULL || checksum == NULL || record_id == NULL)
+    return;
+
+  /* For some extra efficiency, we decode the base32 encoded
+     checksum value.  This should produce exactly SHA1_DIGEST_SIZE
+     bytes.  */
+  size_t checksum_l;
+  char * checksum_v;
+  base32_decode_alloc (checksum, strlen (checksum), &checksum_v,
+                       &checksum_l);
+
+  if (checksum_v != NULL && checksum_l == SHA1_DIGEST_SIZE)
     {
-      /* For some extra efficiency, we decode the base32 encoded
-         checksum value.  This should produce exactly SHA1_DIGEST_SIZE
-         bytes.  */
-      size_t checksum_l;
-      char * checksum_v;
-      base32_decode_alloc (checksum, strlen (checksum), &checksum_v,
-                           &checksum_l);
-      free (checksum);
-
-      if (checksum_v != NULL && checksum_l == SHA1_DIGEST_SIZE)
-        {
-          /* This is a valid line with a valid checksum. */
-          struct warc_cdx_record *rec;
-          rec = malloc (sizeof (struct warc_cdx_record));
-          rec->url = original_url;
-          rec->uuid = record_id;
-          memcpy (rec->digest, checksum_v, SHA1_DIGEST_SIZE);
-          hash_table_put (warc_cdx_dedup_table, rec->digest, rec);
-          free (checksum_v);
-        }
-      else
+      /* This is a valid line with a valid checksum. */
+      size_t url_l = strlen (original_url) + 1;
+      size_t record_id_l = strlen (record_id) + 1;
+
+      if (b->count == b->size)
         {
-          free (original_url);
-          if (checksum_v != NULL)
-            free (checksum_v);
-          free (record_id);
+          b->size = MAX (1024, 2 * b->size);
+          b->entries = xrealloc (b->entries,
+                                 b->size * sizeof (struct warc_cdx_entry));
         }
+      memcpy (b->entries[b->count].digest, checksum_v, SHA1_DIGEST_SIZE);
+      b->entries[b->count].offset = b->strings_length;
+      b->count++;
+
+      fwrite (original_url, 1, url_l, b->strings);
+      fwrite (record_id, 1, record_id_l, b->strings);
+      b->strings_length += url_l + record_id_l;
     }
-  else
-    {
-      xfree_null(checksum);
-      xfree_null(original_url);
-      xfree_null(record_id);
-    }
+  xfree_null (checksum_v);
 }
 
-/* Loads the CDX file from opt.warc_cdx_dedup_filename and fills
-   the warc_cdx_dedup_table. */
-static bool
-warc_load_cdx_dedup_file (void)
+/* Orders CDX records by payload digest, for qsort.  */
+static int
+warc_cmp_cdx_entry (const void *e1, const void *e2)
 {
-  FILE *f = fopen (opt.warc_cdx_dedup_filename, "r");
-  if (f == NULL)
-    return false;
+  return memcmp (((const struct warc_cdx_entry *) e1)->digest,
+                 ((const struct warc_cdx_entry *) e2)->digest,
+                 SHA1_DIGEST_SIZE);
+}
 
+/* Reads the CDX file CDX and writes its index to OUT.  */
+static bool
+warc_build_cdx_index (FILE *cdx, FILE *out)
+{
   int field_num_original_url = -1;
   int field_num_checksum = -1;
   int field_num_record_id = -1;
@@ -937,13 +1610,15 @@ warc_load_cdx_dedup_file (void)
   char *lineptr = NULL;
   size_t n = 0;
   ssize_t line_length;
+  struct warc_cdx_build b;
+  bool ok = true;
 
   /* The first line should contain the CDX header.
      Format:  " CDX x x x x x"
      where x are field type indicators.  For our purposes, we only
      need 'a' (the original url), 'k' (the SHA1 checksum) and
      'u' (the WARC record id). */
-  line_length = getline (&lineptr, &n, f);
+  line_length = getline (&lineptr, &n, cdx);
   if (line_length != -1)
     warc_parse_cdx_header (lineptr, &field_num_original_url,
                            &field_num_checksum, &field_num_record_id);
@@ -962,35 +1637,179 @@ _("CDX file does not list checksums. (Missing column 'k'.)\n"));
       if (field_num_record_id == -1)
         logprintf (LOG_NOTQUIET,
 _("CDX file does not list record ids. (Missing column 'u'.)\n"));
+      field_num_original_url = field_num_checksum = -1;
     }
-  else
+
+  memset (&b, 0, sizeof b);
+  b.strings = warc_tempfile ();
+  if (b.strings == NULL)
+    {
+      free (lineptr);
+      return false;
+    }
+
+  if (field_num_original_url != -1)
+    while (getline (&lineptr, &n, cdx) != -1)
+      warc_process_cdx_line (lineptr, field_num_original_url,
+                             field_num_checksum, field_num_record_id, &b);
+  free (lineptr);
+
+  /* Write the header and the sorted records, then copy the strings
+     after them. */
+  char entry[WARC_CDX_INDEX_ENTRY];
+  wgint i;
+
+  qsort (b.entries, b.count, sizeof (struct warc_cdx_entry),
+         warc_cmp_cdx_entry);
+  memcpy (entry, WARC_CDX_INDEX_MAGIC, 8);
+  warc_put_uint64 (entry + 8, b.count);
+  fwrite (entry, 1, WARC_CDX_INDEX_HEADER, out);
+  for (i = 0; i < b.count; i++)
+    {
+      memcpy (entry, b.entries[i].digest, SHA1_DIGEST_SIZE);
+      warc_put_uint64 (entry + SHA1_DIGEST_SIZE, b.entries[i].offset);
+      fwrite (entry, 1, WARC_CDX_INDEX_ENTRY, out);
+    }
+  xfree_null (b.entries);
+
+  char buffer[BUFSIZ];
+  size_t s;
+  if (fflush (b.strings) != 0 || fseeko (b.strings, 0L, SEEK_SET) != 0)
+    ok = false;
+  while (ok && (s = fread (buffer, 1, sizeof buffer, b.strings)) > 0)
+    if (fwrite (buffer, 1, s, out) != s)
+      ok = false;
+  if (ferror (b.strings) || fflush (out) != 0 || ferror (out))
+    ok = false;
+  fclose (b.strings);
+
+  return ok;
+}
+
+/* Maps the contents of FILE into memory, or reads them if they cannot
+   be mapped.  FILE can be closed afterwards.  */
+static struct file_memory *
+warc_map_file (FILE *file)
+{
+  struct file_memory *fm;
+  struct_fstat st;
+
+  if (fflush (file) != 0 || fstat (fileno (file), &st) != 0
+      || st.st_size == 0)
+    return NULL;
+
+  fm = xnew0 (struct file_memory);
+  fm->length = st.st_size;
+#ifdef HAVE_MMAP
+  fm->content = mmap (NULL, fm->length, PROT_READ, MAP_PRIVATE,
+                      fileno (file), 0);
+  if (fm->content != (char *) MAP_FAILED)
     {
-      /* Initialize the table. */
-      warc_cdx_dedup_table = hash_table_new (1000, warc_hash_sha1_digest,
-                                             warc_cmp_sha1_digest);
+      fm->mmap_p = 1;
+      return fm;
+    }
+#endif
+  fm->content = xmalloc (fm->length);
+  if (fseeko (file, 0L, SEEK_SET) != 0
+      || fread (fm->content, 1, fm->length, file) != (size_t) fm->length)
+    {
+      wget_read_file_free (fm);
+      return NULL;
+    }
+  return fm;
+}
+
+/* Makes the index in FM the CDX index, if it looks sound.  */
+static bool
+warc_use_cdx_index (struct file_memory *fm)
+{
+  wgint count;
 
-      do
+  if (fm->length < WARC_CDX_INDEX_HEADER
+      || memcmp (fm->content, WARC_CDX_INDEX_MAGIC, 8) != 0)
+    return false;
+  count = warc_get_uint64 (fm->content + 8);
+  if (count < 0
+      || count > (fm->length - WARC_CDX_INDEX_HEADER) / WARC_CDX_INDEX_ENTRY
+      /* The strings must end with a null byte, so that reading one
+         can never run past the end.  */
+      || (count > 0 && fm->content[fm->length - 1] != '\0'))
+    return false;
+
+  warc_cdx_index = fm;
+  warc_cdx_index_count = count;
+  return true;
+}
+
+/* Loads the CDX index used for deduplication.
+
+   The index is built from the CDX file in opt.warc_cdx_dedup_filename.
+   If opt.warc_cdx_dedup_index is set, the index is saved to that file,
+   and the next run uses it as long as it is newer than the CDX file,
+   instead of reading the CDX file again.  Either way the index is
+   mapped into memory and searched there, rather than loaded into a
+   table. */
+static bool
+warc_load_cdx_dedup_file (void)
+{
+  const char *cdx_name = opt.warc_cdx_dedup_filename;
+  const char *index_name = opt.warc_cdx_dedup_index;
+  struct file_memory *fm = NULL;
+  FILE *f;
+
+  if (index_name)
+    {
+      struct_stat cdx_st, index_st;
+      if (stat (index_name, &index_st) == 0
+          && (cdx_name == NULL
+              || (stat (cdx_name, &cdx_st) == 0
+                  && index_st.st_mtime >= cdx_st.st_mtime))
+          && (f = fopen (index_name, "rb")) != NULL)
         {
-          line_length = getline (&lineptr, &n, f);
-          if (line_length != -1)
+          fm = warc_map_file (f);
+          fclose (f);
+          if (fm && !warc_use_cdx_index (fm))
             {
-              warc_process_cdx_line (lineptr, field_num_original_url,
-                            field_num_checksum, field_num_record_id);
+              logprintf (LOG_NOTQUIET, _("%s is not a CDX index.\n"),
+                         quote (index_name));
+              wget_read_file_free (fm);
+              return false;
             }
+        }
+    }
+
+  if (warc_cdx_index == NULL)
+    {
+      FILE *cdx;
+      bool ok;
 
+      if (cdx_name == NULL || (cdx = fopen (cdx_name, "r")) == NULL)
+        return false;
+      f = index_name ? fopen (index_name, "wb+") : warc_tempfile ();
+      if (f == NULL)
+        {
+          fclose (cdx);
+          return false;
+        }
+      ok = warc_build_cdx_index (cdx, f);
+      fclose (cdx);
+      if (ok)
+        fm = warc_map_file (f);
+      fclose (f);
+      if (fm == NULL || !warc_use_cdx_index (fm))
+        {
+          if (fm)
+            wget_read_file_free (fm);
+          return false;
         }
-      while (line_length != -1);
-
-      /* Print results. */
-      int nrecords = hash_table_count (warc_cdx_dedup_table);
-      logprintf (LOG_VERBOSE, ngettext ("Loaded %d record from CDX.\n\n",
-                                        "Loaded %d records from CDX.\n\n",
-                                         nrecords),
-                              nrecords);
     }
 
-  free (lineptr);
-  fclose (f);
+  /* Print results. */
+  int nrecords = warc_cdx_index_count;
+  logprintf (LOG_VERBOSE, ngettext ("Loaded %d record from CDX.\n\n",
+                                    "Loaded %d records from CDX.\n\n",
+                                     nrecords),
+                          nrecords);
 
   return true;
 }
@@ -1002,16 +1821,50 @@ _("CDX file does not list record ids. (Missing column 'u'.)\n"));
 static struct warc_cdx_record *
 warc_find_duplicate_cdx_record (char *url, char *sha1_digest_payload)
 {
-  if (warc_cdx_dedup_table == NULL)
+  static struct warc_cdx_record rec;
+  const char *entries, *strings;
+  wgint lo = 0, hi = warc_cdx_index_count;
+
+  if (warc_cdx_index == NULL)
     return NULL;
 
-  struct warc_cdx_record *rec_existing
-    = hash_table_get (warc_cdx_dedup_table, sha1_digest_payload);
+  entries = warc_cdx_index->content + WARC_CDX_INDEX_HEADER;
+  strings = entries + warc_cdx_index_count * WARC_CDX_INDEX_ENTRY;
 
-  if (rec_existing && strcmp (rec_existing->url, url) == 0)
-    return rec_existing;
-  else
-    return NULL;
+  /* Find the first record with this digest... */
+  while (lo < hi)
+    {
+      wgint mid = lo + (hi - lo) / 2;
+      if (memcmp (entries + mid * WARC_CDX_INDEX_ENTRY, sha1_digest_payload,
+                  SHA1_DIGEST_SIZE) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  /* ...and look for the url among the records that have it. */
+  for (; lo < warc_cdx_index_count; lo++)
+    {
+      const char *entry = entries + lo * WARC_CDX_INDEX_ENTRY;
+      wgint offset;
+
+      if (memcmp (entry, sha1_digest_payload, SHA1_DIGEST_SIZE) != 0)
+        break;
+      offset = warc_get_uint64 (entry + SHA1_DIGEST_SIZE);
+      if (offset < 0
+          || offset >= warc_cdx_index->content + warc_cdx_index->length
+                       - strings)
+        break;
+      rec.url = strings + offset;
+      if (strcmp (rec.url, url) == 0)
+        {
+          rec.uuid = rec.url + strlen (rec.url) + 1;
+          if (rec.uuid >= warc_cdx_index->content + warc_cdx_index->length)
+            break;
+          return &rec;
+        }
+    }
+  return NULL;
 }
 
 /* Initializes the WARC writer (if opt.warc_filename is set).
@@ -1023,13 +1876,19 @@ warc_init (void)
 
   if (opt.warc_filename != NULL)
     {
-      if (opt.warc_cdx_dedup_filename != NULL)
+      if (opt.warc_digests_enabled)
+        DEBUGP (("Computing WARC digests with %s.\n", sha1_hw_name ()));
+
+      if (opt.warc_cdx_dedup_filename != NULL
+          || opt.warc_cdx_dedup_index != NULL)
         {
           if (! warc_load_cdx_dedup_file ())
             {
               logprintf (LOG_NOTQUIET,
                          _("Could not read CDX file %s for deduplication.\n"),
-                         quote (opt.warc_cdx_dedup_filename));
+                         quote (opt.warc_cdx_dedup_filename
+                                ? opt.warc_cdx_dedup_filename
+                                : opt.warc_cdx_dedup_index));
               exit(1);
             }
         }
@@ -1054,6 +1913,25 @@ warc_init (void)
           log_set_warc_log_fp (warc_log_fp);
         }
 
+#ifdef HAVE_LIBZSTD
+      if (opt.warc_compression_enabled && opt.warc_zstd)
+        {
+          if (opt.warc_zstd_dictionary && ! warc_load_zstd_dictionary ())
+            {
+              logprintf (LOG_NOTQUIET,
+                         _("Could not read zstd dictionary %s.\n"),
+                         quote (opt.warc_zstd_dictionary));
+              exit(1);
+            }
+          warc_compress_jobs = true;
+        }
+#endif
+
+#ifdef WARC_THREADS
+      if (opt.warc_compression_enabled && opt.warc_compression_threads > 0)
+        warc_start_threads ();
+#endif
+
       warc_current_file_number = -1;
       if (! warc_start_new_file (false))
         {
@@ -1088,34 +1966,29 @@ warc_write_metadata (void)
   warc_write_resource_record (manifest_uuid,
                               "metadata://gnu.org/software/wget/warc/MANIFEST.txt",
                               NULL, NULL, NULL, "text/plain",
-                              warc_manifest_fp, -1);
-  /* warc_write_resource_record has closed warc_manifest_fp. */
+                              warc_block_from_file (warc_manifest_fp));
+  /* warc_block_from_file has closed warc_manifest_fp. */
 
-  FILE * warc_tmp_fp = warc_tempfile ();
-  if (warc_tmp_fp == NULL)
-    {
-      logprintf (LOG_NOTQUIET, _("Could not open temporary WARC file.\n"));
-      exit(1);
-    }
-  fflush (warc_tmp_fp);
-  fprintf (warc_tmp_fp, "%s\n", program_argstring);
+  struct warc_block *block = warc_block_new ();
+  warc_block_write_string (block, program_argstring);
+  warc_block_write_string (block, "\n");
 
   warc_write_resource_record (manifest_uuid,
                    "metadata://gnu.org/software/wget/warc/wget_arguments.txt",
-                              NULL, NULL, NULL, "text/plain",
-                              warc_tmp_fp, -1);
-  /* warc_write_resource_record has closed warc_tmp_fp. */
+                              NULL, NULL, NULL, "text/plain", block);
+  /* warc_write_resource_record has freed block. */
 
   if (warc_log_fp != NULL)
     {
+      /* Stop logging to the file before it is closed.  */
+      log_set_warc_log_fp (NULL);
       warc_write_resource_record (NULL,
                               "metadata://gnu.org/software/wget/warc/wget.log",
                                   NULL, manifest_uuid, NULL, "text/plain",
-                                  warc_log_fp, -1);
-      /* warc_write_resource_record has closed warc_log_fp. */
+                                  warc_block_from_file (warc_log_fp));
+      /* warc_block_from_file has closed warc_log_fp. */
 
       warc_log_fp = NULL;
-      log_set_warc_log_fp (NULL);
     }
 }
 
@@ -1127,9 +2000,24 @@ warc_close (void)
   if (warc_current_file != NULL)
     {
       warc_write_metadata ();
+#ifdef WARC_THREADS
+      warc_stop_threads ();
+#endif
       free (warc_current_warcinfo_uuid_str);
       fclose (warc_current_file);
     }
+  if (warc_cdx_index != NULL)
+    {
+      wget_read_file_free (warc_cdx_index);
+      warc_cdx_index = NULL;
+    }
+#ifdef HAVE_LIBZSTD
+  if (warc_zstd_dict != NULL)
+    {
+      ZSTD_freeCDict (warc_zstd_dict);
+      wget_read_file_free (warc_zstd_dict_file);
+    }
+#endif
   if (warc_current_cdx_file != NULL)
     fclose (warc_current_cdx_file);
   if (warc_log_fp != NULL)
@@ -1164,13 +2052,13 @@ warc_tempfile (void)
    url  is the target uri of the request,
    timestamp_str  is the timestamp of the request (generated with warc_timestamp),
    record_uuid  is the uuid of the request (generated with warc_uuid_str),
-   body  is a pointer to a file containing the request headers and body.
    ip  is the ip address of the server (or NULL),
-   Calling this function will close body.
+   body  is the block holding the request headers and body.
+   Calling this function will free body.
    Returns true on success, false on error. */
 bool
 warc_write_request_record (char *url, char *timestamp_str, char *record_uuid,
-                           ip_address *ip, FILE *body, off_t payload_offset)
+                           ip_address *ip, struct warc_block *body)
 {
   warc_write_start_record ();
   warc_write_header ("WARC-Type", "request");
@@ -1180,33 +2068,28 @@ warc_write_request_record (char *url, char *timestamp_str, char *record_uuid,
   warc_write_header ("WARC-Record-ID", record_uuid);
   warc_write_ip_header (ip);
   warc_write_header ("WARC-Warcinfo-ID", warc_current_warcinfo_uuid_str);
-  warc_write_digest_headers (body, payload_offset);
-  warc_write_block_from_file (body);
+  warc_write_digest_headers (body);
+  warc_write_block (body);
   warc_write_end_record ();
 
-  fclose (body);
+  warc_block_free (body);
 
   return warc_write_ok;
 }
 
-/* Writes a response record to the CDX file.
+/* Returns the CDX line of a response record, up to its offset.
    url  is the target uri of the request/response,
    timestamp_str  is the timestamp of the request that generated this response,
                   (generated with warc_timestamp),
    mime_type  is the mime type of the response body (will be printed to CDX),
    response_code  is the HTTP response code (will be printed to CDX),
    payload_digest  is the sha1 digest of the payload,
-   redirect_location  is the contents of the Location: header, or NULL (will be printed to CDX),
-   offset  is the position of the WARC record in the WARC file,
-   warc_filename  is the filename of the WARC,
-   response_uuid  is the uuid of the response.
-   Returns true on success, false on error. */
-static bool
-warc_write_cdx_record (const char *url, const char *timestamp_str,
-                       const char *mime_type, int response_code,
-                       const char *payload_digest, const char *redirect_location,
-                       off_t offset, const char *warc_filename,
-                       const char *response_uuid)
+   redirect_location  is the contents of the Location: header, or NULL (will be printed to CDX).
+   The line is completed by warc_write_cdx_line.  */
+static char *
+warc_cdx_line (const char *url, const char *timestamp_str,
+               const char *mime_type, int response_code,
+               const char *payload_digest, const char *redirect_location)
 {
   /* Transform the timestamp. */
   char timestamp_str_cdx [15];
@@ -1230,13 +2113,20 @@ warc_write_cdx_record (const char *url, const char *timestamp_str,
   if (redirect_location == NULL || strlen(redirect_location) == 0)
     redirect_location = "-";
 
-  /* Print the CDX line. */
-  fprintf (warc_current_cdx_file, "%s %s %s %s %d %s %s - %ld %s %s\n", url,
-           timestamp_str_cdx, url, mime_type, response_code, checksum,
-           redirect_location, offset, warc_current_filename, response_uuid);
-  fflush (warc_current_cdx_file);
+  return aprintf ("%s %s %s %s %d %s %s - ", url, timestamp_str_cdx, url,
+                  mime_type, response_code, checksum, redirect_location);
+}
 
-  return true;
+/* Writes a line to the CDX file.
+   line  is the start of the line (generated with warc_cdx_line),
+   offset  is the position of the WARC record in the current WARC file,
+   uuid  is the uuid of the response.  */
+static void
+warc_write_cdx_line (const char *line, off_t offset, const char *uuid)
+{
+  fprintf (warc_current_cdx_file, "%s%ld %s %s\n", line, (long) offset,
+           warc_current_filename, uuid);
+  fflush (warc_current_cdx_file);
 }
 
 /* Writes a revisit record to the WARC file.
@@ -1249,20 +2139,21 @@ warc_write_cdx_record (const char *url, const char *timestamp_str,
                  (generated with warc_uuid_str),
    payload_digest  is the sha1 digest of the payload,
    ip  is the ip address of the server (or NULL),
-   body  is a pointer to a file containing the response headers (without payload).
-   Calling this function will close body.
+   body  is the block holding the response headers (without payload).
+   Calling this function will free body.
    Returns true on success, false on error. */
 static bool
 warc_write_revisit_record (char *url, char *timestamp_str,
                            char *concurrent_to_uuid, char *payload_digest,
-                           char *refers_to, ip_address *ip, FILE *body)
+                           const char *refers_to, ip_address *ip,
+                           struct warc_block *body)
 {
   char revisit_uuid [48];
   warc_uuid_str (revisit_uuid);
 
   char *block_digest = NULL;
   char sha1_res_block[SHA1_DIGEST_SIZE];
-  sha1_stream (body, sha1_res_block);
+  warc_block_digests (body, sha1_res_block, NULL);
   block_digest = warc_base32_sha1_digest (sha1_res_block);
 
   warc_write_start_record ();
@@ -1279,10 +2170,10 @@ warc_write_revisit_record (char *url, char *timestamp_str,
   warc_write_header ("Content-Type", "application/http;msgtype=response");
   warc_write_header ("WARC-Block-Digest", block_digest);
   warc_write_header ("WARC-Payload-Digest", payload_digest);
-  warc_write_block_from_file (body);
+  warc_write_block (body);
   warc_write_end_record ();
 
-  fclose (body);
+  warc_block_free (body);
   free (block_digest);
 
   return warc_write_ok;
@@ -1295,16 +2186,17 @@ warc_write_revisit_record (char *url, char *timestamp_str,
    concurrent_to_uuid  is the uuid of the request for that generated this response
                  (generated with warc_uuid_str),
    ip  is the ip address of the server (or NULL),
-   body  is a pointer to a file containing the response headers and body.
+   body  is the block holding the response headers and body, with the
+         payload marked by warc_block_start_payload.
    mime_type  is the mime type of the response body (will be printed to CDX),
    response_code  is the HTTP response code (will be printed to CDX),
    redirect_location  is the contents of the Location: header, or NULL (will be printed to CDX),
-   Calling this function will close body.
+   Calling this function will free body.
    Returns true on success, false on error. */
 bool
 warc_write_response_record (char *url, char *timestamp_str,
                             char *concurrent_to_uuid, ip_address *ip,
-                            FILE *body, off_t payload_offset, char *mime_type,
+                            struct warc_block *body, char *mime_type,
                             int response_code, char *redirect_location)
 {
   char *block_digest = NULL;
@@ -1314,10 +2206,9 @@ warc_write_response_record (char *url, char *timestamp_str,
 
   if (opt.warc_digests_enabled)
     {
-      /* Calculate the block and payload digests. */
-      rewind (body);
-      if (warc_sha1_stream_with_payload (body, sha1_res_block, sha1_res_payload,
-          payload_offset) == 0)
+      /* The digests were calculated as the data arrived. */
+      warc_block_digests (body, sha1_res_block, sha1_res_payload);
+      if (body->payload_offset >= 0)
         {
           /* Decide (based on url + payload digest) if we have seen this
              data before. */
@@ -1331,12 +2222,8 @@ warc_write_response_record (char *url, char *timestamp_str,
               logprintf (LOG_VERBOSE,
           _("Found exact match in CDX file. Saving revisit record to WARC.\n"));
 
-              /* Remove the payload from the file. */
-              if (payload_offset > 0)
-                {
-                  if (ftruncate (fileno (body), payload_offset) == -1)
-                    return false;
-                }
+              /* Remove the payload from the block. */
+              warc_block_truncate_payload (body);
 
               /* Send the original payload digest. */
               payload_digest = warc_base32_sha1_digest (sha1_res_payload);
@@ -1348,9 +2235,9 @@ warc_write_response_record (char *url, char *timestamp_str,
               return result;
             }
 
-          block_digest = warc_base32_sha1_digest (sha1_res_block);
           payload_digest = warc_base32_sha1_digest (sha1_res_payload);
         }
+      block_digest = warc_base32_sha1_digest (sha1_res_block);
     }
 
   /* Not a revisit, just store the record. */
@@ -1358,9 +2245,6 @@ warc_write_response_record (char *url, char *timestamp_str,
   char response_uuid [48];
   warc_uuid_str (response_uuid);
 
-  fseeko (warc_current_file, 0L, SEEK_END);
-  off_t offset = ftello (warc_current_file);
-
   warc_write_start_record ();
   warc_write_header ("WARC-Type", "response");
   warc_write_header ("WARC-Record-ID", response_uuid);
@@ -1372,18 +2256,18 @@ warc_write_response_record (char *url, char *timestamp_str,
   warc_write_header ("WARC-Block-Digest", block_digest);
   warc_write_header ("WARC-Payload-Digest", payload_digest);
   warc_write_header ("Content-Type", "application/http;msgtype=response");
-  warc_write_block_from_file (body);
-  warc_write_end_record ();
-
-  fclose (body);
-
-  if (warc_write_ok && opt.warc_cdx_enabled)
+  warc_write_block (body);
+  if (opt.warc_cdx_enabled)
     {
-      /* Add this record to the CDX. */
-      warc_write_cdx_record (url, timestamp_str, mime_type, response_code,
-      payload_digest, redirect_location, offset, warc_current_filename,
-      response_uuid);
+      /* Add this record to the CDX, once it is written. */
+      warc_current_cdx_line = warc_cdx_line (url, timestamp_str, mime_type,
+                                             response_code, payload_digest,
+                                             redirect_location);
+      warc_current_cdx_uuid = xstrdup (response_uuid);
     }
+  warc_write_end_record ();
+
+  warc_block_free (body);
 
   if (block_digest)
     free (block_digest);
@@ -1401,14 +2285,14 @@ warc_write_response_record (char *url, char *timestamp_str,
    resource (generated with warc_uuid_str) or NULL,
    ip  is the ip address of the server (or NULL),
    content_type  is the mime type of the body (or NULL),
-   body  is a pointer to a file containing the resource data.
-   Calling this function will close body.
+   body  is the block holding the resource data.
+   Calling this function will free body.
    Returns true on success, false on error. */
 bool
 warc_write_resource_record (char *resource_uuid, const char *url,
                  const char *timestamp_str, const char *concurrent_to_uuid,
-                 ip_address *ip, const char *content_type, FILE *body,
-                 off_t payload_offset)
+                 ip_address *ip, const char *content_type,
+                 struct warc_block *body)
 {
   if (resource_uuid == NULL)
     {
@@ -1427,12 +2311,12 @@ warc_write_resource_record (char *resource_uuid, const char *url,
   warc_write_header ("WARC-Target-URI", url);
   warc_write_date_header (timestamp_str);
   warc_write_ip_header (ip);
-  warc_write_digest_headers (body, payload_offset);
+  warc_write_digest_headers (body);
   warc_write_header ("Content-Type", content_type);
-  warc_write_block_from_file (body);
+  warc_write_block (body);
   warc_write_end_record ();
 
-  fclose (body);
+  warc_block_free (body);
 
   return warc_write_ok;
 }
@@ -11,13 +11,19 @@ void warc_uuid_str (char *id_str);
 
 FILE * warc_tempfile (void);
 
+struct warc_block;
+struct warc_block *warc_block_new (void);
+bool warc_block_write (struct warc_block *block, const char *buf, size_t size);
+void warc_block_start_payload (struct warc_block *block);
+void warc_block_free (struct warc_block *block);
+
 bool warc_write_request_record (char *url, char *timestamp_str,
-  char *concurrent_to_uuid, ip_address *ip, FILE *body, off_t payload_offset);
+  char *concurrent_to_uuid, ip_address *ip, struct warc_block *body);
 bool warc_write_response_record (char *url, char *timestamp_str,
-  char *concurrent_to_uuid, ip_address *ip, FILE *body, off_t payload_offset,
+  char *concurrent_to_uuid, ip_address *ip, struct warc_block *body,
   char *mime_type, int response_code, char *redirect_location);
 bool warc_write_resource_record (char *resource_uuid, const char *url,
   const char *timestamp_str, const char *concurrent_to_uuid, ip_address *ip,
-  const char *content_type, FILE *body, off_t payload_offset);
+  const char *content_type, struct warc_block *body);
 
 #endif /* WARC_H */
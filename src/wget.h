@@ -56,6 +56,11 @@ as that of the covered work.  */
 # define HAVE_SSL
 #endif
 
+/* HTTP/2 is only spoken over TLS, chosen during the handshake.  */
+#if defined HAVE_LIBNGHTTP2 && defined HAVE_SSL
+# define ENABLE_HTTP2
+#endif
+
 /* `gettext (FOO)' is long to write, so we use `_(FOO)'.  If NLS is
    unavailable, _(STRING) simply returns STRING.  */
 #include "gettext.h"
@@ -326,7 +331,10 @@ enum
   SEND_NOCACHE         = 0x0008,	/* send Pragma: no-cache directive */
   ACCEPTRANGES         = 0x0010,	/* Accept-ranges header was found */
   ADDED_HTML_EXTENSION = 0x0020,        /* added ".html" extension due to -E */
-  TEXTCSS              = 0x0040	        /* document is of type text/css */
+  TEXTCSS              = 0x0040,	        /* document is of type text/css */
+  IF_MODIFIED_SINCE    = 0x0080,	        /* send If-Modified-Since for -N */
+  RANGE_PROBE          = 0x0100	        /* GET only the first byte, for
+                                           --spider when HEAD fails */
 };
 
 /* Universal error type -- used almost everywhere.  Error reporting of
@@ -355,7 +363,9 @@ typedef enum
   AUTHFAILED, QUOTEXC, WRITEFAILED, SSLINITFAILED, VERIFCERTERR,
   UNLINKERR, NEWLOCATION_KEEP_POST, CLOSEFAILED,
 
-  WARC_ERR, WARC_TMP_FOPENERR, WARC_TMP_FWRITEERR
+  WARC_ERR, WARC_TMP_FOPENERR, WARC_TMP_FWRITEERR,
+
+  RETRYLATER
 } uerr_t;
 
 /* 2005-02-19 SMS.
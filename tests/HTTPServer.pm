@@ -18,6 +18,10 @@ sub run {
     my ($self, $urls, $synch_callback) = @_;
     my $initialized = 0;
 
+    # Clients may close the connection before reading the whole
+    # response; that must not kill the server.
+    local $SIG{PIPE} = 'IGNORE';
+
     while (1) {
         if (!$initialized) {
             $synch_callback->();
@@ -65,7 +69,11 @@ sub send_response {
     # create response
     my ($code, $msg, $headers);
     my $send_content = ($req->method eq "GET");
-    if (exists $url_rec->{'auth_method'}) {
+    if ($req->method eq "HEAD" && exists $url_rec->{'head_code'}) {
+        # the server rejects HEAD requests for this URL
+        ($code, $msg) = ($url_rec->{'head_code'}, $url_rec->{'head_msg'});
+        $headers = {};
+    } elsif (exists $url_rec->{'auth_method'}) {
         ($send_content, $code, $msg, $headers) =
             $self->handle_auth($req, $url_rec);
     } elsif (!$self->verify_request_headers ($req, $url_rec)) {
@@ -100,7 +108,7 @@ sub send_response {
             my $content_len = length($content);
             my $start = $1 ? $1 : 0;
             my $end = $2 ? $2 : ($content_len - 1);
-            my $len = $2 ? ($2 - $start) : ($content_len - $start);
+            my $len = $end - $start + 1;
             if ($len > 0) {
                 $resp->header("Accept-Ranges" => "bytes");
                 $resp->header("Content-Length" => $len);
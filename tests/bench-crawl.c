@@ -0,0 +1,455 @@
+/* Benchmark of recursive retrieval against a synthetic site.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* Crawl a generated site with "wget -r -k" and report the pages
+   retrieved per second, the peak memory use of Wget, and how its time
+   was split between transfers, parsing documents, queueing links and
+   converting them, as recorded by --stats-file.  The site is a tree of
+   HTML pages spread over several hosts: every page links to its
+   children, its parent and the root, so that Wget also has to discard
+   links it has already seen.  Run as
+
+       bench-crawl [-w WGET] [-f FANOUT] [-d DEPTH] [-n HOSTS]
+                   [-s SIZE] [-l LATENCY] [-- WGET-OPTIONS...]
+
+   WGET is the binary to test (../src/wget by default).  The tree has
+   FANOUT children per page (10) and DEPTH levels below the root (3),
+   and is spread over HOSTS hosts (4), which are the addresses
+   127.0.0.1, 127.0.0.2 and so on.  Pages are padded to SIZE bytes
+   (8192), and the server waits LATENCY milliseconds (0) before
+   answering each request.  WGET-OPTIONS, such as --parallel, are
+   passed on to Wget.  Using several loopback addresses works on
+   Linux; elsewhere, use a single host.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "ptimer.h"
+#include "utils.h"
+
+const char *program_argstring = "bench-crawl";
+
+#define MAX_HOSTS 64
+#define MAX_PAGES 1000000
+
+/* The shape of the site.  */
+static long fanout = 10, pages;
+static int depth = 3, nhosts = 4, latency;
+static long page_size = 8192;
+
+/* The port each host listens on.  */
+static int ports[MAX_HOSTS];
+
+static bool
+write_all (int fd, const char *buf, long len)
+{
+  while (len > 0)
+    {
+      ssize_t n = write (fd, buf, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      buf += n;
+      len -= n;
+    }
+  return true;
+}
+
+/* Append to the page being built in BUF a link to page ID, which
+   lives on host ID % NHOSTS.  */
+
+static int
+add_link (char *buf, int len, long id)
+{
+  int h = id % nhosts;
+  return len + sprintf (buf + len,
+                        "<li><a href=\"http://127.0.0.%d:%d/p/%ld.html\">"
+                        "page %ld</a></li>\n", h + 1, ports[h], id, id);
+}
+
+/* Make page ID in BUF, which is big enough for SIZE bytes and the
+   links, and return its length.  */
+
+static int
+make_page (char *buf, long id)
+{
+  int len;
+  long i;
+
+  len = sprintf (buf, "<!DOCTYPE html>\n<html><head><title>Page %ld"
+                 "</title></head>\n<body>\n<ul>\n", id);
+  if (id > 0)
+    {
+      len = add_link (buf, len, 0);
+      len = add_link (buf, len, (id - 1) / fanout);
+    }
+  for (i = id * fanout + 1; i <= id * fanout + fanout && i < pages; i++)
+    len = add_link (buf, len, i);
+  len += sprintf (buf + len, "</ul>\n<p>");
+  while (len < page_size - 16)
+    {
+      static const char filler[] = "The quick brown fox jumps over the "
+        "lazy dog. ";
+      int n = sizeof filler - 1;
+      if (n > page_size - 16 - len)
+        n = page_size - 16 - len;
+      memcpy (buf + len, filler, n);
+      len += n;
+    }
+  len += sprintf (buf + len, "</p></body>\n");
+  return len;
+}
+
+/* Serve the requests that arrive on the connection FD.  */
+
+static void
+serve_connection (int fd)
+{
+  static char req[8192];
+  char *page = xmalloc (page_size + (fanout + 2) * 128 + 256);
+  int have = 0;
+
+  while (1)
+    {
+      char *end, head[256];
+      long id;
+      int len;
+      ssize_t n;
+
+      while (!(end = memmem (req, have, "\r\n\r\n", 4)))
+        {
+          if (have == sizeof req)
+            return;
+          n = read (fd, req + have, sizeof req - have);
+          if (n < 0 && errno == EINTR)
+            continue;
+          if (n <= 0)
+            return;
+          have += n;
+        }
+      end += 4;
+
+      if (latency)
+        usleep (latency * 1000);
+      if (sscanf (req, "GET /p/%ld.html", &id) != 1 || id < 0 || id >= pages)
+        {
+          /* This includes robots.txt.  */
+          static const char notfound[] =
+            "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+          if (!write_all (fd, notfound, sizeof notfound - 1))
+            return;
+        }
+      else
+        {
+          len = make_page (page, id);
+          snprintf (head, sizeof head, "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: text/html\r\n"
+                    "Content-Length: %d\r\n\r\n", len);
+          if (!write_all (fd, head, strlen (head))
+              || !write_all (fd, page, len))
+            return;
+        }
+
+      have -= end - req;
+      memmove (req, end, have);
+    }
+}
+
+/* Start the server for all the hosts in a child process, filling
+   PORTS.  */
+
+static pid_t
+start_server (void)
+{
+  int socks[MAX_HOSTS];
+  int one = 1, h, maxfd = 0;
+  pid_t pid;
+
+  for (h = 0; h < nhosts; h++)
+    {
+      struct sockaddr_in sa;
+      socklen_t len = sizeof sa;
+
+      socks[h] = socket (AF_INET, SOCK_STREAM, 0);
+      if (socks[h] < 0)
+        return -1;
+      setsockopt (socks[h], SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+      memset (&sa, 0, sizeof sa);
+      sa.sin_family = AF_INET;
+      sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK + h);
+      if (bind (socks[h], (struct sockaddr *) &sa, sizeof sa) < 0
+          || listen (socks[h], 64) < 0
+          || getsockname (socks[h], (struct sockaddr *) &sa, &len) < 0)
+        return -1;
+      ports[h] = ntohs (sa.sin_port);
+      if (socks[h] > maxfd)
+        maxfd = socks[h];
+    }
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      signal (SIGCHLD, SIG_IGN);
+      signal (SIGPIPE, SIG_IGN);
+      while (1)
+        {
+          fd_set fds;
+          FD_ZERO (&fds);
+          for (h = 0; h < nhosts; h++)
+            FD_SET (socks[h], &fds);
+          if (select (maxfd + 1, &fds, NULL, NULL, NULL) <= 0)
+            continue;
+          for (h = 0; h < nhosts; h++)
+            {
+              int fd;
+              if (!FD_ISSET (socks[h], &fds))
+                continue;
+              fd = accept (socks[h], NULL, NULL);
+              if (fd < 0)
+                continue;
+              setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+              if (fork () == 0)
+                {
+                  serve_connection (fd);
+                  _exit (0);
+                }
+              close (fd);
+            }
+        }
+    }
+  for (h = 0; h < nhosts; h++)
+    close (socks[h]);
+  return pid;
+}
+
+/* Find "KEY": in the summary line S and return its value, or -1.  */
+
+static double
+summary_field (const char *s, const char *key)
+{
+  char *pat = aprintf ("\"%s\":", key);
+  const char *p = strstr (s, pat);
+  double v = -1;
+
+  if (p)
+    v = atof (p + strlen (pat));
+  xfree (pat);
+  return v;
+}
+
+static void
+print_time (const char *what, double t, double wall)
+{
+  if (t < 0)
+    printf ("%-12s %10s\n", what, "n/a");
+  else
+    printf ("%-12s %10.3f s %5.1f%%\n", what, t, wall > 0 ? t * 100 / wall : 0);
+}
+
+/* Crawl the site with WGET, passing it the NEXTRA options in EXTRA,
+   and report the figures.  DIR is the scratch directory.  */
+
+static bool
+run_wget (const char *wget, char **extra, int nextra, const char *dir)
+{
+  char *stats = aprintf ("%s/stats", dir);
+  char *out = aprintf ("%s/out", dir);
+  char *start = aprintf ("http://127.0.0.1:%d/p/0.html", ports[0]);
+  char *statsopt = aprintf ("--stats-file=%s", stats);
+  char levels[16], line[1024], summary[1024] = "";
+  const char **args = xnew_array (const char *, nextra + 16);
+  struct ptimer *timer = ptimer_new ();
+  struct rusage ru;
+  double secs, files;
+  int i, n = 0, status;
+  FILE *fp;
+  pid_t pid;
+
+  snprintf (levels, sizeof levels, "%d", depth);
+  args[n++] = wget;
+  args[n++] = "-q";
+  args[n++] = "-r";
+  args[n++] = "-l";
+  args[n++] = levels;
+  args[n++] = "-H";
+  args[n++] = "-k";
+  args[n++] = "--no-proxy";
+  args[n++] = "-P";
+  args[n++] = out;
+  args[n++] = statsopt;
+  for (i = 0; i < nextra; i++)
+    args[n++] = extra[i];
+  args[n++] = start;
+  args[n] = NULL;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      execv (wget, (char **) args);
+      _exit (127);
+    }
+  if (pid > 0)
+    wait4 (pid, &status, 0, &ru);
+  secs = ptimer_measure (timer);
+  ptimer_destroy (timer);
+  xfree (args);
+  xfree (statsopt);
+  xfree (start);
+
+  if (pid < 0 || !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    {
+      printf ("wget failed (status %d)\n",
+              pid > 0 && WIFEXITED (status) ? WEXITSTATUS (status) : -1);
+      xfree (stats);
+      xfree (out);
+      return false;
+    }
+
+  fp = fopen (stats, "r");
+  while (fp && fgets (line, sizeof line, fp))
+    if (strstr (line, "\"type\":\"summary\""))
+      strcpy (summary, line);
+  if (fp)
+    fclose (fp);
+  unlink (stats);
+  xfree (stats);
+  xfree (out);
+
+  files = summary_field (summary, "files");
+  printf ("%-12s %10.0f of %ld\n", "pages", files, pages);
+  printf ("%-12s %10.3f s\n", "wall", secs);
+  printf ("%-12s %10.1f\n", "pages/sec", files > 0 ? files / secs : 0);
+  /* ru_maxrss is in kilobytes on Linux and in bytes elsewhere.  */
+  printf ("%-12s %10ld\n", "peak RSS", (long) ru.ru_maxrss);
+  print_time ("transfers", summary_field (summary, "transfer_time"), secs);
+  print_time ("parse", summary_field (summary, "parse_time"), secs);
+  print_time ("queue", summary_field (summary, "queue_time"), secs);
+  print_time ("convert", summary_field (summary, "convert_time"), secs);
+  fflush (stdout);
+  return true;
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *wget = "../src/wget";
+  char dir[] = "/tmp/bench-crawlXXXXXX";
+  char *cmd;
+  long level = 1;
+  int i, opt, ret;
+  bool bad = false;
+  pid_t server;
+
+  while ((opt = getopt (argc, argv, "w:f:d:n:s:l:")) != -1)
+    switch (opt)
+      {
+      case 'w':
+        wget = optarg;
+        break;
+      case 'f':
+        fanout = atol (optarg);
+        break;
+      case 'd':
+        depth = atoi (optarg);
+        break;
+      case 'n':
+        nhosts = atoi (optarg);
+        break;
+      case 's':
+        page_size = atol (optarg);
+        break;
+      case 'l':
+        latency = atoi (optarg);
+        break;
+      default:
+        bad = true;
+        break;
+      }
+
+  /* Count the pages, 1 + FANOUT + FANOUT^2 + ... + FANOUT^DEPTH.  */
+  pages = 1;
+  for (i = 0; !bad && fanout > 0 && i < depth && pages <= MAX_PAGES; i++)
+    {
+      level *= fanout;
+      pages += level;
+    }
+  if (bad || fanout < 1 || depth < 0 || nhosts < 1 || nhosts > MAX_HOSTS
+      || page_size < 0 || latency < 0 || pages > MAX_PAGES
+      || access (wget, X_OK) != 0)
+    {
+      fprintf (stderr, "usage: %s [-w WGET] [-f FANOUT] [-d DEPTH] "
+               "[-n HOSTS] [-s SIZE] [-l LATENCY] [-- WGET-OPTIONS...]\n",
+               argv[0]);
+      return 1;
+    }
+  if (!mkdtemp (dir))
+    {
+      perror (dir);
+      return 1;
+    }
+  setenv ("WGETRC", "/dev/null", 1);
+  setenv ("SYSTEM_WGETRC", "/dev/null", 1);
+  signal (SIGPIPE, SIG_IGN);
+
+  server = start_server ();
+  if (server < 0)
+    {
+      perror ("server");
+      rmdir (dir);
+      return 1;
+    }
+  printf ("%ld pages, fanout %ld, depth %d, %d hosts, %ld bytes, "
+          "%d ms latency\n", pages, fanout, depth, nhosts, page_size, latency);
+  ret = run_wget (wget, argv + optind, argc - optind, dir) ? 0 : 1;
+  kill (server, SIGTERM);
+  waitpid (server, NULL, 0);
+
+  cmd = aprintf ("rm -rf '%s'", dir);
+  if (system (cmd) != 0)
+    ret = 1;
+  xfree (cmd);
+  return ret;
+}
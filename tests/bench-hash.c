@@ -0,0 +1,168 @@
+/* Micro-benchmark of the hash tables.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* Time the operations of the hash tables of hash.c on keys like those
+   Wget stores in them: URLs, file names and host names.  Run as
+
+       bench-hash [COUNT]
+
+   to use COUNT keys (200000 by default).  The times are reported in
+   nanoseconds per operation.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "ptimer.h"
+#include "utils.h"
+
+const char *program_argstring = "bench-hash";
+
+static struct ptimer *timer;
+static double started;
+
+static void
+start (void)
+{
+  started = ptimer_measure (timer);
+}
+
+static void
+report (const char *what, int ops)
+{
+  double secs = ptimer_measure (timer) - started;
+  printf ("%-28s %8.1f ns/op\n", what, secs * 1e9 / ops);
+}
+
+/* Make COUNT distinct keys shaped like the URLs of a crawl.  */
+
+static char **
+make_keys (int count, const char *fmt)
+{
+  char **keys = xnew_array (char *, count);
+  int i;
+  for (i = 0; i < count; i++)
+    keys[i] = aprintf (fmt, i % 97, i / 97 % 1000, i);
+  return keys;
+}
+
+static void
+bench_strings (const char *name, struct hash_table *ht, char **keys,
+               char **absent, int count)
+{
+  char what[64];
+  int i, found = 0, rounds;
+
+  start ();
+  for (i = 0; i < count; i++)
+    hash_table_put (ht, keys[i], keys[i]);
+  snprintf (what, sizeof what, "%s insert", name);
+  report (what, count);
+
+  rounds = 4;
+  start ();
+  while (rounds--)
+    for (i = 0; i < count; i++)
+      found += hash_table_contains (ht, keys[i]);
+  snprintf (what, sizeof what, "%s hit", name);
+  report (what, count * 4);
+
+  start ();
+  for (i = 0; i < count; i++)
+    found -= hash_table_contains (ht, absent[i]);
+  snprintf (what, sizeof what, "%s miss", name);
+  report (what, count);
+
+  start ();
+  for (i = 0; i < count; i += 2)
+    hash_table_remove (ht, keys[i]);
+  snprintf (what, sizeof what, "%s remove", name);
+  report (what, (count + 1) / 2);
+
+  if (found != count * 4)
+    abort ();
+}
+
+int
+main (int argc, char **argv)
+{
+  int count = argc > 1 ? atoi (argv[1]) : 200000;
+  char **keys, **absent;
+  struct hash_table *ht;
+  int i;
+
+  if (count <= 0)
+    {
+      fprintf (stderr, "usage: %s [COUNT]\n", argv[0]);
+      return 1;
+    }
+  timer = ptimer_new ();
+  keys = make_keys (count, "http://www.host%d.example.com/dir%d/page-%d.html");
+  absent = make_keys (count, "http://www.host%d.example.com/dir%d/page-%d.htm");
+
+  printf ("%d keys\n", count);
+
+  ht = make_string_hash_table (0);
+  bench_strings ("string", ht, keys, absent, count);
+  hash_table_destroy (ht);
+
+  ht = make_nocase_string_hash_table (0);
+  bench_strings ("nocase string", ht, keys, absent, count);
+  hash_table_destroy (ht);
+
+  ht = make_string_hash_table (count);
+  bench_strings ("string, presized", ht, keys, absent, count);
+  hash_table_destroy (ht);
+
+  ht = hash_table_new (0, NULL, NULL);
+  start ();
+  for (i = 0; i < count; i++)
+    hash_table_put (ht, keys[i], NULL);
+  report ("pointer insert", count);
+  start ();
+  for (i = 0; i < count; i++)
+    if (!hash_table_contains (ht, keys[i]))
+      abort ();
+  report ("pointer hit", count);
+  hash_table_destroy (ht);
+
+  for (i = 0; i < count; i++)
+    {
+      xfree (keys[i]);
+      xfree (absent[i]);
+    }
+  xfree (keys);
+  xfree (absent);
+  ptimer_destroy (timer);
+  return 0;
+}
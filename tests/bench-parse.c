@@ -0,0 +1,483 @@
+/* Micro-benchmark of the parsers.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* Time the parsers Wget runs on every document of a crawl: the HTML
+   tag scanner and link extraction, the CSS link scanner, robots.txt
+   parsing and matching, FTP listing parsing, and URL parsing and
+   merging.  The corpora are generated, so that the runs are
+   repeatable without shipping large files.  Run as
+
+       bench-parse [SCALE]
+
+   to multiply the size of every corpus by SCALE (1 by default).
+   Each line reports the throughput, the time per item (tag, link,
+   path, listing entry or URL) and, with the GNU C library, the
+   number of allocations per item.  The hash tables have their own
+   benchmark, bench-hash.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "ptimer.h"
+#include "url.h"
+#include "convert.h"
+#include "html-parse.h"
+#include "html-url.h"
+#include "css-url.h"
+#include "res.h"
+#include "ftp.h"
+#include "arena.h"
+
+const char *program_argstring = "bench-parse";
+
+#ifdef __GLIBC__
+/* Count the allocations by interposing on malloc, calloc and
+   realloc, which the GNU C library allows.  free needs no wrapper,
+   as the memory still comes from the library's allocator.  */
+
+extern void *__libc_malloc (size_t);
+extern void *__libc_calloc (size_t, size_t);
+extern void *__libc_realloc (void *, size_t);
+
+static long allocations;
+
+void *
+malloc (size_t size)
+{
+  ++allocations;
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t count, size_t size)
+{
+  ++allocations;
+  return __libc_calloc (count, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  ++allocations;
+  return __libc_realloc (ptr, size);
+}
+
+# define COUNT_ALLOCATIONS 1
+#else
+static long allocations;
+#endif
+
+static struct ptimer *timer;
+static double started;
+static long allocations_started;
+
+static void
+start (void)
+{
+  allocations_started = allocations;
+  started = ptimer_measure (timer);
+}
+
+/* Report the run started by start, which went through BYTES bytes
+   of input, or none, and handled ITEMS items.  */
+
+static void
+report (const char *what, double bytes, long items)
+{
+  double secs = ptimer_measure (timer) - started;
+  long allocs = allocations - allocations_started;
+
+  printf ("%-24s", what);
+  if (bytes)
+    printf (" %8.1f MB/s", bytes / secs / 1048576);
+  else
+    printf (" %13s", "");
+  printf (" %9.1f ns/item", secs * 1e9 / (items ? items : 1));
+#ifdef COUNT_ALLOCATIONS
+  printf (" %7.2f allocs/item", (double) allocs / (items ? items : 1));
+#endif
+  printf ("\n");
+}
+
+/* A growing buffer for the corpora.  */
+struct corpus {
+  char *text;
+  int len, size;
+};
+
+static void
+corpus_printf (struct corpus *c, const char *fmt, ...)
+{
+  va_list args;
+  int n;
+
+  while (1)
+    {
+      va_start (args, fmt);
+      n = vsnprintf (c->text + c->len, c->size - c->len, fmt, args);
+      va_end (args);
+      if (n >= 0 && c->len + n < c->size)
+        break;
+      c->size = c->size ? c->size * 2 : 65536;
+      c->text = xrealloc (c->text, c->size);
+    }
+  c->len += n;
+}
+
+/* Write C to a temporary file, whose name is returned.  */
+
+static char *
+corpus_file (const struct corpus *c)
+{
+  char *name = xstrdup ("/tmp/bench-parseXXXXXX");
+  int fd = mkstemp (name);
+  if (fd < 0 || write (fd, c->text, c->len) != c->len)
+    {
+      perror (name);
+      exit (1);
+    }
+  close (fd);
+  return name;
+}
+
+static void
+make_html (struct corpus *c, int size)
+{
+  int i;
+
+  corpus_printf (c, "<!DOCTYPE html>\n<html><head><title>Index</title>\n"
+                 "<base href=\"http://www.example.com/catalog/\">\n"
+                 "<meta name=\"robots\" content=\"index,follow\">\n"
+                 "<link rel=\"stylesheet\" href=\"/css/site.css\">\n"
+                 "</head><body>\n");
+  for (i = 0; c->len < size; i++)
+    corpus_printf (c,
+      "<div class=\"item\" id=\"item%d\">\n"
+      "  <a href=\"/section%d/page-%d.html\" title=\"Item %d\">Item %d</a>\n"
+      "  <img src=\"images/thumb%d.png\" alt=\"thumbnail %d\" width=\"120\""
+      " height=\"90\">\n"
+      "  <p>Lorem ipsum dolor sit amet, <b>consectetur</b> adipiscing"
+      " elit, sed do eiusmod tempor &amp; incididunt %d.</p>\n"
+      "  <!-- generated entry %d -->\n"
+      "  <script type=\"text/javascript\">var x%d = '<a href=\"x\">';"
+      "</script>\n"
+      "  <table><tr><td style=\"background: url(bg%d.gif)\">%d</td>"
+      "<td><a href=\"http://cdn%d.example.net/assets/%d.js\">js</a></td>"
+      "</tr></table>\n"
+      "</div>\n",
+      i, i % 17, i, i, i, i, i, i, i, i, i, i, i % 5, i);
+  corpus_printf (c, "</body></html>\n");
+}
+
+static void
+make_css (struct corpus *c, int size)
+{
+  int i;
+
+  for (i = 0; i < 8; i++)
+    corpus_printf (c, "@import url(\"part%d.css\") screen;\n", i);
+  for (i = 0; c->len < size; i++)
+    corpus_printf (c,
+      "/* rule %d */\n"
+      ".rule%d, .rule%d:hover > a {\n"
+      "  background: #%06x url(\"../img/bg%d.png\") no-repeat 0 0;\n"
+      "  font: 12px/1.5 \"Helvetica Neue\", Arial, sans-serif;\n"
+      "  margin: 0 auto; padding: 4px 8px;\n"
+      "}\n"
+      "@media screen and (max-width: 600px) {\n"
+      "  .m%d { background-image: url(/img/m%d.gif); }\n"
+      "}\n",
+      i, i, i, (i * 2654435761u) & 0xffffff, i, i, i);
+}
+
+static void
+make_robots (struct corpus *c, int rules)
+{
+  int i;
+
+  corpus_printf (c, "# robots.txt\nUser-agent: otherbot\nDisallow: /\n\n"
+                 "User-agent: *\nCrawl-delay: 1\n");
+  for (i = 0; i < rules; i++)
+    switch (i % 4)
+      {
+      case 0:
+        corpus_printf (c, "Disallow: /private%d/\n", i);
+        break;
+      case 1:
+        corpus_printf (c, "Allow: /private%d/public/\n", i - 1);
+        break;
+      case 2:
+        corpus_printf (c, "Disallow: /*/tmp%d/*.php$\n", i);
+        break;
+      default:
+        corpus_printf (c, "Disallow: /search?q=%d\n", i);
+        break;
+      }
+  corpus_printf (c, "Sitemap: http://www.example.com/sitemap.xml\n");
+}
+
+static void
+make_listing (struct corpus *c, int entries)
+{
+  static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+  int i;
+
+  corpus_printf (c, "total %d\n", entries * 8);
+  for (i = 0; i < entries; i++)
+    if (i % 10 == 0)
+      corpus_printf (c, "drwxr-xr-x   2 ftp      ftp          4096 %s %2d  "
+                     "2011 directory-%d\n", months[i % 12], i % 28 + 1, i);
+    else if (i % 10 == 1)
+      corpus_printf (c, "lrwxrwxrwx   1 ftp      ftp            12 %s %2d "
+                     "12:%02d link-%d -> file-%d.tar.gz\n", months[i % 12],
+                     i % 28 + 1, i % 60, i, i - 1);
+    else
+      corpus_printf (c, "-rw-r--r--   1 ftp      ftp      %9d %s %2d  "
+                     "2012 file-%d.tar.gz\n", i * 7919 % 100000000,
+                     months[i % 12], i % 28 + 1, i);
+}
+
+static int tags_seen;
+
+static void
+count_tag (struct taginfo *tag, void *arg)
+{
+  ++tags_seen;
+}
+
+static void
+free_fileinfo (struct fileinfo *f)
+{
+  while (f)
+    {
+      struct fileinfo *next = f->next;
+      xfree (f->name);
+      xfree_null (f->linkto);
+      xfree (f);
+      f = next;
+    }
+}
+
+static void
+bench_html (int scale)
+{
+  struct corpus c;
+  struct urlpos *urls, *u;
+  char *file;
+  bool nofollow;
+  int links = 0;
+
+  xzero (c);
+  make_html (&c, 4 * 1048576 * scale);
+
+  tags_seen = 0;
+  start ();
+  map_html_tags (c.text, c.len, count_tag, NULL, MHT_TRIM_VALUES, NULL, NULL);
+  report ("map_html_tags", c.len, tags_seen);
+
+  file = corpus_file (&c);
+  start ();
+  urls = get_urls_html (file, "http://www.example.com/catalog/index.html",
+                        &nofollow, NULL);
+  for (u = urls; u; u = u->next)
+    ++links;
+  report ("get_urls_html", c.len, links);
+  free_urlpos (urls);
+  unlink (file);
+  xfree (file);
+  xfree (c.text);
+}
+
+static void
+bench_css (int scale)
+{
+  struct corpus c;
+  struct map_context ctx;
+  struct urlpos *u;
+  int links = 0;
+
+  xzero (c);
+  make_css (&c, 2 * 1048576 * scale);
+
+  xzero (ctx);
+  ctx.text = c.text;
+  ctx.arena = arena_new ();
+  ctx.parent_base = "http://www.example.com/css/site.css";
+  start ();
+  get_urls_css (&ctx, 0, c.len);
+  for (u = ctx.head; u; u = u->next)
+    ++links;
+  report ("get_urls_css", c.len, links);
+  if (ctx.head)
+    free_urlpos (ctx.head);
+  else
+    arena_free (ctx.arena);
+  xfree (c.text);
+}
+
+static void
+bench_robots (int scale)
+{
+  struct corpus c;
+  struct robot_specs *specs;
+  char path[128];
+  int i, matched = 0, count = 200000 * scale;
+
+  xzero (c);
+  make_robots (&c, 2000);
+  /* Registering the specs frees the ones registered before, and
+     res_cleanup the last ones.  */
+  start ();
+  for (i = 0; i < 100; i++)
+    {
+      specs = res_parse (c.text, c.len);
+      res_register_specs ("bench.example.com", 80, specs);
+    }
+  report ("res_parse", 100.0 * c.len, 100);
+
+  start ();
+  for (i = 0; i < count; i++)
+    {
+      switch (i % 4)
+        {
+        case 0:
+          snprintf (path, sizeof path, "/private%d/index.html", i % 2000);
+          break;
+        case 1:
+          snprintf (path, sizeof path, "/private%d/public/a.html",
+                    i % 2000 & ~3);
+          break;
+        case 2:
+          snprintf (path, sizeof path, "/shop/tmp%d/cart.php", i % 2000);
+          break;
+        default:
+          snprintf (path, sizeof path, "/catalog/item-%d.html", i);
+          break;
+        }
+      matched += res_match_path (specs, path);
+    }
+  report ("res_match_path", 0, count);
+  if (matched == count)
+    abort ();
+  res_cleanup ();
+  xfree (c.text);
+}
+
+static void
+bench_listing (int scale)
+{
+  struct corpus c;
+  struct fileinfo *f, *list;
+  char *file;
+  int entries = 0;
+
+  xzero (c);
+  make_listing (&c, 100000 * scale);
+  file = corpus_file (&c);
+  start ();
+  list = ftp_parse_ls (file, ST_UNIX);
+  for (f = list; f; f = f->next)
+    ++entries;
+  report ("ftp_parse_ls", c.len, entries);
+  free_fileinfo (list);
+  unlink (file);
+  xfree (file);
+  xfree (c.text);
+}
+
+static void
+bench_urls (int scale)
+{
+  static const char *links[] = {
+    "page-2.html", "../up/index.html", "/root/file.css?v=3",
+    "//cdn.example.net/lib.js", "#top", "sub/dir/./x/../y.png",
+    "http://other.example.org/a/b/c", "?query=only"
+  };
+  int count = 200000 * scale, i;
+  char **urls = xnew_array (char *, count);
+  double bytes = 0;
+
+  for (i = 0; i < count; i++)
+    {
+      urls[i] = aprintf ("http://www%d.example.com:%d/dir%d/sub%d/page-%d.html"
+                         "?id=%d&lang=en#section%d", i % 97,
+                         i % 3 ? 80 : 8080, i % 1000, i % 7, i, i, i % 5);
+      bytes += strlen (urls[i]);
+    }
+
+  start ();
+  for (i = 0; i < count; i++)
+    {
+      int error;
+      struct url *u = url_parse (urls[i], &error, NULL, true);
+      if (!u)
+        abort ();
+      url_free (u);
+    }
+  report ("url_parse", bytes, count);
+
+  start ();
+  for (i = 0; i < count; i++)
+    xfree (uri_merge (urls[i], links[i % countof (links)]));
+  report ("uri_merge", 0, count);
+
+  for (i = 0; i < count; i++)
+    xfree (urls[i]);
+  xfree (urls);
+}
+
+int
+main (int argc, char **argv)
+{
+  int scale = argc > 1 ? atoi (argv[1]) : 1;
+
+  if (scale <= 0)
+    {
+      fprintf (stderr, "usage: %s [SCALE]\n", argv[0]);
+      return 1;
+    }
+  timer = ptimer_new ();
+
+  bench_html (scale);
+  bench_css (scale);
+  bench_robots (scale);
+  bench_listing (scale);
+  bench_urls (scale);
+
+  ptimer_destroy (timer);
+  return 0;
+}
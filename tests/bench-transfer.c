@@ -0,0 +1,580 @@
+/* Benchmark of the transfer path against a local server.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* Run Wget against a local HTTP server and report, for bodies of
+   several sizes served with Content-Length, chunked, with
+   "Connection: close" and over TLS, the throughput, the CPU time
+   Wget spends per kilobyte and the read and write calls it makes
+   per megabyte.  Everything Wget does to a body happens in
+   fd_read_body, read_response_body and write_data, so these numbers
+   show regressions in that path.  Run as
+
+       bench-transfer [-w WGET] [-m MEGABYTES] [-c CERTDIR]
+
+   WGET is the binary to test (../src/wget by default) and MEGABYTES
+   the amount retrieved in each case (256 by default).  The TLS cases
+   need the openssl program, which serves the files with the key and
+   certificate found in CERTDIR (certs by default).  The counts of
+   calls are read from /proc and are only available on Linux.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "ptimer.h"
+#include "utils.h"
+
+const char *program_argstring = "bench-transfer";
+
+/* Sizes of the bodies retrieved, and the most files retrieved in a
+   single case, so that small bodies don't take forever.  */
+static const long sizes[] = { 4096, 65536, 1048576, 16777216 };
+#define MAX_FILES 2000
+
+/* Every TLS file costs a handshake with a server that handles one
+   connection at a time, so fewer of them are retrieved.  */
+#define MAX_TLS_FILES 100
+
+/* The server writes bodies in blocks of this size, which is also
+   the chunk size of chunked bodies.  */
+#define BLOCK_SIZE 32768
+
+static char block[BLOCK_SIZE];
+
+static bool
+write_all (int fd, const char *buf, long len)
+{
+  while (len > 0)
+    {
+      ssize_t n = write (fd, buf, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      buf += n;
+      len -= n;
+    }
+  return true;
+}
+
+/* Send a body of SIZE bytes to FD, in chunks if CHUNKED.  */
+
+static bool
+send_body (int fd, long size, bool chunked)
+{
+  while (size > 0)
+    {
+      long n = size < BLOCK_SIZE ? size : BLOCK_SIZE;
+      if (chunked)
+        {
+          char head[32];
+          snprintf (head, sizeof head, "%lx\r\n", n);
+          if (!write_all (fd, head, strlen (head)))
+            return false;
+        }
+      if (!write_all (fd, block, n))
+        return false;
+      if (chunked && !write_all (fd, "\r\n", 2))
+        return false;
+      size -= n;
+    }
+  return !chunked || write_all (fd, "0\r\n\r\n", 5);
+}
+
+/* Serve the requests that arrive on the connection FD.  The path of
+   a request is /SIZE/MODE/N, where MODE is "l" for a body with
+   Content-Length, "c" for a chunked body and "x" for a body followed
+   by closing the connection.  N only makes the URLs differ.  */
+
+static void
+serve_connection (int fd)
+{
+  static char req[8192];
+  int have = 0;
+
+  while (1)
+    {
+      char *end, mode;
+      long size;
+      char head[256];
+      ssize_t n;
+
+      while (!(end = memmem (req, have, "\r\n\r\n", 4)))
+        {
+          if (have == sizeof req)
+            return;
+          n = read (fd, req + have, sizeof req - have);
+          if (n < 0 && errno == EINTR)
+            continue;
+          if (n <= 0)
+            return;
+          have += n;
+        }
+      end += 4;
+
+      if (sscanf (req, "GET /%ld/%c/", &size, &mode) != 2 || size < 0)
+        {
+          static const char notfound[] =
+            "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+          write_all (fd, notfound, sizeof notfound - 1);
+          return;
+        }
+      if (mode == 'c')
+        snprintf (head, sizeof head, "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: application/octet-stream\r\n"
+                  "Transfer-Encoding: chunked\r\n\r\n");
+      else
+        snprintf (head, sizeof head, "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: application/octet-stream\r\n"
+                  "Content-Length: %ld\r\n%s\r\n", size,
+                  mode == 'x' ? "Connection: close\r\n" : "");
+      if (!write_all (fd, head, strlen (head))
+          || !send_body (fd, size, mode == 'c')
+          || mode == 'x')
+        return;
+
+      have -= end - req;
+      memmove (req, end, have);
+    }
+}
+
+/* Start the HTTP server in a child process.  Its port is stored to
+   PORT.  */
+
+static pid_t
+start_http_server (int *port)
+{
+  struct sockaddr_in sa;
+  socklen_t len = sizeof sa;
+  int one = 1, sock;
+  pid_t pid;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (sock < 0)
+    return -1;
+  setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+  memset (&sa, 0, sizeof sa);
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (sock, (struct sockaddr *) &sa, sizeof sa) < 0
+      || listen (sock, 64) < 0
+      || getsockname (sock, (struct sockaddr *) &sa, &len) < 0)
+    {
+      close (sock);
+      return -1;
+    }
+  *port = ntohs (sa.sin_port);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      signal (SIGCHLD, SIG_IGN);
+      signal (SIGPIPE, SIG_IGN);
+      while (1)
+        {
+          int fd = accept (sock, NULL, NULL);
+          if (fd < 0)
+            continue;
+          /* Don't let delayed ACKs stall small responses.  */
+          setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+          /* A process per connection, so that --parallel and
+             --segments can be measured as well.  */
+          if (fork () == 0)
+            {
+              close (sock);
+              serve_connection (fd);
+              _exit (0);
+            }
+          close (fd);
+        }
+    }
+  close (sock);
+  return pid;
+}
+
+/* Return a port on the loopback interface that was free a moment
+   ago, or 0.  */
+
+static int
+free_port (void)
+{
+  struct sockaddr_in sa;
+  socklen_t len = sizeof sa;
+  int port = 0, sock = socket (AF_INET, SOCK_STREAM, 0);
+
+  memset (&sa, 0, sizeof sa);
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (sock >= 0
+      && bind (sock, (struct sockaddr *) &sa, sizeof sa) == 0
+      && getsockname (sock, (struct sockaddr *) &sa, &len) == 0)
+    port = ntohs (sa.sin_port);
+  if (sock >= 0)
+    close (sock);
+  return port;
+}
+
+/* Wait up to five seconds for a server to accept connections on
+   PORT.  */
+
+static bool
+wait_for_port (int port)
+{
+  int i;
+  for (i = 0; i < 50; i++)
+    {
+      struct sockaddr_in sa;
+      int sock = socket (AF_INET, SOCK_STREAM, 0);
+      memset (&sa, 0, sizeof sa);
+      sa.sin_family = AF_INET;
+      sa.sin_port = htons (port);
+      sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+      if (connect (sock, (struct sockaddr *) &sa, sizeof sa) == 0)
+        {
+          close (sock);
+          return true;
+        }
+      close (sock);
+      usleep (100000);
+    }
+  return false;
+}
+
+/* Start "openssl s_server" serving the files of DIR over TLS, with
+   the key and certificate of the test suite in CERTDIR.  Its port is
+   stored to PORT.  The server answers with HTTP/1.0 and closes the
+   connection after each body.  */
+
+static pid_t
+start_tls_server (const char *dir, const char *certdir, int *port)
+{
+  char *cert, *key, portstr[16];
+  pid_t pid;
+
+  *port = free_port ();
+  if (!*port)
+    return -1;
+  snprintf (portstr, sizeof portstr, "%d", *port);
+  cert = aprintf ("%s/server-cert.pem", certdir);
+  key = aprintf ("%s/server-key.pem", certdir);
+  if (access (cert, R_OK) != 0 || access (key, R_OK) != 0)
+    {
+      xfree (cert);
+      xfree (key);
+      return -1;
+    }
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      int null = open ("/dev/null", O_RDWR);
+      if (chdir (dir) != 0)
+        _exit (127);
+      dup2 (null, 0);
+      dup2 (null, 1);
+      dup2 (null, 2);
+      execlp ("openssl", "openssl", "s_server", "-quiet", "-WWW",
+              "-accept", portstr, "-cert", cert, "-key", key,
+              "-pass", "pass:Hello", (char *) 0);
+      _exit (127);
+    }
+  xfree (cert);
+  xfree (key);
+  if (pid > 0 && !wait_for_port (*port))
+    {
+      kill (pid, SIGTERM);
+      waitpid (pid, NULL, 0);
+      return -1;
+    }
+  return pid;
+}
+
+static void
+stop_server (pid_t pid)
+{
+  if (pid > 0)
+    {
+      kill (pid, SIGTERM);
+      waitpid (pid, NULL, 0);
+    }
+}
+
+/* Number of read and write calls made by the exited, but not yet
+   reaped, process PID, or -1 if unknown.  */
+
+static long
+rw_calls (pid_t pid)
+{
+  char name[64], line[128];
+  long calls = 0, n;
+  int found = 0;
+  FILE *fp;
+
+  snprintf (name, sizeof name, "/proc/%ld/io", (long) pid);
+  fp = fopen (name, "r");
+  if (!fp)
+    return -1;
+  while (fgets (line, sizeof line, fp))
+    if (sscanf (line, "syscr: %ld", &n) == 1
+        || sscanf (line, "syscw: %ld", &n) == 1)
+      {
+        calls += n;
+        ++found;
+      }
+  fclose (fp);
+  return found == 2 ? calls : -1;
+}
+
+/* Run WGET on the URLs listed in LIST and report the figures for
+   TOTAL bytes on a line starting with WHAT.  */
+
+static void
+run_wget (const char *wget, const char *list, bool tls, const char *what,
+          double total)
+{
+  struct ptimer *timer = ptimer_new ();
+  struct rusage ru;
+  siginfo_t info;
+  long calls;
+  double secs, cpu;
+  int status;
+  pid_t pid;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      /* The TLS server closes the connection after every body
+         without saying so.  */
+      if (tls)
+        execl (wget, wget, "-q", "-O", "/dev/null", "--no-proxy",
+               "--no-check-certificate", "--no-http-keep-alive",
+               "-i", list, (char *) 0);
+      else
+        execl (wget, wget, "-q", "-O", "/dev/null", "--no-proxy",
+               "-i", list, (char *) 0);
+      _exit (127);
+    }
+  if (pid < 0)
+    {
+      ptimer_destroy (timer);
+      return;
+    }
+
+  /* Read the counts of calls before the process is reaped.  */
+  while (waitid (P_PID, pid, &info, WEXITED | WNOWAIT) < 0 && errno == EINTR)
+    ;
+  secs = ptimer_measure (timer);
+  calls = rw_calls (pid);
+  wait4 (pid, &status, 0, &ru);
+  ptimer_destroy (timer);
+
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    {
+      printf ("%-34s failed (status %d)\n", what,
+              WIFEXITED (status) ? WEXITSTATUS (status) : -1);
+      return;
+    }
+  cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  printf ("%-34s %9.1f %11.1f", what, total / secs / 1048576,
+          cpu * 1e9 / (total / 1024));
+  if (calls >= 0)
+    printf (" %12.1f\n", calls / (total / 1048576));
+  else
+    printf ("          n/a\n");
+  fflush (stdout);
+}
+
+/* Write the list of COUNT URLs to LIST.  */
+
+static bool
+write_list (const char *list, int count, const char *fmt, int port,
+            long size, char mode)
+{
+  FILE *fp = fopen (list, "w");
+  int i;
+  if (!fp)
+    return false;
+  for (i = 0; i < count; i++)
+    fprintf (fp, fmt, port, size, mode, i);
+  return fclose (fp) == 0;
+}
+
+static const char *
+size_name (long size)
+{
+  static char buf[24];
+  if (size >= 1048576)
+    snprintf (buf, sizeof buf, "%ldM", size / 1048576);
+  else
+    snprintf (buf, sizeof buf, "%ldK", size / 1024);
+  return buf;
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *wget = "../src/wget", *certdir = "certs";
+  static const struct {
+    char mode;
+    const char *name;
+  } modes[] = {
+    { 'l', "length" },
+    { 'c', "chunked" },
+    { 'x', "close" }
+  };
+  char dir[] = "/tmp/bench-transferXXXXXX";
+  char *list;
+  double megabytes = 256;
+  size_t i, j;
+  int opt, port;
+  pid_t server;
+
+  while ((opt = getopt (argc, argv, "w:m:c:")) != -1)
+    switch (opt)
+      {
+      case 'w':
+        wget = optarg;
+        break;
+      case 'm':
+        megabytes = atof (optarg);
+        break;
+      case 'c':
+        certdir = optarg;
+        break;
+      default:
+        megabytes = 0;
+        break;
+      }
+  if (megabytes <= 0 || optind != argc || access (wget, X_OK) != 0)
+    {
+      fprintf (stderr, "usage: %s [-w WGET] [-m MEGABYTES] [-c CERTDIR]\n",
+               argv[0]);
+      return 1;
+    }
+  if (!mkdtemp (dir))
+    {
+      perror (dir);
+      return 1;
+    }
+  list = aprintf ("%s/urls", dir);
+  memset (block, 'x', sizeof block);
+  setenv ("WGETRC", "/dev/null", 1);
+  setenv ("SYSTEM_WGETRC", "/dev/null", 1);
+  signal (SIGPIPE, SIG_IGN);
+
+  printf ("%-34s %9s %11s %12s\n", "", "MB/s", "CPU ns/KB", "calls/MB");
+
+  server = start_http_server (&port);
+  if (server < 0)
+    {
+      perror ("server");
+      return 1;
+    }
+  for (i = 0; i < countof (modes); i++)
+    for (j = 0; j < countof (sizes); j++)
+      {
+        char what[64];
+        double want = megabytes * 1048576 / sizes[j];
+        int count = want < 1 ? 1 : want > MAX_FILES ? MAX_FILES : (int) want;
+
+        if (!write_list (list, count, "http://127.0.0.1:%d/%ld/%c/%d\n",
+                         port, sizes[j], modes[i].mode))
+          break;
+        snprintf (what, sizeof what, "%-8s %5d x %s", modes[i].name, count,
+                  size_name (sizes[j]));
+        run_wget (wget, list, false, what, (double) count * sizes[j]);
+      }
+  stop_server (server);
+
+  /* openssl s_server serves files, so make one of each size.  */
+  for (j = 0; j < countof (sizes); j++)
+    {
+      char *name = aprintf ("%s/%ld", dir, sizes[j]);
+      int fd = open (name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      long left = sizes[j];
+      while (fd >= 0 && left > 0)
+        {
+          long n = left < BLOCK_SIZE ? left : BLOCK_SIZE;
+          if (!write_all (fd, block, n))
+            break;
+          left -= n;
+        }
+      if (fd >= 0)
+        close (fd);
+      xfree (name);
+    }
+  server = start_tls_server (dir, certdir, &port);
+  if (server < 0)
+    printf ("%-34s skipped (no openssl or certificates)\n", "tls");
+  else
+    for (j = 0; j < countof (sizes); j++)
+      {
+        char what[64];
+        double want = megabytes * 1048576 / sizes[j];
+        int count = (want < 1 ? 1
+                     : want > MAX_TLS_FILES ? MAX_TLS_FILES : (int) want);
+
+        /* s_server has no use for the query string, so every URL
+           names the same file.  */
+        if (!write_list (list, count, "https://127.0.0.1:%d/%ld\n",
+                         port, sizes[j], 0))
+          break;
+        snprintf (what, sizeof what, "%-8s %5d x %s", "tls", count,
+                  size_name (sizes[j]));
+        run_wget (wget, list, true, what, (double) count * sizes[j]);
+      }
+  stop_server (server);
+
+  for (j = 0; j < countof (sizes); j++)
+    {
+      char *name = aprintf ("%s/%ld", dir, sizes[j]);
+      unlink (name);
+      xfree (name);
+    }
+  unlink (list);
+  rmdir (dir);
+  xfree (list);
+  return 0;
+}